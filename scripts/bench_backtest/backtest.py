@@ -0,0 +1,52 @@
+from opentrade import *
+import datetime
+import os
+
+exch = get_exchange('test')
+nsecurities = int(os.environ.get('SECURITIES', 10))
+period = int(os.environ.get('ValidSeconds', 1800))
+algos = ('TWAP', 'VWAP', 'POV')
+
+
+def on_start(self):
+  log_info('benchmark started')
+
+
+def on_end(self):
+  log_info('benchmark done')
+
+
+def on_start_of_day(self, date):
+  self.acc = get_account('test')
+  now = get_datetime()
+  now -= datetime.datetime.combine(now.date(), datetime.time(0))
+  now = now.seconds + now.microseconds / 1e6
+  # one wave of algos every period from 09:30 to 16:00
+  tm = 9 * 3600 + 30 * 60
+  wave = 0
+  while tm < 16 * 3600:
+    self.set_timeout(lambda wave=wave: start_wave(self, wave), tm - now)
+    tm += period
+    wave += 1
+
+
+def start_wave(self, wave):
+  for i in range(nsecurities):
+    st = SecurityTuple()
+    st.sec = exch.get_security('TEST%d' % (i + 1))
+    st.acc = self.acc
+    st.qty = 10000
+    st.side = OrderSide.buy if (i + wave) % 2 else OrderSide.sell
+    name = algos[(i + wave) % len(algos)]
+    params = {
+        'Security': st,
+        'ValidSeconds': period,
+        'Aggression': 'Medium',
+        'MinSize': 100
+    }
+    if name == 'POV': params['MaxPov'] = 0.1
+    self.start_algo(name, params)
+
+
+def on_end_of_day(self, date):
+  pass
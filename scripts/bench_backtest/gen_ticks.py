@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+'''
+synthetic text tick file of one day for the securities of
+test_latency.sqlite3, a random walk of quotes and trades from 09:30 to 16:00
+'''
+
+import argparse
+import random
+
+
+def main():
+  parser = argparse.ArgumentParser()
+  parser.add_argument('outfile')
+  parser.add_argument('-n',
+                      '--securities',
+                      type=int,
+                      default=10,
+                      help='securities TEST1 - TESTn of exchange test')
+  parser.add_argument('-r',
+                      '--rate',
+                      type=float,
+                      default=20,
+                      help='ticks per second per security')
+  parser.add_argument('-s', '--seed', type=int, default=0)
+  args = parser.parse_args()
+  random.seed(args.seed)
+
+  start = 9 * 3600 + 30 * 60
+  end = 16 * 3600
+  step = 1000. / args.rate
+  with open(args.outfile, 'wt') as fh:
+    fh.write('@begin symbol\n')
+    for i in range(args.securities):
+      fh.write('TEST%d test\n' % (i + 1))
+    fh.write('@end\n')
+    mids = [10. + i for i in range(args.securities)]
+    ms = start * 1000.
+    while ms < end * 1000:
+      t = int(ms)
+      hms = t // 1000
+      hmsm = (hms // 3600 * 10000 + hms % 3600 // 60 * 100 +
+              hms % 60) * 1000 + t % 1000
+      for i in range(args.securities):
+        mid = mids[i] = max(0.1, mids[i] + random.choice((-0.01, 0, 0.01)))
+        bid = round(mid - 0.01, 2)
+        ask = round(mid + 0.01, 2)
+        x = random.random()
+        if x < 0.4:
+          fh.write('%d %d B %.2f %d\n' %
+                   (hmsm, i, bid, random.randint(1, 50) * 100))
+        elif x < 0.8:
+          fh.write('%d %d A %.2f %d\n' %
+                   (hmsm, i, ask, random.randint(1, 50) * 100))
+        else:
+          fh.write('%d %d T %.2f %d\n' % (hmsm, i, random.choice(
+              (bid, ask)), random.randint(1, 10) * 100))
+      ms += step
+
+
+if __name__ == '__main__':
+  main()
@@ -4,19 +4,31 @@ import struct
 import os
 import sys
 import mmap
+import zlib
 
 outfile = None
-dump_binary = None
+dump_format = None
 only_symbols = []
 only_symbol_map = {}
+out_format = None
+block = []
+nsymbols = 0
+kBlockSize = 65536
 
 
 def main():
-  if len(sys.argv) < 2:
+  global out_format
+  args = []
+  for x in sys.argv[1:]:
+    if x in ('-c', '--columnar'): out_format = 'columnar'
+    elif x in ('-i', '--indexed'): out_format = 'indexed'
+    else: args.append(x)
+  if len(args) < 1:
     print(
-        'usage: convert_tick_file.py <input_tick_file> [output_tick_file] [symbol file]'
+        'usage: convert_tick_file.py [-c|--columnar|-i|--indexed] <input_tick_file> [output_tick_file] [symbol file]'
     )
     return
+  sys.argv[1:] = args
   if len(sys.argv) > 3:
     fn = sys.argv[3]
     if fn == '-': fh = sys.stdin
@@ -26,31 +38,44 @@ def main():
   parse(sys.argv[1], callback, pre_callback, post_callback)
 
 
-def pre_callback(symbols, symbol_type, is_text):
-  global outfile, dump_binary
-  dump_binary = is_text  # dump binary if original is text
+def pre_callback(symbols, symbol_type, fmt):
+  global outfile, dump_format, nsymbols
+  # dump binary if original is text, text otherwise
+  if out_format: dump_format = out_format
+  elif fmt == 'text': dump_format = 'binary'
+  else: dump_format = 'text'
   if len(sys.argv) == 2:
     outfile = sys.stdout
   else:
     outfile = open(sys.argv[2], 'w+b')
   outfile.write('@begin ' + symbol_type)
-  if dump_binary: outfile.write(' binary')
+  if dump_format != 'text': outfile.write(' ' + dump_format)
   outfile.write('\n')
   if only_symbols:
     sym2idx = dict([(k, i) for i, k in enumerate(symbols)])
     only_symbol_map.update(
         dict([(sym2idx[k], i) for i, k in enumerate(only_symbols)]))
     symbols = only_symbols
+  nsymbols = len(symbols)
   [outfile.write(x + '\n') for x in symbols]
   outfile.write('@end\n')
 
 
 def callback(symbols, ms, isec, tick_type, px, size, *more):
-  global outfile, dump_binary
+  global outfile, dump_format
   if only_symbol_map:
     isec = only_symbol_map.get(isec)
     if isec is None: return
-  if dump_binary:
+  if dump_format == 'columnar':
+    block.append((ms, isec, tick_type, px, size))
+    if len(block) >= kBlockSize:
+      outfile.write(encode_block(block))
+      del block[:]
+    return
+  if dump_format == 'indexed':
+    block.append((ms, isec, tick_type, px, size))
+    return
+  if dump_format == 'binary':
     raw = struct.pack('I', ms) + struct.pack(
         'H', isec) + tick_type + struct.pack('d', px) + struct.pack('I', size)
   else:
@@ -62,9 +87,110 @@ def callback(symbols, ms, isec, tick_type, px, size, *more):
 
 def post_callback(symbols):
   global outfile
+  if dump_format == 'indexed': write_indexed()
+  elif block: outfile.write(encode_block(block))
   outfile.close()
 
 
+def decimals(px):
+  for d in range(9):
+    v = px * 10**d
+    if abs(v - round(v)) < 1e-6: return d
+  return 8
+
+
+def put_varint(out, v):
+  while v >= 0x80:
+    out.append(v & 0x7f | 0x80)
+    v >>= 7
+  out.append(v)
+
+
+def get_varint(raw, offset):
+  v = 0
+  shift = 0
+  while True:
+    b = raw[offset]
+    offset += 1
+    v |= (b & 0x7f) << shift
+    if b < 0x80: return v, offset
+    shift += 7
+
+
+# see src/opentrade/tick_file.h for the layouts
+def encode_block(block):
+  scale = 10**max(decimals(t[3]) for t in block)
+  raw = bytearray()
+  last = 0
+  for t in block:
+    put_varint(raw, t[0] - last)
+    last = t[0]
+  for t in block:
+    put_varint(raw, t[1])
+  for t in block:
+    raw.append(t[2])
+  last_px = {}
+  for t in block:
+    px = int(round(t[3] * scale))
+    d = px - last_px.get(t[1], 0)
+    last_px[t[1]] = px
+    put_varint(raw, (d << 1) ^ (d >> 63))
+  for t in block:
+    put_varint(raw, int(t[4]))
+  z = zlib.compress(bytes(raw), 9)
+  return struct.pack('=IIId', len(block), len(raw), len(z), float(scale)) + z
+
+
+def write_indexed():
+  by_sec = [[] for i in range(nsymbols)]
+  for t in block:
+    by_sec[t[1]].append(t)
+  regions = [
+      ''.join(
+          encode_block(ticks[i:i + kBlockSize])
+          for i in range(0, len(ticks), kBlockSize)) for ticks in by_sec
+  ]
+  offset = 4 + 16 * nsymbols
+  index = struct.pack('=I', nsymbols)
+  for r in regions:
+    index += struct.pack('=QQ', offset, len(r))
+    offset += len(r)
+  outfile.write(index)
+  [outfile.write(r) for r in regions]
+
+
+def read_blocks(mm, offset, end, symbols, callback):
+  while offset < end:
+    n, raw_size, zsize, scale = struct.unpack('=IIId', mm[offset:offset + 20])
+    offset += 20
+    raw = bytearray(zlib.decompress(mm[offset:offset + zsize]))
+    offset += zsize
+    pos = 0
+    cols = [[], [], None, [], []]
+    ms = 0
+    for i in range(n):
+      v, pos = get_varint(raw, pos)
+      ms += v
+      cols[0].append(ms)
+    for i in range(n):
+      v, pos = get_varint(raw, pos)
+      cols[1].append(v)
+    cols[2] = [chr(x) for x in raw[pos:pos + n]]
+    pos += n
+    last_px = {}
+    for i in range(n):
+      v, pos = get_varint(raw, pos)
+      px = last_px.get(cols[1][i], 0) + ((v >> 1) ^ -(v & 1))
+      last_px[cols[1][i]] = px
+      cols[3].append(px / scale)
+    for i in range(n):
+      v, pos = get_varint(raw, pos)
+      cols[4].append(v)
+    for i in range(n):
+      callback(symbols, cols[0][i], cols[1][i], cols[2][i], cols[3][i],
+               cols[4][i])
+
+
 def parse(fn, callback, pre_callback=None, post_callback=None):
   if fn == '-': infile = sys.stdin
   elif fn.endswith('xz'): infile = os.popen('xzcat ' + fn)
@@ -73,15 +199,17 @@ def parse(fn, callback, pre_callback=None, post_callback=None):
   line = infile.readline()
   offset = len(line)
   toks = line.strip().split()
-  is_text = len(toks) == 2
+  if len(toks) == 2: fmt = 'text'
+  elif toks[2].lower() in ('columnar', 'indexed'): fmt = toks[2].lower()
+  else: fmt = 'binary'
   symbol_type = toks[1]
   symbols = []
   for line in infile:
     offset += len(line)
     if line.lower().startswith('@end'): break
     symbols.append(line.strip())
-  if pre_callback: pre_callback(symbols, symbol_type, is_text)
-  if is_text:
+  if pre_callback: pre_callback(symbols, symbol_type, fmt)
+  if fmt == 'text':
     for line in infile:
       toks = line.strip().split()
       hmsm = int(toks[0])
@@ -97,18 +225,33 @@ def parse(fn, callback, pre_callback=None, post_callback=None):
     infile.close()
     infile = open(fn, 'r+b')
     mm = mmap.mmap(infile.fileno(), 0)
-    while offset < len(mm):
-      ms = struct.unpack('I', mm[offset:offset + 4])[0]
-      offset += 4
-      sec = struct.unpack('H', mm[offset:offset + 2])[0]
-      offset += 2
-      t = mm[offset]
-      offset += 1
-      px = struct.unpack('d', mm[offset:offset + 8])[0]
-      offset += 8
-      size = struct.unpack('I', mm[offset:offset + 4])[0]
-      offset += 4
-      callback(symbols, ms, sec, t, px, size)
+    if fmt == 'columnar':
+      read_blocks(mm, offset, len(mm), symbols, callback)
+    elif fmt == 'indexed':
+      ticks = []
+      m = struct.unpack('=I', mm[offset:offset + 4])[0]
+      for i in range(m):
+        start, size = struct.unpack('=QQ',
+                                    mm[offset + 4 + 16 * i:offset + 20 + 16 * i])
+        start += offset
+        read_blocks(mm, start, start + size, symbols,
+                    lambda *t: ticks.append(t[1:]))
+      ticks.sort(key=lambda t: t[0])
+      for t in ticks:
+        callback(symbols, *t)
+    else:
+      while offset < len(mm):
+        ms = struct.unpack('I', mm[offset:offset + 4])[0]
+        offset += 4
+        sec = struct.unpack('H', mm[offset:offset + 2])[0]
+        offset += 2
+        t = mm[offset]
+        offset += 1
+        px = struct.unpack('d', mm[offset:offset + 8])[0]
+        offset += 8
+        size = struct.unpack('I', mm[offset:offset + 4])[0]
+        offset += 4
+        callback(symbols, ms, sec, t, px, size)
   if post_callback: post_callback(symbols)
 
 
@@ -0,0 +1,49 @@
+#!/usr/bin/env python2
+
+# text volume profile ("<security id> HH:MM <volume>" per line) to the
+# binary format mmapped by src/algos/vwap/volume_profile.h
+
+import struct
+import sys
+
+kMinutes = 24 * 60
+kVersion = 1
+
+
+def main():
+  if len(sys.argv) < 3:
+    print('usage: convert_volume_profile.py <volume_profile.txt> <output>')
+    return
+  volumes = {}
+  for ln in open(sys.argv[1]):
+    toks = ln.split()
+    if not toks: continue
+    if len(toks) != 3:
+      print('invalid line: ' + ln.strip())
+      sys.exit(1)
+    hour, minute = toks[1].split(':')
+    m = int(hour) * 60 + int(minute)
+    v = float(toks[2])
+    if m < 0 or m >= kMinutes or v <= 0: continue
+    x = volumes.get(int(toks[0]))
+    if x is None:
+      x = volumes[int(toks[0])] = [0.] * kMinutes
+    x[m] += v
+  ids = sorted(volumes.keys())
+  with open(sys.argv[2], 'wb') as fh:
+    fh.write(b'OTVP' + struct.pack('<III', kVersion, len(ids), kMinutes))
+    fh.write(struct.pack('<%dI' % len(ids), *ids))
+    for i in ids:
+      x = volumes[i]
+      total = sum(x)
+      cum = 0.
+      row = []
+      for v in x:
+        cum += v
+        row.append(cum / total)
+      fh.write(struct.pack('<%df' % kMinutes, *row))
+  print('%d securities written to %s' % (len(ids), sys.argv[2]))
+
+
+if __name__ == '__main__':
+  main()
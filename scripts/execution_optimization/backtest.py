@@ -1,15 +1,29 @@
 from opentrade import *
 import os
+import json
 import datetime
 
 exch = get_exchange(os.environ['MARKET'])
-min_size = int(os.environ['MinSize'])
-period = int(os.environ['ValidSeconds'])
+min_size = int(os.environ.get('MinSize', 100000))
+period = int(os.environ.get('ValidSeconds', 300))
 agg = os.environ.get('Aggression', 'Low')
-fw = open(os.environ.get('ALGOS_OUTFILE') or 'algos.txt', 'wt')
+algos_fn = os.environ.get('ALGOS_OUTFILE') or 'algos.txt'
+fw = None
+
+# SWEEP=<json file of [{"MinSize": .., "ValidSeconds": .., "Aggression": ..}]>
+# plays every configuration in one run, see ./run
+sweep = json.load(open(os.environ['SWEEP'])) if os.environ.get('SWEEP') else None
 
 
 def on_start(self):
+  global min_size, period, agg, fw
+  if self.config:
+    min_size = int(self.config.get('MinSize', min_size))
+    period = int(self.config.get('ValidSeconds', period))
+    agg = self.config.get('Aggression', agg)
+    fw = open('%s.%d' % (algos_fn, self.shard), 'wt')
+  else:
+    fw = open(algos_fn, 'wt')
   log_info('backtest started')
   log_info('MinSize=' + str(min_size))
   log_info('ValidSeconds=' + str(period))
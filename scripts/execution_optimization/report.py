@@ -2,9 +2,43 @@
 # -*- coding: utf-8 -*-
 
 import os
+import struct
+from array import array
 from collections import defaultdict
 
 
+def load_trades(fn):
+  """(symbol, side, qty, px, algo_id) of the fills of a trades file, of
+  text lines or of the binary blocks of TRADES_FORMAT=binary, see
+  src/opentrade/trade_file.h"""
+  with open(fn, 'rb') as fh:
+    if fh.read(4) != b'OTTB':
+      fh.seek(0)
+      for ln in fh:
+        fds = ln.decode().strip().split(',')
+        if len(fds) < 6: continue
+        yield fds[1], fds[2], float(fds[3]), float(fds[4]), fds[5]
+      return
+    fh.seek(0)
+    while True:
+      head = fh.read(12)
+      if len(head) < 12 or head[:4] != b'OTTB': break
+      n, m = struct.unpack('<II', head[4:])
+      symbols = {}
+      for _ in range(m):
+        sec_id, size = struct.unpack('<IH', fh.read(6))
+        symbols[sec_id] = fh.read(size).decode()
+      cols = []
+      for code in ('Q', 'I', 'B', 'd', 'd', 'I'):
+        col = array(code)
+        col.frombytes(fh.read(n * col.itemsize))
+        cols.append(col)
+      _, sec_ids, sides, qtys, pxs, algo_ids = cols
+      for i in range(n):
+        yield (symbols[sec_ids[i]], chr(sides[i]), qtys[i], pxs[i],
+               str(algo_ids[i]))
+
+
 def main():
   accs = defaultdict(int)
   for ln in open(os.environ.get('ALGOS_OUTFILE', 'algos.txt')):
@@ -35,13 +69,10 @@ def report_acc(acc):
     attrs[symbol] = (float(rate), float(multiplier))
   trades = defaultdict(lambda: defaultdict(list))
   rpnl = defaultdict(lambda: [0, 0, 0])
-  for ln in open(os.environ.get('TRADES_OUTFILE', 'trades.txt')):
-    fds = ln.strip().split(',')
-    tm, symbol, side, qty, px, algo_id = fds[:6]
+  for symbol, side, qty, px, algo_id in load_trades(
+      os.environ.get('TRADES_OUTFILE', 'trades.txt')):
     if algo_id not in costs[symbol][side]: continue
     y = x[symbol][side]
-    px = float(px)
-    qty = float(qty)
     y[1] = (y[1] * y[0] + qty * px) / (y[0] + qty)
     y[0] += qty
     p = costs[symbol][side][algo_id]
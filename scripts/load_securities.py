@@ -1,4 +1,6 @@
 #!/usr/bin/env python3
+# row by row, for sqlite or small files; the security_import tool bulk
+# imports the same csv into postgres and notifies the running instances
 
 import optparse
 import pg8000
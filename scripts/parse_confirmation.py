@@ -1,8 +1,11 @@
 #!/usr/bin/env python2
 
 import mmap
+import os
+import glob
 import sys
 import struct
+import zlib
 import datetime
 
 # order side
@@ -78,52 +81,85 @@ kTransCorrect = '2'
 kTransStatus = '3'
 
 
+def files_of(fn):
+  """ the legacy file followed by its daily journal segments """
+  files = sorted(glob.glob(fn + '-*'))
+  if os.path.exists(fn): files.insert(0, fn)
+  return files
+
+
+def journal_records(mm):
+  """ [u32 size][u32 crc32][u32 seq][u16 acc][exec type][body]['\0'],
+  returned in the legacy layout, stops at a torn or corrupted tail """
+  offset = 0
+  while offset + 8 <= len(mm):
+    size, crc = struct.unpack('II', mm[offset:offset + 8])
+    payload = mm[offset + 8:offset + 8 + size]
+    if len(payload) < size or zlib.crc32(payload) & 0xffffffff != crc: break
+    offset += 8 + size
+    seq, acc, exec_type = struct.unpack('IHc', payload[:7])
+    body = payload[7:-1]
+    yield struct.pack('IH', seq, len(body)) + exec_type + struct.pack(
+        'H', acc) + body + '\0\n'
+
+
+def legacy_records(mm):
+  offset = 0
+  while offset + 9 < len(mm):
+    offset0 = offset
+    n = struct.unpack('H', mm[offset + 4:offset + 6])[0]
+    offset += 9 + n + 2  # header + body + '\0' + '\n'
+    yield mm[offset0:offset]
+  assert (offset == len(mm))
+
+
 def parse(fn, callback):
-  with open(fn, 'r+b') as f:
-    # memory-map the file, size 0 means whole file
-    mm = mmap.mmap(f.fileno(), 0)
-    offset = 0
-    while offset + 9 < len(mm):
-      offset0 = offset
-      seq = struct.unpack('I', mm[offset:offset + 4])[0]
-      offset += 4
-      n = struct.unpack('H', mm[offset:offset + 2])[0]
-      offset += 2
-      exec_type = mm[offset]
-      offset += 1
-      acc = struct.unpack('H', mm[offset:offset + 2])[0]
-      offset += 2
-      body = mm[offset:offset + n]
-      offset += n + 2  # body + '\0' + '\n'
-      fds = body.split()
-      raw = mm[offset0:offset]
-      if exec_type == kNew:
-        id, tm, order_id = fds
-        callback(seq, raw, exec_type, acc, id, tm, order_id)
-      elif exec_type == kPartiallyFilled or exec_type == kFilled:
-        id, tm, last_shares, last_px, exec_trans_type, exec_id = fds
-        callback(seq, raw, exec_type, acc, id, tm, last_shares, last_px,
-                 exec_trans_type, exec_id)
-      elif exec_type == kUnconfirmedNew:
-        id, tm, algo_id, qty, price, stop_price, side, type, tif, \
-            sec_id, user_id, broker_account_id = fds[:12]
-        dest = ''
-        if len(fds) > 12: dest = fds[12]
-        callback(seq, raw, exec_type, acc, id, tm, algo_id, qty, price,
-                 stop_price, side, type, tif, sec_id, user_id,
-                 broker_account_id, dest)
-      elif exec_type == kUnconfirmedCancel:
-        id, tm, orig_id = fds
-        callback(seq, raw, exec_type, acc, id, tm, orig_id)
-      elif exec_type == kRiskRejected:
-        id = fds[0]
-        text = ' '.join(fds[1])
-        callback(seq, raw, exec_type, acc, id, None, text)
+  for fn in files_of(fn):
+    with open(fn, 'r+b') as f:
+      if not os.fstat(f.fileno()).st_size: continue
+      # memory-map the file, size 0 means whole file
+      mm = mmap.mmap(f.fileno(), 0)
+      if os.path.basename(fn).startswith('confirmations-'):
+        records = journal_records(mm)
       else:
-        id, tm = fds[:2]
-        text = '.'.join(fds[2:])
-        callback(seq, raw, exec_type, acc, id, tm, text)
-    assert (offset == len(mm))
+        records = legacy_records(mm)
+      for raw in records:
+        parse_record(raw, callback)
+
+
+def parse_record(raw, callback):
+  seq = struct.unpack('I', raw[:4])[0]
+  n = struct.unpack('H', raw[4:6])[0]
+  exec_type = raw[6]
+  acc = struct.unpack('H', raw[7:9])[0]
+  body = raw[9:9 + n]
+  fds = body.split()
+  if exec_type == kNew:
+    id, tm, order_id = fds
+    callback(seq, raw, exec_type, acc, id, tm, order_id)
+  elif exec_type == kPartiallyFilled or exec_type == kFilled:
+    id, tm, last_shares, last_px, exec_trans_type, exec_id = fds
+    callback(seq, raw, exec_type, acc, id, tm, last_shares, last_px,
+             exec_trans_type, exec_id)
+  elif exec_type == kUnconfirmedNew:
+    id, tm, algo_id, qty, price, stop_price, side, type, tif, \
+        sec_id, user_id, broker_account_id = fds[:12]
+    dest = ''
+    if len(fds) > 12: dest = fds[12]
+    callback(seq, raw, exec_type, acc, id, tm, algo_id, qty, price,
+             stop_price, side, type, tif, sec_id, user_id, broker_account_id,
+             dest)
+  elif exec_type == kUnconfirmedCancel:
+    id, tm, orig_id = fds
+    callback(seq, raw, exec_type, acc, id, tm, orig_id)
+  elif exec_type == kRiskRejected:
+    id = fds[0]
+    text = ' '.join(fds[1])
+    callback(seq, raw, exec_type, acc, id, None, text)
+  else:
+    id, tm = fds[:2]
+    text = '.'.join(fds[2:])
+    callback(seq, raw, exec_type, acc, id, tm, text)
 
 
 def print_confirmation(seq, raw, *args):
@@ -0,0 +1,37 @@
+#!/usr/bin/env python2
+
+# Converts a binary FIX messages log (FileLogBinary=Y) to the text format,
+# usage: parse_fix_log.py <prefix>.messages.current.log [direction]
+# direction is I or O to only keep incoming or outgoing messages
+
+import datetime
+import struct
+import sys
+
+kHeader = struct.Struct('<qIc3x')
+
+
+def parse(path):
+  with open(path, 'rb') as f:
+    data = f.read()
+  i = 0
+  while i + kHeader.size <= len(data):
+    ns, size, direction = kHeader.unpack_from(data, i)
+    # zero filled tail of a log not closed
+    if not ns: break
+    i += kHeader.size
+    yield ns, direction, data[i:i + size]
+    i += size
+
+
+def main():
+  direction = sys.argv[2] if len(sys.argv) > 2 else None
+  for ns, d, msg in parse(sys.argv[1]):
+    if direction and d != direction: continue
+    tm = datetime.datetime.utcfromtimestamp(ns // 1000000000)
+    print('%s.%09d : %s' %
+          (tm.strftime('%Y%m%d-%H:%M:%S'), ns % 1000000000, msg))
+
+
+if __name__ == '__main__':
+  main()
@@ -49,7 +49,7 @@ def main():
   if os.path.exists(dest):
     log(dest, 'already exists, skip rolling', src)
     return
-  if not os.path.exists(src):
+  if not files_of(src):
     log(src, 'not exists, skip rolling')
     return
   fh = open(dest, 'wb')
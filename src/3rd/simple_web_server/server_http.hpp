@@ -4,6 +4,7 @@
 #include "asio_compatibility.hpp"
 #include "mutex.hpp"
 #include "utility.hpp"
+#include <array>
 #include <functional>
 #include <iostream>
 #include <limits>
@@ -48,7 +49,12 @@ namespace SimpleWeb {
       long timeout_content;
 
       Mutex send_queue_mutex;
-      std::list<std::pair<std::shared_ptr<asio::streambuf>, std::function<void(const error_code &)>>> send_queue GUARDED_BY(send_queue_mutex);
+      struct OutData {
+        std::shared_ptr<asio::streambuf> streambuf;
+        std::function<void(const error_code &)> callback;
+        std::shared_ptr<const std::string> content; // sent after streambuf without copy, may be null
+      };
+      std::list<OutData> send_queue GUARDED_BY(send_queue_mutex);
 
       Response(std::shared_ptr<Session> session_, long timeout_content) noexcept : std::ostream(nullptr), session(std::move(session_)), timeout_content(timeout_content) {
         rdbuf(streambuf.get());
@@ -74,7 +80,9 @@ namespace SimpleWeb {
 
       void send_from_queue() REQUIRES(send_queue_mutex) {
         auto self = this->shared_from_this();
-        asio::async_write(*self->session->connection->socket, *send_queue.begin()->first, [self](const error_code &ec, std::size_t /*bytes_transferred*/) {
+        auto &out = send_queue.front();
+        std::array<asio::const_buffer, 2> buffers{{out.streambuf->data(), out.content ? asio::buffer(*out.content) : asio::const_buffer()}};
+        asio::async_write(*self->session->connection->socket, buffers, [self](const error_code &ec, std::size_t /*bytes_transferred*/) {
           auto lock = self->session->connection->handler_runner->continue_lock();
           if(!lock)
             return;
@@ -82,7 +90,7 @@ namespace SimpleWeb {
             LockGuard lock(self->send_queue_mutex);
             if(!ec) {
               auto it = self->send_queue.begin();
-              auto callback = std::move(it->second);
+              auto callback = std::move(it->callback);
               self->send_queue.erase(it);
               if(self->send_queue.size() > 0)
                 self->send_from_queue();
@@ -94,9 +102,9 @@ namespace SimpleWeb {
             else {
               // All handlers in the queue is called with ec:
               std::vector<std::function<void(const error_code &)>> callbacks;
-              for(auto &pair : self->send_queue) {
-                if(pair.second)
-                  callbacks.emplace_back(std::move(pair.second));
+              for(auto &out_data : self->send_queue) {
+                if(out_data.callback)
+                  callbacks.emplace_back(std::move(out_data.callback));
               }
               self->send_queue.clear();
 
@@ -130,6 +138,11 @@ namespace SimpleWeb {
       ///
       /// Use this function if you need to recursively send parts of a longer message, or when using server-sent events.
       void send(const std::function<void(const error_code &)> &callback = nullptr) noexcept {
+        send(nullptr, callback);
+      }
+
+      /// Send the content of the response stream followed by content, which is not copied but kept alive until sent, e.g. a file cached in memory.
+      void send(std::shared_ptr<const std::string> content, const std::function<void(const error_code &)> &callback = nullptr) noexcept {
         session->connection->set_timeout(timeout_content);
 
         std::shared_ptr<asio::streambuf> streambuf = std::move(this->streambuf);
@@ -137,7 +150,7 @@ namespace SimpleWeb {
         rdbuf(this->streambuf.get());
 
         LockGuard lock(send_queue_mutex);
-        send_queue.emplace_back(streambuf, callback);
+        send_queue.push_back(OutData{streambuf, callback, std::move(content)});
         if(send_queue.size() == 1)
           send_from_queue();
       }
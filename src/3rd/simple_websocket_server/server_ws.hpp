@@ -14,6 +14,7 @@
 #include <memory>
 #include <thread>
 #include <unordered_set>
+#include <vector>
 
 // Late 2017 TODO: remove the following checks and always use std::regex
 #ifdef USE_BOOST_REGEX
@@ -209,24 +210,35 @@ namespace SimpleWeb {
       std::list<OutData> send_queue GUARDED_BY(send_queue_mutex);
 
       /// send_queue_mutex must be locked here
+      /// Coalesces up to max_coalesce queued frames into one write.
       void send_from_queue() REQUIRES(send_queue_mutex) {
-        std::array<asio::const_buffer, 2> buffers{send_queue.begin()->out_header->streambuf.data(), send_queue.begin()->out_message->streambuf.data()};
+        static const std::size_t max_coalesce = 64;
+        auto buffers = std::make_shared<std::vector<asio::const_buffer>>();
+        std::size_t n = 0;
+        for(auto it = send_queue.begin(); it != send_queue.end() && n < max_coalesce; ++it, ++n) {
+          buffers->emplace_back(it->out_header->streambuf.data());
+          buffers->emplace_back(it->out_message->streambuf.data());
+        }
         auto self = this->shared_from_this();
-        asio::async_write(*socket, buffers, [self](const error_code &ec, std::size_t /*bytes_transferred*/) {
+        asio::async_write(*socket, *buffers, [self, buffers, n](const error_code &ec, std::size_t /*bytes_transferred*/) {
           auto lock = self->handler_runner->continue_lock();
           if(!lock)
             return;
           {
             LockGuard lock(self->send_queue_mutex);
             if(!ec) {
-              auto it = self->send_queue.begin();
-              auto callback = std::move(it->callback);
-              self->send_queue.erase(it);
+              std::vector<std::function<void(const error_code &)>> callbacks;
+              for(std::size_t i = 0; i < n; ++i) {
+                auto it = self->send_queue.begin();
+                if(it->callback)
+                  callbacks.emplace_back(std::move(it->callback));
+                self->send_queue.erase(it);
+              }
               if(self->send_queue.size() > 0)
                 self->send_from_queue();
 
               lock.unlock();
-              if(callback)
+              for(auto &callback : callbacks)
                 callback(ec);
             }
             else {
@@ -31,6 +31,35 @@ static const bbg::Name kBestBidSzs[] = {
     bbg::Name{"BEST_BID3_SZ"}, bbg::Name{"BEST_BID4_SZ"},
     bbg::Name{"BEST_BID5_SZ"}};
 
+// subscribed fields, index 0 of the quote fields is BID/ASK, i + 1 BEST_*i
+enum FieldType {
+  kFieldAsk,
+  kFieldBid,
+  kFieldAskSize,
+  kFieldBidSize,
+  kFieldLast,
+};
+struct Field {
+  const bbg::Name* name;
+  FieldType type;
+  int index;
+};
+static const auto kFields = []() {
+  std::vector<Field> out{{&kLastPrice, kFieldLast, 0},
+                         {&kSizeLastTrade, kFieldLast, 1},
+                         {&kAsk, kFieldAsk, 0},
+                         {&kBid, kFieldBid, 0},
+                         {&kAskSize, kFieldAskSize, 0},
+                         {&kBidSize, kFieldBidSize, 0}};
+  for (auto i = 0; i < 5; ++i) {
+    out.push_back({&kBestAsks[i], kFieldAsk, i + 1});
+    out.push_back({&kBestBids[i], kFieldBid, i + 1});
+    out.push_back({&kBestAskSzs[i], kFieldAskSize, i + 1});
+    out.push_back({&kBestBidSzs[i], kFieldBidSize, i + 1});
+  }
+  return out;
+}();
+
 void BPIPE::Start() noexcept {
   auto logon_type = config("logon_type");
   if (logon_type.empty()) {
@@ -135,6 +164,22 @@ void BPIPE::Reconnect() noexcept {
 
 void BPIPE::SubscribeSync(const opentrade::Security& sec) noexcept {
   bbg::SubscriptionList sub;
+  if (AddSubscription(sec, &sub)) session_->subscribe(sub, identity_);
+}
+
+// one subscription list for all
+void BPIPE::SubscribeBatchSync(
+    const std::vector<const opentrade::Security*>& secs) noexcept {
+  bbg::SubscriptionList sub;
+  auto n = 0;
+  for (auto sec : secs) n += AddSubscription(*sec, &sub);
+  if (!n) return;
+  LOG_INFO(name() << ": subscribe to " << n << " securities in one list");
+  session_->subscribe(sub, identity_);
+}
+
+bool BPIPE::AddSubscription(const opentrade::Security& sec,
+                            bbg::SubscriptionList* sub) {
   std::string symbol("//blp/mktdata/bbgid/");
   symbol += sec.bbgid;
   std::string fields = "LAST_PRICE,SIZE_LAST_TRADE,BID,BID_SIZE,ASK,ASK_SIZE,";
@@ -145,12 +190,21 @@ void BPIPE::SubscribeSync(const opentrade::Security& sec) noexcept {
       "BEST_ASK1_SZ,BEST_ASK2_SZ,BEST_ASK3_SZ,BEST_ASK4_SZ,BEST_ASK5_SZ";
   if (depth_) fields += depth;
 
-  auto ticker = ++request_counter_;
-  tickers_[ticker] = &sec;
-  sub.add(symbol.c_str(), fields.c_str(), "", bbg::CorrelationId(ticker));
-  LOG_INFO(name() << ": subscribe to " << sec.exchange->name << ":"
-                  << sec.symbol << " " << symbol << " " << fields);
-  session_->subscribe(sub, identity_);
+  auto it = slots_.find(sec.id);
+  if (it == slots_.end()) {
+    if (slots_.size() >= kMaxTickers) {
+      LOG_ERROR(name() << ": Too many subscriptions, " << sec.symbol
+                       << " ignored");
+      return false;
+    }
+    it = slots_.emplace(sec.id, slots_.size()).first;
+    tickers_[it->second].store(&sec, std::memory_order_release);
+  }
+  sub->add(symbol.c_str(), fields.c_str(), "",
+           bbg::CorrelationId(static_cast<int64_t>(it->second)));
+  LOG_DEBUG(name() << ": subscribe to " << sec.exchange->name << ":"
+                   << sec.symbol << " " << symbol << " " << fields);
+  return true;
 }
 
 bool BPIPE::processEvent(const bbg::Event& evt, bbg::Session* session) {
@@ -241,62 +295,66 @@ void BPIPE::ProcessResponse(const bbg::Event& evt) {
   LogEvent(evt);
 }
 
-inline void BPIPE::UpdateQuote(const bbg::Message& msg,
-                               const opentrade::Security& sec,
-                               const bbg::Name& ask_name,
-                               const bbg::Name& bid_name,
-                               const bbg::Name& ask_sz_name,
-                               const bbg::Name& bid_sz_name, int level) {
-  auto ask = 0.;
-  auto ask_sz = 0;
-  auto bid = 0.;
-  auto bid_sz = 0;
-  if (msg.hasElement(ask_name, true)) {
-    ask = msg.getElementAsFloat64(ask_name);
-    if (msg.hasElement(ask_sz_name, true))
-      ask_sz = msg.getElementAsInt64(ask_sz_name);
-  }
-  if (msg.hasElement(bid_name, true)) {
-    bid = msg.getElementAsFloat64(bid_name);
-    if (msg.hasElement(bid_sz_name, true))
-      bid_sz = msg.getElementAsInt64(bid_sz_name);
+// one pass over the elements comparing interned names, BEST_*1 overrides
+// BID/ASK as before
+void BPIPE::ParseMessage(const bbg::Message& msg, Batch* batch) {
+  double values[4][6] = {};
+  double last[2] = {};
+  auto elem = msg.asElement();
+  auto n = elem.numElements();
+  auto nfields = depth_ ? kFields.size() : 6;
+  for (size_t i = 0; i < n; ++i) {
+    auto e = elem.getElement(i);
+    if (e.isNull()) continue;
+    auto name = e.name();
+    for (auto j = 0u; j < nfields; ++j) {
+      auto& f = kFields[j];
+      if (*f.name != name) continue;
+      if (f.type == kFieldLast) {
+        last[f.index] = f.index ? e.getValueAsInt64() : e.getValueAsFloat64();
+      } else if (f.type == kFieldAsk || f.type == kFieldBid) {
+        values[f.type][f.index] = e.getValueAsFloat64();
+      } else {
+        values[f.type][f.index] = e.getValueAsInt64();
+      }
+      break;
+    }
   }
-
-  if (ask > 0 && bid > 0) {
-    Update(sec.id, opentrade::MarketData::Quote{ask, bid, ask_sz, bid_sz},
-           level);
-  } else if (ask > 0) {
-    Update(sec.id, ask, ask_sz, false, level);
-  } else if (bid > 0) {
-    Update(sec.id, bid, bid_sz, true, level);
+  if (last[0] > 0) batch->trades.emplace_back(last[0], last[1]);
+  for (auto i = 0; i < (depth_ ? 6 : 1); ++i) {
+    auto level = i ? i - 1 : 0;
+    auto ask = values[kFieldAsk][i];
+    auto bid = values[kFieldBid][i];
+    if (ask > 0) batch->SetAsk(level, ask, values[kFieldAskSize][i]);
+    if (bid > 0) batch->SetBid(level, bid, values[kFieldBidSize][i]);
   }
 }
 
+// messages of one event coalesced per security, one update each
 void BPIPE::ProcessSubscriptionData(const bbg::Event& evt) {
+  ++event_;
   bbg::MessageIterator it(evt);
   while (it.next()) {
     auto msg = it.message();
-    auto ticker = msg.correlationId().asInteger();
-    auto sec = tickers_[ticker];
-    if (!sec) continue;
-    auto px = 0.;
-    auto sz = 0.;
-    if (msg.hasElement(kLastPrice, true)) {
-      px = msg.getElementAsFloat64(kLastPrice);
-      if (msg.hasElement(kSizeLastTrade, true))
-        sz = msg.getElementAsInt64(kSizeLastTrade);
-    }
-    if (px > 0) {
-      Update(sec->id, px, sz);
-    }
-    UpdateQuote(msg, *sec, kAsk, kBid, kAskSize, kBidSize, 0);
-    if (depth_) {
-      for (auto i = 0; i < 5; ++i) {
-        UpdateQuote(msg, *sec, kBestAsks[i], kBestBids[i], kBestAskSzs[i],
-                    kBestBidSzs[i], i);
-      }
+    auto slot = static_cast<uint64_t>(msg.correlationId().asInteger());
+    if (slot >= kMaxTickers) continue;
+    if (!tickers_[slot].load(std::memory_order_acquire)) continue;
+    if (slot >= pending_.size()) pending_.resize(slot + 1);
+    auto& p = pending_[slot];
+    if (p.event != event_) {
+      p.event = event_;
+      p.batch.clear();
+      touched_.push_back(slot);
     }
+    ParseMessage(msg, &p.batch);
+  }
+  for (auto slot : touched_) {
+    auto sec = tickers_[slot].load(std::memory_order_relaxed);
+    auto& p = pending_[slot];
+    if (!p.md) p.md = &md()[sec->id];
+    Update(sec->id, p.batch, 0, p.md);
   }
+  touched_.clear();
 }
 
 void BPIPE::ProcessTokenStatus(const bbg::Event& evt) {
@@ -5,7 +5,10 @@
 #include <blpapi_service.h>
 #include <blpapi_session.h>
 #include <blpapi_sessionoptions.h>
-#include <tbb/concurrent_unordered_map.h>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
 #include "opentrade/market_data.h"
 
@@ -28,17 +31,33 @@ class BPIPE : public opentrade::MarketDataAdapter, public bbg::EventHandler {
   void ProcessResponse(const bbg::Event& evt);
   void LogEvent(const bbg::Event& evt);
   void SubscribeSync(const opentrade::Security& sec) noexcept override;
-  void UpdateQuote(const bbg::Message& msg, const opentrade::Security& sec,
-                   const bbg::Name& ask_name, const bbg::Name& bid_name,
-                   const bbg::Name& ask_sz_name, const bbg::Name& bid_sz_name,
-                   int level);
+  void SubscribeBatchSync(
+      const std::vector<const opentrade::Security*>& secs) noexcept override;
+  bool AddSubscription(const opentrade::Security& sec,
+                       bbg::SubscriptionList* sub);
+  void ParseMessage(const bbg::Message& msg, Batch* batch);
 
  private:
+  // subscriptions are numbered densely, the number is the CorrelationId
+  static inline const size_t kMaxTickers = 1 << 16;
+  struct Pending {
+    uint64_t event = 0;  // the event it was last touched in
+    Batch batch;
+    opentrade::MarketData* md = nullptr;
+  };
+
   bbg::SessionOptions options_;
   bbg::Session* session_ = nullptr;
   bbg::Identity identity_;
   bbg::Service auth_service_;
-  tbb::concurrent_unordered_map<int64_t, const opentrade::Security*> tickers_;
+  // written on tp_ before subscribing, read on the event thread
+  std::unique_ptr<std::atomic<const opentrade::Security*>[]> tickers_{
+      new std::atomic<const opentrade::Security*>[kMaxTickers]{}};
+  std::unordered_map<opentrade::Security::IdType, uint32_t> slots_;
+  // of the event thread
+  std::vector<Pending> pending_;
+  std::vector<uint32_t> touched_;
+  uint64_t event_ = 0;
   int reconnect_interval_ = 5;
   bool depth_ = false;
 };
@@ -1,5 +1,8 @@
-#include <tbb/concurrent_unordered_map.h>
-#include <unordered_set>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <vector>
 
 #include "api/ThostFtdcMdApi.h"
 #include "opentrade/logger.h"
@@ -7,15 +10,76 @@
 
 using Security = opentrade::Security;
 
+// InstrumentID to security, built on subscription with a seed under which
+// no two instruments share a slot, so that a lookup is one hash and one
+// compare without allocating
+class InstrumentTable {
+ public:
+  InstrumentTable(const std::vector<const Security *> &secs,
+                  opentrade::MarketDataAdapter::MarketDataMap *mds) {
+    for (size_t size = 16;; size <<= 1) {
+      if (size < secs.size() * 4) continue;
+      slots_.assign(size, Slot{});
+      mask_ = size - 1;
+      for (seed_ = 0; seed_ < 64; ++seed_) {
+        if (Fill(secs, mds)) return;
+      }
+    }
+  }
+
+  struct Slot {
+    TThostFtdcInstrumentIDType id = {};
+    const Security *sec = nullptr;
+    opentrade::MarketData *md = nullptr;
+  };
+
+  const Slot *Find(const char *id) const {
+    auto &s = slots_[Hash(id, seed_) & mask_];
+    return s.sec && !strncmp(s.id, id, sizeof(s.id)) ? &s : nullptr;
+  }
+
+ private:
+
+  // FNV-1a
+  static uint32_t Hash(const char *id, uint32_t seed) {
+    uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+    for (auto n = sizeof(Slot::id); n && *id; --n) {
+      h ^= static_cast<uint8_t>(*id++);
+      h *= 16777619u;
+    }
+    return h ^ (h >> 15);
+  }
+
+  bool Fill(const std::vector<const Security *> &secs,
+            opentrade::MarketDataAdapter::MarketDataMap *mds) {
+    std::fill(slots_.begin(), slots_.end(), Slot{});
+    for (auto sec : secs) {
+      auto &s = slots_[Hash(sec->local_symbol, seed_) & mask_];
+      if (s.sec) return false;
+      strncpy(s.id, sec->local_symbol, sizeof(s.id) - 1);
+      s.sec = sec;
+      s.md = &(*mds)[sec->id];
+    }
+    return true;
+  }
+
+  std::vector<Slot> slots_;
+  uint32_t mask_ = 0;
+  uint32_t seed_ = 0;
+};
+
 class Data : public CThostFtdcMdSpi, public opentrade::MarketDataAdapter {
  public:
   ~Data();
   void Start() noexcept override;
   void Stop() noexcept override;
   void Reconnect() noexcept override;
+  bool unsubscribe_supported() const noexcept override { return true; }
 
  private:
   void SubscribeSync(const Security &sec) noexcept override;
+  bool UnsubscribeSync(const Security &sec) noexcept override;
+  void SubscribePending();
   void Close();
   void OnFrontConnected() override;
   void OnFrontDisconnected(int reason) override;
@@ -43,10 +107,16 @@ class Data : public CThostFtdcMdSpi, public opentrade::MarketDataAdapter {
  private:
   CThostFtdcMdApi *api_ = nullptr;
   std::string address_, broker_id_, user_id_, password_;
-  tbb::concurrent_unordered_map<std::string, const Security *> instruments_;
+  // written on tp_, read on the CTP thread
+  std::atomic<const InstrumentTable *> instruments_ = nullptr;
+  std::vector<const Security *> secs_;
+  std::vector<const Security *> pending_;
 };
 
-Data::~Data() { api_->Release(); }
+Data::~Data() {
+  api_->Release();
+  delete instruments_.load();
+}
 
 void Data::Start() noexcept {
   address_ = config("address");
@@ -96,11 +166,38 @@ void Data::Reconnect() noexcept {
   });
 }
 
+// batched, ReSubscribeAll rebuilds the instrument table once
 void Data::SubscribeSync(const Security &sec) noexcept {
-  char *req[1] = {const_cast<char *>(sec.local_symbol)};
-  instruments_[sec.local_symbol] = &sec;
-  api_->SubscribeMarketData(req, 1);
-  // api_->SubscribeForQuoteRsp(req, 1);
+  pending_.push_back(&sec);
+  if (pending_.size() == 1) tp_.AddTask([this]() { SubscribePending(); });
+}
+
+bool Data::UnsubscribeSync(const Security &sec) noexcept {
+  auto it = std::find(pending_.begin(), pending_.end(), &sec);
+  if (it != pending_.end()) {
+    pending_.erase(it);
+    return true;
+  }
+  char *req[] = {const_cast<char *>(sec.local_symbol)};
+  return !api_->UnSubscribeMarketData(req, 1);
+}
+
+void Data::SubscribePending() {
+  auto table = instruments_.load(std::memory_order_relaxed);
+  std::vector<char *> req;
+  for (auto sec : pending_) {
+    if (!table || !table->Find(sec->local_symbol)) secs_.push_back(sec);
+    req.push_back(const_cast<char *>(sec->local_symbol));
+  }
+  pending_.clear();
+  if (!table || secs_.size() > req.size()) {
+    auto old = instruments_.exchange(new InstrumentTable(secs_, &md()));
+    // the CTP thread may still be in a lookup of the old table
+    if (old)
+      tp_.AddTask([old]() { delete old; }, boost::posix_time::seconds(1));
+  }
+  api_->SubscribeMarketData(req.data(), req.size());
+  // api_->SubscribeForQuoteRsp(req.data(), req.size());
 }
 
 void Data::OnHeartBeatWarning(int time_lapse) {
@@ -167,31 +264,21 @@ void Data::OnRspUnSubForQuoteRsp(CThostFtdcSpecificInstrumentField *instrument,
 
 void Data::OnRtnDepthMarketData(CThostFtdcDepthMarketDataField *data) {
   if (!data) return;
-  auto sec = instruments_[data->InstrumentID];
-  if (!sec) return;
+  auto table = instruments_.load(std::memory_order_acquire);
+  auto slot = table ? table->Find(data->InstrumentID) : nullptr;
+  if (!slot) return;
   using Quote = opentrade::MarketData::Quote;
-  Update(sec->id, data->LastPrice, data->Volume, data->OpenPrice,
-         data->HighestPrice, data->LowestPrice, data->AveragePrice);
-  Update(sec->id,
-         Quote{data->AskPrice1, data->BidPrice1, data->AskVolume1,
-               data->BidVolume1},
-         0);
-  Update(sec->id,
-         Quote{data->AskPrice2, data->BidPrice2, data->AskVolume2,
-               data->BidVolume2},
-         1);
-  Update(sec->id,
-         Quote{data->AskPrice3, data->BidPrice3, data->AskVolume3,
-               data->BidVolume3},
-         2);
-  Update(sec->id,
-         Quote{data->AskPrice4, data->BidPrice4, data->AskVolume4,
-               data->BidVolume4},
-         3);
-  Update(sec->id,
-         Quote{data->AskPrice5, data->BidPrice5, data->AskVolume5,
-               data->BidVolume5},
-         4);
+  const Quote depth[] = {
+      {data->AskPrice1, data->BidPrice1, data->AskVolume1, data->BidVolume1},
+      {data->AskPrice2, data->BidPrice2, data->AskVolume2, data->BidVolume2},
+      {data->AskPrice3, data->BidPrice3, data->AskVolume3, data->BidVolume3},
+      {data->AskPrice4, data->BidPrice4, data->AskVolume4, data->BidVolume4},
+      {data->AskPrice5, data->BidPrice5, data->AskVolume5, data->BidVolume5},
+  };
+  UpdateSnapshot(slot->sec->id, data->LastPrice, data->Volume,
+                 data->OpenPrice, data->HighestPrice, data->LowestPrice,
+                 data->AveragePrice, depth, sizeof(depth) / sizeof(depth[0]),
+                 0, slot->md);
 }
 
 void Data::OnRtnForQuoteRsp(CThostFtdcForQuoteRspField *data) {}
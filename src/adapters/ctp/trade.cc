@@ -1,8 +1,12 @@
 #include <tbb/concurrent_unordered_map.h>
+#include <algorithm>
+#include <deque>
+#include <mutex>
 
 #include "api/ThostFtdcTraderApi.h"
 #include "opentrade/exchange_connectivity.h"
 #include "opentrade/logger.h"
+#include "opentrade/metrics.h"
 #include "opentrade/task_pool.h"
 
 class Trade : public CThostFtdcTraderSpi,
@@ -42,6 +46,26 @@ class Trade : public CThostFtdcTraderSpi,
   void Login();
   void Auth();
 
+  // outbound request, queued while over the front's flow control
+  struct Request {
+    bool cancel = false;
+    opentrade::Order::IdType id = 0;
+    opentrade::Order::IdType orig_id = 0;
+    CThostFtdcInputOrderField insert{};
+    CThostFtdcInputOrderActionField action{};
+    int64_t tm = 0;  // queued
+  };
+  std::string Submit(Request req);
+  int Send(Request* req);
+  bool Admit(int64_t now);
+  void ScheduleDrain(int64_t now);
+  void Drain();
+  void Reject(const Request& req, const std::string& text);
+  bool CancelQueued(const opentrade::Order& ord);
+  double QueueAge();
+  void LogPlace(const CThostFtdcInputOrderField& c_ord);
+  void LogCancel(const CThostFtdcInputOrderActionField& c_ord);
+
  private:
   CThostFtdcTraderApi* api_ = nullptr;
   std::string address_, broker_id_, user_id_, password_;
@@ -54,9 +78,25 @@ class Trade : public CThostFtdcTraderSpi,
   tbb::concurrent_unordered_map<unsigned, Order> orders_;
   std::ofstream of_;
   std::atomic<int> request_counter_ = 0;
+  // cancels go out before the new orders queued
+  std::deque<Request> cancels_;
+  std::deque<Request> inserts_;
+  // sending times within the last second, for max_requests_per_second
+  std::deque<int64_t> sent_;
+  size_t max_requests_per_second_ = 0;
+  bool drain_scheduled_ = false;
+  std::mutex queue_m_;
 };
 
-Trade::~Trade() { api_->Release(); }
+// ReqOrderInsert / ReqOrderAction returns of the front's flow control, -2 for
+// too many requests outstanding and -3 for too many in the second
+static inline bool IsFlowControl(int ret) { return ret == -2 || ret == -3; }
+static const int64_t kRetryInterval = 100000;  // microseconds
+
+Trade::~Trade() {
+  opentrade::Metrics::Instance().Remove(this);
+  api_->Release();
+}
 
 void Trade::Start() noexcept {
   address_ = config("address");
@@ -82,6 +122,23 @@ void Trade::Start() noexcept {
   product_info_ = config("product_info");
   auth_code_ = config("auth_code");
   app_id_ = config("app_id");
+  // the front's per second limit, requests above it are queued
+  max_requests_per_second_ = config<int>("max_requests_per_second");
+  if (max_requests_per_second_) {
+    LOG_INFO(name() << ": max_requests_per_second="
+                    << max_requests_per_second_);
+  }
+  auto& m = opentrade::Metrics::Instance();
+  auto label = opentrade::Metrics::Label("adapter", name());
+  m.AddGauge("opentrade_ctp_queued", "Requests held by flow control", label,
+             [this]() {
+               std::lock_guard<std::mutex> lock(queue_m_);
+               return static_cast<double>(cancels_.size() + inserts_.size());
+             },
+             this);
+  m.AddGauge("opentrade_ctp_queue_age_seconds",
+             "Wait of the oldest request held by flow control", label,
+             [this]() { return QueueAge(); }, this);
 
   auto path = opentrade::kStorePath / (name() + "-session");
   std::ifstream ifs(path.c_str());
@@ -197,6 +254,16 @@ void Trade::OnFrontDisconnected(int reason) {
   // 当发生这个情况后，API会自动重新连接，客户端可不做处理
   LOG_ERROR(name() << ": Disconnected, reason=" << reason);
   connected_ = 0;
+  // not to send stale requests once reconnected
+  std::deque<Request> cancels;
+  std::deque<Request> inserts;
+  {
+    std::lock_guard<std::mutex> lock(queue_m_);
+    cancels.swap(cancels_);
+    inserts.swap(inserts_);
+  }
+  for (auto& req : cancels) Reject(req, "Disconnected");
+  for (auto& req : inserts) Reject(req, "Disconnected");
 }
 
 // 当客户端发出登录请求之后，该方法会被调用，通知客户端登录是否成功
@@ -400,6 +467,7 @@ void Trade::OnRtnOrder(CThostFtdcOrderField* ord) {
 }
 
 std::string Trade::Cancel(const opentrade::Order& ord) noexcept {
+  if (CancelQueued(ord)) return {};
   auto id = ord.orig_id;
   auto it = orders_.find(id);
   if (it == orders_.end()) {
@@ -423,11 +491,15 @@ std::string Trade::Cancel(const opentrade::Order& ord) noexcept {
 
   c_ord.ActionFlag = THOST_FTDC_AF_Delete;
   c_ord.RequestID = ord.id;
-  auto ret = api_->ReqOrderAction(&c_ord, ++request_counter_);
-  if (ret) {
-    LOG_ERROR(name() << ": ReqOrderAction failed: " << ret);
-    return "ReqOrderAction failed: " + std::to_string(ret);
-  }
+  Request req;
+  req.cancel = true;
+  req.id = ord.id;
+  req.orig_id = id;
+  req.action = c_ord;
+  return Submit(std::move(req));
+}
+
+void Trade::LogCancel(const CThostFtdcInputOrderActionField& c_ord) {
   tp_.AddTask([c_ord, this]() {
     of_ << "# Cancel -> " << opentrade::GetNowStr() << ' '
         << "BrokerID=" << c_ord.BrokerID << ' '
@@ -438,7 +510,6 @@ std::string Trade::Cancel(const opentrade::Order& ord) noexcept {
         << "ActionFlag=" << c_ord.ActionFlag << ' ' << "UserID=" << c_ord.UserID
         << ' ' << "InstrumentID=" << c_ord.InstrumentID << std::endl;
   });
-  return {};
 }
 
 std::string Trade::Place(const opentrade::Order& ord) noexcept {
@@ -500,11 +571,13 @@ std::string Trade::Place(const opentrade::Order& ord) noexcept {
   // 自动挂起标志
   c_ord.IsAutoSuspend = 0;
   c_ord.RequestID = ord.id;
-  auto ret = api_->ReqOrderInsert(&c_ord, ++request_counter_);
-  if (ret) {
-    LOG_ERROR(name() << ": ReqOrderInsert failed: " << ret);
-    return "ReqOrderInsert failed: " + std::to_string(ret);
-  }
+  Request req;
+  req.id = ord.id;
+  req.insert = c_ord;
+  return Submit(std::move(req));
+}
+
+void Trade::LogPlace(const CThostFtdcInputOrderField& c_ord) {
   tp_.AddTask([=]() {
     of_ << "# Place -> " << opentrade::GetNowStr() << ' '
         << "BrokerID=" << c_ord.BrokerID << ' '
@@ -530,9 +603,115 @@ std::string Trade::Place(const opentrade::Order& ord) noexcept {
         << "UserForceClose=" << c_ord.UserForceClose << ' '
         << "IsSwapOrder=" << c_ord.IsSwapOrder << std::endl;
   });
+}
+
+int Trade::Send(Request* req) {
+  if (req->cancel) {
+    auto ret = api_->ReqOrderAction(&req->action, ++request_counter_);
+    if (!ret) LogCancel(req->action);
+    return ret;
+  }
+  auto ret = api_->ReqOrderInsert(&req->insert, ++request_counter_);
+  if (!ret) LogPlace(req->insert);
+  return ret;
+}
+
+// with queue_m_ held
+bool Trade::Admit(int64_t now) {
+  if (!max_requests_per_second_) return true;
+  while (!sent_.empty() && sent_.front() <= now - 1000000) sent_.pop_front();
+  if (sent_.size() >= max_requests_per_second_) return false;
+  sent_.push_back(now);
+  return true;
+}
+
+// with queue_m_ held
+void Trade::ScheduleDrain(int64_t now) {
+  if (drain_scheduled_) return;
+  drain_scheduled_ = true;
+  auto delay = kRetryInterval;
+  if (max_requests_per_second_ && sent_.size() >= max_requests_per_second_)
+    delay = std::max<int64_t>(1000, sent_.front() + 1000000 - now);
+  tp_.AddTask([this]() { Drain(); }, boost::posix_time::microseconds(delay));
+}
+
+std::string Trade::Submit(Request req) {
+  auto now = opentrade::NowUtcInMicro();
+  std::unique_lock<std::mutex> lock(queue_m_);
+  if (cancels_.empty() && inserts_.empty() && Admit(now)) {
+    lock.unlock();
+    auto ret = Send(&req);
+    if (!ret) return {};
+    auto what = req.cancel ? "ReqOrderAction" : "ReqOrderInsert";
+    if (!IsFlowControl(ret)) {
+      LOG_ERROR(name() << ": " << what << " failed: " << ret);
+      return std::string(what) + " failed: " + std::to_string(ret);
+    }
+    LOG_RATE_LIMITED(WARN, 5, name() << ": " << what << " flow controlled: "
+                                     << ret << ", queued");
+    lock.lock();
+  }
+  req.tm = now;
+  (req.cancel ? cancels_ : inserts_).push_back(std::move(req));
+  ScheduleDrain(now);
   return {};
 }
 
+void Trade::Drain() {
+  std::unique_lock<std::mutex> lock(queue_m_);
+  drain_scheduled_ = false;
+  auto now = opentrade::NowUtcInMicro();
+  while (!cancels_.empty() || !inserts_.empty()) {
+    if (!Admit(now)) break;
+    auto& q = cancels_.empty() ? inserts_ : cancels_;
+    auto req = std::move(q.front());
+    q.pop_front();
+    lock.unlock();
+    auto ret = Send(&req);
+    if (ret && !IsFlowControl(ret)) {
+      auto what = req.cancel ? "ReqOrderAction" : "ReqOrderInsert";
+      LOG_ERROR(name() << ": " << what << " failed: " << ret);
+      Reject(req, std::string(what) + " failed: " + std::to_string(ret));
+    }
+    lock.lock();
+    if (IsFlowControl(ret)) {
+      q.push_front(std::move(req));
+      break;
+    }
+    now = opentrade::NowUtcInMicro();
+  }
+  if (!cancels_.empty() || !inserts_.empty()) ScheduleDrain(now);
+}
+
+void Trade::Reject(const Request& req, const std::string& text) {
+  if (req.cancel)
+    HandleCancelRejected(req.id, req.orig_id, text);
+  else
+    HandleNewRejected(req.id, text);
+}
+
+// a new order still queued is dropped instead of sending a cancel after it
+bool Trade::CancelQueued(const opentrade::Order& ord) {
+  {
+    std::lock_guard<std::mutex> lock(queue_m_);
+    auto it = std::find_if(inserts_.begin(), inserts_.end(),
+                           [&](auto& req) { return req.id == ord.orig_id; });
+    if (it == inserts_.end()) return false;
+    inserts_.erase(it);
+  }
+  HandleCanceled(ord.id, ord.orig_id, "Canceled before sent");
+  return true;
+}
+
+double Trade::QueueAge() {
+  std::lock_guard<std::mutex> lock(queue_m_);
+  int64_t tm = 0;
+  if (!cancels_.empty()) tm = cancels_.front().tm;
+  if (!inserts_.empty() && (!tm || inserts_.front().tm < tm))
+    tm = inserts_.front().tm;
+  return tm ? (opentrade::NowUtcInMicro() - tm) / 1e6 : 0.;
+}
+
 void Trade::OnRspSettlementInfoConfirm(
     CThostFtdcSettlementInfoConfirmField* settlement_info,
     CThostFtdcRspInfoField* rsp_info, int request_id, bool is_last) {
@@ -0,0 +1,171 @@
+#include "client.h"
+
+#include <cfloat>
+#include <cstdio>
+
+#include "jts/EDecoder.h"
+
+// as the vendor's EncodeField and EncodeFieldMax
+static inline std::string Format(double v) {
+  char str[128];
+  snprintf(str, sizeof(str), "%.10g", v);
+  return str;
+}
+
+static const OrderId kIdSentinel = 2147023517;
+static const double kQtySentinel = 918273645;
+static const double kLmtSentinel = 97531.8642;
+static const double kAuxSentinel = 86420.9753;
+
+bool IBClient::closeAndSend(std::string msg, unsigned offset) {
+  if (capture_) {
+    *capture_ = std::move(msg);
+    return true;
+  }
+  return EClientSocket::closeAndSend(std::move(msg), offset);
+}
+
+void IBClient::Begin() { buf_.assign(m_useV100Plus ? HEADER_LEN : 0, '\0'); }
+
+void IBClient::Put(int v) { Put(static_cast<int64_t>(v)); }
+
+void IBClient::Put(int64_t v) {
+  char str[32];
+  auto n = snprintf(str, sizeof(str), "%ld", static_cast<long>(v));
+  buf_.append(str, n + 1);
+}
+
+void IBClient::Put(double v) { Put(Format(v)); }
+
+void IBClient::Put(const std::string& v) {
+  buf_ += v;
+  buf_ += '\0';
+}
+
+// the vendor's encoding of order with the sentinels, split at the fields
+// taking them, not ok unless each is found once
+IBClient::Template IBClient::Capture(const Contract& contract,
+                                     const Order& order) {
+  Template t;
+  auto probe = order;
+  probe.totalQuantity = kQtySentinel;
+  auto lmt = probe.lmtPrice != DBL_MAX;
+  auto aux = probe.auxPrice != DBL_MAX;
+  if (lmt) probe.lmtPrice = kLmtSentinel;
+  if (aux) probe.auxPrice = kAuxSentinel;
+  std::string msg;
+  capture_ = &msg;
+  placeOrder(kIdSentinel, contract, probe);
+  capture_ = nullptr;
+  size_t header = m_useV100Plus ? HEADER_LEN : 0;
+  if (msg.size() <= header) return t;
+  const std::pair<std::string, Field> sentinels[] = {
+      {std::to_string(kIdSentinel), kId},
+      {Format(kQtySentinel), kQty},
+      {Format(kLmtSentinel), kLmtPrice},
+      {Format(kAuxSentinel), kAuxPrice}};
+  int found[4] = {};
+  size_t piece = header;
+  for (size_t start = header; start < msg.size();) {
+    auto end = msg.find('\0', start);
+    if (end == std::string::npos) return t;
+    for (auto& s : sentinels) {
+      if (msg.compare(start, end - start, s.first)) continue;
+      t.pieces.push_back(msg.substr(piece, start - piece));
+      t.fields.push_back(s.second);
+      found[s.second]++;
+      piece = end;
+      break;
+    }
+    start = end + 1;
+  }
+  t.pieces.push_back(msg.substr(piece));
+  t.ok = found[kId] == 1 && found[kQty] == 1 && found[kLmtPrice] == lmt &&
+         found[kAuxPrice] == aux;
+  return t;
+}
+
+void IBClient::PlaceOrder(OrderId id, const Contract& contract,
+                          const Order& order, uint64_t key) {
+  if (!isConnected()) {
+    placeOrder(id, contract, order);
+    return;
+  }
+  auto it = templates_.find(key);
+  if (it == templates_.end())
+    it = templates_.emplace(key, Capture(contract, order)).first;
+  auto& t = it->second;
+  if (!t.ok) {
+    placeOrder(id, contract, order);
+    return;
+  }
+  Begin();
+  for (auto i = 0u; i < t.pieces.size(); ++i) {
+    buf_ += t.pieces[i];
+    if (i == t.fields.size()) break;
+    // the '\0' of the field starts the next piece
+    switch (t.fields[i]) {
+      case kId:
+        buf_ += std::to_string(id);
+        break;
+      case kQty:
+        if (m_serverVersion >= MIN_SERVER_VER_FRACTIONAL_POSITIONS)
+          buf_ += Format(order.totalQuantity);
+        else
+          buf_ += std::to_string(static_cast<long>(order.totalQuantity));
+        break;
+      case kLmtPrice:
+        if (order.lmtPrice != DBL_MAX) buf_ += Format(order.lmtPrice);
+        break;
+      case kAuxPrice:
+        if (order.auxPrice != DBL_MAX) buf_ += Format(order.auxPrice);
+        break;
+    }
+  }
+  Send();
+}
+
+void IBClient::CancelOrder(OrderId id) {
+  if (!isConnected()) {
+    cancelOrder(id);
+    return;
+  }
+  Begin();
+  Put(ibapi::client_constants::CANCEL_ORDER);
+  Put(1);  // VERSION
+  Put(static_cast<int64_t>(id));
+  Send();
+}
+
+// the fields of EClient::reqMktData on the servers with trading class, for
+// the contracts without combo legs and delta neutral
+void IBClient::ReqMktData(TickerId ticker, const Contract& contract,
+                          bool snapshot) {
+  if (!isConnected() || m_serverVersion < MIN_SERVER_VER_TRADING_CLASS ||
+      contract.secType == "BAG" || contract.deltaNeutralContract) {
+    reqMktData(ticker, contract, "", snapshot, false, TagValueListSPtr{});
+    return;
+  }
+  Begin();
+  Put(ibapi::client_constants::REQ_MKT_DATA);
+  Put(11);  // VERSION
+  Put(static_cast<int64_t>(ticker));
+  Put(static_cast<int64_t>(contract.conId));
+  Put(contract.symbol);
+  Put(contract.secType);
+  Put(contract.lastTradeDateOrContractMonth);
+  Put(contract.strike);
+  Put(contract.right);
+  Put(contract.multiplier);
+  Put(contract.exchange);
+  Put(contract.primaryExchange);
+  Put(contract.currency);
+  Put(contract.localSymbol);
+  Put(contract.tradingClass);
+  Put(0);  // no delta neutral contract
+  Put(std::string());  // generic ticks
+  Put(snapshot ? 1 : 0);
+  if (m_serverVersion >= MIN_SERVER_VER_REQ_SMART_COMPONENTS) Put(0);
+  Put(std::string());  // mktDataOptions
+  Send();
+}
@@ -0,0 +1,56 @@
+#ifndef ADAPTERS_IB_CLIENT_H_
+#define ADAPTERS_IB_CLIENT_H_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "jts/StdAfx.h"  // first of the vendor headers
+#include "jts/Contract.h"
+#include "jts/EClientSocket.h"
+#include "jts/Order.h"
+
+// EClientSocket with a fast encoder of the requests sent at high rate,
+// written into one reusable buffer rather than through the ostringstream of
+// every vendor request; everything else is left to the vendor API. A
+// placeOrder is spliced into a template of the vendor's own encoding of the
+// same kind of order, captured once with sentinel values in the variable
+// fields, so it follows whatever fields the server version takes. Only used
+// on the thread making the requests.
+class IBClient : public EClientSocket {
+ public:
+  using EClientSocket::EClientSocket;
+  // key tells orders encoded alike apart, i.e. all but the order id,
+  // quantity and prices are the same for the same key
+  void PlaceOrder(OrderId id, const Contract& contract, const Order& order,
+                  uint64_t key);
+  void CancelOrder(OrderId id);
+  void ReqMktData(TickerId ticker, const Contract& contract, bool snapshot);
+  // on connect, the encoding depends on the server version
+  void ClearTemplates() { templates_.clear(); }
+
+ protected:
+  bool closeAndSend(std::string msg, unsigned offset = 0) override;
+
+ private:
+  enum Field { kId, kQty, kLmtPrice, kAuxPrice };
+  struct Template {
+    // the constant bytes around the variable fields
+    std::vector<std::string> pieces;
+    std::vector<Field> fields;
+    bool ok = false;
+  };
+  Template Capture(const Contract& contract, const Order& order);
+  void Begin();
+  void Put(int v);
+  void Put(int64_t v);
+  void Put(double v);
+  void Put(const std::string& v);
+  bool Send() { return EClientSocket::closeAndSend(buf_); }
+
+  std::string buf_;
+  std::string* capture_ = nullptr;
+  std::unordered_map<uint64_t, Template> templates_;
+};
+
+#endif  // ADAPTERS_IB_CLIENT_H_
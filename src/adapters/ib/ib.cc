@@ -34,7 +34,7 @@ static inline decltype(auto) CreateContract(const opentrade::Security& sec) {
   return contract;
 }
 
-IB::IB() : client_(new EClientSocket(this, &os_signal_)) {}
+IB::IB() : client_(new IBClient(this, &os_signal_)) {}
 
 IB::~IB() { delete client_; }
 
@@ -84,6 +84,12 @@ void IB::Start() noexcept {
   // client_id 0 is special, which receive all messages sent from the other ids
   LOG_INFO(name() << ": client_id=" << client_id_);
 
+  auto rate = atof(config("max_msg_rate").c_str());
+  if (rate > 0) max_msg_rate_ = rate;
+  LOG_INFO(name() << ": max_msg_rate=" << max_msg_rate_ << "/s");
+  tokens_ = max_msg_rate_;
+  refilled_ = std::chrono::steady_clock::now();
+
   Connect();
   Heartbeat();
 }
@@ -108,10 +114,39 @@ void IB::Read() {
   });
 }
 
-void IB::Heartbeat() {
-  tp_.AddTask([this] {
-    if (client_->isConnected()) client_->reqCurrentTime();
+void IB::Request(std::function<void()> func, bool urgent) {
+  tp_.AddTask([this, func{std::move(func)}, urgent]() {
+    (urgent ? urgent_ : paced_).push_back(std::move(func));
+    Drain();
   });
+}
+
+void IB::Drain() {
+  auto now = std::chrono::steady_clock::now();
+  auto elapsed = std::chrono::duration<double>(now - refilled_).count();
+  // burst of at most one second's worth
+  tokens_ = std::min(max_msg_rate_, tokens_ + elapsed * max_msg_rate_);
+  refilled_ = now;
+  while (tokens_ >= 1 && (!urgent_.empty() || !paced_.empty())) {
+    auto& q = urgent_.empty() ? paced_ : urgent_;
+    auto func = std::move(q.front());
+    q.pop_front();
+    tokens_ -= 1;
+    if (client_->isConnected()) func();
+  }
+  if (drain_scheduled_ || (urgent_.empty() && paced_.empty())) return;
+  drain_scheduled_ = true;
+  auto wait = static_cast<int64_t>((1 - tokens_) / max_msg_rate_ * 1e6) + 1;
+  tp_.AddTask(
+      [this]() {
+        drain_scheduled_ = false;
+        Drain();
+      },
+      boost::posix_time::microseconds(wait));
+}
+
+void IB::Heartbeat() {
+  Request([this] { client_->reqCurrentTime(); });
   tp_.AddTask(
       [this] {
         if (time(nullptr) - last_heartbeat_tm_ > 2 * heartbeat_interval_) {
@@ -134,6 +169,7 @@ bool IB::Connect(const char* host, unsigned int port, int client_id) {
   LOG_INFO(name() << ": Connecting to " << host << ':' << port
                   << " client_id: " << client_id);
 
+  client_->ClearTemplates();
   bool res = client_->eConnect(host, port, client_id, false);
 
   if (res && client_->isConnected()) {
@@ -141,6 +177,9 @@ bool IB::Connect(const char* host, unsigned int port, int client_id) {
     LOG_INFO(name() << ": Connected");
     reader_.reset(new EReader(client_, &os_signal_));
     reader_->start();
+    // the subscriptions of the old connection are renewed below in a batch
+    // paced under the message rate limit
+    paced_.clear();
     ReSubscribeAll();
     client_->reqOpenOrders();
     ExecutionFilter f;
@@ -328,7 +367,10 @@ std::string IB::Place(const opentrade::Order& ord) noexcept {
   auto id2 = next_valid_id_++;
   orders_[id] = id2;
   orders2_[id2] = id;
-  tp_.AddTask([=]() { client_->placeOrder(id2, *contract, *ib_ord); });
+  // orders of the same security, type and side are encoded alike
+  auto key = static_cast<uint64_t>(ord.sec->id) << 16 |
+             static_cast<uint64_t>(ord.type) << 1 | ord.IsBuy();
+  Request([=]() { client_->PlaceOrder(id2, *contract, *ib_ord, key); });
   io_tp_.AddTask([=]() {
     of_ << id << ' ' << id2 << '\n'
         << "# -> " << opentrade::GetNowStr() << ' ' << "id=" << id2 << ' '
@@ -349,6 +391,7 @@ std::string IB::Place(const opentrade::Order& ord) noexcept {
 
 void IB::nextValidId(OrderId orderId) {
   next_valid_id_ = orderId;
+  ConnectedState::Changed();
   LOG_INFO(name() << ": nextValidId=" << next_valid_id_);
 }
 
@@ -359,8 +402,8 @@ std::string IB::Cancel(const opentrade::Order& ord) noexcept {
   if (it == orders_.end()) return "Original IB order id not found";
   id2 = it->second;
 
-  tp_.AddTask([=]() {
-    client_->cancelOrder(id2);
+  Request([=]() {
+    client_->CancelOrder(id2);
     io_tp_.AddTask([this, id2]() {
       of_ << "# -> " << opentrade::GetNowStr() << ' ' << "Cancel " << id2
           << std::endl;
@@ -379,15 +422,20 @@ void IB::SubscribeSync(const opentrade::Security& sec) noexcept {
   tickers_[ticker] = sec.id;
   ticker = ++request_counter_;
   */
-  client_->reqMktData(ticker, *c, "", false, false, TagValueListSPtr{});
+  if (ticker >= static_cast<int>(tickers_.size())) tickers_.resize(ticker + 1);
   tickers_[ticker] = &sec;
+  Request(
+      [this, ticker, c]() {
+        client_->ReqMktData(ticker, *c, false);
+      },
+      false);
 }
 
 // https://interactivebrokers.github.io/tws-api/tick_types.html
 void IB::tickPrice(TickerId tickerId, TickType field, double price,
                    const TickAttrib& attribs) {
   if (price < 0) return;
-  auto sec = tickers_[tickerId];
+  auto sec = GetTicker(tickerId);
   if (!sec) return;
   auto sec_id = sec->id;
   switch (field) {
@@ -420,7 +468,7 @@ void IB::tickPrice(TickerId tickerId, TickType field, double price,
 
 void IB::tickSize(TickerId tickerId, TickType field, int size) {
   if (size < 0) return;
-  auto sec = tickers_[tickerId];
+  auto sec = GetTicker(tickerId);
   if (!sec) return;
   auto sec_id = sec->id;
   switch (field) {
@@ -1,8 +1,8 @@
 #ifndef ADAPTERS_IB_IB_H_
 #define ADAPTERS_IB_IB_H_
 
+#include "client.h"
 #include "jts/DefaultEWrapper.h"
-#include "jts/EClientSocket.h"
 #include "jts/EReader.h"
 #include "jts/EReaderOSSignal.h"
 #include "opentrade/exchange_connectivity.h"
@@ -11,8 +11,12 @@
 
 #include <tbb/concurrent_unordered_map.h>
 #include <atomic>
+#include <chrono>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <string>
+#include <vector>
 
 class IB : public opentrade::ExchangeConnectivityAdapter,
            public opentrade::MarketDataAdapter,
@@ -56,9 +60,18 @@ class IB : public opentrade::ExchangeConnectivityAdapter,
   void Read();
   void Heartbeat();
   void SubscribeSync(const opentrade::Security& sec) noexcept override;
+  // all the requests to TWS go through the token bucket below, orders and
+  // cancels ahead of subscriptions, run on tp_ like the reader
+  void Request(std::function<void()> func, bool urgent = true);
+  void Drain();
+  const opentrade::Security* GetTicker(TickerId id) const {
+    return id >= 0 && id < static_cast<TickerId>(tickers_.size())
+               ? tickers_[id]
+               : nullptr;
+  }
 
   EReaderOSSignal os_signal_ = 10;  // 10 ms timeout for reader
-  EClientSocket* const client_ = nullptr;
+  IBClient* const client_ = nullptr;
   std::shared_ptr<EReader> reader_;
 
   std::string host_;
@@ -71,7 +84,15 @@ class IB : public opentrade::ExchangeConnectivityAdapter,
   std::atomic<uint32_t> next_valid_id_ = 0;
   tbb::concurrent_unordered_map<uint32_t, uint32_t> orders_;
   tbb::concurrent_unordered_map<uint32_t, uint32_t> orders2_;
-  tbb::concurrent_unordered_map<TickerId, const opentrade::Security*> tickers_;
+  // indexed by ticker id, only touched on tp_
+  std::vector<const opentrade::Security*> tickers_;
+  // TWS disconnects if more than 50 messages a second
+  double max_msg_rate_ = 45;
+  double tokens_ = 0;
+  std::chrono::steady_clock::time_point refilled_;
+  std::deque<std::function<void()>> urgent_;
+  std::deque<std::function<void()>> paced_;
+  bool drain_scheduled_ = false;
 };
 
 #endif  // ADAPTERS_IB_IB_H_
@@ -1,8 +1,14 @@
 #include "pb.h"
 
+#include <fcntl.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
 #include <ctime>
+#include <thread>
 
 #include "opentrade/logger.h"
 #include "opentrade/order.h"
@@ -22,76 +28,170 @@ void PB::Start() noexcept {
     if (n > 0) interval_ = n;
   }
   LOG_INFO(name() << ": interval=" << interval_ << "ms");
+  order_file_.path = dir_ + "/orderstatus_.csv";
+  order_file_.replay = true;  // status updated in place
+  trade_file_.path = dir_ + "/trade.csv";
+  std::thread([this]() { Watch(); }).detach();
   tp_.AddTask([this]() { Loop(); });
 }
 
-inline void PB::LoopAction() {
-  std::string order_file = dir_ + "/orderstatus_.csv";
-  std::string trade_file = dir_ + "/trade.csv";
-  struct stat attr;
-  auto now = time(NULL);
-  stat(order_file.c_str(), &attr);
-  if (attr.st_mtime + 60 < now) {
-    connected_ = 0;
+static const char* kWatched[] = {"orderstatus_.csv", "trade.csv",
+                                 "command.csv"};
+
+void PB::Watch() {
+  auto fd = inotify_init1(IN_CLOEXEC);
+  if (fd < 0 || inotify_add_watch(fd, dir_.c_str(),
+                                  IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE |
+                                      IN_MOVED_TO | IN_DELETE |
+                                      IN_MOVED_FROM) < 0) {
+    LOG_ERROR(name() << ": Failed to watch " << dir_ << ": "
+                     << strerror(errno) << ", read every " << interval_
+                     << "ms only");
+    if (fd >= 0) close(fd);
     return;
   }
-  stat(trade_file.c_str(), &attr);
-  if (attr.st_mtime + 60 < now) {
-    connected_ = 0;
-    return;
+  alignas(struct inotify_event) char buf[4096];
+  while (true) {
+    auto n = read(fd, buf, sizeof(buf));
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR) continue;
+      LOG_ERROR(name() << ": Failed to read inotify events: "
+                       << strerror(errno));
+      break;
+    }
+    for (auto p = buf; p < buf + n;) {
+      auto evt = reinterpret_cast<const struct inotify_event*>(p);
+      p += sizeof(struct inotify_event) + evt->len;
+      if (!evt->len) continue;
+      for (auto f : kWatched) {
+        if (!strcmp(evt->name, f)) {
+          Schedule();
+          break;
+        }
+      }
+    }
   }
-  std::ifstream ifs(order_file.c_str());
-  if (!ifs.good()) {
-    connected_ = 0;
-    return;
+  close(fd);
+}
+
+// one LoopAction for a burst of events
+void PB::Schedule() {
+  if (scheduled_.exchange(true)) return;
+  tp_.AddTask([this]() {
+    scheduled_ = false;
+    LoopAction();
+  });
+}
+
+bool PB::CsvFile::Read(std::vector<std::string>* out) {
+  static const size_t kTailSize = 64;
+  out->clear();
+  auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st)) {
+    close(fd);
+    return false;
   }
-  std::string line;
-  std::vector<std::string> toks;
-  std::getline(ifs, line);
-  boost::split(toks, line, boost::is_any_of(",\r"));
-  int i_tag = -1;
-  int i_cmd_id = -1;
-  int istatus_ = -1;
-  int i_order_id = -1;
-  int i_reason = -1;
-  for (auto i = 0u; i < toks.size(); ++i) {
-    if (toks[i] == "\xcd\xb6\xd7\xca\xb1\xb8\xd7\xa2") {  // tou zi bei zhu
-      i_tag = i;
-    } else if (toks[i] ==
-               "\xd6\xb8\xc1\xee\xb1\xe0\xba\xc5") {  // zhi ling bian hao
-      i_cmd_id = i;
-    } else if (toks[i] ==
-               "\xce\xaf\xcd\xd0\xd7\xb4\xcc\xac") {  // wei tuo zhuang tai
-      istatus_ = i;
-    } else if (toks[i] ==
-               "\xba\xcf\xcd\xac\xb1\xe0\xba\xc5") {  // he tong bian hao
-      i_order_id = i;
-    } else if (toks[i] ==
-               "\xb7\xcf\xb5\xa5\xd4\xad\xd2\xf2") {  // he tong bian hao
-      i_reason = i;
+  auto rewritten = st.st_ino != ino || st.st_size < offset;
+  if (!rewritten && !tail.empty()) {
+    std::string buf(tail.size(), '\0');
+    rewritten = pread(fd, &buf[0], buf.size(), offset - buf.size()) !=
+                    static_cast<ssize_t>(buf.size()) ||
+                buf != tail;
+  }
+  if (rewritten) {
+    // assumed to start with the lines read unless shorter, e.g. a new day
+    skip = replay || st.st_size < offset ? 0 : lines;
+    lines = 0;
+    offset = 0;
+    ino = st.st_ino;
+    tail.clear();
+    partial.clear();
+    header.clear();
+  }
+  std::string data(st.st_size - offset, '\0');
+  auto n = data.empty() ? 0 : pread(fd, &data[0], data.size(), offset);
+  close(fd);
+  if (n < 0) return false;
+  data.resize(n);
+  offset += n;
+  if (data.size() >= kTailSize) {
+    tail.assign(data, data.size() - kTailSize, kTailSize);
+  } else {
+    tail += data;
+    if (tail.size() > kTailSize) tail.erase(0, tail.size() - kTailSize);
+  }
+  size_t start = 0;
+  for (auto i = data.find('\n'); i != std::string::npos;
+       start = i + 1, i = data.find('\n', start)) {
+    partial.append(data, start, i - start);
+    if (header.empty()) {
+      boost::split(header, partial, boost::is_any_of(",\r"));
+    } else if (skip) {
+      --skip;
+      ++lines;
+    } else {
+      out->push_back(std::move(partial));
+      ++lines;
     }
+    partial.clear();
+  }
+  partial.append(data, start, std::string::npos);
+  return true;
+}
+
+int PB::CsvFile::Column(const char* name) const {
+  for (auto i = 0u; i < header.size(); ++i) {
+    if (header[i] == name) return i;
+  }
+  return -1;
+}
+
+bool PB::CheckAlive() {
+  struct stat attr;
+  auto now = time(NULL);
+  if (stat(order_file_.path.c_str(), &attr) || attr.st_mtime + 60 < now)
+    return false;
+  if (stat(trade_file_.path.c_str(), &attr) || attr.st_mtime + 60 < now)
+    return false;
+  return true;
+}
+
+bool PB::ReadOrderStatus() {
+  if (!order_file_.Read(&lines_)) {
+    connected_ = 0;
+    return false;
   }
+  if (lines_.empty()) return true;
+  auto& f = order_file_;
+  // tou zi bei zhu
+  auto i_tag = f.Column("\xcd\xb6\xd7\xca\xb1\xb8\xd7\xa2");
+  // zhi ling bian hao
+  auto i_cmd_id = f.Column("\xd6\xb8\xc1\xee\xb1\xe0\xba\xc5");
+  // wei tuo zhuang tai
+  auto istatus_ = f.Column("\xce\xaf\xcd\xd0\xd7\xb4\xcc\xac");
+  // he tong bian hao
+  auto i_order_id = f.Column("\xba\xcf\xcd\xac\xb1\xe0\xba\xc5");
+  // fei dan yuan yin
+  auto i_reason = f.Column("\xb7\xcf\xb5\xa5\xd4\xad\xd2\xf2");
   if (i_tag < 0 || i_cmd_id < 0 || istatus_ < 0 || i_order_id < 0 ||
       i_reason < 0) {
     LOG_ERROR(name() << ": invalid order status file");
-    return;
+    return false;
   }
 
   // to-do: time
 
-  static thread_local std::unordered_map<int64_t, int64_t> kTag2Cmd;
-  while (std::getline(ifs, line)) {
+  auto n = std::max({i_tag, i_cmd_id, istatus_, i_order_id, i_reason});
+  std::vector<std::string> toks;
+  for (auto& line : lines_) {
     boost::split(toks, line, boost::is_any_of(",\r"));
-    if (static_cast<int>(toks.size()) < i_tag + 1) continue;
-    if (static_cast<int>(toks.size()) < i_cmd_id + 1) continue;
-    if (static_cast<int>(toks.size()) < istatus_ + 1) continue;
-    if (static_cast<int>(toks.size()) < i_order_id + 1) continue;
-    if (static_cast<int>(toks.size()) < i_reason + 1) continue;
+    if (static_cast<int>(toks.size()) < n + 1) continue;
     if (toks[i_tag].empty()) continue;
-    std::string reason;
     auto tag = atoll(toks[i_tag].c_str());
     if (tag <= 0) continue;
-    kTag2Cmd[tag] = atoll(toks[i_cmd_id].c_str());
+    tag2cmd_[tag] = atoll(toks[i_cmd_id].c_str());
     auto status = toks[istatus_];
     auto& status0 = status_[tag];
     if (status0 != status) {
@@ -115,55 +215,47 @@ inline void PB::LoopAction() {
       }
     }
   }
-  ifs.close();
-  ifs.open(trade_file.c_str());
-  if (!ifs.good()) {
+  return true;
+}
+
+// duplicated trades of a rewritten file are dropped by their exec ids
+bool PB::ReadTrades() {
+  if (!trade_file_.Read(&lines_)) {
     connected_ = 0;
-    return;
+    return false;
   }
   connected_ = 1;
-  std::getline(ifs, line);
-  boost::split(toks, line, boost::is_any_of(",\r"));
-  i_tag = -1;
-  int i_px = -1;
-  int i_qty = -1;
-  int i_trade_id = -1;
-  i_order_id = -1;
-  for (auto i = 0; i < static_cast<int>(toks.size()); ++i) {
-    if (toks[i] == "\xcd\xb6\xd7\xca\xb1\xb8\xd7\xa2") {  // tou zi bei zhu
-      i_tag = i;
-    } else if (toks[i] ==
-               "\xb3\xc9\xbd\xbb\xbc\xdb\xb8\xf1") {  // cheng jiao jia ge
-      i_px = i;
-    } else if (toks[i] ==
-               "\xb3\xc9\xbd\xbb\xca\xfd\xc1\xbf") {  // cheng jiao shu liang
-      i_qty = i;
-    } else if (toks[i] ==
-               "\xb3\xc9\xbd\xbb\xb1\xe0\xba\xc5") {  // cheng jiao bian hao
-      i_trade_id = i;
-    } else if (toks[i] ==
-               "\xba\xcf\xcd\xac\xb1\xe0\xba\xc5") {  // he tong bian hao
-      i_order_id = i;
-    }
-  }
+  if (lines_.empty()) return true;
+  auto& f = trade_file_;
+  // tou zi bei zhu
+  auto i_tag = f.Column("\xcd\xb6\xd7\xca\xb1\xb8\xd7\xa2");
+  // cheng jiao jia ge
+  auto i_px = f.Column("\xb3\xc9\xbd\xbb\xbc\xdb\xb8\xf1");
+  // cheng jiao shu liang
+  auto i_qty = f.Column("\xb3\xc9\xbd\xbb\xca\xfd\xc1\xbf");
+  // cheng jiao bian hao
+  auto i_trade_id = f.Column("\xb3\xc9\xbd\xbb\xb1\xe0\xba\xc5");
+  // he tong bian hao
+  auto i_order_id = f.Column("\xba\xcf\xcd\xac\xb1\xe0\xba\xc5");
   if (i_tag < 0 || i_px < 0 || i_qty < 0 || i_trade_id < 0 || i_order_id < 0) {
     LOG_ERROR(name() << ": invalid trade file");
-    return;
+    return false;
   }
-  while (std::getline(ifs, line)) {
+  auto n = std::max({i_tag, i_px, i_qty, i_trade_id, i_order_id});
+  std::vector<std::string> toks;
+  for (auto& line : lines_) {
     boost::split(toks, line, boost::is_any_of(",\r"));
-    if (static_cast<int>(toks.size()) < i_tag + 1) continue;
-    if (static_cast<int>(toks.size()) < i_px + 1) continue;
-    if (static_cast<int>(toks.size()) < i_qty + 1) continue;
-    if (static_cast<int>(toks.size()) < i_trade_id + 1) continue;
-    if (static_cast<int>(toks.size()) < i_order_id + 1) continue;
-    auto trade_id = toks[i_trade_id];
+    if (static_cast<int>(toks.size()) < n + 1) continue;
+    auto& trade_id = toks[i_trade_id];
     auto tag = atoll(toks[i_tag].c_str());
     if (tag <= 0) continue;
-    if (!trades_readed_.insert(trade_id).second) continue;
     HandleFill(tag, atof(toks[i_qty].c_str()), atof(toks[i_px].c_str()),
                trade_id);
   }
+  return true;
+}
+
+void PB::SendCommands() {
   static const std::string kCmdFile = dir_ + "/command.csv";
   if (std::ifstream(kCmdFile.c_str()).good()) {
     LOG_ERROR(name() << ": command.csv exists");
@@ -179,8 +271,8 @@ inline void PB::LoopAction() {
     of << "orderparam=<tag>note=" << pair.first << "</tag>\r\n";
   }
   for (auto it = pending_cancels_.begin(); it != pending_cancels_.end();) {
-    auto it2 = kTag2Cmd.find(*it);
-    if (it2 == kTag2Cmd.end()) {
+    auto it2 = tag2cmd_.find(*it);
+    if (it2 == tag2cmd_.end()) {
       ++it;
       continue;
     }
@@ -194,6 +286,16 @@ inline void PB::LoopAction() {
   orders_.clear();  // for safety, always clear even above failed
 }
 
+inline void PB::LoopAction() {
+  if (!CheckAlive()) {
+    connected_ = 0;
+    return;
+  }
+  if (!ReadOrderStatus()) return;
+  if (!ReadTrades()) return;
+  SendCommands();
+}
+
 void PB::Loop() {
   LoopAction();
   tp_.AddTask([this]() { Loop(); }, boost::posix_time::milliseconds(interval_));
@@ -210,6 +312,7 @@ std::string PB::Cancel(const opentrade::Order& ord) noexcept {
       return;
     }
     pending_cancels_.insert(orig_id);
+    SendCommands();
   });
   return {};
 }
@@ -225,7 +328,10 @@ std::string PB::Place(const opentrade::Order& ord) noexcept {
   else
     exch_order.mode = "24";
   exch_order.symbol = ord.sec->symbol;
-  tp_.AddTask([this, id, exch_order]() { orders_[id] = exch_order; });
+  tp_.AddTask([this, id, exch_order]() {
+    orders_[id] = exch_order;
+    SendCommands();
+  });
   return {};
 }
 
@@ -1,9 +1,18 @@
 #ifndef ADAPTERS_THINKTRADER_PB_PB_H_
 #define ADAPTERS_THINKTRADER_PB_PB_H_
 
+#include <sys/types.h>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
 #include "opentrade/exchange_connectivity.h"
 
 // http://www.thinktrader.net/, 迅投
+// The order status and trade files are read on inotify events of dir, from
+// where they were left, interval is only the heartbeat of the file checks.
 class PB : public opentrade::ExchangeConnectivityAdapter {
  public:
   void Start() noexcept override;
@@ -21,10 +30,35 @@ class PB : public opentrade::ExchangeConnectivityAdapter {
     std::string mode;
     std::string symbol;
   };
+  // csv file written by PB, the lines appended since the last read
+  struct CsvFile {
+    std::string path;
+    bool replay = false;  // all lines again once the file is rewritten
+    ino_t ino = 0;
+    off_t offset = 0;
+    size_t lines = 0;  // data lines read
+    size_t skip = 0;   // of a rewritten file, read before
+    std::string tail;  // the bytes before offset, to detect a rewrite
+    std::string partial;
+    std::vector<std::string> header;
+    bool Read(std::vector<std::string>* out);
+    int Column(const char* name) const;
+  };
+  void Watch();
+  void Schedule();
+  bool CheckAlive();
+  bool ReadOrderStatus();
+  bool ReadTrades();
+  void SendCommands();
+
   std::unordered_map<int64_t, Order> orders_;
   std::unordered_set<int64_t> pending_cancels_;
-  std::unordered_set<std::string> trades_readed_;
   std::unordered_map<int64_t, std::string> status_;
+  std::unordered_map<int64_t, int64_t> tag2cmd_;
+  CsvFile order_file_;
+  CsvFile trade_file_;
+  std::vector<std::string> lines_;
+  std::atomic<bool> scheduled_ = false;
   int interval_ = 1000;  // ms
   std::string dir_;
   std::string channel_;
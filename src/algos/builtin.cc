@@ -0,0 +1,33 @@
+#include "builtin.h"
+
+#include "opentrade/logger.h"
+#include "peg/peg.h"
+#include "pov/pov.h"
+#include "smartroute/smartroute.h"
+#include "twap/twap.h"
+#include "vwap/vwap.h"
+
+namespace opentrade {
+
+template <typename T>
+static void Add(const std::string& name) {
+  auto& mngr = AlgoManager::Instance();
+  if (mngr.GetAdapter(name)) {
+    LOG_INFO("Built-in algo " << name << " replaced by the loaded one");
+    return;
+  }
+  auto algo = new T;
+  algo->set_create_func([]() { return new T; });
+  algo->set_name(name);
+  mngr.AddAdapter(algo);
+}
+
+void AddBuiltinAlgos() {
+  Add<TwapAlgo>("TWAP");
+  Add<VWAP>("VWAP");
+  Add<Pov>("POV");
+  Add<Peg>("Peg");
+  Add<SmartRoute>("SmartRoute");
+}
+
+}  // namespace opentrade
@@ -0,0 +1,13 @@
+#ifndef ALGOS_BUILTIN_H_
+#define ALGOS_BUILTIN_H_
+
+namespace opentrade {
+
+// The stock C++ algos linked into the executable, added under their usual
+// names unless an algo of the name is loaded already, e.g. a .so of the algo
+// directory, which keeps replacing a stock one.
+void AddBuiltinAlgos();
+
+}  // namespace opentrade
+
+#endif  // ALGOS_BUILTIN_H_
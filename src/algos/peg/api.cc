@@ -0,0 +1,5 @@
+#include "peg.h"
+
+extern "C" {
+opentrade::Adapter* create() { return new opentrade::Peg{}; }
+}
@@ -1,8 +1,11 @@
+#ifndef ALGOS_PEG_PEG_H_
+#define ALGOS_PEG_PEG_H_
+
 #include "../twap/twap.h"
 
 namespace opentrade {
 
-struct Peg : public TWAP {
+struct Peg final : public TwapT<Peg> {
   const ParamDefs& GetParamDefs() noexcept override { return kCommonParamDefs; }
 
   std::string OnStart(const ParamMap& params) noexcept override {
@@ -12,13 +15,16 @@ struct Peg : public TWAP {
     return {};
   }
 
-  double GetLeaves() noexcept override {
+  double GetLeaves() noexcept {
     return st_.qty - inst_->total_exposure();
   }
+
+  // not time driven but for the trade period
+  time_t NextSliceTime(time_t now) noexcept {
+    return inst_->sec().IsInTradePeriod() ? end_time_ + 1 : now + 1;
+  }
 };
 
 }  // namespace opentrade
 
-extern "C" {
-opentrade::Adapter* create() { return new opentrade::Peg{}; }
-}
+#endif  // ALGOS_PEG_PEG_H_
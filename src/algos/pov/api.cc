@@ -0,0 +1,5 @@
+#include "pov.h"
+
+extern "C" {
+opentrade::Adapter* create() { return new opentrade::Pov{}; }
+}
@@ -1,15 +1,25 @@
+#ifndef ALGOS_POV_POV_H_
+#define ALGOS_POV_POV_H_
+
 #include "../twap/twap.h"
+#include "opentrade/rolling_volume.h"
 
 namespace opentrade {
 
-struct Pov : public TWAP {
+struct Pov final : public TwapT<Pov> {
   std::string OnStart(const ParamMap& params) noexcept override {
     auto err = TWAP::OnStart(params);
     if (!err.empty()) return err;
     if (max_pov_ <= 0) return "MaxPov required";
     window_ = GetParam(params, "Window", 0) * 60;
     if (window_ > 0) {
-      roll_market_vol_.Initialize(window_, initial_volume_);
+      // the shared market volume if its handler runs, not in backtest
+      shared_ = window_ <= RollingVolume::kMaxWindow &&
+                IndicatorHandlerManager::Instance().Get(kRollingVolume);
+      if (shared_)
+        inst_->Subscribe(kRollingVolume);
+      else
+        roll_market_vol_.Initialize(window_, initial_volume_);
       roll_my_vol_.Initialize(window_, 0);
     }
     return {};
@@ -23,10 +33,12 @@ struct Pov : public TWAP {
     return kDefs;
   }
 
-  double GetLeaves() noexcept override {
+  double GetLeaves() noexcept {
     double exposure, pov;
     if (window_ > 0) {
-      pov = roll_market_vol_.GetValue();
+      auto rolling = inst_->Get<RollingVolume>();
+      pov = rolling ? rolling->Get(GetTime(), window_, start_time_)
+                    : roll_market_vol_.GetValue();
       exposure = roll_my_vol_.GetValue() + inst_->total_outstanding_qty();
     } else {
       pov = md().trade.volume - initial_volume_;
@@ -36,13 +48,23 @@ struct Pov : public TWAP {
     return pov + (min_size_ > 0 ? min_size_ : inst_->sec().lot_size) - exposure;
   }
 
+  // the leaves grow with the market volume
+  void OnMarketTrade(const Instrument& inst, const MarketData& md,
+                     const MarketData& md0) noexcept override {
+    DeferBatch();
+  }
+
+  time_t NextSliceTime(time_t now) noexcept {
+    return window_ > 0 ? now + 1 : end_time_ + 1;
+  }
+
   void Timer() noexcept override {
     if (window_ > 0) {
       auto time = GetTime();
-      roll_market_vol_.Update(md().trade.volume, time);
+      if (!shared_) roll_market_vol_.Update(md().trade.volume, time);
       roll_my_vol_.Update(inst_->cum_qty(true), time);
     }
-    TWAP::Timer();
+    TwapT::Timer();
   }
 
   void OnStop() noexcept override {
@@ -53,12 +75,12 @@ struct Pov : public TWAP {
 
  private:
   int window_ = 0;
+  bool shared_ = false;
   RollDelta<MarketData::Volume> roll_market_vol_{0, 0};
+  // own fills only, sparse
   RollDelta<MarketData::Volume> roll_my_vol_{0, 0};
 };
 
 }  // namespace opentrade
 
-extern "C" {
-opentrade::Adapter* create() { return new opentrade::Pov{}; }
-}
+#endif  // ALGOS_POV_POV_H_
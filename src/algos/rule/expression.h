@@ -0,0 +1,313 @@
+#ifndef ALGOS_RULE_EXPRESSION_H_
+#define ALGOS_RULE_EXPRESSION_H_
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace opentrade {
+
+// Arithmetic and boolean expression over market data variables, e.g.
+//   ask_price - bid_price <= 0.02 && bid_size > 2 * ask_size
+// compiled once into postfix code, Evaluate runs on a fixed stack without
+// allocation. Boolean results are 1 or 0, any non-zero value is true.
+class Expression {
+ public:
+  enum Var {
+    kBidPrice,
+    kAskPrice,
+    kBidSize,
+    kAskSize,
+    kMid,
+    kSpread,
+    kLastPrice,
+    kLastQty,
+    kOpen,
+    kHigh,
+    kLow,
+    kVwap,
+    kVolume,
+    kNetQty,    // filled by this algo, negative if sold
+    kPosition,  // of the sub account
+    kNumVars,
+  };
+  typedef std::array<double, kNumVars> Vars;
+  static inline const int kMaxDepth = 32;
+
+  static const char* Name(Var v) {
+    static const char* kNames[] = {
+        "bid_price", "ask_price", "bid_size", "ask_size", "mid",
+        "spread",    "last_price", "last_qty", "open",    "high",
+        "low",       "vwap",      "volume",   "net_qty",  "position"};
+    static_assert(sizeof(kNames) / sizeof(kNames[0]) == kNumVars);
+    return kNames[v];
+  }
+
+  // returns error message, empty if succeeded
+  std::string Compile(const std::string& src) {
+    code_.clear();
+    used_ = 0;
+    Parser p{src.c_str(), this};
+    if (p.Or() && p.Skip() && *p.s) p.Fail("unexpected character");
+    if (p.err.empty() && code_.empty()) p.Fail("empty expression");
+    if (!p.err.empty()) {
+      code_.clear();
+      return p.err + " at " + std::to_string(p.s - src.c_str()) + " of \"" +
+             src + '"';
+    }
+    return {};
+  }
+
+  double Evaluate(const Vars& vars) const {
+    double stack[kMaxDepth];
+    auto sp = stack;
+    for (auto& op : code_) {
+      switch (op.code) {
+        case kConst:
+          *sp++ = op.value;
+          continue;
+        case kLoad:
+          *sp++ = vars[op.var];
+          continue;
+        case kNeg:
+          sp[-1] = -sp[-1];
+          continue;
+        case kNot:
+          sp[-1] = !sp[-1];
+          continue;
+        case kAbs:
+          sp[-1] = std::abs(sp[-1]);
+          continue;
+        default:
+          break;
+      }
+      auto b = *--sp;
+      auto& a = sp[-1];
+      switch (op.code) {
+        case kAdd:
+          a += b;
+          break;
+        case kSub:
+          a -= b;
+          break;
+        case kMul:
+          a *= b;
+          break;
+        case kDiv:
+          a /= b;
+          break;
+        case kLt:
+          a = a < b;
+          break;
+        case kLe:
+          a = a <= b;
+          break;
+        case kGt:
+          a = a > b;
+          break;
+        case kGe:
+          a = a >= b;
+          break;
+        case kEq:
+          a = a == b;
+          break;
+        case kNe:
+          a = a != b;
+          break;
+        case kAnd:
+          a = a && b;
+          break;
+        case kOr:
+          a = a || b;
+          break;
+        case kMin:
+          a = std::min(a, b);
+          break;
+        case kMax:
+          a = std::max(a, b);
+          break;
+        default:
+          break;
+      }
+    }
+    return code_.empty() ? 0 : stack[0];
+  }
+
+  bool empty() const { return code_.empty(); }
+  bool Uses(Var v) const { return used_ & (1u << v); }
+
+ private:
+  enum OpCode : uint8_t {
+    kConst,
+    kLoad,
+    kNeg,
+    kNot,
+    kAbs,
+    kAdd,
+    kSub,
+    kMul,
+    kDiv,
+    kLt,
+    kLe,
+    kGt,
+    kGe,
+    kEq,
+    kNe,
+    kAnd,
+    kOr,
+    kMin,
+    kMax,
+  };
+  struct Op {
+    OpCode code;
+    uint8_t var = 0;
+    double value = 0;
+  };
+
+  // recursive descent, precedence from low to high:
+  // || && comparison +- */ unary primary
+  struct Parser {
+    const char* s;
+    Expression* e;
+    int depth = 0;
+    std::string err;
+
+    bool Fail(const char* msg) {
+      if (err.empty()) err = msg;
+      return false;
+    }
+    bool Skip() {
+      while (std::isspace(*s)) ++s;
+      return true;
+    }
+    bool Match(const char* tok) {
+      Skip();
+      auto n = std::strlen(tok);
+      if (std::strncmp(s, tok, n)) return false;
+      s += n;
+      return true;
+    }
+    bool Emit(OpCode code, int delta, uint8_t var = 0, double value = 0) {
+      depth += delta;
+      if (depth > kMaxDepth) return Fail("expression too deep");
+      e->code_.push_back(Op{code, var, value});
+      return true;
+    }
+    bool Binary(OpCode code) { return Emit(code, -1); }
+
+    bool Or() {
+      if (!And()) return false;
+      while (Match("||")) {
+        if (!And() || !Binary(kOr)) return false;
+      }
+      return true;
+    }
+    bool And() {
+      if (!Compare()) return false;
+      while (Match("&&")) {
+        if (!Compare() || !Binary(kAnd)) return false;
+      }
+      return true;
+    }
+    bool Compare() {
+      if (!Sum()) return false;
+      for (;;) {
+        OpCode code;
+        // two character operators first
+        if (Match("<="))
+          code = kLe;
+        else if (Match(">="))
+          code = kGe;
+        else if (Match("=="))
+          code = kEq;
+        else if (Match("!="))
+          code = kNe;
+        else if (Match("<"))
+          code = kLt;
+        else if (Match(">"))
+          code = kGt;
+        else
+          return true;
+        if (!Sum() || !Binary(code)) return false;
+      }
+    }
+    bool Sum() {
+      if (!Product()) return false;
+      for (;;) {
+        OpCode code;
+        if (Match("+"))
+          code = kAdd;
+        else if (Match("-"))
+          code = kSub;
+        else
+          return true;
+        if (!Product() || !Binary(code)) return false;
+      }
+    }
+    bool Product() {
+      if (!Unary()) return false;
+      for (;;) {
+        OpCode code;
+        if (Match("*"))
+          code = kMul;
+        else if (Match("/"))
+          code = kDiv;
+        else
+          return true;
+        if (!Unary() || !Binary(code)) return false;
+      }
+    }
+    bool Unary() {
+      if (Match("-")) return Unary() && Emit(kNeg, 0);
+      if (Match("!")) return Unary() && Emit(kNot, 0);
+      if (Match("+")) return Unary();
+      return Primary();
+    }
+    bool Primary() {
+      Skip();
+      if (Match("(")) {
+        if (!Or()) return false;
+        return Match(")") || Fail("missing )");
+      }
+      if (std::isdigit(*s) || *s == '.') {
+        char* end;
+        auto v = std::strtod(s, &end);
+        if (end == s) return Fail("invalid number");
+        s = end;
+        return Emit(kConst, 1, 0, v);
+      }
+      if (!std::isalpha(*s) && *s != '_') return Fail("syntax error");
+      auto begin = s;
+      while (std::isalnum(*s) || *s == '_') ++s;
+      std::string name(begin, s);
+      if (name == "abs") {
+        if (!Match("(") || !Or() || !Match(")")) return Fail("abs(x)");
+        return Emit(kAbs, 0);
+      }
+      if (name == "min" || name == "max") {
+        if (!Match("(") || !Or() || !Match(",") || !Or() || !Match(")"))
+          return Fail("min(x, y) or max(x, y)");
+        return Binary(name == "min" ? kMin : kMax);
+      }
+      for (auto i = 0; i < kNumVars; ++i) {
+        if (name != Name(static_cast<Var>(i))) continue;
+        e->used_ |= 1u << i;
+        return Emit(kLoad, 1, i);
+      }
+      s = begin;
+      return Fail("unknown variable");
+    }
+  };
+
+  std::vector<Op> code_;
+  uint32_t used_ = 0;
+};
+
+}  // namespace opentrade
+
+#endif  // ALGOS_RULE_EXPRESSION_H_
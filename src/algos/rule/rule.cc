@@ -0,0 +1,126 @@
+#include <cmath>
+
+#include "expression.h"
+#include "opentrade/algo.h"
+#include "opentrade/logger.h"
+#include "opentrade/position.h"
+
+namespace opentrade {
+
+// Places an order whenever Condition holds on a market data update, e.g.
+//   Condition: ask_price <= 10.5 && ask_size >= 1000, Price: ask_price
+// the expressions are compiled at start and evaluated on the runner
+// thread, for simple signals which do not need python. One order at a
+// time, the next one is considered once it is done.
+class Rule : public Algo {
+ public:
+  std::string OnStart(const ParamMap& params) noexcept override {
+    st_ = GetParam(params, "Security", st_);
+    assert(st_.sec && st_.acc && st_.side && st_.qty > 0);
+    auto err = condition_.Compile(GetParam(params, "Condition", kEmptyStr));
+    if (!err.empty()) return "Condition: " + err;
+    auto price = GetParam(params, "Price", kEmptyStr);
+    if (price.empty()) price = IsBuy(st_.side) ? "ask_price" : "bid_price";
+    err = price_.Compile(price);
+    if (!err.empty()) return "Price: " + err;
+    max_floor_ = GetParam(params, "MaxFloor", 0);
+    auto seconds = GetParam(params, "ValidSeconds", 0);
+    if (seconds < 60) return "Too short ValidSeconds, must be >= 60";
+    inst_ = Subscribe(*st_.sec, st_.src);
+    SetTimeout([this]() { Stop(); }, seconds);
+    LOG_DEBUG('[' << name() << ' ' << id() << "] started");
+    return {};
+  }
+
+  void OnMarketTrade(const Instrument& inst, const MarketData& md,
+                     const MarketData& md0) noexcept override {
+    Check(md);
+  }
+
+  void OnMarketQuote(const Instrument& inst, const MarketData& md,
+                     const MarketData& md0) noexcept override {
+    Check(md);
+  }
+
+  void OnConfirmation(const Confirmation& cm) noexcept override {
+    if (inst_->cum_qty() >= st_.qty) Stop();
+  }
+
+  const ParamDefs& GetParamDefs() noexcept override {
+    static const ParamDefs kDefs{
+        {"Security", SecurityTuple{}, true},
+        {"Condition", "", true},
+        {"Price", "", false},
+        {"MaxFloor", 0, false, 0, 10000000},
+        {"ValidSeconds", 300, true, 60},
+    };
+    return kDefs;
+  }
+
+ private:
+  void Check(const MarketData& md) {
+    if (!inst_->active_orders().empty()) return;
+    auto leaves = st_.qty - inst_->total_exposure();
+    if (leaves <= 0) return;
+    Update(md);
+    if (!condition_.Evaluate(vars_)) return;
+    auto px = price_.Evaluate(vars_);
+    if (!(px > 0)) return;
+    auto& sec = inst_->sec();
+    auto qty = max_floor_ > 0 ? std::min<double>(leaves, max_floor_) : leaves;
+    if (sec.lot_size > 0 && !sec.exchange->odd_lot_allowed)
+      qty = std::floor(qty / sec.lot_size) * sec.lot_size;
+    if (qty <= 0) return;
+    auto tick_size = sec.GetTickSize(px);
+    if (tick_size > 0) {
+      px = (IsBuy(st_.side) ? std::floor(px / tick_size)
+                            : std::ceil(px / tick_size)) *
+           tick_size;
+    }
+    Contract c;
+    c.side = st_.side;
+    c.qty = qty;
+    c.price = px > 100 ? Round6(px) : Round8(px);
+    c.sub_account = st_.acc;
+    c.position_effect = st_.position_effect;
+    Place(c, inst_);
+  }
+
+  void Update(const MarketData& md) {
+    auto& q = md.quote();
+    auto& t = md.trade;
+    vars_[Expression::kBidPrice] = q.bid_price;
+    vars_[Expression::kAskPrice] = q.ask_price;
+    vars_[Expression::kBidSize] = q.bid_size;
+    vars_[Expression::kAskSize] = q.ask_size;
+    auto two_sided = q.bid_price > 0 && q.ask_price > 0;
+    vars_[Expression::kMid] = two_sided ? md.mid() : 0;
+    vars_[Expression::kSpread] = two_sided ? q.ask_price - q.bid_price : 0;
+    vars_[Expression::kLastPrice] = t.close;
+    vars_[Expression::kLastQty] = t.qty;
+    vars_[Expression::kOpen] = t.open;
+    vars_[Expression::kHigh] = t.high;
+    vars_[Expression::kLow] = t.low;
+    vars_[Expression::kVwap] = t.vwap;
+    vars_[Expression::kVolume] = t.volume;
+    vars_[Expression::kNetQty] = inst_->net_qty();
+    if (condition_.Uses(Expression::kPosition) ||
+        price_.Uses(Expression::kPosition)) {
+      vars_[Expression::kPosition] =
+          PositionManager::Instance().Get(*st_.acc, *st_.sec).qty;
+    }
+  }
+
+  Instrument* inst_ = nullptr;
+  SecurityTuple st_;
+  Expression condition_;
+  Expression price_;
+  Expression::Vars vars_{};
+  int max_floor_ = 0;
+};
+
+}  // namespace opentrade
+
+extern "C" {
+opentrade::Adapter* create() { return new opentrade::Rule{}; }
+}
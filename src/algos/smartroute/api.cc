@@ -0,0 +1,5 @@
+#include "smartroute.h"
+
+extern "C" {
+opentrade::Adapter* create() { return new opentrade::SmartRoute{}; }
+}
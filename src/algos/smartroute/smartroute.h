@@ -0,0 +1,195 @@
+#ifndef ALGOS_SMARTROUTE_SMARTROUTE_H_
+#define ALGOS_SMARTROUTE_SMARTROUTE_H_
+
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#include "../twap/twap.h"
+#include "opentrade/consolidation.h"
+
+namespace opentrade {
+
+// value per venue, "<value>[,<src>=<value>...]"
+class VenueTable {
+ public:
+  void Parse(const std::string& str) {
+    for (auto& tok : Split(str, ",")) {
+      auto pos = tok.find('=');
+      if (pos == std::string::npos) {
+        default_ = atof(tok.c_str());
+        continue;
+      }
+      by_src_[DataSrc::GetId(tok.substr(0, pos).c_str())] =
+          atof(tok.c_str() + pos + 1);
+    }
+  }
+
+  double Get(DataSrc src) const {
+    auto it = by_src_.find(src);
+    return it == by_src_.end() ? default_ : it->second;
+  }
+
+ private:
+  double default_ = 0;
+  std::unordered_map<DataSrc::IdType, double> by_src_;
+};
+
+// IOC fill rate per venue of all the smart routes on a runner, decayed so
+// that recent sweeps weigh more
+class VenueStats {
+ public:
+  static VenueStats& Instance() {
+    static thread_local VenueStats kInstance;
+    return kInstance;
+  }
+
+  double FillRate(DataSrc src) const {
+    auto it = stats_.find(src);
+    if (it == stats_.end() || it->second.sent <= 0) return 1;
+    return it->second.filled / it->second.sent;
+  }
+
+  void Update(DataSrc src, double sent, double filled) {
+    auto& s = stats_[src];
+    s.sent = s.sent * kDecay + sent;
+    s.filled = s.filled * kDecay + filled;
+  }
+
+ private:
+  static inline const double kDecay = 0.9;
+  struct Stat {
+    double sent = 0;
+    double filled = 0;
+  };
+  std::unordered_map<DataSrc::IdType, Stat> stats_;
+};
+
+// Sweeps the venues of the consolidated book in parallel each slice, ranked
+// by price net of fees, then by the displayed size weighted with the venue's
+// fill rate, then by latency. The IOC children go out in one pass, the
+// slowest venue first so that they arrive together; the rest of the slice
+// rests on the top venue as before.
+//   fees=0.2,ARCA=-0.2: bps of the price, negative for rebates
+//   latencies=500,BATS=200: microseconds to the venue
+struct SmartRoute final : public TwapT<SmartRoute> {
+  static inline VenueTable kFees;
+  static inline VenueTable kLatencies;
+
+  void Start() noexcept override {
+    kFees.Parse(config("fees"));
+    kLatencies.Parse(config("latencies"));
+  }
+
+  Instrument* Subscribe() override {
+    st_.src = kConsolidationSrc;
+    auto inst = TWAP::Subscribe();
+    inst->Subscribe(kConsolidation);
+    return inst;
+  }
+
+  const MarketData& md() {
+    auto book = inst_->Get<ConsolidationBook>();
+    assert(book);
+    auto top = book->top();
+    auto dest = IsBuy(st_.side) ? top.bid.inst : top.ask.inst;
+    if (dest) {
+      dest_ = dest->src().str();
+      return dest->md();
+    }
+    return inst_->md();
+  }
+
+  // the consolidated book is not a quote event, keeps the 1 second cadence
+  time_t NextSliceTime(time_t now) noexcept { return now + 1; }
+
+  void Place(Contract* c) {
+    auto book = inst_->Get<ConsolidationBook>();
+    legs_.clear();
+    if (book) {
+      book->Sweep(c->IsBuy(), std::numeric_limits<MarketData::Qty>::max(),
+                  &legs_, c->type == kMarket ? 0 : c->price);
+    }
+    Rank(c->IsBuy());
+    auto lot_size = inst_->sec().lot_size;
+    if (inst_->sec().exchange->odd_lot_allowed) lot_size = 0;
+    auto n = 0u;
+    for (auto leg : legs_) {
+      double qty = std::min<double>(leg.size, c->qty);
+      if (lot_size > 0) qty = std::floor(qty / lot_size) * lot_size;
+      if (qty <= 0) continue;
+      leg.size = qty;
+      legs_[n++] = leg;
+      c->qty -= qty;
+    }
+    legs_.resize(n);
+    std::stable_sort(legs_.begin(), legs_.end(), [](auto& a, auto& b) {
+      return kLatencies.Get(a.inst->src()) > kLatencies.Get(b.inst->src());
+    });
+    for (auto& leg : legs_) {
+      Contract child = *c;
+      child.type = kLimit;
+      child.tif = kImmediateOrCancel;
+      child.price = leg.price;
+      child.qty = leg.size;
+      child.destination = leg.inst->src().str();
+      Algo::Place(child, inst_);
+    }
+    if (c->qty <= 0) return;
+    c->destination = dest_;
+    Algo::Place(*c, inst_);
+  }
+
+  void OnConfirmation(const Confirmation& cm) noexcept override {
+    auto ord = cm.order;
+    if (ord->tif == kImmediateOrCancel && !ord->IsLive()) {
+      switch (cm.exec_type) {
+        case kFilled:
+        case kCanceled:
+        case kExpired:
+        case kDoneForDay:
+          VenueStats::Instance().Update(DataSrc(ord->destination), ord->qty,
+                                        ord->cum_qty);
+          break;
+        default:
+          break;
+      }
+    }
+    TWAP::OnConfirmation(cm);
+  }
+
+  void Rank(bool buy) {
+    auto& stats = VenueStats::Instance();
+    for (auto& leg : legs_) {
+      auto src = leg.inst->src();
+      auto fee = kFees.Get(src) / 1e4;
+      auto cost = buy ? leg.price * (1 + fee) : -leg.price * (1 - fee);
+      candidates_.push_back(Candidate{leg, cost, leg.size * stats.FillRate(src),
+                                      kLatencies.Get(src)});
+    }
+    std::stable_sort(candidates_.begin(), candidates_.end(),
+                     [](auto& x, auto& y) {
+                       if (x.cost != y.cost) return x.cost < y.cost;
+                       if (x.expected != y.expected)
+                         return x.expected > y.expected;
+                       return x.latency < y.latency;
+                     });
+    for (auto i = 0u; i < legs_.size(); ++i) legs_[i] = candidates_[i].leg;
+    candidates_.clear();
+  }
+
+  struct Candidate {
+    SweepLeg leg;
+    double cost;      // per share net of fees, negated for sells
+    double expected;  // displayed size times fill rate
+    double latency;
+  };
+  std::string dest_;
+  std::vector<SweepLeg> legs_;
+  std::vector<Candidate> candidates_;
+};
+
+}  // namespace opentrade
+
+#endif  // ALGOS_SMARTROUTE_SMARTROUTE_H_
@@ -1,5 +1,5 @@
 #include "twap.h"
 
 extern "C" {
-opentrade::Adapter* create() { return new opentrade::TWAP{}; }
+opentrade::Adapter* create() { return new opentrade::TwapAlgo{}; }
 }
@@ -17,10 +17,51 @@ static thread_local std::mt19937 kRandomGen{
 };
 static thread_local std::uniform_real_distribution<> kRandom{-0.01, 0.01};
 
-Instrument* TWAP::Subscribe() {
-  return Algo::Subscribe(*st_.sec, st_.src, false);
+void SliceScheduler::Schedule(TWAP* algo, time_t tm) {
+  if (algo->slice_tm_ == tm) return;
+  if (algo->slice_tm_) queue_.erase(std::make_pair(algo->slice_tm_, algo));
+  algo->slice_tm_ = tm;
+  queue_.emplace(tm, algo);
+  Arm();
 }
 
+void SliceScheduler::Remove(TWAP* algo) {
+  if (algo->slice_tm_) queue_.erase(std::make_pair(algo->slice_tm_, algo));
+  algo->slice_tm_ = 0;
+  if (owner_ == algo) {
+    algo->CancelTimeout(timer_);
+    owner_ = nullptr;
+  }
+  Arm();
+}
+
+void SliceScheduler::Arm() {
+  if (queue_.empty()) return;
+  auto& first = *queue_.begin();
+  if (owner_ && armed_ <= first.first) return;
+  if (owner_) owner_->CancelTimeout(timer_);
+  owner_ = first.second;
+  armed_ = first.first;
+  timer_ = owner_->SetTimeout([this]() { Run(); }, armed_ - GetTime());
+}
+
+void SliceScheduler::Run() {
+  owner_ = nullptr;
+  auto now = GetTime();
+  std::vector<TWAP*> due;
+  while (!queue_.empty() && queue_.begin()->first <= now) {
+    due.push_back(queue_.begin()->second);
+    due.back()->slice_tm_ = 0;
+    queue_.erase(queue_.begin());
+  }
+  for (auto algo : due) {
+    if (algo->is_active()) algo->Timer();
+  }
+  Arm();
+}
+
+Instrument* TWAP::Subscribe() { return Algo::Subscribe(*st_.sec, st_.src); }
+
 std::string TWAP::OnStart(const ParamMap& params) noexcept {
   st_ = GetParam(params, "Security", st_);
   auto sec = st_.sec;
@@ -103,27 +144,47 @@ void TWAP::OnModify(const ParamMap& params) noexcept {
 }
 
 void TWAP::OnStop() noexcept {
+  SliceScheduler::Instance().Remove(this);
   inst_->Clear();
   LOG_DEBUG('[' << name() << ' ' << id() << "] stopped");
 }
 
 void TWAP::OnMarketTrade(const Instrument& inst, const MarketData& md,
                          const MarketData& md0) noexcept {
-  auto& t = md.trade;
-  LOG_DEBUG(inst.sec().symbol << " trade: " << t.open << ' ' << t.high << ' '
-                              << t.low << ' ' << t.close << ' ' << t.qty << ' '
-                              << t.vwap << ' ' << t.volume);
+  if (wait_ & kWaitTrade) DeferBatch();
 }
 
 void TWAP::OnMarketQuote(const Instrument& inst, const MarketData& md,
                          const MarketData& md0) noexcept {
+  if (!(wait_ & kWaitQuote)) return;
   auto& q = md.quote();
-  LOG_DEBUG(inst.sec().symbol << " quote: " << q.ask_price << ' ' << q.ask_size
-                              << ' ' << q.bid_price << ' ' << q.bid_size);
+  auto& q0 = md0.quote();
+  if (q.bid_price != q0.bid_price || q.ask_price != q0.ask_price)
+    DeferBatch();
 }
 
 void TWAP::OnConfirmation(const Confirmation& cm) noexcept {
-  if (inst_->cum_qty() >= st_.qty) Stop();
+  if (inst_->cum_qty() >= st_.qty) {
+    Stop();
+    return;
+  }
+  switch (cm.exec_type) {
+    case kPartiallyFilled:
+    case kFilled:
+    case kCanceled:
+    case kExpired:
+    case kDoneForDay:
+      break;
+    default:
+      return;  // rejects are retried on the next boundary
+  }
+  // not within Place which may confirm synchronously
+  if (async_) return;
+  async_ = true;
+  Async([this]() {
+    async_ = false;
+    Timer();
+  });
 }
 
 const ParamDefs& TWAP::GetParamDefs() noexcept {
@@ -145,104 +206,113 @@ double TWAP::GetLeaves() noexcept {
   return expect - inst_->total_exposure();
 }
 
-void TWAP::Timer() noexcept {
-  auto now = GetTime();
-  if (now > end_time_) {
-    Stop();
-    return;
-  }
-  SetTimeout([this]() { Timer(); }, 1);
-  if (!inst_->sec().IsInTradePeriod()) return;
+time_t TWAP::NextSliceTime(time_t now) noexcept {
+  if (!inst_->sec().IsInTradePeriod()) return now + 1;
+  auto ratio = inst_->total_exposure() / st_.qty - random_ * 0.01;
+  if (ratio <= 0) return now + 1;
+  if (tilt_ != 1.) ratio = pow(ratio, 1 / tilt_);
+  auto tm = start_time_ - 1 + ratio * ((end_time_ - start_time_) + 1.);
+  return std::max(now + 1, static_cast<time_t>(std::ceil(tm)));
+}
 
-  auto& md = this->md();
+bool TWAP::Prepare(const MarketData& md, Contract* c) noexcept {
   auto bid = md.quote().bid_price;
   auto ask = md.quote().ask_price;
   // md.trade.close may be not rounded
   auto last_px = RoundPrice(md.trade.close);
   auto mid_px = 0.;
   if (ask > bid && bid > 0) mid_px = RoundPrice((ask + bid) / 2);
-  Contract c;
   switch (agg_) {
     case kAggLow:
       if (IsBuy(st_.side)) {
         if (bid > 0)
-          c.price = bid;
+          c->price = bid;
         else if (last_px > 0)
-          c.price = last_px;
-        else
-          return;
+          c->price = last_px;
       } else {
         if (ask > 0)
-          c.price = ask;
+          c->price = ask;
         else if (last_px > 0)
-          c.price = last_px;
-        else
-          return;
+          c->price = last_px;
+      }
+      if (c->price <= 0) {
+        wait_ = kWaitQuote | kWaitTrade;
+        return false;
       }
       break;
     case kAggMedium:
       if (mid_px > 0) {
-        c.price = mid_px;
+        c->price = mid_px;
         break;
       }  // else go to kAggHigh
     case kAggHigh:
       if (IsBuy(st_.side)) {
         if (ask > 0) {
-          c.price = ask;
+          c->price = ask;
           break;
         }  // else go to kAggHighest
       } else {
         if (bid > 0) {
-          c.price = bid;
+          c->price = bid;
           break;
         }  // else go to kAggHighest
       }
     case kAggHighest:
     default:
-      c.type = kMarket;
+      c->type = kMarket;
       break;
   }
-  if (c.type != kMarket && price_ > 0 &&
-      ((IsBuy(st_.side) && c.price > price_) ||
-       (!IsBuy(st_.side) && c.price < price_))) {
-    c.price = price_;
+  if (c->type != kMarket && price_ > 0 &&
+      ((IsBuy(st_.side) && c->price > price_) ||
+       (!IsBuy(st_.side) && c->price < price_))) {
+    c->price = price_;
   }
-  if (not_lower_than_last_px_ && c.price < last_px) c.price = last_px;
+  if (not_lower_than_last_px_ && c->price < last_px) c->price = last_px;
 
   if (!inst_->active_orders().empty()) {
+    wait_ |= kWaitQuote;
     for (auto ord : inst_->active_orders()) {
-      if (c.price <= 0 || c.price == ord->price) continue;
+      if (c->price <= 0 || c->price == ord->price) continue;
       if (IsBuy(st_.side)) {
-        if (ord->price < bid) Cancel(*ord);
+        if (ord->price >= bid) continue;
       } else {
-        if (ask > 0 && ord->price > ask) Cancel(*ord);
+        if (ask <= 0 || ord->price <= ask) continue;
       }
+      // amended in one message where the venue allows, else cancelled
+      if (ord->replace_id) continue;
+      if (!Replace(*ord, ord->qty, c->price)) Cancel(*ord);
     }
-    return;
+    return false;
   }
 
   auto volume = md.trade.volume - initial_volume_;
   if (volume > 0 && max_pov_ > 0) {
-    if (inst_->cum_qty() - inst_->cum_cx_qty() > max_pov_ * volume) return;
+    if (inst_->cum_qty() - inst_->cum_cx_qty() > max_pov_ * volume) {
+      wait_ |= kWaitTrade;
+      return false;
+    }
   }
-  auto leaves = GetLeaves();
-  if (leaves <= 0) return;
+  return true;
+}
+
+bool TWAP::Size(double leaves, Contract* c) noexcept {
+  if (leaves <= 0) return false;
   auto total_leaves = st_.qty - inst_->total_exposure();
   auto lot_size = inst_->sec().lot_size;
   auto odd_ok = inst_->sec().exchange->odd_lot_allowed || (lot_size <= 0);
   if (lot_size <= 0) lot_size = std::max(1, min_size_);
   auto max_qty =
       odd_ok ? total_leaves : std::floor(total_leaves / lot_size) * lot_size;
-  if (max_qty <= 0) return;
+  if (max_qty <= 0) return false;
   auto would_qty = std::ceil(leaves / lot_size) * lot_size;
   if (would_qty < min_size_) would_qty = min_size_;
   if (max_floor_ > 0 && would_qty > max_floor_) would_qty = max_floor_;
   if (would_qty > max_qty) would_qty = max_qty;
-  c.side = st_.side;
-  c.qty = would_qty;
-  c.sub_account = st_.acc;
-  c.position_effect = st_.position_effect;
-  Place(&c);
+  c->side = st_.side;
+  c->qty = would_qty;
+  c->sub_account = st_.acc;
+  c->position_effect = st_.position_effect;
+  return true;
 }
 
 }  // namespace opentrade
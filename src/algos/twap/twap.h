@@ -1,6 +1,10 @@
 #ifndef ALGOS_TWAP_TWAP_H_
 #define ALGOS_TWAP_TWAP_H_
 
+#include <algorithm>
+#include <set>
+#include <utility>
+
 #include "opentrade/algo.h"
 #include "opentrade/security.h"
 
@@ -13,6 +17,34 @@ enum Aggression {
   kAggHighest,
 };
 
+class TWAP;
+
+// Slice boundaries of the TWAP family algos on one runner thread, one timer
+// armed at the earliest, owned by the algo due first.
+class SliceScheduler {
+ public:
+  static SliceScheduler& Instance() {
+    static thread_local SliceScheduler kInstance;
+    return kInstance;
+  }
+  // replaces the boundary scheduled before for algo
+  void Schedule(TWAP* algo, time_t tm);
+  void Remove(TWAP* algo);
+
+ private:
+  void Arm();
+  void Run();
+
+  std::set<std::pair<time_t, TWAP*>> queue_;
+  TWAP* owner_ = nullptr;
+  time_t armed_ = 0;
+  TimerId timer_ = 0;
+};
+
+// Event driven, a slice is recomputed on its boundary from NextSliceTime,
+// on the fills and cancels, and on the market data it waits for. The slice
+// hooks GetLeaves, NextSliceTime, md and Place are not virtual, an algo of
+// the family derives TwapT and hides those it changes.
 class TWAP : public Algo {
  public:
   std::string OnStart(const ParamMap& params) noexcept override;
@@ -24,28 +56,29 @@ class TWAP : public Algo {
                      const MarketData& md0) noexcept override;
   void OnConfirmation(const Confirmation& cm) noexcept override;
   const ParamDefs& GetParamDefs() noexcept override;
-  virtual void Timer() noexcept;
+  virtual void Timer() noexcept = 0;
   virtual Instrument* Subscribe();
-  virtual const MarketData& md() { return inst_->md(); }
-  virtual void Place(Contract* c) { Algo::Place(*c, inst_); }
-  virtual double GetLeaves() noexcept;
+  // the earliest time GetLeaves may turn positive
+  time_t NextSliceTime(time_t now) noexcept;
+  const MarketData& md() { return inst_->md(); }
+  void Place(Contract* c) { Algo::Place(*c, inst_); }
+  double GetLeaves() noexcept;
   std::string Modify(const ParamMap& params);
   double RoundPrice(double px) {
-    auto tick_size = inst_->sec().GetTickSize(px);
-    if (tick_size > 0) {
-      if (IsBuy(st_.side))
-        px = std::floor(px / tick_size) * tick_size;
-      else
-        px = std::ceil(px / tick_size) * tick_size;
-    }
-    if (px > 100) {
-      px = Round6(px);
-    } else {
-      px = Round8(px);
-    }
-    return px;
+    return inst_->sec().RoundPrice(px, IsBuy(st_.side));
   }
 
+ protected:
+  // the price of the slice, false if it waits, e.g. for the market data or
+  // for the live orders
+  bool Prepare(const MarketData& md, Contract* c) noexcept;
+  // the qty of the slice, false if none to place
+  bool Size(double leaves, Contract* c) noexcept;
+  enum : uint8_t {
+    kWaitQuote = 1,
+    kWaitTrade = 1 << 1,
+  };
+
  protected:
   Instrument* inst_ = nullptr;
   SecurityTuple st_;
@@ -60,8 +93,47 @@ class TWAP : public Algo {
   bool not_lower_than_last_px_ = false;
   double random_ = 0.;
   double tilt_ = 1.;
+  uint8_t wait_ = 0;  // market data the last slice waits for
+  bool async_ = false;
+  time_t slice_tm_ = 0;  // in SliceScheduler
+  friend class SliceScheduler;
 };
 
+// The slices of the TWAP family algo D, which is final, call the hooks of D
+// without the vtable.
+template <typename D>
+class TwapT : public TWAP {
+ public:
+  void OnMarketBatch() noexcept override { self()->Timer(); }
+
+  void Timer() noexcept override {
+    auto now = GetTime();
+    if (now > end_time_) {
+      Stop();
+      return;
+    }
+    wait_ = 0;
+    Slice();
+    if (!is_active()) return;
+    auto tm = std::min(self()->NextSliceTime(now), end_time_ + 1);
+    SliceScheduler::Instance().Schedule(this, tm);
+  }
+
+ protected:
+  D* self() { return static_cast<D*>(this); }
+
+  void Slice() noexcept {
+    if (!inst_->sec().IsInTradePeriod()) return;
+    Contract c;
+    if (!Prepare(self()->md(), &c)) return;
+    if (!Size(self()->GetLeaves(), &c)) return;
+    self()->Place(&c);
+    wait_ |= kWaitQuote;
+  }
+};
+
+class TwapAlgo final : public TwapT<TwapAlgo> {};
+
 }  // namespace opentrade
 
 #endif  // ALGOS_TWAP_TWAP_H_
@@ -0,0 +1,5 @@
+#include "vwap.h"
+
+extern "C" {
+opentrade::Adapter* create() { return new opentrade::VWAP{}; }
+}
@@ -1,75 +1,193 @@
 #ifndef ALGOS_VWAP_VOLUME_PROFILE_H_
 #define ALGOS_VWAP_VOLUME_PROFILE_H_
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <vector>
+
 #include "opentrade/logger.h"
+#include "opentrade/pipe_stream.h"
 #include "opentrade/security.h"
+#include "opentrade/text_parser.h"
 
 namespace opentrade {
 
+// Per minute cumulative volume fractions of the day, one row of kMinutes
+// floats per security. The binary file is mmapped and shared, the text file
+// of "<security id> HH:MM <volume>" lines is converted in memory, see Save
+// and scripts/convert_volume_profile.py.
+// Binary: Header, uint32 ids[count] ascending, float rows[count][kMinutes].
 struct VolumeProfile {
+  static inline const uint32_t kMinutes = 24 * 60;
+  static inline const uint32_t kVersion = 1;
+  struct Header {
+    char magic[4];  // "OTVP"
+    uint32_t version;
+    uint32_t count;
+    uint32_t minutes;
+  };
+
+  // per minute volumes, kMinutes of each security
+  typedef std::map<Security::IdType, std::vector<double>> Volumes;
+
   explicit VolumeProfile(const char* file) {
+    if (!Map(file)) Load(file);
+  }
+  // e.g. of volume_profile_builder to Save
+  explicit VolumeProfile(const Volumes& volumes) { Build(volumes); }
+
+  ~VolumeProfile() {
+    if (map_) munmap(map_, map_size_);
+  }
+
+  VolumeProfile(const VolumeProfile&) = delete;
+  VolumeProfile& operator=(const VolumeProfile&) = delete;
+
+  // cumulative fractions of a window, a view into the rows without copy
+  class Profile {
+   public:
+    Profile() = default;
+    size_t size() const { return size_; }
+    bool empty() const { return !size_; }
+    float operator[](size_t i) const { return (cum_[i] - base_) / total_; }
+
+   private:
+    Profile(const float* cum, float base, float total, size_t size)
+        : cum_(cum), base_(base), total_(total), size_(size) {}
+    const float* cum_ = nullptr;
+    float base_ = 0;
+    float total_ = 1;
+    size_t size_ = 0;
+    friend struct VolumeProfile;
+  };
+
+  // [start, end] in minutes since midnight, up to the last minute traded
+  Profile Get(Security::IdType id, int start, int end) const {
+    if (start >= end || start < 0 || start >= static_cast<int>(kMinutes))
+      return {};
+    if (end >= static_cast<int>(kMinutes)) end = kMinutes - 1;
+    auto it = std::lower_bound(ids_, ids_ + count_, id);
+    if (it == ids_ + count_ || *it != id) return {};
+    auto row = rows_ + (it - ids_) * kMinutes;
+    auto base = start ? row[start - 1] : 0.f;
+    auto last = end;
+    while (last > start && row[last] <= row[last - 1]) --last;
+    if (row[last] <= base) return {};
+    return Profile(row + start, base, row[last] - base, last - start + 1);
+  }
+
+  // writes the binary format
+  bool Save(const char* file) const {
+    std::ofstream of(file, std::ios::binary);
+    Header h{{'O', 'T', 'V', 'P'}, kVersion, count_, kMinutes};
+    of.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    of.write(reinterpret_cast<const char*>(ids_), count_ * sizeof(*ids_));
+    of.write(reinterpret_cast<const char*>(rows_),
+             count_ * kMinutes * sizeof(*rows_));
+    return of.good();
+  }
+
+  size_t size() const { return count_; }
+
+ private:
+  bool Map(const char* file) {
+    auto fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    Header h;
+    if (fstat(fd, &st) || static_cast<size_t>(st.st_size) < sizeof(h) ||
+        pread(fd, &h, sizeof(h), 0) != sizeof(h) ||
+        memcmp(h.magic, "OTVP", 4)) {
+      close(fd);
+      return false;
+    }
+    if (h.version != kVersion || h.minutes != kMinutes ||
+        static_cast<size_t>(st.st_size) !=
+            sizeof(h) + h.count * (sizeof(uint32_t) + kMinutes * 4)) {
+      LOG_ERROR("Invalid volume profile file: " << file);
+      close(fd);
+      return true;
+    }
+    auto p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+      LOG_ERROR("Failed to map volume profile file: " << file);
+      return true;
+    }
+    map_ = p;
+    map_size_ = st.st_size;
+    count_ = h.count;
+    ids_ = reinterpret_cast<const uint32_t*>(static_cast<char*>(p) +
+                                             sizeof(h));
+    rows_ = reinterpret_cast<const float*>(ids_ + count_);
+    return true;
+  }
+
+  void Load(const char* file) {
     PipeStream str(file);
     if (!str.good()) {
       LOG_ERROR("Failed to read volume profile file: " << file);
       return;
     }
-    static const int kLineLength = 128;
-    char line[kLineLength];
-    while (str.stream().getline(line, sizeof(line))) {
+    Volumes volumes;
+    LineReader lines(&str.stream());
+    const char* line;
+    const char* end;
+    while (lines.Next(&line, &end)) {
       uint32_t id;
       int hour;
       int minute;
-      float volume;
-      if (sscanf(line, "%u %d:%d %f", &id, &hour, &minute, &volume) != 4) {
+      double x;
+      TextCursor c(line, end);
+      if (!c.Uint(&id) || !c.Int(&hour) || !c.Expect(':') || !c.Int(&minute) ||
+          !c.Double(&x)) {
         LOG_ERROR("Invalid volume profile file: " << file);
-        profiles_.clear();
-        break;
+        return;
       }
-      profiles_[id].emplace_back(hour * 60 + minute, volume);
+      float volume = x;
+      auto m = hour * 60 + minute;
+      if (m < 0 || m >= static_cast<int>(kMinutes) || volume <= 0) continue;
+      auto& v = volumes[id];
+      if (v.empty()) v.resize(kMinutes);
+      v[m] += volume;
     }
-    for (auto& pair : profiles_)
-      std::sort(pair.second.begin(), pair.second.end());
+    Build(volumes);
   }
 
-  struct Volume {
-    Volume(int m, float v) : minute_time(m), value(v) {}
-    bool operator<(int time) const { return minute_time < time; }
-    bool operator<(const Volume& b) const {
-      return minute_time < b.minute_time;
-    }
-    int minute_time;  // minutes since midnight
-    float value;
-  };
-  typedef std::vector<float> Profile;
-
-  // [start, end]
-  Profile Get(Security::IdType id, int start, int end) const {
-    if (start >= end) return {};
-    auto it = profiles_.find(id);
-    if (it == profiles_.end()) return {};
-    auto& p = it->second;
-    auto it_begin = std::lower_bound(p.begin(), p.end(), start);  // first >=
-    auto it_end = std::lower_bound(p.begin(), p.end(), end);
-    if (it_end != p.end() && it_end->minute_time == end) it_end++;
-    if (it_begin == it_end) return {};
-    std::vector<float> res((it_end - 1)->minute_time - start + 1);
-    auto sum = 0.;
-    for (auto it = it_begin; it != it_end; ++it) sum += it->value;
-    auto tmp = 0.;
-    for (auto it = it_begin; it != it_end; ++it) {
-      tmp += it->value;
-      res[it->minute_time - start] = tmp / sum;
-    }
-    for (auto i = 1u; i < res.size(); ++i) {
-      auto& b = res[i];
-      auto a = res[i - 1];
-      if (b < a) b = a;
+  void Build(const Volumes& volumes) {
+    ids_buf_.reserve(volumes.size());
+    rows_buf_.reserve(volumes.size() * kMinutes);
+    for (auto& pair : volumes) {
+      auto& v = pair.second;
+      auto total = 0.;
+      for (auto x : v) total += x;
+      if (v.size() != kMinutes || total <= 0) continue;
+      ids_buf_.push_back(pair.first);
+      auto cum = 0.;
+      for (auto x : v) {
+        cum += x;
+        rows_buf_.push_back(cum / total);
+      }
     }
-    return res;
+    count_ = ids_buf_.size();
+    ids_ = ids_buf_.data();
+    rows_ = rows_buf_.data();
   }
 
  private:
-  std::unordered_map<Security::IdType, std::vector<Volume>> profiles_;
+  void* map_ = nullptr;
+  size_t map_size_ = 0;
+  uint32_t count_ = 0;
+  const uint32_t* ids_ = nullptr;
+  const float* rows_ = nullptr;
+  std::vector<uint32_t> ids_buf_;
+  std::vector<float> rows_buf_;
 };
 
 }  // namespace opentrade
@@ -1,9 +1,12 @@
+#ifndef ALGOS_VWAP_VWAP_H_
+#define ALGOS_VWAP_VWAP_H_
+
 #include "../twap/twap.h"
 #include "volume_profile.h"
 
 namespace opentrade {
 
-struct VWAP : public TWAP {
+struct VWAP final : public TwapT<VWAP> {
   const ParamDefs& GetParamDefs() noexcept override { return kCommonParamDefs; }
 
   std::string OnStart(const ParamMap& params) noexcept override {
@@ -12,13 +15,13 @@ struct VWAP : public TWAP {
     auto sec = st_.sec;
     auto start_seconds = sec->exchange->GetSeconds(start_time_);
     start_time_floor_ = start_time_ - start_seconds % 60;
-    profile_ = std::move(kProfiles_.Get(
+    profile_ = std::move(Profiles().Get(
         sec->id, start_seconds / 60,
         std::round(sec->exchange->GetSeconds(end_time_) / 60.) - 1));
     return {};
   }
 
-  double GetLeaves() noexcept override {
+  double GetLeaves() noexcept {
     if (profile_.empty()) return TWAP::GetLeaves();
     auto i = std::min(static_cast<int64_t>(profile_.size() - 1),
                       std::max(0l, static_cast<int64_t>(
@@ -26,20 +29,29 @@ struct VWAP : public TWAP {
     return st_.qty * profile_[i] - inst_->total_exposure();
   }
 
+  // the profile steps every minute
+  time_t NextSliceTime(time_t now) noexcept {
+    if (profile_.empty()) return TWAP::NextSliceTime(now);
+    if (!inst_->sec().IsInTradePeriod()) return now + 1;
+    return start_time_floor_ + ((now - start_time_floor_) / 60 + 1) * 60;
+  }
+
   void OnStop() noexcept override {
     TWAP::OnStop();
-    decltype(profile_)().swap(profile_);
+    profile_ = {};
   }
 
  private:
   time_t start_time_floor_;
   VolumeProfile::Profile profile_;
-  static inline VolumeProfile kProfiles_{
-      PythonOr(std::getenv("VOLUME_PROFILE_FILE"), "volume_profile.txt")};
+  // loaded on the first start rather than with the executable
+  static VolumeProfile& Profiles() {
+    static VolumeProfile kProfiles{
+        PythonOr(std::getenv("VOLUME_PROFILE_FILE"), "volume_profile.txt")};
+    return kProfiles;
+  }
 };
 
 }  // namespace opentrade
 
-extern "C" {
-opentrade::Adapter* create() { return new opentrade::VWAP{}; }
-}
+#endif  // ALGOS_VWAP_VWAP_H_
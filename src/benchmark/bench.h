@@ -0,0 +1,39 @@
+#ifndef BENCHMARK_BENCH_H_
+#define BENCHMARK_BENCH_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace opentrade {
+
+// A case is a setup returning the loop to time, so that the state it builds
+// is not timed, loop(n) runs n operations. Each case is run with n doubled
+// till it takes the minimum time, then timed a few more rounds; results go
+// to stdout, one json object per line.
+struct Bench {
+  typedef std::function<void(size_t n)> Loop;
+  typedef std::function<Loop()> Setup;
+  std::string name;
+  Setup setup;
+
+  static auto& cases() {
+    static std::vector<Bench> kCases;
+    return kCases;
+  }
+  struct Register {
+    Register(const std::string& name, Setup setup) {
+      cases().push_back({name, setup});
+    }
+  };
+};
+
+// keeps v from being optimized out
+template <typename T>
+inline void DoNotOptimize(const T& v) {
+  asm volatile("" : : "r,m"(v) : "memory");
+}
+
+}  // namespace opentrade
+
+#endif  // BENCHMARK_BENCH_H_
@@ -0,0 +1,84 @@
+#include <memory>
+#include <random>
+
+#include "bench.h"
+#include "opentrade/consolidation.h"
+
+namespace opentrade {
+
+// quotes of num_src venues moving within a few ticks of each other, 3 of 4
+// size changes at the same price, the others a move to a new price
+template <typename Levels>
+static Bench::Setup LevelsSetup(int num_src) {
+  return [num_src]() -> Bench::Loop {
+    struct Event {
+      const Instrument* inst;
+      double price;
+      Fixed tick;
+      Fixed old_tick;
+      MarketData::Qty size;
+    };
+    FixedScale scale(2);
+    auto levels = std::make_shared<Levels>();
+    auto events = std::make_shared<std::vector<Event>>();
+    std::mt19937 rng(1);
+    std::vector<double> prices(num_src);
+    for (auto i = 0; i < num_src; ++i) {
+      auto inst = reinterpret_cast<const Instrument*>((i + 1) * 64lu);
+      prices[i] = 100 + 0.01 * (rng() % 5);
+      levels->Insert(scale.From(prices[i]), prices[i], 100, inst);
+    }
+    for (auto i = 0; i < (1 << 16); ++i) {
+      auto src = rng() % num_src;
+      auto inst = reinterpret_cast<const Instrument*>((src + 1) * 64lu);
+      auto price = prices[src];
+      if (rng() % 4 == 0) price = 100 + 0.01 * (rng() % 5);
+      events->push_back(Event{inst, price, scale.From(price),
+                              scale.From(prices[src]),
+                              static_cast<MarketData::Qty>(rng() % 50 + 1)});
+      prices[src] = price;
+    }
+    return [levels, events](size_t n) {
+      auto& l = *levels;
+      auto& e = *events;
+      for (size_t i = 0; i < n; ++i) {
+        auto& x = e[i & 0xffff];
+        if (x.tick == x.old_tick) {
+          l.Update(x.tick, x.size, x.inst);
+        } else {
+          l.Erase(x.old_tick, x.inst);
+          l.Insert(x.tick, x.price, x.size, x.inst);
+        }
+        DoNotOptimize(l.front().price);
+      }
+    };
+  };
+}
+
+static Bench::Register kAsks4("ConsolidationBook/Update/4",
+                              LevelsSetup<AskLevels>(4));
+static Bench::Register kAsks16("ConsolidationBook/Update/16",
+                               LevelsSetup<AskLevels>(16));
+static Bench::Register kBids16("ConsolidationBook/UpdateBids/16",
+                               LevelsSetup<BidLevels>(16));
+
+static Bench::Loop GetIndicatorSetup(bool by_id) {
+  auto md = std::make_shared<MarketData>();
+  md->Set(new ConsolidationBook(4));
+  return [md, by_id](size_t n) {
+    const MarketData& x = *md;
+    for (size_t i = 0; i < n; ++i) {
+      if (by_id)
+        DoNotOptimize(x.Get<ConsolidationBook>(kConsolidation));
+      else
+        DoNotOptimize(x.Get<ConsolidationBook>());
+    }
+  };
+}
+
+static Bench::Register kGet("MarketData/Get<T>",
+                            []() { return GetIndicatorSetup(false); });
+static Bench::Register kGetById("MarketData/Get<T>(id)",
+                                []() { return GetIndicatorSetup(true); });
+
+}  // namespace opentrade
@@ -0,0 +1,128 @@
+#include <memory>
+#include <random>
+
+#include "bench.h"
+#include "opentrade/account.h"
+#include "opentrade/order.h"
+#include "opentrade/position.h"
+#include "opentrade/risk.h"
+
+namespace opentrade {
+
+// one sub account, broker account and user trading a universe of
+// securities, with all the limits set so that every check is done
+struct Universe {
+  static inline const int kSecurities = 1000;
+  Exchange exchange;
+  std::vector<Security> secs{kSecurities};
+  SubAccount sub_account;
+  BrokerAccount broker_account;
+  User user;
+
+  Universe() {
+    for (auto i = 0; i < kSecurities; ++i) {
+      secs[i].id = i + 1;
+      secs[i].exchange = &exchange;
+    }
+    sub_account.id = 1;
+    broker_account.id = 1;
+    user.id = 1;
+    Limits l;
+    l.msg_rate = 1e9;
+    l.msg_rate_per_security = 1e9;
+    l.order_qty = 1e9;
+    l.order_value = 1e12;
+    l.value = 1e15;
+    l.turnover = 1e15;
+    l.total_value = 1e15;
+    l.total_turnover = 1e15;
+    l.total_long_value = 1e15;
+    l.total_short_value = 1e15;
+    sub_account.limits = broker_account.limits = user.limits = l;
+  }
+
+  // never freed, the positions of the singletons point into it
+  static Universe& Instance() {
+    static auto kInstance = new Universe;
+    return *kInstance;
+  }
+
+  // random orders across the universe, never freed either as the orders
+  // of GlobalOrderBook
+  std::vector<Order*> NewOrders(size_t n) {
+    std::mt19937 rng(1);
+    std::vector<Order*> out;
+    for (size_t i = 0; i < n; ++i) {
+      auto ord = new Order{};
+      ord->sec = &secs[rng() % kSecurities];
+      ord->sub_account = &sub_account;
+      ord->broker_account = &broker_account;
+      ord->user = &user;
+      ord->side = rng() % 2 ? kBuy : kSell;
+      ord->qty = 100 * (rng() % 10 + 1);
+      ord->price = 10 + 0.01 * (rng() % 10000);
+      out.push_back(ord);
+    }
+    return out;
+  }
+};
+
+// with the context kept per order as an instrument does, or resolved on
+// every check
+static Bench::Setup RiskSetup(bool cached) {
+  return [cached]() -> Bench::Loop {
+    auto ords = std::make_shared<std::vector<Order*>>(
+        Universe::Instance().NewOrders(4096));
+    auto ctxs = std::make_shared<std::vector<RiskContext>>(ords->size());
+    for (auto ord : *ords) PositionManager::Instance().Resolve(ord);
+    return [ords, ctxs, cached](size_t n) {
+      auto& risk = RiskManager::Instance();
+      for (size_t i = 0; i < n; ++i) {
+        auto j = i & 4095;
+        DoNotOptimize(
+            risk.Check(*(*ords)[j], cached ? &(*ctxs)[j] : nullptr));
+      }
+    };
+  };
+}
+
+static Bench::Register kCheck("RiskManager/Check", RiskSetup(true));
+static Bench::Register kCheckNoContext("RiskManager/Check/NoContext",
+                                       RiskSetup(false));
+
+// the in line stages of a confirmation, order state and positions, through
+// the life of orders of new, acknowledged and filled, offline so that
+// nothing is journaled; an op is one confirmation
+static Bench::Register kHandle("GlobalOrderBook/Handle", []() -> Bench::Loop {
+  auto ords = Universe::Instance().NewOrders(4096);
+  auto cms = std::make_shared<std::vector<Confirmation::Ptr>>();
+  auto& book = GlobalOrderBook::Instance();
+  for (auto ord : ords) {
+    ord->id = book.NewOrderId();
+    ord->tm = NowUtcInMicro();
+    for (auto exec_type : {kUnconfirmedNew, kNew, kFilled}) {
+      auto cm = Confirmation::New();
+      cm->order = ord;
+      cm->exec_type = exec_type;
+      if (exec_type == kFilled) {
+        cm->last_shares = ord->qty;
+        cm->last_px = ord->price;
+      }
+      cms->push_back(cm);
+    }
+  }
+  return [cms](size_t n) {
+    auto& book = GlobalOrderBook::Instance();
+    auto& x = *cms;
+    for (size_t i = 0; i < n; ++i) {
+      auto& cm = x[i % x.size()];
+      if (cm->exec_type == kUnconfirmedNew) {
+        auto ord = cm->order;
+        ord->cum_qty = ord->avg_px = 0;
+      }
+      book.Handle(cm, true);
+    }
+  };
+});
+
+}  // namespace opentrade
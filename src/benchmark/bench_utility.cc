@@ -0,0 +1,45 @@
+#include <memory>
+
+#include "bench.h"
+#include "opentrade/risk.h"
+#include "opentrade/utility.h"
+
+namespace opentrade {
+
+// a 5 minutes window of a few trades per second
+static Bench::Register kRollSum("RollSum/Update", []() -> Bench::Loop {
+  auto rs = std::make_shared<RollSum<double>>(300);
+  return [rs](size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      rs->Update(100 + (i & 7), i >> 3);
+      DoNotOptimize(rs->GetValue());
+    }
+  };
+});
+
+static Bench::Register kRollDelta("RollDelta/Update", []() -> Bench::Loop {
+  auto rd = std::make_shared<RollDelta<double>>(300, 0);
+  auto volume = std::make_shared<double>(0);
+  return [rd, volume](size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      *volume += 100;
+      rd->Update(*volume, i >> 3);
+      DoNotOptimize(rd->GetValue());
+    }
+  };
+});
+
+// the per message check and count of an account at ~50k msgs/s
+static Bench::Register kThrottle("Throttle/Check", []() -> Bench::Loop {
+  auto t = std::make_shared<Throttle>();
+  auto now = std::make_shared<int64_t>(1000 * kMicroInSec);
+  return [t, now](size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      *now += 20;
+      DoNotOptimize((*t)(*now));
+      t->Update(*now);
+    }
+  };
+});
+
+}  // namespace opentrade
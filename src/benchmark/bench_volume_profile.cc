@@ -0,0 +1,46 @@
+#include <memory>
+#include <random>
+
+#include "algos/vwap/volume_profile.h"
+#include "bench.h"
+
+namespace opentrade {
+
+// a US equity universe traded 09:30 to 16:00, windows of a VWAP order
+// started at a random minute, reading the profile as the algo does
+static Bench::Register kGet("VolumeProfile/Get/3000", []() -> Bench::Loop {
+  static const int kSecurities = 3000;
+  static const int kOpen = 9 * 60 + 30;
+  static const int kClose = 16 * 60;
+  std::mt19937 rng(1);
+  VolumeProfile::Volumes volumes;
+  for (auto i = 1; i <= kSecurities; ++i) {
+    auto& v = volumes[i * 7];
+    v.resize(VolumeProfile::kMinutes);
+    for (auto m = kOpen; m < kClose; ++m) v[m] = rng() % 10000 + 1;
+  }
+  auto vp = std::make_shared<VolumeProfile>(volumes);
+  struct Query {
+    Security::IdType id;
+    int start;
+    int end;
+  };
+  auto queries = std::make_shared<std::vector<Query>>();
+  for (auto i = 0; i < 4096; ++i) {
+    auto start = kOpen + rng() % (kClose - kOpen - 30);
+    queries->push_back(Query{static_cast<Security::IdType>(
+                                 (rng() % kSecurities + 1) * 7),
+                             static_cast<int>(start),
+                             static_cast<int>(start + 30 + rng() % 60)});
+  }
+  return [vp, queries](size_t n) {
+    auto& q = *queries;
+    for (size_t i = 0; i < n; ++i) {
+      auto& x = q[i & 4095];
+      auto p = vp->Get(x.id, x.start, x.end);
+      DoNotOptimize(p.empty() ? 0.f : p[p.size() / 2]);
+    }
+  };
+});
+
+}  // namespace opentrade
@@ -0,0 +1,46 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "bench.h"
+
+// benchmark [filter], runs the cases of names containing filter
+//   BENCH_MIN_TIME=<seconds> of one round, 0.2 by default
+//   BENCH_ROUNDS=<n>, 5 by default
+int main(int argc, char* argv[]) {
+  using opentrade::Bench;
+  auto filter = argc > 1 ? argv[1] : "";
+  auto env = getenv("BENCH_MIN_TIME");
+  auto min_time = env ? atof(env) : 0.2;
+  env = getenv("BENCH_ROUNDS");
+  auto rounds = std::max(env ? atoi(env) : 5, 1);
+  auto& cases = Bench::cases();
+  std::sort(cases.begin(), cases.end(),
+            [](auto& a, auto& b) { return a.name < b.name; });
+  for (auto& c : cases) {
+    if (!strstr(c.name.c_str(), filter)) continue;
+    auto loop = c.setup();
+    auto time = [&loop](size_t n) {
+      auto t0 = std::chrono::steady_clock::now();
+      loop(n);
+      std::chrono::duration<double> d = std::chrono::steady_clock::now() - t0;
+      return d.count();
+    };
+    size_t n = 1;
+    while (time(n) < min_time && n < (1lu << 40)) n *= 2;
+    std::vector<double> ns;
+    for (auto i = 0; i < rounds; ++i) ns.push_back(time(n) * 1e9 / n);
+    std::sort(ns.begin(), ns.end());
+    auto median = ns[ns.size() / 2];
+    printf(
+        "{\"name\": \"%s\", \"iterations\": %zu, \"rounds\": %d, "
+        "\"ns_per_op\": %.3f, \"min_ns_per_op\": %.3f, \"max_ns_per_op\": "
+        "%.3f, \"ops_per_sec\": %.0f}\n",
+        c.name.c_str(), n, rounds, median, ns.front(), ns.back(),
+        1e9 / median);
+    fflush(stdout);
+  }
+  return 0;
+}
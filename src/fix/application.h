@@ -8,6 +8,7 @@
 #include <quickfix/MessageCracker.h>
 #include <quickfix/NullStore.h>
 #include <quickfix/Session.h>
+#include <quickfix/SocketInitiator.h>
 #include <quickfix/ThreadedSocketAcceptor.h>
 #include <quickfix/ThreadedSocketInitiator.h>
 #include <quickfix/fix42/ExecutionReport.h>
@@ -59,7 +60,7 @@ class Application : public FIX::Application {
   std::unique_ptr<FIX::MessageStoreFactory> fix_store_factory_;
   std::unique_ptr<FIX::LogFactory> fix_log_factory_;
   std::unique_ptr<FIX::ThreadedSocketAcceptor> threaded_socket_acceptor_;
-  std::unique_ptr<FIX::ThreadedSocketInitiator> threaded_socket_initiator_;
+  std::unique_ptr<FIX::Initiator> initiator_;
   FIX::Session* session_ = nullptr;
 };
 
@@ -6,53 +6,234 @@
 #include <quickfix/FileLog.h>
 #undef private
 #undef throw
-
-#include "opentrade/task_pool.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <condition_variable>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
 
 namespace FIX {
 
+// FileLog with one writer thread. The session threads only stamp the time
+// and append the message into a pre-reserved buffer, the writer swaps it
+// out and formats the whole batch, the date and time once per second, into
+// the messages file mapped in pre-sized segments. The tail of the last
+// segment is zero filled until the log is closed.
+// In binary mode (FileLogBinary=Y) each message is written as
+// int64 nanoseconds since epoch, uint32 length, char 'I' or 'O', 3 bytes
+// padding and the raw message, see scripts/parse_fix_log.py.
 class AsyncFileLog : public FileLog {
  public:
-  explicit AsyncFileLog(const std::string& path) : FileLog(path) {}
-  AsyncFileLog(const std::string& path, const SessionID& sessionID)
-      : FileLog(path, sessionID) {}
+  static inline const size_t kSegmentSize = 64 << 20;
+  static inline const size_t kBufferSize = 4 << 20;
+
+  explicit AsyncFileLog(const std::string& path, bool binary = false)
+      : FileLog(path), binary_(binary) {
+    Start();
+  }
+  AsyncFileLog(const std::string& path, const SessionID& sessionID,
+               bool binary = false)
+      : FileLog(path, sessionID), binary_(binary) {
+    Start();
+  }
   AsyncFileLog(const std::string& path, const std::string& backupPath,
-               const SessionID& sessionID)
-      : FileLog(path, backupPath, sessionID) {}
+               const SessionID& sessionID, bool binary = false)
+      : FileLog(path, backupPath, sessionID), binary_(binary) {
+    Start();
+  }
+
+  ~AsyncFileLog() {
+    Push(kStop, {});
+    writer_.join();
+  }
 
-  void appendTime(const std::string& value, std::string& newvalue) {
+  void onIncoming(const std::string& value) override { Push(kIncoming, value); }
+  void onOutgoing(const std::string& value) override { Push(kOutgoing, value); }
+  void onEvent(const std::string& value) override { Push(kEvent, value); }
+  void clear() override { Push(kClear, {}); }
+  void backup() override { Push(kBackup, {}); }
+
+ private:
+  enum Type : char {
+    kIncoming = 'I',
+    kOutgoing = 'O',
+    kEvent = 'E',
+    kClear = 'C',
+    kBackup = 'B',
+    kStop = 'S',
+  };
+  struct Header {
+    int64_t ns;
+    uint32_t size;
+    char type;
+  };
+
+  void Start() {
+    buf_.reserve(kBufferSize);
+    Open();
+    writer_ = std::thread([this]() { Run(); });
+  }
+
+  void Push(Type type, const std::string& value) {
     struct timespec t;
     clock_gettime(CLOCK_REALTIME, &t);
-    char buf[64];
-    int n = snprintf(buf, sizeof(buf), "0=%ld.%ld\1", t.tv_sec, t.tv_nsec);
-    if (n < 0) n = 0;
-    newvalue.reserve(value.length() + n + 1);
-    newvalue.append(value);
-    if (n > 0) newvalue.append(buf);
+    Header h{t.tv_sec * 1000000000l + t.tv_nsec,
+             static_cast<uint32_t>(value.size()), type};
+    std::lock_guard<std::mutex> lock(m_);
+    buf_.append(reinterpret_cast<const char*>(&h), sizeof(h));
+    buf_.append(value);
+    if (!pending_) {
+      pending_ = true;
+      cv_.notify_one();
+    }
+  }
+
+  void Run() {
+    std::string batch;
+    batch.reserve(kBufferSize);
+    std::string out;
+    out.reserve(kBufferSize);
+    for (auto stop = false; !stop;) {
+      {
+        std::unique_lock<std::mutex> lock(m_);
+        cv_.wait(lock, [this]() { return pending_; });
+        pending_ = false;
+        buf_.swap(batch);
+      }
+      for (size_t i = 0; i < batch.size();) {
+        Header h;
+        memcpy(&h, batch.data() + i, sizeof(h));
+        auto value = batch.data() + i + sizeof(h);
+        i += sizeof(h) + h.size;
+        switch (h.type) {
+          case kIncoming:
+          case kOutgoing:
+            Format(h, value, &out);
+            continue;
+          case kEvent:
+            FileLog::onEvent(std::string(value, h.size));
+            continue;
+          case kStop:
+            stop = true;
+            break;
+          default:
+            break;
+        }
+        // in order with the messages before
+        Append(out);
+        out.clear();
+        if (h.type == kClear || h.type == kBackup) {
+          Close();
+          if (h.type == kClear)
+            FileLog::clear();
+          else
+            FileLog::backup();
+          Open();
+        }
+      }
+      Append(out);
+      out.clear();
+      batch.clear();
+    }
+    Close();
   }
 
-  void onIncoming(const std::string& value) override {
-    std::string newvalue;
-    appendTime(value, newvalue);
-    pool_.AddTask([=]() { this->FileLog::onIncoming(newvalue); });
+  void Format(const Header& h, const char* value, std::string* out) {
+    if (binary_) {
+      out->append(reinterpret_cast<const char*>(&h), sizeof(h));
+      out->append(value, h.size);
+      return;
+    }
+    auto sec = static_cast<time_t>(h.ns / 1000000000l);
+    if (sec != sec_) {
+      struct tm tm;
+      gmtime_r(&sec, &tm);
+      strftime(sec_str_, sizeof(sec_str_), "%Y%m%d-%H:%M:%S", &tm);
+      sec_ = sec;
+    }
+    char ns[16];
+    snprintf(ns, sizeof(ns), ".%09ld : ", h.ns % 1000000000l);
+    out->append(sec_str_);
+    out->append(ns);
+    out->append(value, h.size);
+    out->push_back('\n');
   }
-  void onOutgoing(const std::string& value) override {
-    std::string newvalue;
-    appendTime(value, newvalue);
-    pool_.AddTask([=]() { this->FileLog::onOutgoing(newvalue); });
+
+  // appends to the end of the messages file
+  void Open() {
+    fd_ = open(m_messagesFileName.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+      std::cerr << "Failed to open " << m_messagesFileName << ": "
+                << strerror(errno) << std::endl;
+      return;
+    }
+    struct stat st;
+    size_ = fstat(fd_, &st) ? 0 : st.st_size;
   }
-  void onEvent(const std::string& value) override {
-    pool_.AddTask([=]() { this->FileLog::onEvent(value); });
+
+  void Close() {
+    if (fd_ < 0) return;
+    if (map_) munmap(map_, kSegmentSize);
+    map_ = nullptr;
+    if (ftruncate(fd_, size_)) {
+      std::cerr << "Failed to truncate " << m_messagesFileName << std::endl;
+    }
+    close(fd_);
+    fd_ = -1;
   }
-  void clear() override {
-    pool_.AddTask([=]() { this->FileLog::clear(); });
+
+  // maps the segment containing the end of file
+  bool Map() {
+    if (map_) munmap(map_, kSegmentSize);
+    map_ = nullptr;
+    static const auto kPageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    map_offset_ = size_ / kPageSize * kPageSize;
+    if (ftruncate(fd_, map_offset_ + kSegmentSize)) return false;
+    auto p = mmap(nullptr, kSegmentSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  fd_, map_offset_);
+    if (p == MAP_FAILED) return false;
+    map_ = static_cast<char*>(p);
+    return true;
   }
-  void backup() override {
-    pool_.AddTask([=]() { this->FileLog::backup(); });
+
+  void Append(const std::string& data) {
+    if (fd_ < 0) return;
+    for (size_t i = 0; i < data.size();) {
+      auto pos = size_ - map_offset_;
+      if (!map_ || pos >= kSegmentSize) {
+        if (!Map()) {
+          std::cerr << "Failed to map " << m_messagesFileName << ": "
+                    << strerror(errno) << std::endl;
+          return;
+        }
+        pos = size_ - map_offset_;
+      }
+      auto n = std::min(data.size() - i, kSegmentSize - pos);
+      memcpy(map_ + pos, data.data() + i, n);
+      size_ += n;
+      i += n;
+    }
   }
 
  private:
-  opentrade::TaskPool pool_;
+  const bool binary_;
+  std::mutex m_;
+  std::condition_variable cv_;
+  std::string buf_;
+  bool pending_ = false;
+  std::thread writer_;
+  int fd_ = -1;
+  char* map_ = nullptr;
+  size_t map_offset_ = 0;
+  size_t size_ = 0;  // of the messages written
+  time_t sec_ = -1;
+  char sec_str_[32] = {};
 };
 
 struct NullLogFactory : public LogFactory {
@@ -70,6 +251,12 @@ class AsyncFileLogFactory : public FileLogFactory {
   AsyncFileLogFactory(const std::string& path, const std::string& backupPath)
       : FileLogFactory(path, backupPath) {}
 
+  static inline const char* kFileLogBinary = "FileLogBinary";
+
+  static bool IsBinary(const Dictionary& settings) {
+    return settings.has(kFileLogBinary) && settings.getBool(kFileLogBinary);
+  }
+
  public:
   Log* create() {
     m_globalLogCount++;
@@ -86,7 +273,7 @@ class AsyncFileLogFactory : public FileLogFactory {
       if (settings.has(FILE_LOG_BACKUP_PATH))
         backupPath = settings.getString(FILE_LOG_BACKUP_PATH);
 
-      return m_globalLog = new AsyncFileLog(path);
+      return m_globalLog = new AsyncFileLog(path, IsBinary(settings));
     } catch (ConfigError&) {
       m_globalLogCount--;
       throw;
@@ -101,7 +288,7 @@ class AsyncFileLogFactory : public FileLogFactory {
     std::string path;
     Dictionary settings = m_settings.get(s);
     path = settings.getString(FILE_LOG_PATH);
-    return new AsyncFileLog(path, s);
+    return new AsyncFileLog(path, s, IsBinary(settings));
   }
 };
 
@@ -6,70 +6,244 @@
 #include <quickfix/FileStore.h>
 #undef private
 #undef throw
+#include <tbb/concurrent_queue.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
 
-#include "opentrade/task_pool.h"
+#include "opentrade/metrics.h"
+#include "opentrade/replication.h"
 
 namespace FIX {
 
+// FileStore with a single writer thread per session. set() and the seq num
+// updates are queued, the writer appends a burst of messages with one
+// flush and rewrites the seq nums once per burst. get() for resends is
+// served from a ring of the recent messages, also covering those not
+// written yet, and only goes to the file for older ones.
 class AsyncFileStore : public FileStore {
  public:
-  AsyncFileStore(std::string path, const SessionID& s) : FileStore(path, s) {}
+  static inline const int kRingSize = 1 << 14;
+  static inline const size_t kMaxBatch = 1024;
+
+  AsyncFileStore(std::string path, const SessionID& s)
+      : FileStore(path, s), ring_(kRingSize) {
+    if (!m_offsets.empty()) evicted_ = m_offsets.rbegin()->first;
+    queue_.set_capacity(1 << 16);
+    writer_ = std::thread([this]() { Run(); });
+    auto& m = opentrade::Metrics::Instance();
+    auto label = opentrade::Metrics::Label("session", s.toString());
+    m.AddCounter(
+        "opentrade_fix_store_messages_total", "Messages persisted", label,
+        [this]() { return stored_.load(std::memory_order_relaxed); }, this);
+    m.AddCounter(
+        "opentrade_fix_store_flushes_total", "Batched writes", label,
+        [this]() { return flushes_.load(std::memory_order_relaxed); }, this);
+    m.AddGauge(
+        "opentrade_fix_store_queued", "Updates waiting for the writer", label,
+        [this]() { return enqueued_ - written_; }, this);
+  }
+
+  ~AsyncFileStore() {
+    opentrade::Metrics::Instance().Remove(this);
+    Enqueue(-1, nullptr);
+    writer_.join();
+  }
 
   bool set(int seq, const std::string& msg) override {
-    pool_.AddTask([=]() { set_(seq, msg); });
+    auto ptr = std::make_shared<const std::string>(msg);
+    {
+      std::scoped_lock<std::mutex> lock(ring_m_);
+      auto& slot = ring_[seq & (kRingSize - 1)];
+      if (slot.first > evicted_) evicted_ = slot.first;
+      slot = std::make_pair(seq, ptr);
+      if (seq > last_) last_ = seq;
+    }
+    Enqueue(seq, std::move(ptr));
     return true;
   }
+
   void get(int begin, int end,
            std::vector<std::string>& result) const override {
+    result.clear();
+    {
+      std::scoped_lock<std::mutex> lock(ring_m_);
+      if (begin > evicted_ && last_ - begin < kRingSize) {
+        auto n = std::min(end, last_);
+        for (auto seq = begin; seq <= n; ++seq) {
+          auto& slot = ring_[seq & (kRingSize - 1)];
+          if (slot.first == seq) result.push_back(*slot.second);
+        }
+        return;
+      }
+    }
+    Drain();
     std::scoped_lock<std::mutex> lock(m_);
-    return FileStore::get(begin, end, result);
+    FileStore::get(begin, end, result);
   }
 
   void setNextSenderMsgSeqNum(int value) override {
     m_cache.setNextSenderMsgSeqNum(value);
-    pool_.AddTask([this]() { setSeqNum_(); });
+    SetSeqNum();
   }
   void setNextTargetMsgSeqNum(int value) override {
     m_cache.setNextTargetMsgSeqNum(value);
-    pool_.AddTask([this]() { setSeqNum_(); });
+    SetSeqNum();
   }
   void incrNextSenderMsgSeqNum() override {
     m_cache.incrNextSenderMsgSeqNum();
-    pool_.AddTask([this]() { setSeqNum_(); });
+    SetSeqNum();
   }
   void incrNextTargetMsgSeqNum() override {
     m_cache.incrNextTargetMsgSeqNum();
-    pool_.AddTask([this]() { setSeqNum_(); });
+    SetSeqNum();
   }
 
   void reset() override {
+    Drain();
     std::scoped_lock<std::mutex> lock(m_);
     FileStore::reset();
+    PublishSeqNum();
+    ClearRing();
   }
   void refresh() override {
+    Drain();
     std::scoped_lock<std::mutex> lock(m_);
     FileStore::refresh();
+    ClearRing();
   }
 
  private:
-  void set_(int seq, const std::string& msg) {
+  // seq 0 for seq nums, -1 to stop the writer
+  typedef std::pair<int, std::shared_ptr<const std::string>> Item;
+
+  void Enqueue(int seq, std::shared_ptr<const std::string> msg) {
+    enqueued_.fetch_add(1, std::memory_order_relaxed);
+    queue_.push(Item{seq, std::move(msg)});
+  }
+
+  // coalesced, the writer stores the latest values
+  void SetSeqNum() {
+    if (!seq_queued_.exchange(true, std::memory_order_acq_rel))
+      Enqueue(0, nullptr);
+  }
+
+  // waits until the writer has caught up with the queue
+  void Drain() const {
+    while (written_.load(std::memory_order_acquire) !=
+           enqueued_.load(std::memory_order_acquire))
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+
+  void ClearRing() {
+    std::scoped_lock<std::mutex> lock(ring_m_);
+    for (auto& slot : ring_) slot = Item{};
+    evicted_ = m_offsets.empty() ? 0 : m_offsets.rbegin()->first;
+    last_ = 0;
+  }
+
+  void Run() {
+    std::vector<Item> batch;
+    batch.reserve(kMaxBatch);
+    for (auto stop = false; !stop;) {
+      Item item;
+      queue_.pop(item);
+      batch.push_back(std::move(item));
+      while (batch.size() < kMaxBatch && queue_.try_pop(item))
+        batch.push_back(std::move(item));
+      stop = batch.back().first < 0;
+      Write(batch);
+      written_.fetch_add(batch.size(), std::memory_order_release);
+      batch.clear();
+    }
+  }
+
+  void Write(const std::vector<Item>& batch) {
     std::scoped_lock<std::mutex> lock(m_);
+    auto n = 0;
+    auto seq_num = false;
     try {
-      FileStore::set(seq, msg);
+      long offset = -1;
+      for (auto& item : batch) {
+        if (item.first <= 0) {
+          if (!item.first) seq_num = true;
+          continue;
+        }
+        // stdio flushes on fseek, so seek once and track the offset
+        if (offset < 0) offset = SeekEnd();
+        Append(item.first, *item.second, offset);
+        offset += item.second->size();
+        n++;
+      }
+      if (n) {
+        if (fflush(m_msgFile) == EOF)
+          throw IOException("Unable to flush file " + m_msgFileName);
+        if (fflush(m_headerFile) == EOF)
+          throw IOException("Unable to flush file " + m_headerFileName);
+      }
+      if (seq_num) {
+        seq_queued_.store(false, std::memory_order_release);
+        FileStore::setSeqNum();
+        PublishSeqNum();
+      }
     } catch (const IOException& e) {
       std::cerr << e.what() << std::endl;
     }
+    stored_.fetch_add(n, std::memory_order_relaxed);
+    if (n || seq_num) flushes_.fetch_add(1, std::memory_order_relaxed);
   }
 
-  void setSeqNum_() {
-    std::scoped_lock<std::mutex> lock(m_);
-    FileStore::setSeqNum();
+  // same layout as FileStore::setSeqNum, for the hot standbys to log on
+  // with; the messages are not mirrored, resends of them are gap filled
+  void PublishSeqNum() {
+    char buf[32];
+    auto n = snprintf(buf, sizeof(buf), "%10.10d : %10.10d",
+                      getNextSenderMsgSeqNum(), getNextTargetMsgSeqNum());
+    opentrade::Replication::Instance().Publish(
+        opentrade::Replication::kFile, m_seqNumsFileName, {buf, size_t(n)});
+  }
+
+  long SeekEnd() {
+    if (fseek(m_msgFile, 0, SEEK_END))
+      throw IOException("Cannot seek to end of " + m_msgFileName);
+    if (fseek(m_headerFile, 0, SEEK_END))
+      throw IOException("Cannot seek to end of " + m_headerFileName);
+    auto offset = ftell(m_msgFile);
+    if (offset < 0)
+      throw IOException("Unable to get file pointer position from " +
+                        m_msgFileName);
+    return offset;
+  }
+
+  // same layout as FileStore::set
+  void Append(int seq, const std::string& msg, long offset) {
+    if (fprintf(m_headerFile, "%d,%ld,%zu ", seq, offset, msg.size()) < 0)
+      throw IOException("Unable to write to file " + m_headerFileName);
+    m_offsets[seq] = std::make_pair(offset, msg.size());
+    fwrite(msg.data(), sizeof(char), msg.size(), m_msgFile);
+    if (ferror(m_msgFile))
+      throw IOException("Unable to write to file " + m_msgFileName);
   }
 
  private:
-  opentrade::TaskPool pool_;
-  mutable std::mutex m_;
+  tbb::concurrent_bounded_queue<Item> queue_;
+  std::thread writer_;
+  mutable std::mutex m_;  // the files, only contended by old resends
+  std::vector<Item> ring_;
+  mutable std::mutex ring_m_;
+  int evicted_ = 0;  // highest seq no longer in ring_
+  int last_ = 0;
+  std::atomic<bool> seq_queued_ = false;
+  std::atomic<uint64_t> enqueued_ = 0;
+  std::atomic<uint64_t> written_ = 0;
+  std::atomic<uint64_t> stored_ = 0;
+  std::atomic<uint64_t> flushes_ = 0;
 };
 
 class AsyncFileStoreFactory : public FileStoreFactory {
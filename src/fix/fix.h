@@ -1,7 +1,13 @@
 #ifndef FIX_FIX_H_
 #define FIX_FIX_H_
 
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
 #include "application.h"
+#include "reactor.h"
 #include "opentrade/consolidation.h"
 #include "opentrade/exchange_connectivity.h"
 #include "opentrade/logger.h"
@@ -47,6 +53,26 @@ class FixAdapter : public Application,
       LOG_INFO(name() << ": multiplier=" << multiplier_);
     }
 
+    replace_ = config("replace") != "0";
+    if (!replace_) {
+      LOG_INFO(name() << ": no OrderCancelReplaceRequest, cancel and new");
+    }
+
+    mass_cancel_ = config<bool>("mass_cancel");
+    if (mass_cancel_) {
+      LOG_INFO(name() << ": OrderMassCancelRequest for mass cancels");
+    }
+
+    fast_exec_report_ = config("fast_exec_report") != "0";
+    if (!fast_exec_report_) {
+      LOG_INFO(name() << ": execution reports through MessageCracker");
+    }
+
+    if (config<bool>("send_thread")) {
+      writer_.reset(new TaskPool(1));
+      LOG_INFO(name() << ": orders sent by a writer thread of the session");
+    }
+
     fix_settings_.reset(new FIX::SessionSettings(config_file));
     auto file_store_path = fix_settings_->get().getString("FileStorePath");
     if (file_store_path.find("/dev/null") == 0)
@@ -58,15 +84,58 @@ class FixAdapter : public Application,
       fix_log_factory_.reset(new FIX::NullLogFactory);
     else
       fix_log_factory_.reset(new FIX::AsyncFileLogFactory(*fix_settings_));
-    threaded_socket_initiator_.reset(new FIX::ThreadedSocketInitiator(
+    StartInitiator();
+  }
+
+  // initiator=threaded (default): a thread per session
+  // initiator=socket: one thread polling all the sessions of config_file
+  // initiator=reactor:<name>: a thread shared by the adapters with the same
+  //   name, see FixReactor
+  // cpus=2-3,6 pins the thread the session callbacks run on
+  void StartInitiator() {
+    auto cpus = config("cpus");
+    if (!cpus.empty()) {
+      if (!ParseCpuSet(cpus, &cpus_))
+        LOG_FATAL(name() << ": Invalid cpus: " << cpus);
+      pin_ = true;
+      LOG_INFO(name() << ": cpus=" << cpus);
+    }
+    auto type = config("initiator");
+    if (type.empty() || type == "threaded") {
+      initiator_.reset(new FIX::ThreadedSocketInitiator(
+          *this, *fix_store_factory_, *fix_settings_, *fix_log_factory_));
+      initiator_->start();
+      return;
+    }
+    initiator_.reset(new FIX::SocketInitiator(
         *this, *fix_store_factory_, *fix_settings_, *fix_log_factory_));
-    threaded_socket_initiator_->start();
+    if (type == "socket") {
+      initiator_->start();
+    } else if (type.find("reactor:") == 0) {
+      reactor_ = FixReactor::Get(type.substr(8));
+      reactor_->Add(initiator_.get(), pin_ ? &cpus_ : nullptr);
+    } else {
+      LOG_FATAL(name() << ": Invalid initiator: " << type);
+    }
+    LOG_INFO(name() << ": initiator=" << type);
+  }
+
+  void Stop() noexcept override {
+    if (!reactor_) {
+      initiator_->stop();
+      return;
+    }
+    reactor_->Remove(initiator_.get());
+    initiator_->stop(true);
   }
 
-  void Stop() noexcept override { threaded_socket_initiator_->stop(); }
+  // session_ is the first session of config_file, see Application::onCreate
+  bool IsOwnSession(const FIX::SessionID& session_id) const {
+    return session_ && session_->getSessionID() == session_id;
+  }
 
   void onLogon(const FIX::SessionID& session_id) override {
-    if (session_ != FIX::Session::lookupSession(session_id)) return;
+    if (!IsOwnSession(session_id)) return;
     connected_ = -1;
     // in case frequently reconnected, e.g. seqnum mismatch,
     // OnLogout is called immediately after OnLogon
@@ -75,29 +144,39 @@ class FixAdapter : public Application,
           if (-1 == connected_) {
             connected_ = 1;
             ReSubscribeAll();
-            LOG_INFO(name() << ": Logged-in to " << session_id.toString());
+            LOG_RATE_LIMITED(INFO, 5, name() << ": Logged-in to "
+                                             << session_id.toString());
           }
         },
         boost::posix_time::seconds(1));
   }
 
   void onLogout(const FIX::SessionID& session_id) override {
-    if (session_ != FIX::Session::lookupSession(session_id)) return;
+    if (!IsOwnSession(session_id)) return;
     if (connected())
-      LOG_INFO(name() << ": Logged-out from " << session_id.toString());
+      LOG_RATE_LIMITED(INFO, 5, name() << ": Logged-out from "
+                                       << session_id.toString());
     connected_ = 0;
   }
 
+  // no resend of orders, PossDupFlag is only in the header of the resent
   void toApp(FIX::Message& msg, const FIX::SessionID& session_id) override {
-    if (msg.isSetField(FIX::FIELD::PossDupFlag)) {
-      FIX::PossDupFlag flag;
-      msg.getHeader().getField(flag);
-      if (flag) throw FIX::DoNotSend();
-    }
+    auto& header = msg.getHeader();
+    if (!header.isSetField(FIX::FIELD::PossDupFlag)) return;
+    FIX::PossDupFlag flag;
+    header.getField(flag);
+    if (flag) throw FIX::DoNotSend();
   }
 
   void fromApp(const FIX::Message& msg,
                const FIX::SessionID& session_id) override {
+    if (fast_exec_report_) {
+      auto& msg_type = msg.getHeader().getField(FIX::FIELD::MsgType);
+      if (msg_type == FIX::MsgType_ExecutionReport) {
+        OnExecutionReport(msg, session_id);
+        return;
+      }
+    }
     crack(msg, session_id);
   }
 
@@ -107,6 +186,12 @@ class FixAdapter : public Application,
   }
 
   void toAdmin(FIX::Message& msg, const FIX::SessionID& id) override {
+    // a reactor pins itself
+    if (pin_ && !reactor_) {
+      static thread_local bool kPinned = false;
+      if (!kPinned) PinThread(cpus_);
+      kPinned = true;
+    }
     FIX::MsgType msg_type;
     msg.getHeader().getField(msg_type);
     if (msg_type == FIX::MsgType_Logon) {
@@ -126,54 +211,164 @@ class FixAdapter : public Application,
     }
   }
 
-  void UpdateTm(const FIX::Message& msg) {
-    if (msg.isSetField(FIX::FIELD::TransactTime)) {
-      auto t = FIX::UtcTimeStampConvertor::convert(
-          (msg.getField(FIX::FIELD::TransactTime)));
-      transact_time_ = t.getTimeT() * 1000000l + t.getMillisecond() * 1000;
-    } else {
-      transact_time_ = NowUtcInMicro();
+  // The tags of an execution report we use, pulled in one pass over the
+  // message, string values referenced in place, no lookup per tag or copy
+  struct ExecReport {
+    const std::string* clordid = nullptr;
+    const std::string* orig_clordid = nullptr;
+    const std::string* order_id = nullptr;
+    const std::string* exec_id = nullptr;
+    const std::string* text = nullptr;
+    const std::string* last_shares = nullptr;
+    const std::string* last_px = nullptr;
+    const std::string* transact_time = nullptr;
+    char exec_type = 0;
+    char exec_trans_type = FIX::ExecTransType_NEW;
+
+    explicit ExecReport(const FIX::FieldMap& msg) {
+      for (auto& it : msg) {
+        auto& field = FieldOf(it);
+        auto& v = field.getString();
+        switch (field.getTag()) {
+          case FIX::FIELD::ClOrdID:
+            clordid = &v;
+            break;
+          case FIX::FIELD::OrigClOrdID:
+            orig_clordid = &v;
+            break;
+          case FIX::FIELD::OrderID:
+            order_id = &v;
+            break;
+          case FIX::FIELD::ExecID:
+            exec_id = &v;
+            break;
+          case FIX::FIELD::Text:
+            text = &v;
+            break;
+          case FIX::FIELD::LastShares:
+            last_shares = &v;
+            break;
+          case FIX::FIELD::LastPx:
+            last_px = &v;
+            break;
+          case FIX::FIELD::TransactTime:
+            transact_time = &v;
+            break;
+          case FIX::FIELD::ExecType:
+            if (!v.empty()) exec_type = v[0];
+            break;
+          case FIX::FIELD::ExecTransType:
+            if (!v.empty()) exec_trans_type = v[0];
+            break;
+          default:
+            break;
+        }
+      }
+    }
+
+    // quickfix before 1.15 keeps fields in a multimap
+    static const FIX::FieldBase& FieldOf(const FIX::FieldBase& f) { return f; }
+    template <typename Pair>
+    static const FIX::FieldBase& FieldOf(const Pair& p) {
+      return p.second;
+    }
+
+    static Order::IdType Id(const std::string* v) {
+      return v ? atol(v->c_str()) : 0;
+    }
+    static double Number(const std::string* v) {
+      return v ? atof(v->c_str()) : 0;
     }
+    static const std::string& Str(const std::string* v) {
+      return v ? *v : kEmptyStr;
+    }
+  };
+
+  // YYYYMMDD-HH:MM:SS[.s...] in microseconds, 0 if malformed
+  static int64_t ParseUtcTimestamp(const std::string& v) {
+    auto s = v.c_str();
+    auto num = [s](int pos, int n) {
+      auto x = 0;
+      for (auto i = pos; i < pos + n; ++i) {
+        if (s[i] < '0' || s[i] > '9') return -1;
+        x = x * 10 + s[i] - '0';
+      }
+      return x;
+    };
+    if (v.size() < 17 || s[8] != '-' || s[11] != ':' || s[14] != ':') return 0;
+    auto y = num(0, 4), m = num(4, 2), d = num(6, 2);
+    auto hh = num(9, 2), mm = num(12, 2), ss = num(15, 2);
+    if (y < 0 || m < 1 || m > 12 || d < 1 || hh < 0 || mm < 0 || ss < 0)
+      return 0;
+    // days since epoch of the civil date, H. Hinnant's days_from_civil
+    y -= m <= 2;
+    auto era = y / 400;
+    auto yoe = y - era * 400;
+    auto doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    auto doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int64_t days = era * 146097 + doe - 719468;
+    int64_t micros = 0;
+    if (v.size() > 18 && s[17] == '.') {
+      auto scale = 100000;
+      for (auto i = 18u; i < v.size() && scale; ++i, scale /= 10) {
+        if (s[i] < '0' || s[i] > '9') break;
+        micros += (s[i] - '0') * scale;
+      }
+    }
+    return ((days * 24 + hh) * 60 + mm) * 60 * 1000000l + ss * 1000000l +
+           micros;
+  }
+
+  void UpdateTm(const std::string* transact_time) {
+    transact_time_ = transact_time ? ParseUtcTimestamp(*transact_time) : 0;
+    if (!transact_time_) transact_time_ = NowUtcInMicro();
+  }
+
+  void UpdateTm(const FIX::Message& msg) {
+    UpdateTm(msg.isSetField(FIX::FIELD::TransactTime)
+                 ? &msg.getField(FIX::FIELD::TransactTime)
+                 : nullptr);
   }
 
   void OnExecutionReport(const FIX::Message& msg,
                          const FIX::SessionID& session_id) {
-    UpdateTm(msg);
-    std::string text;
-    if (msg.isSetField(FIX::FIELD::Text)) text = msg.getField(FIX::FIELD::Text);
-    auto exec_type = msg.getField(FIX::FIELD::ExecType)[0];
+    ExecReport r(msg);
+    UpdateTm(r.transact_time);
+    auto& text = ExecReport::Str(r.text);
+    auto exec_type = r.exec_type;
     switch (exec_type) {
       case FIX::ExecType_PENDING_NEW:
-        OnPendingNew(msg, text);
+        OnPendingNew(r, text);
         break;
       case FIX::ExecType_PENDING_CANCEL:
-        OnPendingCancel(msg);
+        OnPendingCancel(r);
         break;
       case FIX::ExecType_NEW:
-        OnNew(msg);
+        OnNew(r);
         break;
       case FIX::ExecType_PARTIAL_FILL:
       case FIX::ExecType_FILL:
       case FIX::ExecType_TRADE:
-        OnFilled(msg, exec_type, exec_type == FIX::ExecType_PARTIAL_FILL);
+        OnFilled(r, exec_type, exec_type == FIX::ExecType_PARTIAL_FILL);
         break;
       case FIX::ExecType_PENDING_REPLACE:
+        OnPendingReplace(r);
         break;
       case FIX::ExecType_CANCELED:
-        OnCanceled(msg, text);
+        OnCanceled(r, text);
         break;
       case FIX::ExecType_REPLACED:
-        OnReplaced(msg, text);
+        OnReplaced(r, text);
         break;
       case FIX::ExecType_REJECTED:
-        OnRejected(msg, text);
+        OnRejected(r, text);
         break;
       case FIX::ExecType_SUSPENDED:
       case FIX::ExecType_DONE_FOR_DAY:
       case FIX::ExecType_CALCULATED:
       case FIX::ExecType_STOPPED:
       case FIX::ExecType_EXPIRED:
-        OnOthers(msg, exec_type, text);
+        OnOthers(r, exec_type, text);
         break;
       case FIX::ExecType_RESTATED:
         break;
@@ -188,111 +383,147 @@ class FixAdapter : public Application,
     }
   }
 
-  void OnNew(const FIX::Message& msg) {
-    Order::IdType clordid = atol(msg.getField(FIX::FIELD::ClOrdID).c_str());
-    std::string order_id;
-    if (msg.isSetField(FIX::FIELD::OrderID))
-      order_id = msg.getField(FIX::FIELD::OrderID);
-    HandleNew(clordid, order_id, transact_time_);
+  void OnNew(const ExecReport& r) {
+    HandleNew(ExecReport::Id(r.clordid), ExecReport::Str(r.order_id),
+              transact_time_);
   }
 
-  void OnOthers(const FIX::Message& msg, char exec_type,
-                const std::string& text) {
-    Order::IdType clordid = atol(msg.getField(FIX::FIELD::ClOrdID).c_str());
-    HandleOthers(clordid, static_cast<OrderStatus>(exec_type), text,
-                 transact_time_);
+  void OnOthers(const ExecReport& r, char exec_type, const std::string& text) {
+    HandleOthers(ExecReport::Id(r.clordid), static_cast<OrderStatus>(exec_type),
+                 text, transact_time_);
   }
 
-  void OnPendingNew(const FIX::Message& msg, const std::string& text) {
-    Order::IdType clordid = atol(msg.getField(FIX::FIELD::ClOrdID).c_str());
-    HandlePendingNew(clordid, text, transact_time_);
+  void OnPendingNew(const ExecReport& r, const std::string& text) {
+    HandlePendingNew(ExecReport::Id(r.clordid), text, transact_time_);
   }
 
-  void OnFilled(const FIX::Message& msg, char exec_type, bool is_partial) {
-    char exec_trans_type = FIX::ExecTransType_NEW;
-    if (msg.isSetField(FIX::FIELD::ExecTransType))
-      exec_trans_type = msg.getField(FIX::FIELD::ExecTransType)[0];
-    if (exec_trans_type == FIX::ExecTransType_CORRECT) {
+  void OnFilled(const ExecReport& r, char exec_type, bool is_partial) {
+    if (r.exec_trans_type == FIX::ExecTransType_CORRECT) {
       LOG_WARN(name() << ": Ignoring FIX::ExecTransType_CORRECT");
       return;
     }
-    auto exec_id = msg.getField(FIX::FIELD::ExecID);
-    auto last_shares = atof(msg.getField(FIX::FIELD::LastShares).c_str());
+    auto last_shares = ExecReport::Number(r.last_shares);
     if (multiplier_ > 0) last_shares = Round6(last_shares * multiplier_);
-    auto last_px = atof(msg.getField(FIX::FIELD::LastPx).c_str());
-    auto clordid = atol(msg.getField(FIX::FIELD::ClOrdID).c_str());
-    HandleFill(clordid, last_shares, last_px, exec_id, transact_time_,
-               is_partial, static_cast<ExecTransType>(exec_trans_type));
+    HandleFill(ExecReport::Id(r.clordid), last_shares,
+               ExecReport::Number(r.last_px), ExecReport::Str(r.exec_id),
+               transact_time_, is_partial,
+               static_cast<ExecTransType>(r.exec_trans_type));
   }
 
-  void OnCanceled(const FIX::Message& msg, const std::string& text) {
-    Order::IdType orig_id = 0;
-    if (msg.isSetField(FIX::FIELD::OrigClOrdID))
-      orig_id = atol(msg.getField(FIX::FIELD::OrigClOrdID).c_str());
-    Order::IdType clordid = 0;
-    if (msg.isSetField(FIX::FIELD::ClOrdID))
-      clordid = atol(msg.getField(FIX::FIELD::ClOrdID).c_str());
-    HandleCanceled(clordid, orig_id, text, transact_time_);
+  void OnCanceled(const ExecReport& r, const std::string& text) {
+    HandleCanceled(ExecReport::Id(r.clordid), ExecReport::Id(r.orig_clordid),
+                   text, transact_time_);
   }
 
-  void OnPendingCancel(const FIX::Message& msg) {
-    Order::IdType orig_id = 0;
-    if (msg.isSetField(FIX::FIELD::OrigClOrdID))
-      orig_id = atol(msg.getField(FIX::FIELD::OrigClOrdID).c_str());
-    Order::IdType clordid = 0;
-    if (msg.isSetField(FIX::FIELD::ClOrdID))
-      clordid = atol(msg.getField(FIX::FIELD::ClOrdID).c_str());
-    HandlePendingCancel(clordid, orig_id, transact_time_);
+  void OnPendingCancel(const ExecReport& r) {
+    HandlePendingCancel(ExecReport::Id(r.clordid),
+                        ExecReport::Id(r.orig_clordid), transact_time_);
+  }
+
+  void OnPendingReplace(const ExecReport& r) {
+    HandlePendingReplace(ExecReport::Id(r.clordid), transact_time_);
   }
 
-  template <typename MDEntry>
-  inline void OnMarketData(const FIX::Message& msg) {
-    auto req_id = atoi(msg.getField(FIX::FIELD::MDReqID).c_str());
-    auto req = reqs_.find(req_id);
+  // walks the NoMDEntries groups in place, parsed already by quickfix,
+  // instead of copying each out with getGroup and looking up its fields,
+  // and applies them to MarketData with one update per message
+  inline void OnMarketData(const FIX::Message& msg, bool snapshot = false) {
+    const std::string* req_id = nullptr;
+    for (auto& it : msg) {
+      auto& field = ExecReport::FieldOf(it);
+      if (field.getTag() != FIX::FIELD::MDReqID) continue;
+      req_id = &field.getString();
+      break;
+    }
+    if (!req_id) return;
+    auto req = reqs_.find(atoi(req_id->c_str()));
     if (req == reqs_.end()) return;
-    auto no_md_entries = atoi(msg.getField(FIX::FIELD::NoMDEntries).c_str());
-    auto mid0 = req->second.md->mid();
-    for (auto i = 1; i <= no_md_entries; i++) {
-      MDEntry md_entry;
-      msg.getGroup(i, md_entry);
-      double price = 0.;
-      if (md_entry.isSetField(FIX::FIELD::MDEntryPx))
-        price = atof(md_entry.getField(FIX::FIELD::MDEntryPx).c_str());
-      MarketData::Qty size = 0;
-      if (md_entry.isSetField(FIX::FIELD::MDEntrySize)) {
-        size = atoll(md_entry.getField(FIX::FIELD::MDEntrySize).c_str());
-        if (multiplier_ > 0) size = Round6(multiplier_ * size);
-      }
-      if (md_entry.isSetField(FIX::FIELD::MDUpdateAction)) {
-        auto action = *md_entry.getField(FIX::FIELD::MDUpdateAction).c_str();
-        if (action == FIX::MDUpdateAction_DELETE) {
-          price = 0;
-          size = 0;
+    auto& r = req->second;
+    auto mid0 = r.md->mid();
+    // deeper than MarketData::kDepthSize goes to OrderBook
+    auto full_book = market_depth_ > 1;
+    auto quote = r.md->quote();
+    auto quote0 = quote;
+    book_entries_.clear();
+    for (auto g = msg.g_begin(); g != msg.g_end(); ++g) {
+      if (g->first != FIX::FIELD::NoMDEntries) continue;
+      for (auto md_entry : g->second) {
+        MDEntry e(*md_entry, multiplier_);
+        if (e.is_delete) {
+          if (!full_book) e.price = 0;
+          e.size = 0;
         }
+        if (full_book) {
+          book_entries_.push_back({e.price, e.size, e.is_bid});
+          continue;
+        }
+        UpdateQuote(*md_entry, e.price, e.size, e.is_bid, &r, &quote);
       }
-      auto type = *md_entry.getField(FIX::FIELD::MDEntryType).c_str();
-      UpdateQuote(md_entry, price, size, type == FIX::MDEntryType_BID,
-                  &req->second);
     }
-    AfterOnMarketData(&req->second);
+    if (full_book) {
+      if (snapshot || !book_entries_.empty())
+        r.src->UpdateBook(r.sec->id, book_entries_, snapshot, 0, r.md);
+    } else if (quote != quote0) {
+      r.src->Update(r.sec->id, quote, 0, 0, r.md);
+    }
+    AfterOnMarketData(&r);
     if (update_fx_price_) {
-      auto mid = req->second.md->mid();
-      if (mid != mid0)
-        req->second.src->UpdateLastPrice(req->second.sec->id, mid, 0,
-                                         req->second.md);
+      auto mid = r.md->mid();
+      if (mid != mid0) r.src->UpdateLastPrice(r.sec->id, mid, 0, r.md);
     }
   }
 
+  // the fields of one NoMDEntries group in one pass
+  struct MDEntry {
+    double price = 0;
+    MarketData::Qty size = 0;
+    bool is_bid = false;
+    bool is_delete = false;
+
+    MDEntry(const FIX::FieldMap& group, double multiplier) {
+      for (auto& it : group) {
+        auto& field = ExecReport::FieldOf(it);
+        auto& v = field.getString();
+        switch (field.getTag()) {
+          case FIX::FIELD::MDEntryPx:
+            price = atof(v.c_str());
+            break;
+          case FIX::FIELD::MDEntrySize:
+            size = atoll(v.c_str());
+            if (multiplier > 0) size = Round6(multiplier * size);
+            break;
+          case FIX::FIELD::MDEntryType:
+            is_bid = !v.empty() && v[0] == FIX::MDEntryType_BID;
+            break;
+          case FIX::FIELD::MDUpdateAction:
+            is_delete = !v.empty() && v[0] == FIX::MDUpdateAction_DELETE;
+            break;
+          default:
+            break;
+        }
+      }
+    }
+  };
+
   struct ReqTuple {
     MarketDataAdapter* src;
     const Security* sec;
     MarketData* md;
     void* misc;
+    bool disabled = false;
   };
 
+  // applies an entry to the top quote, published after the whole message
   virtual void UpdateQuote(const FIX::FieldMap& md_entry, double price,
-                           MarketData::Qty size, bool is_bid, ReqTuple* req) {
-    req->src->Update(req->sec->id, price, size, is_bid, 0, 0, req->md);
+                           MarketData::Qty size, bool is_bid, ReqTuple* req,
+                           MarketData::Quote* quote) {
+    if (is_bid) {
+      quote->bid_price = price;
+      quote->bid_size = size;
+    } else {
+      quote->ask_price = price;
+      quote->ask_size = size;
+    }
   }
 
   virtual void AfterOnMarketData(ReqTuple* req) {}
@@ -300,13 +531,13 @@ class FixAdapter : public Application,
   virtual void SetRelatedSymbol(const Security& sec, DataSrc src,
                                 FIX::Message* msg) noexcept = 0;
 
-  void OnReplaced(const FIX::Message& msg, const std::string& text) {
-    // to-do
+  void OnReplaced(const ExecReport& r, const std::string& text) {
+    HandleReplaced(ExecReport::Id(r.clordid), ExecReport::Str(r.order_id),
+                   transact_time_);
   }
 
-  void OnRejected(const FIX::Message& msg, const std::string& text) {
-    Order::IdType clordid = atol(msg.getField(FIX::FIELD::ClOrdID).c_str());
-    HandleNewRejected(clordid, text, transact_time_);
+  void OnRejected(const ExecReport& r, const std::string& text) {
+    HandleNewRejected(ExecReport::Id(r.clordid), text, transact_time_);
   }
 
   // Cancel or Replace msg got rejected
@@ -315,11 +546,10 @@ class FixAdapter : public Application,
     msg.getField(rejResponse);
     switch (rejResponse) {
       case FIX::CxlRejResponseTo_ORDER_CANCEL_REQUEST:
-        break;
       case FIX::CxlRejResponseTo_ORDER_CANCEL_REPLACE_REQUEST:
-      default:
-        return;  // to-do: replace rejected
         break;
+      default:
+        return;
     }
 
     Order::IdType orig_id = 0;
@@ -331,23 +561,27 @@ class FixAdapter : public Application,
     UpdateTm(msg);
     std::string text;
     if (msg.isSetField(FIX::FIELD::Text)) text = msg.getField(FIX::FIELD::Text);
-    HandleCancelRejected(clordid, orig_id, text, transact_time_);
+    if (rejResponse == FIX::CxlRejResponseTo_ORDER_CANCEL_REPLACE_REQUEST)
+      HandleReplaceRejected(clordid, text, transact_time_);
+    else
+      HandleCancelRejected(clordid, orig_id, text, transact_time_);
   }
 
   virtual void SetExtraTags(const Order& ord, FIX::Message* msg) {}
 
+  // the tags which change from order to order
   void SetTags(const Order& ord, FIX::Message* msg) {
-    if (!ord.orig_id) {  // not cancel
+    if (!ord.orig_id || ord.IsReplacing()) {  // not cancel
       if (ord.type != kMarket && ord.type != kStop) {
         msg->setField(FIX::Price(ord.price));
       }
       if (ord.stop_price) msg->setField(FIX::StopPx(ord.stop_price));
       msg->setField(FIX::TimeInForce(ord.tif));
-    } else {
+    }
+    if (ord.orig_id) {
       msg->setField(FIX::OrigClOrdID(std::to_string(ord.orig_id)));
     }
 
-    msg->setField(FIX::HandlInst('1'));
     msg->setField(FIX::OrderQty(multiplier_ > 0 ? Round6(ord.qty / multiplier_)
                                                 : ord.qty));
     msg->setField(FIX::ClOrdID(std::to_string(ord.id)));
@@ -355,14 +589,27 @@ class FixAdapter : public Application,
     if (ord.side == kShort) msg->setField(FIX::LocateReqd(false));
     msg->setField(FIX::TransactTime());
     msg->setField(FIX::OrdType(ord.type));
+  }
+
+  static bool IsOrderTag(int tag) {
+    static const std::unordered_set<int> kTags{
+        FIX::FIELD::Price,    FIX::FIELD::StopPx,     FIX::FIELD::TimeInForce,
+        FIX::FIELD::OrigClOrdID, FIX::FIELD::OrderQty, FIX::FIELD::ClOrdID,
+        FIX::FIELD::Side,     FIX::FIELD::LocateReqd, FIX::FIELD::TransactTime,
+        FIX::FIELD::OrdType};
+    return kTags.count(tag);
+  }
 
-    auto type = ord.sec->type;
+  // the tags of the security, same for all its orders
+  void SetSecurityTags(const Security& sec, FIX::Message* msg) {
+    msg->setField(FIX::HandlInst('1'));
+    auto type = sec.type;
     if (type == kOption) {
-      msg->setField(FIX::PutOrCall(ord.sec->put_or_call));
+      msg->setField(FIX::PutOrCall(sec.put_or_call));
       msg->setField(FIX::OptAttribute('A'));
-      msg->setField(FIX::StrikePrice(ord.sec->strike_price));
+      msg->setField(FIX::StrikePrice(sec.strike_price));
       msg->setField(FIX::SecurityType(FIX::SecurityType_OPTION));
-      auto d = ord.sec->maturity_date;
+      auto d = sec.maturity_date;
       msg->setField(FIX::MaturityMonthYear(std::to_string(d / 100)));
       msg->setField(FIX::MaturityDay(std::to_string(d % 100)));
     } else if (type == kStock) {
@@ -373,8 +620,49 @@ class FixAdapter : public Application,
       msg->setField(FIX::Product(FIX::Product_CURRENCY));
     }
 
-    SetSymbol(*ord.sec, msg);
-    msg->setField(FIX::ExDestination(ord.sec->exchange->name));
+    SetSymbol(sec, msg);
+    msg->setField(FIX::ExDestination(sec.exchange->name));
+  }
+
+  // Security and broker account tags of an order message, built on the
+  // first order of (msg type, broker account, security) and copied for
+  // the next ones, rebuilt once the broker account params are reloaded.
+  struct Template {
+    uint64_t params_version = 0;
+    FIX::Message msg;
+    // broker params on the tags of SetTags, applied after them
+    std::vector<std::pair<std::string, std::string>> overrides;
+  };
+  typedef std::shared_ptr<const Template> TemplatePtr;
+
+  TemplatePtr GetTemplate(const Order& ord, const FIX::Message& msg) {
+    auto& msg_type = msg.getHeader().getField(FIX::FIELD::MsgType);
+    auto key = static_cast<uint64_t>(msg_type.empty() ? 0 : msg_type[0]) << 48 |
+               static_cast<uint64_t>(ord.broker_account->id) << 32 |
+               ord.sec->id;
+    auto version = ord.broker_account->params_version();
+    {
+      std::lock_guard<std::mutex> lock(templates_m_);
+      auto it = templates_.find(key);
+      if (it != templates_.end() && it->second->params_version == version)
+        return it->second;
+    }
+    auto params = ord.broker_account->params();
+    auto tmpl = std::make_shared<Template>();
+    tmpl->params_version = version;
+    tmpl->msg = msg;
+    SetSecurityTags(*ord.sec, &tmpl->msg);
+    for (auto& pair : *params) {
+      auto& k = pair.first;
+      if (k.find(kTagPrefix) == 0 &&
+          IsOrderTag(atoi(k.c_str() + kTagPrefix.length())))
+        tmpl->overrides.push_back(pair);
+      else
+        Set(k, pair.second, &tmpl->msg);
+    }
+    std::lock_guard<std::mutex> lock(templates_m_);
+    templates_[key] = tmpl;
+    return tmpl;
   }
 
   inline void Set(const std::string& key, const std::string& value,
@@ -392,21 +680,43 @@ class FixAdapter : public Application,
     }
   }
 
-  void SetBrokerTags(const Order& ord, FIX::Message* msg) {
-    auto params = ord.broker_account->params();
-    for (auto& pair : *params) Set(pair.first, pair.second, msg);
+  void SetBrokerTags(const Order& ord, const Template& tmpl,
+                     FIX::Message* msg) {
+    for (auto& pair : tmpl.overrides) Set(pair.first, pair.second, msg);
     if (ord.optional) {
       for (auto& pair : *ord.optional)
         Set(pair.first, ToString(pair.second), msg);
     }
   }
 
+  // straight to the session resolved on creation, under its own lock only
   bool Send(FIX::Message* msg) { return session_->send(*msg); }
 
+  // with send_thread=1 the message is built and sent by writer_ in order,
+  // and a failure is confirmed as the rejection of the request
   virtual std::string SetAndSend(const opentrade::Order& ord,
                                  FIX::Message* msg) {
+    if (!writer_) return BuildAndSend(ord, msg);
+    writer_->AddTask([this, &ord, msg = *msg]() mutable {
+      auto err = BuildAndSend(ord, &msg);
+      if (err.empty()) return;
+      auto& msg_type = msg.getHeader().getField(FIX::FIELD::MsgType);
+      if (msg_type == FIX::MsgType_NewOrderSingle) {
+        HandleNewRejected(ord.id, err);
+      } else if (msg_type == FIX::MsgType_OrderCancelRequest) {
+        HandleCancelRejected(ord.id, ord.orig_id, err);
+      } else if (msg_type == FIX::MsgType_OrderCancelReplaceRequest) {
+        HandleReplaceRejected(ord.id, err);
+      }
+    });
+    return {};
+  }
+
+  std::string BuildAndSend(const opentrade::Order& ord, FIX::Message* msg) {
+    auto tmpl = GetTemplate(ord, *msg);
+    *msg = tmpl->msg;
     SetTags(ord, msg);
-    SetBrokerTags(ord, msg);
+    SetBrokerTags(ord, *tmpl, msg);
     SetExtraTags(ord, msg);
     if (Send(msg))
       return {};
@@ -429,10 +739,21 @@ class FixAdapter : public Application,
   FIX::MDUpdateType md_update_type_ = FIX::MDUpdateType_INCREMENTAL_REFRESH;
   bool update_fx_price_ = false;
   double multiplier_ = 0;
+  bool fast_exec_report_ = true;
+  bool replace_ = true;
+  bool mass_cancel_ = false;
+  cpu_set_t cpus_;
+  bool pin_ = false;
+  std::shared_ptr<FixReactor> reactor_;
+  std::unique_ptr<TaskPool> writer_;
+  std::vector<MarketDataAdapter::BookEntry> book_entries_;
+  std::unordered_map<uint64_t, TemplatePtr> templates_;
+  std::mutex templates_m_;
 };
 
 template <typename NewOrderSingle, typename OrderCancelRequest,
-          typename ExecutionReport, typename TradingSessionStatus,
+          typename OrderCancelReplaceRequest, typename ExecutionReport,
+          typename TradingSessionStatus,
           typename OrderCancelReject, typename MarketDataSnapshotFullRefresh,
           typename MarketDataIncrementalRefresh,
           typename MarketDataRequestReject, typename MarketDataRequest>
@@ -462,15 +783,21 @@ class FixTmpl : public FixAdapter {
     return SetAndSend(ord, &msg);
   }
 
+  bool replace_supported() const noexcept override { return replace_; }
+
+  std::string Replace(const opentrade::Order& ord) noexcept override {
+    OrderCancelReplaceRequest msg;
+    return SetAndSend(ord, &msg);
+  }
+
   void onMessage(const MarketDataSnapshotFullRefresh& depth,
                  const FIX::SessionID& session) override {
-    OnMarketData<typename MarketDataSnapshotFullRefresh::NoMDEntries>(depth);
+    OnMarketData(depth, true);
   }
 
   void onMessage(const MarketDataIncrementalRefresh& depth_refresh,
                  const FIX::SessionID& session) override {
-    OnMarketData<typename MarketDataIncrementalRefresh::NoMDEntries>(
-        depth_refresh);
+    OnMarketData(depth_refresh);
   }
 
   void onMessage(const MarketDataRequestReject& reject,
@@ -489,6 +816,11 @@ class FixTmpl : public FixAdapter {
 
   virtual void* CreateReqMisc() { return nullptr; }
 
+  // the dummy feeds of srcs_ are routed on their own
+  bool unsubscribe_supported() const noexcept override {
+    return srcs_.size() == 1 && srcs_.front() == this;
+  }
+
   void SubscribeSync(const Security& sec) noexcept override {
     for (auto& src : srcs_) {
       auto n = ++request_counter_;
@@ -504,6 +836,23 @@ class FixTmpl : public FixAdapter {
     }
   }
 
+  // the entries of reqs_ stay, late updates of them are harmless
+  bool UnsubscribeSync(const Security& sec) noexcept override {
+    for (auto& pair : reqs_) {
+      auto& r = pair.second;
+      if (r.sec != &sec || r.disabled) continue;
+      r.disabled = true;
+      FIX::SubscriptionRequestType sub_type(
+          FIX::SubscriptionRequestType_DISABLE_PREVIOUS_SNAPSHOT_PLUS_UPDATE_REQUEST);
+      FIX::MDReqID md_req_id(std::to_string(pair.first));
+      MarketDataRequest req(md_req_id, sub_type, market_depth_);
+      req.set(md_update_type_);
+      SetRelatedSymbol(sec, DataSrc(r.src->src()), &req);
+      Send(&req);
+    }
+    return true;
+  }
+
   void SetRelatedSymbol(const Security& sec, DataSrc src,
                         FIX::Message* msg) noexcept override {
     typename MarketDataRequest::NoMDEntryTypes type_group;
@@ -521,8 +870,8 @@ class FixTmpl : public FixAdapter {
 
 class Fix42
     : public FixTmpl<FIX42::NewOrderSingle, FIX42::OrderCancelRequest,
-                     FIX42::ExecutionReport, FIX42::TradingSessionStatus,
-                     FIX42::OrderCancelReject,
+                     FIX42::OrderCancelReplaceRequest, FIX42::ExecutionReport,
+                     FIX42::TradingSessionStatus, FIX42::OrderCancelReject,
                      FIX42::MarketDataSnapshotFullRefresh,
                      FIX42::MarketDataIncrementalRefresh,
                      FIX42::MarketDataRequestReject, FIX42::MarketDataRequest> {
@@ -530,11 +879,56 @@ class Fix42
 
 class Fix44
     : public FixTmpl<FIX44::NewOrderSingle, FIX44::OrderCancelRequest,
-                     FIX44::ExecutionReport, FIX44::TradingSessionStatus,
-                     FIX44::OrderCancelReject,
+                     FIX44::OrderCancelReplaceRequest, FIX44::ExecutionReport,
+                     FIX44::TradingSessionStatus, FIX44::OrderCancelReject,
                      FIX44::MarketDataSnapshotFullRefresh,
                      FIX44::MarketDataIncrementalRefresh,
                      FIX44::MarketDataRequestReject, FIX44::MarketDataRequest> {
+ public:
+  bool mass_cancel_supported() const noexcept override { return mass_cancel_; }
+
+  std::string MassCancel(const Security* sec) noexcept override {
+    auto id = GlobalOrderBook::Instance().NewOrderId();
+    FIX44::OrderMassCancelRequest msg(
+        FIX::ClOrdID(std::to_string(id)),
+        FIX::MassCancelRequestType(
+            sec ? FIX::MassCancelRequestType_CANCEL_ORDERS_FOR_A_SECURITY
+                : FIX::MassCancelRequestType_CANCEL_ALL_ORDERS),
+        FIX::TransactTime());
+    if (sec) SetSecurityTags(*sec, &msg);
+    if (!Send(&msg)) return "Failed in FIX::Session::send()";
+    std::lock_guard<std::mutex> lock(mass_cancels_m_);
+    mass_cancels_[id] = sec;
+    return {};
+  }
+
+  // the venue has canceled nothing if rejected, falls back to one by one
+  void onMessage(const FIX44::OrderMassCancelReport& msg,
+                 const FIX::SessionID& id) override {
+    auto clordid = atol(msg.getField(FIX::FIELD::ClOrdID).c_str());
+    const Security* sec = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mass_cancels_m_);
+      auto it = mass_cancels_.find(clordid);
+      if (it == mass_cancels_.end()) return;
+      sec = it->second;
+      mass_cancels_.erase(it);
+    }
+    if (msg.getField(FIX::FIELD::MassCancelResponse)[0] !=
+        FIX::MassCancelResponse_CANCEL_REQUEST_REJECTED)
+      return;
+    std::string text;
+    if (msg.isSetField(FIX::FIELD::Text)) text = msg.getField(FIX::FIELD::Text);
+    LOG_WARN(name() << ": mass cancel rejected, " << text);
+    auto& ec = ExchangeConnectivityManager::Instance();
+    for (auto ord : GlobalOrderBook::Instance().GetOrders(this)) {
+      if (ord->IsLive() && (!sec || ord->sec == sec)) ec.Cancel(*ord);
+    }
+  }
+
+ private:
+  std::unordered_map<Order::IdType, const Security*> mass_cancels_;
+  std::mutex mass_cancels_m_;
 };
 
 }  // namespace opentrade
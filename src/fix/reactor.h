@@ -0,0 +1,116 @@
+#ifndef FIX_REACTOR_H_
+#define FIX_REACTOR_H_
+
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#define throw(...)
+#include <quickfix/Initiator.h>
+#undef throw
+
+#include "opentrade/utility.h"
+
+namespace opentrade {
+
+// "2-3,6" to cpu set, false if empty or invalid
+inline bool ParseCpuSet(const std::string& str, cpu_set_t* set) {
+  CPU_ZERO(set);
+  auto n = 0;
+  for (auto& tok : Split(str, ", ")) {
+    auto dash = tok.find('-');
+    auto a = atoi(tok.c_str());
+    auto b = dash == std::string::npos ? a : atoi(tok.c_str() + dash + 1);
+    if (a < 0 || b < a || b >= CPU_SETSIZE) return false;
+    for (auto i = a; i <= b; ++i, ++n) CPU_SET(i, set);
+  }
+  return n > 0;
+}
+
+inline void PinThread(const cpu_set_t& set) {
+  auto err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (err) std::cerr << "Failed to set thread affinity: " << err << std::endl;
+}
+
+// One thread polling the SocketInitiators of several FIX adapters, in place
+// of a thread per session. With one initiator it blocks in select, with
+// more it busy polls and should be pinned to its own cpus.
+class FixReactor {
+ public:
+  static std::shared_ptr<FixReactor> Get(const std::string& name) {
+    static std::mutex m;
+    static std::map<std::string, std::weak_ptr<FixReactor>> reactors;
+    std::lock_guard<std::mutex> lock(m);
+    auto& r = reactors[name];
+    auto out = r.lock();
+    if (!out) r = out = std::make_shared<FixReactor>();
+    return out;
+  }
+
+  ~FixReactor() {
+    stop_ = true;
+    if (thread_.joinable()) thread_.join();
+  }
+
+  // the first cpus given wins
+  void Add(FIX::Initiator* initiator, const cpu_set_t* cpus) {
+    std::lock_guard<std::mutex> lock(m_);
+    initiators_.push_back(initiator);
+    if (cpus && !pinned_) {
+      cpus_ = *cpus;
+      pinned_ = true;
+    }
+    if (!thread_.joinable()) thread_ = std::thread([this]() { Run(); });
+  }
+
+  // returns once the reactor thread is out of initiator
+  void Remove(FIX::Initiator* initiator) {
+    std::lock_guard<std::mutex> lock(m_);
+    initiators_.erase(
+        std::remove(initiators_.begin(), initiators_.end(), initiator),
+        initiators_.end());
+  }
+
+ private:
+  void Run() {
+    auto pinned = false;
+    while (!stop_) {
+      std::unique_lock<std::mutex> lock(m_);
+      if (pinned_ && !pinned) {
+        PinThread(cpus_);
+        pinned = true;
+      }
+      if (initiators_.empty()) {
+        lock.unlock();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        continue;
+      }
+      auto timeout = initiators_.size() > 1 ? 0. : 0.1;
+      for (auto initiator : initiators_) {
+        try {
+          initiator->poll(timeout);
+        } catch (std::exception& e) {
+          std::cerr << "FIX reactor: " << e.what() << std::endl;
+        }
+      }
+    }
+  }
+
+  std::mutex m_;
+  std::vector<FIX::Initiator*> initiators_;
+  std::thread thread_;
+  std::atomic<bool> stop_ = false;
+  cpu_set_t cpus_;
+  bool pinned_ = false;
+};
+
+}  // namespace opentrade
+
+#endif  // FIX_REACTOR_H_
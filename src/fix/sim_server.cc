@@ -1,249 +1,330 @@
 #include "sim_server.h"
 
-#include <boost/uuid/uuid.hpp>
-#include <boost/uuid/uuid_generators.hpp>
-#include <boost/uuid/uuid_io.hpp>
+#include <cmath>
+#include <sstream>
 
 #include "opentrade/market_data.h"
 
-static thread_local boost::uuids::random_generator kUuidGen;
-void SimServer::HandleTick(Security::IdType sec, char type, double px,
-                           double qty) {
-  if (px <= 0 || qty <= 0) return;
-  tp_.AddTask([=]() {
-    auto size = qty;
-    auto& actives = active_orders_[sec];
-    if (actives.empty()) return;
-    auto it = actives.begin();
-    if (type == 'T' && rand_r(&seed_) % 100 / 100. < (1 - trade_hit_ratio_))
-      return;
-    while (it != actives.end() && size > 0) {
-      auto& tuple = it->second;
-      bool ok;
-      switch (type) {
-        case 'T':
-          ok = (tuple.is_buy && px <= tuple.px) ||
-               (!tuple.is_buy && px >= tuple.px);
-          break;
-        case 'A':
-          ok = tuple.is_buy && px <= tuple.px;
-          break;
-        case 'B':
-          ok = !tuple.is_buy && px >= tuple.px;
-          break;
-        default:
-          ok = false;
-          break;
+// quickfix before 1.15 keeps fields in a multimap
+static inline const FIX::FieldBase& FieldOf(const FIX::FieldBase& f) {
+  return f;
+}
+template <typename Pair>
+static inline const FIX::FieldBase& FieldOf(const Pair& p) {
+  return p.second;
+}
+
+// one message per thread refilled for every response, instead of a copy of
+// the request kept per order
+static inline FIX::Message& Reset(const char* msg_type) {
+  static thread_local FIX::Message kMsg;
+  kMsg.clear();
+  kMsg.getHeader().setField(FIX::MsgType(msg_type));
+  return kMsg;
+}
+
+void SimServer::Send(const Order& ord, char exec_type, const char* text,
+                     double last_qty, double last_px,
+                     const std::string* cancel_id) {
+  auto& resp = Reset(FIX::MsgType_ExecutionReport);
+  if (cancel_id) {
+    resp.setField(FIX::ClOrdID(*cancel_id));
+    resp.setField(FIX::OrigClOrdID(ord.clordid));
+  } else {
+    resp.setField(FIX::ClOrdID(ord.clordid));
+  }
+  resp.setField(FIX::OrderID("SIM-" + ord.clordid));
+  resp.setField(FIX::ExecID(exec_id_prefix_ + std::to_string(++exec_id_)));
+  resp.setField(FIX::ExecTransType(FIX::ExecTransType_NEW));
+  resp.setField(FIX::ExecType(exec_type));
+  resp.setField(FIX::OrdStatus(exec_type));
+  resp.setField(FIX::Symbol(ord.symbol));
+  resp.setField(FIX::Side(ord.side));
+  resp.setField(FIX::OrderQty(ord.qty));
+  if (ord.px > 0) resp.setField(FIX::Price(ord.px));
+  resp.setField(FIX::LeavesQty(ord.leaves));
+  resp.setField(FIX::CumQty(ord.cum));
+  resp.setField(FIX::AvgPx(ord.avg_px));
+  if (last_qty > 0) {
+    resp.setField(FIX::LastShares(last_qty));
+    resp.setField(FIX::LastPx(last_px));
+  }
+  if (text) resp.setField(FIX::Text(text));
+  resp.setField(FIX::TransactTime(FIX::UTCTIMESTAMP()));
+  ord.session->send(resp);
+}
+
+void SimServer::Reject(const Request& req, const char* text) {
+  stats_.rejects.fetch_add(1, std::memory_order_relaxed);
+  if (req.msg_type == 'F') {
+    auto& resp = Reset(FIX::MsgType_OrderCancelReject);
+    resp.setField(FIX::ClOrdID(req.clordid));
+    resp.setField(FIX::OrigClOrdID(req.orig_clordid));
+    resp.setField(FIX::OrderID("SIM-" + req.orig_clordid));
+    resp.setField(FIX::OrdStatus(FIX::OrdStatus_REJECTED));
+    resp.setField(
+        FIX::CxlRejResponseTo(FIX::CxlRejResponseTo_ORDER_CANCEL_REQUEST));
+    resp.setField(FIX::Text(text));
+    resp.setField(FIX::TransactTime(FIX::UTCTIMESTAMP()));
+    req.session->send(resp);
+    return;
+  }
+  Order ord{req.session, req.clordid, req.symbol, req.side,
+            req.px,      req.qty,     0};
+  Send(ord, FIX::ExecType_REJECTED, text);
+}
+
+void SimServer::Fill(Order* ord, double qty, double px) {
+  ord->avg_px = (ord->avg_px * ord->cum + qty * px) / (ord->cum + qty);
+  ord->cum += qty;
+  ord->leaves -= qty;
+  assert(ord->leaves >= 0);
+  stats_.fills.fetch_add(1, std::memory_order_relaxed);
+  Send(*ord,
+       ord->leaves <= 0 ? FIX::ExecType_FILL : FIX::ExecType_PARTIAL_FILL,
+       nullptr, qty, px);
+}
+
+// the orders at px or better, the touch of their side moved to px
+template <typename Levels>
+void SimServer::UpdateQueue(Levels* levels, double px, double qty) {
+  for (auto& lvl : *levels) {
+    if (levels->key_comp()(px, lvl.first) &&
+        !opentrade::SamePrice(px, lvl.first))
+      break;
+    for (auto& ord : lvl.second)
+      opentrade::UpdateQueue(ord.is_buy(), lvl.first, px, qty, &ord.ahead);
+  }
+}
+
+// fills the orders crossed by px, best price first, then time priority
+template <typename Levels>
+void SimServer::Fill(Levels* levels, double px, char type, double* size,
+                     Shard* shard) {
+  auto queue = trade_hit_ratio_ < 0;
+  auto qty = *size;
+  for (auto lvl = levels->begin(); lvl != levels->end() && *size > 0;) {
+    if (levels->key_comp()(px, lvl->first)) break;
+    auto same = opentrade::SamePrice(px, lvl->first);
+    auto& orders = lvl->second;
+    for (auto it = orders.begin(); it != orders.end() && *size > 0;) {
+      auto n = std::min(*size, it->leaves);
+      if (type == 'T' && queue && same) {
+        // a print at our price eats the queue in front first
+        n = std::min(it->leaves, std::max(0., *size - it->ahead));
+        it->ahead = std::max(0., it->ahead - qty);
+        if (n <= 0) {
+          it++;
+          continue;
+        }
       }
-      if (!ok) {
+      *size -= n;
+      Fill(&*it, n, lvl->first);
+      if (it->leaves <= 0) {
+        shard->orders.erase(OrderKey(it->session, it->clordid));
+        it = orders.erase(it);
+      } else {
         it++;
-        continue;
       }
-      auto n = std::min(size, tuple.leaves);
-      size -= n;
-      tuple.leaves -= n;
-      assert(size >= 0);
-      assert(tuple.leaves >= 0);
-      auto& resp = tuple.resp;
-      resp.setField(FIX::ExecTransType('0'));
-      resp.setField(FIX::ExecType(
-          tuple.leaves <= 0 ? FIX::ExecType_FILL : FIX::ExecType_PARTIAL_FILL));
-      resp.setField(FIX::OrdStatus(
-          tuple.leaves <= 0 ? FIX::ExecType_FILL : FIX::ExecType_PARTIAL_FILL));
-      resp.setField(FIX::LastShares(n));
-      resp.setField(FIX::LastPx(tuple.px));
-      auto eid = boost::uuids::to_string(kUuidGen());
-      resp.setField(FIX::ExecID(eid));
-      resp.setField(FIX::TransactTime(FIX::UTCTIMESTAMP()));
-      session_->send(resp);
-      if (tuple.leaves <= 0)
-        it = actives.erase(it);
-      else
-        it++;
     }
-  });
+    if (orders.empty())
+      lvl = levels->erase(lvl);
+    else
+      lvl++;
+  }
+}
+
+void SimServer::HandleTick(Shard* shard, Security::IdType sec, char type,
+                           double px, double qty) {
+  auto it = shard->books.find(sec);
+  if (it == shard->books.end()) return;
+  auto& book = it->second;
+  if (type == 'A')
+    UpdateQueue(&book.asks, px, qty);
+  else if (type == 'B')
+    UpdateQueue(&book.bids, px, qty);
+  auto queue = trade_hit_ratio_ < 0;
+  if (type == 'T' && !queue &&
+      rand_r(&shard->seed) % 100 / 100. < (1 - trade_hit_ratio_))
+    return;
+  auto size = qty * fill_ratio_;
+  if (type == 'T' || type == 'A') Fill(&book.bids, px, type, &size, shard);
+  if (type == 'T' || type == 'B') Fill(&book.asks, px, type, &size, shard);
+}
+
+void SimServer::HandleTick(Security::IdType sec, char type, double px,
+                           double qty) {
+  if (px <= 0 || qty <= 0) return;
+  stats_.ticks.fetch_add(1, std::memory_order_relaxed);
+  auto shard = &GetShard(sec);
+  shard->tp.AddTask([=]() { HandleTick(shard, sec, type, px, qty); });
+}
+
+void SimServer::HandleNew(Shard* shard, const Request& req,
+                          const Security& sec) {
+  if (!sec.IsInTradePeriod()) return Reject(req, "Not in trading period");
+  if (req.qty <= 0) return Reject(req, "invalid OrderQty");
+  auto market = req.type == FIX::OrdType_MARKET;
+  if (req.px <= 0 && !market) return Reject(req, "invalid price");
+  Order ord{req.session, req.clordid, req.symbol, req.side,
+            req.px,      req.qty,     req.qty};
+  Send(ord, FIX::ExecType_PENDING_NEW);
+  OrderKey key(req.session, req.clordid);
+  if (!shard->ids.Insert(key)) {
+    stats_.rejects.fetch_add(1, std::memory_order_relaxed);
+    ord.leaves = 0;
+    Send(ord, FIX::ExecType_REJECTED, "duplicate ClOrdID");
+    return;
+  }
+  stats_.orders.fetch_add(1, std::memory_order_relaxed);
+  Send(ord, FIX::ExecType_NEW);
+  auto is_buy = ord.is_buy();
+  auto q = opentrade::MarketDataManager::Instance().Get(sec).quote();
+  auto qty_q = is_buy ? q.ask_size : q.bid_size;
+  auto px_q = is_buy ? q.ask_price : q.bid_price;
+  if (!qty_q && sec.type == opentrade::kForexPair) qty_q = 1e9;
+  auto crossed = qty_q > 0 && px_q > 0 &&
+                 (market || (is_buy && req.px >= px_q) ||
+                  (!is_buy && req.px <= px_q));
+  if (crossed) {
+    Fill(&ord, std::min<double>(qty_q, ord.leaves), px_q);
+    if (ord.leaves <= 0) return;
+  }
+  if (market || req.tif == FIX::TimeInForce_IMMEDIATE_OR_CANCEL) {
+    ord.leaves = 0;
+    Send(ord, FIX::ExecType_CANCELLED, "no quote");
+    return;
+  }
+  ord.ahead = opentrade::QueueAhead(is_buy, req.px, q);
+  auto& book = shard->books[sec.id];
+  auto& level = is_buy ? book.bids[req.px] : book.asks[req.px];
+  level.push_back(std::move(ord));
+  shard->orders[key] = OrderRef{sec.id, std::prev(level.end())};
+}
+
+template <typename Levels>
+static inline void Erase(Levels* levels, double px,
+                         typename Levels::mapped_type::iterator it) {
+  auto lvl = levels->find(px);
+  if (lvl == levels->end()) return;
+  lvl->second.erase(it);
+  if (lvl->second.empty()) levels->erase(lvl);
+}
+
+void SimServer::HandleCancel(Shard* shard, const Request& req) {
+  stats_.cancels.fetch_add(1, std::memory_order_relaxed);
+  if (!shard->ids.Insert(OrderKey(req.session, req.clordid)))
+    return Reject(req, "duplicate ClOrdID");
+  auto it = shard->orders.find(OrderKey(req.session, req.orig_clordid));
+  if (it == shard->orders.end()) return Reject(req, "inactive");
+  auto ref = it->second;
+  shard->orders.erase(it);
+  auto& ord = *ref.it;
+  ord.leaves = 0;
+  Send(ord, FIX::ExecType_CANCELLED, nullptr, 0, 0, &req.clordid);
+  auto& book = shard->books[ref.sec];
+  if (ord.is_buy())
+    Erase(&book.bids, ord.px, ref.it);
+  else
+    Erase(&book.asks, ord.px, ref.it);
+}
+
+void SimServer::Schedule(Shard* shard, const opentrade::Exchange* exch,
+                         std::function<void()> func) {
+  static thread_local std::mt19937 kRng(std::random_device{}());
+  auto delay = latencies_.Get(exch);
+  if (latency_jitter_ > 0) {
+    delay += std::exponential_distribution<>(1 / latency_jitter_)(kRng);
+  }
+  auto now = opentrade::TimerService::Now();
+  int64_t due;
+  {
+    // random latencies must not reorder the requests, e.g. new and cancel
+    std::lock_guard<std::mutex> lock(shard->m);
+    due = std::max(now + static_cast<int64_t>(delay), shard->due);
+    shard->due = due;
+  }
+  if (due <= now) {
+    shard->tp.AddTask(func);
+    return;
+  }
+  shard->tp.AddTask(func, boost::posix_time::microseconds(due - now));
 }
 
 void SimServer::fromApp(const FIX::Message& msg,
                         const FIX::SessionID& session_id) {
-  tp_.AddTask(
-      [=]() {
-        const std::string& msgType =
-            msg.getHeader().getField(FIX::FIELD::MsgType);
-        auto resp = msg;
-        if (msgType == "D") {  // new order
-          resp.getHeader().setField(FIX::MsgType("8"));
-          auto symbol = msg.getField(FIX::FIELD::Symbol);
-          auto exchange = msg.getField(FIX::FIELD::ExDestination);
-          auto sec =
-              opentrade::SecurityManager::Instance().Get(exchange, symbol);
-          if (!sec) {
-            resp.setField(FIX::ExecType(FIX::ExecType_REJECTED));
-            resp.setField(FIX::OrdStatus(FIX::ExecType_REJECTED));
-            resp.setField(FIX::Text("unknown security"));
-            resp.setField(FIX::TransactTime(FIX::UTCTIMESTAMP()));
-            session_->send(resp);
-            return;
-          }
-          if (!sec->IsInTradePeriod()) {
-            resp.setField(FIX::ExecType(FIX::ExecType_REJECTED));
-            resp.setField(FIX::OrdStatus(FIX::ExecType_REJECTED));
-            resp.setField(FIX::Text("Not in trading period"));
-            resp.setField(FIX::TransactTime(FIX::UTCTIMESTAMP()));
-            session_->send(resp);
-            return;
-          }
-          auto qty = atof(msg.getField(FIX::FIELD::OrderQty).c_str());
-          if (qty <= 0) {
-            resp.setField(FIX::ExecType(FIX::ExecType_REJECTED));
-            resp.setField(FIX::OrdStatus(FIX::ExecType_REJECTED));
-            resp.setField(FIX::Text("invalid OrderQty"));
-            resp.setField(FIX::TransactTime(FIX::UTCTIMESTAMP()));
-            session_->send(resp);
-            return;
-          }
-          auto px = 0.;
-          if (msg.isSetField(FIX::FIELD::Price))
-            px = atof(msg.getField(FIX::FIELD::Price).c_str());
-          FIX::OrdType type;
-          msg.getField(type);
-          if (px <= 0 && type != FIX::OrdType_MARKET) {
-            resp.setField(FIX::ExecType(FIX::ExecType_REJECTED));
-            resp.setField(FIX::OrdStatus(FIX::ExecType_REJECTED));
-            resp.setField(FIX::Text("invalid price"));
-            resp.setField(FIX::TransactTime(FIX::UTCTIMESTAMP()));
-            session_->send(resp);
-            return;
-          }
-          resp.setField(FIX::ExecType(FIX::ExecType_PENDING_NEW));
-          resp.setField(FIX::OrdStatus(FIX::ExecType_PENDING_NEW));
-          resp.setField(FIX::TransactTime(FIX::UTCTIMESTAMP()));
-          session_->send(resp);
-          auto clordid = msg.getField(FIX::FIELD::ClOrdID);
-          if (used_ids_.find(clordid) != used_ids_.end()) {
-            resp.setField(FIX::ExecType(FIX::ExecType_REJECTED));
-            resp.setField(FIX::OrdStatus(FIX::ExecType_REJECTED));
-            resp.setField(FIX::Text("duplicate ClOrdID"));
-            resp.setField(FIX::TransactTime(FIX::UTCTIMESTAMP()));
-            session_->send(resp);
-            return;
-          }
-          used_ids_.insert(clordid);
-          resp.setField(FIX::FIELD::OrderID, "SIM-" + clordid);
-          resp.setField(FIX::ExecType(FIX::ExecType_NEW));
-          resp.setField(FIX::OrdStatus(FIX::ExecType_NEW));
-          resp.setField(FIX::TransactTime(FIX::UTCTIMESTAMP()));
-          session_->send(resp);
-          FIX::Side side;
-          msg.getField(side);
-          auto is_buy = side == FIX::Side_BUY;
-          if (type == FIX::OrdType_MARKET) {
-            auto q = opentrade::MarketDataManager::Instance().Get(*sec).quote();
-            auto qty_q = is_buy ? q.ask_size : q.bid_size;
-            auto px_q = is_buy ? q.ask_price : q.bid_price;
-            if (!qty_q && sec->type == opentrade::kForexPair) qty_q = 1e9;
-            if (qty_q > 0 && px_q > 0) {
-              if (qty_q > qty) qty_q = qty;
-              resp.setField(FIX::ExecTransType('0'));
-              resp.setField(FIX::ExecType(qty_q == qty
-                                              ? FIX::ExecType_FILL
-                                              : FIX::ExecType_PARTIAL_FILL));
-              resp.setField(FIX::OrdStatus(qty_q == qty
-                                               ? FIX::ExecType_FILL
-                                               : FIX::ExecType_PARTIAL_FILL));
-              resp.setField(FIX::LastShares(qty_q));
-              resp.setField(FIX::LastPx(px_q));
-              auto eid = boost::uuids::to_string(kUuidGen());
-              resp.setField(FIX::ExecID(eid));
-              resp.setField(FIX::TransactTime(FIX::UTCTIMESTAMP()));
-              session_->send(resp);
-              if (qty_q >= qty) return;
-            }
-            resp.setField(FIX::ExecType(FIX::ExecType_CANCELLED));
-            resp.setField(FIX::OrdStatus(FIX::ExecType_CANCELLED));
-            resp.setField(FIX::Text("no quote"));
-            resp.setField(FIX::TransactTime(FIX::UTCTIMESTAMP()));
-            session_->send(resp);
-            return;
-          }
-          OrderTuple ord{px, qty, is_buy, resp};
-          auto q = opentrade::MarketDataManager::Instance().Get(*sec).quote();
-          auto qty_q = is_buy ? q.ask_size : q.bid_size;
-          auto px_q = is_buy ? q.ask_price : q.bid_price;
-          if (!qty_q && sec->type == opentrade::kForexPair) qty_q = 1e9;
-          if (qty_q > 0 && px_q > 0) {
-            if ((is_buy && px >= px_q) || (!is_buy && px <= px_q)) {
-              if (qty_q > qty) qty_q = qty;
-              resp.setField(FIX::ExecTransType('0'));
-              resp.setField(FIX::ExecType(qty_q == qty
-                                              ? FIX::ExecType_FILL
-                                              : FIX::ExecType_PARTIAL_FILL));
-              resp.setField(FIX::OrdStatus(qty_q == qty
-                                               ? FIX::ExecType_FILL
-                                               : FIX::ExecType_PARTIAL_FILL));
-              resp.setField(FIX::LastShares(qty_q));
-              resp.setField(FIX::LastPx(px_q));
-              auto eid = boost::uuids::to_string(kUuidGen());
-              resp.setField(FIX::ExecID(eid));
-              resp.setField(FIX::TransactTime(FIX::UTCTIMESTAMP()));
-              session_->send(resp);
-              ord.leaves -= qty_q;
-              assert(ord.leaves >= 0);
-              if (ord.leaves <= 0) return;
-            }
-          }
-          FIX::TimeInForce tif;
-          if (msg.isSetField(FIX::FIELD::TimeInForce)) msg.getField(tif);
-          if (tif == FIX::TimeInForce_IMMEDIATE_OR_CANCEL) {
-            resp.setField(FIX::ExecType(FIX::ExecType_CANCELLED));
-            resp.setField(FIX::OrdStatus(FIX::ExecType_CANCELLED));
-            resp.setField(FIX::Text("no quote"));
-            resp.setField(FIX::TransactTime(FIX::UTCTIMESTAMP()));
-            session_->send(resp);
-            return;
-          }
-          active_orders_[sec->id][clordid] = ord;
-        } else if (msgType == "F") {
-          resp.getHeader().setField(FIX::MsgType("9"));
-          resp.setField(FIX::CxlRejResponseTo(
-              FIX::CxlRejResponseTo_ORDER_CANCEL_REQUEST));
-          auto symbol = msg.getField(FIX::FIELD::Symbol);
-          auto exchange = msg.getField(FIX::FIELD::ExDestination);
-          auto sec =
-              opentrade::SecurityManager::Instance().Get(exchange, symbol);
-          if (!sec) {
-            resp.setField(FIX::Text("unknown security"));
-            resp.setField(FIX::TransactTime(FIX::UTCTIMESTAMP()));
-            session_->send(resp);
-            return;
-          }
-          auto& actives = active_orders_[sec->id];
-          auto clordid = msg.getField(FIX::FIELD::ClOrdID);
-          if (used_ids_.find(clordid) != used_ids_.end()) {
-            resp.setField(FIX::Text("duplicate ClOrdID"));
-            resp.setField(FIX::TransactTime(FIX::UTCTIMESTAMP()));
-            session_->send(resp);
-            return;
-          }
-          used_ids_.insert(clordid);
-          auto orig = msg.getField(FIX::FIELD::OrigClOrdID);
-          auto it = actives.find(orig);
-          if (it == actives.end()) {
-            resp.setField(FIX::Text("inactive"));
-            resp.setField(FIX::TransactTime(FIX::UTCTIMESTAMP()));
-            session_->send(resp);
-            return;
-          }
-          resp = msg;
-          resp.getHeader().setField(FIX::MsgType("8"));
-          resp.setField(FIX::ExecType(FIX::ExecType_CANCELLED));
-          resp.setField(FIX::OrdStatus(FIX::ExecType_CANCELLED));
-          resp.setField(FIX::TransactTime(FIX::UTCTIMESTAMP()));
-          session_->send(resp);
-          actives.erase(it);
-        }
-      },
-      boost::posix_time::microseconds(latency_));
+  auto& msg_type = msg.getHeader().getField(FIX::FIELD::MsgType);
+  if (msg_type != FIX::MsgType_NewOrderSingle &&
+      msg_type != FIX::MsgType_OrderCancelRequest)
+    return;
+  Request req;
+  req.session = FIX::Session::lookupSession(session_id);
+  if (!req.session) return;
+  req.msg_type = msg_type[0];
+  for (auto& it : msg) {
+    auto& field = FieldOf(it);
+    auto& v = field.getString();
+    switch (field.getTag()) {
+      case FIX::FIELD::ClOrdID:
+        req.clordid = v;
+        break;
+      case FIX::FIELD::OrigClOrdID:
+        req.orig_clordid = v;
+        break;
+      case FIX::FIELD::Symbol:
+        req.symbol = v;
+        break;
+      case FIX::FIELD::ExDestination:
+        req.exchange = v;
+        break;
+      case FIX::FIELD::Side:
+        if (!v.empty()) req.side = v[0];
+        break;
+      case FIX::FIELD::OrdType:
+        if (!v.empty()) req.type = v[0];
+        break;
+      case FIX::FIELD::TimeInForce:
+        if (!v.empty()) req.tif = v[0];
+        break;
+      case FIX::FIELD::OrderQty:
+        req.qty = atof(v.c_str());
+        break;
+      case FIX::FIELD::Price:
+        req.px = atof(v.c_str());
+        break;
+      default:
+        break;
+    }
+  }
+  auto sec =
+      opentrade::SecurityManager::Instance().Get(req.exchange, req.symbol);
+  auto exch = sec ? sec->exchange
+                  : opentrade::SecurityManager::Instance().GetExchange(
+                        req.exchange);
+  auto shard = sec ? &GetShard(sec->id) : shards_[0].get();
+  Schedule(shard, exch, [this, shard, sec, req{std::move(req)}]() {
+    if (!sec) return Reject(req, "unknown security");
+    if (req.msg_type == 'D')
+      HandleNew(shard, req, *sec);
+    else
+      HandleCancel(shard, req);
+  });
+}
+
+void SimServer::Report() {
+  static const char* kNames[] = {"orders", "cancels", "fills", "rejects",
+                                 "ticks"};
+  const std::atomic<uint64_t>* counts[] = {&stats_.orders, &stats_.cancels,
+                                           &stats_.fills, &stats_.rejects,
+                                           &stats_.ticks};
+  std::stringstream ss;
+  ss << "SimServer throughput per second:";
+  for (auto i = 0u; i < sizeof(kNames) / sizeof(kNames[0]); ++i) {
+    auto n = counts[i]->load(std::memory_order_relaxed);
+    ss << ' ' << kNames[i] << '=' << (n - reported_[i]) / report_interval_;
+    reported_[i] = n;
+  }
+  LOG_INFO(ss.str());
 }
 
 void SimServer::StartFix(const opentrade::Adapter& adapter) {
@@ -252,10 +333,41 @@ void SimServer::StartFix(const opentrade::Adapter& adapter) {
     trade_hit_ratio_ = atof(trade_hit_ratio_str);
   }
 
-  LOG_INFO("TRADE_HIT_RATIO=" << trade_hit_ratio_);
+  if (trade_hit_ratio_ < 0)
+    LOG_INFO("Fill trade ticks by queue position");
+  else
+    LOG_INFO("TRADE_HIT_RATIO=" << trade_hit_ratio_);
+
+  // latency=<us>[,<exchange>=<us>...]
+  auto latency = adapter.config("latency");
+  latencies_.Parse(latency);
+  LOG_INFO(adapter.name() << ": latency=" << latency << "us");
+  latency_jitter_ = adapter.config<double>("latency_jitter");
+  if (latency_jitter_ > 0) {
+    LOG_INFO(adapter.name() << ": latency_jitter=" << latency_jitter_
+                            << "us, exponentially distributed");
+  }
+
+  auto fill_ratio = adapter.config<double>("fill_ratio");
+  if (fill_ratio > 0 && fill_ratio <= 1) fill_ratio_ = fill_ratio;
+  LOG_INFO(adapter.name() << ": fill_ratio=" << fill_ratio_);
+
+  auto nthreads = std::max(1, adapter.config<int>("threads"));
+  for (auto i = 0; i < nthreads; ++i) {
+    shards_.emplace_back(new Shard);
+    shards_.back()->seed = i;
+  }
+  LOG_INFO(adapter.name() << ": threads=" << nthreads);
+  exec_id_prefix_ = std::to_string(time(nullptr)) + '-';
 
-  latency_ = atoi(adapter.config("latency").c_str());
-  LOG_INFO(adapter.name() << ": latency=" << latency_ << "us");
+  auto report_interval = adapter.config("report_interval");
+  report_interval_ =
+      report_interval.empty() ? 10 : atoi(report_interval.c_str());
+  if (report_interval_ > 0) {
+    tp_.RepeatTask([this]() { Report(); },
+                   boost::posix_time::seconds(report_interval_),
+                   boost::posix_time::seconds(report_interval_));
+  }
 
   auto config_file = adapter.config("config_file");
   if (config_file.empty())
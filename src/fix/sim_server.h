@@ -1,20 +1,34 @@
 #ifndef FIX_SIM_SERVER_H_
 #define FIX_SIM_SERVER_H_
 
-#include <tbb/concurrent_unordered_set.h>
+#include <boost/functional/hash.hpp>
 #include <boost/unordered_map.hpp>
+#include <atomic>
 #include <ctime>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "application.h"
 #include "opentrade/adapter.h"
+#include "opentrade/fill_model.h"
 #include "opentrade/logger.h"
 #include "opentrade/security.h"
 
 using Security = opentrade::Security;
 
+// Exchange simulator answering the orders of any number of FIX sessions.
+// Securities are sharded over worker threads, each shard owns the price
+// indexed books of its securities, so ticks and orders of one security are
+// processed in order on one thread without locking.
 class SimServer : public opentrade::Application {
  public:
   void fromApp(const FIX::Message& msg,
@@ -23,20 +37,106 @@ class SimServer : public opentrade::Application {
   void StartFix(const opentrade::Adapter& adapter);
 
  protected:
-  struct OrderTuple {
+  // the fields of an order request, parsed on the session thread
+  struct Request {
+    FIX::Session* session = nullptr;
+    char msg_type = 0;
+    char side = 0;
+    char type = 0;
+    char tif = 0;
+    double qty = 0;
     double px = 0;
-    double leaves = 0;
-    bool is_buy = false;
-    FIX::Message resp;
+    std::string clordid;
+    std::string orig_clordid;
+    std::string symbol;
+    std::string exchange;
   };
-  std::unordered_map<Security::IdType,
-                     std::unordered_map<std::string, OrderTuple>>
-      active_orders_;
-  tbb::concurrent_unordered_set<std::string> used_ids_;
+  struct Order {
+    FIX::Session* session;
+    std::string clordid;
+    std::string symbol;
+    char side;
+    double px;
+    double qty;
+    double leaves;
+    double cum = 0;
+    double avg_px = 0;
+    double ahead = 0;  // see fill_model.h
+    bool is_buy() const { return side == FIX::Side_BUY; }
+  };
+  typedef std::list<Order> Level;  // time priority
+  struct Book {
+    std::map<double, Level, std::greater<double>> bids;
+    std::map<double, Level> asks;
+  };
+  typedef std::pair<const FIX::Session*, std::string> OrderKey;
+  struct OrderRef {
+    Security::IdType sec;
+    Level::iterator it;
+  };
+  // ClOrdIDs seen recently, bounded instead of growing forever
+  struct RecentIds {
+    static inline const size_t kMaxSize = 1 << 20;
+    bool Insert(const OrderKey& key) {
+      if (!set.insert(key).second) return false;
+      fifo.push_back(key);
+      if (fifo.size() > kMaxSize) {
+        set.erase(fifo.front());
+        fifo.pop_front();
+      }
+      return true;
+    }
+    std::unordered_set<OrderKey, boost::hash<OrderKey>> set;
+    std::deque<OrderKey> fifo;
+  };
+  struct Shard {
+    opentrade::TaskPool tp;
+    std::unordered_map<Security::IdType, Book> books;
+    boost::unordered_map<OrderKey, OrderRef> orders;
+    RecentIds ids;
+    uint32_t seed = 0;
+    std::mutex m;
+    int64_t due = 0;  // of the last request, keeps them in order
+  };
+  struct Stats {
+    std::atomic<uint64_t> orders = 0;
+    std::atomic<uint64_t> cancels = 0;
+    std::atomic<uint64_t> fills = 0;
+    std::atomic<uint64_t> rejects = 0;
+    std::atomic<uint64_t> ticks = 0;
+  };
+
+  Shard& GetShard(Security::IdType sec) {
+    return *shards_[sec % shards_.size()];
+  }
+  void Schedule(Shard* shard, const opentrade::Exchange* exch,
+                std::function<void()> func);
+  void HandleNew(Shard* shard, const Request& req, const Security& sec);
+  void HandleCancel(Shard* shard, const Request& req);
+  void HandleTick(Shard* shard, Security::IdType sec, char type, double px,
+                  double qty);
+  template <typename Levels>
+  void UpdateQueue(Levels* levels, double px, double qty);
+  template <typename Levels>
+  void Fill(Levels* levels, double px, char type, double* size, Shard* shard);
+  void Fill(Order* ord, double qty, double px);
+  void Send(const Order& ord, char exec_type, const char* text = nullptr,
+            double last_qty = 0, double last_px = 0,
+            const std::string* cancel_id = nullptr);
+  void Reject(const Request& req, const char* text);
+  void Report();
+
+  std::vector<std::unique_ptr<Shard>> shards_;
   opentrade::TaskPool tp_;
-  int latency_ = 0;  // in microseconds
-  uint32_t seed_ = 0;
-  double trade_hit_ratio_ = 0.5;
+  opentrade::Latencies latencies_;  // in microseconds
+  double latency_jitter_ = 0;       // mean of the exponential extra latency
+  double trade_hit_ratio_ = -1;     // < 0 for the queue position model
+  double fill_ratio_ = 1;           // of the tick size orders can take
+  std::atomic<uint64_t> exec_id_ = 0;
+  std::string exec_id_prefix_;
+  Stats stats_;
+  uint64_t reported_[5] = {};
+  int report_interval_ = 0;
 };
 
 #endif  // FIX_SIM_SERVER_H_
@@ -1,93 +1,289 @@
 #include "sim_server.h"
 
+#include <tbb/concurrent_queue.h>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <chrono>
+
 #include "opentrade/market_data.h"
+#include "opentrade/pipe_stream.h"
+#include "opentrade/text_parser.h"
+#include "opentrade/tick_file.h"
 
+// Plays back ticks_file to the subscribers and the simulated orders.
+//   speed=10: ten times faster than real time, 1 by default
+//   start_time=09:30:00: seconds of the day (UTC) to start from, the
+//     current time of day if not given, so that speed 1 is in sync with
+//     the wall clock as before
+//   dispatch_threads=4: securities sharded over threads to publish the
+//     ticks, the playback thread itself by default
+// Binary tick files are memory mapped, or decompressed into memory if
+// compressed, start_time is found by binary
+// search in the plain binary format, and by skipping decoded ticks without
+// publishing them in the others. The file is played again after its end.
 struct SimServerFile : public opentrade::MarketDataAdapter, public SimServer {
+  struct Tick {
+    const Security* sec;
+    uint32_t ms;
+    char type;
+    double px;
+    double qty;
+  };
+  enum Format { kText, kBinary, kColumnar, kIndexed };
+  static inline const size_t kBinaryTickSize = 19;
+
   void Start() noexcept override;
   void Stop() noexcept override {}
   void SubscribeSync(const Security& sec) noexcept override {}
+
+  void Open();
+  bool Next(Tick* t);
+  void Seek(uint32_t ms, Tick* t);
+  void Play();
+  void Dispatch(const Tick& t);
+
+  std::string ticks_file_;
+  std::vector<const Security*> secs_;
+  Format format_ = kText;
+  opentrade::PipeStream ifs_;
+  opentrade::LineReader lines_;
+  boost::iostreams::mapped_file_source mmfile_;
+  const char* body_ = nullptr;
+  const char* p_ = nullptr;
+  const char* p_end_ = nullptr;
+  opentrade::ColumnarTickReader columnar_;
+  opentrade::IndexedTickReader indexed_;
+  double speed_ = 1;
+  int start_time_ = -1;
+  std::vector<std::unique_ptr<tbb::concurrent_bounded_queue<Tick>>> queues_;
 };
 
 void SimServerFile::Start() noexcept {
-  auto ticks_file = config("ticks_file");
-  if (ticks_file.empty()) {
+  ticks_file_ = config("ticks_file");
+  if (ticks_file_.empty()) {
     LOG_FATAL(name() << ": ticks_file not given");
   }
 
-  opentrade::PipeStream ifs(ticks_file.c_str());
+  opentrade::PipeStream ifs(ticks_file_.c_str());
   if (!ifs.good()) {
-    LOG_FATAL(name() << ": Can not open " << ticks_file);
+    LOG_FATAL(name() << ": Can not open " << ticks_file_);
   }
   bool binary;
-  auto secs = opentrade::SecurityManager::Instance().GetSecurities(
-      &ifs.stream(), ticks_file.c_str(), &binary);
-  assert(!binary);
+  std::string format;
+  secs_ = opentrade::SecurityManager::Instance().GetSecurities(
+      &ifs.stream(), ticks_file_.c_str(), &binary, {}, &format);
+  if (binary) {
+    if (ifs.compressed()) {
+      if (!ifs_.open(ticks_file_.c_str(), true))
+        LOG_FATAL(name() << ": Failed to decompress " << ticks_file_);
+      secs_ = opentrade::SecurityManager::Instance().GetSecurities(
+          &ifs_.stream(), ticks_file_.c_str(), &binary, {}, &format);
+      body_ = ifs_.data() + ifs_.tellg();
+      p_end_ = ifs_.data() + ifs_.size();
+    } else {
+      mmfile_.open(ticks_file_);
+      body_ = mmfile_.data() + ifs.tellg();
+      p_end_ = mmfile_.data() + mmfile_.size();
+    }
+    format_ = format == "columnar"
+                  ? kColumnar
+                  : format == "indexed" ? kIndexed : kBinary;
+    if (format_ == kBinary && (p_end_ - body_) % kBinaryTickSize)
+      LOG_FATAL(name() << ": Invalid binary file: " << ticks_file_);
+  }
+
+  auto speed = config<double>("speed");
+  if (speed > 0) speed_ = speed;
+  auto start_time = config("start_time");
+  if (!start_time.empty()) {
+    int h = 0, m = 0, s = 0;
+    sscanf(start_time.c_str(), "%d:%d:%d", &h, &m, &s);
+    start_time_ = h * 3600 + m * 60 + s;
+  }
+  LOG_INFO(name() << ": speed=" << speed_ << ", start_time="
+                  << (start_time.empty() ? "now" : start_time));
+  auto nthreads = config<int>("dispatch_threads");
+  for (auto i = 0; i < nthreads; ++i) {
+    queues_.emplace_back(new tbb::concurrent_bounded_queue<Tick>);
+    auto q = queues_.back().get();
+    q->set_capacity(1 << 16);
+    std::thread([this, q]() {
+      Tick t;
+      while (true) {
+        q->pop(t);
+        Dispatch(t);
+      }
+    }).detach();
+  }
 
   StartFix(*this);
   connected_ = 1;
 
-  std::thread thread([=, secs{std::move(secs)}]() {
+  std::thread([this]() {
     while (true) {
-      struct tm tm;
-      auto t = time(nullptr);
-      gmtime_r(&t, &tm);
-      auto n = tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec;
-      auto t0 = t - n;
-      std::string line;
-      LOG_DEBUG(name() << ": Start to play back");
-      auto skip = 0l;
-      opentrade::PipeStream ifs(ticks_file.c_str());
-      for (auto i = 0u; i < secs.size() + 2; ++i) {
-        std::getline(ifs.stream(), line);
-      }
-      while (std::getline(ifs.stream(), line)) {
-        if (skip-- > 0) continue;
-        char hms_str[24];
+      Play();
+      md().ForEach([](auto, auto& md) { md = opentrade::MarketData{}; });
+    }
+  }).detach();
+}
+
+void SimServerFile::Open() {
+  if (format_ == kText) {
+    ifs_.close();
+    ifs_.open(ticks_file_.c_str());
+    std::string line;
+    for (auto i = 0u; i < secs_.size() + 2; ++i) {
+      std::getline(ifs_.stream(), line);
+    }
+    lines_ = opentrade::LineReader(&ifs_.stream());
+    return;
+  }
+  p_ = body_;
+  if (format_ == kColumnar) {
+    columnar_ = opentrade::ColumnarTickReader(body_, p_end_);
+  } else if (format_ == kIndexed) {
+    std::vector<bool> used(secs_.size());
+    for (auto i = 0u; i < used.size(); ++i) used[i] = secs_[i];
+    indexed_ = opentrade::IndexedTickReader(body_, p_end_, used);
+  }
+}
+
+static inline uint32_t BinaryTickMs(const char* p) {
+  return *reinterpret_cast<const uint32_t*>(p);
+}
+
+bool SimServerFile::Next(Tick* t) {
+  opentrade::RawTick raw;
+  while (true) {
+    switch (format_) {
+      case kText: {
+        const char* line;
+        const char* end;
+        if (!lines_.Next(&line, &end)) return false;
+        opentrade::TextCursor c(line, end);
+        auto hms_str = c.Word();
+        uint32_t hms;
         uint32_t i;
-        char type;
-        double px;
-        double qty;
-        if (sscanf(line.c_str(), "%s %u %c %lf %lf", hms_str, &i, &type, &px,
-                   &qty) != 5)
-          continue;
-        auto hms = atol(hms_str);
-        if (strlen(hms_str) > 6) hms /= 1000;
-        if (i >= secs.size()) continue;
-        t = t0 + hms / 10000 * 3600 + hms % 10000 / 100 * 60 + hms % 100;
-        auto now = time(nullptr);
-        if (t < now - 3) {
-          skip = 1000;
+        if (!opentrade::TextCursor(hms_str).Uint(&hms) || !c.Uint(&i) ||
+            !c.Char(&t->type) || !c.Double(&t->px) || !c.Double(&t->qty))
           continue;
+        auto ms = 0;
+        if (hms_str.size() > 6) {
+          ms = hms % 1000;
+          hms /= 1000;
         }
-        if (now < t) {
-          LOG_DEBUG(name() << ": " << hms);
-          std::this_thread::sleep_for(std::chrono::seconds(t - now));
-        }
-        auto sec = secs[i];
-        if (!sec) continue;
-        switch (type) {
-          case 'T':
-            Update(sec->id, px, qty);
-            break;
-          case 'A':
-            if (*sec->exchange->name == 'U') qty *= 100;
-            Update(sec->id, px, qty, false);
-            if (!qty && sec->type == opentrade::kForexPair) qty = 1e9;
-            break;
-          case 'B':
-            if (*sec->exchange->name == 'U') qty *= 100;
-            Update(sec->id, px, qty, true);
-            if (!qty && sec->type == opentrade::kForexPair) qty = 1e9;
-            break;
-          default:
-            continue;
-        }
-        HandleTick(sec->id, type, px, qty);
+        if (i >= secs_.size()) continue;
+        raw.index = i;
+        raw.ms = (hms / 10000 * 3600 + hms % 10000 / 100 * 60 + hms % 100) *
+                     1000 +
+                 ms;
+        break;
       }
-      for (auto& pair : md()) pair.second = opentrade::MarketData{};
+      case kBinary:
+        if (p_ >= p_end_) return false;
+        raw.ms = BinaryTickMs(p_);
+        raw.index = *reinterpret_cast<const uint16_t*>(p_ + 4);
+        t->type = p_[6];
+        t->px = *reinterpret_cast<const double*>(p_ + 7);
+        t->qty = *reinterpret_cast<const uint32_t*>(p_ + 15);
+        p_ += kBinaryTickSize;
+        break;
+      case kColumnar:
+        if (!columnar_.Next(&raw)) return false;
+        break;
+      case kIndexed:
+        if (!indexed_.Next(&raw)) return false;
+        break;
+    }
+    if (format_ == kColumnar || format_ == kIndexed) {
+      t->type = raw.type;
+      t->px = raw.px;
+      t->qty = raw.qty;
+    }
+    if (raw.index >= secs_.size() || !secs_[raw.index]) continue;
+    t->sec = secs_[raw.index];
+    t->ms = raw.ms;
+    return true;
+  }
+}
+
+// t is the first tick at or after ms
+void SimServerFile::Seek(uint32_t ms, Tick* t) {
+  if (format_ == kBinary) {
+    size_t lo = 0;
+    size_t hi = (p_end_ - body_) / kBinaryTickSize;
+    while (lo < hi) {
+      auto mid = (lo + hi) / 2;
+      if (BinaryTickMs(body_ + mid * kBinaryTickSize) < ms)
+        lo = mid + 1;
+      else
+        hi = mid;
     }
-  });
-  thread.detach();
+    p_ = body_ + lo * kBinaryTickSize;
+  }
+  while (Next(t)) {
+    if (t->ms >= ms) return;
+  }
+  t->sec = nullptr;
+}
+
+void SimServerFile::Play() {
+  auto start = start_time_;
+  if (start < 0) {
+    auto now = time(nullptr);
+    start = now % opentrade::kSecondsOneDay;
+  }
+  LOG_DEBUG(name() << ": Start to play back from " << start << "s");
+  Open();
+  Tick t;
+  Seek(start * 1000u, &t);
+  if (!t.sec) {
+    // past the end of the file for today
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    return;
+  }
+  auto wall0 = std::chrono::steady_clock::now();
+  auto ms0 = start * 1000.;
+  auto n = 0lu;
+  do {
+    auto due = wall0 + std::chrono::microseconds(static_cast<int64_t>(
+                           (t.ms - ms0) * 1000 / speed_));
+    if (due > std::chrono::steady_clock::now())
+      std::this_thread::sleep_until(due);
+    if (queues_.empty())
+      Dispatch(t);
+    else
+      queues_[t.sec->id % queues_.size()]->push(t);
+    ++n;
+  } while (Next(&t));
+  LOG_INFO(name() << ": Played back " << n << " ticks in "
+                  << std::chrono::duration_cast<std::chrono::seconds>(
+                         std::chrono::steady_clock::now() - wall0)
+                         .count()
+                  << "s");
+}
+
+void SimServerFile::Dispatch(const Tick& t) {
+  auto sec = t.sec;
+  auto px = t.px;
+  auto qty = t.qty;
+  switch (t.type) {
+    case 'T':
+      Update(sec->id, px, qty);
+      break;
+    case 'A':
+      if (*sec->exchange->name == 'U') qty *= 100;
+      Update(sec->id, px, qty, false);
+      if (!qty && sec->type == opentrade::kForexPair) qty = 1e9;
+      break;
+    case 'B':
+      if (*sec->exchange->name == 'U') qty *= 100;
+      Update(sec->id, px, qty, true);
+      if (!qty && sec->type == opentrade::kForexPair) qty = 1e9;
+      break;
+    default:
+      return;
+  }
+  HandleTick(sec->id, t.type, px, qty);
 }
 
 extern "C" {
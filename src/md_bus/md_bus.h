@@ -0,0 +1,198 @@
+#ifndef MD_BUS_MD_BUS_H_
+#define MD_BUS_MD_BUS_H_
+
+// Layout of the shared memory market data bus of opentrade, and a read-only
+// client of it with no other dependency, for out of process consumers.
+//
+// One POSIX shared memory object per data source, e.g. /opentrade_md_<src>:
+//   Header
+//   Record[capacity], indexed by security id, each a seqlock
+//   Note[ring_size], security ids in the order updated
+//
+// A record is rewritten in place by its adapter thread on every update, a
+// reader seeing an odd or changed seq retries. The ring only tells what
+// changed, a reader falling behind by more than ring_size skips to the
+// latest records.
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+
+namespace md_bus {
+
+static const uint32_t kVersion = 1;
+static const uint32_t kDepthSize = 5;
+static const char kMagic[4] = {'O', 'T', 'M', 'D'};
+
+struct Header {
+  char magic[4];
+  uint32_t version;
+  uint32_t capacity;
+  uint32_t ring_size;  // power of 2
+  uint32_t record_size;
+  uint32_t depth_size;
+  uint64_t src;  // opentrade DataSrc::IdType, little endian chars
+  // incremented by the writer, this Note goes at ring[head % ring_size]
+  alignas(64) std::atomic<uint64_t> head;
+};
+
+struct Record {
+  // odd while being written, 0 if never written
+  std::atomic<uint32_t> seq;
+  uint32_t id;
+  int64_t tm;  // seconds since epoch
+  struct Trade {
+    double qty;  // last
+    double open;
+    double high;
+    double low;
+    double close;
+    double vwap;
+    double volume;
+  } trade;
+  struct Quote {
+    double ask_price;
+    double bid_price;
+    double ask_size;
+    double bid_size;
+  } depth[kDepthSize];
+};
+
+struct alignas(64) Slot {
+  Record r;
+};
+
+struct Note {
+  // position + 1 in the ring when written, a reader expecting another
+  // position lost it to the writer lapping
+  std::atomic<uint64_t> pos;
+  uint32_t id;
+  uint32_t reserved;
+};
+
+inline size_t MapSize(uint32_t capacity, uint32_t ring_size) {
+  return sizeof(Header) + sizeof(Slot) * capacity + sizeof(Note) * ring_size;
+}
+
+inline std::string ShmName(const std::string& prefix, uint64_t src) {
+  auto name = prefix;
+  if (!src) return name + "_";
+  for (; src; src >>= 8) name += static_cast<char>(src & 0xFF);
+  return name;
+}
+
+class Reader {
+ public:
+  ~Reader() {
+    if (map_) munmap(map_, size_);
+  }
+
+  // name as created by opentrade, e.g. ShmName("/opentrade_md_", src)
+  bool Open(const std::string& name) {
+    auto fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) return false;
+    struct stat st;
+    Header h;
+    if (fstat(fd, &st) || static_cast<size_t>(st.st_size) < sizeof(h) ||
+        pread(fd, &h, sizeof(h), 0) != sizeof(h) ||
+        memcmp(h.magic, kMagic, sizeof(kMagic)) || h.version != kVersion ||
+        h.record_size != sizeof(Slot) || h.depth_size != kDepthSize ||
+        static_cast<size_t>(st.st_size) != MapSize(h.capacity, h.ring_size)) {
+      close(fd);
+      return false;
+    }
+    auto p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return false;
+    map_ = p;
+    size_ = st.st_size;
+    header_ = static_cast<const Header*>(p);
+    slots_ = reinterpret_cast<const Slot*>(header_ + 1);
+    ring_ = reinterpret_cast<const Note*>(slots_ + header_->capacity);
+    next_ = header_->head.load(std::memory_order_acquire);
+    return true;
+  }
+
+  const Header* header() const { return header_; }
+
+  // in place, for readers doing their own seqlock validation
+  const Record* Get(uint32_t id) const {
+    if (!header_ || id >= header_->capacity) return nullptr;
+    return &slots_[id].r;
+  }
+
+  // consistent copy, false if never written
+  bool Read(uint32_t id, Record* out) const {
+    auto r = Get(id);
+    if (!r) return false;
+    for (;;) {
+      auto seq = r->seq.load(std::memory_order_acquire);
+      if (!seq) return false;
+      if (seq & 1) {
+        std::this_thread::yield();
+        continue;
+      }
+      out->id = r->id;
+      out->tm = r->tm;
+      out->trade = r->trade;
+      memcpy(out->depth, r->depth, sizeof(out->depth));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (r->seq.load(std::memory_order_relaxed) == seq) {
+        out->seq.store(seq, std::memory_order_relaxed);
+        return true;
+      }
+    }
+  }
+
+  // func(id) per update noted since the last Poll, ids may repeat; returns
+  // the number seen, with *lost set to the number overrun
+  template <typename F>
+  size_t Poll(F func, uint64_t* lost = nullptr) {
+    if (!header_) return 0;
+    auto head = header_->head.load(std::memory_order_acquire);
+    auto mask = header_->ring_size - 1;
+    uint64_t dropped = 0;
+    if (head - next_ > header_->ring_size) {
+      dropped = head - next_ - header_->ring_size;
+      next_ = head - header_->ring_size;
+    }
+    size_t n = 0;
+    for (; next_ < head; ++next_) {
+      auto& note = ring_[next_ & mask];
+      auto pos = note.pos.load(std::memory_order_acquire);
+      if (pos != next_ + 1) {
+        if (pos < next_ + 1) break;  // not published yet
+        dropped++;
+        continue;
+      }
+      auto id = note.id;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (note.pos.load(std::memory_order_relaxed) != pos) {
+        dropped++;
+        continue;
+      }
+      func(id);
+      n++;
+    }
+    if (lost) *lost = dropped;
+    return n;
+  }
+
+ private:
+  void* map_ = nullptr;
+  size_t size_ = 0;
+  const Header* header_ = nullptr;
+  const Slot* slots_ = nullptr;
+  const Note* ring_ = nullptr;
+  uint64_t next_ = 0;
+};
+
+}  // namespace md_bus
+
+#endif  // MD_BUS_MD_BUS_H_
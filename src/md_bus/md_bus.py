@@ -0,0 +1,90 @@
+"""Read-only client of the opentrade market data bus, see md_bus.h.
+
+  bus = Reader('/opentrade_md_', 'ctp')
+  for id in bus.poll():
+    md = bus.read(id)
+"""
+
+import mmap
+import os
+import struct
+
+VERSION = 1
+DEPTH_SIZE = 5
+HEADER = struct.Struct('<4sIIIIIQ')
+HEAD_OFFSET = 64
+HEADER_SIZE = 128
+RECORD = struct.Struct('<IIq7d%dd' % (DEPTH_SIZE * 4))
+SLOT_SIZE = 256
+NOTE = struct.Struct('<QII')
+SEQ = struct.Struct('<I')
+U64 = struct.Struct('<Q')
+
+
+def shm_name(prefix, src):
+  return prefix + (src or '_')
+
+
+class Reader:
+
+  def __init__(self, prefix='/opentrade_md_', src=''):
+    path = '/dev/shm/' + shm_name(prefix, src).lstrip('/')
+    fd = os.open(path, os.O_RDONLY)
+    try:
+      self.map = mmap.mmap(fd, 0, mmap.MAP_SHARED, mmap.PROT_READ)
+    finally:
+      os.close(fd)
+    (magic, version, self.capacity, self.ring_size, record_size, depth_size,
+     _) = HEADER.unpack_from(self.map, 0)
+    if magic != b'OTMD' or version != VERSION or \
+        record_size != SLOT_SIZE or depth_size != DEPTH_SIZE:
+      raise ValueError('Invalid market data bus: ' + path)
+    self.ring = HEADER_SIZE + SLOT_SIZE * self.capacity
+    self.next = self.head()
+
+  def head(self):
+    return U64.unpack_from(self.map, HEAD_OFFSET)[0]
+
+  def read(self, id):
+    """dict of the record of security id, None if never written"""
+    if id >= self.capacity:
+      return None
+    offset = HEADER_SIZE + SLOT_SIZE * id
+    while True:
+      seq = SEQ.unpack_from(self.map, offset)[0]
+      if not seq:
+        return None
+      if seq & 1:
+        continue
+      v = RECORD.unpack_from(self.map, offset)
+      if SEQ.unpack_from(self.map, offset)[0] == seq:
+        break
+    return {
+        'id': v[1],
+        'tm': v[2],
+        'trade': dict(
+            zip(('qty', 'open', 'high', 'low', 'close', 'vwap', 'volume'),
+                v[3:10])),
+        'depth': [
+            dict(
+                zip(('ask_price', 'bid_price', 'ask_size', 'bid_size'),
+                    v[10 + i * 4:14 + i * 4])) for i in range(DEPTH_SIZE)
+        ],
+    }
+
+  def poll(self):
+    """security ids updated since the last poll, may repeat"""
+    head = self.head()
+    if head - self.next > self.ring_size:
+      self.next = head - self.ring_size
+    ids = []
+    while self.next < head:
+      offset = self.ring + NOTE.size * (self.next & (self.ring_size - 1))
+      pos, id, _ = NOTE.unpack_from(self.map, offset)
+      if pos < self.next + 1:
+        break
+      if pos == self.next + 1 and \
+          U64.unpack_from(self.map, offset)[0] == pos:
+        ids.append(id)
+      self.next += 1
+    return ids
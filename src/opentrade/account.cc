@@ -54,9 +54,7 @@ void AccountManager::Initialize() {
     auto i = 0;
     b->id = Database::GetValue(*it, i++, 0);
     b->name = Database::GetValue(*it, i++, "");
-    b->adapter_name = Database::GetValue(*it, i++, "");
-    b->adapter =
-        ExchangeConnectivityManager::Instance().GetAdapter(b->adapter_name);
+    b->SetAdapter(Database::GetValue(*it, i++, kEmptyStr));
     b->SetParams(Database::GetValue(*it, i++, kEmptyStr));
     b->is_disabled = Database::GetValue(*it, i++, 0);
     b->limits.FromString(Database::GetValue(*it, i++, kEmptyStr));
@@ -111,6 +109,7 @@ void AccountManager::Initialize() {
 std::string BrokerAccount::SetParams(const std::string& params) {
   auto res = ParamsBase::SetParams(params);
   if (!res.empty()) return res;
+  least_loaded = GetParam("session_routing") == "least_loaded";
   auto cm = GetParam("commission");
   if (cm.empty()) {
     this->commission_adapter = nullptr;
@@ -131,6 +130,60 @@ std::string BrokerAccount::SetParams(const std::string& params) {
   return {};
 }
 
+std::string BrokerAccount::SetAdapter(const std::string& names) {
+  auto tmp = Split(names, ", ");
+  // see Order::session
+  if (tmp.size() > 255) return "too many adapters of a session group";
+  std::string err;
+  auto sessions = new Sessions;
+  for (auto& name : tmp) {
+    auto adapter = ExchangeConnectivityManager::Instance().GetAdapter(name);
+    if (adapter)
+      sessions->push_back(adapter);
+    else
+      err = "unknown adapter name: " + name;
+  }
+  if (sessions->empty() && err.empty()) err = "unknown adapter name";
+  adapter_name = strdup(names.c_str());
+  adapter = sessions->empty() ? nullptr : sessions->front();
+  sessions_.store(SessionsPtr(sessions));
+  return err;
+}
+
+uint8_t BrokerAccount::Route(const Security& sec) const {
+  auto sessions = this->sessions();
+  auto n = sessions->size();
+  if (n <= 1) return 0;
+  auto i = sec.id % n;
+  if (least_loaded) {
+    auto tm = NowCoarseInMicro();
+    auto min = -1;
+    for (size_t j = 0; j < n; ++j) {
+      auto s = (*sessions)[j];
+      if (!s->connected()) continue;
+      auto v = s->throttle_in_sec(tm);
+      if (min < 0 || v < min) {
+        i = j;
+        min = v;
+      }
+    }
+    return i + 1;
+  }
+  for (size_t j = 0; j < n; ++j) {
+    if ((*sessions)[(i + j) % n]->connected()) return (i + j) % n + 1;
+  }
+  return i + 1;
+}
+
+ExchangeConnectivityAdapter* BrokerAccount::GetSession(
+    uint8_t session, const Security& sec) const {
+  auto sessions = this->sessions();
+  auto n = sessions->size();
+  if (n <= 1) return adapter;
+  if (session && session <= n) return (*sessions)[session - 1];
+  return (*sessions)[sec.id % n];
+}
+
 bool AccountBase::CheckDisabled(const char* name, std::string* err) const {
   char buf[256];
   if (is_disabled) {
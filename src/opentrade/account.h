@@ -2,13 +2,16 @@
 #define OPENTRADE_ACCOUNT_H_
 
 #include <tbb/concurrent_unordered_map.h>
+#include <atomic>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "commission.h"
 #include "position_value.h"
 #include "risk.h"
 #include "security.h"
+#include "rcu.h"
 #include "utility.h"
 
 namespace opentrade {
@@ -22,17 +25,19 @@ struct AccountBase {
   bool is_disabled = false;
   Limits limits;
   Throttle throttle_in_sec;
-  tbb::concurrent_unordered_map<Security::IdType, Throttle>
-      throttle_per_security_in_sec;
-  tbb::concurrent_unordered_map<Security::IdType, tbb::atomic<int>>
-      cancels_per_security;
-  PositionValue position_value;
-
-  boost::shared_ptr<const std::string> disabled_reason() const {
-    return disabled_reason_.load(boost::memory_order_relaxed);
+  // of msg_rate_per_security and max_cancels_per_security
+  SecurityCounters per_security;
+  AccountPositionValue position_value;
+  // this shard's budget of msg_rate and the total_* limits, as a fraction,
+  // for the users and broker accounts spanning shards, see ShardManager
+  AtomicDouble msg_rate_share = 1;
+  AtomicDouble value_share = 1;
+
+  RcuSnapshot<std::string> disabled_reason() const {
+    return disabled_reason_.load();
   }
   void set_disabled_reason(boost::shared_ptr<const std::string> v = {}) {
-    disabled_reason_.store(v, boost::memory_order_release);
+    disabled_reason_.store(v);
   }
   bool CheckDisabled(const char* name, std::string* err) const;
 
@@ -40,37 +45,56 @@ struct AccountBase {
   // different from is_disabled which is persistent in database,
   // disabled_reason is not persistent and designed for OpenRisk
   // https://stackoverflow.com/questions/40223599/what-is-the-difference-between-stdshared-ptr-and-stdexperimentalatomic-sha
-  boost::atomic_shared_ptr<const std::string> disabled_reason_;
+  RcuPtr<std::string> disabled_reason_;
 };
 
 struct BrokerAccount : public AccountBase, public ParamsBase {
   std::string SetParams(const std::string& params);
+  // names is one adapter, or comma separated ones of a session group,
+  // returns error if any of them is not started, the others are kept
+  std::string SetAdapter(const std::string& names);
+  typedef std::vector<ExchangeConnectivityAdapter*> Sessions;
+  typedef boost::shared_ptr<const Sessions> SessionsPtr;
+  RcuSnapshot<Sessions> sessions() const { return sessions_.load(); }
+  // 1 + index of the session for a new order, by hash of security skipping
+  // the disconnected ones, or the least loaded by messages in the last
+  // second if session_routing=least_loaded in params, 0 if not a group
+  uint8_t Route(const Security& sec) const;
+  // the session of an order routed to it, by hash if not known (0), e.g.
+  // of the orders loaded from the store
+  ExchangeConnectivityAdapter* GetSession(uint8_t session,
+                                          const Security& sec) const;
   const char* adapter_name = "";
-  ExchangeConnectivityAdapter* adapter = nullptr;
+  ExchangeConnectivityAdapter* adapter = nullptr;  // the first session
   const CommissionAdapter* commission_adapter = nullptr;
+  bool least_loaded = false;
+
+ private:
+  RcuPtr<Sessions> sessions_{SessionsPtr(new Sessions)};
 };
 
 struct SubAccount : public AccountBase {
   typedef std::unordered_map<Exchange::IdType, const BrokerAccount*>
       BrokerAccountMap;
   typedef boost::shared_ptr<const BrokerAccountMap> BrokerAccountMapPtr;
-  BrokerAccountMapPtr broker_accounts() const {
-    return broker_accounts_.load(boost::memory_order_relaxed);
+  RcuSnapshot<BrokerAccountMap> broker_accounts() const {
+    return broker_accounts_.load();
   }
   void set_broker_accounts(BrokerAccountMapPtr accs) {
     assert(accs);
-    broker_accounts_.store(accs, boost::memory_order_release);
+    broker_accounts_.store(accs);
   }
   const BrokerAccount* GetBrokerAccount(Exchange::IdType id) const {
     assert(id);
-    auto tmp = FindInMap(broker_accounts(), id);
-    if (!tmp && id) tmp = FindInMap(broker_accounts(), 0);
+    auto accs = broker_accounts();
+    auto tmp = FindInMap(*accs, id);
+    if (!tmp && id) tmp = FindInMap(*accs, 0);
     return tmp;
   }
 
  private:
-  boost::atomic_shared_ptr<const BrokerAccountMap> broker_accounts_ =
-      BrokerAccountMapPtr(new BrokerAccountMap);
+  RcuPtr<BrokerAccountMap> broker_accounts_{
+      BrokerAccountMapPtr(new BrokerAccountMap)};
 };
 
 struct User : public AccountBase {
@@ -82,17 +106,20 @@ struct User : public AccountBase {
   const SubAccount* GetSubAccount(SubAccount::IdType id) const {
     return FindInMap(sub_accounts(), id);
   }
-  SubAccountMapPtr sub_accounts() const {
-    return sub_accounts_.load(boost::memory_order_relaxed);
+  RcuSnapshot<SubAccountMap> sub_accounts() const {
+    return sub_accounts_.load();
   }
   void set_sub_accounts(SubAccountMapPtr accs) {
     assert(accs);
-    sub_accounts_.store(accs, boost::memory_order_release);
+    sub_accounts_.store(accs);
+    kSubAccountsVersion++;
   }
+  // bumped whenever sub accounts of any user change
+  static uint32_t sub_accounts_version() { return kSubAccountsVersion; }
 
  private:
-  boost::atomic_shared_ptr<const SubAccountMap> sub_accounts_ =
-      SubAccountMapPtr(new SubAccountMap);
+  RcuPtr<SubAccountMap> sub_accounts_{SubAccountMapPtr(new SubAccountMap)};
+  static inline std::atomic<uint32_t> kSubAccountsVersion = 0;
 };
 
 inline const User kEmptyUser;
@@ -129,6 +156,7 @@ class AccountManager : public Singleton<AccountManager> {
   friend class Connection;
   friend class Backtest;
   friend class PositionManager;
+  friend class ShardManager;
 };
 
 }  // namespace opentrade
@@ -3,6 +3,7 @@
 
 #include <tbb/atomic.h>
 #include <boost/lexical_cast.hpp>
+#include <atomic>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -24,7 +25,9 @@ class Adapter {
   typedef std::unordered_map<std::string, std::string> StrMap;
   const std::string& name() const { return name_; }
   void set_name(const std::string& name) { name_ = name; }
-  void set_config(const StrMap& config) { config_ = config; }
+  void set_config(const StrMap& config) {
+    config_ = std::make_shared<const StrMap>(config);
+  }
   std::string GetVersion() const { return kApiVersion; }
   typedef Adapter* (*CFunc)();
   typedef std::function<Adapter*()> Func;
@@ -32,13 +35,14 @@ class Adapter {
     if (!create_func_) return this;
     auto inst = create_func_();
     inst->set_name(name());
-    inst->set_config(config());
+    // shared with the clones rather than copied into every one
+    inst->config_ = config_;
     return inst;
   }
-  const StrMap& config() const { return config_; }
+  const StrMap& config() const { return *config_; }
   template <typename T = std::string>
   T config(const std::string& name, T default_value = {}) const {
-    auto str = FindInMap(config_, name);
+    auto str = FindInMap(*config_, name);
     if (str.empty()) return default_value;
     if constexpr (std::is_same_v<std::decay_t<T>, std::string>) {
       return str;
@@ -60,19 +64,43 @@ class Adapter {
 
  protected:
   std::string name_;
-  StrMap config_;
+  std::shared_ptr<const StrMap> config_ = kEmptyConfig;
   Func create_func_;
+
+ private:
+  static inline const auto kEmptyConfig = std::make_shared<const StrMap>();
 };
 
 class NetworkAdapter : public Adapter {
  public:
+  // 1 connected, 0 not, -1 connecting; a change bumps version() for all the
+  // adapters, so that their status is recomputed once rather than polled by
+  // every GUI connection
+  class ConnectedState {
+   public:
+    ConnectedState& operator=(int v) {
+      if (v_.exchange(v) != v) Changed();
+      return *this;
+    }
+    operator int() const { return v_; }
+    // for connected() of more than the state, when the rest of it changes
+    static void Changed() { kVersion.fetch_add(1, std::memory_order_release); }
+    static uint32_t version() {
+      return kVersion.load(std::memory_order_acquire);
+    }
+
+   private:
+    std::atomic<int> v_ = 0;
+    static inline std::atomic<uint32_t> kVersion = 0;
+  };
+
   virtual void Reconnect() noexcept {}
   virtual void Stop() noexcept = 0;
   virtual bool connected() const noexcept { return 1 == connected_; }
   auto& tp() { return tp_; }
 
  protected:
-  tbb::atomic<int> connected_ = 0;
+  ConnectedState connected_;
   TaskPool tp_;
 };
 
@@ -2,82 +2,337 @@
 
 #include <boost/filesystem.hpp>
 #include <boost/iostreams/device/mapped_file.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
 #include <mutex>
 #include <sstream>
+#include <thread>
 
 #include "connection.h"
+#include "consolidation.h"
 #include "cross_engine.h"
 #include "exchange_connectivity.h"
 #include "indicator_handler.h"
 #include "logger.h"
+#include "memory.h"
+#include "pool.h"
 #include "python.h"
+#include "replication.h"
 #include "server.h"
 #include "stop_book.h"
+#include "thread_placement.h"
 
 namespace fs = boost::filesystem;
 
 namespace opentrade {
 
 static auto kPath = kStorePath / "algos";
+static auto kIndexPath = kStorePath / "algos.idx";
+// one index entry for the first record of every kIndexInterval seqs
+static const uint32_t kIndexInterval = 1024;
+// algo name of the record ending a Roll, not an algo
+static const char kRollMarker[] = "_roll";
+
+struct AlgoIndexEntry {
+  uint32_t seq;
+  uint32_t reserved;
+  uint64_t offset;
+};
+
+struct AlgoRecord {
+  uint32_t seq;
+  uint32_t n;
+  User::IdType user_id;
+  Algo::IdType id;
+  const char* body;
+};
+
+// [u32 seq][u32 n][user id][u32 algo id][body]['\0']['\n'],
+// returns the next record, nullptr if truncated
+static inline const char* ReadAlgoRecord(const char* p, const char* p_end,
+                                         AlgoRecord* r) {
+  if (p + 8 >= p_end) return nullptr;
+  r->seq = *reinterpret_cast<const uint32_t*>(p);
+  p += 4;
+  r->n = *reinterpret_cast<const uint32_t*>(p);
+  if (p + r->n + 10 + sizeof(User::IdType) > p_end) return nullptr;
+  p += 4;
+  r->user_id = *reinterpret_cast<const User::IdType*>(p);
+  p += sizeof(User::IdType);
+  r->id = *reinterpret_cast<const uint32_t*>(p);
+  p += 4;
+  r->body = p;
+  return p + r->n + 2;  // body + '\0' + '\n'
+}
+
+// entries pointing to a record with the same seq, ascending
+static std::vector<AlgoIndexEntry> ReadAlgoIndex(const char* p, size_t size) {
+  std::vector<AlgoIndexEntry> out;
+  std::ifstream ifs(kIndexPath.c_str(), std::ifstream::binary);
+  AlgoIndexEntry e;
+  AlgoRecord r;
+  while (ifs.read(reinterpret_cast<char*>(&e), sizeof(e))) {
+    if (e.offset >= size) break;
+    if (!out.empty() && (e.seq <= out.back().seq ||
+                         e.offset <= out.back().offset))
+      break;
+    if (!ReadAlgoRecord(p + e.offset, p + size, &r) || r.seq != e.seq) break;
+    out.push_back(e);
+  }
+  return out;
+}
 static thread_local std::string kError;
 
+inline void AlgoRunner::Push(Dirty* node) {
+  node->next.store(nullptr, std::memory_order_relaxed);
+  auto prev = head_.exchange(node, std::memory_order_acq_rel);
+  prev->next.store(node, std::memory_order_release);
+}
+
+inline AlgoRunner::Dirty* AlgoRunner::Pop() {
+  auto tail = tail_;
+  auto next = tail->next.load(std::memory_order_acquire);
+  if (tail == &stub_) {
+    if (!next) return nullptr;
+    tail_ = next;
+    tail = next;
+    next = next->next.load(std::memory_order_acquire);
+  }
+  if (next) {
+    tail_ = next;
+    return tail;
+  }
+  // a producer is in the middle of Push
+  if (tail != head_.load(std::memory_order_acquire)) return nullptr;
+  Push(&stub_);
+  next = tail->next.load(std::memory_order_acquire);
+  if (!next) return nullptr;
+  tail_ = next;
+  return tail;
+}
+
+inline bool AlgoRunner::MarkDirty(Dirty* node, uint64_t origin) {
+  if (node->queued.exchange(true)) {
+    coalesced_++;
+    return false;
+  }
+  node->origin.store(origin, std::memory_order_relaxed);
+  // count before push so that the runner never exits with a node queued
+  auto n = pending_++;
+  Push(node);
+  return n == 0;
+}
+
+void AlgoRunner::Clear() {
+  stub_.next = nullptr;
+  head_ = &stub_;
+  tail_ = &stub_;
+  pending_ = 0;
+  dirties_.clear();
+  indices_.clear();
+  mds_.clear();
+  insts_.clear();
+  md_refs_.clear();
+  deferred_.clear();
+}
+
+inline void AlgoRunner::Flush() {
+  for (auto algo : deferred_) {
+    if (algo->is_active()) algo->OnMarketBatch();
+  }
+  deferred_.clear();
+}
+
 inline void AlgoRunner::operator()() {
   assert(std::this_thread::get_id() == tid_);
 
+  auto tm0 = std::chrono::steady_clock::now();
+  CachedTime cached_time;
+  auto yield = false;
   for (;;) {
-    decltype(dirties_)::value_type key;
-    {
-      LockGuard lock(mutex_);
-      if (dirties_.empty()) return;
-      auto it = dirties_.begin();
-      static thread_local uint32_t kSeed = time(NULL);
-      if (dirties_.size() > 1) {
-        auto n = rand_r(&kSeed) % std::min(3lu, dirties_.size());
-        if (n > 0) std::advance(it, n);
-      }
-      key = *it;
-      dirties_.erase(it);
+    auto node = Pop();
+    if (!node) {
+      if (!pending_) break;
+      std::this_thread::yield();
+      continue;
     }
-    auto& pair = instruments_[key];
-    auto& insts = pair.second;
-    auto it = insts.begin();
-    if (it == insts.end()) continue;
-    auto md = (*it)->md();
-    auto& md0 = pair.first;
-    bool trade_update = md0.trade != md.trade;
-    bool quote_update = md0.quote() != md.quote();
-    while (it != insts.end()) {
-      auto& algo = (*it)->algo();
-      if (!algo.is_active() || !(*it)->listen()) {
-        it = insts.erase(it);
-        md_refs_[key]--;
-        assert(md_refs_[key] >= 0);
-        assert(md_refs_[key] == insts.size());
-        assert(AlgoManager::Instance().md_refs_[key] > 0);
-        AlgoManager::Instance().md_refs_[key]--;
-        assert(AlgoManager::Instance().md_refs_[key] >= 0);
-        continue;
-      }
-      if (trade_update) algo.OnMarketTrade(**it, md, md0);
-      if (quote_update) algo.OnMarketQuote(**it, md, md0);
-      it++;
+    auto origin = node->origin.load(std::memory_order_relaxed);
+    // clear before reading market data so that a newer update requeues it
+    node->queued = false;
+    TickLatency::Instance().Record(TickLatency::kDispatch, origin);
+#ifndef BACKTEST
+    if (origin) {
+      auto now = TickLatency::Now();
+      CheckLag(now > origin ? now - origin : 0);
+    }
+#endif
+    TickLatency::kOrigin = origin;
+    Dispatch(*node);
+    TickLatency::kOrigin = 0;
+    auto n = ++dispatched_;
+    if (n % kFlushInterval == 0) {
+      Flush();
+      cached_time.Refresh();
+    }
+    if (--pending_ == 0) break;
+    // the nodes left wait for the timers and confirmations posted meanwhile
+    if (lag_shed_ && lag_ > lag_shed_ && index_ >= 0 &&
+        n % kYieldInterval == 0) {
+      yield = true;
+      break;
     }
-    md0 = md;
   }
+  Flush();
+  busy_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - tm0)
+               .count();
+  if (!yield) return;
+  yields_++;
+  // pending_ stays nonzero so Update does not post, Spin polls it itself
+  if (!spinning_) {
+    AlgoManager::Instance().strands_[index_].post([this]() { (*this)(); });
+  }
+}
+
+void AlgoRunner::CheckLag(uint64_t lag) {
+  lag_.store(lag, std::memory_order_relaxed);
+  if (!lag_warn_) return;
+  if (lag <= lag_warn_) {
+    if (lag_alert_tm_ && lag <= lag_warn_ / 2) {
+      LOG_INFO("Runner " << index_ << " caught up, lag=" << lag / 1e6
+                         << "ms");
+      lag_alert_tm_ = 0;
+    }
+    return;
+  }
+  auto now = TickLatency::Now();
+  if (lag_alert_tm_ && now - lag_alert_tm_ < kLagAlertInterval) return;
+  lag_alert_tm_ = now;
+  LOG_WARN("Runner " << index_ << " lagging, lag=" << lag / 1e6
+                     << "ms, pending=" << pending_ << ", yields=" << yields_);
+}
+
+double Instrument::lag() const {
+  if (!TickLatency::kOrigin) return 0;
+  return AlgoManager::Instance().runner(algo_->runner()).lag();
+}
+
+inline void AlgoRunner::Dispatch(const Dirty& node) {
+  auto& key = node.key;
+  auto& insts = insts_[node.index];
+  if (insts.empty()) return;
+  auto& pair = mds_[node.index];
+  auto& md0 = pair.md[pair.cur];
+  auto& md = pair.md[!pair.cur];
+  md = insts.front()->md();
+  auto changes = md.Changes(md0);
+  bool trade_update = changes & MarketData::kTradeChanged;
+  uint8_t quote_changes = 0;
+  uint8_t levels = 0;
+  if (changes & (MarketData::kQuoteChanged | MarketData::kDepthChanged))
+    levels = md.ChangedLevels(md0);
+  if (changes & MarketData::kQuoteChanged) {
+    auto& q = md.quote();
+    auto& q0 = md0.quote();
+    if (q.bid_price != q0.bid_price || q.ask_price != q0.ask_price)
+      quote_changes |= Instrument::kInterestL1Price;
+    if (q.bid_size != q0.bid_size || q.ask_size != q0.ask_size)
+      quote_changes |= Instrument::kInterestL1Size;
+    // rewritten with the same values, as before
+    if (!quote_changes) quote_changes = Instrument::kInterestL1Size;
+  }
+  if (changes & MarketData::kDepthChanged)
+    quote_changes |= Instrument::kInterestDepth;
+  // index based, callbacks may Register more instruments into insts
+  for (auto i = 0u; i < insts.size();) {
+    auto inst = insts[i];
+    auto& algo = inst->algo();
+    if (!algo.is_active() || !inst->listen()) {
+      insts.erase(insts.begin() + i);
+      Release(key);
+      assert(md_refs_[key] == insts.size());
+      continue;
+    }
+    if (trade_update && (inst->interest_ & Instrument::kInterestTrade))
+      algo.OnMarketTrade(*inst, md, md0);
+    if (quote_changes && WantsQuote(inst, quote_changes, levels, md)) {
+      inst->changed_levels_ = levels;
+      algo.OnMarketQuote(*inst, md, md0);
+    }
+    ++i;
+  }
+  pair.cur = !pair.cur;
+}
+
+inline bool AlgoRunner::WantsQuote(Instrument* inst, uint8_t changes,
+                                   uint8_t levels, const MarketData& md) {
+  changes &= inst->interest_;
+  if ((changes & Instrument::kInterestDepth) &&
+      !(levels & inst->depth_levels_ & ~1u))
+    changes &= ~Instrument::kInterestDepth;
+  if (!changes) return false;
+  if (inst->min_ticks_ <= 0) return true;
+  auto& q = md.quote();
+  if (changes == Instrument::kInterestL1Price && inst->last_bid_ > 0 &&
+      inst->last_ask_ > 0) {
+    auto& sec = inst->sec();
+    auto moved = [&](double px, double px0) {
+      auto tick = sec.GetTickSize(px0);
+      return tick <= 0 || std::abs(px - px0) >= inst->min_ticks_ * tick - 1e-9;
+    };
+    if (!moved(q.bid_price, inst->last_bid_) &&
+        !moved(q.ask_price, inst->last_ask_))
+      return false;
+  }
+  inst->last_bid_ = q.bid_price;
+  inst->last_ask_ = q.ask_price;
+  return true;
+}
+
+inline void AlgoRunner::Release(const Key& key) {
+  md_refs_[key]--;
+  assert(md_refs_[key] >= 0);
+  assert(AlgoManager::Instance().md_refs_[key] > 0);
+  if (!--AlgoManager::Instance().md_refs_[key])
+    MarketDataManager::Instance().Unwatched(key.second, key.first);
+}
+
+void AlgoRunner::Unregister(Instrument* inst) {
+  assert(std::this_thread::get_id() == tid_);
+  auto key = std::make_pair(inst->src(), inst->sec().id);
+  auto it = indices_.find(key);
+  if (it == indices_.end()) return;
+  auto& insts = insts_[it->second];
+  auto pos = std::find(insts.begin(), insts.end(), inst);
+  if (pos == insts.end()) return;
+  insts.erase(pos);
+  Release(key);
 }
 
 inline void AlgoManager::Register(Instrument* inst) {
-  auto& runner = runners_[inst->algo().id() % threads_.size()];
+  auto& runner = runners_[inst->algo().runner_];
   auto key = std::make_pair(inst->src(), inst->sec().id);
-  auto& pair = runner.instruments_[key];
-  if (pair.second.empty()) {
-    pair.first = inst->md();
+  auto res = runner.indices_.emplace(key, runner.insts_.size());
+  auto index = res.first->second;
+  if (res.second) {
+    runner.mds_.emplace_back();
+    runner.insts_.emplace_back();
+    // created before md_refs_ turns positive, so Update only needs find
+    auto& node = runner.dirties_[key];
+    node.key = key;
+    node.index = index;
   }
-  assert(std::find(pair.second.begin(), pair.second.end(), inst) ==
-         pair.second.end());
+  auto& insts = runner.insts_[index];
+  if (insts.empty()) {
+    auto& pair = runner.mds_[index];
+    pair.md[pair.cur] = inst->md();
+  }
+  assert(std::find(insts.begin(), insts.end(), inst) == insts.end());
   runner.md_refs_[key]++;
   md_refs_[key]++;
-  pair.second.push_back(inst);
+  insts.push_back(inst);
   assert(std::this_thread::get_id() == runner.tid_);
 }
 
@@ -92,6 +347,86 @@ Algo* AlgoManager::Spawn(Algo::ParamMapPtr params, const std::string& name,
                          const User& user, const std::string& params_raw,
                          const std::string& token,
                          Contract::OptionPtr optional) {
+  std::string disabled;
+  auto algo = Create(params, name, user, token, optional, &disabled);
+  if (!algo) return nullptr;
+  if (dynamic_cast<IndicatorHandler*>(algo)) return algo;
+  Persist(*algo, "new", params ? params_raw : "{\"test\":true}");
+  algo->Async([params, algo, disabled]() { Start(algo, params, disabled); });
+  return algo;
+}
+
+std::vector<Algo*> AlgoManager::SpawnBatch(
+    const std::string& name, const User& user,
+    const std::vector<SpawnRequest>& reqs) {
+  std::vector<Algo*> out(reqs.size());
+  std::vector<std::string> disabled(reqs.size());
+  std::vector<std::pair<const Algo*, std::string>> records;
+  std::unordered_map<DataSrc::IdType, std::vector<const Security*>> secs;
+  for (auto i = 0u; i < reqs.size(); ++i) {
+    auto& req = reqs[i];
+    assert(req.params);
+    auto algo = Create(req.params, name, user, req.token, {}, &disabled[i]);
+    if (!algo) continue;
+    out[i] = algo;
+    if (dynamic_cast<IndicatorHandler*>(algo)) continue;
+    records.emplace_back(algo, req.params_raw);
+    if (!disabled[i].empty()) continue;
+    for (auto& pair : *req.params) {
+      auto pval = std::get_if<SecurityTuple>(&pair.second);
+      if (pval && pval->sec) secs[pval->src].push_back(pval->sec);
+    }
+  }
+  if (records.empty()) return out;
+  // in bulk ahead of OnStart, whose Subscribe then finds them in flight
+  for (auto& pair : secs) {
+    auto& v = pair.second;
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+    MarketDataManager::Instance().Subscribe(v, pair.first);
+  }
+  PersistBatch(records, "new");
+  // one task per runner rather than per algo
+  typedef std::vector<std::tuple<Algo*, Algo::ParamMapPtr, std::string>>
+      Starts;
+  std::vector<std::shared_ptr<Starts>> starts(num_runners());
+  for (auto i = 0u; i < reqs.size(); ++i) {
+    auto algo = out[i];
+    if (!algo || dynamic_cast<IndicatorHandler*>(algo)) continue;
+    auto& s = starts[algo->runner_];
+    if (!s) s = std::make_shared<Starts>();
+    s->emplace_back(algo, reqs[i].params, std::move(disabled[i]));
+  }
+  for (auto i = 0u; i < starts.size(); ++i) {
+    auto s = starts[i];
+    if (!s) continue;
+    Post(i, [s]() {
+      for (auto& t : *s) Start(std::get<0>(t), std::get<1>(t), std::get<2>(t));
+    });
+  }
+  return out;
+}
+
+void AlgoManager::Start(Algo* algo, Algo::ParamMapPtr params,
+                        const std::string& disabled) {
+  if (!disabled.empty()) {
+    kError = disabled;
+  } else {
+    kError = params ? algo->OnStart(*params.get()) : algo->Test();
+  }
+  if (!kError.empty()) {
+    algo->Stop();
+#ifdef BACKTEST
+    LOG_ERROR(kError);
+#endif
+  }
+  kError.clear();
+}
+
+Algo* AlgoManager::Create(Algo::ParamMapPtr params, const std::string& name,
+                          const User& user, const std::string& token,
+                          Contract::OptionPtr optional,
+                          std::string* disabled) {
   Algo* algo = nullptr;
   if (params) {
     auto adapter = GetAdapter(name);
@@ -101,66 +436,41 @@ Algo* AlgoManager::Spawn(Algo::ParamMapPtr params, const std::string& name,
     algo = Python::LoadTest(name, token);
   }
   if (!algo) return nullptr;
-  for (;;) {
-    algo->id_ = ++algo_id_counter_;
-    // assign python algo on 0th thread, the others shares the other threads
-    if (threads_.size() > 1) {
-      if (dynamic_cast<Python*>(algo)) {
-        if (algo->id_ % threads_.size() == 0) break;
-      } else {
-        if (algo->id_ % threads_.size() != 0) break;
-      }
-    } else {
-      break;
-    }
-  }
+  algo->id_ = ++algo_id_counter_;
+  algo->runner_ = PickRunner(dynamic_cast<Python*>(algo));
+  runners_[algo->runner_].algos_++;
   algo->user_ = &user;
   algo->token_ = token;
   algo->is_active_ = true;  // for permanent in backtest
   algo->optional_ = optional;
-  algos_.emplace(algo->id_, algo);
-  if (!token.empty()) algo_of_token_.emplace(token, algo);
-  std::string disabled;
-  user.CheckDisabled("user", &disabled);
+  std::lock_guard<std::mutex> lock(index_m_);
+  auto idx = index();
+  idx->algos.emplace(algo->id_, algo);
+  if (!token.empty()) idx->of_token.emplace(token, algo);
+  user.CheckDisabled("user", disabled);
   if (params) {
     for (auto& pair : *params) {
       if (auto pval = std::get_if<SecurityTuple>(&pair.second)) {
         if (pval->acc) {
-          if (disabled.empty())
-            pval->acc->CheckDisabled("sub_account", &disabled);
+          if (disabled->empty())
+            pval->acc->CheckDisabled("sub_account", disabled);
           if (pval->sec) {
-            if (disabled.empty()) {
+            if (disabled->empty()) {
               auto broker =
                   pval->acc->GetBrokerAccount(pval->sec->exchange->id);
-              if (broker) broker->CheckDisabled("broker_account", &disabled);
+              if (broker) broker->CheckDisabled("broker_account", disabled);
             }
-            if (disabled.empty()) {
+            if (disabled->empty()) {
               StopBookManager::Instance().CheckStop(*pval->sec, pval->acc,
-                                                    &disabled);
+                                                    disabled);
             }
-            algos_of_sec_acc_.insert(std::make_pair(
+            idx->of_sec_acc.insert(std::make_pair(
                 std::make_pair(pval->sec->id, pval->acc->id), algo));
           }
         }
       }
     }
   }
-  if (dynamic_cast<IndicatorHandler*>(algo)) return algo;
-  Persist(*algo, "new", params ? params_raw : "{\"test\":true}");
-  algo->Async([params, algo, disabled]() {
-    if (!disabled.empty()) {
-      kError = disabled;
-    } else {
-      kError = params ? algo->OnStart(*params.get()) : algo->Test();
-    }
-    if (!kError.empty()) {
-      algo->Stop();
-#ifdef BACKTEST
-      LOG_ERROR(kError);
-#endif
-    }
-    kError.clear();
-  });
   return algo;
 }
 
@@ -175,20 +485,55 @@ void AlgoManager::Initialize() {
   self.algo_id_counter_ += 100;
   LOG_INFO("Algo id starts from " << self.algo_id_counter_);
   self.seq_counter_ += 100;
+  MemoryAccounting::Instance().AddReporter("algo_index", [&self]() {
+    auto idx = self.index();
+    auto u = MemoryAccounting::OfMap(idx->algos);
+    u += MemoryAccounting::OfMap(idx->of_token);
+    u += MemoryAccounting::OfMap(idx->of_sec_acc);
+    u += MemoryAccounting::OfMap(self.md_refs_);
+    return u;
+  });
+}
+
+uint32_t AlgoManager::PickRunner(bool python) {
+  // python algo on 0th thread because of GIL, the others share the others
+  if (threads_.size() <= 1 || python) return 0;
+  std::lock_guard<std::mutex> lock(pick_mutex_);
+  auto now = NowUtcInMicro();
+  auto dt = now - pick_tm_;
+  if (dt >= static_cast<int64_t>(kMicroInSec)) {
+    for (auto i = 0u; i < threads_.size(); ++i) {
+      auto& r = runners_[i];
+      uint64_t busy = r.busy_;
+      r.load_ = pick_tm_ ? (busy - r.busy0_) / (1e3 * dt) : 0.;
+      r.busy0_ = busy;
+    }
+    pick_tm_ = now;
+  }
+  // load is only sampled once a second, count algos to spread bursts
+  auto best = 1u;
+  auto best_score = 0.;
+  for (auto i = 1u; i < threads_.size(); ++i) {
+    auto& r = runners_[i];
+    auto score = r.load_ + 0.01 * r.algos_;
+    if (i == 1 || score < best_score) {
+      best = i;
+      best_score = score;
+    }
+  }
+  return best;
 }
 
 void AlgoManager::Update(DataSrc::IdType src, Security::IdType id) {
   auto key = std::make_pair(src, id);
+  auto origin = TickLatency::Now();
   for (auto i = 0u; i < threads_.size(); ++i) {
     auto& runner = runners_[i];
     if (runner.md_refs_[key] > 0) {
-      auto should_run = false;
-      {
-        AlgoRunner::LockGuard lock(runner.mutex_);
-        should_run = runner.dirties_.empty();
-        runner.dirties_.insert(key);
-      }
-      if (should_run) strands_[i].post([&runner]() { runner(); });
+      auto it = runner.dirties_.find(key);
+      if (it == runner.dirties_.end()) continue;
+      if (runner.MarkDirty(&it->second, origin) && !runner.spinning_)
+        strands_[i].post([&runner]() { runner(); });
     }
   }
 }
@@ -208,14 +553,89 @@ void AlgoManager::Run(int nthreads) {
   works_.resize(nthreads);
   for (auto i = 0; i < nthreads; ++i) {
     strands_[i].io = new boost::asio::io_service;
+    strands_[i].timers = new TimerService(*strands_[i].io);
     works_[i].reset(new boost::asio::io_service::work(*strands_[i].io));
-    threads_.emplace_back([this, i]() { strands_[i].io->run(); });
+    auto spin = busy_poll_ == "all";
+    for (auto& tok : Split(busy_poll_, ",; ")) {
+      if (tok == std::to_string(i)) spin = true;
+    }
+    if (spin) {
+      LOG_INFO("Runner " << i << " busy polling, idle_us=" << busy_poll_idle_);
+      threads_.emplace_back([this, i]() { Spin(i); });
+    } else {
+      threads_.emplace_back([this, i]() { strands_[i].io->run(); });
+    }
     runners_[i].tid_ = threads_[i].get_id();
+    runners_[i].index_ = i;
+    auto& placement = ThreadPlacement::Instance();
+    placement.Apply(threads_[i].native_handle(), "runners", i);
+    runners_[i].arena_.set_node(placement.Node("runners", i));
+  }
+  auto& m = Metrics::Instance();
+  for (auto i = 0; i < nthreads; ++i) {
+    auto& r = runners_[i];
+    auto label = Metrics::Label("runner", i);
+    m.AddGauge("opentrade_algo_runner_pending",
+               "Dirty securities waiting for dispatch", label,
+               [&r]() { return r.pending(); });
+    m.AddCounter("opentrade_algo_runner_coalesced_total",
+                 "Market data updates merged into a queued dirty security",
+                 label, [&r]() { return r.coalesced(); });
+    m.AddCounter("opentrade_algo_runner_dispatched_total",
+                 "Dirty securities dispatched", label,
+                 [&r]() { return r.dispatched(); });
+    m.AddCounter("opentrade_algo_runner_busy_seconds_total",
+                 "Time spent in market data dispatch", label,
+                 [&r]() { return r.busy() / 1e9; });
+    m.AddGauge("opentrade_algo_runner_algos", "Active algos", label,
+               [&r]() { return r.algos(); });
+    m.AddGauge("opentrade_algo_runner_lag_seconds",
+               "Wait of the last dispatched update since published", label,
+               [&r]() { return r.lag(); });
+    m.AddCounter("opentrade_algo_runner_yields_total",
+                 "Drains cut short for timers and confirmations while lagging",
+                 label, [&r]() { return r.yields(); });
   }
   StartPermanents();
 #endif
 }
 
+#ifndef BACKTEST
+void AlgoManager::SetBusyPoll(const std::string& runners, int64_t idle_us) {
+  busy_poll_ = runners;
+  busy_poll_idle_ = std::max<int64_t>(0, idle_us);
+}
+
+void AlgoManager::Spin(size_t i) {
+  auto& s = strands_[i];
+  auto& runner = runners_[i];
+  runner.spinning_ = true;
+  int64_t idle0 = 0;
+  while (!s.io->stopped()) {
+    auto n = s.io->poll();
+    if (s.timers->Poll()) ++n;
+    if (runner.pending_) {
+      runner();
+      ++n;
+    }
+    if (n) {
+      idle0 = 0;
+      continue;
+    }
+    auto now = TimerService::Now();
+    if (!idle0) idle0 = now;
+    if (now - idle0 < busy_poll_idle_) continue;
+    // back off to sleep, Update posts again from now on; a node counted
+    // before the store is seen by the check after it
+    runner.spinning_ = false;
+    if (!runner.pending_) s.io->run_one();
+    runner.spinning_ = true;
+    idle0 = 0;
+  }
+  runner.spinning_ = false;
+}
+#endif
+
 void AlgoManager::StartPermanents() {
   for (auto& pair : adapters()) {
     auto ih = dynamic_cast<IndicatorHandler*>(pair.second);
@@ -236,13 +656,14 @@ void AlgoManager::StartPermanents() {
     }
   }
 
-  for (auto& pair : algos_) {
+  auto idx = index();
+  for (auto& pair : idx->algos) {
     auto ih = dynamic_cast<IndicatorHandler*>(pair.second);
     if (!ih) continue;
     IndicatorHandlerManager::Instance().Register(ih);
   }
 
-  for (auto& pair : algos_) {
+  for (auto& pair : idx->algos) {
     auto ih = dynamic_cast<IndicatorHandler*>(pair.second);
     if (!ih) continue;
     ih->Async([ih]() { ih->OnStart(); });
@@ -252,9 +673,10 @@ void AlgoManager::StartPermanents() {
 void AlgoManager::Handle(Confirmation::Ptr cm) {
   assert(cm->order->inst);
   auto inst = const_cast<Instrument*>(cm->order->inst);
-  static std::mutex kMutex;
-  {
-    std::lock_guard<std::mutex> lock(kMutex);
+  // the qty bookkeeping runs on the runner of the algo, the only thread that
+  // reads it or places orders on the instrument, so it takes no lock
+  auto leaves = cm->order->leaves_qty;  // of a replacement as acknowledged
+  inst->algo().Async([cm, inst, leaves]() {
     switch (cm->exec_type) {
       case kPartiallyFilled:
       case kFilled:
@@ -291,6 +713,14 @@ void AlgoManager::Handle(Confirmation::Ptr cm) {
         else
           inst->outstanding_sell_qty_ -= cm->leaves_qty;
         break;
+      case kReplaced:
+        if (cm->order->IsBuy())
+          inst->outstanding_buy_qty_ += leaves - cm->leaves_qty;
+        else
+          inst->outstanding_sell_qty_ += leaves - cm->leaves_qty;
+        break;
+      case kUnconfirmedReplace:
+      case kPendingReplace:
       case kUnconfirmedNew:
       case kUnconfirmedCancel:
       case kPendingCancel:
@@ -303,8 +733,6 @@ void AlgoManager::Handle(Confirmation::Ptr cm) {
       default:
         return;
     }
-  }
-  inst->algo().Async([cm, inst]() {
     switch (cm->exec_type) {
       case kPartiallyFilled:
       case kFilled:
@@ -319,6 +747,14 @@ void AlgoManager::Handle(Confirmation::Ptr cm) {
         inst->active_orders_.erase(cm->order);
         inst->algo().OnConfirmation(*cm.get());
         break;
+      case kReplaced: {
+        auto orig = GlobalOrderBook::Instance().Get(cm->order->orig_id);
+        if (orig) inst->active_orders_.erase(orig);
+        if (cm->order->IsLive()) inst->active_orders_.insert(cm->order);
+        inst->algo().OnConfirmation(*cm.get());
+      } break;
+      case kUnconfirmedReplace:
+      case kPendingReplace:
       case kUnconfirmedNew:
       case kUnconfirmedCancel:
       case kPendingCancel:
@@ -336,102 +772,455 @@ void AlgoManager::Handle(Confirmation::Ptr cm) {
 }
 
 void AlgoManager::Stop() {
-  for (auto& pair : algos_) {
+  auto idx = index();
+  for (auto& pair : idx->algos) {
     auto algo = pair.second;
     algo->Async([algo]() { algo->Stop(); });
   }
 }
 
 void AlgoManager::Stop(Algo::IdType id) {
-  auto algo = FindInMap(algos_, id);
+  auto algo = Get(id);
   if (algo) algo->Async([algo]() { algo->Stop(); });
 }
 
 void AlgoManager::Stop(const std::string& token) {
-  auto algo = FindInMap(algo_of_token_, token);
+  auto algo = Get(token);
   if (algo) algo->Async([algo]() { algo->Stop(); });
 }
 
 void AlgoManager::Stop(Security::IdType sec, SubAccount::IdType acc) {
+  auto idx = index();
   if (sec > 0) {
-    auto range = algos_of_sec_acc_.equal_range(std::make_pair(sec, acc));
+    auto range = idx->of_sec_acc.equal_range(std::make_pair(sec, acc));
     for (auto it = range.first; it != range.second; ++it) {
       if (it->second->is_active()) Stop(it->second->id());
     }
   } else {
-    for (auto& pair : algos_of_sec_acc_) {
+    for (auto& pair : idx->of_sec_acc) {
       if (pair.first.second == acc && pair.second->is_active())
         Stop(pair.second->id());
     }
   }
 }
 
+#ifndef BACKTEST
+void AlgoManager::StartCompaction(double interval) {
+  if (interval <= 0) return;
+  auto t = boost::posix_time::microseconds(
+      static_cast<int64_t>(interval * kMicroInSec));
+  kTimerTaskPool.RepeatTask([this]() { Compact(); }, t, t);
+  LOG_INFO("Compaction of finished algos every " << interval << 's');
+}
+
+void AlgoManager::Compact() {
+  std::vector<Algo*> finished;
+  std::vector<Algo*> detached;
+  {
+    std::lock_guard<std::mutex> lock(gc_m_);
+    finished.swap(finished_);
+    detached.swap(detached_);
+  }
+
+  // detached a generation ago, out of every index and dispatch list since,
+  // through the write pool first for the records still queued there, then
+  // the runner for its queued tasks
+  for (auto algo : detached) {
+    kWriteTaskPool.AddTask([this, algo]() {
+      Post(algo->runner_, [algo]() { delete algo; });
+    });
+  }
+
+  // dropped from the index a generation ago, detached on their runners once
+  // quiet, i.e. no live order or timer left; never freed if anything else
+  // may still refer to them
+  for (auto algo : finished) {
+    Post(algo->runner_, [this, algo]() {
+      if (dynamic_cast<Python*>(algo) || dynamic_cast<IndicatorHandler*>(algo))
+        return;
+      for (auto inst : algo->instruments_) {
+        if (inst->pinned_ || inst->src() == kConsolidationSrc) return;
+      }
+      auto quiet = !algo->timers_;
+      for (auto inst : algo->instruments_) {
+        if (!inst->active_orders_.empty()) quiet = false;
+      }
+      if (!quiet) {
+        std::lock_guard<std::mutex> lock(gc_m_);
+        finished_.push_back(algo);
+        return;
+      }
+      auto& runner = runners_[algo->runner_];
+      for (auto inst : algo->instruments_) runner.Unregister(inst);
+      GlobalOrderBook::Instance().ForEach([algo](Order* ord) {
+        if (ord->inst && &ord->inst->algo() == algo) ord->inst = nullptr;
+      });
+      std::lock_guard<std::mutex> lock(gc_m_);
+      detached_.push_back(algo);
+    });
+  }
+
+  // a new generation with only the active algos
+  auto n = 0u;
+  {
+    std::lock_guard<std::mutex> lock(index_m_);
+    auto old = index_.load();
+    auto idx = new Index;
+    std::vector<Algo*> inactive;
+    for (auto& pair : old->algos) {
+      auto algo = pair.second;
+      if (!algo->is_active()) {
+        inactive.push_back(algo);
+        continue;
+      }
+      idx->algos.emplace(pair);
+      if (!algo->token_.empty()) idx->of_token.emplace(algo->token_, algo);
+    }
+    for (auto& pair : old->of_sec_acc) {
+      if (pair.second->is_active()) idx->of_sec_acc.insert(pair);
+    }
+    index_.store(idx);
+    Rcu::Retire([old]() { delete old; });
+    n = inactive.size();
+    std::lock_guard<std::mutex> lock2(gc_m_);
+    finished_.insert(finished_.end(), inactive.begin(), inactive.end());
+  }
+  if (n || !detached.empty()) {
+    LOG_DEBUG("Compaction: " << n << " finished, " << detached.size()
+                             << " freed");
+  }
+}
+#endif
+
 void AlgoManager::Persist(const Algo& algo, const std::string& status,
                           const std::string& body) {
 #ifdef BACKTEST
   return;
 #endif
-  kWriteTaskPool.AddTask([this, &algo, status, body]() {
-    std::stringstream ss;
-    ss << GetTime() << ' ' << algo.name() << ' ' << status << ' ' << body;
-    auto str = ss.str();
-    auto seq = ++seq_counter_;
-    Server::Publish(algo, status, body, seq);
-    of_.write(reinterpret_cast<const char*>(&seq), sizeof(seq));
-    uint32_t n = str.size();
-    of_.write(reinterpret_cast<const char*>(&n), sizeof(n));
-    auto uid = algo.user().id;
-    of_.write(reinterpret_cast<const char*>(&uid), sizeof(uid));
-    auto aid = algo.id();
-    of_.write(reinterpret_cast<const char*>(&aid), sizeof(aid));
-    of_ << ss.str() << '\0' << std::endl;
+  {
+    // a FlushStatus already running writes it first on the same thread
+    std::lock_guard<std::mutex> lock(status_m_);
+    pending_status_.erase(&algo);
+  }
+  kWriteTaskPool.AddTask(
+      [this, &algo, status, body]() { Write(algo, status, body); });
+}
+
+void AlgoManager::PersistBatch(
+    const std::vector<std::pair<const Algo*, std::string>>& records,
+    const std::string& status) {
+#ifdef BACKTEST
+  return;
+#endif
+  kWriteTaskPool.AddTask([this, records, status]() {
+    for (auto i = 0u; i < records.size(); ++i) {
+      Write(*records[i].first, status, records[i].second,
+            i + 1 == records.size());
+    }
   });
 }
 
+void AlgoManager::PersistStatus(const Algo& algo, const std::string& body) {
+#ifdef BACKTEST
+  return;
+#endif
+  if (!algo.is_active()) return;
+  if (status_window_ <= 0) {
+    kWriteTaskPool.AddTask(
+        [this, &algo, body]() { Write(algo, "update", body); });
+    return;
+  }
+  std::lock_guard<std::mutex> lock(status_m_);
+  pending_status_[&algo] = body;
+  if (status_scheduled_) return;
+  status_scheduled_ = true;
+  kWriteTaskPool.AddTask([this]() { FlushStatus(); },
+                         boost::posix_time::microseconds(static_cast<int64_t>(
+                             status_window_ * kMicroInSec)));
+}
+
+// on the write thread, the pending updates in one file flush and one post
+// per connection
+void AlgoManager::FlushStatus() {
+  std::vector<std::pair<const Algo*, std::string>> updates;
+  {
+    std::lock_guard<std::mutex> lock(status_m_);
+    updates.reserve(pending_status_.size());
+    for (auto& pair : pending_status_) updates.emplace_back(pair);
+    pending_status_.clear();
+    status_scheduled_ = false;
+  }
+  if (updates.empty()) return;
+  auto tm = GetTime();
+  auto msgs = std::make_shared<Server::AlgoMessages>();
+  msgs->reserve(updates.size());
+  for (auto i = 0u; i < updates.size(); ++i) {
+    auto& algo = *updates[i].first;
+    auto& body = updates[i].second;
+    auto seq = Append(algo, "update", body, tm, i + 1 == updates.size());
+    msgs->emplace_back(algo.user().id,
+                       Connection::Serialize(algo.id(), tm, algo.token(),
+                                             algo.name(), "update", body, seq,
+                                             false));
+  }
+  Server::Publish(msgs);
+}
+
+static std::string AlgoRecordOf(uint32_t seq, User::IdType uid,
+                                Algo::IdType aid, const std::string& str) {
+  uint32_t n = str.size();
+  std::string rec;
+  rec.reserve(14 + sizeof(uid) + n);
+  rec.append(reinterpret_cast<const char*>(&seq), sizeof(seq));
+  rec.append(reinterpret_cast<const char*>(&n), sizeof(n));
+  rec.append(reinterpret_cast<const char*>(&uid), sizeof(uid));
+  rec.append(reinterpret_cast<const char*>(&aid), sizeof(aid));
+  rec.append(str).append(1, '\0').append(1, '\n');
+  return rec;
+}
+
+// on the write thread, flushed at the end of a batch
+void AlgoManager::Write(const Algo& algo, const std::string& status,
+                        const std::string& body, bool flush) {
+  auto seq = Append(algo, status, body, GetTime(), flush);
+  Server::Publish(algo, status, body, seq);
+}
+
+uint32_t AlgoManager::Append(const Algo& algo, const std::string& status,
+                             const std::string& body, time_t tm, bool flush) {
+  auto str = std::to_string(tm);
+  str.append(1, ' ').append(algo.name()).append(1, ' ');
+  str.append(status).append(1, ' ').append(body);
+  auto seq = ++seq_counter_;
+  auto rec = AlgoRecordOf(seq, algo.user().id, algo.id(), str);
+  of_.write(rec.data(), rec.size());
+  if (flush) of_.flush();
+  Replication::Instance().Publish(Replication::kAlgos, {}, rec);
+  IndexRecord(seq, rec.size());
+  return seq;
+}
+
+// of the record of size appended at offset_
+void AlgoManager::IndexRecord(uint32_t seq, size_t size) {
+  if (static_cast<int64_t>(seq / kIndexInterval) != idx_bucket_) {
+    idx_bucket_ = seq / kIndexInterval;
+    AlgoIndexEntry e{seq, 0, offset_};
+    idx_of_.write(reinterpret_cast<const char*>(&e), sizeof(e));
+    idx_of_.flush();
+  }
+  offset_ += size;
+}
+
+// the records of the algos still active, e.g. the permanent ones, and a
+// marker of the counters make the new store, the old one is renamed to
+// algos.rolled and returned
+std::vector<fs::path> AlgoManager::Roll() {
+  of_.flush();
+  if (!fs::file_size(kPath)) return {};
+  std::unordered_set<Algo::IdType> active;
+  for (auto& pair : index()->algos) {
+    if (pair.second->is_active()) active.insert(pair.first);
+  }
+  auto tmp = kPath.string() + ".tmp";
+  std::ofstream of(tmp.c_str(), std::ofstream::trunc);
+  std::vector<std::pair<uint32_t, size_t>> copied;
+  {
+    boost::iostreams::mapped_file_source m(kPath.string());
+    auto p = m.data();
+    auto p_end = p + m.size();
+    AlgoRecord r;
+    for (const char* next; (next = ReadAlgoRecord(p, p_end, &r)); p = next) {
+      if (!active.count(r.id)) continue;
+      of.write(p, next - p);
+      copied.emplace_back(r.seq, next - p);
+    }
+  }
+  // seq and algo id to resume from, the records of both may be rolled out
+  std::stringstream ss;
+  ss << GetTime() << ' ' << kRollMarker << " roll {}";
+  auto seq = ++seq_counter_;
+  auto marker = AlgoRecordOf(seq, 0, algo_id_counter_, ss.str());
+  of.write(marker.data(), marker.size());
+  copied.emplace_back(seq, marker.size());
+  of.close();
+  if (!of) {
+    LOG_ERROR("Failed to write file: " << tmp << ": " << strerror(errno));
+    fs::remove(tmp);
+    return {};
+  }
+  of_.close();
+  auto old = kPath.string() + ".rolled";
+  fs::rename(kPath, old);
+  fs::rename(tmp, kPath);
+  of_.open(kPath.c_str(), std::ofstream::app);
+  if (!of_.good()) {
+    LOG_FATAL("Failed to write file: " << kPath.c_str() << ": "
+                                       << strerror(errno));
+  }
+  idx_of_.close();
+  idx_of_.open(kIndexPath.c_str(), std::ofstream::trunc);
+  idx_bucket_ = -1;
+  offset_ = 0;
+  for (auto& pair : copied) IndexRecord(pair.first, pair.second);
+  LOG_INFO("Rolled " << active.size() << " active algos onto "
+                     << kPath.c_str());
+  return {old};
+}
+
+void AlgoManager::TakeOver() {
+  // the store mirrored from the primary, for the counters and the index
+  LoadStore();
+  algo_id_counter_ += 100;
+  seq_counter_ += 100;
+  LOG_INFO("Algo id starts from " << algo_id_counter_);
+}
+
 void AlgoManager::LoadStore(uint32_t seq0, Connection* conn) {
-  if (!fs::file_size(kPath)) return;
+  if (!fs::file_size(kPath)) {
+    if (!conn) idx_of_.open(kIndexPath.c_str(), std::ofstream::trunc);
+    return;
+  }
   boost::iostreams::mapped_file_source m(kPath.string());
-  auto p = m.data();
-  auto p_end = p + m.size();
-  auto ln = 0;
-  while (p + 8 < p_end) {
-    ln++;
-    auto seq = *reinterpret_cast<const uint32_t*>(p);
-    if (!conn) seq_counter_ = seq;
-    p += 4;
-    auto n = *reinterpret_cast<const uint32_t*>(p);
-    if (p + n + 10 + sizeof(User::IdType) > p_end) break;
-    p += 4;
-    auto user_id = *reinterpret_cast<const User::IdType*>(p);
-    p += sizeof(User::IdType);
-    auto id = *reinterpret_cast<const uint32_t*>(p);
-    if (!conn && id > algo_id_counter_) algo_id_counter_ = id;
-    p += 4;
-    auto payload = p;
-    p += n + 2;  // body + '\0' + '\n'
-    if (!conn || seq <= seq0) continue;
-    if (!conn->user_->is_admin && conn->user_->id != user_id) continue;
-    int32_t tm;
-    char name[n];
-    char status[n];
-    char body[n];
-    *body = 0;
-    if (sscanf(payload, "%d %s %s %[^\1]", &tm, name, status, body) < 3) {
-      LOG_ERROR("Failed to parse algo line #" << ln);
-      continue;
+  auto p0 = m.data();
+  auto p_end = p0 + m.size();
+  auto index = ReadAlgoIndex(p0, m.size());
+  if (conn) {
+    // seek to the last indexed record not after seq0
+    auto p = p0;
+    auto it = std::upper_bound(
+        index.begin(), index.end(), seq0,
+        [](uint32_t seq, const AlgoIndexEntry& e) { return seq < e.seq; });
+    if (it != index.begin()) p += (--it)->offset;
+    AlgoRecord r;
+    auto ln = 0;
+    for (const char* next; (next = ReadAlgoRecord(p, p_end, &r)); p = next) {
+      ln++;
+      if (r.seq <= seq0) continue;
+      if (!conn->user_->is_admin && conn->user_->id != r.user_id) continue;
+      auto n = r.n;
+      int32_t tm;
+      char name[n];
+      char status[n];
+      char body[n];
+      *body = 0;
+      if (sscanf(r.body, "%d %s %s %[^\1]", &tm, name, status, body) < 3) {
+        LOG_ERROR("Failed to parse algo line #" << ln);
+        continue;
+      }
+      if (!r.user_id && !strcmp(name, kRollMarker)) continue;
+      conn->Send(r.id, tm, "", name, status, body, r.seq, true);
     }
-    conn->Send(id, tm, "", name, status, body, seq, true);
+    return;
   }
-  if (!conn && p != p_end) {
-    LOG_FATAL("Corrupted algo file: " << kPath.c_str()
-                                      << ", please fix it first");
+
+  // initial load only needs the counters, walk chunks split at the
+  // previous index in parallel, the index is rebuilt on the way
+  struct Chunk {
+    const char* begin;
+    const char* end;
+    bool ok = false;
+    uint32_t seq = 0;
+    Algo::IdType max_id = 0;
+    std::vector<AlgoIndexEntry> entries;
+  };
+  auto scan = [p0](Chunk* c) {
+    auto p = c->begin;
+    AlgoRecord r;
+    int64_t bucket = -1;
+    for (const char* next; (next = ReadAlgoRecord(p, c->end, &r)); p = next) {
+      c->seq = r.seq;
+      if (r.id > c->max_id) c->max_id = r.id;
+      if (static_cast<int64_t>(r.seq / kIndexInterval) != bucket) {
+        bucket = r.seq / kIndexInterval;
+        c->entries.push_back(
+            AlgoIndexEntry{r.seq, 0, static_cast<uint64_t>(p - p0)});
+      }
+    }
+    c->ok = p == c->end;
+  };
+  std::vector<Chunk> chunks;
+  auto nchunks = std::max(1u, std::thread::hardware_concurrency());
+  auto step = index.size() / nchunks + 1;
+  auto begin = p0;
+  for (auto i = step; i < index.size(); i += step) {
+    chunks.push_back(Chunk{begin, p0 + index[i].offset});
+    begin = p0 + index[i].offset;
+  }
+  chunks.push_back(Chunk{begin, p_end});
+  std::vector<std::thread> threads;
+  for (auto i = 1u; i < chunks.size(); ++i)
+    threads.emplace_back(scan, &chunks[i]);
+  scan(&chunks[0]);
+  for (auto& t : threads) t.join();
+  if (!std::all_of(chunks.begin(), chunks.end(),
+                   [](auto& c) { return c.ok; })) {
+    chunks.assign(1, Chunk{p0, p_end});
+    scan(&chunks[0]);
+    if (!chunks[0].ok) {
+      LOG_FATAL("Corrupted algo file: " << kPath.c_str()
+                                        << ", please fix it first");
+    }
+  }
+
+  idx_of_.open(kIndexPath.c_str(), std::ofstream::trunc);
+  for (auto& c : chunks) {
+    if (c.max_id > algo_id_counter_) algo_id_counter_ = c.max_id;
+    if (!c.seq) continue;
+    seq_counter_ = c.seq;
+    for (auto& e : c.entries) {
+      // first record of a chunk may share the bucket of the previous one
+      if (static_cast<int64_t>(e.seq / kIndexInterval) == idx_bucket_)
+        continue;
+      idx_bucket_ = e.seq / kIndexInterval;
+      idx_of_.write(reinterpret_cast<const char*>(&e), sizeof(e));
+    }
   }
+  idx_of_.flush();
+  offset_ = m.size();
 }
 
 Algo::~Algo() {
   for (auto& inst : instruments_) delete inst;
 }
 
+static MemoryTag& AlgoTag() {
+  static auto& kTag = MemoryTag::Get("algos");
+  return kTag;
+}
+
+static MemoryTag& InstrumentTag() {
+  static auto& kTag = MemoryTag::Get("instruments");
+  return kTag;
+}
+
+void* Algo::operator new(size_t n) {
+  AlgoTag().Add(n);
+  if (n <= 512) return SlabPool<512, 16>::Allocate();
+  if (n <= 1024) return SlabPool<1024, 16>::Allocate();
+  if (n <= 2048) return SlabPool<2048, 16>::Allocate();
+  if (n <= 4096) return SlabPool<4096, 16>::Allocate();
+  return ::operator new(n);
+}
+
+void Algo::operator delete(void* p, size_t n) {
+  AlgoTag().Sub(n);
+  if (n <= 512) return SlabPool<512, 16>::Free(p);
+  if (n <= 1024) return SlabPool<1024, 16>::Free(p);
+  if (n <= 2048) return SlabPool<2048, 16>::Free(p);
+  if (n <= 4096) return SlabPool<4096, 16>::Free(p);
+  ::operator delete(p);
+}
+
+void* Instrument::operator new(size_t) {
+  InstrumentTag().Add(sizeof(Instrument));
+  return SlabPool<sizeof(Instrument)>::Allocate();
+}
+
+void Instrument::operator delete(void* p) {
+  InstrumentTag().Sub(sizeof(Instrument));
+  SlabPool<sizeof(Instrument)>::Free(p);
+}
+
 Instrument* Algo::Subscribe(const Security& sec, DataSrc src, bool listen,
                             Instrument* parent) {
   assert(std::this_thread::get_id() == AlgoManager::Instance().tid(*this));
@@ -450,10 +1239,15 @@ Instrument* Algo::Subscribe(const Security& sec, DataSrc src, bool listen,
   return inst;
 }
 
+void Algo::SetStatus(const std::string& body) {
+  AlgoManager::Instance().PersistStatus(*this, body);
+}
+
 void Algo::Stop() {
   assert(std::this_thread::get_id() == AlgoManager::Instance().tid(*this));
   if (is_active_) {
     is_active_ = false;
+    AlgoManager::Instance().runners_[runner_].algos_--;
     for (auto inst : instruments_) inst->Cancel();
     AlgoManager::Instance().Persist(
         *this, kError.empty() ? "terminated" : "failed", kError);
@@ -461,31 +1255,72 @@ void Algo::Stop() {
   }
 }
 
-inline void AlgoManager::SetTimeout(const Algo& algo,
-                                    std::function<void()> func,
-                                    double seconds) {
-  if (seconds < 0) seconds = 0;
 #ifdef BACKTEST
-  kTimers.emplace(kTime + seconds * kMicroInSec, [&algo, func]() {
-    if (algo.is_active()) func();
+void AlgoManager::ScheduleInterval(const Algo& algo, TimerId id,
+                                   std::function<void()> func, uint64_t tm,
+                                   uint64_t interval) {
+  timers_[id] = kTimers.Push(tm, [=, &algo]() {
+    if (!algo.is_active()) {
+      timers_.erase(id);
+      return;
+    }
+    ScheduleInterval(algo, id, func, tm + interval, interval);
+    func();
   });
+}
+#endif
+
+TimerId AlgoManager::SetInterval(const Algo& algo, std::function<void()> func,
+                                 double first, double interval) {
+  if (first < 0) first = 0;
+#ifdef BACKTEST
+  auto id = ++timer_id_counter_;
+  ScheduleInterval(algo, id, func, kTime + first * kMicroInSec,
+                   std::max(1., interval * kMicroInSec));
+  return id;
 #else
-  if (seconds <= 0) {
-    strands_[algo.id() % threads_.size()].post(func);
-    return;
-  }
-  auto t = new boost::asio::deadline_timer(
-      *strands_[algo.id() % threads_.size()].io,
-      boost::posix_time::microseconds((int64_t)(seconds * kMicroInSec)));
-  t->async_wait([&algo, func, t](auto) {
-    if (algo.is_active()) func();
-    delete t;
-  });
+  auto timers = strands_[algo.runner_].timers;
+  auto& runner = runners_[algo.runner_];
+  auto id = std::make_shared<TimerId>(0);
+  const_cast<Algo&>(algo).timers_++;
+  *id = timers->AddPeriodic(
+      [&algo, &runner, func, timers, id]() {
+        if (!algo.is_active()) {
+          if (timers->Cancel(*id)) const_cast<Algo&>(algo).timers_--;
+          return;
+        }
+        auto tm0 = std::chrono::steady_clock::now();
+        func();
+        runner.busy_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - tm0)
+                            .count();
+      },
+      first * kMicroInSec, interval * kMicroInSec);
+  return *id;
 #endif
 }
 
-void Algo::SetTimeout(std::function<void()> func, double seconds) {
-  AlgoManager::Instance().SetTimeout(*this, func, seconds);
+inline bool AlgoManager::CancelTimeout(const Algo& algo, TimerId id) {
+#ifdef BACKTEST
+  auto it = timers_.find(id);
+  if (it == timers_.end()) return false;
+  kTimers.Cancel(it->second);
+  timers_.erase(it);
+  return true;
+#else
+  if (!strands_[algo.runner_].timers->Cancel(id)) return false;
+  const_cast<Algo&>(algo).timers_--;
+  return true;
+#endif
+}
+
+TimerId Algo::SetInterval(std::function<void()> func, double first,
+                          double interval) {
+  return AlgoManager::Instance().SetInterval(*this, func, first, interval);
+}
+
+bool Algo::CancelTimeout(TimerId id) {
+  return AlgoManager::Instance().CancelTimeout(*this, id);
 }
 
 void AlgoManager::Cancel(Instrument* inst) {
@@ -502,9 +1337,15 @@ Order* Algo::Place(const Contract& contract, Instrument* inst) {
   ord->inst = inst;
   ord->sec = &inst->sec();
   if (!contract.optional && optional_) ord->optional = optional_;
+  ord->origin = TickLatency::kOrigin;
+  TickLatency::Instance().Record(TickLatency::kPlace, ord->origin);
   auto ok = ExchangeConnectivityManager::Instance().Place(ord);
   if (!ok) return nullptr;
-  if (contract.type == kCX) return ord;
+  if (contract.type == kCX) {
+    // held by the cross engine, not in active_orders_
+    inst->pinned_ = true;
+    return ord;
+  }
   inst->active_orders_.insert(ord);
   if (ord->IsBuy())
     inst->outstanding_buy_qty_ += ord->qty;
@@ -524,11 +1365,22 @@ void Algo::Cross(double qty, double price, OrderSide side,
   Place(c, inst);
 }
 
+void Algo::DeferBatch() {
+  auto& runner = AlgoManager::Instance().runners_[runner_];
+  assert(std::this_thread::get_id() == runner.tid_);
+  runner.deferred_.push_back(this);
+}
+
 bool Algo::Cancel(const Order& ord) {
   return ExchangeConnectivityManager::Instance().Cancel(ord);
 }
 
+bool Algo::Replace(const Order& ord, double qty, double price) {
+  return ExchangeConnectivityManager::Instance().Replace(ord, qty, price);
+}
+
 void Instrument::Subscribe(Indicator::IdType id, bool listen) {
+  pinned_ = true;  // the handler may keep it, e.g. as the parent of its own
   auto ih = IndicatorHandlerManager::Instance().Get(id);
   if (ih) ih->Subscribe(this, listen);
 }
@@ -3,11 +3,16 @@
 
 #include <tbb/atomic.h>
 #include <tbb/concurrent_unordered_map.h>
+#include <algorithm>
 #include <atomic>
 #include <boost/asio.hpp>
+#include <boost/container/small_vector.hpp>
 #include <boost/unordered_map.hpp>
 #include <boost/unordered_set.hpp>
+#include <chrono>
+#include <deque>
 #include <fstream>
+#include <limits>
 #include <list>
 #include <mutex>
 #include <thread>
@@ -18,15 +23,19 @@
 #include <vector>
 
 #include "adapter.h"
+#include "latency.h"
 #include "market_data.h"
 #include "order.h"
 #include "position.h"
+#include "rcu.h"
 #include "security.h"
 #include "utility.h"
 
 namespace opentrade {
 
 class Instrument;
+class ParamSchema;
+struct ParamStruct;
 
 struct SecurityTuple {
   DataSrc src;
@@ -78,11 +87,30 @@ class Algo : public Adapter {
  public:
   ~Algo();
   typedef uint32_t IdType;
-  typedef std::unordered_map<std::string, ParamDef::Value> ParamMap;
+  struct ParamMap : public std::unordered_map<std::string, ParamDef::Value> {
+    using unordered_map::unordered_map;
+    // parsed by the schema of a TypedAlgo, see param_schema.h
+    std::shared_ptr<const ParamStruct> typed;
+  };
   typedef std::shared_ptr<ParamMap> ParamMapPtr;
-  void SetTimeout(std::function<void()> func, double seconds);
-  void Async(std::function<void()> func) { SetTimeout(func, 0); }
+  // returns id for CancelTimeout, 0 if seconds <= 0 (posted immediately),
+  // func is kept in place with the timer if it fits an InlineFunc
+  template <typename F>
+  TimerId SetTimeout(F&& func, double seconds);
+  // fixed-rate timer, first run after first seconds then every interval,
+  // stops with the algo, can be cancelled with CancelTimeout
+  TimerId SetInterval(std::function<void()> func, double first,
+                      double interval);
+  bool CancelTimeout(TimerId id);
+  template <typename F>
+  void Async(F&& func) {
+    SetTimeout(std::forward<F>(func), 0);
+  }
   static bool Cancel(const Order& ord);
+  // amends ord to qty, filled included, at price, false if not sent, e.g.
+  // the venue has no replace or one is pending, so that it can be cancelled
+  // instead. kReplaced comes with the replacement, which holds the leaves
+  static bool Replace(const Order& ord, double qty, double price);
 
   virtual std::string OnStart(const ParamMap& params) noexcept { return {}; }
   virtual void OnModify(const ParamMap& params) noexcept {}
@@ -94,8 +122,13 @@ class Algo : public Adapter {
   // for cross order, only kUnconfirmedNew and kFilled
   virtual void OnConfirmation(const Confirmation& cm) noexcept {}
   virtual const ParamDefs& GetParamDefs() noexcept { return kCommonParamDefs; }
+  // non-null for a TypedAlgo, for the json to be parsed into its struct
+  virtual const ParamSchema* GetParamSchema() noexcept { return nullptr; }
   virtual void OnIndicator(Indicator::IdType id,
                            const Instrument& inst) noexcept {}
+  // once per runner cycle after DeferBatch, for algos which coalesce
+  // market data callbacks themselves, e.g. Python's on_market_batch
+  virtual void OnMarketBatch() noexcept {}
 
   virtual std::string Test() noexcept {
     assert(false);
@@ -108,9 +141,20 @@ class Algo : public Adapter {
 
   bool is_active() const { return is_active_; }
   IdType id() const { return id_; }
+  uint32_t runner() const { return runner_; }
   const std::string& token() const { return token_; }
   const User& user() const { return *user_; }
   void set_user(const User* user) { user_ = user; }
+  // an intermediate status, e.g. the progress on a child fill, to the store
+  // and the user's clients as "update", the latest within the status window
+  // of AlgoManager wins
+  void SetStatus(const std::string& body);
+
+  // from slab pools by size class, the subclasses sharing those of their
+  // size, so an algo freed by AlgoManager::Compact hands its block to a later
+  // spawn rather than to the heap
+  static void* operator new(size_t n);
+  static void operator delete(void* p, size_t n);
 
  protected:
   Instrument* Subscribe(const Security& sec, DataSrc src = {},
@@ -119,21 +163,65 @@ class Algo : public Adapter {
   Order* Place(const Contract& contract, Instrument* inst);
   void Cross(double qty, double price, OrderSide side, const SubAccount* acc,
              Instrument* inst);
+  // schedules OnMarketBatch, only in market data callbacks
+  void DeferBatch();
 
  private:
   const User* user_ = nullptr;
   bool is_active_ = true;
   IdType id_ = 0;
+  uint32_t runner_ = 0;  // index of AlgoRunner this algo lives on
   std::string token_;
   std::unordered_set<Instrument*> instruments_;
   Contract::OptionPtr optional_;
+  // pending timeouts and intervals, see AlgoManager::Compact
+  tbb::atomic<uint32_t> timers_ = 0;
   friend class AlgoManager;
   friend class Backtest;
 };
 
 class Instrument {
  public:
-  typedef std::unordered_set<Order*> Orders;
+  // live orders, inline for the few an algo typically has, removed by
+  // swapping in the last through Order::inst_index, so no hashing
+  class Orders {
+   public:
+    typedef boost::container::small_vector<Order*, 4> Vector;
+    typedef Vector::const_iterator const_iterator;
+    const_iterator begin() const { return v_.begin(); }
+    const_iterator end() const { return v_.end(); }
+    size_t size() const { return v_.size(); }
+    bool empty() const { return v_.empty(); }
+    bool contains(const Order* ord) const {
+      return ord->inst_index < v_.size() && v_[ord->inst_index] == ord;
+    }
+    void insert(Order* ord) {
+      if (contains(ord)) return;
+      assert(v_.size() <= std::numeric_limits<uint16_t>::max());
+      ord->inst_index = v_.size();
+      v_.push_back(ord);
+    }
+    void erase(const Order* ord) {
+      if (!contains(ord)) return;
+      auto i = ord->inst_index;
+      v_[i] = v_.back();
+      v_[i]->inst_index = i;
+      v_.pop_back();
+    }
+    void swap(Orders& other) { v_.swap(other.v_); }
+
+   private:
+    Vector v_;
+  };
+  // the updates dispatched to OnMarketTrade and OnMarketQuote, checked by the
+  // runner so that the others never reach the algo
+  enum Interest : uint8_t {
+    kInterestTrade = 1,
+    kInterestL1Price = 1 << 1,
+    kInterestL1Size = 1 << 2,
+    kInterestDepth = 1 << 3,  // depth[1:], to OnMarketQuote
+    kInterestAll = kInterestTrade | kInterestL1Price | kInterestL1Size,
+  };
   Instrument(Algo* algo, const Security& sec, DataSrc src, uint8_t src_idx = 0)
       : algo_(algo), sec_(sec), src_(src), src_idx_(src_idx) {}
   Algo& algo() { return *algo_; }
@@ -164,6 +252,9 @@ class Instrument {
     return Round6(cum_qty(ignore_cx) + total_outstanding_qty());
   }
   size_t id() const { return id_; }
+  // seconds the market data being dispatched waited on the runner since
+  // published, 0 in timers and confirmations
+  double lag() const;
 
   void Cancel() {
     for (auto ord : active_orders_) algo_->Cancel(*ord);
@@ -171,7 +262,21 @@ class Instrument {
 
   void UnListen() { listen_ = false; }
   bool listen() const { return listen_; }
+  // min_ticks: an update of only the L1 prices is skipped unless bid or ask
+  // moved at least so many ticks since the last one dispatched to here
+  void SetInterest(uint8_t mask, double min_ticks = 0) {
+    interest_ = mask;
+    min_ticks_ = min_ticks;
+  }
+  uint8_t interest() const { return interest_; }
+  // with kInterestDepth, depth[1:] changes get to OnMarketQuote only if one
+  // of levels changed, bit i for depth[i]
+  void SetDepthLevels(uint8_t levels) { depth_levels_ = levels; }
+  uint8_t depth_levels() const { return depth_levels_; }
+  // of the update dispatched to OnMarketQuote, bit i set if depth[i] changed
+  uint8_t changed_levels() const { return changed_levels_; }
   void HookTradeTick(TradeTickHook* hook) {
+    pinned_ = true;
     const_cast<MarketData*>(md_)->HookTradeTick(hook);
   }
   void UnhookTradeTick(TradeTickHook* hook) {
@@ -188,6 +293,11 @@ class Instrument {
     return md_->Get<T>(id);
   }
   void Clear() { decltype(active_orders_){}.swap(active_orders_); }
+  RiskContext* risk_context() const { return &risk_context_; }
+
+  // pooled as the algos are, see Algo::operator new
+  static void* operator new(size_t n);
+  static void operator delete(void* p);
 
  private:
   Algo* algo_ = nullptr;
@@ -203,9 +313,20 @@ class Instrument {
   double outstanding_sell_qty_ = 0;
   size_t id_ = 0;
   bool listen_ = true;
+  uint8_t interest_ = kInterestAll;
+  uint8_t depth_levels_ = 0xff;
+  uint8_t changed_levels_ = 0;
+  double min_ticks_ = 0;
+  // L1 prices last dispatched, for min_ticks_
+  double last_bid_ = 0;
+  double last_ask_ = 0;
+  // referenced by an indicator or a hook, so never freed with its algo
+  bool pinned_ = false;
   uint8_t src_idx_ = -1;  // for fast looking up in price consolidation
   Instrument* parent_ = nullptr;
+  mutable RiskContext risk_context_;
   friend class AlgoManager;
+  friend class AlgoRunner;
   friend class Algo;
   static inline std::atomic<size_t> kIdCounter_ = 0;
 };
@@ -217,19 +338,106 @@ class AlgoRunner {
   explicit AlgoRunner(std::thread::id tid) : tid_(tid) {}
 #endif
   void operator()();
+  // number of dirty (src, security) waiting for dispatch
+  uint32_t pending() const { return pending_; }
+  // updates merged into an already queued dirty
+  uint64_t coalesced() const { return coalesced_; }
+  // active algos placed on this runner
+  uint32_t algos() const { return algos_; }
+  uint64_t dispatched() const { return dispatched_; }
+  // accumulated nanoseconds spent in market data dispatch and timers
+  uint64_t busy() const { return busy_; }
+  // busy ratio of the last sampling period
+  double load() const { return load_; }
+  // polling without blocking, see AlgoManager::SetBusyPoll
+  bool spinning() const { return spinning_; }
+  // seconds the last dispatched update waited since published
+  double lag() const { return lag_ / 1e9; }
+  // drains cut short for the timers and confirmations queued behind them
+  uint64_t yields() const { return yields_; }
+  // lagging over shed seconds, a drain gives way to the other work posted
+  // on the runner every kYieldInterval dispatches; over warn, an alert is
+  // logged at most every kLagAlertInterval; 0 to disable, call before Run
+  static void SetLagThresholds(double warn, double shed) {
+    lag_warn_ = std::max(0., warn) * 1e9;
+    lag_shed_ = std::max(0., shed) * 1e9;
+  }
 
  private:
-  boost::unordered_map<std::pair<DataSrc::IdType, Security::IdType>,
-                       std::pair<MarketData, std::list<Instrument*>>>
-      instruments_;
-  tbb::concurrent_unordered_map<std::pair<DataSrc::IdType, Security::IdType>,
-                                tbb::atomic<uint32_t>>
-      md_refs_;
+  typedef std::pair<DataSrc::IdType, Security::IdType> Key;
+  struct Dirty {
+    Key key;
+    uint32_t index = 0;  // into mds_ and insts_
+    std::atomic<bool> queued = false;
+    std::atomic<Dirty*> next = nullptr;
+    // of the oldest update coalesced, see TickLatency
+    std::atomic<uint64_t> origin = 0;
+  };
+  // returns true if the runner needs to be scheduled
+  bool MarkDirty(Dirty* node, uint64_t origin);
+  // intrusive MPSC queue (Vyukov), producers push on head_, runner pops tail_
+  void Push(Dirty* node);
+  Dirty* Pop();
+  void Dispatch(const Dirty& node);
+  // the quote changes of an update as Instrument::Interest bits, true if
+  // inst is to get OnMarketQuote for them, levels the depth levels changed
+  static bool WantsQuote(Instrument* inst, uint8_t changes, uint8_t levels,
+                         const MarketData& md);
+  // takes inst out of dispatch, e.g. before it is freed
+  void Unregister(Instrument* inst);
+  // of an instrument leaving key
+  void Release(const Key& key);
+  // calls OnMarketBatch of the deferred algos
+  void Flush();
+  void Clear();
+
+ private:
+  typedef boost::container::small_vector<Instrument*, 4> Instruments;
+  // dense index assigned at Register, only touched on the runner thread,
+  // deque keeps references stable when Register is called in a callback
+  boost::unordered_map<Key, uint32_t> indices_;
+  // last dispatched copy and the one being dispatched, swapped by flipping
+  // cur rather than copying md into md0 after every dispatch
+  struct MdPair {
+    MarketData md[2];
+    uint8_t cur = 0;  // md[cur] is md0
+  };
+  // from the runner's own arena, on the node of its cpu if pinned, see
+  // AlgoManager::Run
+  NumaArena arena_;
+  std::deque<MdPair, NumaAllocator<MdPair>> mds_{
+      NumaAllocator<MdPair>(&arena_)};
+  std::deque<Instruments, NumaAllocator<Instruments>> insts_{
+      NumaAllocator<Instruments>(&arena_)};
+  tbb::concurrent_unordered_map<Key, tbb::atomic<uint32_t>> md_refs_;
+  tbb::concurrent_unordered_map<Key, Dirty> dirties_;
   std::thread::id tid_;
-  boost::unordered_set<std::pair<DataSrc::IdType, Security::IdType>> dirties_;
-  std::mutex mutex_;
-  typedef std::lock_guard<std::mutex> LockGuard;
+  Dirty stub_;
+  std::atomic<Dirty*> head_ = &stub_;
+  Dirty* tail_ = &stub_;
+  std::vector<Algo*> deferred_;
+  // flushes deferred_ every so many dispatches on a long drain
+  static inline const uint64_t kFlushInterval = 256;
+  void CheckLag(uint64_t lag);
+  static inline const uint64_t kYieldInterval = 64;
+  static inline const uint64_t kLagAlertInterval = 10000000000;  // ns
+  static inline uint64_t lag_warn_ = 0;
+  static inline uint64_t lag_shed_ = 0;
+  std::atomic<uint64_t> lag_ = 0;
+  std::atomic<uint64_t> yields_ = 0;
+  uint64_t lag_alert_tm_ = 0;  // of the last alert, 0 if not lagging
+  int index_ = -1;  // into AlgoManager::strands_, -1 not to yield
+  std::atomic<uint32_t> pending_ = 0;
+  std::atomic<uint64_t> coalesced_ = 0;
+  std::atomic<uint32_t> algos_ = 0;
+  std::atomic<uint64_t> dispatched_ = 0;
+  std::atomic<uint64_t> busy_ = 0;
+  std::atomic<double> load_ = 0;
+  // the runner thread polls pending_ itself, no need to post it
+  std::atomic<bool> spinning_ = false;
+  uint64_t busy0_ = 0;  // busy_ at the last sampling
   friend class AlgoManager;
+  friend class Algo;
   friend class Backtest;
 };
 
@@ -241,11 +449,25 @@ class AlgoManager : public AdapterManager<Algo>, public Singleton<AlgoManager> {
   Algo* Spawn(Algo::ParamMapPtr params, const std::string& name,
               const User& user, const std::string& params_raw,
               const std::string& token, Contract::OptionPtr optional = {});
+  struct SpawnRequest {
+    Algo::ParamMapPtr params;
+    std::string params_raw;
+    std::string token;
+  };
+  // the algos of a basket, e.g. a rebalance: persisted in one write task,
+  // market data subscribed in bulk, OnStart posted once per runner; nullptr
+  // for the ones which failed
+  std::vector<Algo*> SpawnBatch(const std::string& name, const User& user,
+                                const std::vector<SpawnRequest>& reqs);
   template <typename T>
   void Modify(const T& id, Algo::ParamMapPtr params) {
     Modify(Get(id), params);
   }
   void Modify(Algo* algo, Algo::ParamMapPtr params);
+  // runners (comma separated indices or "all") to busy poll their dirty
+  // queue, timers and posts instead of sleeping in the io_service, blocking
+  // again after idle_us microseconds without work, call before Run
+  void SetBusyPoll(const std::string& runners, int64_t idle_us);
   void Run(int nthreads);
   void StartPermanents();
   void Update(DataSrc::IdType src, Security::IdType id);
@@ -254,60 +476,180 @@ class AlgoManager : public AdapterManager<Algo>, public Singleton<AlgoManager> {
   void Stop(const std::string& token);
   void Stop(Security::IdType sec, SubAccount::IdType acc);
   void Handle(Confirmation::Ptr cm);
-  void SetTimeout(const Algo& algo, std::function<void()> func, double seconds);
+  template <typename F>
+  TimerId SetTimeout(const Algo& algo, F&& func, double seconds);
+  TimerId SetInterval(const Algo& algo, std::function<void()> func,
+                      double first, double interval);
+  bool CancelTimeout(const Algo& algo, TimerId id);
   bool IsSubscribed(DataSrc::IdType src, Security::IdType id) {
     return md_refs_[std::make_pair(src, id)] > 0;
   }
   void Register(Instrument* inst);
   void Persist(const Algo& algo, const std::string& status,
                const std::string& body);
+  void PersistBatch(
+      const std::vector<std::pair<const Algo*, std::string>>& records,
+      const std::string& status);
+  // coalesced per algo over window seconds, written and published in one
+  // batch, 0 to persist every one; "new" and the terminal statuses of
+  // Persist always go through, superseding the pending one
+  void PersistStatus(const Algo& algo, const std::string& body);
+  void set_status_window(double seconds) { status_window_ = seconds; }
   void LoadStore(uint32_t seq0 = 0, Connection* conn = nullptr);
-  Algo* Get(const Algo::IdType& id) { return FindInMap(algos_, id); }
+  // the standby becomes the primary, see Replication
+  void TakeOver();
+  // day roll on the write thread, see DayRoll; returns the files rolled
+  // out of the store
+  std::vector<boost::filesystem::path> Roll();
+  Algo* Get(const Algo::IdType& id) { return FindInMap(index()->algos, id); }
   Algo* Get(const std::string& token) {
-    return FindInMap(algo_of_token_, token);
+    return FindInMap(index()->of_token, token);
   }
+  // every interval seconds, drops the finished algos from the indexes, and
+  // frees them two generations later unless orders, timers or indicators
+  // still refer to them
+  void StartCompaction(double interval);
+  void Compact();
   void Cancel(Instrument* inst);
-  auto tid(const Algo& algo) const {
-    return runners_[algo.id() % threads_.size()].tid_;
+  auto tid(const Algo& algo) const { return runners_[algo.runner_].tid_; }
+  size_t num_runners() const { return threads_.size(); }
+  // run func on the i-th runner thread
+  void Post(size_t runner, InlineFunc func) {
+    strands_[runner].post(std::move(func));
   }
+  const AlgoRunner& runner(size_t i) const { return runners_[i]; }
 
  protected:
   std::atomic<Algo::IdType> algo_id_counter_ = 0;
-  tbb::concurrent_unordered_map<Algo::IdType, Algo*> algos_;
-  tbb::concurrent_unordered_map<std::string, Algo*> algo_of_token_;
-  tbb::concurrent_unordered_multimap<
-      std::pair<Security::IdType, SubAccount::IdType>, Algo*>
-      algos_of_sec_acc_;
+  // a generation of the indexes of the algos, inserted into concurrently
+  // under index_m_ and replaced as a whole by Compact, see Rcu
+  struct Index {
+    mutable tbb::concurrent_unordered_map<Algo::IdType, Algo*> algos;
+    mutable tbb::concurrent_unordered_map<std::string, Algo*> of_token;
+    mutable tbb::concurrent_unordered_multimap<
+        std::pair<Security::IdType, SubAccount::IdType>, Algo*>
+        of_sec_acc;
+  };
+  RcuSnapshot<Index> index() const { return RcuSnapshot<Index>(index_); }
+  std::atomic<const Index*> index_ = new Index;
+  std::mutex index_m_;
+  // finished algos waiting for their orders and timers to be done, and
+  // those detached from them waiting one more generation to be freed
+  std::vector<Algo*> finished_;
+  std::vector<Algo*> detached_;
+  std::mutex gc_m_;
   tbb::concurrent_unordered_map<std::pair<DataSrc::IdType, Security::IdType>,
                                 tbb::atomic<uint32_t>>
       md_refs_;
+  // least loaded runner, python algos are always on the 0th runner
+  uint32_t PickRunner(bool python);
+  // registered and placed on a runner, but neither persisted nor started; the
+  // reason it must not start in disabled
+  Algo* Create(Algo::ParamMapPtr params, const std::string& name,
+               const User& user, const std::string& token,
+               Contract::OptionPtr optional, std::string* disabled);
+  static void Start(Algo* algo, Algo::ParamMapPtr params,
+                    const std::string& disabled);
+  void Write(const Algo& algo, const std::string& status,
+             const std::string& body, bool flush = true);
+  // appends the record and returns its seq, on the write thread
+  uint32_t Append(const Algo& algo, const std::string& status,
+                  const std::string& body, time_t tm, bool flush);
+  void FlushStatus();
+  void IndexRecord(uint32_t seq, size_t size);
+
+ protected:
   AlgoRunner* runners_ = nullptr;
   std::vector<std::thread> threads_;
+  std::mutex pick_mutex_;
+  int64_t pick_tm_ = 0;  // last load sampling time in micro seconds
 #ifdef BACKTEST
   struct Strand {
-    void post(std::function<void()> func) { kTimers.emplace(0, func); }
+    template <typename F>
+    void post(F&& func) {
+      kTimers.Push(0, std::forward<F>(func));
+    }
   };
+  void ScheduleInterval(const Algo& algo, TimerId id,
+                        std::function<void()> func, uint64_t tm,
+                        uint64_t interval);
+  TimerId timer_id_counter_ = 0;
+  std::unordered_map<TimerId, EventQueue::Id> timers_;
 #else
   struct Strand {
     // clang-format off
 #ifdef UNIT_TEST
     virtual
 #endif
-    void post(std::function<void()> func) {
-      io->post(func);
+    void post(InlineFunc func) {
+      PostTask(*io, std::move(func));
     }
     // clang-format on
     boost::asio::io_service* io;
+    TimerService* timers = nullptr;
   };
   std::vector<std::unique_ptr<boost::asio::io_service::work>> works_;
+  void Spin(size_t i);
+  std::string busy_poll_;
+  int64_t busy_poll_idle_ = 1000;
 #endif
   Strand* strands_ = nullptr;
   std::ofstream of_;
+  std::ofstream idx_of_;  // sparse seq -> offset index of of_
+  uint64_t offset_ = 0;
+  int64_t idx_bucket_ = -1;
   uint32_t seq_counter_ = 0;
+  double status_window_ = 0.2;
+  std::unordered_map<const Algo*, std::string> pending_status_;
+  bool status_scheduled_ = false;
+  std::mutex status_m_;  // pending_status_ and status_scheduled_
   friend class AlgoRunner;
+  friend class Algo;
   friend class Backtest;
+  friend class Replication;
 };
 
+template <typename F>
+inline TimerId AlgoManager::SetTimeout(const Algo& algo, F&& func,
+                                       double seconds) {
+  if (seconds < 0) seconds = 0;
+#ifdef BACKTEST
+  auto id = ++timer_id_counter_;
+  auto it = kTimers.Push(
+      kTime + seconds * kMicroInSec,
+      [this, &algo, func = std::forward<F>(func), id]() mutable {
+        timers_.erase(id);
+        if (algo.is_active()) func();
+      });
+  timers_.emplace(id, it);
+  return id;
+#else
+  if (seconds <= 0) {
+    strands_[algo.runner_].post(std::forward<F>(func));
+    return 0;
+  }
+  auto& runner = runners_[algo.runner_];
+  const_cast<Algo&>(algo).timers_++;
+  return strands_[algo.runner_].timers->Add(
+      [&algo, &runner, func = std::forward<F>(func)]() mutable {
+        const_cast<Algo&>(algo).timers_--;
+        if (!algo.is_active()) return;
+        auto tm0 = std::chrono::steady_clock::now();
+        func();
+        runner.busy_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - tm0)
+                            .count();
+      },
+      seconds * kMicroInSec);
+#endif
+}
+
+template <typename F>
+inline TimerId Algo::SetTimeout(F&& func, double seconds) {
+  return AlgoManager::Instance().SetTimeout(*this, std::forward<F>(func),
+                                            seconds);
+}
+
 }  // namespace opentrade
 
 #endif  // OPENTRADE_ALGO_H_
@@ -0,0 +1,163 @@
+#ifndef OPENTRADE_ASYNC_TRADE_TICK_HOOK_H_
+#define OPENTRADE_ASYNC_TRADE_TICK_HOOK_H_
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+
+#include "clock.h"
+#include "market_data.h"
+
+namespace opentrade {
+
+// TradeTickHook delivered off the feed thread. OnTrade only copies the tick
+// into a bounded ring, the consumer drains it in batches on its own thread,
+// scheduled through Post once per batch, so a slow consumer never stalls
+// the adapter. Several adapters may feed one hook, so the ring takes
+// multiple producers (Vyukov bounded queue) with a single consumer.
+// Ticks are delivered inline in backtest to keep it deterministic.
+class AsyncTradeTickHook : public TradeTickHook {
+ public:
+  struct Tick {
+    DataSrc::IdType src;
+    Security::IdType id;
+    const MarketData* md;
+    time_t tm;
+    double px;
+    double qty;
+    int64_t enqueued;  // steady clock ns
+  };
+  // what OnTrade does when the ring is full
+  enum Policy {
+    kDropNewest,
+    kBlock,  // spin until the consumer frees a cell
+  };
+
+  explicit AsyncTradeTickHook(size_t capacity = 4096,
+                              Policy policy = kDropNewest)
+      : policy_(policy) {
+    size_t n = 1;
+    while (n < capacity) n <<= 1;
+    mask_ = n - 1;
+    cells_.reset(new Cell[n]);
+    for (auto i = 0u; i < n; ++i) cells_[i].seq = i;
+  }
+
+  void OnTrade(DataSrc::IdType src, Security::IdType id, const MarketData* md,
+               time_t tm, double px, double qty) noexcept final {
+    Tick t{src, id, md, tm, px, qty, Now()};
+#ifdef BACKTEST
+    OnTick(t);
+    delivered_++;
+    return;
+#endif
+    while (!TryPush(t)) {
+      Schedule();
+      if (policy_ == kDropNewest) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      std::this_thread::yield();
+    }
+    Schedule();
+  }
+
+  uint64_t delivered() const { return delivered_; }
+  uint64_t dropped() const { return dropped_; }
+  // enqueue to delivery, in nanoseconds
+  uint64_t total_latency() const { return total_latency_; }
+  uint64_t max_latency() const { return max_latency_; }
+
+ protected:
+  // on the consumer thread
+  virtual void OnTick(const Tick& t) noexcept = 0;
+  // run func on the consumer thread
+  virtual void Post(std::function<void()> func) noexcept = 0;
+
+ private:
+  static inline const size_t kBatch = 256;
+
+  struct alignas(64) Cell {
+    std::atomic<size_t> seq;
+    Tick tick;
+  };
+
+  static int64_t Now() { return FineClock::Now(); }
+
+  bool TryPush(const Tick& t) {
+    auto pos = head_.load(std::memory_order_relaxed);
+    while (true) {
+      auto& c = cells_[pos & mask_];
+      auto seq = c.seq.load(std::memory_order_acquire);
+      auto dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (dif == 0) {
+        if (head_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          c.tick = t;
+          c.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool TryPop(Tick* t) {
+    auto& c = cells_[tail_ & mask_];
+    if (c.seq.load(std::memory_order_acquire) != tail_ + 1) return false;
+    *t = c.tick;
+    c.seq.store(tail_ + mask_ + 1, std::memory_order_release);
+    tail_++;
+    return true;
+  }
+
+  void Schedule() {
+    if (scheduled_.exchange(true, std::memory_order_acq_rel)) return;
+    Post([this]() { Drain(); });
+  }
+
+  void Drain() {
+    while (true) {
+      Tick t;
+      auto n = 0u;
+      while (n < kBatch && TryPop(&t)) {
+        OnTick(t);
+        uint64_t d = Now() - t.enqueued;
+        total_latency_ += d;
+        if (d > max_latency_) max_latency_ = d;
+        n++;
+      }
+      delivered_ += n;
+      if (n == kBatch) {
+        // yield the consumer thread to its other work between batches
+        Post([this]() { Drain(); });
+        return;
+      }
+      scheduled_.store(false, std::memory_order_seq_cst);
+      // a producer may have pushed after the last TryPop but seen
+      // scheduled_ still true
+      auto& c = cells_[tail_ & mask_];
+      if (c.seq.load(std::memory_order_acquire) != tail_ + 1) return;
+      if (scheduled_.exchange(true, std::memory_order_acq_rel)) return;
+    }
+  }
+
+  const Policy policy_;
+  size_t mask_;
+  std::unique_ptr<Cell[]> cells_;
+  alignas(64) std::atomic<size_t> head_ = 0;
+  alignas(64) size_t tail_ = 0;
+  std::atomic<bool> scheduled_ = false;
+  std::atomic<uint64_t> delivered_ = 0;
+  std::atomic<uint64_t> dropped_ = 0;
+  std::atomic<uint64_t> total_latency_ = 0;
+  std::atomic<uint64_t> max_latency_ = 0;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_ASYNC_TRADE_TICK_HOOK_H_
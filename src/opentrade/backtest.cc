@@ -1,12 +1,27 @@
 #ifdef BACKTEST
 #include "backtest.h"
 
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <boost/iostreams/device/mapped_file.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
 
 #include "cross_engine.h"
+#include "indicator_cache.h"
 #include "indicator_handler.h"
 #include "logger.h"
+#include "pipe_stream.h"
 #include "simulator.h"
+#include "tca.h"
+#include "text_parser.h"
+#include "tick_file.h"
 
 namespace fs = boost::filesystem;
 
@@ -27,13 +42,100 @@ struct Tick {
   char type;
   double px;
   double qty;
-  bool operator<(const Tick& b) const { return ms < b.ms; }
 };
-typedef std::vector<Tick> Ticks;
+
+// <hhmmssmmm> <security index> <type> <px> <qty>
+inline bool ReadTextTick(LineReader* lines, SecTuples* sts, Tick* t) {
+  const char* line;
+  const char* end;
+  while (lines->Next(&line, &end)) {
+    uint32_t i;
+    uint32_t hmsm;
+    TextCursor c(line, end);
+    if (!c.Uint(&hmsm) || !c.Uint(&i) || !c.Char(&t->type) ||
+        !c.Double(&t->px) || !c.Double(&t->qty))
+      continue;
+    if (i >= sts->size()) continue;
+    auto& st = (*sts)[i];
+    if (!st.sec) continue;
+    t->st = &st;
+    t->px *= st.adj_px;
+    t->qty *= st.adj_vol;
+    auto hms = hmsm / 1000;
+    t->ms = (hms / 10000 * 3600 + hms % 10000 / 100 * 60 + hms % 100) * 1000 +
+            hmsm % 1000;
+    return true;
+  }
+  return false;
+}
+
+inline bool ReadBinaryTick(const char** pp, const char* p_end, SecTuples* sts,
+                           Tick* t) {
+  auto& p = *pp;
+  while (p < p_end) {
+    t->ms = *reinterpret_cast<const uint32_t*>(p);
+    p += 4;
+    auto i = *reinterpret_cast<const uint16_t*>(p);
+    p += 2;
+    t->type = *p;
+    p += 1;
+    t->px = *reinterpret_cast<const double*>(p);
+    p += 8;
+    t->qty = *reinterpret_cast<const uint32_t*>(p);
+    p += 4;
+    if (i >= sts->size()) continue;
+    auto& st = (*sts)[i];
+    if (!st.sec) continue;
+    t->st = &st;
+    t->px *= st.adj_px;
+    t->qty *= st.adj_vol;
+    return true;
+  }
+  return false;
+}
+
+template <typename Reader>
+inline bool ReadColumnarTick(Reader* reader, SecTuples* sts, Tick* t) {
+  RawTick raw;
+  while (reader->Next(&raw)) {
+    if (raw.index >= sts->size()) continue;
+    auto& st = (*sts)[raw.index];
+    if (!st.sec) continue;
+    *t = Tick{&st, raw.ms, raw.type, raw.px * st.adj_px, raw.qty * st.adj_vol};
+    return true;
+  }
+  return false;
+}
+
+// the ticks of one simulator's file, in time order
+struct TickCursor {
+  enum Format { kText, kBinary, kColumnar, kIndexed };
+  Format format = kText;
+  SecTuples* sts = nullptr;
+  LineReader lines;
+  const char* p = nullptr;
+  const char* p_end = nullptr;
+  ColumnarTickReader columnar;
+  IndexedTickReader indexed;
+
+  bool Next(Tick* t) {
+    switch (format) {
+      case kText:
+        return ReadTextTick(&lines, sts, t);
+      case kBinary:
+        return ReadBinaryTick(&p, p_end, sts, t);
+      case kColumnar:
+        return ReadColumnarTick(&columnar, sts, t);
+      case kIndexed:
+        return ReadColumnarTick(&indexed, sts, t);
+    }
+    return false;
+  }
+};
 
 bool LoadTickFile(const char* fn, Simulator* sim,
                   const boost::gregorian::date& date, SecTuples* sts,
-                  PipeStream* ifs, bool* binary,
+                  PipeStream* ifs, bool* binary, std::string* format,
                   const std::set<std::string>& used_symbols) {
   *binary = true;
   ifs->open(fn);
@@ -41,9 +143,12 @@ bool LoadTickFile(const char* fn, Simulator* sim,
 
   LOG_INFO("Loading " << fn);
   auto secs0 = opentrade::SecurityManager::Instance().GetSecurities(
-      &ifs->stream(), fn, binary, used_symbols);
-  if (*binary && ifs->pipe()) {
-    LOG_FATAL("Not support compressed tick file");
+      &ifs->stream(), fn, binary, used_symbols, format);
+  if (*binary && ifs->compressed()) {
+    // the binary readers want the whole file
+    if (!ifs->open(fn, true)) LOG_FATAL("Failed to decompress " << fn);
+    secs0 = opentrade::SecurityManager::Instance().GetSecurities(
+        &ifs->stream(), fn, binary, used_symbols, format);
   }
   sts->clear();
   sts->resize(secs0.size());
@@ -55,67 +160,13 @@ bool LoadTickFile(const char* fn, Simulator* sim,
     auto it = std::upper_bound(sec->adjs.begin(), sec->adjs.end(),
                                Security::Adj(date_num));
     if (it == adjs.end())
-      (*sts)[i] = SecTuple{sec, sim, &sim->active_orders()[sec->id], 1., 1.};
+      (*sts)[i] = SecTuple{sec, sim, &sim->OrdersOf(*sec), 1., 1.};
     else
-      (*sts)[i] =
-          SecTuple{sec, sim, &sim->active_orders()[sec->id], it->px, it->vol};
+      (*sts)[i] = SecTuple{sec, sim, &sim->OrdersOf(*sec), it->px, it->vol};
   }
   return true;
 }
 
-inline Tick ReadTextTickFile(std::basic_istream<char>* ifs, uint32_t to_tm,
-                             SecTuples* sts, Ticks* ticks) {
-  static const int kLineLength = 128;
-  char line[kLineLength];
-  while (ifs->getline(line, sizeof(line))) {
-    Tick t;
-    uint32_t i;
-    uint32_t hmsm;
-    if (sscanf(line, "%u %u %c %lf %lf", &hmsm, &i, &t.type, &t.px, &t.qty) !=
-        5)
-      continue;
-    if (i >= sts->size()) continue;
-    auto& st = (*sts)[i];
-    if (!st.sec) continue;
-    t.st = &st;
-    t.px *= st.adj_px;
-    t.qty *= st.adj_vol;
-    auto hms = hmsm / 1000;
-    t.ms = (hms / 10000 * 3600 + hms % 10000 / 100 * 60 + hms % 100) * 1000 +
-           hmsm % 1000;
-    if (t.ms > to_tm) return t;
-    ticks->push_back(t);
-  }
-  return {};
-}
-
-inline Tick ReadBinaryTickFile(const char** pp, const char* p_end,
-                               uint32_t to_tm, SecTuples* sts, Ticks* ticks) {
-  auto& p = *pp;
-  while (p < p_end) {
-    Tick t;
-    t.ms = *reinterpret_cast<const uint32_t*>(p);
-    p += 4;
-    auto i = *reinterpret_cast<const uint16_t*>(p);
-    p += 2;
-    t.type = *p;
-    p += 1;
-    t.px = *reinterpret_cast<const double*>(p);
-    p += 8;
-    t.qty = *reinterpret_cast<const uint32_t*>(p);
-    p += 4;
-    if (i >= sts->size()) continue;
-    auto& st = (*sts)[i];
-    if (!st.sec) continue;
-    t.st = &st;
-    t.px *= st.adj_px;
-    t.qty *= st.adj_vol;
-    if (t.ms > to_tm) return t;
-    ticks->push_back(t);
-  }
-  return {};
-}
-
 void Backtest::Play(const boost::gregorian::date& date) {
   skip_ = false;
   boost::posix_time::ptime pt(date);
@@ -132,30 +183,56 @@ void Backtest::Play(const boost::gregorian::date& date) {
   SecTuples sts[simulators_.size()];
   PipeStream ifs[simulators_.size()];
   bool binaries[simulators_.size()];
-  std::vector<std::pair<const char*, const char*>> fpos(simulators_.size());
+  std::string formats[simulators_.size()];
+  TickCursor cursors[simulators_.size()];
   boost::iostreams::mapped_file_source mmfiles[simulators_.size()];
   auto n = 0;
   for (auto i = 0u; i < simulators_.size(); ++i) {
     strftime(fn, sizeof(fn), simulators_[i].first.c_str(), &tm);
     if (LoadTickFile(fn, simulators_[i].second, date, &sts[i], &ifs[i],
-                     &binaries[i], used_symbols_)) {
+                     &binaries[i], &formats[i], used_symbols_)) {
       LOG_DEBUG("Start to play back " << fn);
+      auto& c = cursors[i];
+      c.sts = &sts[i];
+      c.lines = LineReader(&ifs[i].stream());
       if (binaries[i]) {
-        mmfiles[i].open(fn);
-        auto p = mmfiles[i].data();
-        auto p_end = p + mmfiles[i].size();
-        p += ifs[i].tellg();
-        ifs[i].close();
-        if ((p_end - p) % 19) {
+        const char* p;
+        const char* p_end;
+        if (ifs[i].compressed()) {
+          p = ifs[i].data();
+          p_end = p + ifs[i].size();
+          p += ifs[i].tellg();
+        } else {
+          mmfiles[i].open(fn);
+          p = mmfiles[i].data();
+          p_end = p + mmfiles[i].size();
+          p += ifs[i].tellg();
+          ifs[i].close();
+        }
+        if (formats[i] == "columnar") {
+          c.format = TickCursor::kColumnar;
+          c.columnar = ColumnarTickReader(p, p_end);
+        } else if (formats[i] == "indexed") {
+          std::vector<bool> used(sts[i].size());
+          for (auto j = 0u; j < used.size(); ++j) used[j] = sts[i][j].sec;
+          c.format = TickCursor::kIndexed;
+          c.indexed = IndexedTickReader(p, p_end, used);
+        } else if ((p_end - p) % 19) {
           LOG_FATAL("Invalid binary file: " << fn);
+        } else {
+          c.format = TickCursor::kBinary;
         }
-        fpos[i] = std::make_pair(p, p_end);
+        c.p = p;
+        c.p_end = p_end;
       }
       ++n;
     }
   }
   if (!n) return;
+  if (!replay_dir_.empty() && !replay_.Load(replay_dir_, date))
+    LOG_WARN("No confirmation journal of " << date << " to replay");
 
+  IndicatorCache::Instance().StartOfDay(boost::gregorian::to_iso_string(date));
   AlgoManager::Instance().StartPermanents();
   if (on_start_of_day_) {
     try {
@@ -166,43 +243,55 @@ void Backtest::Play(const boost::gregorian::date& date) {
     }
   }
 
-  std::vector<Tick> last_ticks(simulators_.size());
-  static const uint32_t kNSteps = 240;
-  static const uint32_t kStep = (kSecondsOneDay * 1000) / kNSteps;
-  Ticks ticks;
-  for (auto to_tm = kStep; to_tm <= kSecondsOneDay * 1000 && !skip_;
-       to_tm += kStep) {
-    ticks.clear();
-    for (auto i = 0u; i < simulators_.size(); ++i) {
-      auto& t = last_ticks[i];
-      if (t.st) {
-        if (t.ms > to_tm) continue;
-        ticks.push_back(t);
+  // k-way merge of the simulators' files, ties go to the earlier simulator
+  typedef std::pair<Tick, size_t> Head;
+  auto later = [](const Head& a, const Head& b) {
+    return a.first.ms != b.first.ms ? a.first.ms > b.first.ms
+                                    : a.second > b.second;
+  };
+  std::vector<Head> heads;
+  for (auto i = 0u; i < simulators_.size(); ++i) {
+    Tick t;
+    if (cursors[i].sts && cursors[i].Next(&t)) heads.emplace_back(t, i);
+  }
+  std::make_heap(heads.begin(), heads.end(), later);
+  static const uint32_t kDayEnd = kSecondsOneDay * 1000;
+  EventQueue::Func timer;
+  auto t0 = std::chrono::steady_clock::now();
+  while (!heads.empty() && !skip_) {
+    std::pop_heap(heads.begin(), heads.end(), later);
+    auto& h = heads.back();
+    auto& t = h.first;
+    if (t.ms > kDayEnd) break;
+    auto tm = tm0_us + t.ms * 1000lu;
+    if (tm < kTime) tm = kTime;
+    uint64_t at;
+    while (kTimers.Pop(tm, &timer, &at)) {
+      if (at > kTime) {
+        FlushConfirmations();
+        kTime = at;
       }
-      t = binaries[i]
-              ? ReadBinaryTickFile(&fpos[i].first, fpos[i].second, to_tm,
-                                   &sts[i], &ticks)
-              : ReadTextTickFile(&ifs[i].stream(), to_tm, &sts[i], &ticks);
+      timer();
+      stats_.timers++;
     }
-    if (simulators_.size() > 1) std::sort(ticks.begin(), ticks.end());
-    for (auto& t : ticks) {
-      if (skip_) break;
-      auto tm = tm0_us + t.ms * 1000lu;
-      if (tm < kTime) tm = kTime;
-      auto it = kTimers.begin();
-      while (it != kTimers.end() && it->first <= tm) {
-        if (it->first > kTime) kTime = it->first;
-        it->second();
-        kTimers.erase(it);
-        // do not use it = kTimers.erase(it) in case smaller timer inserted
-        it = kTimers.begin();
-      }
-      if (tm > kTime) kTime = tm;
-
-      t.st->sim->HandleTick(*t.st->sec, t.type, t.px, t.qty, trade_hit_ratio_,
-                            t.st->actives);
+    if (tm > kTime) {
+      FlushConfirmations();
+      kTime = tm;
     }
+
+    t.st->sim->HandleTick(*t.st->sec, t.type, t.px, t.qty, trade_hit_ratio_,
+                          t.st->actives);
+    stats_.ticks++;
+    if (cursors[h.second].Next(&t))
+      std::push_heap(heads.begin(), heads.end(), later);
+    else
+      heads.pop_back();
   }
+  stats_.seconds += std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - t0)
+                        .count();
+  FlushConfirmations();
+  IndicatorCache::Instance().EndOfDay(!skip_);
 
   PositionManager::Instance().UpdatePnl();
 
@@ -214,28 +303,65 @@ void Backtest::Play(const boost::gregorian::date& date) {
     }
   }
 
+  if (replay_.loaded()) {
+    if (!replay_of_.is_open()) {
+      auto path = of_path_ + ".replay";
+      if (shard_ >= 0) path += "." + std::to_string(shard_);
+      replay_of_.open(path);
+      replay_of_ << "kind,tm,symbol,side,type,qty,price,recorded_tm,"
+                    "recorded_type,recorded_qty,recorded_price\n";
+    }
+    replay_.Report(replay_of_);
+  }
+
   Clear();
 }
 
+void Backtest::Link::Parse(const char* name) {
+  auto str = getenv(name);
+  if (!str) return;
+  latencies.Parse(str);
+  enabled = !latencies.empty();
+  LOG_INFO(name << '=' << str);
+}
+
+uint64_t Backtest::Link::Arrival(const Exchange* exch) {
+  auto at = kTime;
+  if (!enabled) return at;
+  at += latencies.Sample(exch, &seed) * kMicroInSec;
+  auto& x = last[exch];
+  if (at < x) at = x;
+  x = at;
+  return at;
+}
+
 void Backtest::Clear() {
   auto& algo_mngr = AlgoManager::Instance();
-  for (auto& pair : algo_mngr.algos_) {
+  auto old = algo_mngr.index_.load();
+  for (auto& pair : old->algos) {
     pair.second->Stop();
     if (pair.second->create_func()) delete pair.second;
   }
-  algo_mngr.runners_[0].dirties_.clear();
-  algo_mngr.runners_[0].instruments_.clear();
-  algo_mngr.runners_[0].md_refs_.clear();
+  algo_mngr.runners_[0].Clear();
   algo_mngr.md_refs_.clear();
-  algo_mngr.algos_.clear();
-  algo_mngr.algo_of_token_.clear();
-  algo_mngr.algos_of_sec_acc_.clear();
+  // single threaded, no reader to wait for
+  algo_mngr.index_.store(new AlgoManager::Index);
+  delete old;
   auto& gb = GlobalOrderBook::Instance();
-  for (auto& pair : gb.orders_) delete pair.second;
-  gb.orders_.clear();
-  gb.exec_ids_.clear();
+  gb.orders_.ForEach([this](Order* ord) {
+    stats_.orders++;
+    delete ord;
+  });
+  gb.orders_.Reset();
+  for (auto& l : gb.status_lists_) l = {};
+  gb.exec_ids_.Clear();
   for (auto& pair : simulators_) pair.second->active_orders().clear();
+  order_link_.Reset();
+  confirmation_link_.Reset();
+  md_link_.Reset();
   kTimers.clear();
+  cm_batch_.n = 0;
+  algo_mngr.timers_.clear();
   IndicatorHandlerManager::Instance().ihs_.clear();
   IndicatorHandlerManager::Instance().name2id_.clear();
   for (auto& pair : simulators_) {
@@ -329,27 +455,50 @@ void Backtest::Start(const std::string& py,
   on_start_ = GetCallable(m, "on_start");
   on_start_of_day_ = GetCallable(m, "on_start_of_day");
   on_confirmation_ = GetCallable(m, "on_confirmation");
+  on_confirmation_batch_ = GetCallable(m, "on_confirmation_batch");
+  if (on_confirmation_batch_) LOG_INFO("Confirmations delivered in batches");
   on_end_ = GetCallable(m, "on_end");
   if (!on_end_) on_end_ = GetCallable(m, "on_stop");
   on_end_of_day_ = GetCallable(m, "on_end_of_day");
+  if (PyObject_HasAttrString(m.ptr(), "sweep")) {
+    bp::object sweep = m.attr("sweep");
+    if (PyCallable_Check(sweep.ptr())) sweep = sweep(obj_);
+    if (!sweep.is_none()) {
+      for (auto i = 0; i < bp::len(sweep); ++i) configs_.push_back(sweep[i]);
+      LOG_INFO("Sweep of " << configs_.size() << " configurations");
+    }
+  }
   if (!on_start_) return;
-  try {
-    on_start_(obj_);
-  } catch (const bp::error_already_set& err) {
-    PrintPyError("on_start", true);
+  // deferred to each sweep worker, after its config is set
+  if (configs_.empty()) {
+    try {
+      on_start_(obj_);
+    } catch (const bp::error_already_set& err) {
+      PrintPyError("on_start", true);
+    }
   }
 
   auto trade_hit_ratio_str = getenv("TRADE_HIT_RATIO");
   if (trade_hit_ratio_str) {
     trade_hit_ratio_ = atof(trade_hit_ratio_str);
   }
-  LOG_INFO("TRADE_HIT_RATIO=" << trade_hit_ratio_);
+  if (trade_hit_ratio_ < 0)
+    LOG_INFO("Fill trade ticks by queue position");
+  else
+    LOG_INFO("TRADE_HIT_RATIO=" << trade_hit_ratio_);
 
-  auto latency_str = getenv("LATENCY");
-  if (latency_str) {
-    latency_ = atof(latency_str);
+  // <seconds>[~<jitter>][,<exchange>=<seconds>[~<jitter>]...] of the orders
+  // to the exchanges, of the acks and fills back, and of the ticks to the
+  // algos, the exchanges matching the ticks as they come
+  order_link_.Parse("LATENCY");
+  confirmation_link_.Parse("CONFIRMATION_LATENCY");
+  md_link_.Parse("MD_LATENCY");
+
+  auto replay_str = getenv("REPLAY_JOURNAL");
+  if (replay_str) {
+    replay_dir_ = replay_str;
+    LOG_INFO("REPLAY_JOURNAL=" << replay_str);
   }
-  LOG_INFO("LATENCY=" << latency_);
 
   auto used_symbols_str = getenv("USED_SYMBOLS");
   if (used_symbols_str) {
@@ -358,6 +507,175 @@ void Backtest::Start(const std::string& py,
   }
 }
 
+void Backtest::Run(const boost::gregorian::date& start,
+                   const boost::gregorian::date& end, int nworkers,
+                   int warmup_days) {
+  typedef boost::gregorian::date_duration Days;
+  auto ndays = (end - start).days() + 1;
+  if (nworkers <= 1 || ndays <= 1) {
+    for (auto dt = start; dt <= end; dt += Days(1)) Play(dt);
+    End();
+    return;
+  }
+  nworkers = std::min<int64_t>(nworkers, ndays);
+  of_.close();
+  std::cout.flush();
+  std::vector<pid_t> pids;
+  for (auto k = 0; k < nworkers; ++k) {
+    auto first = start + Days(ndays * k / nworkers);
+    auto last = start + Days(ndays * (k + 1) / nworkers - 1);
+    auto pid = fork();
+    if (pid < 0) {
+      LOG_FATAL("Failed to fork backtest worker: " << strerror(errno));
+    }
+    if (pid) {
+      pids.push_back(pid);
+      continue;
+    }
+    shard_ = k;
+    auto dt = k ? std::max(start, first - Days(warmup_days)) : first;
+    LOG_INFO("Backtest shard " << k << ": " << first << " - " << last
+                               << ", warmup from " << dt);
+    if (dt < first) of_.open("/dev/null");
+    for (; dt <= last; dt += Days(1)) {
+      if (dt == first) {
+        of_.open(ShardPath(k));
+        TcaManager::Instance().Clear();
+      }
+      Play(dt);
+    }
+    End();
+    std::cout.flush();
+    _exit(0);
+  }
+  auto failed = 0;
+  for (auto pid : pids) {
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status)) {
+      failed++;
+    }
+  }
+  if (failed) LOG_ERROR(failed << " backtest shards failed");
+  std::ofstream out(of_path_, std::ofstream::binary);
+  for (auto k = 0; k < nworkers; ++k) {
+    std::ifstream in(ShardPath(k));
+    if (in.peek() != std::ifstream::traits_type::eof()) out << in.rdbuf();
+    in.close();
+    std::remove(ShardPath(k).c_str());
+  }
+  std::ofstream tca;
+  for (auto k = 0; k < nworkers; ++k) {
+    auto path = ShardPath(k) + ".tca";
+    std::ifstream in(path);
+    if (!in.good()) continue;
+    if (!tca.is_open()) tca.open(of_path_ + ".tca");
+    if (in.peek() != std::ifstream::traits_type::eof()) tca << in.rdbuf();
+    in.close();
+    std::remove(path.c_str());
+  }
+  LOG_INFO("Merged trades of " << nworkers << " backtest shards into "
+                               << of_path_);
+}
+
+void Backtest::Sweep(const boost::gregorian::date& start,
+                     const boost::gregorian::date& end, int nworkers) {
+  typedef boost::gregorian::date_duration Days;
+  nworkers = std::max(1, nworkers);
+  of_.close();
+  std::cout.flush();
+  auto running = 0;
+  auto failed = 0;
+  auto wait_one = [&]() {
+    int status;
+    if (wait(&status) < 0) return;
+    running--;
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) failed++;
+  };
+  for (auto k = 0; k < static_cast<int>(configs_.size()); ++k) {
+    while (running >= nworkers) wait_one();
+    auto pid = fork();
+    if (pid < 0) {
+      LOG_FATAL("Failed to fork sweep worker: " << strerror(errno));
+    }
+    if (pid) {
+      running++;
+      continue;
+    }
+    shard_ = k;
+    config_ = configs_[k];
+    of_.open(ShardPath(k));
+    if (on_start_) {
+      try {
+        on_start_(obj_);
+      } catch (const bp::error_already_set& err) {
+        PrintPyError("on_start", true);
+      }
+    }
+    for (auto dt = start; dt <= end; dt += Days(1)) Play(dt);
+    End();
+    std::cout.flush();
+    _exit(0);
+  }
+  while (running > 0) wait_one();
+  if (failed) LOG_ERROR(failed << " sweep workers failed");
+
+  // index,trades,qty,notional,config
+  std::ofstream out(of_path_ + ".sweep");
+  for (auto k = 0u; k < configs_.size(); ++k) {
+    TradeReader in(ShardPath(k));
+    TradeRecord r;
+    auto n = 0;
+    double qty = 0;
+    double notional = 0;
+    while (in.Next(&r)) {
+      n++;
+      qty += r.qty;
+      notional += r.qty * r.px;
+    }
+    out << k << ',' << n << ',' << qty << ',' << notional << ','
+        << bp::extract<std::string>(bp::str(configs_[k]))() << '\n';
+  }
+  LOG_INFO("Sweep summary written to " << of_path_ << ".sweep");
+}
+
+// "<trades file>.tca" of lines "algo id,sub account,symbol,side,qty,avg px,
+// arrival px,arrival bps,vwap bps,participation,markout bps", the costs of
+// all also logged weighted by notional
+void Backtest::WriteTca() {
+  auto tca = TcaManager::Instance().Get();
+  if (tca.empty()) return;
+  auto path = (shard_ < 0 ? of_path_ : ShardPath(shard_)) + ".tca";
+  std::ofstream out(path);
+  double notional = 0;
+  double qty = 0;
+  double volume = 0;
+  double bps[3] = {};
+  for (auto& [key, s] : tca) {
+    auto [algo_id, acc_id, sec_id] = key;
+    auto acc = AccountManager::Instance().GetSubAccount(acc_id);
+    auto sec = SecurityManager::Instance().Get(sec_id);
+    out << std::setprecision(15) << algo_id << ',' << (acc ? acc->name : "")
+        << ',' << (sec ? sec->symbol : "") << ',' << (s.buy ? 'B' : 'S')
+        << ',' << s.qty << ',' << s.avg_px() << ',' << s.arrival_px << ','
+        << s.arrival_bps() << ',' << s.vwap_bps() << ',' << s.participation()
+        << ',' << s.markout_bps() << '\n';
+    notional += s.notional;
+    qty += s.qty;
+    volume += s.volume;
+    bps[0] += s.arrival_bps() * s.notional;
+    bps[1] += s.vwap_bps() * s.notional;
+    bps[2] += s.markout_bps() * s.notional;
+  }
+  if (notional <= 0) return;
+  LOG_INFO("TCA: notional=" << notional << " arrival_bps="
+                            << bps[0] / notional << " vwap_bps="
+                            << bps[1] / notional << " participation="
+                            << (volume > 0 ? qty / volume : 0)
+                            << " markout_bps=" << bps[2] / notional
+                            << ", details in " << path);
+}
+
 void Backtest::End() {
   if (on_end_) {
     try {
@@ -367,9 +685,53 @@ void Backtest::End() {
     }
   }
   of_.close();
+  WriteTca();
+
+  if (!stats_.ticks) return;
+  rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  auto s = std::max(stats_.seconds, 1e-9);
+  LOG_INFO("Backtest throughput: seconds="
+           << stats_.seconds << " ticks=" << stats_.ticks
+           << " ticks/s=" << static_cast<uint64_t>(stats_.ticks / s)
+           << " timers=" << stats_.timers
+           << " timers/s=" << static_cast<uint64_t>(stats_.timers / s)
+           << " orders=" << stats_.orders
+           << " orders/s=" << static_cast<uint64_t>(stats_.orders / s)
+           << " peak_rss_kb=" << ru.ru_maxrss);
+  if (replay_dir_.empty()) return;
+  auto& rs = replay_.stats();
+  LOG_INFO("Replay: recorded=" << rs.recorded << " matched=" << rs.matched
+                               << " extra=" << rs.extra
+                               << " differing=" << rs.diff);
 }
 
 void Backtest::OnConfirmation(const Confirmation& cm) {
+  if (on_confirmation_batch_) {
+    typedef ConfirmationBatch B;
+    auto& b = cm_batch_;
+    if (b.data.size() < (b.n + 1) * B::kColumns)
+      b.data.resize(std::max<size_t>(64, b.n * 2) * B::kColumns);
+    auto p = &b.data[b.n++ * B::kColumns];
+    auto& ord = *cm.order;
+    auto fill = cm.exec_type == kFilled || cm.exec_type == kPartiallyFilled;
+    p[B::kOrderId] = ord.id;
+    p[B::kSecurityId] = ord.sec ? ord.sec->id : 0;
+    p[B::kSubAccountId] = ord.sub_account ? ord.sub_account->id : 0;
+    p[B::kAlgoId] = ord.inst ? ord.inst->algo().id() : 0;
+    p[B::kTransactionTime] = cm.transaction_time;
+    p[B::kExecType] = cm.exec_type;
+    p[B::kExecTransType] = cm.exec_trans_type;
+    p[B::kSide] = ord.side;
+    p[B::kQty] = ord.qty;
+    p[B::kPrice] = ord.price;
+    p[B::kLastShares] = fill ? cm.last_shares : 0;
+    p[B::kLastPx] = cm.last_px;
+    p[B::kCumQty] = ord.cum_qty;
+    p[B::kAvgPx] = ord.avg_px;
+    p[B::kLeavesQty] = ord.leaves_qty;
+    return;
+  }
   if (!on_confirmation_) return;
   try {
     on_confirmation_(obj_, bp::ptr(&cm));
@@ -378,6 +740,32 @@ void Backtest::OnConfirmation(const Confirmation& cm) {
   }
 }
 
+// once the clock moves on, the confirmations placed by the callback going
+// to the next batch
+void Backtest::FlushConfirmations() {
+  auto& b = cm_batch_;
+  if (!b.n) return;
+  auto n = b.n;
+  b.n = 0;
+  b.data.swap(b.out);
+  b.shape[0] = n;
+  Py_buffer view{};
+  view.buf = b.out.data();
+  view.len = n * ConfirmationBatch::kColumns * sizeof(double);
+  view.itemsize = sizeof(double);
+  view.readonly = 1;
+  view.ndim = 2;
+  view.format = const_cast<char*>("d");
+  view.shape = b.shape;
+  view.strides = b.strides;
+  try {
+    bp::object data(bp::handle<>(PyMemoryView_FromBuffer(&view)));
+    on_confirmation_batch_(obj_, data);
+  } catch (const bp::error_already_set& err) {
+    PrintPyError("on_confirmation_batch", true);
+  }
+}
+
 }  // namespace opentrade
 
 #endif  // BACKTEST
@@ -6,9 +6,14 @@
 #include <cstdlib>
 #include <fstream>
 #include <set>
+#include <unordered_map>
+#include <vector>
 
+#include "fill_model.h"
 #include "python.h"
+#include "replay.h"
 #include "security.h"
+#include "trade_file.h"
 
 namespace opentrade {
 
@@ -16,8 +21,70 @@ class Simulator;
 
 class Backtest : public Singleton<Backtest> {
  public:
-  Backtest() : of_(PythonOr(std::getenv("TRADES_OUTFILE"), "trades.txt")) {}
+  // The confirmations of a step of the backtest clock, handed to
+  // on_confirmation_batch(self, data) instead of one on_confirmation call
+  // each, data a read only memoryview of doubles shaped (n, kColumns) valid
+  // only within the callback, exec_type and side as their character codes.
+  struct ConfirmationBatch {
+    enum Column {
+      kOrderId,
+      kSecurityId,
+      kSubAccountId,
+      kAlgoId,
+      kTransactionTime,
+      kExecType,
+      kExecTransType,
+      kSide,
+      kQty,
+      kPrice,
+      kLastShares,  // 0 if not a fill
+      kLastPx,
+      kCumQty,
+      kAvgPx,
+      kLeavesQty,
+      kColumns,
+    };
+    static inline const char* kFields[kColumns] = {
+        "order_id", "sec_id", "sub_account_id", "algo_id", "tm", "exec_type",
+        "exec_trans_type", "side", "qty", "price", "last_shares", "last_px",
+        "cum_qty", "avg_px", "leaves_qty"};
+    std::vector<double> data;
+    std::vector<double> out;  // of the callback, data free to grow
+    uint32_t n = 0;
+    Py_ssize_t shape[2] = {0, kColumns};
+    Py_ssize_t strides[2] = {kColumns * sizeof(double), sizeof(double)};
+  };
+  // summed over the days played, logged by End, see scripts/bench_backtest
+  struct Stats {
+    uint64_t ticks = 0;
+    uint64_t timers = 0;
+    uint64_t orders = 0;
+    double seconds = 0;  // wall time of the tick loops
+  };
+  Backtest()
+      : of_path_(PythonOr(std::getenv("TRADES_OUTFILE"), "trades.txt")),
+        of_(!strcasecmp(PythonOr(std::getenv("TRADES_FORMAT"), ""),
+                        "binary")) {
+    of_.open(of_path_);
+  }
   void Play(const boost::gregorian::date& date);
+  // plays [start, end], with nworkers > 1 the dates are split into
+  // contiguous blocks each played in a forked process writing trades to
+  // "<trades file>.<shard>", merged in date order once all are done. A
+  // shard other than the first replays warmup_days before its block
+  // without output, so positions built up by then carry into it.
+  void Run(const boost::gregorian::date& start,
+           const boost::gregorian::date& end, int nworkers = 1,
+           int warmup_days = 0);
+  // parameter sweep over the configurations listed by "sweep" of the
+  // script, each played over [start, end] in its own forked process
+  // (at most nworkers at a time) with bt.config set before on_start,
+  // trades go to "<trades file>.<index>" and a per configuration summary
+  // to "<trades file>.sweep"
+  void Sweep(const boost::gregorian::date& start,
+             const boost::gregorian::date& end, int nworkers = 1);
+  bool sweeping() const { return !configs_.empty(); }
+  bp::object config() const { return config_; }
   void Start(const std::string& py, const std::string& default_tick_file,
              int start_date, int end_date);
   SubAccount* CreateSubAccount(const std::string& name,
@@ -27,25 +94,74 @@ class Backtest : public Singleton<Backtest> {
   void Clear();
   void Skip() { skip_ = true; }
   void AddSimulator(const std::string& fn_tmpl, const std::string& name = "");
-  auto latency() { return latency_; }
+  // kTime a message sent now reaches the exchange of sec, or the algos from
+  // it, the messages of an exchange kept in the order sent
+  uint64_t OrderArrival(const Security& sec) {
+    return order_link_.Arrival(sec.exchange);
+  }
+  uint64_t ConfirmationArrival(const Security& sec) {
+    return confirmation_link_.Arrival(sec.exchange);
+  }
+  uint64_t MdArrival(const Security& sec) {
+    return md_link_.Arrival(sec.exchange);
+  }
+  // false if delivered at once
+  bool confirmation_delayed() const { return confirmation_link_.enabled; }
+  bool md_delayed() const { return md_link_.enabled; }
   auto start_date() const { return start_date_; }
   auto end_date() const { return end_date_; }
+  auto shard() const { return shard_; }
+  const Stats& stats() const { return stats_; }
+  Replay& replay() { return replay_; }
+
+ private:
+  std::string ShardPath(int k) const {
+    return of_path_ + "." + std::to_string(k);
+  }
+  void WriteTca();
+  void FlushConfirmations();
+
+  // a one way path to or from the exchanges
+  struct Link {
+    void Parse(const char* name);
+    uint64_t Arrival(const Exchange* exch);
+    void Reset() {
+      last.clear();
+      seed = 0;
+    }
+    Latencies latencies;  // in seconds
+    std::unordered_map<const Exchange*, uint64_t> last;
+    uint32_t seed = 0;
+    bool enabled = false;
+  };
 
  private:
   bp::object obj_;
   bp::object on_start_;
   bp::object on_start_of_day_;
   bp::object on_confirmation_;
+  bp::object on_confirmation_batch_;
+  ConfirmationBatch cm_batch_;
   bp::object on_end_of_day_;
   bp::object on_end_;
-  double latency_ = 0;  // in seconds
-  double trade_hit_ratio_ = 0.5;
-  std::ofstream of_;
+  Link order_link_;  // LATENCY
+  Link confirmation_link_;  // CONFIRMATION_LATENCY
+  Link md_link_;  // MD_LATENCY
+  double trade_hit_ratio_ = -1;  // < 0 for the queue position model
+  const std::string of_path_;
+  TradeWriter of_;  // TRADES_FORMAT=binary for the binary blocks
+  int shard_ = -1;  // -1 if not sharded
   bool skip_ = false;
   std::vector<std::pair<std::string, Simulator*>> simulators_;
   std::set<std::string> used_symbols_;
+  std::vector<bp::object> configs_;
+  bp::object config_;
   bp::object start_date_;
   bp::object end_date_;  // exclusive
+  Stats stats_;
+  std::string replay_dir_;  // REPLAY_JOURNAL
+  Replay replay_;
+  std::ofstream replay_of_;
 };
 
 }  // namespace opentrade
@@ -1,27 +1,175 @@
 #ifndef OPENTRADE_BAR_HANDLER_H_
 #define OPENTRADE_BAR_HANDLER_H_
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "async_trade_tick_hook.h"
+#include "indicator_cache.h"
 #include "indicator_handler.h"
 
 namespace opentrade {
 
 static const Indicator::IdType kBar = 0;
+static const Indicator::IdType kMultiBar = 3;
 
 struct Bar : public MarketData::Trade {
   time_t tm = 0;
 };
 
+// Ring of the latest closed bars with rolling statistics over them. Only
+// the handler thread pushes, on roll; readers go lock free through a
+// seqlock. Bars without trade are kept in the ring but not in the stats.
+class BarHistory {
+ public:
+  struct Stats {
+    size_t n = 0;  // bars with trade
+    double sum = 0;  // of close
+    double sum2 = 0;  // of close * close
+    double high = 0;
+    double low = 0;
+    double vwap = 0;
+    MarketData::Volume volume = 0;
+    double mean() const { return n ? sum / n : 0; }
+    double variance() const {
+      return n ? std::max(0., sum2 / n - mean() * mean()) : 0;
+    }
+  };
+
+  explicit BarHistory(size_t capacity = 120)
+      : bars_(capacity), highs_(capacity), lows_(capacity) {}
+
+  size_t capacity() const { return bars_.size(); }
+  size_t size() const {
+    return std::min<uint64_t>(n_.load(std::memory_order_acquire),
+                              bars_.size());
+  }
+
+  // i-th latest, 0 is the last closed bar
+  Bar Get(size_t i) const {
+    Bar out;
+    Read([&](uint64_t n) {
+      out = i < std::min<uint64_t>(n, bars_.size())
+                ? bars_[(n - 1 - i) % bars_.size()]
+                : Bar{};
+    });
+    return out;
+  }
+
+  Stats stats() const {
+    Stats out;
+    Read([&](uint64_t) { out = stats_; });
+    return out;
+  }
+
+  void Push(const Bar& b) {
+    auto n = n_.load(std::memory_order_relaxed);
+    auto cap = bars_.size();
+    auto seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    auto& slot = bars_[n % cap];
+    if (n >= cap) Remove(slot);
+    slot = b;
+    Add(b, n);
+    n_.store(n + 1, std::memory_order_release);
+    seq_.store(seq + 2, std::memory_order_release);
+  }
+
+ private:
+  template <typename Func>
+  void Read(Func func) const {
+    while (true) {
+      auto seq = seq_.load(std::memory_order_acquire);
+      if (seq & 1) continue;
+      func(n_.load(std::memory_order_relaxed));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq_.load(std::memory_order_relaxed) == seq) return;
+    }
+  }
+
+  // monotonic deque of bar sequence numbers over the ring window
+  struct MonoQueue {
+    explicit MonoQueue(size_t cap) : q(cap) {}
+    std::vector<uint64_t> q;
+    uint64_t head = 0;
+    uint64_t tail = 0;
+    // better(j) tells if bar j beats the one being pushed
+    template <typename Better>
+    void Push(uint64_t i, Better better) {
+      while (tail > head && !better(q[(tail - 1) % q.size()])) tail--;
+      q[tail++ % q.size()] = i;
+    }
+    void Expire(uint64_t oldest) {
+      while (tail > head && q[head % q.size()] < oldest) head++;
+    }
+    bool empty() const { return tail == head; }
+    uint64_t front() const { return q[head % q.size()]; }
+  };
+
+  const Bar& At(uint64_t i) const { return bars_[i % bars_.size()]; }
+
+  void Remove(const Bar& b) {
+    if (!b.close) return;
+    auto& s = stats_;
+    s.n--;
+    s.sum -= b.close;
+    s.sum2 -= b.close * b.close;
+    auto volume = s.volume - b.volume;
+    s.vwap = volume > 0 ? (s.vwap * s.volume - b.vwap * b.volume) / volume : 0;
+    s.volume = volume;
+  }
+
+  void Add(const Bar& b, uint64_t i) {
+    auto& s = stats_;
+    auto cap = bars_.size();
+    auto oldest = i + 1 >= cap ? i + 1 - cap : 0;
+    highs_.Expire(oldest);
+    lows_.Expire(oldest);
+    if (b.close) {
+      s.n++;
+      s.sum += b.close;
+      s.sum2 += b.close * b.close;
+      if (b.volume > 0) {
+        auto volume = s.volume + b.volume;
+        s.vwap = (s.vwap * s.volume + b.vwap * b.volume) / volume;
+        s.volume = volume;
+      }
+      highs_.Push(i, [this, &b](uint64_t j) { return At(j).high > b.high; });
+      lows_.Push(i, [this, &b](uint64_t j) { return At(j).low < b.low; });
+    }
+    s.high = highs_.empty() ? 0 : At(highs_.front()).high;
+    s.low = lows_.empty() ? 0 : At(lows_.front()).low;
+  }
+
+  std::vector<Bar> bars_;
+  MonoQueue highs_;
+  MonoQueue lows_;
+  Stats stats_;
+  std::atomic<uint64_t> n_ = 0;  // bars ever pushed
+  std::atomic<uint32_t> seq_ = 0;
+};
+
 template <int interval = 1, Indicator::IdType ind_id = kBar>
 struct BarIndicator : public Indicator {
   static const Indicator::IdType kId = ind_id;
   Bar current;
   Bar last;
+  BarHistory history;
+  // built once, the dict only refers to the members
   bp::object GetPyObject() const override {
-    bp::dict out;
-    out["last"] = bp::ptr(&last);
-    out["current"] = bp::ptr(&current);
-    out["interval"] = interval;
-    return out;
+    if (!py_) {
+      bp::dict out;
+      out["last"] = bp::ptr(&last);
+      out["current"] = bp::ptr(&current);
+      out["interval"] = interval;
+      out["history"] = bp::ptr(&history);
+      py_ = bp::handle<>(bp::borrowed(out.ptr()));
+    }
+    return bp::object(py_);
   }
 
   void Update(double px, double qty) {
@@ -30,17 +178,103 @@ struct BarIndicator : public Indicator {
   }
 
   void Roll(time_t tm) {
+    auto start = tm - 60 * interval;
+#ifdef BACKTEST
+    if (from_cache) {
+      auto& c = cached;
+      while (cached_pos < c.n && c.p[cached_pos].tm < start) ++cached_pos;
+      if (cached_pos < c.n && c.p[cached_pos].tm == start) {
+        last = c.p[cached_pos++];
+      } else {
+        last = Bar{};
+        last.tm = start;
+      }
+      history.Push(last);
+      return;
+    }
+#endif
     {
       Lock lock(m_);
       last = current;
       bzero(&current, sizeof(current));
     }
-    last.tm = tm - 60 * interval;
+    last.tm = start;
+    history.Push(last);
+#ifdef BACKTEST
+    if (record && last.close) record->push_back(last);
+#endif
   }
+
+#ifdef BACKTEST
+  // the closed bars with trade of IndicatorCache instead of the trades, in
+  // which case current stays empty, or recorded into it
+  bool from_cache = false;
+  IndicatorCache::Series<Bar> cached;
+  size_t cached_pos = 0;
+  std::vector<Bar>* record = nullptr;
+#endif
+
+ private:
+  mutable bp::handle<> py_;
+};
+
+// Bars spread over the algo runners, each runner rolls its own shard in
+// chunks and the listeners of a chunk are notified in one batch per
+// runner, so a minute boundary is not one sweep of every bar plus a
+// callback per listener on a single thread.
+template <typename Ind>
+class BarShards {
+ public:
+  // on the handler thread
+  void Add(Ind* bar) {
+    if (!shards_) {
+      n_ = std::max<size_t>(1, AlgoManager::Instance().num_runners());
+      shards_.reset(new Shard[n_]);
+    }
+    auto& s = shards_[next_++ % n_];
+    std::lock_guard<std::mutex> lock(s.m);
+    s.bars.push_back(bar);
+  }
+
+  template <typename Func>
+  void Roll(Indicator::IdType id, Func roll) {
+    for (auto i = 0u; i < n_; ++i) Roll(id, roll, i, 0);
+  }
+
+ private:
+  static inline const size_t kChunk = 256;
+
+  struct Shard {
+    std::mutex m;
+    std::vector<Ind*> bars;
+  };
+
+  template <typename Func>
+  void Roll(Indicator::IdType id, Func roll, size_t i, size_t begin) {
+    AlgoManager::Instance().Post(i, [=]() {
+      std::vector<Instrument*> listeners;
+      auto& s = shards_[i];
+      size_t end;
+      {
+        std::lock_guard<std::mutex> lock(s.m);
+        end = std::min(begin + kChunk, s.bars.size());
+        for (auto j = begin; j < end; ++j) {
+          roll(s.bars[j]);
+          s.bars[j]->Publish(&listeners);
+        }
+        if (end < s.bars.size()) Roll(id, roll, i, end);
+      }
+      Indicator::Notify(id, &listeners);
+    });
+  }
+
+  std::unique_ptr<Shard[]> shards_;
+  size_t n_ = 0;
+  size_t next_ = 0;
 };
 
 template <int interval = 1, Indicator::IdType ind_id = kBar>
-class BarHandler : public IndicatorHandler, public TradeTickHook {
+class BarHandler : public IndicatorHandler, public AsyncTradeTickHook {
  public:
   typedef BarIndicator<interval, ind_id> Ind;
   explicit BarHandler(const char* name = "bar") {
@@ -48,7 +282,12 @@ class BarHandler : public IndicatorHandler, public TradeTickHook {
     tm0_ = GetStartOfDayTime() * kMicroInSec;
   }
 
-  void OnStart() noexcept override { StartNext(); }
+  void OnStart() noexcept override {
+    auto now = NowInMicro();
+    auto n = kMicroInMin * interval;
+    auto wait = n - (now - tm0_) % n;
+    SetInterval([this]() { OnTimer(); }, wait / kMicroInSecF, 60 * interval);
+  }
 
   Indicator::IdType id() const override { return ind_id; }
 
@@ -56,41 +295,184 @@ class BarHandler : public IndicatorHandler, public TradeTickHook {
     Async([=]() {
       auto bar = const_cast<Ind*>(inst->Get<Ind>());
       if (!bar) {
-        inst->HookTradeTick(this);
         bar = new Ind{};
-        bars_.push_back(bar);
+        if (!FromCache(inst->sec(), bar)) inst->HookTradeTick(this);
+        bars_.Add(bar);
         const_cast<MarketData&>(inst->md()).Set(bar);
       }
       if (listen) bar->AddListener(inst);
     });
   }
 
-  void OnTrade(DataSrc::IdType src, Security::IdType id, const MarketData* md,
-               time_t tm, double px, double qty) noexcept override {
-    auto bar = const_cast<Ind*>(md->Get<Ind>());
+  void OnTick(const Tick& t) noexcept override {
+    auto bar = const_cast<Ind*>(t.md->Get<Ind>());
     if (!bar) return;
-    bar->Update(px, qty);
+    bar->Update(t.px, t.qty);
   }
 
-  void StartNext() {
-    auto now = NowInMicro();
+  void Post(std::function<void()> func) noexcept override { Async(func); }
+
+  void OnTimer() {
+    // the bar boundary this run is scheduled for
     auto n = kMicroInMin * interval;
-    auto wait = n - (now - tm0_) % n;
-    auto ind_tm = std::round((now + wait) / kMicroInSecF);
-    SetTimeout([this, ind_tm]() { OnTimer(ind_tm); }, wait / kMicroInSecF);
+    auto now = NowInMicro();
+    time_t tm = (tm0_ + (now - tm0_ + n / 2) / n * n) / kMicroInSec;
+    bars_.Roll(ind_id, [tm](Ind* bar) { bar->Roll(tm); });
+  }
+
+ private:
+  bool FromCache(const Security& sec, Ind* bar) {
+#ifdef BACKTEST
+    auto& cache = IndicatorCache::Instance();
+    if (!cache.enabled()) return false;
+    auto key = name() + "-" + std::to_string(interval) + "-v1";
+    bar->from_cache = cache.Get(key, sec.id, kTime, &bar->cached);
+    if (!bar->from_cache) bar->record = cache.Record<Bar>(key, sec.id, kTime);
+    return bar->from_cache;
+#else
+    return false;
+#endif
+  }
+
+  uint64_t tm0_ = 0;
+  BarShards<Ind> bars_;
+};
+
+// Bars of several intervals in minutes, each a multiple of the first one.
+// Trades only update the finest bar, coarser bars are merged from it when
+// it rolls.
+struct MultiBarIndicator : public Indicator {
+  static const Indicator::IdType kId = kMultiBar;
+  explicit MultiBarIndicator(const std::vector<int>& intervals)
+      : intervals_(intervals),
+        acc_(intervals.size()),
+        last_(intervals.size()) {}
+
+  const std::vector<int>& intervals() const { return intervals_; }
+
+  // the open and the last closed bar of intervals()[i]
+  Bar current(size_t i) const {
+    Lock lock(m_);
+    auto b = acc_[i];
+    Merge(current_, &b);
+    return b;
+  }
+  Bar last(size_t i) const {
+    Lock lock(m_);
+    return last_[i];
   }
 
-  void OnTimer(time_t tm) {
-    for (auto bar : bars_) {
-      bar->Roll(tm);
-      bar->Publish(ind_id);
+  bp::object GetPyObject() const override {
+    bp::dict out;
+    for (auto i = 0u; i < intervals_.size(); ++i) {
+      bp::dict d;
+      d["last"] = last(i);
+      d["current"] = current(i);
+      out[intervals_[i]] = d;
     }
-    StartNext();
+    return out;
+  }
+
+  void Update(double px, double qty) {
+    Lock lock(m_);
+    current_.Update(px, qty);
+  }
+
+  // tm is the end of the finest bar, minutes since start of day at tm
+  void Roll(time_t tm, int minutes) {
+    Lock lock(m_);
+    for (auto i = 0u; i < intervals_.size(); ++i) {
+      Merge(current_, &acc_[i]);
+      if (minutes % intervals_[i]) continue;
+      last_[i] = acc_[i];
+      last_[i].tm = tm - 60 * intervals_[i];
+      acc_[i] = Bar{};
+    }
+    current_ = Bar{};
+  }
+
+  static void Merge(const Bar& b, Bar* a) {
+    if (!b.close) return;  // no trade
+    if (!a->open) a->open = b.open;
+    if (b.high > a->high) a->high = b.high;
+    if (b.low < a->low || !a->low) a->low = b.low;
+    a->close = b.close;
+    a->qty = b.qty;
+    if (b.volume <= 0) return;
+    auto volume = a->volume + b.volume;
+    a->vwap = (a->vwap * a->volume + b.vwap * b.volume) / volume;
+    a->volume = volume;
+  }
+
+ private:
+  const std::vector<int> intervals_;
+  Bar current_;  // of the finest interval
+  std::vector<Bar> acc_;
+  std::vector<Bar> last_;
+};
+
+class MultiBarHandler : public IndicatorHandler, public AsyncTradeTickHook {
+ public:
+  typedef MultiBarIndicator Ind;
+  explicit MultiBarHandler(std::vector<int> intervals = {1, 5, 15, 60},
+                           const char* name = "multi_bar") {
+    set_name(name);
+    tm0_ = GetStartOfDayTime() * kMicroInSec;
+    std::sort(intervals.begin(), intervals.end());
+    for (auto i : intervals) {
+      if (i <= 0 || (!intervals_.empty() && i % intervals_[0])) {
+        LOG_ERROR(name << ": invalid interval " << i << ", ignored");
+        continue;
+      }
+      if (intervals_.empty() || i != intervals_.back()) intervals_.push_back(i);
+    }
+    if (intervals_.empty()) intervals_.push_back(1);
+  }
+
+  void OnStart() noexcept override {
+    auto now = NowInMicro();
+    auto n = kMicroInMin * intervals_[0];
+    auto wait = n - (now - tm0_) % n;
+    SetInterval([this]() { OnTimer(); }, wait / kMicroInSecF,
+                60 * intervals_[0]);
+  }
+
+  Indicator::IdType id() const override { return kMultiBar; }
+
+  void Subscribe(Instrument* inst, bool listen) noexcept override {
+    Async([=]() {
+      auto bar = const_cast<Ind*>(inst->Get<Ind>());
+      if (!bar) {
+        inst->HookTradeTick(this);
+        bar = new Ind(intervals_);
+        bars_.Add(bar);
+        const_cast<MarketData&>(inst->md()).Set(bar);
+      }
+      if (listen) bar->AddListener(inst);
+    });
+  }
+
+  void OnTick(const Tick& t) noexcept override {
+    auto bar = const_cast<Ind*>(t.md->Get<Ind>());
+    if (!bar) return;
+    bar->Update(t.px, t.qty);
+  }
+
+  void Post(std::function<void()> func) noexcept override { Async(func); }
+
+  void OnTimer() {
+    auto n = kMicroInMin * intervals_[0];
+    auto now = NowInMicro();
+    auto end = tm0_ + (now - tm0_ + n / 2) / n * n;
+    time_t tm = end / kMicroInSec;
+    int minutes = (end - tm0_) / kMicroInMin;
+    bars_.Roll(kMultiBar, [=](Ind* bar) { bar->Roll(tm, minutes); });
   }
 
  private:
   uint64_t tm0_ = 0;
-  std::vector<Ind*> bars_;
+  std::vector<int> intervals_;
+  BarShards<Ind> bars_;
 };
 
 }  // namespace opentrade
@@ -0,0 +1,156 @@
+#include "binary_order_entry.h"
+
+#include "logger.h"
+#include "socket.h"
+
+namespace opentrade {
+
+void BinaryOrderEntry::Start() noexcept {
+  stopped_ = false;
+  tp_.AddTask([this]() { Connect(); });
+}
+
+void BinaryOrderEntry::Stop() noexcept {
+  tp_.AddTask([this]() {
+    stopped_ = true;
+    Close("stopped");
+  });
+}
+
+void BinaryOrderEntry::Reconnect() noexcept {
+  tp_.AddTask([this]() {
+    if (fd_ >= 0) {
+      Close("reconnect");
+    } else {
+      Connect();
+    }
+  });
+}
+
+void BinaryOrderEntry::Connect() {
+  if (fd_ >= 0 || stopped_) return;
+  auto addr = config("address");
+  std::string host, port;
+  if (!SplitHostPort(addr, &host, &port)) {
+    LOG_ERROR(name() << ": invalid address " << addr);
+    return;
+  }
+  auto fd = TcpConnect(host, port);
+  if (fd < 0) {
+    auto interval = config<int>("reconnect_interval", 5);
+    LOG_ERROR(name() << ": failed to connect " << addr << ", retry in "
+                     << interval << " seconds");
+    tp_.AddTask([this]() { Connect(); },
+                boost::posix_time::seconds(interval));
+    return;
+  }
+  LOG_INFO(name() << ": connected to " << addr);
+  socket_ = std::make_unique<boost::asio::posix::stream_descriptor>(
+      tp_.service(), fd);
+  socket_->non_blocking(true);
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    fd_ = fd;
+  }
+  connected_ = -1;
+  OnConnected();
+  WaitRead();
+}
+
+void BinaryOrderEntry::Close(const char* reason) {
+  if (fd_ < 0) return;
+  LOG_INFO(name() << ": disconnected, " << reason);
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    boost::system::error_code ec;
+    socket_->close(ec);
+    fd_ = -1;
+    out_.clear();
+    write_pending_ = false;
+  }
+  in_.clear();
+  connected_ = 0;
+  OnDisconnected();
+  if (stopped_) return;
+  tp_.AddTask([this]() { Connect(); },
+              boost::posix_time::seconds(config<int>("reconnect_interval", 5)));
+}
+
+void BinaryOrderEntry::WaitRead() {
+  auto func = [this](const boost::system::error_code& ec, auto...) {
+    if (!ec) Read();
+  };
+#if BOOST_VERSION < 106600
+  socket_->async_read_some(boost::asio::null_buffers(), func);
+#else
+  socket_->async_wait(boost::asio::posix::descriptor_base::wait_read, func);
+#endif
+}
+
+void BinaryOrderEntry::WaitWrite() {
+  if (!socket_) return;
+  auto func = [this](const boost::system::error_code& ec, auto...) {
+    if (ec) return;
+    std::lock_guard<std::mutex> lock(m_);
+    write_pending_ = false;
+    Flush();
+  };
+#if BOOST_VERSION < 106600
+  socket_->async_write_some(boost::asio::null_buffers(), func);
+#else
+  socket_->async_wait(boost::asio::posix::descriptor_base::wait_write, func);
+#endif
+}
+
+void BinaryOrderEntry::Read() {
+  static const size_t kChunk = 1 << 16;
+  auto fd = socket_->native_handle();
+  for (;;) {
+    auto n = in_.size();
+    in_.resize(n + kChunk);
+    auto rc = ::recv(fd, &in_[n], kChunk, MSG_DONTWAIT);
+    in_.resize(n + std::max<ssize_t>(rc, 0));
+    if (rc > 0) continue;
+    if (rc < 0 && errno == EINTR) continue;
+    if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    Close(rc ? "read failed" : "closed by peer");
+    return;
+  }
+  if (!in_.empty()) in_.erase(0, OnData(in_.data(), in_.size()));
+  if (fd_ >= 0) WaitRead();
+}
+
+bool BinaryOrderEntry::Flush() {
+  if (fd_ < 0) {
+    out_.clear();
+    return false;
+  }
+  if (write_pending_) return true;
+  size_t off = 0;
+  while (off < out_.size()) {
+    auto rc = ::send(fd_, out_.data() + off, out_.size() - off,
+                     MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (rc > 0) {
+      off += rc;
+      continue;
+    }
+    if (rc < 0 && errno == EINTR) continue;
+    if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      write_pending_ = true;
+      tp_.AddTask([this]() { WaitWrite(); });
+      break;
+    }
+    tp_.AddTask([this]() { Close("write failed"); });
+    out_.clear();
+    return false;
+  }
+  out_.erase(0, off);
+  if (out_.size() > kMaxOut) {
+    LOG_ERROR(name() << ": send buffer overflow");
+    tp_.AddTask([this]() { Close("send buffer overflow"); });
+    return false;
+  }
+  return true;
+}
+
+}  // namespace opentrade
@@ -0,0 +1,95 @@
+#ifndef OPENTRADE_BINARY_ORDER_ENTRY_H_
+#define OPENTRADE_BINARY_ORDER_ENTRY_H_
+
+#include <boost/asio.hpp>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+
+#include "exchange_connectivity.h"
+
+namespace opentrade {
+
+// Base of the order entry adapters of binary exchange protocols, e.g. OUCH
+// or a venue's native one, where building every order through QuickFIX as
+// FixAdapter does costs too much. A message is a packed struct of the
+// protocol, copied from a template of its constant fields kept by the
+// subclass right into the send buffer, filled there and written in line by
+// the calling thread, e.g. the algo runner in Place, with a non-blocking
+// send; only what the socket does not take is left to tp_ for when it gets
+// writable. Receiving runs on tp_, OnData maps the responses onto HandleNew,
+// HandleFill, HandleCanceled and the others.
+// Configs:
+//   address=host:port
+//   reconnect_interval=<seconds>, 5 by default
+class BinaryOrderEntry : public ExchangeConnectivityAdapter {
+ public:
+  void Start() noexcept override;
+  void Stop() noexcept override;
+  void Reconnect() noexcept override;
+
+ protected:
+  // a message built in place in the send buffer from tmpl, holding the
+  // session until sent or dropped, e.g.
+  //   auto m = Begin(new_order_);
+  //   m->id = ord.id;
+  //   if (!m.Send()) return "Not connected";
+  template <typename T>
+  class Msg {
+   public:
+    Msg(BinaryOrderEntry* s, const T& tmpl)
+        : s_(s), lock_(s->m_), offset_(s->out_.size()) {
+      static_assert(std::is_trivially_copyable_v<T>);
+      s->out_.append(reinterpret_cast<const char*>(&tmpl), sizeof(T));
+    }
+    ~Msg() {
+      if (!sent_) s_->out_.resize(offset_);
+    }
+    T* operator->() { return reinterpret_cast<T*>(&s_->out_[offset_]); }
+    // false if not connected or the socket is broken
+    bool Send() {
+      sent_ = true;
+      return s_->Flush();
+    }
+
+   private:
+    BinaryOrderEntry* s_;
+    std::lock_guard<std::mutex> lock_;
+    size_t offset_;
+    bool sent_ = false;
+  };
+  template <typename T>
+  Msg<T> Begin(const T& tmpl) {
+    return {this, tmpl};
+  }
+
+  // connected, e.g. to log on, connected_ is -1 until the subclass sets it
+  virtual void OnConnected() noexcept = 0;
+  // returns the bytes of the whole messages taken of [p, p + n)
+  virtual size_t OnData(const char* p, size_t n) noexcept = 0;
+  virtual void OnDisconnected() noexcept {}
+
+ private:
+  // on tp_
+  void Connect();
+  void Close(const char* reason);
+  void WaitRead();
+  void WaitWrite();
+  void Read();
+  // under m_, false if not connected
+  bool Flush();
+
+  static inline const size_t kMaxOut = 4 << 20;
+  std::unique_ptr<boost::asio::posix::stream_descriptor> socket_;
+  std::mutex m_;
+  int fd_ = -1;  // under m_
+  std::string out_;  // under m_
+  bool write_pending_ = false;  // under m_, waiting for writable
+  std::string in_;
+  bool stopped_ = false;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_BINARY_ORDER_ENTRY_H_
@@ -0,0 +1,121 @@
+#ifndef OPENTRADE_CLOCK_H_
+#define OPENTRADE_CLOCK_H_
+
+#include <sys/time.h>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace opentrade {
+
+static const auto kMicroInSec = 1000000lu;
+static const double kMicroInSecF = kMicroInSec;
+static const auto kMicroInMin = kMicroInSec * 60;
+
+// simulated wall time in microseconds, the system clock is used while it is
+// 0, backtest advances it with the ticks and timers
+inline uint64_t kTime;
+
+// wall seconds of the thread while a CachedTime lives on it
+inline thread_local time_t kCachedTime;
+
+inline time_t GetTime() {
+  if (kTime) return kTime / kMicroInSec;
+  if (kCachedTime) return kCachedTime;
+  return std::time(nullptr);
+}
+
+// GetTime cached on the thread over a loop of short iterations, e.g. an
+// algo runner's dispatch batch, so that its callbacks do not read the clock
+class CachedTime {
+ public:
+  CachedTime() : prev_(kCachedTime) { Refresh(); }
+  ~CachedTime() { kCachedTime = prev_; }
+  void Refresh() {
+    kCachedTime = 0;
+    kCachedTime = GetTime();
+  }
+
+ private:
+  const time_t prev_;
+};
+
+inline int GetTimeOfDay(struct timeval* out) {
+  if (kTime) {
+    out->tv_sec = kTime / kMicroInSec;
+    out->tv_usec = kTime % kMicroInSec;
+    return 0;
+  }
+  return gettimeofday(out, nullptr);
+}
+
+static inline int64_t NowUtcInMicro() {
+  struct timeval now;
+  auto rc = GetTimeOfDay(&now);
+  if (rc)
+    return GetTime() * kMicroInSec;
+  else
+    return now.tv_sec * kMicroInSec + now.tv_usec;
+}
+
+// CLOCK_REALTIME_COARSE, a few ms resolution without touching the hardware
+// clock, for rate limiting on the hot path
+static inline int64_t NowCoarseInMicro() {
+  if (kTime) return kTime;
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+  return ts.tv_sec * kMicroInSec + ts.tv_nsec / 1000;
+}
+
+static inline int64_t NowInMicro(int tm_gmtoff = 0) {
+  return NowUtcInMicro() + tm_gmtoff * kMicroInSec;
+}
+
+// monotonic nanoseconds for latency stamps, counted with the TSC where there
+// is one, scaled by a 2 ms calibration against steady_clock on first use
+class FineClock {
+ public:
+  static uint64_t Now() {
+#if defined(__x86_64__) || defined(__i386__)
+    auto& c = Calibrate();
+    return c.ns0 + static_cast<uint64_t>((__rdtsc() - c.tsc0) * c.ns_per_tick);
+#else
+    return SteadyNow();
+#endif
+  }
+
+  static uint64_t SteadyNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+ private:
+#if defined(__x86_64__) || defined(__i386__)
+  struct Calibration {
+    uint64_t tsc0;
+    uint64_t ns0;
+    double ns_per_tick;
+  };
+
+  static const Calibration& Calibrate() {
+    static const Calibration kCalibration = []() {
+      auto ns0 = SteadyNow();
+      auto tsc0 = __rdtsc();
+      auto ns1 = ns0;
+      while (ns1 - ns0 < 2000000) ns1 = SteadyNow();
+      auto tsc1 = __rdtsc();
+      return Calibration{tsc0, ns0, static_cast<double>(ns1 - ns0) /
+                                        static_cast<double>(tsc1 - tsc0)};
+    }();
+    return kCalibration;
+  }
+#endif
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_CLOCK_H_
@@ -1,18 +1,59 @@
 #include "commission.h"
 
+#include <algorithm>
+#include <cstdlib>
+
 #include "order.h"
 
 namespace opentrade {
 double CommissionAdapter::Compute(const Confirmation& cm) const noexcept {
-  auto it = table_.find(cm.order->sec->exchange->id);
-  if (it == table_.end()) it = table_.find(0);
-  if (it == table_.end()) return 0;
-  auto& f = cm.order->IsBuy() ? it->second.buy : it->second.sell;
-  if (f.per_share > 0) return f.per_share * cm.last_shares;
-  if (f.per_value > 0) return f.per_value * cm.last_shares * cm.last_px;
+  auto ord = cm.order;
+  auto& f = ord->IsBuy() ? Get(ord->sec->exchange->id).buy
+                         : Get(ord->sec->exchange->id).sell;
+  auto qty = cm.last_shares;
+  if (f.per_share > 0) {
+    if (tiers_.empty()) return f.per_share * qty;
+    // a bust takes its shares back, the caller negates the cost
+    auto delta = cm.exec_trans_type == kTransCancel ? -qty : qty;
+    auto& v = volumes_[ord->broker_account->id];
+    auto v0 = v.load(std::memory_order_relaxed);
+    while (!v.compare_exchange_weak(v0, v0 + delta, std::memory_order_relaxed))
+      ;
+    return GetTieredCost(f.per_share, std::min(v0, v0 + delta),
+                         std::max(v0, v0 + delta));
+  }
+  if (f.per_value > 0) return f.per_value * qty * cm.last_px;
   return 0;
 }
 
+double CommissionAdapter::GetTieredCost(double per_share, double a,
+                                        double b) const {
+  auto cost = 0.;
+  for (auto& tier : tiers_) {
+    if (a >= b) break;
+    if (a < tier.first) {
+      auto end = std::min(b, tier.first);
+      cost += (end - a) * per_share;
+      a = end;
+    }
+    per_share = tier.second;
+  }
+  if (a < b) cost += (b - a) * per_share;
+  return cost;
+}
+
+void CommissionAdapter::Compile() {
+  std::sort(tiers_.begin(), tiers_.end());
+  default_ = FindInMap(table_, 0);
+  dense_.clear();
+  for (auto& pair : table_) {
+    if (pair.first < 0) continue;
+    if (pair.first >= static_cast<int64_t>(dense_.size()))
+      dense_.resize(pair.first + 1, default_);
+    dense_[pair.first] = pair.second;
+  }
+}
+
 std::string CommissionAdapter::SetTable(const std::string& tbl_str) {
   for (auto& str : Split(tbl_str, " \t|")) {
     char name[str.size()];
@@ -21,6 +62,16 @@ std::string CommissionAdapter::SetTable(const std::string& tbl_str) {
       return "Invalid commission format, expect "
              "<name>=<value>[<space><tab>|]...";
     }
+    if (strstr(name, "tier_") == name) {
+      char* end;
+      auto shares = strtod(name + 5, &end);
+      if (end == name + 5 || *end || shares <= 0) {
+        return "Invalid commission tier " + std::string(name) +
+               ", expect tier_<shares>=<per_share>";
+      }
+      tiers_.emplace_back(shares, value);
+      continue;
+    }
     bool is_buy = strstr(name, "buy_") == name;
     bool is_sell = is_buy ? false : strstr(name, "sell_") == name;
     auto p = name + (is_buy ? 4 : (is_sell ? 5 : 0));
@@ -59,6 +110,7 @@ std::string CommissionAdapter::SetTable(const std::string& tbl_str) {
         cm.buy.per_share = cm.sell.per_share = value;
     }
   }
+  Compile();
   return {};
 }
 }  // namespace opentrade
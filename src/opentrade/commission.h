@@ -1,6 +1,11 @@
 #ifndef OPENTRADE_COMMISSION_H_
 #define OPENTRADE_COMMISSION_H_
 
+#include <tbb/concurrent_unordered_map.h>
+#include <atomic>
+#include <utility>
+#include <vector>
+
 #include "adapter.h"
 #include "common.h"
 
@@ -17,16 +22,37 @@ struct Commission {
 
 struct Confirmation;
 
+// Table compiled into an array indexed by exchange id, the exchanges not in
+// it filled with the default entry (exchange id 0). With tiers, the per share
+// fee of a fill is split over the tiers the broker account's shares of the
+// session cross, e.g. "per_share=0.005 tier_300000=0.003 tier_3000000=0.002"
 struct CommissionAdapter : public Adapter {
   typedef std::unordered_map<int64_t, Commission> Table;  // <exchange_id, ...>
+  typedef std::vector<std::pair<double, double>> Tiers;   // <shares, per_share>
   CommissionAdapter() {}
-  explicit CommissionAdapter(Table&& other) : table_(std::move(other)) {}
+  explicit CommissionAdapter(Table&& other) : table_(std::move(other)) {
+    Compile();
+  }
   void Start() noexcept override {}
   std::string SetTable(const std::string& tbl_str);
   virtual double Compute(const Confirmation& cm) const noexcept;
+  const Commission& Get(int64_t exchange_id) const {
+    return exchange_id >= 0 && exchange_id < static_cast<int64_t>(dense_.size())
+               ? dense_[exchange_id]
+               : default_;
+  }
+  // cost of the shares from volume a to b at per_share until the first tier
+  double GetTieredCost(double per_share, double a, double b) const;
 
  private:
+  void Compile();
+
   Table table_;
+  Tiers tiers_;
+  std::vector<Commission> dense_;
+  Commission default_;
+  // shares of the session per broker account, only with tiers
+  mutable tbb::concurrent_unordered_map<int64_t, std::atomic<double>> volumes_;
 };
 
 struct CommissionManager : public AdapterManager<CommissionAdapter, kCmPrefix>,
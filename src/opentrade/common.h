@@ -4,11 +4,11 @@
 #include <boost/atomic.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/make_shared.hpp>
-#include <boost/smart_ptr/atomic_shared_ptr.hpp>
 #include <string>
 #include <unordered_map>
 #include "3rd/json.hpp"
 
+#include "rcu.h"
 #include "task_pool.h"
 #include "utility.h"
 
@@ -29,7 +29,8 @@ struct ParamsBase {
     return FindInMap(params(), k);
   }
 
-  StrMapPtr params() const { return params_.load(boost::memory_order_relaxed); }
+  RcuSnapshot<StrMap> params() const { return params_.load(); }
+  uint64_t params_version() const { return params_.version(); }
 
   std::string SetParams(const std::string& params) {
     if (params.empty()) return {};
@@ -60,14 +61,14 @@ struct ParamsBase {
         tmp.emplace((const char*)k, (const char*)v);
       }
     }
-    params_.store(StrMapPtr(new StrMap(std::move(tmp))),
-                  boost::memory_order_release);
+    params_.store(StrMapPtr(new StrMap(std::move(tmp))));
     return {};
   }
 
   std::string GetParamsString() const {
     std::string out;
-    for (auto& pair : *params()) {
+    auto params = this->params();
+    for (auto& pair : *params) {
       if (!out.empty()) out += "\n";
       out += pair.first + "=" + pair.second;
     }
@@ -75,7 +76,7 @@ struct ParamsBase {
   }
 
  private:
-  boost::atomic_shared_ptr<const StrMap> params_ = StrMapPtr(new StrMap);
+  RcuPtr<StrMap> params_{StrMapPtr(new StrMap)};
 };
 
 template <typename V>
@@ -103,9 +104,9 @@ class Singleton {
   static inline V* kInstance = new V{};
 };
 
-inline TaskPool kTimerTaskPool;
-inline TaskPool kWriteTaskPool;
-inline TaskPool kDatabaseTaskPool;
+inline TaskPool kTimerTaskPool{1, "timer"};
+inline TaskPool kWriteTaskPool{1, "write"};
+inline TaskPool kDatabaseTaskPool{1, "database"};
 }  // namespace opentrade
 
 #endif  // OPENTRADE_COMMON_H_
@@ -5,20 +5,34 @@
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string_view>
 #include <thread>
+#include <unordered_set>
 
 #include "algo.h"
 #include "consolidation.h"
 #include "database.h"
 #include "exchange_connectivity.h"
 #include "indicator_handler.h"
+#include "latency.h"
 #include "logger.h"
 #include "market_data.h"
+#include "memory.h"
 #include "opentick.h"
+#include "param_schema.h"
 #include "position.h"
 #include "security.h"
 #include "server.h"
+#include "sharding.h"
 #include "stop_book.h"
+#include "tca.h"
+#include "tick_recorder.h"
 
 namespace fs = boost::filesystem;
 
@@ -27,13 +41,18 @@ namespace opentrade {
 static time_t kStartTime = GetTime();
 static thread_local boost::uuids::random_generator kUuidGen;
 static tbb::concurrent_unordered_map<std::string, const User*> kTokens;
-static TaskPool kTaskPool(3);
+static TaskPool kTaskPool(3, "connection");
+static TaskPool kBulkPool(2, "bulk");
 enum {
   kListen = 0,
   kStopListenEveryOne = 1,
   kStopListenNonAdmin = 2,
 };
 static int kStopListen = kListen;
+// market data push cadences in milliseconds
+static const uint32_t kStatusInterval = 1000;
+static const uint32_t kMinInterval = 50;
+static const uint32_t kMaxInterval = 60000;
 
 std::string sha1(const std::string& str) {
   boost::uuids::detail::sha1 s;
@@ -199,11 +218,43 @@ static inline ParamDef::Value ParseParamValue(const json& j) {
   return ParseParamScalar<ParamDef::Value>(j);
 }
 
-static inline decltype(auto) ParseParams(const json& params) {
+// with the schema of a TypedAlgo, the values go into its struct directly,
+// only the SecurityTuples are kept in the map too, for AlgoManager to check
+// and subscribe
+static inline decltype(auto) ParseParams(const json& params,
+                                         const ParamSchema* schema = nullptr) {
   auto m = std::make_shared<Algo::ParamMap>();
+  if (!schema) {
+    for (auto& it : params.items()) {
+      (*m.get())[it.key()] = ParseParamValue(it.value());
+    }
+    return m;
+  }
+  auto p = schema->New();
   for (auto& it : params.items()) {
-    (*m.get())[it.key()] = ParseParamValue(it.value());
+    auto& v = it.value();
+    auto f = schema->Find(it.key());
+    std::string err;
+    if (v.is_object()) {
+      auto s = std::get<SecurityTuple>(ParseParamScalar<ParamDef::Value>(v));
+      (*m.get())[it.key()] = s;
+      if (f) err = schema->Set(p.get(), *f, s);
+    } else if (!f || v.is_null()) {
+      continue;
+    } else if (v.is_number_float()) {
+      err = schema->Set(p.get(), *f, v.get<double>());
+    } else if (v.is_number_integer()) {
+      err = schema->Set(p.get(), *f, v.get<int64_t>());
+    } else if (v.is_boolean()) {
+      err = schema->Set(p.get(), *f, v.get<bool>());
+    } else if (v.is_string()) {
+      err = schema->Set(p.get(), *f, v.get<std::string>());
+    } else {
+      err = "invalid type of " + it.key();
+    }
+    if (!err.empty()) throw std::runtime_error(err);
   }
+  m->typed = p;
   return m;
 }
 
@@ -211,56 +262,111 @@ static std::atomic<int> kConnCounter = 0;
 static std::atomic<int> kActiveConn = 0;
 
 Connection::~Connection() {
+  for (auto& pair : subs_) {
+    auto sec = SecurityManager::Instance().Get(pair.first.first);
+    if (sec && pair.second.n > 0)
+      MarketDataManager::Instance().Release(*sec, pair.first.second);
+  }
   LOG_DEBUG('#' << id_ << ": #" << id_
                 << " Connection destructed, active=" << --kActiveConn);
 }
 
 Connection::Connection(Transport::Ptr transport,
                        std::shared_ptr<boost::asio::io_service> service)
-    : transport_(transport), strand_(*service), timer_(*service) {
+    : transport_(transport),
+      strand_(*service),
+      bulk_strand_(kBulkPool.service()),
+      admin_strand_(Database::query_service()),
+      service_(service),
+      md_interval_(kStatusInterval) {
   id_ = ++kConnCounter;
   LOG_DEBUG('#' << id_ << ": " << GetAddress()
                 << ", Connection constructed, stateless="
                 << transport_->stateless << ", active=" << ++kActiveConn);
 }
 
-void Connection::PublishMarketStatus() {
-  auto& ecs = ExchangeConnectivityManager::Instance().adapters();
-  for (auto& it : ecs) {
-    auto& name = it.first;
-    auto v = it.second->connected();
-    auto it2 = ecs_.find(name);
-    if (it2 == ecs_.end() || it2->second != v) {
-      ecs_[name] = v;
-      Send(json{"market", "exchange", name, v});
+// The connected status of the exchange and market data adapters for all the
+// connections, recomputed once per NetworkAdapter::ConnectedState change,
+// each connection sending the changes after the seq it has seen.
+class MarketStatus {
+ public:
+  // the messages after *seq, all the statuses if too far behind
+  void Get(uint32_t* seq, std::vector<std::string>* out) {
+    auto v = NetworkAdapter::ConnectedState::version();
+    if (v != version_.load(std::memory_order_acquire)) Update(v);
+    if (*seq == seq_.load(std::memory_order_acquire)) return;
+    std::lock_guard<std::mutex> lock(m_);
+    if (!*seq || log_.empty() || log_.front().first > *seq + 1) {
+      for (auto& pair : states_) out->push_back(pair.second.msg);
+    } else {
+      for (auto& e : log_) {
+        if (e.first > *seq) out->push_back(e.second);
+      }
     }
+    *seq = seq_;
   }
-  auto& mds = MarketDataManager::Instance().adapters();
-  for (auto& it : mds) {
-    auto& name = it.first;
-    auto v = it.second->connected();
-    auto it2 = mds_.find(name);
-    if (it2 == mds_.end() || it2->second != v) {
-      mds_[name] = v;
-      Send(json{"market", "data", name, v});
-    }
+
+ private:
+  static inline const size_t kMaxLog = 256;
+
+  void Update(uint32_t v) {
+    std::lock_guard<std::mutex> lock(m_);
+    if (v == version_) return;
+    // bumps during the scan get another one
+    version_.store(v, std::memory_order_release);
+    for (auto& it : ExchangeConnectivityManager::Instance().adapters())
+      Set("exchange", it.first, it.second->connected());
+    for (auto& it : MarketDataManager::Instance().adapters())
+      Set("data", it.first, it.second->connected());
+    while (log_.size() > kMaxLog) log_.pop_front();
   }
+
+  void Set(const char* type, const std::string& name, bool v) {
+    auto it = states_.find(std::make_pair(type, name));
+    if (it != states_.end() && it->second.v == v) return;
+    auto msg = json{"market", type, name, v}.dump();
+    states_[std::make_pair(type, name)] = State{v, msg};
+    log_.emplace_back(seq_ + 1, msg);
+    seq_.store(seq_ + 1, std::memory_order_release);
+  }
+
+  struct State {
+    bool v;
+    std::string msg;
+  };
+  std::mutex m_;
+  std::atomic<uint32_t> version_ = -1;
+  std::atomic<uint32_t> seq_ = 0;
+  std::map<std::pair<std::string, std::string>, State> states_;
+  std::deque<std::pair<uint32_t, std::string>> log_;
+};
+
+static MarketStatus kMarketStatus;
+
+void Connection::PublishMarketStatus() {
+  std::vector<std::string> msgs;
+  kMarketStatus.Get(&status_seq_, &msgs);
+  for (auto& msg : msgs) Send(msg);
 }
 
 static inline void GetMarketData(
     const MarketData& md, MarketData* md0,
     const std::pair<Security::IdType, DataSrc::IdType>& sec_src, json* j) {
   if (md.tm == md0->tm) return;
+  auto changes = md.Changes(*md0);
   json j3;
   j3["t"] = md.tm;
-  if (md.trade.open != md0->trade.open) j3["o"] = md.trade.open;
-  if (md.trade.high != md0->trade.high) j3["h"] = md.trade.high;
-  if (md.trade.low != md0->trade.low) j3["l"] = md.trade.low;
-  if (md.trade.close != md0->trade.close) j3["c"] = md.trade.close;
-  if (md.trade.qty != md0->trade.qty) j3["q"] = md.trade.qty;
-  if (md.trade.volume != md0->trade.volume) j3["v"] = md.trade.volume;
-  if (md.trade.vwap != md0->trade.vwap) j3["V"] = md.trade.vwap;
-  for (auto i = 0u; i < 5u; ++i) {
+  if (changes & MarketData::kTradeChanged) {
+    if (md.trade.open != md0->trade.open) j3["o"] = md.trade.open;
+    if (md.trade.high != md0->trade.high) j3["h"] = md.trade.high;
+    if (md.trade.low != md0->trade.low) j3["l"] = md.trade.low;
+    if (md.trade.close != md0->trade.close) j3["c"] = md.trade.close;
+    if (md.trade.qty != md0->trade.qty) j3["q"] = md.trade.qty;
+    if (md.trade.volume != md0->trade.volume) j3["v"] = md.trade.volume;
+    if (md.trade.vwap != md0->trade.vwap) j3["V"] = md.trade.vwap;
+  }
+  auto n = changes & MarketData::kDepthChanged ? MarketData::kDepthSize : 1u;
+  for (auto i = changes & MarketData::kQuoteChanged ? 0u : 1u; i < n; ++i) {
     char name[3] = "a";
     auto& d0 = md0->depth[i];
     auto& d = md.depth[i];
@@ -292,60 +398,190 @@ static inline void GetMarketData(
   *md0 = md;
 }
 
-void Connection::PublishMarketdata() {
-  if (closed_) return;
-  auto self = shared_from_this();
-  timer_.expires_from_now(boost::posix_time::milliseconds(1000));
-  timer_.async_wait(strand_.wrap([self](auto) {
-    self->PublishMarketStatus();
-    json j = {"md"};
-    for (auto& pair : self->subs_) {
-      auto sec_src = pair.first;
-      auto md =
-          MarketDataManager::Instance().GetLite(sec_src.first, sec_src.second);
-      GetMarketData(md, &pair.second.first, sec_src, &j);
-    }
-    if (j.size() > 1) {
-      self->Send(j);
-    }
-    self->PublishMarketdata();
-    if (!self->sub_pnl_) return;
-    for (auto& pair : PositionManager::Instance().sub_positions_) {
-      auto sub_account_id = pair.first.first;
-      if (!self->user_->is_admin && !self->user_->GetSubAccount(sub_account_id))
-        continue;
-      auto sec_id = pair.first.second;
-      auto& pnl0 = self->single_pnls_[pair.first];
-      auto pos = pair.second;
-      auto c_changed = pos.commission != pnl0.commission;
-      auto r_changed = pos.realized_pnl != pnl0.realized;
-      if (pos.unrealized_pnl != pnl0.unrealized || c_changed || r_changed) {
-        json j = {
-            "pnl",
-            sub_account_id,
-            sec_id,
-            pos.unrealized_pnl,
-        };
-        if (c_changed || r_changed) j.push_back(pos.commission);
-        if (r_changed) j.push_back(pos.realized_pnl);
-        pnl0.unrealized = pos.unrealized_pnl;
-        pnl0.commission = pos.commission;
-        pnl0.realized = pos.realized_pnl;
-        self->Send(j);
+// Deltas shared by all connections, each (security, source) is diffed and
+// serialized at most once per tick of a cadence however many connections
+// watch it, so every cadence conflates on its own. A connection which
+// missed a version gets the full frame.
+class MarketDataDeltas {
+ public:
+  typedef std::pair<Security::IdType, DataSrc::IdType> Key;
+
+  // appends ",<frame>" to out if key changed since *ver was seen
+  void Get(const Key& key, uint32_t interval, uint64_t tick, uint32_t* ver,
+           std::string* out) {
+    std::lock_guard<std::mutex> lock(m_);
+    auto& e = entries_[std::make_pair(key, interval)];
+    if (e.tick != tick) {
+      e.tick = tick;
+      auto md = MarketDataManager::Instance()
+                    .GetLite(key.first, key.second)
+                    .Snapshot();
+      json j;
+      GetMarketData(md, &e.md, key, &j);
+      if (!j.empty()) {
+        e.ver++;
+        e.delta = j[0].dump();
+        e.full.clear();
       }
     }
-    for (auto& pair : PositionManager::Instance().pnls_) {
-      auto id = pair.first;
-      if (!self->user_->is_admin && !self->user_->GetSubAccount(id)) continue;
-      auto& pnl0 = self->pnls_[id];
-      auto pnl = pair.second;
-      if (pnl.unrealized != pnl0.unrealized || pnl.realized != pnl0.realized) {
-        self->Send(json{"Pnl", id, GetTime(), pnl.unrealized, pnl.commission,
-                        pnl.realized});
-        pnl0 = pnl;
+    if (*ver == e.ver) return;
+    out->push_back(',');
+    if (*ver + 1 == e.ver) {
+      *out += e.delta;
+    } else {
+      if (e.full.empty()) {
+        MarketData md0;
+        json j;
+        GetMarketData(e.md, &md0, key, &j);
+        e.full = j[0].dump();
+      }
+      *out += e.full;
+    }
+    *ver = e.ver;
+  }
+
+ private:
+  struct Entry {
+    MarketData md;
+    uint32_t ver = 0;
+    uint64_t tick = 0;
+    std::string delta;  // from ver - 1 to ver
+    std::string full;
+  };
+  std::mutex m_;
+  boost::unordered_map<std::pair<Key, uint32_t>, Entry> entries_;
+};
+
+static MarketDataDeltas kMdDeltas;
+
+// One timer per cadence instead of one per connection, every tick posts
+// Connection::Publish to the strands of the connections on it.
+class PublishScheduler {
+ public:
+  void Add(uint32_t interval, Connection::Ptr conn,
+           boost::asio::io_service* service) {
+    std::lock_guard<std::mutex> lock(m_);
+    auto& c = cadences_[interval];
+    c.conns.push_back(conn);
+    if (c.timer) return;
+    c.timer.reset(new boost::asio::deadline_timer(*service));
+    c.timer->expires_from_now(boost::posix_time::milliseconds(interval));
+    Wait(interval, &c);
+  }
+
+  void Remove(uint32_t interval, const Connection* conn) {
+    std::lock_guard<std::mutex> lock(m_);
+    auto it = cadences_.find(interval);
+    if (it == cadences_.end()) return;
+    auto& v = it->second.conns;
+    v.erase(std::remove_if(v.begin(), v.end(),
+                           [conn](auto& w) {
+                             auto p = w.lock();
+                             return !p || p.get() == conn;
+                           }),
+            v.end());
+  }
+
+ private:
+  struct Cadence {
+    std::unique_ptr<boost::asio::deadline_timer> timer;
+    std::vector<std::weak_ptr<Connection>> conns;
+  };
+
+  void Wait(uint32_t interval, Cadence* c) {
+    c->timer->async_wait([this, interval](auto e) {
+      if (e) return;
+      std::vector<Connection::Ptr> conns;
+      uint64_t tick;
+      {
+        std::lock_guard<std::mutex> lock(m_);
+        tick = ++tick_;
+        auto it = cadences_.find(interval);
+        auto& c = it->second;
+        for (auto& w : c.conns) {
+          if (auto p = w.lock()) conns.push_back(p);
+        }
+        if (conns.empty()) {
+          cadences_.erase(it);
+        } else {
+          // keep the cadence, unless we fell behind
+          auto next = c.timer->expires_at() +
+                      boost::posix_time::milliseconds(interval);
+          if (next < boost::asio::deadline_timer::traits_type::now())
+            c.timer->expires_from_now(
+                boost::posix_time::milliseconds(interval));
+          else
+            c.timer->expires_at(next);
+          Wait(interval, &c);
+        }
+      }
+      for (auto& conn : conns) {
+        conn->strand_.post(
+            [conn, interval, tick]() { conn->Publish(interval, tick); });
       }
+    });
+  }
+
+  std::mutex m_;
+  std::map<uint32_t, Cadence> cadences_;
+  uint64_t tick_ = 0;
+};
+
+static PublishScheduler kPublishScheduler;
+
+void Connection::Schedule(uint32_t interval) {
+  if (transport_->stateless || !cadences_.insert(interval).second) return;
+  kPublishScheduler.Add(interval, shared_from_this(), service_.get());
+}
+
+bool Connection::Publish(uint32_t interval, uint64_t tick) {
+  if (closed_) {
+    kPublishScheduler.Remove(interval, this);
+    return false;
+  }
+  auto status = interval == kStatusInterval;
+  if (status) PublishMarketStatus();
+  std::string msg = "[\"md\"";
+  auto n = msg.size();
+  auto any = false;
+  for (auto& pair : subs_) {
+    if (pair.second.interval != interval) continue;
+    any = true;
+    kMdDeltas.Get(pair.first, interval, tick, &pair.second.ver, &msg);
+  }
+  if (msg.size() > n) {
+    msg.push_back(']');
+    Send(msg);
+  }
+  if (status) {
+    PublishPnl();
+    return true;
+  }
+  if (any) return true;
+  cadences_.erase(interval);
+  kPublishScheduler.Remove(interval, this);
+  return false;
+}
+
+void Connection::PublishPnl() {
+  if (!sub_pnl_) return;
+  std::vector<PositionManager::PnlChange> changes;
+  auto user = user_;
+  PositionManager::Instance().GetPnlChanges(
+      &pnl_seqs_,
+      [user](auto id) { return user->is_admin || user->GetSubAccount(id); },
+      &changes);
+  auto tm = GetTime();
+  for (auto& c : changes) {
+    auto& pnl = c.pnl;
+    if (c.sec_id) {
+      Send(json{"pnl", c.sub_account_id, c.sec_id, pnl.unrealized,
+                pnl.commission, pnl.realized});
+    } else {
+      Send(json{"Pnl", c.sub_account_id, tm, pnl.unrealized, pnl.commission,
+                pnl.realized});
     }
-  }));
+  }
 }
 
 template <typename T>
@@ -389,9 +625,62 @@ static inline void Jsonify(const ParamDef::Value& v, json* j) {
   }
 }
 
+// the action of ["action", ...] without parsing the message
+static std::string_view GetAction(const std::string& msg) {
+  auto p = msg.c_str();
+  while (isspace(*p)) p++;
+  if (*p++ != '[') return {};
+  while (isspace(*p)) p++;
+  if (*p++ != '"') return {};
+  auto end = strchr(p, '"');
+  if (!end) return {};
+  return std::string_view(p, end - p);
+}
+
+// may take long, so they go to the bulk lane rather than hold the io
+// threads which serve orders of all connections
+static bool IsBulk(std::string_view action) {
+  return action == "securities" || action == "security_params" ||
+         action == "securities_page" || action == "bod" ||
+         action == "position" || action == "positions" ||
+         action == "trades" || action == "target" || action == "admin" ||
+         action == "batch" || action == "tca";
+}
+
+// ["cancel", id]
+static bool ParseCancel(const std::string& msg, int64_t* id) {
+  auto p = msg.c_str();
+  while (isspace(*p)) p++;
+  if (*p++ != '[') return false;
+  while (isspace(*p)) p++;
+  static const char kCancel[] = "\"cancel\"";
+  if (strncmp(p, kCancel, sizeof(kCancel) - 1)) return false;
+  p += sizeof(kCancel) - 1;
+  while (isspace(*p)) p++;
+  if (*p++ != ',') return false;
+  char* end;
+  errno = 0;
+  *id = strtoll(p, &end, 10);
+  if (end == p || errno) return false;
+  p = end;
+  while (isspace(*p)) p++;
+  if (*p++ != ']') return false;
+  while (isspace(*p)) p++;
+  return !*p;
+}
+
 void Connection::OnMessageAsync(const std::string& msg) {
   if (closed_) return;
   auto self = shared_from_this();
+  auto action = GetAction(msg);
+  if (IsBulk(action)) {
+    // hop through strand_ to stay behind the requests before it, e.g. login
+    auto& lane = action == "admin" ? admin_strand_ : bulk_strand_;
+    strand_.post([self, msg, &lane]() {
+      lane.post([self, msg]() { self->OnMessageSync(msg); });
+    });
+    return;
+  }
   strand_.post([self, msg]() { self->OnMessageSync(msg); });
 }
 
@@ -441,6 +730,11 @@ void Connection::HandleMessageSync(const std::string& msg,
       Send(h);
       return;
     }
+    int64_t id;
+    if (user_ && ParseCancel(msg, &id)) {
+      OnCancel(id, msg);
+      return;
+    }
     auto j = json::parse(msg);
     auto action = Get<std::string>(j[0]);
     if (action.empty()) {
@@ -501,6 +795,8 @@ void Connection::HandleMessageSync(const std::string& msg,
       OnSecurities(j, action);
     } else if (action == "security_params") {
       OnSecurities(j, action);
+    } else if (action == "securities_page") {
+      OnSecuritiesPage(j);
     } else if (action == "rates") {
       Send(SecurityManager::Instance().rates());
     } else if (action == "admin") {
@@ -515,12 +811,24 @@ void Connection::HandleMessageSync(const std::string& msg,
         for (auto& pair : AccountManager::Instance().sub_accounts_)
           out.push_back(pair.second->name);
       } else {
-        for (auto& pair : *user_->sub_accounts())
-          out.push_back(pair.second->name);
+        auto accs = user_->sub_accounts();
+        for (auto& pair : *accs) out.push_back(pair.second->name);
       }
       Send(out);
     } else if (action == "trades") {
       OnTrades(j);
+    } else if (action == "tca") {
+      // ["tca", [algo id, sub account id, security id, side, qty, avg px,
+      //   arrival px, arrival bps, vwap bps, participation, markout bps]...]
+      json out = json{action};
+      for (auto& [key, s] : TcaManager::Instance().Get()) {
+        auto [algo_id, acc, sec] = key;
+        if (!user_->is_admin && !user_->GetSubAccount(acc)) continue;
+        out.push_back(json{algo_id, acc, sec, s.buy ? "buy" : "sell", s.qty,
+                           s.avg_px(), s.arrival_px, s.arrival_bps(),
+                           s.vwap_bps(), s.participation(), s.markout_bps()});
+      }
+      Send(out);
     } else if (action == "target") {
       if (j.size() == 1) {
         for (auto& pair : AccountManager::Instance().sub_accounts_) {
@@ -566,7 +874,44 @@ void Connection::HandleMessageSync(const std::string& msg,
         auto n = GetNum(j[1]);
         if (n >= 0) offset = n;
       }
-      ExchangeConnectivityManager::Instance().ClearUnformed(offset);
+      ExchangeConnectivityAdapter* adapter = nullptr;
+      if (j.size() > 2) {
+        auto name = Get<std::string>(j[2]);
+        adapter = ExchangeConnectivityManager::Instance().GetAdapter(name);
+        if (!adapter) throw std::runtime_error("unknown adapter: " + name);
+      }
+      ExchangeConnectivityManager::Instance().ClearUnformed(offset, adapter);
+    } else if (action == "mass_cancel") {
+      // ["mass_cancel", {"sub_account": name, "broker_account": name,
+      //   "security": id, "algo": id}]
+      if (!user_->is_admin) throw std::runtime_error("admin required");
+      MassCancelFilter f;
+      auto& am = AccountManager::Instance();
+      if (j.size() > 1 && j[1].is_object()) {
+        auto& v = j[1];
+        if (v.count("sub_account")) {
+          f.sub_account = am.GetSubAccount(Get<std::string>(v["sub_account"]));
+          if (!f.sub_account) throw std::runtime_error("unknown sub_account");
+        }
+        if (v.count("broker_account")) {
+          auto name = Get<std::string>(v["broker_account"]);
+          f.broker_account = am.GetBrokerAccount(name);
+          if (!f.broker_account)
+            throw std::runtime_error("unknown broker_account");
+        }
+        if (v.count("security")) {
+          f.sec = SecurityManager::Instance().Get(GetNum(v["security"]));
+          if (!f.sec) throw std::runtime_error("unknown security");
+        }
+        if (v.count("algo")) f.algo_id = GetNum(v["algo"]);
+      }
+      auto n = ExchangeConnectivityManager::Instance().MassCancel(f);
+      Send(json{"mass_cancel", n});
+    } else if (action == "md_rebalance") {
+      if (!user_->is_admin) throw std::runtime_error("admin required");
+      auto n = MarketDataManager::Instance().Rebalance();
+      json j = {"md_rebalance", n};
+      Send(j.dump());
     } else if (action == "stop_listen") {
       if (!user_->is_admin) throw std::runtime_error("admin required");
       if (j.size() > 1) {
@@ -613,6 +958,7 @@ void Connection::HandleMessageSync(const std::string& msg,
         for (auto& it : ecs) it.second->tp().Stop(false);
         kDatabaseTaskPool.Stop(true);
         kWriteTaskPool.Stop(true);
+        TickRecorder::Instance().Stop();
         self->Send(json{"shutdown", "done"});
         Server::CloseConnection(0);
         // let self destructed and flush message out
@@ -623,18 +969,15 @@ void Connection::HandleMessageSync(const std::string& msg,
         });
       });
     } else if (action == "cancel") {
-      auto id = Get<int64_t>(j[1]);
-      auto ord = GlobalOrderBook::Instance().Get(id);
-      if (!ord) {
-        json j = {"error", "cancel", "invalid order id: " + std::to_string(id)};
-        LOG_DEBUG('#' << id_ << ": " << j << '\n' << msg);
-        Send(j);
-        return;
-      }
-      ExchangeConnectivityManager::Instance().Cancel(*ord);
+      OnCancel(Get<int64_t>(j[1]), msg);
+    } else if (action == "replace") {
+      CheckStopListen();
+      OnReplace(j, msg);
     } else if (action == "order") {
       CheckStopListen();
       OnOrder(j, msg);
+    } else if (action == "batch") {
+      OnBatch(j);
     } else if (action == "algo") {
       OnAlgo(j, msg);
     } else if (action == "pnl") {
@@ -686,9 +1029,17 @@ void Connection::HandleMessageSync(const std::string& msg,
         auto& s = subs_[sec_src];
         auto sec = SecurityManager::Instance().Get(sec_src.first);
         if (sec) {
-          auto md = MarketDataManager::Instance().Get(*sec, sec_src.second);
-          GetMarketData(md, &s.first, sec_src, &jout);
-          s.second += 1;
+          auto md = MarketDataManager::Instance()
+                        .Get(*sec, sec_src.second)
+                        .Snapshot();
+          MarketData md0;
+          GetMarketData(md, &md0, sec_src, &jout);
+          // the next tick sends the shared full frame
+          s.ver = 0;
+          if (!s.n) MarketDataManager::Instance().AddRef(*sec, sec_src.second);
+          s.n += 1;
+          if (!s.interval) s.interval = md_interval_;
+          Schedule(s.interval);
         }
       }
       if (jout.size() > 1) Send(jout);
@@ -696,8 +1047,27 @@ void Connection::HandleMessageSync(const std::string& msg,
       for (auto i = 1u; i < j.size(); ++i) {
         auto it = subs_.find(GetSecSrc(j[i]));
         if (it == subs_.end()) return;
-        it->second.second -= 1;
-        if (it->second.second <= 0) subs_.erase(it);
+        it->second.n -= 1;
+        if (it->second.n <= 0) {
+          auto sec = SecurityManager::Instance().Get(it->first.first);
+          auto src = it->first.second;
+          if (sec) MarketDataManager::Instance().Release(*sec, src);
+          subs_.erase(it);
+        }
+      }
+    } else if (action == "md_rate") {
+      // ["md_rate", ms] for the subscriptions made afterwards,
+      // ["md_rate", ms, security...] for the given subscriptions
+      auto interval = Get<uint32_t>(j[1]);
+      interval = std::min(std::max(interval, kMinInterval), kMaxInterval);
+      interval -= interval % kMinInterval;
+      if (j.size() == 2) md_interval_ = interval;
+      for (auto i = 2u; i < j.size(); ++i) {
+        auto it = subs_.find(GetSecSrc(j[i]));
+        if (it == subs_.end()) continue;
+        it->second.interval = interval;
+        it->second.ver = 0;
+        Schedule(interval);
       }
     } else if (action == "algoFile") {
       auto fn = Get<std::string>(j[1]);
@@ -792,13 +1162,37 @@ void Connection::HandleMessageSync(const std::string& msg,
   }
 }
 
-void Connection::Send(Confirmation::Ptr cm) {
-  if (closed_) return;
-  if (!user_) return;
-  if (!user_->is_admin && !user_->GetSubAccount(cm->order->sub_account->id))
+void Connection::OnCancel(int64_t id, const std::string& msg) {
+  auto ord = GlobalOrderBook::Instance().Get(id);
+  if (!ord) {
+    json j = {"error", "cancel", "invalid order id: " + std::to_string(id)};
+    LOG_DEBUG('#' << id_ << ": " << j << '\n' << msg);
+    Send(j);
     return;
+  }
+  ExchangeConnectivityManager::Instance().Cancel(*ord);
+}
+
+// ["replace", id, qty, price]
+void Connection::OnReplace(const json& j, const std::string& msg) {
+  auto id = Get<int64_t>(j[1]);
+  auto ord = GlobalOrderBook::Instance().Get(id);
+  if (!ord) {
+    json err = {"error", "replace", "invalid order id: " + std::to_string(id)};
+    LOG_DEBUG('#' << id_ << ": " << err << '\n' << msg);
+    Send(err);
+    return;
+  }
+  if (!ExchangeConnectivityManager::Instance().Replace(*ord, GetNum(j[2]),
+                                                       GetNum(j[3]))) {
+    Send(json{"error", "replace", "not replaceable: " + std::to_string(id)});
+  }
+}
+
+void Connection::Send(std::shared_ptr<const std::string> msg) {
+  if (closed_) return;
   auto self = shared_from_this();
-  strand_.post([self, cm]() { self->Send(*cm.get(), false); });
+  strand_.post([self, msg]() { self->Send(*msg); });
 }
 
 void Connection::Send(const std::string& msg, const SubAccount* acc) {
@@ -820,13 +1214,41 @@ void Connection::Send(const Algo& algo, const std::string& status,
   });
 }
 
+void Connection::Send(std::shared_ptr<const Server::AlgoMessages> msgs) {
+  if (closed_) return;
+  if (!user_) return;
+  auto id = user_->id;
+  auto self = shared_from_this();
+  strand_.post([self, msgs, id]() {
+    for (auto& pair : *msgs) {
+      if (pair.first == id) self->Send(pair.second);
+    }
+  });
+}
+
 void Connection::Send(Algo::IdType id, time_t tm, const std::string& token,
                       const std::string& name, const std::string& status,
                       const std::string& body, uint32_t seq, bool offline) {
-  Send(json{offline ? "Algo" : "algo", seq, id, tm, token, name, status, body});
+  Send(Serialize(id, tm, token, name, status, body, seq, offline));
+}
+
+std::string Connection::Serialize(Algo::IdType id, time_t tm,
+                                  const std::string& token,
+                                  const std::string& name,
+                                  const std::string& status,
+                                  const std::string& body, uint32_t seq,
+                                  bool offline) {
+  return json{offline ? "Algo" : "algo", seq, id, tm, token, name, status,
+              body}
+      .dump();
 }
 
 void Connection::Send(const Confirmation& cm, bool offline) {
+  auto msg = Serialize(cm, offline);
+  if (!msg.empty()) Send(msg);
+}
+
+std::string Connection::Serialize(const Confirmation& cm, bool offline) {
   assert(cm.order);
   auto cmd = offline ? "Order" : "order";
   json j = {
@@ -852,10 +1274,21 @@ void Connection::Send(const Confirmation& cm, bool offline) {
       j.push_back(GetTif(cm.order->tif));
       break;
 
+    case kUnconfirmedReplace:
+      j.push_back("unconfirmed_replace");
+      j.push_back(cm.order->orig_id);
+      j.push_back(cm.order->qty);
+      j.push_back(cm.order->price);
+      break;
+
     case kPendingNew:
       status = "pending";
     case kPendingCancel:
       if (!status) status = "pending_cancel";
+    case kPendingReplace:
+      if (!status) status = "pending_replace";
+    case kReplaced:
+      if (!status) status = "replaced";
     case kNew:
       if (!status) status = "new";
     case kSuspended:
@@ -871,8 +1304,8 @@ void Connection::Send(const Confirmation& cm, bool offline) {
     case kCanceled:
       if (!status) status = "cancelled";
       j.push_back(status);
-      if (cm.exec_type == kNew) {
-        j.push_back(cm.order_id);
+      if (cm.exec_type == kNew || cm.exec_type == kReplaced) {
+        j.push_back(cm.order_id.str());
       }
       if (!cm.text.empty()) {
         j.push_back(cm.text);
@@ -886,13 +1319,13 @@ void Connection::Send(const Confirmation& cm, bool offline) {
       j.push_back(status);
       j.push_back(cm.last_shares);
       j.push_back(cm.last_px);
-      j.push_back(cm.exec_id);
+      j.push_back(cm.exec_id.str());
       if (cm.exec_trans_type == kTransNew)
         j.push_back("new");
       else if (cm.exec_trans_type == kTransCancel)
         j.push_back("cancel");
       else
-        return;
+        return {};
       break;
 
     case kRejected:
@@ -920,10 +1353,10 @@ void Connection::Send(const Confirmation& cm, bool offline) {
       break;
 
     default:
-      return;
+      return {};
       break;
   }
-  Send(j);
+  return j.dump();
 }
 
 static inline auto ValidateAcc(const User* user, json j) {
@@ -950,6 +1383,21 @@ void Connection::OnTrades(const json& j) {
   if (end_time && end_time - tm > kSecondsOneDay * 31)
     throw std::runtime_error("at most 30 days");
   sent_ = true;
+  PositionHistory::Snapshots rows;
+  if (PositionManager::Instance().history().Get(acc->id, sec, tm, end_time,
+                                                &rows)) {
+    json out = {"trades"};
+    auto& am = AccountManager::Instance();
+    for (auto& s : rows) {
+      auto broker_account = am.GetBrokerAccount(s.broker_account_id);
+      auto broker_name = broker_account ? broker_account->name : "";
+      out.push_back(json{s.id, s.sec, s.tm, s.qty, s.avg_px, s.realized_pnl,
+                         s.commission, broker_name, s.info});
+    }
+    Send(out);
+    return;
+  }
+  // older than the history, from the database
   kTaskPool.AddTask([self, acc, sec, tm, end_time]() {
     struct tm tm_info;
     gmtime_r(&tm, &tm_info);
@@ -1035,33 +1483,32 @@ void Connection::OnTrades(const json& j) {
   });
 }
 
-template <typename A, typename B>
-json DumpPositions(const A& acc, const B& positions) {
-  json out = {"positions"};
-  for (auto& pair : positions) {
-    if (pair.first.first != acc.id) continue;
-    auto& p = pair.second;
-    out.push_back(
-        json({pair.first.second, p.qty, p.avg_px, p.unrealized_pnl,
-              p.commission, p.realized_pnl, p.total_bought_qty,
-              p.total_sold_qty, p.total_outstanding_buy_qty,
-              p.total_outstanding_sell_qty, p.total_outstanding_sell_qty}));
-  }
-  return out;
-}
-
+// ["positions", acc, broker], or ["positions", acc, broker, version] for
+// only the ones changed after the version of a previous reply,
+// ["position changes", acc, version, <row>...], version 0 for all
 void Connection::OnPositions(const json& j) {
   bool broker = j.size() > 2 && Get<bool>(j[2]);
+  auto changes = j.size() > 3;
+  auto since = changes ? Get<int64_t>(j[3]) : 0;
+  auto& mngr = PositionManager::Instance();
+  std::string rows;
+  uint64_t version;
   if (broker) {
     if (!user_->is_admin) throw std::runtime_error("admin required");
     auto acc =
         AccountManager::Instance().GetBrokerAccount(Get<std::string>(j[1]));
     if (!acc) throw std::runtime_error("invalid broker account name");
-    Send(DumpPositions(*acc, PositionManager::Instance().broker_positions()));
+    version = mngr.GetPositionRows(*acc, std::max<int64_t>(since, 0), &rows);
   } else {
     auto acc = ValidateAcc(user_, j[1]);
-    Send(DumpPositions(*acc, PositionManager::Instance().sub_positions()));
+    version = mngr.GetPositionRows(*acc, std::max<int64_t>(since, 0), &rows);
   }
+  if (!changes) {
+    Send("[\"positions\"" + rows + ']');
+    return;
+  }
+  Send("[\"position changes\"," + j[1].dump() + ',' +
+       std::to_string(version) + rows + ']');
 }
 
 void Connection::OnPosition(const json& j) {
@@ -1149,7 +1596,10 @@ void Connection::OnAlgo(const json& j, const std::string& msg) {
     AlgoManager::Instance().Stop(sec_id, acc->id);
   } else if (action == "modify") {
     CheckStopListen();
-    auto params = ParseParams(j[3]);
+    auto algo = j[2].is_string()
+                    ? AlgoManager::Instance().Get(Get<std::string>(j[2]))
+                    : AlgoManager::Instance().Get(Get<int64_t>(j[2]));
+    auto params = ParseParams(j[3], algo ? algo->GetParamSchema() : nullptr);
     if (j[2].is_string()) {
       AlgoManager::Instance().Modify(Get<std::string>(j[2]), params);
       return;
@@ -1173,19 +1623,9 @@ void Connection::OnAlgo(const json& j, const std::string& msg) {
     try {
       Algo::ParamMapPtr params;
       if (action == "new") {
-        params = ParseParams(j[4]);
-        for (auto& pair : *params) {
-          if (auto pval = std::get_if<SecurityTuple>(&pair.second)) {
-            auto acc = pval->acc;
-            if (!user_->GetSubAccount(acc->id)) {
-              throw std::runtime_error("No permission to trade with account: " +
-                                       std::string(acc->name));
-            }
-            // in case receive [exch, symbol] sec, convert to sec_id before
-            // publish to gui
-            const_cast<json&>(j)[4]["Security"]["sec"] = pval->sec->id;
-          }
-        }
+        auto adapter = AlgoManager::Instance().GetAdapter(algo_name);
+        params = ParseAlgoParams(&const_cast<json&>(j)[4],
+                                 adapter ? adapter->GetParamSchema() : nullptr);
       } else if (token.size()) {
         test_algo_tokens_.insert(token);
       }
@@ -1200,11 +1640,107 @@ void Connection::OnAlgo(const json& j, const std::string& msg) {
       LOG_DEBUG('#' << id_ << ": " << err.what() << '\n' << msg);
       Send(json{"error", "algo", "invalid params", err.what()});
     }
+  } else if (action == "basket") {
+    OnAlgoBasket(j);
   } else {
     Send(json{"error", "algo", "invalid action: " + action});
   }
 }
 
+Algo::ParamMapPtr Connection::ParseAlgoParams(json* j,
+                                              const ParamSchema* schema) {
+  auto params = ParseParams(*j, schema);
+  for (auto& pair : *params) {
+    if (auto pval = std::get_if<SecurityTuple>(&pair.second)) {
+      auto acc = pval->acc;
+      if (!user_->GetSubAccount(acc->id)) {
+        throw std::runtime_error("No permission to trade with account: " +
+                                 std::string(acc->name));
+      }
+      // in case receive [exch, symbol] sec, convert to sec_id before
+      // publish to gui
+      (*j)["Security"]["sec"] = pval->sec->id;
+    }
+  }
+  return params;
+}
+
+// ["algo", "basket", name, [[token, params], ...]], answered with one
+// ["algo_basket", name, number spawned, [[index, token, error], ...]]
+void Connection::OnAlgoBasket(const json& j) {
+  CheckStopListen();
+  auto algo_name = Get<std::string>(j[2]);
+  auto adapter = AlgoManager::Instance().GetAdapter(algo_name);
+  if (!adapter) throw std::runtime_error("unknown algo name: " + algo_name);
+  auto schema = adapter->GetParamSchema();
+  auto& items = j[3];
+  if (!items.is_array()) throw std::runtime_error("expect array of algos");
+  std::vector<AlgoManager::SpawnRequest> reqs;
+  std::vector<size_t> indices;
+  json errors = json::array();
+  std::unordered_set<std::string> tokens;
+  for (auto i = 0u; i < items.size(); ++i) {
+    std::string token;
+    try {
+      auto item = items[i];
+      token = Get<std::string>(item[0]);
+      if (AlgoManager::Instance().Get(token) || !tokens.insert(token).second)
+        throw std::runtime_error("duplicate token: " + token);
+      AlgoManager::SpawnRequest req;
+      req.params = ParseAlgoParams(&item[1], schema);
+      req.params_raw = item[1].dump();
+      req.token = token;
+      reqs.push_back(std::move(req));
+      indices.push_back(i);
+    } catch (const std::exception& err) {
+      errors.push_back(json{i, token, err.what()});
+    }
+  }
+  auto algos = AlgoManager::Instance().SpawnBatch(algo_name, *user_, reqs);
+  auto n = 0u;
+  for (auto i = 0u; i < algos.size(); ++i) {
+    if (algos[i])
+      n++;
+    else
+      errors.push_back(json{indices[i], reqs[i].token, "failed to spawn"});
+  }
+  LOG_DEBUG('#' << id_ << ": " << n << " of " << items.size() << ' '
+                << algo_name << " spawned in basket");
+  Send(json{"algo_basket", algo_name, n, errors});
+}
+
+// ["batch", request...] with requests like ["order", ...], ["algo", ...]
+// and ["cancel", id], the session is validated once for all of them and
+// the replies of each request are streamed back as they are done
+void Connection::OnBatch(const json& j) {
+  transport_->BeginStream();
+  auto checked = false;
+  for (auto i = 1u; i < j.size(); ++i) {
+    auto& req = j[i];
+    std::string action;
+    try {
+      action = Get<std::string>(req[0]);
+      if (action == "order") {
+        if (!checked) {
+          CheckStopListen();
+          checked = true;
+        }
+        OnOrder(req, req.dump());
+      } else if (action == "algo") {
+        OnAlgo(req, req.dump());
+      } else if (action == "cancel") {
+        OnCancel(Get<int64_t>(req[1]), req.dump());
+      } else {
+        throw std::runtime_error("not allowed in batch");
+      }
+    } catch (std::exception& e) {
+      Send(json{"error", action, e.what(), "batch", i - 1});
+    }
+  }
+  transport_->EndStream();
+  sent_ = true;  // the stream was the response, even if empty
+}
+
 void Connection::OnOrder(const json& j, const std::string& msg) {
   auto sub_account = Get<std::string>(j[2]);
   auto acc = AccountManager::Instance().GetSubAccount(sub_account);
@@ -1271,20 +1807,9 @@ void Connection::OnOrder(const json& j, const std::string& msg) {
   Send(json{"order", "done"});
 }
 
-void Connection::HandleOneSecurity(const Security& s, json* out,
-                                   bool request_params) {
-  if (request_params) {
-    assert(transport_->stateless);
-    auto params = s.params();
-    if (!params || params->empty()) return;
-    json j;
-    for (auto& pair : *params) j[pair.first] = pair.second;
-    j["id"] = s.id;
-    out->push_back(j);
-    return;
-  }
-  if (user_->is_admin) {
-    json j = {
+static json SecurityJson(const Security& s, bool admin) {
+  if (admin) {
+    return {
         "security",
         s.id,
         s.symbol,
@@ -1307,20 +1832,73 @@ void Connection::HandleOneSecurity(const Security& s, json* out,
         s.sedol,
         s.isin,
     };
-    if (transport_->stateless)
-      out->push_back(j);
-    else
-      Send(j);
-  } else {
-    json j = {
-        "security", s.id,         s.symbol,   s.exchange->name, s.type,
-        s.lot_size, s.multiplier, s.currency, s.rate,
-    };
-    if (transport_->stateless)
-      out->push_back(j);
-    else
-      Send(j);
   }
+  return {
+      "security", s.id,         s.symbol,   s.exchange->name, s.type,
+      s.lot_size, s.multiplier, s.currency, s.rate,
+  };
+}
+
+// Pre-serialized "security" messages of an exchange (0 for all), for admin
+// or not, rebuilt on the first request after SecurityManager reloads.
+class SecurityDumps {
+ public:
+  struct Dump {
+    uint32_t version;
+    std::string etag;
+    std::vector<std::string> msgs;  // sorted by security id
+  };
+  typedef std::shared_ptr<const Dump> Ptr;
+
+  Ptr Get(const Exchange* exch, bool admin) {
+    auto& sm = SecurityManager::Instance();
+    auto version = sm.version();
+    std::lock_guard<std::mutex> lock(m_);
+    auto& d = dumps_[std::make_pair(exch ? exch->id : 0, admin)];
+    if (d && d->version == version) return d;
+    std::vector<const Security*> secs;
+    if (exch) {
+      for (auto& pair : exch->security_of_name) secs.push_back(pair.second);
+    } else {
+      for (auto& pair : sm.securities()) secs.push_back(pair.second);
+    }
+    std::sort(secs.begin(), secs.end(),
+              [](auto a, auto b) { return a->id < b->id; });
+    auto tmp = std::make_shared<Dump>();
+    tmp->version = version;
+    tmp->etag = std::string(sm.check_sum()) + "." + std::to_string(version) +
+                (admin ? ".1" : ".0");
+    tmp->msgs.reserve(secs.size());
+    for (auto s : secs) tmp->msgs.push_back(SecurityJson(*s, admin).dump());
+    d = tmp;
+    return d;
+  }
+
+ private:
+  std::mutex m_;
+  std::map<std::pair<Exchange::IdType, bool>, Ptr> dumps_;
+};
+
+static SecurityDumps kSecurityDumps;
+static const size_t kSecurityPageSize = 1000;
+
+void Connection::HandleOneSecurity(const Security& s, json* out,
+                                   bool request_params) {
+  if (request_params) {
+    assert(transport_->stateless);
+    auto params = s.params();
+    if (!params || params->empty()) return;
+    json j;
+    for (auto& pair : *params) j[pair.first] = pair.second;
+    j["id"] = s.id;
+    out->push_back(j);
+    return;
+  }
+  auto j = SecurityJson(s, user_->is_admin);
+  if (transport_->stateless)
+    out->push_back(j);
+  else
+    Send(j);
 }
 
 void Connection::OnSecurities(const json& j, const std::string& action) {
@@ -1332,6 +1910,23 @@ void Connection::OnSecurities(const json& j, const std::string& action) {
     if (!exch)
       throw std::runtime_error("unknown exchange " + Get<std::string>(j[1]));
   }
+  if (!request_params && j.size() <= 2) {
+    auto dump = kSecurityDumps.Get(exch, user_->is_admin);
+    if (transport_->stateless) {
+      auto out = json{action}.dump();
+      out.pop_back();
+      for (auto& msg : dump->msgs) {
+        out.push_back(',');
+        out += msg;
+      }
+      out.push_back(']');
+      Send(out);
+      return;
+    }
+    for (auto& msg : dump->msgs) Send(msg);
+    Send(json{action, "complete"});
+    return;
+  }
   json out = {action};
   if (j.size() > 2) {
     for (auto k = 2u; k < j.size(); ++k) {
@@ -1356,6 +1951,41 @@ void Connection::OnSecurities(const json& j, const std::string& action) {
   Send(out);
 }
 
+// ["securities_page", exchange or "", page, etag], replies
+// ["securities_page", etag, "not_modified"] if etag is still current, else
+// ["securities_page", etag, page, pages, security...]
+void Connection::OnSecuritiesPage(const json& j) {
+  const Exchange* exch = nullptr;
+  auto name = j.size() > 1 ? Get<std::string>(j[1]) : "";
+  if (!name.empty()) {
+    exch = SecurityManager::Instance().GetExchange(name);
+    if (!exch) throw std::runtime_error("unknown exchange " + name);
+  }
+  auto page = j.size() > 2 ? Get<int64_t>(j[2]) : 0;
+  auto dump = kSecurityDumps.Get(exch, user_->is_admin);
+  json head = {"securities_page", dump->etag};
+  if (j.size() > 3 && Get<std::string>(j[3]) == dump->etag) {
+    head.push_back("not_modified");
+    Send(head);
+    return;
+  }
+  auto n = dump->msgs.size();
+  int64_t pages = (n + kSecurityPageSize - 1) / kSecurityPageSize;
+  if (page < 0 || (page >= pages && page))
+    throw std::runtime_error("invalid page " + std::to_string(page));
+  head.push_back(page);
+  head.push_back(pages);
+  auto out = head.dump();
+  out.pop_back();
+  auto end = std::min(n, (page + 1) * kSecurityPageSize);
+  for (auto i = page * kSecurityPageSize; i < end; ++i) {
+    out.push_back(',');
+    out += dump->msgs[i];
+  }
+  out.push_back(']');
+  Send(out);
+}
+
 bool Connection::Disable(const json& j, AccountBase* acc) {
   if (!acc) {
     Send(json{"error", "", "unknown account id"});
@@ -1422,10 +2052,16 @@ void Connection::OnLogin(const std::string& action, const json& j) {
        {"isAdmin", user->is_admin},
        {"securitiesCheckSum", SecurityManager::Instance().check_sum()}},
   };
+  auto& shards = ShardManager::Instance();
+  if (shards.enabled()) {
+    // the node of sub account id is shardNodes[id % shardNodes.length]
+    out[2]["shard"] = shards.shard();
+    out[2]["shardNodes"] = shards.nodes();
+  }
   Send(out);
   if (!user_ && !transport_->stateless) {
     user_ = user;
-    PublishMarketdata();
+    Schedule(kStatusInterval);
     if (user->is_admin) {
       for (auto& pair : AccountManager::Instance().users_) {
         auto tmp = pair.second->sub_accounts();
@@ -1518,6 +2154,10 @@ void Connection::OnAdmin(const json& j) {
     if (action == "reload") {
       SecurityManager::Instance().LoadFromDatabase();
       Server::Trigger(json{"securities"}.dump());
+    } else if (action == "reload changed") {
+      auto changed = SecurityManager::Instance().LoadChanged();
+      if (!changed.empty()) Server::Trigger(json{"securities"}.dump());
+      Send(json{"admin", name, action, changed.size()});
     }
   } else if (!strcasecmp(name.c_str(), "sub accounts of user")) {
     OnAdminSubAccountOfUser(j, name, action);
@@ -1525,6 +2165,38 @@ void Connection::OnAdmin(const json& j) {
     OnAdminBrokerAccountOfSubAccount(j, name, action);
   } else if (!strcasecmp(name.c_str(), "stop book")) {
     OnAdminStopBook(j, name, action);
+  } else if (!strcasecmp(name.c_str(), "stop book groups")) {
+    OnAdminStopBookGroups(j, name, action);
+  } else if (!strcasecmp(name.c_str(), "algo runners")) {
+    auto& mngr = AlgoManager::Instance();
+    json out;
+    for (auto i = 0u; i < mngr.num_runners(); ++i) {
+      auto& r = mngr.runner(i);
+      out.push_back(json{i, r.algos(), r.load(), r.pending(), r.dispatched(),
+                         r.coalesced(), r.busy() / 1000});
+    }
+    Send(json{"admin", name, action, out});
+  } else if (!strcasecmp(name.c_str(), "tick latency")) {
+    // [stage, count, mean, p50, p90, p99, p99.9, max] in microseconds
+    auto& latency = TickLatency::Instance();
+    if (action == "reset") latency.Clear();
+    json out;
+    for (auto i = 0; i < TickLatency::kNumStages; ++i) {
+      auto s = static_cast<TickLatency::Stage>(i);
+      auto& h = latency.Get(s);
+      auto n = h.count();
+      out.push_back(json{TickLatency::Name(s), n, n ? h.sum() / 1e3 / n : 0.,
+                         h.Percentile(0.5) / 1e3, h.Percentile(0.9) / 1e3,
+                         h.Percentile(0.99) / 1e3, h.Percentile(0.999) / 1e3,
+                         h.max() / 1e3});
+    }
+    Send(json{"admin", name, action, out});
+  } else if (!strcasecmp(name.c_str(), "memory")) {
+    // [subsystem, bytes, objects], rss first
+    json out;
+    for (auto& u : MemoryAccounting::Instance().Report())
+      out.push_back(json{u.name, u.bytes, u.objects});
+    Send(json{"admin", name, action, out});
   }
 }
 
@@ -1702,7 +2374,8 @@ void Connection::OnAdminBrokerAccountOfSubAccount(const json& j,
     json subs;
     for (auto& pair : inst.sub_accounts_) {
       subs.push_back(pair.second->name);
-      for (auto& pair2 : *pair.second->broker_accounts()) {
+      auto accs = pair.second->broker_accounts();
+      for (auto& pair2 : *accs) {
         auto e = SecurityManager::Instance().GetExchange(pair2.first);
         assert(e);
         if (!e) continue;
@@ -1802,7 +2475,8 @@ void Connection::OnAdminSubAccountOfUser(const json& j, const std::string& name,
     json users;
     for (auto& pair : inst.users_) {
       users.push_back(pair.second->name);
-      for (auto& pair2 : *pair.second->sub_accounts()) {
+      auto accs = pair.second->sub_accounts();
+      for (auto& pair2 : *accs) {
         json tmp = {pair.second->name, pair2.second->name};
         out.push_back(tmp);
       }
@@ -1920,11 +2594,72 @@ void Connection::OnAdminStopBook(const json& j, const std::string& name,
       return;
     }
     LOG_DEBUG('#' << id_ << ": OnAdminStopBook " << str);
-    inst.Set(sec->id, acc->id, action == "add");
+    inst.Set(sec->id, acc ? acc->id : 0, action == "add");
     Send(json{"admin", name, action});
   }
 }
 
+// stops all the securities of an exchange or a sector at once
+void Connection::OnAdminStopBookGroups(const json& j, const std::string& name,
+                                       const std::string& action) {
+  auto& inst = StopBookManager::Instance();
+  static const char* kKinds[] = {"exchange", "sector"};
+  if (action == "ls") {
+    json book;
+    for (auto kind : {StopBookManager::kExchange, StopBookManager::kSector}) {
+      for (auto& pair : inst.GetGroups(kind)) {
+        if (!pair.second) continue;
+        book.push_back(json{kKinds[kind], pair.first.first, pair.first.second});
+      }
+    }
+    Send(json{"admin", name, action, book});
+    return;
+  }
+  auto values = j[3];
+  auto kind = StopBookManager::kExchange;
+  auto value = -1;
+  const SubAccount* acc = nullptr;
+  for (auto i = 0u; i < values.size(); ++i) {
+    auto v = values[i];
+    auto name = Get<std::string>(v[0]);
+    if (name == "exchange") {
+      auto exch_name = Get<std::string>(v[1]);
+      auto exch = SecurityManager::Instance().GetExchange(exch_name);
+      if (exch) value = exch->id;
+    } else if (name == "sector") {
+      kind = StopBookManager::kSector;
+      value = Get<int64_t>(v[1]);
+    } else if (name == "sub") {
+      acc = ValidateAcc(user_, v[1]);
+    }
+  }
+  if (value < 0) {
+    Send(json{"admin", name, action, "exchange or sector required"});
+    return;
+  }
+  std::stringstream ss;
+  if (action == "add") {
+    ss << "insert into stop_book_group(kind, value, sub_account_id) values("
+       << kind << ", " << value << ", " << (acc ? acc->id : 0) << ")";
+  } else if (action == "delete") {
+    ss << "delete from stop_book_group where kind=" << kind
+       << " and value=" << value
+       << " and sub_account_id=" << (acc ? acc->id : 0);
+  }
+  auto str = ss.str();
+  if (str.empty()) return;
+  try {
+    auto sql = Database::Session();
+    *sql << str;
+  } catch (const std::exception& e) {
+    Send(json{"admin", name, action, e.what()});
+    return;
+  }
+  LOG_DEBUG('#' << id_ << ": OnAdminStopBookGroups " << str);
+  inst.SetGroup(kind, value, acc ? acc->id : 0, action == "add");
+  Send(json{"admin", name, action});
+}
+
 void Connection::OnAdminUsers(const json& j, const std::string& name,
                               const std::string& action) {
   auto& inst = AccountManager::Instance();
@@ -2020,9 +2755,8 @@ void Connection::OnAdminBrokerAccounts(const json& j, const std::string& name,
             BrokerAccount b;
             *err = b.SetParams(str);
           } else if (key == "adapter") {
-            auto adapter =
-                ExchangeConnectivityManager::Instance().GetAdapter(str);
-            if (!adapter) *err = "unknown adapter name";
+            BrokerAccount b;
+            *err = b.SetAdapter(str);
           }
           (*ss) << "'" << str << "'";
           return true;
@@ -2033,9 +2767,7 @@ void Connection::OnAdminBrokerAccounts(const json& j, const std::string& name,
           if (key == "params") {
             acc->SetParams(str);
           } else {
-            acc->adapter_name = StrDup(str);
-            acc->adapter =
-                ExchangeConnectivityManager::Instance().GetAdapter(str);
+            acc->SetAdapter(str);
           }
           return true;
         }));
@@ -2050,14 +2782,7 @@ void Connection::OnAdminBrokerAccounts(const json& j, const std::string& name,
           if (key == "params") {
             *err = acc->SetParams(str);
           } else {
-            auto adapter =
-                ExchangeConnectivityManager::Instance().GetAdapter(str);
-            if (!adapter) {
-              *err = "unknown adapter name";
-            } else {
-              acc->adapter = adapter;
-              acc->adapter_name = StrDup(str);
-            }
+            *err = acc->SetAdapter(str);
           }
           return true;
         },
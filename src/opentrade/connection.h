@@ -4,6 +4,7 @@
 #include <boost/asio.hpp>
 #include <boost/unordered_map.hpp>
 #include <memory>
+#include <set>
 #include <unordered_map>
 
 #include "account.h"
@@ -11,6 +12,7 @@
 #include "market_data.h"
 #include "order.h"
 #include "security.h"
+#include "server.h"
 
 namespace opentrade {
 
@@ -18,6 +20,10 @@ struct Transport {
   typedef std::shared_ptr<Transport> Ptr;
   virtual void Send(const std::string& msg) = 0;
   virtual std::string GetAddress() const = 0;
+  // a stateless transport streams one response in parts, each Send in
+  // between is one part
+  virtual void BeginStream() {}
+  virtual void EndStream() {}
   bool stateless = false;
 };
 
@@ -30,13 +36,20 @@ class Connection : public std::enable_shared_from_this<Connection> {
   void OnMessageAsync(const std::string&);
   void OnMessageSync(const std::string&, const std::string& token = "");
   void OnAlgo(const json& j, const std::string& msg);
+  void OnAlgoBasket(const json& j);
+  Algo::ParamMapPtr ParseAlgoParams(json* j,
+                                    const ParamSchema* schema = nullptr);
   void OnOrder(const json& j, const std::string& msg);
+  void OnBatch(const json& j);
   void OnSecurities(const json& j, const std::string& action);
+  void OnSecuritiesPage(const json& j);
   void OnAdmin(const json& j);
   void OnAdminUsers(const json& j, const std::string& name,
                     const std::string& action);
   void OnAdminStopBook(const json& j, const std::string& name,
                        const std::string& action);
+  void OnAdminStopBookGroups(const json& j, const std::string& name,
+                             const std::string& action);
   void OnAdminSubAccountOfUser(const json& j, const std::string& name,
                                const std::string& action);
   void OnAdminBrokerAccountOfSubAccount(const json& j, const std::string& name,
@@ -52,10 +65,21 @@ class Connection : public std::enable_shared_from_this<Connection> {
   void OnTrades(const json& j);
   void OnTarget(const json& j, const std::string& msg);
   void OnLogin(const std::string& action, const json& j);
-  void Send(Confirmation::Ptr cm);
+  // serialized confirmation, empty if not for web clients
+  static std::string Serialize(const Confirmation& cm, bool offline);
+  // shared by all the connections it is sent to
+  void Send(std::shared_ptr<const std::string> msg);
   void Send(const std::string& msg, const SubAccount* acc);
   void Send(const Algo& algo, const std::string& status,
             const std::string& body, uint32_t seq);
+  // the ones of the user
+  void Send(std::shared_ptr<const Server::AlgoMessages> msgs);
+  static std::string Serialize(Algo::IdType id, time_t tm,
+                               const std::string& token,
+                               const std::string& name,
+                               const std::string& status,
+                               const std::string& body, uint32_t seq,
+                               bool offline);
   void Close() { closed_ = true; }
   void SendTestMsg(const std::string& token, const std::string& msg,
                    bool stopped);
@@ -63,9 +87,15 @@ class Connection : public std::enable_shared_from_this<Connection> {
 
  protected:
   void HandleMessageSync(const std::string&, const std::string& token);
+  void OnCancel(int64_t id, const std::string& msg);
+  void OnReplace(const json& j, const std::string& msg);
   void HandleOneSecurity(const Security& s, json* out, bool request_params);
-  void PublishMarketdata();
+  // market data of the subscriptions on this cadence, plus market status
+  // and pnl on kStatusInterval, returns false once nothing is left on it
+  bool Publish(uint32_t interval, uint64_t tick);
   void PublishMarketStatus();
+  void PublishPnl();
+  void Schedule(uint32_t interval);
   void Send(const std::string& msg) {
     sent_ = true;
     if (!closed_) transport_->Send(msg);
@@ -83,21 +113,29 @@ class Connection : public std::enable_shared_from_this<Connection> {
  private:
   Transport::Ptr transport_;
   const User* user_ = nullptr;
-  boost::unordered_map<std::pair<Security::IdType, DataSrc::IdType>,
-                       std::pair<MarketData, uint32_t>>
+  struct Sub {
+    uint32_t ver = 0;  // of the shared delta last sent
+    uint32_t n = 0;    // number of subscriptions
+    uint32_t interval = 0;
+  };
+  boost::unordered_map<std::pair<Security::IdType, DataSrc::IdType>, Sub>
       subs_;
 #if BOOST_VERSION < 106600
   boost::asio::strand strand_;
+  boost::asio::strand bulk_strand_;
+  boost::asio::strand admin_strand_;
 #else
   boost::asio::io_context::strand strand_;
+  // bulk queries and admin, off the io threads
+  boost::asio::io_context::strand bulk_strand_;
+  // admin, on the database query threads
+  boost::asio::io_context::strand admin_strand_;
 #endif
-  boost::asio::deadline_timer timer_;
-  std::unordered_map<std::string, bool> ecs_;
-  std::unordered_map<std::string, bool> mds_;
-  std::unordered_map<SubAccount::IdType, PositionManager::Pnl> pnls_;
-  boost::unordered_map<std::pair<SubAccount::IdType, Security::IdType>,
-                       PositionManager::Pnl>
-      single_pnls_;
+  std::shared_ptr<boost::asio::io_service> service_;
+  std::set<uint32_t> cadences_;
+  uint32_t md_interval_;
+  uint32_t status_seq_ = 0;  // of the market status sent
+  PositionManager::PnlSeqs pnl_seqs_;
   tbb::concurrent_unordered_set<std::string> test_algo_tokens_;
   bool sub_pnl_ = false;
   bool closed_ = false;
@@ -105,6 +143,7 @@ class Connection : public std::enable_shared_from_this<Connection> {
   int id_ = 0;
   friend class AlgoManager;
   friend class GlobalOrderBook;
+  friend class PublishScheduler;
 };
 
 }  // namespace opentrade
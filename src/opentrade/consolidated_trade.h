@@ -0,0 +1,171 @@
+#ifndef OPENTRADE_CONSOLIDATED_TRADE_H_
+#define OPENTRADE_CONSOLIDATED_TRADE_H_
+
+#include <atomic>
+#include <cstring>
+#include <unordered_map>
+
+#include "async_trade_tick_hook.h"
+#include "consolidation.h"
+#include "indicator_handler.h"
+
+namespace opentrade {
+
+static const Indicator::IdType kConsolidatedTrade = 5;
+static const char* kConsolidatedTradeName = "ConsolidatedTrade";
+
+// The trades of a security on all sources as one tape, set on the
+// consolidation source's MarketData, so POV/VWAP algos take the consolidated
+// volume with one subscription. Only the handler thread writes, readers get
+// a lock free snapshot.
+class ConsolidatedTrade : public Indicator {
+ public:
+  static const Indicator::IdType kId = kConsolidatedTrade;
+
+  struct Tape {
+    double open = 0;
+    double high = 0;
+    double low = 0;
+    double close = 0;  // last price of any source
+    double qty = 0;  // of the last counted print
+    MarketData::Volume volume = 0;  // counted, see ConsolidatedTradeHandler
+    double vwap = 0;
+    time_t tm = 0;
+  };
+
+  Tape tape() const {
+    uint64_t words[kWords];
+    while (true) {
+      auto seq = seq_.load(std::memory_order_acquire);
+      if (seq & 1) continue;
+      for (auto i = 0u; i < kWords; ++i)
+        words[i] = words_[i].load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq_.load(std::memory_order_relaxed) == seq) break;
+    }
+    Tape out;
+    memcpy(&out, words, sizeof(out));
+    return out;
+  }
+
+  // count the qty into volume and vwap, or only take the price
+  void Update(time_t tm, double px, double qty, bool count) {
+    auto& t = tape_;
+    if (!t.open) t.open = px;
+    if (px > t.high) t.high = px;
+    if (!t.low || px < t.low) t.low = px;
+    t.close = px;
+    t.tm = tm;
+    if (count && qty > 0) {
+      t.vwap = (t.vwap * t.volume + px * qty) / (t.volume + qty);
+      t.volume += qty;
+      t.qty = qty;
+    }
+    Publish();
+  }
+
+ private:
+  // seqlock writer
+  void Publish() {
+    uint64_t words[kWords] = {};
+    memcpy(words, &tape_, sizeof(tape_));
+    auto seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (auto i = 0u; i < kWords; ++i)
+      words_[i].store(words[i], std::memory_order_relaxed);
+    seq_.store(seq + 2, std::memory_order_release);
+  }
+
+  static inline const size_t kWords = (sizeof(Tape) + 7) / 8;
+  Tape tape_;
+  std::atomic<uint32_t> seq_ = 0;
+  std::atomic<uint64_t> words_[kWords] = {};
+};
+
+// Feeds ConsolidatedTrade from the trade tick hooks of the security on every
+// source but the consolidation one. How a source's prints count into the
+// volume is the "consolidated_volume" config of its market data adapter:
+//   all (default), every print counts
+//   price, the price only, e.g. a feed repeating the prints of the others
+//   dedup, a print counts unless another source counted the same price and
+//     qty in the last kDedupWindow seconds, e.g. a partly overlapping feed
+class ConsolidatedTradeHandler : public IndicatorHandler,
+                                 public AsyncTradeTickHook {
+ public:
+  typedef ConsolidatedTrade Ind;
+  static inline const time_t kDedupWindow = 1;
+
+  ConsolidatedTradeHandler() { set_name(kConsolidatedTradeName); }
+
+  Indicator::IdType id() const override { return kConsolidatedTrade; }
+
+  void Subscribe(Instrument* inst, bool listen) noexcept override {
+    assert(kConsolidationSrc == inst->src());
+    Async([=]() {
+      auto ind = const_cast<Ind*>(inst->Get<Ind>());
+      if (!ind) {
+        ind = new Ind;
+        auto mngr = &MarketDataManager::Instance();
+        for (auto& p : mngr->adapters()) {
+          auto src = p.second->src();
+          if (kConsolidationSrc == src) continue;
+          auto mode = p.second->config("consolidated_volume");
+          Source s{ind, mode == "price" ? kPrice
+                        : mode == "dedup" ? kDedup
+                                          : kAll};
+          auto& md = mngr->Get(inst->sec(), src);
+          sources_[&md] = s;
+          const_cast<MarketData&>(md).HookTradeTick(this);
+        }
+        const_cast<MarketData&>(inst->md()).Set(ind);
+      }
+      if (listen) ind->AddListener(inst);
+    });
+  }
+
+  void OnTick(const Tick& t) noexcept override {
+    auto it = sources_.find(t.md);
+    if (it == sources_.end() || t.px <= 0) return;
+    auto& s = it->second;
+    auto count = s.mode != kPrice;
+    if (count && t.qty > 0) {
+      // the prints counted lately of the security, newest last
+      auto& recent = recent_[s.ind];
+      while (!recent.empty() && recent.front().tm + kDedupWindow < t.tm)
+        recent.erase(recent.begin());
+      if (s.mode == kDedup) {
+        for (auto& r : recent) {
+          if (r.src != t.src && r.px == t.px && r.qty == t.qty) {
+            count = false;
+            break;
+          }
+        }
+      }
+      if (count) recent.push_back(Print{t.src, t.tm, t.px, t.qty});
+    }
+    s.ind->Update(t.tm, t.px, t.qty, count);
+  }
+
+  void Post(std::function<void()> func) noexcept override { Async(func); }
+
+ private:
+  enum Mode { kAll, kPrice, kDedup };
+  struct Source {
+    Ind* ind;
+    Mode mode;
+  };
+  struct Print {
+    DataSrc::IdType src;
+    time_t tm;
+    double px;
+    double qty;
+  };
+  // on the handler thread
+  std::unordered_map<const MarketData*, Source> sources_;
+  std::unordered_map<const Ind*, std::vector<Print>> recent_;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_CONSOLIDATED_TRADE_H_
@@ -2,78 +2,109 @@
 
 namespace opentrade {
 
-static PriceLevel::Quotes kEmptyQuotes;
-
-ConsolidationBook::ConsolidationBook(int num_src) {
-  ask_quotes.resize(num_src, kEmptyQuotes.end());
-  bid_quotes.resize(num_src, kEmptyQuotes.end());
+ConsolidationBook::ConsolidationBook(int num_src, FixedScale scale)
+    : scale(scale) {
+  ask_quotes.resize(num_src);
+  bid_quotes.resize(num_src);
 }
 
 void ConsolidationBook::Reset() {
   Lock lock(m);
-  for (auto& p : ask_quotes) p = kEmptyQuotes.end();
-  for (auto& p : bid_quotes) p = kEmptyQuotes.end();
+  for (auto& q : ask_quotes) q = {};
+  for (auto& q : bid_quotes) q = {};
   asks.clear();
   bids.clear();
+  Publish();
 }
 
-template <bool reset, typename A>
-inline void ConsolidationBook::Erase(PriceLevel::Quotes::const_iterator it,
-                                     A* a) {
-  if constexpr (reset) {
-    if constexpr (A::IsAsk())
-      ask_quotes[it->inst->src_idx()] = kEmptyQuotes.end();
-    else
-      bid_quotes[it->inst->src_idx()] = kEmptyQuotes.end();
-  }
-  auto level = it->parent;
-  level->size -= it->size;
-  level->quotes.erase(it);
-  if (level->quotes.empty()) a->erase(level->self);
+void ConsolidationBook::Publish() {
+  TopOfBook top;
+  top.ask = Best(asks);
+  top.bid = Best(bids);
+  if (top.ask == published_.ask && top.bid == published_.bid) return;
+  published_ = top;
+  uint64_t words[kTopWords] = {};
+  memcpy(words, &top, sizeof(top));
+  auto seq = top_seq_.load(std::memory_order_relaxed);
+  top_seq_.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (auto i = 0u; i < kTopWords; ++i)
+    top_[i].store(words[i], std::memory_order_relaxed);
+  top_seq_.store(seq + 2, std::memory_order_release);
 }
 
 template <typename A, typename B>
-inline void ConsolidationBook::Insert(double price, MarketData::Qty size,
+inline void ConsolidationBook::Update(double price, MarketData::Qty size,
                                       const Instrument* inst, A* a, B* b) {
-  auto p = a->emplace(price);
-  auto& level = const_cast<PriceLevel&>(*p.first);
-  if (p.second) level.self = p.first;
-  if constexpr (A::IsAsk())
-    ask_quotes[inst->src_idx()] = level.Insert(inst, size);
-  else
-    bid_quotes[inst->src_idx()] = level.Insert(inst, size);
-  // remove crossed levels of b, lock allowed
-  for (auto it = b->begin(); it != b->end() && A::kPriceCmp(price, it->price);
-       ++it) {
-    while (!it->quotes.empty()) Erase<true>(it->quotes.begin(), b);
+  auto tick = scale.From(price);
+  Lock lock(m);
+  auto& q = quotes<A>()[inst->src_idx()];
+  if (q.price > 0) {
+    if (tick == q.tick) {
+      if (size != q.size) {
+        a->Update(tick, size, inst);
+        q.size = size;
+        Publish();
+      }
+      return;
+    }
+    a->Erase(q.tick, inst);
+    q = {};
+  }
+  if (price <= 0 || tick <= Fixed()) {
+    Publish();
+    return;
+  }
+  // the same double for all the venues at the level
+  price = scale.To(tick);
+  a->Insert(tick, price, size, inst);
+  q.price = price;
+  q.tick = tick;
+  q.size = size;
+  // remove crossed levels of b
+  auto& b_quotes = quotes<B>();
+  while (!b->empty() && A::kTickCmp(tick, b->front().tick)) {
+    for (auto& q2 : b->front().quotes) b_quotes[q2.inst->src_idx()] = {};
+    b->PopFront();
   }
+  Publish();
 }
 
-template <typename A, typename B>
-inline void ConsolidationBook::Update(double price, MarketData::Qty size,
-                                      const Instrument* inst, A* a, B* b) {
-  PriceLevel::Quotes::iterator it;
-  if constexpr (A::IsAsk())
-    it = ask_quotes[inst->src_idx()];
-  else
-    it = bid_quotes[inst->src_idx()];
-  Lock lock(m);
-  if (it == kEmptyQuotes.end()) {
-    if (price > 0) Insert(price, size, inst, a, b);
-  } else {
-    if (price > 0) {
-      if (price != it->parent->price) {
-        Erase<false>(it, a);
-        Insert(price, size, inst, a, b);
-      } else if (size != it->size) {
-        auto d = size - it->size;
-        it->size = size;
-        it->parent->size += d;
+template <typename A>
+MarketData::Qty ConsolidationBook::SweepLevels(const A& a, MarketData::Qty qty,
+                                               std::vector<SweepLeg>* out,
+                                               Fixed limit) {
+  MarketData::Qty total = 0;
+  for (auto& level : a) {
+    if (total >= qty) break;
+    if (limit > Fixed() && A::kTickCmp(limit, level.tick)) break;
+    auto n = out->size();
+    for (auto& q : level.quotes) {
+      if (q.size > 0) out->push_back(SweepLeg{q.inst, level.price, q.size});
+    }
+    std::stable_sort(out->begin() + n, out->end(),
+                     [](auto& x, auto& y) { return x.size > y.size; });
+    for (; n < out->size(); ++n) {
+      auto& leg = (*out)[n];
+      if (leg.size >= qty - total) {
+        leg.size = qty - total;
+        total = qty;
+        break;
       }
-    } else {
-      Erase<true>(it, a);
+      total += leg.size;
     }
+    out->resize(std::min(n + 1, out->size()));
   }
+  return total;
+}
+
+MarketData::Qty ConsolidationBook::Sweep(bool buy, MarketData::Qty qty,
+                                         std::vector<SweepLeg>* out,
+                                         double limit_price) const {
+  auto limit = limit_price > 0 ? scale.From(limit_price) : Fixed();
+  Lock lock(m);
+  return buy ? SweepLevels(asks, qty, out, limit)
+             : SweepLevels(bids, qty, out, limit);
 }
 
 void ConsolidationHandler::Start() noexcept {
@@ -87,11 +118,8 @@ void ConsolidationHandler::Subscribe(Instrument* inst, bool listen) noexcept {
   Async([=]() {
     auto book = const_cast<Ind*>(inst->Get<Ind>());
     if (!book) {
-      book = new Ind{};
-      book->ask_quotes.resize(MarketDataManager::Instance().adapters().size(),
-                              kEmptyQuotes.end());
-      book->bid_quotes.resize(MarketDataManager::Instance().adapters().size(),
-                              kEmptyQuotes.end());
+      book = new Ind(MarketDataManager::Instance().adapters().size(),
+                     inst->sec().price_scale());
       const_cast<MarketData&>(inst->md()).Set(book);
       for (auto& p : MarketDataManager::Instance().adapters()) {
         if (kConsolidationSrc == p.second->src()) continue;
@@ -110,9 +138,9 @@ void ConsolidationHandler::OnMarketQuote(const Instrument& inst,
   auto book = const_cast<Ind*>(inst.parent()->Get<Ind>());
   auto& q0 = md0.quote();
   auto& q = md.quote();
-  if (q.ask_price != q0.ask_price)
+  if (q.ask_price != q0.ask_price || q.ask_size != q0.ask_size)
     book->Update(q.ask_price, q.ask_size, &inst, &book->asks, &book->bids);
-  if (q.bid_price != q0.bid_price)
+  if (q.bid_price != q0.bid_price || q.bid_size != q0.bid_size)
     book->Update(q.bid_price, q.bid_size, &inst, &book->bids, &book->asks);
 }
 
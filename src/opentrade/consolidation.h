@@ -1,9 +1,13 @@
 #ifndef OPENTRADE_CONSOLIDATION_H_
 #define OPENTRADE_CONSOLIDATION_H_
 
-#include <tbb/tbb_allocator.h>
-#include <set>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <vector>
 
+#include "fixed_point.h"
 #include "indicator_handler.h"
 #include "market_data.h"
 
@@ -13,62 +17,207 @@ static const Indicator::IdType kConsolidation = 1;
 static const DataSrc kConsolidationSrc("CONS");
 static const char* kConsolidationBook = "ConsolidationBook";
 
-template <typename T, template <typename> typename Cmp,
-          template <typename> typename Alloc = std::allocator>
-struct PriceLevels : public std::set<T, Cmp<T>, Alloc<T>> {
-  static inline Cmp<double> kPriceCmp;
-  static constexpr bool IsAsk() { return kPriceCmp(0, 1); }
-};
-
 struct PriceLevel {
-  explicit PriceLevel(double price) : price(price), size(0) {}
-  double price;
-  MarketData::Qty size;
+  double price = 0;
+  Fixed tick;  // price in the book's scale, the key of the level
+  MarketData::Qty size = 0;
   struct Quote {
-    Quote(const Instrument* inst, PriceLevel* parent, MarketData::Qty size)
-        : inst(inst), parent(parent), size(size) {}
-
     const Instrument* inst;
-    PriceLevel* parent;
     MarketData::Qty size;
   };
-  typedef std::list<Quote, tbb::tbb_allocator<Quote>> Quotes;
+  typedef std::vector<Quote> Quotes;  // latest first
   Quotes quotes;
-  std::set<PriceLevel>::iterator
-      self;  // for erase myself from levels efficiently
-  bool operator<(const PriceLevel& rhs) const { return price < rhs.price; }
-  bool operator>(const PriceLevel& rhs) const { return price > rhs.price; }
-  auto Insert(const Instrument* inst, MarketData::Qty size) {
-    quotes.emplace_front(inst, this, size);
-    this->size += size;
-    return quotes.begin();
+};
+
+// Price ladder sorted best first in a flat array. Every source has at most
+// one quote on each side, so it never has more levels than sources, and a
+// linear scan beats any tree. Erased levels are parked after size() and
+// recycled with their quote buffers, nothing is allocated once warmed up.
+// Levels are matched and ordered on their Fixed ticks, exact whatever the
+// double arithmetic of the venues' feeds.
+template <template <typename> typename Cmp>
+class PriceLevels {
+ public:
+  static inline Cmp<double> kPriceCmp;
+  static inline Cmp<Fixed> kTickCmp;
+  static constexpr bool IsAsk() { return kPriceCmp(0, 1); }
+  typedef std::vector<PriceLevel>::const_iterator const_iterator;
+
+  const_iterator begin() const { return levels_.begin(); }
+  const_iterator end() const { return levels_.begin() + n_; }
+  size_t size() const { return n_; }
+  bool empty() const { return !n_; }
+  const PriceLevel& front() const { return levels_.front(); }
+
+  void clear() {
+    for (auto i = 0u; i < n_; ++i) Reuse(&levels_[i]);
+    n_ = 0;
+  }
+
+  void Insert(Fixed tick, double price, MarketData::Qty size,
+              const Instrument* inst) {
+    auto i = 0u;
+    while (i < n_ && kTickCmp(levels_[i].tick, tick)) ++i;
+    if (i == n_ || levels_[i].tick != tick) {
+      if (levels_.size() == n_) levels_.emplace_back();
+      auto it = levels_.begin();
+      std::rotate(it + i, it + n_, it + n_ + 1);
+      n_++;
+      levels_[i].price = price;
+      levels_[i].tick = tick;
+    }
+    auto& level = levels_[i];
+    level.quotes.insert(level.quotes.begin(), PriceLevel::Quote{inst, size});
+    level.size += size;
+  }
+
+  void Update(Fixed tick, MarketData::Qty size, const Instrument* inst) {
+    auto level = Find(tick);
+    if (!level) return;
+    for (auto& q : level->quotes) {
+      if (q.inst != inst) continue;
+      level->size += size - q.size;
+      q.size = size;
+      return;
+    }
+  }
+
+  void Erase(Fixed tick, const Instrument* inst) {
+    auto level = Find(tick);
+    if (!level) return;
+    auto& quotes = level->quotes;
+    for (auto it = quotes.begin(); it != quotes.end(); ++it) {
+      if (it->inst != inst) continue;
+      level->size -= it->size;
+      quotes.erase(it);
+      break;
+    }
+    if (quotes.empty()) Erase(level - &levels_[0]);
+  }
+
+  void PopFront() { Erase(0); }
+
+ private:
+  PriceLevel* Find(Fixed tick) {
+    for (auto i = 0u; i < n_; ++i) {
+      if (levels_[i].tick == tick) return &levels_[i];
+    }
+    return nullptr;
+  }
+
+  void Erase(size_t i) {
+    Reuse(&levels_[i]);
+    auto it = levels_.begin();
+    std::rotate(it + i, it + i + 1, it + n_);
+    n_--;
   }
+
+  static void Reuse(PriceLevel* level) {
+    level->size = 0;
+    level->quotes.clear();
+  }
+
+  std::vector<PriceLevel> levels_;
+  size_t n_ = 0;
 };
 
-typedef PriceLevels<PriceLevel, std::less, tbb::tbb_allocator> AskLevels;
-typedef PriceLevels<PriceLevel, std::greater, tbb::tbb_allocator> BidLevels;
+typedef PriceLevels<std::less> AskLevels;
+typedef PriceLevels<std::greater> BidLevels;
 static_assert(AskLevels::IsAsk(), "AskLevels cmp function wrong");
 static_assert(!BidLevels::IsAsk(), "BidLevels cmp function wrong");
 
+// best level of each side, inst is the latest source joining the level
+struct TopOfBook {
+  struct Side {
+    double price = 0;
+    MarketData::Qty size = 0;
+    const Instrument* inst = nullptr;
+    bool operator==(const Side& b) const {
+      return price == b.price && size == b.size && inst == b.inst;
+    }
+  };
+  Side ask;
+  Side bid;
+};
+
+// one child of a sweep across venues
+struct SweepLeg {
+  const Instrument* inst;
+  double price;
+  MarketData::Qty size;
+};
+
 struct ConsolidationBook : public Indicator {
   ConsolidationBook() {}
-  explicit ConsolidationBook(int num_src);
+  // prices are kept to the units of scale, see Security::price_scale
+  explicit ConsolidationBook(int num_src, FixedScale scale = FixedScale());
   static const Indicator::IdType kId = kConsolidation;
   typedef std::unique_lock<std::mutex> Lock;
-  std::vector<PriceLevel::Quotes::iterator> ask_quotes;
-  std::vector<PriceLevel::Quotes::iterator> bid_quotes;
+  // current quote of each source, price 0 if not in the book
+  struct SrcQuote {
+    double price = 0;
+    Fixed tick;
+    MarketData::Qty size = 0;
+  };
+  std::vector<SrcQuote> ask_quotes;
+  std::vector<SrcQuote> bid_quotes;
   AskLevels asks;
   BidLevels bids;
+  FixedScale scale;
   mutable std::mutex m;
   void Reset();
   template <typename A, typename B>
   void Update(double price, MarketData::Qty size, const Instrument* inst, A* a,
               B* b);
-  template <bool reset, typename A>
-  void Erase(PriceLevel::Quotes::const_iterator it, A* a);
-  template <typename A, typename B>
-  void Insert(double price, MarketData::Qty size, const Instrument* inst, A* a,
-              B* b);
+  // Venues to hit, best price first and larger displayed size first within
+  // a level, until qty is filled or the levels run out. Buying sweeps asks.
+  // Stop at levels worse than limit_price if it is positive. Return the
+  // total size of the legs appended to out.
+  MarketData::Qty Sweep(bool buy, MarketData::Qty qty,
+                        std::vector<SweepLeg>* out,
+                        double limit_price = 0) const;
+  // lock free snapshot of best ask/bid, published after every change of
+  // the book, asks/bids above need m held
+  TopOfBook top() const {
+    TopOfBook out;
+    uint64_t words[kTopWords];
+    while (true) {
+      auto seq = top_seq_.load(std::memory_order_acquire);
+      if (seq & 1) continue;
+      for (auto i = 0u; i < kTopWords; ++i)
+        words[i] = top_[i].load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (top_seq_.load(std::memory_order_relaxed) == seq) break;
+    }
+    memcpy(&out, words, sizeof(out));
+    return out;
+  }
+
+ private:
+  template <typename A>
+  static TopOfBook::Side Best(const A& a) {
+    if (a.empty()) return {};
+    auto& l = a.front();
+    return {l.price, l.size, l.quotes.front().inst};
+  }
+  template <typename A>
+  static MarketData::Qty SweepLevels(const A& a, MarketData::Qty qty,
+                                     std::vector<SweepLeg>* out, Fixed limit);
+  // seqlock writer, m held
+  void Publish();
+
+  template <typename A>
+  std::vector<SrcQuote>& quotes() {
+    if constexpr (A::IsAsk())
+      return ask_quotes;
+    else
+      return bid_quotes;
+  }
+
+  static inline const size_t kTopWords = (sizeof(TopOfBook) + 7) / 8;
+  TopOfBook published_;
+  std::atomic<uint32_t> top_seq_ = 0;
+  std::atomic<uint64_t> top_[kTopWords] = {};
 };
 
 struct ConsolidationHandler : public IndicatorHandler {
@@ -86,7 +235,7 @@ class DummyFeed : public MarketDataAdapter {
   explicit DummyFeed(const std::string& src) {
     connected_ = 1;
     set_name(src);
-    config_["src"] = src;
+    set_config({{"src", src}});
   }
   void Start() noexcept override {}
   void Stop() noexcept override {}
@@ -0,0 +1,187 @@
+#ifndef OPENTRADE_CORO_H_
+#define OPENTRADE_CORO_H_
+
+// Needs C++20, the algo library including it is built with e.g.
+// target_compile_options(<algo> PRIVATE -std=c++20), the rest of the tree
+// stays on C++17
+#if __cplusplus > 201703L && __has_include(<coroutine>)
+
+#include <algorithm>
+#include <coroutine>
+#include <exception>
+#include <new>
+#include <vector>
+
+#include <boost/container/small_vector.hpp>
+
+#include "algo.h"
+#include "pool.h"
+
+namespace opentrade {
+
+// An algo written as coroutines rather than chains of SetTimeout and state
+// flags, e.g.
+//
+//   Coro Run(Instrument* inst) {
+//     while (inst->net_qty() < qty_) {
+//       co_await NextQuote(inst);
+//       auto cm = co_await Fill(Place(contract, inst));
+//       if (!cm) co_await Sleep(1);
+//     }
+//     Stop();
+//   }
+//
+// started by calling Run(inst) in OnStart. A Coro is a member function of
+// the CoroAlgo, runs up to its first co_await at once, and is resumed on the
+// runner thread of the algo, by the timer wheel for Sleep and by the
+// callbacks below for the others. Once the algo is stopped it is never
+// resumed again, and is destroyed where it is suspended with the algo. The
+// frames come from the slab pools of the runner thread. A subclass
+// overriding OnMarketTrade, OnMarketQuote or OnConfirmation calls the
+// CoroAlgo one too.
+class CoroAlgo : public Algo {
+ public:
+  struct Coro {
+    struct promise_type {
+      // a is the object of the member function, the CoroAlgo
+      template <typename A, typename... Args>
+      explicit promise_type(A&& a, Args&&...) : algo(&a) {
+        next = algo->coros_;
+        if (next) next->prev = this;
+        algo->coros_ = this;
+      }
+      ~promise_type() {
+        if (prev)
+          prev->next = next;
+        else
+          algo->coros_ = next;
+        if (next) next->prev = prev;
+      }
+      Coro get_return_object() noexcept { return {}; }
+      std::suspend_never initial_suspend() noexcept { return {}; }
+      std::suspend_never final_suspend() noexcept { return {}; }
+      void return_void() noexcept {}
+      // the callbacks of the algos are noexcept
+      void unhandled_exception() noexcept { std::terminate(); }
+      static void* operator new(size_t n) { return Allocate(n); }
+      static void operator delete(void* p, size_t n) { Free(p, n); }
+
+      CoroAlgo* algo;
+      promise_type* prev = nullptr;
+      promise_type* next = nullptr;
+    };
+  };
+
+  // suspended for seconds, on the timer wheel of the runner
+  auto Sleep(double seconds) {
+    struct Awaiter {
+      CoroAlgo* algo;
+      double seconds;
+      bool await_ready() const noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) {
+        algo->SetTimeout(
+            [algo = algo, h]() {
+              if (algo->is_active()) h.resume();
+            },
+            seconds);
+      }
+      void await_resume() const noexcept {}
+    };
+    return Awaiter{this, seconds};
+  }
+
+  // the next quote, or trade, dispatched to inst, see Instrument::Interest
+  auto NextQuote(const Instrument* inst) { return Waiter{this, kQuote, inst}; }
+  auto NextTrade(const Instrument* inst) { return Waiter{this, kTrade, inst}; }
+
+  // the next fill of ord, or the confirmation ending it, e.g. canceled or
+  // rejected; nullptr at once if ord is null or not live. The confirmation
+  // is valid until the next co_await.
+  auto Fill(const Order* ord) {
+    Waiter w{this, kFill, ord};
+    w.ready = !ord || !ord->IsLive();
+    return w;
+  }
+
+  void OnMarketTrade(const Instrument& inst, const MarketData& md,
+                     const MarketData& md0) noexcept override {
+    Resume(kTrade, &inst, nullptr);
+  }
+  void OnMarketQuote(const Instrument& inst, const MarketData& md,
+                     const MarketData& md0) noexcept override {
+    Resume(kQuote, &inst, nullptr);
+  }
+  void OnConfirmation(const Confirmation& cm) noexcept override {
+    auto ord = cm.order;
+    if (cm.exec_type == kPartiallyFilled || cm.exec_type == kFilled ||
+        (ord && !ord->IsLive()))
+      Resume(kFill, ord, &cm);
+  }
+
+  ~CoroAlgo() {
+    waiters_.clear();
+    while (coros_) {
+      std::coroutine_handle<Coro::promise_type>::from_promise(*coros_)
+          .destroy();
+    }
+  }
+
+ private:
+  enum Kind : uint8_t { kQuote, kTrade, kFill };
+  struct Waiter {
+    CoroAlgo* algo;
+    Kind kind;
+    const void* key;
+    bool ready = false;
+    std::coroutine_handle<> h;
+    const Confirmation* cm = nullptr;
+    bool await_ready() const noexcept { return ready; }
+    void await_suspend(std::coroutine_handle<> h) {
+      this->h = h;
+      algo->waiters_.push_back(this);
+    }
+    const Confirmation* await_resume() const noexcept { return cm; }
+  };
+
+  void Resume(Kind kind, const void* key, const Confirmation* cm) {
+    if (waiters_.empty() || !is_active()) return;
+    // taken out first, a resumed one may wait again or Place synchronously
+    boost::container::small_vector<Waiter*, 4> ready;
+    auto it = std::remove_if(waiters_.begin(), waiters_.end(), [&](auto w) {
+      if (w->kind != kind || w->key != key) return false;
+      ready.push_back(w);
+      return true;
+    });
+    waiters_.erase(it, waiters_.end());
+    for (auto w : ready) {
+      w->cm = cm;
+      w->h.resume();
+      if (!is_active()) break;
+    }
+  }
+
+  // frames rounded up to a few size classes, the larger from the heap
+  static void* Allocate(size_t n) {
+    if (n <= 256) return SlabPool<256>::Allocate();
+    if (n <= 512) return SlabPool<512>::Allocate();
+    if (n <= 1024) return SlabPool<1024>::Allocate();
+    if (n <= 2048) return SlabPool<2048>::Allocate();
+    return ::operator new(n);
+  }
+  static void Free(void* p, size_t n) {
+    if (n <= 256) return SlabPool<256>::Free(p);
+    if (n <= 512) return SlabPool<512>::Free(p);
+    if (n <= 1024) return SlabPool<1024>::Free(p);
+    if (n <= 2048) return SlabPool<2048>::Free(p);
+    ::operator delete(p);
+  }
+
+  Coro::promise_type* coros_ = nullptr;  // alive, suspended or running
+  std::vector<Waiter*> waiters_;
+};
+
+}  // namespace opentrade
+
+#endif
+
+#endif  // OPENTRADE_CORO_H_
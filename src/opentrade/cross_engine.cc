@@ -1,116 +1,207 @@
 #include "cross_engine.h"
 
+#include <cstdio>
+
 #include "exchange_connectivity.h"
 #include "logger.h"
 
 namespace opentrade {
 
-void CrossEngine::Place(CrossOrder* ord) {
-  assert(ord->inst);
-  Get(ord->sec->id)->Execute(ord);
-}
-
-void CrossSecurity::Execute(CrossOrder* ord) {
-  auto& md = ord->inst->md();
+static inline double GetCrossPrice(const MarketData& md, const Security& sec) {
   auto price = 0.;
   auto ask = md.quote().ask_price;
   auto bid = md.quote().bid_price;
   if (ask > 0 && bid > 0) price = (ask + bid) / 2;
   if (!price) price = md.trade.close;
-  if (!price) price = ord->sec->close_price;
-  Lock lock(m);
-  (ord->IsBuy() ? buys : sells).push_back(ord);
-  if (!(buys.size() && sells.size())) return;
-  if (!price) return;
-  auto& ecm = ExchangeConnectivityManager::Instance();
-  for (auto it_buy = buys.begin(); it_buy != buys.end() && sells.size();) {
-    auto buy = *it_buy;
-    if (!buy->inst->algo().is_active()) {
-      it_buy = buys.erase(it_buy);
+  if (!price) price = sec.close_price;
+  return price;
+}
+
+void CrossEngine::Start(double interval, int threads) {
+  if (interval <= 0) return;
+  tp_.reset(new TaskPool(std::max(1, threads), "cross"));
+  auto t =
+      boost::posix_time::microseconds(static_cast<int64_t>(interval * 1e6));
+  tp_->RepeatTask([this]() { RunSession(); }, t, t);
+  LOG_INFO("Cross engine in batch mode, every " << interval << "s on "
+                                                << threads << " threads");
+}
+
+void CrossEngine::Place(CrossOrder* ord) {
+  assert(ord->inst);
+  auto sec = Get(ord->sec->id);
+  if (!tp_) {
+    sec->Execute(ord);
+    return;
+  }
+  if (!sec->Add(ord)) return;
+  Lock lock(m_);
+  pending_.push_back(sec);
+}
+
+void CrossEngine::RunSession() {
+  std::vector<CrossSecurity*> secs;
+  {
+    Lock lock(m_);
+    secs.swap(pending_);
+  }
+  for (auto sec : secs) tp_->AddTask([sec]() { sec->Cross(); });
+}
+
+void CrossSide::Add(CrossOrder* ord) {
+  auto aid = ord->inst->algo().id();
+  auto it = index.find(aid);
+  if (it == index.end()) {
+    queue.push_back(Interest{&ord->inst->algo(), {}});
+    it = index.emplace(aid, std::prev(queue.end())).first;
+  }
+  it->second->orders.push_back(ord);
+}
+
+void CrossSide::Erase(Queue::iterator it) {
+  index.erase(it->algo->id());
+  queue.erase(it);
+}
+
+void CrossSide::Erase(Algo::IdType aid) {
+  auto it = index.find(aid);
+  if (it != index.end()) Erase(it->second);
+}
+
+void CrossSide::Erase(const CrossOrder& ord) {
+  auto it = index.find(ord.inst->algo().id());
+  if (it == index.end()) return;
+  auto& ords = it->second->orders;
+  auto it2 = std::find(ords.begin(), ords.end(), &ord);
+  if (it2 == ords.end()) return;
+  ords.erase(it2);
+  if (ords.empty()) Erase(it->second);
+}
+
+CrossOrder* CrossSide::Find(const Instrument* inst) {
+  auto it = index.find(inst->algo().id());
+  if (it == index.end()) return nullptr;
+  for (auto ord : it->second->orders) {
+    if (ord->inst == inst) return ord;
+  }
+  return nullptr;
+}
+
+void CrossSecurity::Fill(CrossOrder* ord, double qty, double price) {
+  AlgoManager::Instance().Cancel(const_cast<Instrument*>(ord->inst));
+  char buf[32];
+  snprintf(buf, sizeof(buf), "CX-%u-%d", ord->id, ord->count++);
+  exec_id_ = buf;
+  ExchangeConnectivityManager::Instance().HandleFilled(ord, qty, price,
+                                                       exec_id_);
+}
+
+double CrossSecurity::Match(CrossOrder* ord, double leaves, CrossSide* other,
+                            double price) {
+  auto aid = ord->inst->algo().id();
+  auto filled = 0.;
+  auto it = other->queue.begin();
+  while (it != other->queue.end() && leaves > 0) {
+    auto next = std::next(it);
+    if (!it->algo->is_active()) {
+      other->Erase(it);
+      it = next;
       continue;
     }
-    auto a = buy->leaves();
-    assert(a > 0);
-    for (auto it_sell = sells.begin(); it_sell != sells.end() && a > 0;) {
-      auto sell = *it_sell;
-      if (!sell->inst->algo().is_active()) {
-        it_sell = sells.erase(it_sell);
-        continue;
-      }
-      if (buy->inst->algo().id() == sell->inst->algo().id()) {
-        ++it_sell;
-        continue;
-      }
-      auto b = sell->leaves();
-      assert(b > 0);
-      if (a >= b) {
-        a -= b;
-        b = 0;
-      } else {
-        b -= a;
-        a = 0;
-      }
-      auto qty = sell->leaves() - b;
-      assert(qty > 0);
-      AlgoManager::Instance().Cancel(const_cast<Instrument*>(sell->inst));
-      ecm.HandleFilled(sell, qty, price,
-                       "CX-" + std::to_string(sell->id) + "-" +
-                           std::to_string(sell->count++));
-      if (!b) {
-        it_sell = sells.erase(it_sell);
-        continue;
-      }
-      ++it_sell;
+    if (it->algo->id() == aid) {
+      it = next;
+      continue;
     }
-    auto qty = buy->leaves() - a;
-    if (qty > 0) {
-      AlgoManager::Instance().Cancel(const_cast<Instrument*>(buy->inst));
-      ecm.HandleFilled(
-          buy, qty, price,
-          "CX-" + std::to_string(buy->id) + "-" + std::to_string(buy->count++));
+    auto& ords = it->orders;
+    while (!ords.empty() && leaves > 0) {
+      auto x = ords.front();
+      auto qty = std::min(leaves, x->leaves());
+      assert(qty > 0);
+      auto done = qty >= x->leaves();
+      leaves -= qty;
+      filled += qty;
+      Fill(x, qty, price);
+      if (done) ords.pop_front();
     }
-    if (!a) {
-      it_buy = buys.erase(it_buy);
-      continue;
+    if (ords.empty()) other->Erase(it);
+    it = next;
+  }
+  if (filled > 0) Fill(ord, filled, price);
+  return leaves;
+}
+
+void CrossSecurity::MatchAll(double price) {
+  for (auto it = buys.queue.begin(); it != buys.queue.end();) {
+    auto next = std::next(it);
+    auto& ords = it->orders;
+    while (!ords.empty() && it->algo->is_active()) {
+      auto x = ords.front();
+      if (Match(x, x->leaves(), &sells, price) > 0) break;
+      ords.pop_front();
     }
-    ++it_buy;
+    if (ords.empty() || !it->algo->is_active()) buys.Erase(it);
+    it = next;
+  }
+}
+
+bool CrossSecurity::Add(CrossOrder* ord) {
+  Lock lock(m);
+  (ord->IsBuy() ? buys : sells).Add(ord);
+  md_ = &ord->inst->md();
+  sec_ = ord->sec;
+  if (pending_) return false;
+  pending_ = true;
+  return true;
+}
+
+void CrossSecurity::Cross() {
+  Lock lock(m);
+  pending_ = false;
+  if (buys.empty() || sells.empty() || !md_) return;
+  auto price = GetCrossPrice(md_->Snapshot(), *sec_);
+  if (price) MatchAll(price);
+}
+
+void CrossSecurity::Execute(CrossOrder* ord) {
+  auto price = GetCrossPrice(ord->inst->md(), *ord->sec);
+  Lock lock(m);
+  auto& side = ord->IsBuy() ? buys : sells;
+  auto& other = ord->IsBuy() ? sells : buys;
+  if (!price) {
+    side.Add(ord);
+    unpriced_ = true;
+    return;
   }
+  if (unpriced_) {
+    // orders rested without a price may cross each other
+    unpriced_ = false;
+    MatchAll(price);
+  }
+  auto leaves = ord->leaves();
+  assert(leaves > 0);
+  if (!other.empty()) leaves = Match(ord, leaves, &other, price);
+  if (leaves > 0) side.Add(ord);
 }
 
 void CrossEngine::UpdateTrade(Confirmation::Ptr cm) {
   auto sec = Get(cm->order->sec->id);
   auto& orders = (cm->order->IsBuy() ? sec->buys : sec->sells);
-  if (orders.empty()) return;
   CrossSecurity::Lock lock(sec->m);
-  for (auto it = orders.begin(); it != orders.end(); ++it) {
-    if ((*it)->inst == cm->order->inst) {
-      (*it)->filled_in_market += cm->last_shares;
-      if ((*it)->leaves() <= 0) {
-        orders.erase(it);
-      }
-      break;
-    }
-  }
+  auto ord = orders.Find(cm->order->inst);
+  if (!ord) return;
+  ord->filled_in_market += cm->last_shares;
+  if (ord->leaves() <= 0) orders.Erase(*ord);
 }
 
 void CrossSecurity::Erase(const CrossOrder& ord) {
   Lock lock(m);
-  auto& ords = (ord.IsBuy() ? buys : sells);
-  auto it = std::find(ords.begin(), ords.end(), &ord);
-  if (it != ords.end()) ords.erase(it);
+  (ord.IsBuy() ? buys : sells).Erase(ord);
 }
 
 void CrossSecurity::Erase(Algo::IdType aid) {
   Lock lock(m);
-  for (auto i = 0; i < 2; ++i) {
-    auto& ords = i ? buys : sells;
-    for (auto it = ords.begin(); it != ords.end();) {
-      if ((*it)->inst->algo().id() == aid)
-        it = ords.erase(it);
-      else
-        ++it;
-    }
-  }
+  buys.Erase(aid);
+  sells.Erase(aid);
 }
 
 }  // namespace opentrade
@@ -2,12 +2,17 @@
 #define OPENTRADE_CROSS_ENGINE_H_
 
 #include <deque>
+#include <list>
+#include <memory>
 #include <mutex>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "algo.h"
 #include "order.h"
 #include "security.h"
+#include "task_pool.h"
 
 namespace opentrade {
 
@@ -17,18 +22,62 @@ struct CrossOrder : public Order {
   double leaves() { return leaves_qty - filled_in_market; }
 };
 
+static_assert(sizeof(CrossOrder) <= Order::kPoolBlockSize,
+              "CrossOrder does not fit in Order pool");
+
+// Resting cross orders of one side, aggregated per algo. Algos queue in the
+// order of their oldest resting order and their own orders queue behind it,
+// so an incoming order skips at most its own algo's interest, and inactive
+// algos are dropped when matching runs into them.
+struct CrossSide {
+  struct Interest {
+    const Algo* algo;
+    std::deque<CrossOrder*> orders;  // oldest first
+  };
+  typedef std::list<Interest> Queue;
+  Queue queue;
+  std::unordered_map<Algo::IdType, Queue::iterator> index;
+
+  bool empty() const { return queue.empty(); }
+  void Add(CrossOrder* ord);
+  void Erase(Queue::iterator it);
+  void Erase(Algo::IdType aid);
+  void Erase(const CrossOrder& ord);
+  CrossOrder* Find(const Instrument* inst);
+};
+
 struct CrossSecurity {
-  std::deque<CrossOrder*> buys;
-  std::deque<CrossOrder*> sells;
+  CrossSide buys;
+  CrossSide sells;
   std::mutex m;
   typedef std::lock_guard<std::mutex> Lock;
   void Execute(CrossOrder* ord);
+  // for the batch session, returns true if first since the last session
+  bool Add(CrossOrder* ord);
+  // batch session, all the resting interest at one mid of md snapshot
+  void Cross();
   void Erase(const CrossOrder& ord);
   void Erase(Algo::IdType aid);
+
+ private:
+  // fills the interest of the other side against ord, returns ord's leaves
+  double Match(CrossOrder* ord, double leaves, CrossSide* other,
+               double price);
+  void MatchAll(double price);
+  void Fill(CrossOrder* ord, double qty, double price);
+  bool unpriced_ = false;  // orders added while no price to cross at
+  bool pending_ = false;   // orders added since the last batch session
+  const MarketData* md_ = nullptr;
+  const Security* sec_ = nullptr;
+  std::string exec_id_;
 };
 
 class CrossEngine : public Singleton<CrossEngine> {
  public:
+  // interval > 0 (seconds) switches to call auction, cross orders are
+  // collected and the securities with new interest crossed every interval
+  // on threads, otherwise every arrival crosses immediately.
+  void Start(double interval, int threads = 1);
   void Place(CrossOrder* ord);
   void Erase(const CrossOrder& ord) { Get(ord.sec->id)->Erase(ord); }
   void Erase(Security::IdType sid, Algo::IdType aid) { Get(sid)->Erase(aid); }
@@ -42,8 +91,13 @@ class CrossEngine : public Singleton<CrossEngine> {
     return sec;
   }
 
+ private:
+  void RunSession();
+
  private:
   std::unordered_map<Security::IdType, CrossSecurity*> securities_;
+  std::vector<CrossSecurity*> pending_;
+  std::unique_ptr<TaskPool> tp_;
   std::mutex m_;
   typedef std::lock_guard<std::mutex> Lock;
   friend class Backtest;
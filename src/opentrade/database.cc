@@ -3,6 +3,7 @@
 #include <postgresql/soci-postgresql.h>
 #include <sqlite3/soci-sqlite3.h>
 #include <boost/algorithm/string.hpp>
+#include <algorithm>
 
 #include "logger.h"
 #include "security.h"
@@ -183,6 +184,28 @@ static const char create_tables_sql[] = R"(
     sub_account_id int2 not null references sub_account(id), -- on update cascade on delete cascade,
     primary key(security_id, sub_account_id)
   );
+
+  -- securities inserted or updated, see SecurityManager::LoadChanged
+  create table if not exists security_change(
+    seq bigserial primary key not null,
+    security_id int4 not null
+  );
+  --pg  create or replace function log_security_change() returns trigger as $$
+  --pg  begin
+  --pg    insert into security_change(security_id) values(new.id);
+  --pg    return new;
+  --pg  end $$ language plpgsql;
+  --pg  drop trigger if exists security_change_trigger on security;
+  --pg  create trigger security_change_trigger after insert or update on security
+  --pg    for each row execute procedure log_security_change();
+
+  -- kind: 0 exchange id, 1 sector
+  create table if not exists stop_book_group(
+    kind int2 not null,
+    value int4 not null,
+    sub_account_id int2 not null,
+    primary key(kind, value, sub_account_id)
+  );
 )";
 
 void Database::Initialize(const std::string& url, uint8_t pool_size,
@@ -194,6 +217,7 @@ void Database::Initialize(const std::string& url, uint8_t pool_size,
   static SqlLog log;
   LOG_INFO("Database pool_size=" << (int)pool_size);
   LOG_INFO("Connecting to database " << url);
+  url_ = url;
   if (url.find("sqlite") != std::string::npos) {
     LOG_INFO("It is sqlite");
     is_sqlite_ = true;
@@ -209,6 +233,7 @@ void Database::Initialize(const std::string& url, uint8_t pool_size,
     sql.set_log_stream(&log);
   }
   LOG_INFO("Database connected");
+  query_pool_ = new TaskPool(std::max(1, pool_size / 4), "query");
   if (!create_tables) {
     try {
       *Session() << "select * from stop_book limit 1";
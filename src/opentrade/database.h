@@ -5,11 +5,13 @@
 #include <boost/lexical_cast.hpp>
 #include <boost/type_index.hpp>
 #include <cstring>
+#include <future>
 #include <memory>
 #include <string>
 #include <typeinfo>
 
 #include "logger.h"
+#include "task_pool.h"
 
 namespace opentrade {
 
@@ -19,6 +21,33 @@ class Database {
                          bool create_tables, bool alter_tables);
   static auto Session() { return std::make_unique<soci::session>(*pool_); }
 
+  // runs func(session) on the query threads, the future gets its result or
+  // exception, so a slow database holds none of the caller's threads
+  template <typename F>
+  static auto Async(F func) {
+    typedef decltype(func(std::declval<soci::session&>())) R;
+    auto task = std::make_shared<std::packaged_task<R()>>(
+        [func]() mutable { return func(QuerySession()); });
+    auto fut = task->get_future();
+    query_pool_->AddTask([task]() { (*task)(); });
+    return fut;
+  }
+
+  // as above, cb(std::shared_future) then runs on strand, e.g. the caller's
+  template <typename F, typename Strand, typename Callback>
+  static void Async(F func, Strand* strand, Callback cb) {
+    typedef decltype(func(std::declval<soci::session&>())) R;
+    query_pool_->AddTask([func, strand, cb]() {
+      std::packaged_task<R()> task(
+          [&func]() { return func(QuerySession()); });
+      auto fut = task.get_future().share();
+      task();
+      strand->post([cb, fut]() mutable { cb(fut); });
+    });
+  }
+
+  static auto& query_service() { return query_pool_->service(); }
+
   template <typename T, bool warn = true>
   static T Get(soci::row const& row, int index) {
     if constexpr (!warn) {
@@ -101,10 +130,19 @@ class Database {
   static time_t GetTm(soci::row const& row, int index);
 
   static auto is_sqlite() { return is_sqlite_; }
+  static const std::string& url() { return url_; }
 
  private:
+  // a query thread keeps its session of the pool for its lifetime
+  static soci::session& QuerySession() {
+    static thread_local auto sql = Session();
+    return *sql;
+  }
+
   inline static soci::connection_pool* pool_ = nullptr;
+  inline static TaskPool* query_pool_ = nullptr;
   inline static bool is_sqlite_;
+  inline static std::string url_;
 };
 
 }  // namespace opentrade
@@ -0,0 +1,106 @@
+#include "day_roll.h"
+
+#include <zlib.h>
+#include <ctime>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+#include "algo.h"
+#include "logger.h"
+#include "order.h"
+#include "position.h"
+#include "replication.h"
+#include "utility.h"
+
+namespace opentrade {
+
+static const auto kArchivePath = fs::path(".") / "archive";
+
+// path.gz of path, which is removed if done
+static bool Gzip(const fs::path& path) {
+  std::ifstream ifs(path.c_str(), std::ifstream::binary);
+  if (!ifs.good()) return false;
+  auto out = path.string() + ".gz";
+  auto gz = gzopen(out.c_str(), "wb");
+  if (!gz) return false;
+  char buf[1 << 16];
+  auto ok = true;
+  while (ok && (ifs.read(buf, sizeof(buf)) || ifs.gcount())) {
+    auto n = static_cast<int>(ifs.gcount());
+    ok = gzwrite(gz, buf, n) == n;
+  }
+  ok = gzclose(gz) == Z_OK && ok;
+  boost::system::error_code ec;
+  fs::remove(ok ? path : fs::path(out), ec);
+  return ok;
+}
+
+void DayRoll::Start(const std::string& time) {
+  if (time.empty()) return;
+  int h = 0, mi = 0, s = 0;
+  if (sscanf(time.c_str(), "%d:%d:%d", &h, &mi, &s) < 2) {
+    LOG_ERROR("Invalid store_roll_time: " << time);
+    return;
+  }
+  Schedule(h * 3600 + mi * 60 + s);
+  LOG_INFO("Stores rolled daily at " << time);
+}
+
+void DayRoll::Schedule(int seconds_of_day) {
+  time_t t = GetTime();
+  struct tm now;
+  localtime_r(&t, &now);
+  auto secs = now.tm_hour * 3600 + now.tm_min * 60 + now.tm_sec;
+  auto delay = seconds_of_day - secs;
+  if (delay <= 0) delay += 24 * 3600;
+  kTimerTaskPool.AddTask(
+      [this, seconds_of_day]() {
+        Roll();
+        Schedule(seconds_of_day);
+      },
+      boost::posix_time::seconds(delay));
+}
+
+void DayRoll::Roll() {
+  if (Replication::Instance().serving()) {
+    LOG_WARN("Day roll skipped, the standbys mirror the store as it is");
+    return;
+  }
+  kWriteTaskPool.AddTask([]() {
+    time_t t = GetTime();
+    struct tm tm;
+    localtime_r(&t, &tm);
+    char name[32];
+    strftime(name, sizeof(name), "%Y%m%d-%H%M%S", &tm);
+    auto files = GlobalOrderBook::Instance().Roll();
+    auto algos = AlgoManager::Instance().Roll();
+    files.insert(files.end(), algos.begin(), algos.end());
+    PositionManager::Instance().RollSession();
+
+    auto dir = kArchivePath / name;
+    boost::system::error_code ec;
+    fs::create_directories(dir, ec);
+    std::vector<fs::path> moved;
+    for (auto& f : files) {
+      auto fn = f.filename();
+      if (fn.extension() == ".rolled") fn = fn.stem();
+      auto to = dir / fn;
+      fs::rename(f, to, ec);
+      if (ec) {
+        LOG_ERROR("Failed to archive " << f.c_str() << ": " << ec.message());
+        continue;
+      }
+      moved.push_back(to);
+    }
+    std::thread([moved, dir]() {
+      for (auto& f : moved) {
+        if (!Gzip(f)) LOG_ERROR("Failed to gzip " << f.c_str());
+      }
+      LOG_INFO("Archived " << moved.size() << " store files to "
+                           << dir.c_str());
+    }).detach();
+  });
+}
+
+}  // namespace opentrade
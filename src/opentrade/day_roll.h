@@ -0,0 +1,35 @@
+#ifndef OPENTRADE_DAY_ROLL_H_
+#define OPENTRADE_DAY_ROLL_H_
+
+#include <string>
+
+#include "common.h"
+
+namespace opentrade {
+
+// Day roll of the stores, what scripts/roll_confirmation.py and archive.sh
+// do with the process down. At the time of day, on the write thread, in
+// between the confirmations and the algos written there:
+//   the confirmation journal goes onto a fresh segment of only the GTC and
+//   GTD orders still live, see GlobalOrderBook::Roll
+//   the algo store is compacted to the algos still active, see
+//   AlgoManager::Roll
+//   the session restarts, the next startup takes the fills rolled out from
+//   the BODs in the database
+// The files rolled out are moved to archive/YYYYMMDD-HHMMSS/ and gzipped on
+// a thread of their own, the next startup reads only from the roll on.
+// Skipped on a primary serving standbys, which mirror the store as it is.
+class DayRoll : public Singleton<DayRoll> {
+ public:
+  // time "HH:MM:SS" local, empty to never
+  void Start(const std::string& time);
+  // now, queued to the write thread
+  void Roll();
+
+ private:
+  void Schedule(int seconds_of_day);
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_DAY_ROLL_H_
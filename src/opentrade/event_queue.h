@@ -0,0 +1,127 @@
+#ifndef OPENTRADE_EVENT_QUEUE_H_
+#define OPENTRADE_EVENT_QUEUE_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "inline_func.h"
+
+namespace opentrade {
+
+// Timer queue for backtest, a binary heap ordered by (time, insertion), so
+// events of the same time run in the order they were pushed. Callables live
+// in recycled nodes, cancel only drops the callable and the stale heap entry
+// is skipped when it surfaces. Not thread safe.
+class EventQueue {
+ public:
+  typedef uint64_t Id;  // 0 is never a valid id
+  typedef InlineFunc Func;
+
+  template <typename F>
+  Id Push(uint64_t tm, F&& func) {
+    uint32_t idx;
+    if (free_.empty()) {
+      idx = nodes_.size();
+      nodes_.emplace_back();
+    } else {
+      idx = free_.back();
+      free_.pop_back();
+    }
+    auto& n = nodes_[idx];
+    n.func = Func(std::forward<F>(func));
+    heap_.push_back(Entry{tm, seq_++, idx, n.gen});
+    std::push_heap(heap_.begin(), heap_.end());
+    size_++;
+    return (static_cast<Id>(n.gen) << 32) | (idx + 1);
+  }
+
+  bool Cancel(Id id) {
+    if (!id) return false;
+    uint32_t idx = (id & 0xFFFFFFFF) - 1;
+    if (idx >= nodes_.size()) return false;
+    auto& n = nodes_[idx];
+    if (n.gen != (id >> 32) || !n.func) return false;
+    Free(idx);
+    size_--;
+    // drop stale entries once they dominate the heap
+    if (heap_.size() > kMinCompact && heap_.size() > 2 * size_) Compact();
+    return true;
+  }
+
+  // moves the earliest event not later than tm into func
+  bool Pop(uint64_t tm, Func* func, uint64_t* at) {
+    while (!heap_.empty()) {
+      auto e = heap_.front();
+      auto& n = nodes_[e.idx];
+      auto live = n.gen == e.gen;
+      if (live && e.tm > tm) return false;
+      std::pop_heap(heap_.begin(), heap_.end());
+      heap_.pop_back();
+      if (!live) continue;
+      *func = std::move(n.func);
+      *at = e.tm;
+      Free(e.idx);
+      size_--;
+      return true;
+    }
+    return false;
+  }
+
+  void clear() {
+    heap_.clear();
+    nodes_.clear();
+    free_.clear();
+    size_ = 0;
+  }
+  size_t size() const { return size_; }
+  bool empty() const { return !size_; }
+
+ private:
+  static inline const size_t kMinCompact = 1024;
+
+  struct Node {
+    Func func;
+    uint32_t gen = 0;
+  };
+
+  struct Entry {
+    uint64_t tm;
+    uint64_t seq;
+    uint32_t idx;
+    uint32_t gen;
+    // std heap is a max heap
+    bool operator<(const Entry& b) const {
+      return tm != b.tm ? tm > b.tm : seq > b.seq;
+    }
+  };
+
+  void Free(uint32_t idx) {
+    auto& n = nodes_[idx];
+    n.func.reset();
+    n.gen++;
+    free_.push_back(idx);
+  }
+
+  void Compact() {
+    heap_.erase(std::remove_if(heap_.begin(), heap_.end(),
+                               [this](const Entry& e) {
+                                 return nodes_[e.idx].gen != e.gen;
+                               }),
+                heap_.end());
+    std::make_heap(heap_.begin(), heap_.end());
+  }
+
+ private:
+  std::vector<Entry> heap_;
+  std::vector<Node> nodes_;
+  std::vector<uint32_t> free_;
+  uint64_t seq_ = 0;
+  size_t size_ = 0;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_EVENT_QUEUE_H_
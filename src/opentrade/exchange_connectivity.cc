@@ -1,39 +1,53 @@
 #include "exchange_connectivity.h"
 
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <unordered_map>
+#include <vector>
 
 #include "cross_engine.h"
+#include "latency.h"
 #include "logger.h"
+#include "metrics.h"
+#include "position.h"
 #include "risk.h"
+#include "sharding.h"
+#include "stop_engine.h"
 
 namespace opentrade {
 
-static inline void UpdateThrottle(const Order& ord) {
-  auto tm = GetTime();
+static Counter* const kPlacedOrders = Metrics::Instance().AddCounter(
+    "opentrade_orders_placed_total", "Orders sent to exchange adapters");
+static Counter* const kRejectedOrders = Metrics::Instance().AddCounter(
+    "opentrade_orders_rejected_total", "Orders rejected before sent");
+static LatencyHistogram* const kRiskCheck = []() {
+  auto h = new LatencyHistogram;
+  Metrics::Instance().AddSummary("opentrade_risk_check_seconds",
+                                 "RiskManager::Check of new orders", "", h);
+  return h;
+}();
+
+static inline void UpdateThrottle(const Order& ord,
+                                  ExchangeConnectivityAdapter* adapter) {
+  auto tm = NowCoarseInMicro();
+  adapter->throttle_in_sec.Update(tm);
   const_cast<SubAccount*>(ord.sub_account)->throttle_in_sec.Update(tm);
   const_cast<BrokerAccount*>(ord.broker_account)->throttle_in_sec.Update(tm);
   const_cast<User*>(ord.user)->throttle_in_sec.Update(tm);
-  if (ord.sub_account->limits.msg_rate_per_security > 0)
-    const_cast<SubAccount*>(ord.sub_account)
-        ->throttle_per_security_in_sec[ord.sec->id]
-        .Update(tm);
-  if (ord.broker_account->limits.msg_rate_per_security > 0)
-    const_cast<BrokerAccount*>(ord.broker_account)
-        ->throttle_per_security_in_sec[ord.sec->id]
-        .Update(tm);
-  if (ord.user->limits.msg_rate_per_security > 0)
-    const_cast<User*>(ord.user)
-        ->throttle_per_security_in_sec[ord.sec->id]
-        .Update(tm);
+  const AccountBase* accs[] = {ord.sub_account, ord.broker_account, ord.user};
+  for (auto acc : accs) {
+    if (acc->limits.msg_rate_per_security > 0)
+      const_cast<AccountBase*>(acc)->per_security.Get(ord.sec->id)->throttle
+          .Update(tm);
+  }
 }
 
 static inline void HandleConfirmation(Order* ord, OrderStatus exec_type,
                                       const std::string& text = "",
                                       int64_t tm = 0) {
-  auto cm = std::make_shared<Confirmation>();
+  auto cm = Confirmation::New();
   cm->order = ord;
   cm->exec_type = exec_type;
-  if (exec_type == kNew)
+  if (exec_type == kNew || exec_type == kReplaced)
     cm->order_id = text;
   else
     cm->text = text;
@@ -77,7 +91,7 @@ static inline void HandleConfirmation(
     Order* ord, double qty, double price, const std::string& exec_id,
     int64_t tm, bool is_partial, ExecTransType exec_trans_type,
     Confirmation::StrMapPtr misc = Confirmation::StrMapPtr{}) {
-  auto cm = std::make_shared<Confirmation>();
+  auto cm = Confirmation::New();
   cm->order = ord;
   cm->exec_type = is_partial ? kPartiallyFilled : kFilled;
   cm->last_shares = Round6(qty);
@@ -96,13 +110,20 @@ void ExchangeConnectivityManager::HandleFilled(Order* ord, double qty,
                      kTransNew);
 }
 
-static inline auto CheckAdapter(Order* ord) {
-  auto adapter = ord->broker_account->adapter;
-  auto name = ord->broker_account->adapter_name;
-  if (!adapter && !ord->destination.empty()) {
-    name = ord->destination.c_str();
-    adapter = ExchangeConnectivityManager::Instance().GetAdapter(name);
+static inline ExchangeConnectivityAdapter* FindAdapter(const Order& ord,
+                                                       const char** name) {
+  auto adapter = ord.broker_account->GetSession(ord.session, *ord.sec);
+  *name = adapter ? adapter->name().c_str() : ord.broker_account->adapter_name;
+  if (!adapter && !ord.destination.empty()) {
+    *name = ord.destination.c_str();
+    adapter = ExchangeConnectivityManager::Instance().GetAdapter(*name);
   }
+  return adapter;
+}
+
+static inline auto CheckAdapter(Order* ord) {
+  const char* name;
+  auto adapter = FindAdapter(*ord, &name);
   char buf[256];
   if (!adapter) {
     snprintf(buf, sizeof(buf),
@@ -118,24 +139,37 @@ static inline auto CheckAdapter(Order* ord) {
   return adapter;
 }
 
-bool ExchangeConnectivityManager::Place(Order* ord) {
+// the checks and defaults of ord before the risk check, nullptr if rejected
+// or, for an OTC or CX order, *placed already
+static ExchangeConnectivityAdapter* Prepare(Order* ord, bool* placed) {
+  *placed = false;
   assert(ord->qty > 0);
   ord->qty = Round6(ord->qty);
-  if (ord->qty <= 0) return false;
+  if (ord->qty <= 0) return nullptr;
   kRiskError.clear();
   assert(ord->sub_account);
   assert(ord->sec);
   assert(ord->user);
-  if (!ord->sub_account) return false;
-  if (!ord->sec) return false;
-  if (!ord->user) return false;
+  if (!ord->sub_account) return nullptr;
+  if (!ord->sec) return nullptr;
+  if (!ord->user) return nullptr;
   if (!ord->user->GetSubAccount(ord->sub_account->id)) {
     char buf[256];
     snprintf(buf, sizeof(buf), "Not permissioned to trade with sub account: %s",
              ord->sub_account->name);
     kRiskError = buf;
     HandleConfirmation(ord, kRiskRejected, kRiskError);
-    return false;
+    return nullptr;
+  }
+  auto& shards = ShardManager::Instance();
+  if (!shards.Owns(ord->sub_account->id)) {
+    auto shard = shards.ShardOf(ord->sub_account->id);
+    char buf[256];
+    snprintf(buf, sizeof(buf), "Sub account %s is on shard %d at %s",
+             ord->sub_account->name, shard, shards.nodes()[shard].c_str());
+    kRiskError = buf;
+    HandleConfirmation(ord, kRiskRejected, kRiskError);
+    return nullptr;
   }
   if (!ord->broker_account) {
     auto exchange = ord->sec->exchange;
@@ -146,60 +180,159 @@ bool ExchangeConnectivityManager::Place(Order* ord) {
                exchange->name);
       kRiskError = buf;
       HandleConfirmation(ord, kRiskRejected, kRiskError);
-      return false;
+      return nullptr;
     }
     ord->broker_account = broker;
   }
+  PositionManager::Instance().Resolve(ord);
   if (ord->type == kOTC) {
     HandleConfirmation(ord, kUnconfirmedNew);
     HandleConfirmation(ord, ord->qty, ord->price,
                        "OTC-" + std::to_string(ord->id), NowUtcInMicro(), false,
                        kTransNew);
-    return true;
+    *placed = true;
+    return nullptr;
   } else if (ord->type == kCX) {
     HandleConfirmation(ord, kUnconfirmedNew);
     CrossEngine::Instance().Place(static_cast<CrossOrder*>(ord));
-    return true;
+    *placed = true;
+    return nullptr;
   }
+  // the cancels and replaces of it go through the same session
+  if (!ord->session) ord->session = ord->broker_account->Route(*ord->sec);
   auto adapter = CheckAdapter(ord);
-  if (!adapter) return false;
+  if (!adapter) return nullptr;
   if (ord->type == kMarket || ord->type == kStop) {
     if (ord->price <= 0) {
       ord->price = ord->sec->CurrentPrice();
       if (ord->price <= 0) {
         kRiskError = "Can not find last price for this security";
         HandleConfirmation(ord, kRiskRejected, kRiskError);
-        return false;
+        return nullptr;
       }
     }
     if (ord->type == kMarket) ord->tif = kImmediateOrCancel;
   } else if (ord->price <= 0) {
     kRiskError = "Price can not be empty for limit order";
     HandleConfirmation(ord, kRiskRejected, kRiskError);
-    return false;
+    return nullptr;
+  }
+  return adapter;
+}
+
+// ord passed the risk check
+static bool Send(Order* ord, ExchangeConnectivityAdapter* adapter) {
+  auto& latency = TickLatency::Instance();
+  latency.Record(TickLatency::kRisk, ord->origin);
+  HandleConfirmation(ord, kUnconfirmedNew, "", ord->tm);
+  if ((ord->type == kStop || ord->type == kStopLimit) &&
+      !adapter->stop_supported()) {
+    HandleConfirmation(ord, kNew, "STOP-" + std::to_string(ord->id));
+    StopEngine::Instance().Place(ord);
+    return true;
+  }
+  kRiskError = adapter->Place(*ord);
+  auto ok = kRiskError.empty();
+  if (!ok) {
+    kRejectedOrders->Add();
+    HandleConfirmation(ord, kRiskRejected, kRiskError);
+  } else {
+    kPlacedOrders->Add();
+    latency.Record(TickLatency::kSend, ord->origin);
+    UpdateThrottle(*ord, adapter);
   }
-  if (!RiskManager::Instance().Check(*ord)) {
+  return ok;
+}
+
+bool ExchangeConnectivityManager::Place(Order* ord) {
+  bool placed;
+  auto adapter = Prepare(ord, &placed);
+  if (!adapter) return placed;
+  auto ctx = ord->inst ? ord->inst->risk_context() : nullptr;
+  auto t0 = TickLatency::Now();
+  auto passed = RiskManager::Instance().Check(*ord, ctx);
+  kRiskCheck->Record(TickLatency::Now() - t0);
+  if (!passed) {
+    kRejectedOrders->Add();
     HandleConfirmation(ord, kRiskRejected, kRiskError);
     return false;
   }
-  HandleConfirmation(ord, kUnconfirmedNew, "", ord->tm);
+  return Send(ord, adapter);
+}
+
+bool ExchangeConnectivityManager::Place(const std::vector<Order*>& ords) {
+  if (ords.size() == 1) return Place(ords[0]);
+  // OTC and CX orders take no risk check, they are placed in Prepare
+  std::vector<Order*> basket;
+  std::vector<ExchangeConnectivityAdapter*> adapters;
+  std::string error;
+  auto i = 0u;
+  for (; i < ords.size() && error.empty(); ++i) {
+    bool placed;
+    auto adapter = Prepare(ords[i], &placed);
+    if (adapter) {
+      basket.push_back(ords[i]);
+      adapters.push_back(adapter);
+    } else if (!placed) {
+      error = "basket rejected: " + kRiskError;
+    }
+  }
+  if (error.empty()) {
+    auto t0 = TickLatency::Now();
+    if (!RiskManager::Instance().Check(basket)) error = kRiskError;
+    kRiskCheck->Record(TickLatency::Now() - t0);
+  }
+  if (!error.empty()) {
+    // the prepared ones and the ones not reached
+    for (auto ord : basket) {
+      kRejectedOrders->Add();
+      HandleConfirmation(ord, kRiskRejected, error);
+    }
+    for (; i < ords.size(); ++i) {
+      kRejectedOrders->Add();
+      HandleConfirmation(ords[i], kRiskRejected, error);
+    }
+    kRiskError = error;
+    return false;
+  }
+  auto ok = true;
+  for (i = 0; i < basket.size(); ++i) {
+    if (!Send(basket[i], adapters[i])) ok = false;
+  }
+  return ok;
+}
+
+bool ExchangeConnectivityManager::Trigger(Order* ord) {
+  kRiskError.clear();
+  if (!ord->IsLive()) return false;
+  auto adapter = CheckAdapter(ord);
+  if (!adapter) return false;
+  if (ord->type == kStop) {
+    ord->type = kMarket;
+    ord->tif = kImmediateOrCancel;
+  } else {
+    ord->type = kLimit;
+  }
   kRiskError = adapter->Place(*ord);
   auto ok = kRiskError.empty();
-  if (!ok)
+  if (!ok) {
+    kRejectedOrders->Add();
     HandleConfirmation(ord, kRiskRejected, kRiskError);
-  else
-    UpdateThrottle(*ord);
+  } else {
+    kPlacedOrders->Add();
+    UpdateThrottle(*ord, adapter);
+  }
   return ok;
 }
 
-static inline bool Cancel(Order* cancel_order) {
+static inline bool Cancel(Order* cancel_order, bool mass = false) {
   kRiskError.clear();
   if (!RiskManager::Instance().CheckMsgRate(*cancel_order) ||
-      !RiskManager::Instance().CheckCancels(*cancel_order)) {
+      (!mass && !RiskManager::Instance().CheckCancels(*cancel_order))) {
     HandleConfirmation(cancel_order, kRiskRejected, kRiskError);
     static uint32_t seed;
     kTimerTaskPool.AddTask(
-        [cancel_order]() { Cancel(cancel_order); },
+        [cancel_order, mass]() { Cancel(cancel_order, mass); },
         boost::posix_time::milliseconds(1000 + rand_r(&seed) % 1000));
     return false;
   }
@@ -211,16 +344,21 @@ static inline bool Cancel(Order* cancel_order) {
   if (!ok)
     HandleConfirmation(cancel_order, kRiskRejected, kRiskError);
   else
-    UpdateThrottle(*cancel_order);
+    UpdateThrottle(*cancel_order, adapter);
   return ok;
 }
 
-bool ExchangeConnectivityManager::Cancel(const Order& orig_ord) {
+static bool SendCancel(const Order& orig_ord, bool mass) {
   if (orig_ord.type == kCX) {
     CrossEngine::Instance().Erase(static_cast<const CrossOrder&>(orig_ord));
     return true;
   }
   if (orig_ord.type == kOTC) return false;
+  if ((orig_ord.type == kStop || orig_ord.type == kStopLimit) &&
+      StopEngine::Instance().Cancel(orig_ord)) {
+    HandleConfirmation(const_cast<Order*>(&orig_ord), kCanceled);
+    return true;
+  }
   assert(orig_ord.sub_account);
   assert(orig_ord.sec);
   assert(orig_ord.user);
@@ -234,7 +372,128 @@ bool ExchangeConnectivityManager::Cancel(const Order& orig_ord) {
   cancel_order->orig_id = orig_ord.id;
   cancel_order->id = 0;
   cancel_order->status = kOrderStatusUnknown;
-  return opentrade::Cancel(cancel_order);
+  return Cancel(cancel_order, mass);
+}
+
+bool ExchangeConnectivityManager::Cancel(const Order& orig_ord) {
+  return SendCancel(orig_ord, false);
+}
+
+static inline bool Matches(const MassCancelFilter& f, const Order& ord) {
+  if (f.sub_account && ord.sub_account != f.sub_account) return false;
+  if (f.broker_account && ord.broker_account != f.broker_account)
+    return false;
+  if (f.sec && ord.sec != f.sec) return false;
+  if (f.algo_id && (!ord.inst || ord.inst->algo().id() != f.algo_id))
+    return false;
+  return true;
+}
+
+size_t ExchangeConnectivityManager::MassCancel(const MassCancelFilter& f) {
+  auto& book = GlobalOrderBook::Instance();
+  std::vector<Order*> ords;
+  if (f.broker_account) {
+    ords = book.GetOrders(f.broker_account);
+  } else {
+    for (auto status :
+         {kUnconfirmedNew, kPendingNew, kNew, kSuspended, kPartiallyFilled}) {
+      auto tmp = book.GetOrders(status);
+      ords.insert(ords.end(), tmp.begin(), tmp.end());
+    }
+  }
+  size_t n = 0;
+  std::unordered_map<ExchangeConnectivityAdapter*, std::vector<Order*>>
+      by_adapter;
+  for (auto ord : ords) {
+    if (!ord->IsLive() || !Matches(f, *ord)) continue;
+    if (ord->type == kCX || ord->type == kOTC) {
+      n += SendCancel(*ord, true);
+      continue;
+    }
+    // the local stops here, so that the orders of the session left may still
+    // go in one mass cancel
+    if ((ord->type == kStop || ord->type == kStopLimit) &&
+        StopEngine::Instance().Cancel(*ord)) {
+      HandleConfirmation(ord, kCanceled);
+      n++;
+      continue;
+    }
+    const char* name;
+    by_adapter[FindAdapter(*ord, &name)].push_back(ord);
+  }
+  for (auto& pair : by_adapter) {
+    auto adapter = pair.first;
+    auto& group = pair.second;
+    if (adapter && adapter->mass_cancel_supported() && adapter->connected()) {
+      size_t all = 0;
+      for (auto ord : book.GetOrders(adapter)) {
+        if (ord->IsLive() && (!f.sec || ord->sec == f.sec)) all++;
+      }
+      if (all == group.size()) {
+        auto err = adapter->MassCancel(f.sec);
+        if (err.empty()) {
+          LOG_INFO(adapter->name() << ": mass cancel of " << group.size()
+                                   << " orders sent");
+          n += group.size();
+          continue;
+        }
+        LOG_WARN(adapter->name() << ": mass cancel failed, " << err);
+      }
+    }
+    for (auto ord : group) n += SendCancel(*ord, true);
+  }
+  return n;
+}
+
+bool ExchangeConnectivityManager::Replace(const Order& orig_ord, double qty,
+                                          double price) {
+  if (orig_ord.type == kCX || orig_ord.type == kOTC) return false;
+  assert(orig_ord.sub_account);
+  assert(orig_ord.sec);
+  assert(orig_ord.user);
+  assert(orig_ord.broker_account);
+  if (!orig_ord.IsLive() || orig_ord.replace_id) return false;
+  if (!orig_ord.sub_account) return false;
+  if (!orig_ord.sec) return false;
+  if (!orig_ord.user) return false;
+  if (!orig_ord.broker_account) return false;
+  qty = Round6(qty);
+  if (qty <= orig_ord.cum_qty || price <= 0) return false;
+  if (orig_ord.type == kMarket) return false;
+  const char* name;
+  auto adapter = FindAdapter(orig_ord, &name);
+  if (!adapter || !adapter->replace_supported()) return false;
+  // a local stop is cancelled and placed again instead
+  if ((orig_ord.type == kStop || orig_ord.type == kStopLimit) &&
+      !adapter->stop_supported())
+    return false;
+  auto ord = new Order(orig_ord);
+  ord->orig_id = orig_ord.id;
+  ord->id = 0;
+  ord->status = kOrderStatusUnknown;
+  ord->qty = qty;
+  ord->price = price;
+  ord->avg_px = 0;
+  ord->cum_qty = 0;
+  ord->leaves_qty = 0;
+  ord->replace_id = 0;
+  ord->tm = 0;
+  kRiskError.clear();
+  auto ctx = ord->inst ? ord->inst->risk_context() : nullptr;
+  if (!CheckAdapter(ord)) return false;
+  if (!RiskManager::Instance().Check(*ord, ctx, &orig_ord)) {
+    kRejectedOrders->Add();
+    HandleConfirmation(ord, kRiskRejected, kRiskError);
+    return false;
+  }
+  HandleConfirmation(ord, kUnconfirmedReplace);
+  kRiskError = adapter->Replace(*ord);
+  auto ok = kRiskError.empty();
+  if (!ok)
+    HandleConfirmation(ord, kCancelRejected, kRiskError);
+  else
+    UpdateThrottle(*ord, adapter);
+  return ok;
 }
 
 void ExchangeConnectivityAdapter::HandleNew(Order::IdType id,
@@ -298,6 +557,23 @@ void ExchangeConnectivityAdapter::HandlePendingCancel(
          transaction_time);
 }
 
+void ExchangeConnectivityAdapter::HandlePendingReplace(
+    Order::IdType id, int64_t transaction_time) {
+  Handle(name(), id, "pending replace", kPendingReplace, "", transaction_time);
+}
+
+void ExchangeConnectivityAdapter::HandleReplaced(Order::IdType id,
+                                                 const std::string& order_id,
+                                                 int64_t transaction_time) {
+  Handle(name(), id, "replaced", kReplaced, order_id, transaction_time);
+}
+
+void ExchangeConnectivityAdapter::HandleReplaceRejected(
+    Order::IdType id, const std::string& text, int64_t transaction_time) {
+  Handle(name(), id, "replace rejected", kCancelRejected, text,
+         transaction_time);
+}
+
 void ExchangeConnectivityAdapter::HandleOthers(Order::IdType id,
                                                OrderStatus exec_type,
                                                const std::string& text,
@@ -305,9 +581,13 @@ void ExchangeConnectivityAdapter::HandleOthers(Order::IdType id,
   Handle(name(), id, exec_type, exec_type, text, transaction_time);
 }
 
-void ExchangeConnectivityManager::ClearUnformed(int offset) {
-  for (auto& ord : GlobalOrderBook::Instance().GetOrders(kUnconfirmedNew)) {
-    if (ord->tm > offset) HandleConfirmation(ord, kDoneForDay);
+void ExchangeConnectivityManager::ClearUnformed(
+    int offset, const ExchangeConnectivityAdapter* adapter) {
+  auto& book = GlobalOrderBook::Instance();
+  for (auto& ord : adapter ? book.GetOrders(adapter)
+                           : book.GetOrders(kUnconfirmedNew)) {
+    if (ord->status == kUnconfirmedNew && ord->tm > offset)
+      HandleConfirmation(ord, kDoneForDay);
   }
 }
 
@@ -3,12 +3,33 @@
 
 #include "adapter.h"
 #include "order.h"
+#include "risk.h"
 
 namespace opentrade {
 
 struct ExchangeConnectivityAdapter : public virtual NetworkAdapter {
+  // messages sent through the session, for BrokerAccount::Route
+  Throttle throttle_in_sec;
   virtual std::string Place(const Order& ord) noexcept = 0;
   virtual std::string Cancel(const Order& ord) noexcept = 0;
+  // amends the order of ord.orig_id to ord.qty and ord.price in one message,
+  // keeping its place in the queue where the venue allows, the orders of the
+  // adapters without it are cancelled and placed again
+  virtual bool replace_supported() const noexcept { return false; }
+  virtual std::string Replace(const Order& ord) noexcept {
+    return "Replace not supported";
+  }
+  // cancels all the live orders of the session, or only those of sec, in one
+  // message, each of them is confirmed canceled as usual
+  virtual bool mass_cancel_supported() const noexcept { return false; }
+  // false to hold the stop and stop limit orders in StopEngine until they
+  // trigger, e.g. local_stops=1 in the config of a venue without them
+  virtual bool stop_supported() const noexcept {
+    return !config<int>("local_stops");
+  }
+  virtual std::string MassCancel(const Security* sec) noexcept {
+    return "Mass cancel not supported";
+  }
   void HandleNew(Order::IdType id, const std::string& order_id,
                  int64_t transaction_time = 0);
   void HandlePendingNew(Order::IdType id, const std::string& text = {},
@@ -28,18 +49,46 @@ struct ExchangeConnectivityAdapter : public virtual NetworkAdapter {
   void HandleCancelRejected(Order::IdType id, Order::IdType orig_id,
                             const std::string& text,
                             int64_t transaction_time = 0);
+  // id of the replacement, the fills after kReplaced come with it too
+  void HandlePendingReplace(Order::IdType id, int64_t transaction_time = 0);
+  void HandleReplaced(Order::IdType id, const std::string& order_id,
+                      int64_t transaction_time = 0);
+  void HandleReplaceRejected(Order::IdType id, const std::string& text,
+                             int64_t transaction_time = 0);
   void HandleOthers(Order::IdType id, OrderStatus exec_type,
                     const std::string& text, int64_t transaction_time = 0);
 };
 
+// the orders matching all the non-null fields
+struct MassCancelFilter {
+  const SubAccount* sub_account = nullptr;
+  const BrokerAccount* broker_account = nullptr;
+  const Security* sec = nullptr;
+  uint32_t algo_id = 0;
+};
+
 struct ExchangeConnectivityManager
     : public AdapterManager<ExchangeConnectivityAdapter, kEcPrefix>,
       public Singleton<ExchangeConnectivityManager> {
   bool Place(Order* ord);
+  // the orders of a basket placed all or none with one risk check of their
+  // aggregate, see RiskManager::Check, false if any is rejected
+  bool Place(const std::vector<Order*>& ords);
   bool Cancel(const Order& orig_ord);
+  // qty is the new total quantity, filled included, false if not sent
+  bool Replace(const Order& orig_ord, double qty, double price);
+  // the adapters' mass cancel if the orders selected are all the live ones
+  // of the session (or of the security), cancels one by one otherwise but
+  // without the cancel limits of RiskManager::CheckCancels, returns the
+  // number of orders canceled
+  size_t MassCancel(const MassCancelFilter& filter);
   void HandleFilled(Order* ord, double qty, double price,
                     const std::string& exec_id);
-  void ClearUnformed(int offset);
+  // sends a stop of StopEngine triggered, as a market or limit order
+  bool Trigger(Order* ord);
+  // all adapters' if adapter is null
+  void ClearUnformed(int offset,
+                     const ExchangeConnectivityAdapter* adapter = nullptr);
 };
 
 }  // namespace opentrade
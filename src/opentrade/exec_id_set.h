@@ -0,0 +1,132 @@
+#ifndef OPENTRADE_EXEC_ID_SET_H_
+#define OPENTRADE_EXEC_ID_SET_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace opentrade {
+
+// Dedup set of (order id, exec id), only a 64-bit hash is kept, so a
+// collision (~n^2/2^64) would drop a genuine fill. Sharded by hash with
+// open addressing. Each shard holds at most two generations of
+// max_per_shard entries, when the current one is full the older one is
+// dropped, so memory is bounded and the most recent ids are remembered.
+class ExecIdSet {
+ public:
+  explicit ExecIdSet(size_t max_per_shard = 1 << 16)
+      : max_per_shard_(max_per_shard) {}
+
+  // return false if already there
+  bool Insert(uint32_t id, std::string_view exec_id) {
+    auto h = Hash(id, exec_id);
+    auto& s = shards_[h & (kShards - 1)];
+    std::lock_guard<std::mutex> lock(s.m);
+    if (s.cur.Find(h) || s.old.Find(h)) return false;
+    if (s.cur.n >= max_per_shard_) {
+      std::swap(s.old, s.cur);
+      s.cur.Reset();
+    }
+    s.cur.Insert(h);
+    return true;
+  }
+
+  size_t size() {
+    size_t n = 0;
+    for (auto& s : shards_) {
+      std::lock_guard<std::mutex> lock(s.m);
+      n += s.cur.n + s.old.n;
+    }
+    return n;
+  }
+
+  // slots allocated, in bytes
+  size_t bytes() {
+    size_t n = 0;
+    for (auto& s : shards_) {
+      std::lock_guard<std::mutex> lock(s.m);
+      n += (s.cur.slots.capacity() + s.old.slots.capacity()) * sizeof(uint64_t);
+    }
+    return n;
+  }
+
+  void Clear() {
+    for (auto& s : shards_) {
+      std::lock_guard<std::mutex> lock(s.m);
+      // keep the capacity, e.g. the next backtest day fills it up again
+      s.cur.Reset();
+      s.old.Reset();
+    }
+  }
+
+ private:
+  static inline const size_t kShards = 16;
+
+  static uint64_t Hash(uint32_t id, std::string_view exec_id) {
+    uint64_t h = std::hash<std::string_view>{}(exec_id);
+    h ^= (id + 0x9e3779b97f4a7c15lu) + (h << 6) + (h >> 2);
+    // splitmix64 finalizer, low bits pick the shard
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9lu;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111eblu;
+    h ^= h >> 31;
+    return h ? h : 1;  // 0 marks empty slot
+  }
+
+  struct Table {
+    std::vector<uint64_t> slots;
+    size_t n = 0;
+
+    bool Find(uint64_t h) const {
+      if (slots.empty()) return false;
+      auto mask = slots.size() - 1;
+      for (auto i = (h >> 4) & mask;; i = (i + 1) & mask) {
+        if (slots[i] == h) return true;
+        if (!slots[i]) return false;
+      }
+    }
+
+    void Insert(uint64_t h) {
+      if (2 * (n + 1) > slots.size()) Grow();
+      auto mask = slots.size() - 1;
+      auto i = (h >> 4) & mask;
+      while (slots[i]) i = (i + 1) & mask;
+      slots[i] = h;
+      n++;
+    }
+
+    void Grow() {
+      std::vector<uint64_t> tmp(slots.empty() ? 64 : slots.size() * 2);
+      std::swap(tmp, slots);
+      auto mask = slots.size() - 1;
+      for (auto h : tmp) {
+        if (!h) continue;
+        auto i = (h >> 4) & mask;
+        while (slots[i]) i = (i + 1) & mask;
+        slots[i] = h;
+      }
+    }
+
+    // keep the capacity, it will be filled up again
+    void Reset() {
+      std::fill(slots.begin(), slots.end(), 0);
+      n = 0;
+    }
+  };
+
+  struct alignas(64) Shard {
+    std::mutex m;
+    Table cur;
+    Table old;
+  };
+
+  const size_t max_per_shard_;
+  Shard shards_[kShards];
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_EXEC_ID_SET_H_
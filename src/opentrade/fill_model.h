@@ -0,0 +1,127 @@
+#ifndef OPENTRADE_FILL_MODEL_H_
+#define OPENTRADE_FILL_MODEL_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <unordered_map>
+
+#include "fixed_point.h"
+#include "logger.h"
+#include "market_data.h"
+#include "security.h"
+#include "utility.h"
+
+namespace opentrade {
+
+// Queue position fill model shared by the backtest Simulator and SimServer.
+// A resting order tracks the displayed size queued in front of it at its
+// price. Quotes cap it, a print at the order's price eats it before the
+// order fills, a print through the price fills outright.
+
+static inline const double kUnknownQueue = std::numeric_limits<double>::max();
+
+inline bool SamePrice(double a, double b) {
+  return std::abs(a - b) <= 1e-9 * std::abs(a);
+}
+
+inline bool SamePrice(Fixed a, Fixed b) { return a == b; }
+
+// displayed size in front of a new order at price, the touch of its side at
+// px with size, unknown if it rests behind the touch until the touch
+// reaches it
+template <typename P>
+inline double QueueAhead(bool buy, P price, P px, double size) {
+  if (SamePrice(price, px)) return size;
+  return (buy ? price > px : price < px) ? 0 : kUnknownQueue;
+}
+
+inline double QueueAhead(bool buy, double price, const MarketData::Quote& q) {
+  auto px = buy ? q.bid_price : q.ask_price;
+  if (px <= 0) return 0;
+  return QueueAhead(buy, price, px, buy ? q.bid_size : q.ask_size);
+}
+
+// the touch of the order's side moved to px with size qty, returns false if
+// the order rests behind the touch
+template <typename P>
+inline bool UpdateQueue(bool buy, P price, P px, double qty, double* ahead) {
+  if (SamePrice(price, px)) {
+    *ahead = std::min(*ahead, qty);
+    return true;
+  }
+  if (buy ? price < px : price > px) return false;
+  *ahead = 0;
+  return true;
+}
+
+// latency per exchange, "<latency>[,<exchange>=<latency>...]" in the unit
+// of the caller, a latency of "<base>[~<jitter>]" is the base plus an
+// exponential tail of mean jitter
+class Latencies {
+ public:
+  void Parse(const std::string& str) {
+    for (auto& tok : Split(str, ",")) {
+      auto pos = tok.find('=');
+      if (pos == std::string::npos) {
+        default_ = ParseOne(tok);
+        continue;
+      }
+      auto name = tok.substr(0, pos);
+      auto exch = SecurityManager::Instance().GetExchange(name);
+      if (!exch) {
+        LOG_ERROR("Unknown exchange in latency: " << name);
+        continue;
+      }
+      by_exchange_[exch->id] = ParseOne(tok.substr(pos + 1));
+    }
+  }
+
+  // the base latency
+  double Get(const Exchange* exch) const { return Find(exch).base; }
+
+  // a latency drawn from the distribution of exch
+  double Sample(const Exchange* exch, uint32_t* seed) const {
+    auto& l = Find(exch);
+    if (l.jitter <= 0) return l.base;
+    auto u = (rand_r(seed) + 1.) / (RAND_MAX + 2.);
+    return l.base - l.jitter * std::log(u);
+  }
+
+  bool empty() const {
+    if (default_.base > 0 || default_.jitter > 0) return false;
+    for (auto& pair : by_exchange_) {
+      if (pair.second.base > 0 || pair.second.jitter > 0) return false;
+    }
+    return true;
+  }
+
+ private:
+  struct Latency {
+    double base = 0;
+    double jitter = 0;
+  };
+
+  static Latency ParseOne(const std::string& str) {
+    Latency l;
+    l.base = atof(str.c_str());
+    auto pos = str.find('~');
+    if (pos != std::string::npos) l.jitter = atof(str.c_str() + pos + 1);
+    return l;
+  }
+
+  const Latency& Find(const Exchange* exch) const {
+    if (by_exchange_.empty() || !exch) return default_;
+    auto it = by_exchange_.find(exch->id);
+    return it == by_exchange_.end() ? default_ : it->second;
+  }
+
+  Latency default_;
+  std::unordered_map<Exchange::IdType, Latency> by_exchange_;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_FILL_MODEL_H_
@@ -0,0 +1,92 @@
+#ifndef OPENTRADE_FIXED_POINT_H_
+#define OPENTRADE_FIXED_POINT_H_
+
+#include <cmath>
+#include <cstdint>
+#include <functional>
+
+namespace opentrade {
+
+// A price or quantity as an integer count of the units of its FixedScale,
+// e.g. the cents of a price on a 0.05 tick. Sums and comparisons are exact,
+// unlike doubles the same price reached two ways may differ in the last
+// bits, and a price can index its ticks. Doubles stay at the api
+// boundaries, Python and the web.
+class Fixed {
+ public:
+  constexpr Fixed() = default;
+  constexpr explicit Fixed(int64_t units) : v_(units) {}
+  constexpr int64_t units() const { return v_; }
+  constexpr explicit operator bool() const { return v_ != 0; }
+
+  constexpr bool operator==(Fixed b) const { return v_ == b.v_; }
+  constexpr bool operator!=(Fixed b) const { return v_ != b.v_; }
+  constexpr bool operator<(Fixed b) const { return v_ < b.v_; }
+  constexpr bool operator>(Fixed b) const { return v_ > b.v_; }
+  constexpr bool operator<=(Fixed b) const { return v_ <= b.v_; }
+  constexpr bool operator>=(Fixed b) const { return v_ >= b.v_; }
+  constexpr Fixed operator+(Fixed b) const { return Fixed(v_ + b.v_); }
+  constexpr Fixed operator-(Fixed b) const { return Fixed(v_ - b.v_); }
+  constexpr Fixed operator-() const { return Fixed(-v_); }
+  Fixed& operator+=(Fixed b) {
+    v_ += b.v_;
+    return *this;
+  }
+  Fixed& operator-=(Fixed b) {
+    v_ -= b.v_;
+    return *this;
+  }
+
+ private:
+  int64_t v_ = 0;
+};
+
+// 10^-decimals per unit, converting to the nearest unit and back
+class FixedScale {
+ public:
+  static constexpr int kMaxDecimals = 9;
+  static constexpr int kPriceDecimals = 8;  // as Round8
+  static constexpr int kQtyDecimals = 6;  // as Round6
+
+  explicit FixedScale(int decimals = kPriceDecimals) {
+    if (decimals < 0) decimals = 0;
+    if (decimals > kMaxDecimals) decimals = kMaxDecimals;
+    decimals_ = decimals;
+    mul_ = 1;
+    for (auto i = 0; i < decimals; ++i) mul_ *= 10;
+  }
+  // the fewest decimals step takes, e.g. 4 of 0.0025, or decimals if it is
+  // not positive or takes more than kMaxDecimals
+  static FixedScale Of(double step, int decimals = kPriceDecimals) {
+    if (!(step > 0)) return FixedScale(decimals);
+    auto mul = 1.;
+    for (auto i = 0; i <= kMaxDecimals; ++i, mul *= 10) {
+      auto v = step * mul;
+      if (std::abs(v - std::round(v)) <= 1e-6 * v) return FixedScale(i);
+    }
+    return FixedScale(decimals);
+  }
+
+  int decimals() const { return decimals_; }
+  Fixed From(double v) const { return Fixed(std::llround(v * mul_)); }
+  double To(Fixed f) const { return f.units() / mul_; }
+  // to the nearest unit, the same double for the same Fixed
+  double Round(double v) const { return To(From(v)); }
+
+ private:
+  int decimals_;
+  double mul_;
+};
+
+}  // namespace opentrade
+
+namespace std {
+template <>
+struct hash<opentrade::Fixed> {
+  size_t operator()(opentrade::Fixed f) const {
+    return hash<int64_t>()(f.units());
+  }
+};
+}  // namespace std
+
+#endif  // OPENTRADE_FIXED_POINT_H_
@@ -0,0 +1,174 @@
+#include "fx_rate.h"
+
+#include <cctype>
+#include <deque>
+
+#include "logger.h"
+
+namespace opentrade {
+
+// "EUR.USD", "EUR/USD" or "EURUSD" -> "EUR"
+static std::string ParseBase(const char* symbol, std::string* quote) {
+  std::string s;
+  for (auto p = symbol; *p; ++p) {
+    if (isalpha(*p)) s += toupper(*p);
+  }
+  if (s.size() != 6) return {};
+  if (quote->empty()) *quote = s.substr(3);
+  return s.substr(0, 3);
+}
+
+uint32_t FxRateManager::Node(const std::string& name) {
+  auto it = ids_.find(name);
+  if (it != ids_.end()) return it->second;
+  auto id = currencies_.size();
+  currencies_.emplace_back();
+  currencies_.back().name = name;
+  ids_[name] = id;
+  return id;
+}
+
+void FxRateManager::Initialize(const std::string& home) {
+  if (home.empty()) return;
+  std::vector<const Security*> secs;
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    auto& sm = SecurityManager::Instance();
+    for (auto& pair : sm.securities()) {
+      auto s = pair.second;
+      if (s->type != kForexPair) continue;
+      std::string quote = s->currency;
+      for (auto& c : quote) c = toupper(c);
+      auto base = ParseBase(s->symbol, &quote);
+      if (base.empty() || base == quote) {
+        LOG_WARN("FX: can not parse currency pair " << s->symbol);
+        continue;
+      }
+      pairs_[s->id] = Pair{Node(base), Node(quote)};
+      secs.push_back(s);
+    }
+    if (secs.empty()) {
+      LOG_WARN("FX: no currency pairs");
+      return;
+    }
+    std::string name = home;
+    for (auto& c : name) c = toupper(c);
+    auto h = Node(name);
+    for (auto& c : currencies_) {
+      auto it = sm.rates().find(c.name);
+      if (it != sm.rates().end()) c.rate = it->second;
+    }
+    currencies_[h].rate = 1;
+    BuildTree(h);
+    BuildSecurities();
+    for (auto& pair : pairs_) {
+      auto sec = sm.Get(pair.first);
+      pair.second.px = MarketDataManager::Instance().Get(*sec).trade.close;
+    }
+    for (auto c : currencies_[h].children) Derive(c, true);
+    auto n = 0;
+    for (auto& c : currencies_) n += c.parent != nullptr;
+    LOG_INFO("FX: " << pairs_.size() << " currency pairs, " << n
+                    << " currencies reached from " << home);
+  }
+  for (auto s : secs) {
+    // subscribes
+    const_cast<MarketData&>(MarketDataManager::Instance().Get(*s))
+        .HookTradeTick(this);
+  }
+  // reloaded securities come with the rate of the table
+  SecurityManager::Instance().AddListener(
+      [this](const std::vector<const Security*>&) {
+        std::lock_guard<std::mutex> lock(m_);
+        BuildSecurities();
+        for (auto i = 0u; i < currencies_.size(); ++i) {
+          if (currencies_[i].live) Set(i, currencies_[i].rate);
+        }
+      });
+}
+
+// breadth first, so a currency is reached by the fewest pairs
+void FxRateManager::BuildTree(uint32_t home) {
+  std::vector<std::vector<const Pair*>> edges(currencies_.size());
+  for (auto& pair : pairs_) {
+    edges[pair.second.base].push_back(&pair.second);
+    edges[pair.second.quote].push_back(&pair.second);
+  }
+  std::vector<bool> seen(currencies_.size());
+  seen[home] = true;
+  std::deque<uint32_t> q{home};
+  while (!q.empty()) {
+    auto c = q.front();
+    q.pop_front();
+    for (auto p : edges[c]) {
+      auto other = p->base == c ? p->quote : p->base;
+      if (seen[other]) continue;
+      seen[other] = true;
+      currencies_[other].parent = p;
+      currencies_[c].children.push_back(other);
+      q.push_back(other);
+    }
+  }
+}
+
+void FxRateManager::BuildSecurities() {
+  for (auto& c : currencies_) c.securities.clear();
+  for (auto& pair : SecurityManager::Instance().securities()) {
+    auto s = pair.second;
+    std::string cur = s->currency;
+    for (auto& c : cur) c = toupper(c);
+    auto it = ids_.find(cur);
+    if (it != ids_.end()) currencies_[it->second].securities.push_back(s->id);
+  }
+}
+
+void FxRateManager::Derive(uint32_t c, bool force) {
+  auto& x = currencies_[c];
+  auto p = x.parent;
+  if (p->px > 0) {
+    auto& parent = currencies_[p->base == c ? p->quote : p->base];
+    if (parent.rate > 0) {
+      auto rate = p->base == c ? p->px * parent.rate : parent.rate / p->px;
+      if (rate != x.rate) {
+        x.live = true;
+        Set(c, rate);
+        force = true;
+      }
+    }
+  }
+  if (!force) return;
+  for (auto child : x.children) Derive(child, force);
+}
+
+void FxRateManager::Set(uint32_t c, double rate) {
+  auto& x = currencies_[c];
+  x.rate = rate;
+  auto& sm = SecurityManager::Instance();
+  for (auto id : x.securities) sm.SetRate(id, rate);
+}
+
+void FxRateManager::OnTrade(DataSrc::IdType, Security::IdType id,
+                            const MarketData*, time_t, double px,
+                            double) noexcept {
+  if (px <= 0) return;
+  std::lock_guard<std::mutex> lock(m_);
+  auto it = pairs_.find(id);
+  if (it == pairs_.end()) return;
+  auto& p = it->second;
+  if (p.px == px) return;
+  p.px = px;
+  // only the side further from home depends on the pair
+  if (currencies_[p.base].parent == &p) {
+    Derive(p.base, false);
+  } else if (currencies_[p.quote].parent == &p) {
+    Derive(p.quote, false);
+  }
+}
+
+double FxRateManager::Get(const std::string& currency) const {
+  std::lock_guard<std::mutex> lock(m_);
+  auto it = ids_.find(currency);
+  return it == ids_.end() ? 0 : currencies_[it->second].rate;
+}
+
+}  // namespace opentrade
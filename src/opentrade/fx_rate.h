@@ -0,0 +1,62 @@
+#ifndef OPENTRADE_FX_RATE_H_
+#define OPENTRADE_FX_RATE_H_
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+#include "market_data.h"
+#include "security.h"
+
+namespace opentrade {
+
+// Live Security::rate, the value of one unit of the security's currency in
+// the home currency, derived from the trade ticks of the currency pairs
+// (kForexPair, e.g. "EUR.USD" of currency USD, or "EURUSD"), whose last price
+// is their mid with the update_fx_price config of the FIX adapters. The pairs
+// are subscribed once, each currency reached from the home currency by the
+// fewest pairs, and a tick re-derives only the currencies reached through
+// its pair, and only the securities of a currency whose rate changed are
+// updated. A currency not reached, or until its pairs have a price, keeps
+// the rate of the security table.
+class FxRateManager : public Singleton<FxRateManager>, public TradeTickHook {
+ public:
+  // no-op if home is empty
+  void Initialize(const std::string& home);
+  void OnTrade(DataSrc::IdType src, Security::IdType id, const MarketData* md,
+               time_t tm, double px, double qty) noexcept override;
+  double Get(const std::string& currency) const;
+
+ private:
+  struct Pair {
+    uint32_t base;
+    uint32_t quote;
+    double px = 0;  // of one base in quote
+  };
+  struct Currency {
+    std::string name;
+    double rate = 0;  // 0 if unknown
+    bool live = false;  // derived from the pairs rather than the table
+    const Pair* parent = nullptr;  // towards home, nullptr for home
+    std::vector<uint32_t> children;
+    std::vector<Security::IdType> securities;
+  };
+
+  uint32_t Node(const std::string& name);
+  void BuildTree(uint32_t home);
+  void BuildSecurities();
+  // rate of c from its parent, and of its children if it changed or force
+  void Derive(uint32_t c, bool force);
+  void Set(uint32_t c, double rate);
+
+  mutable std::mutex m_;
+  std::vector<Currency> currencies_;
+  std::unordered_map<std::string, uint32_t> ids_;
+  std::unordered_map<Security::IdType, Pair> pairs_;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_FX_RATE_H_
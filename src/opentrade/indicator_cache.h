@@ -0,0 +1,216 @@
+#ifndef OPENTRADE_INDICATOR_CACHE_H_
+#define OPENTRADE_INDICATOR_CACHE_H_
+#ifdef BACKTEST
+
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+#include "logger.h"
+#include "utility.h"
+
+namespace opentrade {
+
+// Indicator outputs of a day of ticks kept in sidecar files, so that the
+// repeated backtests of the date, e.g. the configurations of a sweep, take
+// them from the mapped file rather than computing them from the ticks
+// again. Enabled by the INDICATOR_CACHE directory, which belongs to one set
+// of tick files. The first replay of a date records the series of the
+// handlers and writes "<dir>/<date>/<key>" if the day is played through; the
+// key has the handler name, version and parameters. A series starts when the
+// security is first subscribed, a later replay subscribing it earlier, or a
+// security not in the file, falls back to the ticks. A file is of fixed size
+// records of the securities in time order:
+//   "OTIC" u32 version, u32 record size, u32 count,
+//   [u32 sec id, u32 n, u64 offset, u64 since] * count ascending, records
+class IndicatorCache : public Singleton<IndicatorCache> {
+ public:
+  // the records of a security in a mapped file
+  template <typename T>
+  struct Series {
+    const T* p = nullptr;
+    size_t n = 0;
+  };
+
+  IndicatorCache() : dir_(PythonOr(std::getenv("INDICATOR_CACHE"), "")) {}
+
+  bool enabled() const { return !dir_.empty(); }
+
+  // the mapped files of the previous day are released
+  void StartOfDay(const std::string& date) {
+    files_.clear();
+    writers_.clear();
+    date_ = date;
+  }
+
+  // the records written if the day played through
+  void EndOfDay(bool complete) {
+    if (complete) {
+      for (auto& pair : writers_) Write(pair.first, pair.second);
+    }
+    writers_.clear();
+  }
+
+  // false if the series of sec of key recorded from since (kTime) on is not
+  // cached for the day
+  template <typename T>
+  bool Get(const std::string& key, uint32_t sec_id, uint64_t since,
+           Series<T>* out) {
+    auto f = Open(key, sizeof(T));
+    if (!f) return false;
+    auto it = std::lower_bound(
+        f->index, f->index + f->count, sec_id,
+        [](const IndexEntry& e, uint32_t id) { return e.sec_id < id; });
+    if (it == f->index + f->count || it->sec_id != sec_id || it->since > since)
+      return false;
+    out->p = reinterpret_cast<const T*>(f->data + it->offset);
+    out->n = it->n;
+    return true;
+  }
+
+  // the records of sec of key from since on to write at the end of day, null
+  // if disabled or key is cached already
+  template <typename T>
+  std::vector<T>* Record(const std::string& key, uint32_t sec_id,
+                         uint64_t since) {
+    if (!enabled() || Open(key, sizeof(T))) return nullptr;
+    auto& w = writers_[key];
+    w.record_size = sizeof(T);
+    auto& s = w.series[sec_id];
+    if (!s.buf) {
+      s.buf.reset(new Buffer<T>);
+      s.since = since;
+    }
+    return &static_cast<Buffer<T>*>(s.buf.get())->v;
+  }
+
+ private:
+  static inline const uint32_t kVersion = 1;
+  static inline const size_t kHeaderSize = 16;
+
+  struct IndexEntry {
+    uint32_t sec_id;
+    uint32_t n;
+    uint64_t offset;
+    uint64_t since;
+  };
+
+  struct File {
+    void Open(const std::string& path, size_t record_size) {
+      try {
+        mm.open(path);
+      } catch (const std::exception& e) {
+        LOG_ERROR("Failed to map indicator cache " << path << ": " << e.what());
+        return;
+      }
+      uint32_t h[3];
+      if (mm.size() < kHeaderSize || memcmp(mm.data(), "OTIC", 4)) return;
+      memcpy(h, mm.data() + 4, sizeof(h));
+      count = h[2];
+      ok = h[0] == kVersion && h[1] == record_size &&
+           mm.size() >= kHeaderSize + count * sizeof(IndexEntry);
+      index = reinterpret_cast<const IndexEntry*>(mm.data() + kHeaderSize);
+      for (auto i = 0u; ok && i < count; ++i)
+        ok = index[i].offset + index[i].n * record_size <= mm.size();
+      if (!ok) LOG_ERROR("Invalid indicator cache " << path);
+      data = mm.data();
+    }
+
+    boost::iostreams::mapped_file_source mm;
+    const char* data = nullptr;
+    const IndexEntry* index = nullptr;
+    uint32_t count = 0;
+    bool ok = false;
+  };
+
+  struct BufferBase {
+    virtual ~BufferBase() {}
+    virtual const char* data() const = 0;
+    virtual size_t size() const = 0;
+  };
+  template <typename T>
+  struct Buffer : public BufferBase {
+    std::vector<T> v;
+    const char* data() const override {
+      return reinterpret_cast<const char*>(v.data());
+    }
+    size_t size() const override { return v.size(); }
+  };
+
+  struct Writer {
+    uint32_t record_size = 0;
+    struct Series {
+      uint64_t since = 0;
+      std::unique_ptr<BufferBase> buf;
+    };
+    std::map<uint32_t, Series> series;
+  };
+
+  std::string Path(const std::string& key) const {
+    return dir_ + "/" + date_ + "/" + key;
+  }
+
+  // the mapped file of key, null if not cached
+  const File* Open(const std::string& key, size_t record_size) {
+    if (!enabled()) return nullptr;
+    auto& f = files_[key];
+    if (!f) {
+      f.reset(new File);
+      auto path = Path(key);
+      if (boost::filesystem::exists(path)) f->Open(path, record_size);
+    }
+    return f->ok ? f.get() : nullptr;
+  }
+
+  void Write(const std::string& key, const Writer& w) {
+    auto path = Path(key);
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(dir_ + "/" + date_, ec);
+    auto tmp = path + ".tmp." + std::to_string(getpid());
+    std::ofstream os(tmp, std::ofstream::binary | std::ofstream::trunc);
+    uint32_t count = w.series.size();
+    uint32_t h[3] = {kVersion, w.record_size, count};
+    os.write("OTIC", 4);
+    os.write(reinterpret_cast<const char*>(h), sizeof(h));
+    // the index and records 8-byte aligned for the mapped reads
+    uint64_t offset = kHeaderSize + count * sizeof(IndexEntry);
+    for (auto& pair : w.series) {
+      auto& s = pair.second;
+      IndexEntry e{pair.first, static_cast<uint32_t>(s.buf->size()), offset,
+                   s.since};
+      os.write(reinterpret_cast<const char*>(&e), sizeof(e));
+      offset += e.n * w.record_size;
+    }
+    for (auto& pair : w.series) {
+      auto& s = pair.second;
+      os.write(s.buf->data(), s.buf->size() * w.record_size);
+    }
+    os.close();
+    // the sweep workers of a date may write it at once, of the same content
+    if (os) boost::filesystem::rename(tmp, path, ec);
+    if (!os || ec) {
+      LOG_ERROR("Failed to write indicator cache " << path);
+      boost::filesystem::remove(tmp, ec);
+    }
+  }
+
+  const std::string dir_;
+  std::string date_;
+  std::unordered_map<std::string, std::unique_ptr<File>> files_;
+  std::unordered_map<std::string, Writer> writers_;
+};
+
+}  // namespace opentrade
+
+#endif  // BACKTEST
+#endif  // OPENTRADE_INDICATOR_CACHE_H_
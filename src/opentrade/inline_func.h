@@ -0,0 +1,85 @@
+#ifndef OPENTRADE_INLINE_FUNC_H_
+#define OPENTRADE_INLINE_FUNC_H_
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace opentrade {
+
+// Move-only void() callable, closures up to kInline bytes are stored in
+// place instead of on the heap.
+class InlineFunc {
+ public:
+  static inline const size_t kInline = 80;
+
+  InlineFunc() {}
+  template <typename F, typename = std::enable_if_t<!std::is_same_v<
+                            std::decay_t<F>, InlineFunc>>>
+  InlineFunc(F&& f) {  // NOLINT
+    typedef std::decay_t<F> T;
+    if constexpr (sizeof(T) <= kInline &&
+                  alignof(T) <= alignof(std::max_align_t) &&
+                  std::is_nothrow_move_constructible_v<T>) {
+      new (buf_) T(std::forward<F>(f));
+      ops_ = &kInlineOps<T>;
+    } else {
+      *reinterpret_cast<T**>(buf_) = new T(std::forward<F>(f));
+      ops_ = &kHeapOps<T>;
+    }
+  }
+  InlineFunc(InlineFunc&& b) noexcept { *this = std::move(b); }
+  InlineFunc& operator=(InlineFunc&& b) noexcept {
+    if (this == &b) return *this;
+    reset();
+    if (b.ops_) {
+      b.ops_->move(buf_, b.buf_);
+      ops_ = b.ops_;
+      b.ops_ = nullptr;
+    }
+    return *this;
+  }
+  InlineFunc(const InlineFunc&) = delete;
+  InlineFunc& operator=(const InlineFunc&) = delete;
+  ~InlineFunc() { reset(); }
+
+  void operator()() { ops_->call(buf_); }
+  explicit operator bool() const { return ops_; }
+  void reset() {
+    if (!ops_) return;
+    ops_->destroy(buf_);
+    ops_ = nullptr;
+  }
+
+ private:
+  struct Ops {
+    void (*call)(void*);
+    void (*move)(void* dst, void* src);  // and destroys src
+    void (*destroy)(void*);
+  };
+
+  template <typename T>
+  static inline const Ops kInlineOps = {
+      [](void* p) { (*static_cast<T*>(p))(); },
+      [](void* dst, void* src) {
+        new (dst) T(std::move(*static_cast<T*>(src)));
+        static_cast<T*>(src)->~T();
+      },
+      [](void* p) { static_cast<T*>(p)->~T(); }};
+
+  template <typename T>
+  static inline const Ops kHeapOps = {
+      [](void* p) { (**static_cast<T**>(p))(); },
+      [](void* dst, void* src) {
+        *static_cast<T**>(dst) = *static_cast<T**>(src);
+      },
+      [](void* p) { delete *static_cast<T**>(p); }};
+
+  alignas(std::max_align_t) char buf_[kInline];
+  const Ops* ops_ = nullptr;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_INLINE_FUNC_H_
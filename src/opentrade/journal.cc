@@ -0,0 +1,133 @@
+#include "journal.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/crc.hpp>
+#include <boost/range/iterator_range.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "logger.h"
+#include "utility.h"
+
+namespace fs = boost::filesystem;
+
+namespace opentrade {
+
+static const size_t kFrameHeader = 2 * sizeof(uint32_t);
+
+Journal::~Journal() { Close(); }
+
+void Journal::Close() {
+  if (fd_ < 0) return;
+  Flush();
+  ::close(fd_);
+  fd_ = -1;
+}
+
+void Journal::Open() { Open(false); }
+
+std::vector<fs::path> Journal::Roll() {
+  Close();
+  auto old = Segments();
+  Open(true);
+  old.erase(std::remove(old.begin(), old.end(), dir_ / segment_), old.end());
+  return old;
+}
+
+void Journal::Open(bool roll) {
+  Close();
+  auto t = GetTime();
+  struct tm tm;
+  localtime_r(&t, &tm);
+  char day[32];
+  // sorted after the segment of the day and before the next day's
+  strftime(day, sizeof(day), roll ? "%Y%m%d-%H%M%S" : "%Y%m%d", &tm);
+  tm.tm_sec = tm.tm_min = tm.tm_hour = 0;
+  tm.tm_mday += 1;
+  tm.tm_isdst = -1;
+  day_end_ = mktime(&tm);
+  segment_ = prefix_ + "-" + day;
+  auto path = dir_ / segment_;
+  fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd_ < 0) {
+    LOG_FATAL("Failed to write file: " << path.c_str() << ": "
+                                       << strerror(errno));
+  }
+  size_ = ::lseek(fd_, 0, SEEK_END);
+}
+
+uint64_t Journal::Append(std::initializer_list<std::string_view> parts) {
+  if (GetTime() >= day_end_) Open();
+  auto offset = size_ + buf_.size() + kFrameHeader;
+  boost::crc_32_type crc;
+  uint32_t size = 0;
+  for (auto& s : parts) {
+    crc.process_bytes(s.data(), s.size());
+    size += s.size();
+  }
+  uint32_t checksum = crc.checksum();
+  buf_.append(reinterpret_cast<const char*>(&size), sizeof(size));
+  buf_.append(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+  for (auto& s : parts) buf_.append(s.data(), s.size());
+  if (buf_.size() >= kMaxBuffer) Flush();
+  return offset;
+}
+
+void Journal::Flush() {
+  if (buf_.empty() || fd_ < 0) return;
+  auto p = buf_.data();
+  auto n = buf_.size();
+  while (n) {
+    auto rc = ::write(fd_, p, n);
+    if (rc < 0) {
+      if (errno == EINTR) continue;
+      LOG_FATAL("Failed to write journal " << prefix_ << ": "
+                                           << strerror(errno));
+    }
+    p += rc;
+    n -= rc;
+  }
+  size_ += buf_.size();
+  if (tap_) tap_(segment_, buf_);
+  buf_.clear();
+  if (fsync_ && fdatasync(fd_)) {
+    LOG_ERROR("Failed to sync journal " << prefix_ << ": " << strerror(errno));
+  }
+}
+
+std::vector<fs::path> Journal::Segments() const {
+  std::vector<fs::path> out;
+  if (!fs::is_directory(dir_)) return out;
+  auto prefix = prefix_ + "-";
+  for (auto& entry :
+       boost::make_iterator_range(fs::directory_iterator(dir_), {})) {
+    auto fn = entry.path().filename().string();
+    if (fn.size() > prefix.size() && !fn.compare(0, prefix.size(), prefix))
+      out.push_back(entry.path());
+  }
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+size_t Journal::Scan(const char* p, size_t n, std::vector<Record>* out) {
+  auto p0 = p;
+  auto p_end = p + n;
+  while (p + kFrameHeader <= p_end) {
+    uint32_t size;
+    uint32_t checksum;
+    memcpy(&size, p, sizeof(size));
+    memcpy(&checksum, p + sizeof(size), sizeof(checksum));
+    auto payload = p + kFrameHeader;
+    if (size > static_cast<size_t>(p_end - payload)) break;
+    boost::crc_32_type crc;
+    crc.process_bytes(payload, size);
+    if (crc.checksum() != checksum) break;
+    out->emplace_back(payload, size);
+    p = payload + size;
+  }
+  return p - p0;
+}
+
+}  // namespace opentrade
@@ -0,0 +1,66 @@
+#ifndef OPENTRADE_JOURNAL_H_
+#define OPENTRADE_JOURNAL_H_
+
+#include <boost/filesystem.hpp>
+#include <ctime>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace opentrade {
+
+// Append-only journal, one segment file "<prefix>-YYYYMMDD" per local day,
+// and "<prefix>-YYYYMMDD-HHMMSS" from a Roll on until the next day.
+// Each record is framed as [u32 size][u32 crc32 of payload][payload].
+// Append only buffers, Flush writes the buffer with one write call and
+// optionally fdatasync, so the caller decides the group commit boundary.
+// Not thread safe.
+class Journal {
+ public:
+  typedef std::string_view Record;
+
+  Journal(const boost::filesystem::path& dir, const std::string& prefix)
+      : dir_(dir), prefix_(prefix) {}
+  ~Journal();
+  void set_fsync(bool fsync) { fsync_ = fsync; }
+  void Open();
+  // onto a new segment from now, returns the segments before it, which are
+  // left to the caller, e.g. to archive
+  std::vector<boost::filesystem::path> Roll();
+  // payload is the concatenation of parts, returns its offset in segment()
+  uint64_t Append(std::initializer_list<std::string_view> parts);
+  const std::string& segment() const { return segment_; }
+  void Flush();
+  // called with the bytes of every write and the segment file name, e.g.
+  // to replicate them, set before the first Append
+  typedef std::function<void(const std::string&, std::string_view)> Tap;
+  void set_tap(Tap tap) { tap_ = std::move(tap); }
+
+  // sorted by day
+  std::vector<boost::filesystem::path> Segments() const;
+  // appends the valid records in [p, p + n) to out, returns the size of the
+  // valid prefix, which is less than n if the tail is torn or corrupted
+  static size_t Scan(const char* p, size_t n, std::vector<Record>* out);
+
+ private:
+  void Close();
+  void Open(bool roll);
+
+ private:
+  static inline const size_t kMaxBuffer = 1 << 20;
+  const boost::filesystem::path dir_;
+  const std::string prefix_;
+  bool fsync_ = false;
+  int fd_ = -1;
+  uint64_t size_ = 0;  // of the segment file
+  time_t day_end_ = 0;
+  std::string segment_;
+  std::string buf_;
+  Tap tap_;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_JOURNAL_H_
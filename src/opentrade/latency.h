@@ -0,0 +1,133 @@
+#ifndef OPENTRADE_LATENCY_H_
+#define OPENTRADE_LATENCY_H_
+
+#include <atomic>
+#include <cstdint>
+
+#include "clock.h"
+#include "common.h"
+#include "metrics.h"
+
+namespace opentrade {
+
+// Log linear buckets like HdrHistogram, kSubBits bits of precision (~3%),
+// lock free and cheap enough to record on every tick
+class LatencyHistogram {
+ public:
+  static inline const int kSubBits = 5;
+  static inline const uint64_t kSub = 1 << kSubBits;
+  static inline const int kBuckets = (65 - kSubBits) * kSub;
+
+  void Record(uint64_t v) {
+    counts_[Index(v)].fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(v, std::memory_order_relaxed);
+  }
+
+  uint64_t count() const {
+    uint64_t n = 0;
+    for (auto& c : counts_) n += c.load(std::memory_order_relaxed);
+    return n;
+  }
+
+  uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+
+  // highest value equivalent to the q-th quantile, 0 if empty
+  uint64_t Percentile(double q) const {
+    uint64_t counts[kBuckets];
+    uint64_t n = 0;
+    for (auto i = 0; i < kBuckets; ++i) {
+      counts[i] = counts_[i].load(std::memory_order_relaxed);
+      n += counts[i];
+    }
+    if (!n) return 0;
+    auto target = static_cast<uint64_t>(q * n + 0.5);
+    if (target < 1) target = 1;
+    uint64_t acc = 0;
+    for (auto i = 0; i < kBuckets; ++i) {
+      acc += counts[i];
+      if (acc >= target) return Highest(i);
+    }
+    return Highest(kBuckets - 1);
+  }
+
+  uint64_t max() const {
+    for (auto i = kBuckets - 1; i >= 0; --i) {
+      if (counts_[i].load(std::memory_order_relaxed)) return Highest(i);
+    }
+    return 0;
+  }
+
+  void Reset() {
+    for (auto& c : counts_) c.store(0, std::memory_order_relaxed);
+    sum_.store(0, std::memory_order_relaxed);
+  }
+
+  static int Index(uint64_t v) {
+    if (v < kSub) return v;
+    auto e = 63 - __builtin_clzll(v) - kSubBits;
+    return e * kSub + (v >> e);
+  }
+
+  static uint64_t Highest(int i) {
+    if (i < static_cast<int>(kSub)) return i;
+    auto e = i / kSub - 1;
+    return ((i % kSub + kSub) << e) + (1lu << e) - 1;
+  }
+
+ private:
+  std::atomic<uint64_t> counts_[kBuckets] = {};
+  std::atomic<uint64_t> sum_ = 0;
+};
+
+// Tick to order latencies, in nanoseconds since the tick was published to
+// AlgoManager::Update. A runner dispatches with the oldest tick coalesced
+// into the dirty security, orders placed meanwhile carry it as origin.
+class TickLatency : public Singleton<TickLatency> {
+ public:
+  enum Stage {
+    kDispatch,  // runner starts the algos' callbacks
+    kPlace,     // Algo::Place
+    kRisk,      // RiskManager::Check passed
+    kSend,      // adapter Place returned
+    kNumStages,
+  };
+
+  TickLatency() {
+    for (auto i = 0; i < kNumStages; ++i) {
+      auto s = static_cast<Stage>(i);
+      Metrics::Instance().AddSummary(
+          "opentrade_tick_latency_seconds", "Tick to order latency by stage",
+          Metrics::Label("stage", Name(s)), &hists_[i]);
+    }
+  }
+
+  static uint64_t Now() { return FineClock::Now(); }
+
+  static const char* Name(Stage s) {
+    static const char* kNames[] = {"dispatch", "place", "risk", "send"};
+    return kNames[s];
+  }
+
+  void Record(Stage s, uint64_t origin) {
+    if (!origin) return;
+    auto now = Now();
+    hists_[s].Record(now > origin ? now - origin : 0);
+  }
+
+  const LatencyHistogram& Get(Stage s) const { return hists_[s]; }
+
+  void Clear() {
+    for (auto& h : hists_) h.Reset();
+  }
+
+  // origin of the market data the current runner thread is dispatching,
+  // 0 for timers and other callbacks
+  static inline thread_local uint64_t kOrigin = 0;
+
+ private:
+  LatencyHistogram hists_[kNumStages];
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_LATENCY_H_
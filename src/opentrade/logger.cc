@@ -0,0 +1,53 @@
+#include "logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+namespace opentrade {
+
+void AsyncLogger::Start() {
+  if (kStarted.exchange(true)) return;
+  std::thread([]() {
+    for (;;) {
+      if (!Drain()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }).detach();
+}
+
+void AsyncLogger::Flush() {
+  if (kStarted.load(std::memory_order_acquire)) Drain();
+}
+
+size_t AsyncLogger::Drain() {
+  std::lock_guard<std::mutex> lock(kDrainMutex);
+  std::vector<std::shared_ptr<Ring>> rings;
+  {
+    std::lock_guard<std::mutex> lock2(kRingsMutex);
+    rings = kRings;
+  }
+  auto n = 0u;
+  for (auto& r : rings) {
+    auto head = r->head.load(std::memory_order_relaxed);
+    auto tail = r->tail.load(std::memory_order_acquire);
+    for (; head != tail; ++head) {
+      auto& e = r->entries[head % Ring::kSize];
+      Logger::logger->forcedLog(e.level, e.msg);
+      e.msg.clear();
+      r->head.store(head + 1, std::memory_order_release);
+      ++n;
+    }
+  }
+  rings.clear();
+  // the rings of exited threads
+  std::lock_guard<std::mutex> lock2(kRingsMutex);
+  kRings.erase(std::remove_if(kRings.begin(), kRings.end(),
+                              [](auto& r) {
+                                return r.use_count() == 1 &&
+                                       r->head.load() == r->tail.load();
+                              }),
+               kRings.end());
+  return n;
+}
+
+}  // namespace opentrade
@@ -5,6 +5,19 @@
 #include <log4cxx/logger.h>
 #include <log4cxx/propertyconfigurator.h>
 #include <unistd.h>
+#include <atomic>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// lowest level compiled in, the arguments of lower ones are not evaluated
+// 0 trace, 1 debug, 2 info, 3 warn, 4 error
+#ifndef OPENTRADE_LOG_LEVEL
+#define OPENTRADE_LOG_LEVEL 0
+#endif
 
 namespace opentrade {
 
@@ -28,6 +41,111 @@ class Logger {
   inline static std::string config_file;
 };
 
+// LOG_* lines are formatted on the calling thread into a reused buffer and
+// queued on a ring of the thread, a background thread hands them to the
+// log4cxx appenders so that the caller never waits on file or console
+// output. Until Start, and if the ring is full, lines go to log4cxx
+// directly.
+class AsyncLogger {
+ public:
+  static void Start();
+  // appends the queued lines, e.g. before exiting
+  static void Flush();
+
+  // buffer of one line, a line logged while formatting gets its own
+  class Line {
+   public:
+    Line() {
+      if (kDepth == kStreams.size())
+        kStreams.emplace_back(new std::ostringstream);
+      os_ = kStreams[kDepth++].get();
+      os_->str({});
+    }
+    ~Line() { --kDepth; }
+    std::ostream& os() { return *os_; }
+    std::string str() const { return os_->str(); }
+
+   private:
+    static inline thread_local std::vector<std::unique_ptr<std::ostringstream>>
+        kStreams;
+    static inline thread_local size_t kDepth = 0;
+    std::ostringstream* os_;
+  };
+
+  static void Log(const log4cxx::LevelPtr& level, std::string&& msg) {
+    if (kStarted.load(std::memory_order_acquire)) {
+      auto& r = GetRing();
+      auto tail = r.tail.load(std::memory_order_relaxed);
+      if (tail - r.head.load(std::memory_order_acquire) < Ring::kSize) {
+        auto& e = r.entries[tail % Ring::kSize];
+        e.level = level;
+        e.msg = std::move(msg);
+        r.tail.store(tail + 1, std::memory_order_release);
+        return;
+      }
+    }
+    Logger::logger->forcedLog(level, msg);
+  }
+
+ private:
+  struct Entry {
+    log4cxx::LevelPtr level;
+    std::string msg;
+  };
+  // single producer, the owner thread, single consumer under kDrainMutex
+  struct Ring {
+    static inline const size_t kSize = 1 << 12;
+    Entry entries[kSize];
+    std::atomic<size_t> head = 0;
+    std::atomic<size_t> tail = 0;
+  };
+  static Ring& GetRing() {
+    static thread_local std::shared_ptr<Ring> kRing;
+    if (!kRing) {
+      kRing = std::make_shared<Ring>();
+      std::lock_guard<std::mutex> lock(kRingsMutex);
+      kRings.push_back(kRing);
+    }
+    return *kRing;
+  }
+  static size_t Drain();
+
+  static inline std::atomic<bool> kStarted = false;
+  static inline std::mutex kRingsMutex;
+  static inline std::vector<std::shared_ptr<Ring>> kRings;
+  static inline std::mutex kDrainMutex;
+};
+
+// state of one LOG_EVERY_N or LOG_RATE_LIMITED call site
+class LogLimiter {
+ public:
+  bool Every(uint64_t n) {
+    return seen_.fetch_add(1, std::memory_order_relaxed) % n == 0;
+  }
+
+  // at most n lines a second, *suppressed gets the lines dropped since the
+  // last one let through
+  bool Allow(uint32_t n, uint64_t* suppressed) {
+    auto now = std::time(nullptr);
+    auto sec = sec_.load(std::memory_order_relaxed);
+    if (now != sec &&
+        sec_.compare_exchange_strong(sec, now, std::memory_order_relaxed))
+      count_.store(0, std::memory_order_relaxed);
+    if (count_.fetch_add(1, std::memory_order_relaxed) >= n) {
+      suppressed_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    *suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+    return true;
+  }
+
+ private:
+  std::atomic<uint64_t> seen_ = 0;
+  std::atomic<time_t> sec_ = 0;
+  std::atomic<uint32_t> count_ = 0;
+  std::atomic<uint64_t> suppressed_ = 0;
+};
+
 inline const char* kDefaultLogConf = R"(
 log4j.rootLogger=debug, stdout_debug
 log4j.logger.opentrade=debug, stdout, opentrade
@@ -88,14 +206,64 @@ log4j.appender.sql.layout.ConversionPattern=%d{yyyy-MM-dd HH:mm:ss,SSS} %5p - %m
   LOG4CXX_ERROR(opentrade::Logger::logger, opentrade::GetNowStr() \
                                                << " - " << msg)
 #else
-#define LOG_TRACE(msg) LOG4CXX_TRACE(opentrade::Logger::logger, msg)
-#define LOG_DEBUG(msg) LOG4CXX_DEBUG(opentrade::Logger::logger, msg)
-#define LOG_INFO(msg) LOG4CXX_INFO(opentrade::Logger::logger, msg)
-#define LOG_WARN(msg) LOG4CXX_WARN(opentrade::Logger::logger, msg)
-#define LOG_ERROR(msg) LOG4CXX_ERROR(opentrade::Logger::logger, msg)
+#define LOG_ASYNC(level, msg)                                       \
+  do {                                                              \
+    if (opentrade::Logger::logger->is##level##Enabled()) {          \
+      opentrade::AsyncLogger::Line _line;                           \
+      _line.os() << msg;                                            \
+      opentrade::AsyncLogger::Log(log4cxx::Level::get##level(),     \
+                                  _line.str());                     \
+    }                                                               \
+  } while (0)
+#define LOG_TRACE(msg) LOG_ASYNC(Trace, msg)
+#define LOG_DEBUG(msg) LOG_ASYNC(Debug, msg)
+#define LOG_INFO(msg) LOG_ASYNC(Info, msg)
+#define LOG_WARN(msg) LOG_ASYNC(Warn, msg)
+#define LOG_ERROR(msg) LOG_ASYNC(Error, msg)
 #endif
+
+#define LOG_NOTHING(msg) \
+  do {                   \
+  } while (0)
+#if OPENTRADE_LOG_LEVEL > 0
+#undef LOG_TRACE
+#define LOG_TRACE(msg) LOG_NOTHING(msg)
+#endif
+#if OPENTRADE_LOG_LEVEL > 1
+#undef LOG_DEBUG
+#define LOG_DEBUG(msg) LOG_NOTHING(msg)
+#endif
+#if OPENTRADE_LOG_LEVEL > 2
+#undef LOG_INFO
+#define LOG_INFO(msg) LOG_NOTHING(msg)
+#endif
+#if OPENTRADE_LOG_LEVEL > 3
+#undef LOG_WARN
+#define LOG_WARN(msg) LOG_NOTHING(msg)
+#endif
+
+// the first of every n lines of the call site, e.g. LOG_EVERY_N(INFO, 100, x)
+#define LOG_EVERY_N(level, n, msg)           \
+  do {                                       \
+    static opentrade::LogLimiter _limiter;   \
+    if (_limiter.Every(n)) LOG_##level(msg); \
+  } while (0)
+
+// at most n lines a second of the call site, the count suppressed appended
+#define LOG_RATE_LIMITED(level, n, msg)                              \
+  do {                                                               \
+    static opentrade::LogLimiter _limiter;                           \
+    uint64_t _suppressed;                                            \
+    if (_limiter.Allow(n, &_suppressed)) {                           \
+      if (_suppressed)                                               \
+        LOG_##level(msg << " (" << _suppressed << " suppressed)");   \
+      else                                                           \
+        LOG_##level(msg);                                            \
+    }                                                                \
+  } while (0)
 #define LOG_FATAL(msg)                                             \
   {                                                                \
+    opentrade::AsyncLogger::Flush();                               \
     LOG4CXX_FATAL(opentrade::Logger::logger, msg);                 \
     /* to-do: safe exit */                                         \
     if (system(("kill -9 " + std::to_string(getpid())).c_str())) { \
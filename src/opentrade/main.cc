@@ -4,26 +4,40 @@
 #include <boost/property_tree/ini_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <thread>
+#include <vector>
 
 #include "account.h"
 #include "algo.h"
+#include "algos/builtin.h"
 #include "backtest.h"
 #include "bar_handler.h"
 #include "commission.h"
+#include "consolidated_trade.h"
 #include "consolidation.h"
+#include "cross_engine.h"
 #include "database.h"
+#include "day_roll.h"
 #include "exchange_connectivity.h"
+#include "fx_rate.h"
 #include "logger.h"
 #include "market_data.h"
+#include "numa.h"
 #include "opentick.h"
 #include "position.h"
 #include "python.h"
+#include "replication.h"
 #include "risk.h"
+#include "rolling_volume.h"
 #include "security.h"
 #include "server.h"
+#include "sharding.h"
 #include "stop_book.h"
+#include "tca.h"
 #include "test_latency.h"
+#include "thread_placement.h"
 
 namespace bpo = boost::program_options;
 namespace fs = boost::filesystem;
@@ -35,24 +49,73 @@ using opentrade::kStorePath;
 using opentrade::MarketDataManager;
 using opentrade::PositionManager;
 
+// the adapters connect on Start, each on its own thread
+template <typename Adapters>
+static void StartAll(const Adapters &adapters) {
+  std::vector<std::thread> threads;
+  for (auto &p : adapters) {
+    auto adapter = p.second;
+    threads.emplace_back([adapter]() { adapter->Start(); });
+  }
+  for (auto &t : threads) t.join();
+}
+
 int main(int argc, char *argv[]) {
   std::string config_file_path;
   std::string log_config_file_path;
   std::string db_url;
   std::string opentick_url;
+  auto opentick_cache_size = 100000u;
   uint16_t db_pool_size = 1;
   auto db_create_tables = false;
   auto db_alter_tables = false;
   auto algo_threads = 0;
+  auto tca_markout_seconds = 60.;
+  std::string fx_home_currency;
 #ifdef BACKTEST
   std::string backtest_file;
   std::string tick_file;
   auto start_date = 0u;
   auto end_date = 0u;
+  auto workers = 1;
+  auto warmup_days = 0;
 #else
   auto io_threads = 0;
   auto port = 0;
   auto disable_rms = true;
+  auto journal_fsync = false;
+  auto cross_interval = 0.;
+  auto cross_threads = 1;
+  auto async_log = true;
+  auto md_unsubscribe_grace = 300.;
+  auto md_rate_interval = 60.;
+  std::string algo_busy_poll;
+  auto algo_busy_poll_idle = 1000;
+  auto algo_gc_interval = 600.;
+  auto algo_status_window = 0.2;
+  auto algo_lag_warn = 0.1;
+  auto algo_lag_shed = 0.02;
+  std::string md_rebalance_time;
+  std::string md_bus;
+  auto md_bus_capacity = 1u << 18;
+  auto md_bus_ring_size = 1u << 16;
+  std::string record_ticks;
+  std::string opentick_prefetch;
+  std::string opentick_prefetch_universe;
+  auto opentick_prefetch_days = 20;
+  std::string opentick_prefetch_time;
+  uint16_t replication_port = 0;
+  std::string replication_primary;
+  auto replication_timeout = 3.;
+  auto shard = 0;
+  std::string shard_nodes;
+  uint16_t shard_risk_port = 0;
+  std::string shard_risk_server;
+  auto shard_risk_interval = 1.;
+  auto position_history_days = 2;
+  std::string huge_pages;
+  auto huge_pages_reserve = 0u;
+  std::string store_roll_time;
 #endif
   try {
     bpo::options_description config("Configuration");
@@ -69,7 +132,12 @@ int main(int argc, char *argv[]) {
             "start_date,s", bpo::value<uint32_t>(&start_date),
             "start date, in 'YYYYmmdd' format")(
             "end_date,e", bpo::value<uint32_t>(&end_date),
-            "end date inclusively, in 'YYYYmmdd' format")
+            "end date inclusively, in 'YYYYmmdd' format")(
+            "workers,w", bpo::value<int>(&workers)->default_value(1),
+            "number of worker processes, over date shards or sweep configs")(
+            "warmup_days",
+            bpo::value<int>(&warmup_days)->default_value(0),
+            "days replayed before each shard to carry positions into it")
 #else
         ("db_create_tables",
          bpo::value<bool>(&db_create_tables)->default_value(false),
@@ -85,8 +153,116 @@ int main(int argc, char *argv[]) {
             "number of web server io threads")(
             "algo_threads", bpo::value<int>(&algo_threads)->default_value(1),
             "number of algo threads")(
+            "algo_busy_poll", bpo::value<std::string>(&algo_busy_poll),
+            "algo runners to busy poll instead of sleeping, comma separated "
+            "indices or \"all\"")(
+            "algo_busy_poll_idle",
+            bpo::value<int>(&algo_busy_poll_idle)->default_value(1000),
+            "microseconds a busy polling runner spins idle before sleeping")(
+            "algo_gc_interval",
+            bpo::value<double>(&algo_gc_interval)->default_value(600),
+            "seconds between compactions of finished algos, 0 to disable")(
+            "algo_status_window",
+            bpo::value<double>(&algo_status_window)->default_value(0.2),
+            "seconds the status updates of an algo are coalesced over, the "
+            "latest kept, 0 to persist every one")(
+            "algo_lag_warn",
+            bpo::value<double>(&algo_lag_warn)->default_value(0.1),
+            "seconds of market data dispatch lag alerted on, 0 to disable")(
+            "algo_lag_shed",
+            bpo::value<double>(&algo_lag_shed)->default_value(0.02),
+            "seconds of market data dispatch lag over which a runner gives "
+            "way to timers and confirmations, 0 to disable")(
             "disable_rms", bpo::value<bool>(&disable_rms)->default_value(false),
-            "whether disable rms")
+            "whether disable rms")(
+            "journal_fsync",
+            bpo::value<bool>(&journal_fsync)->default_value(false),
+            "fdatasync confirmation journal on every group commit")(
+            "cross_interval",
+            bpo::value<double>(&cross_interval)->default_value(0),
+            "seconds between batch crossing sessions, 0 to cross on arrival")(
+            "cross_threads",
+            bpo::value<int>(&cross_threads)->default_value(1),
+            "number of threads crossing securities in batch sessions")(
+            "async_log", bpo::value<bool>(&async_log)->default_value(true),
+            "append log lines on a background thread")(
+            "md_unsubscribe_grace",
+            bpo::value<double>(&md_unsubscribe_grace)->default_value(300),
+            "seconds a feed stays subscribed after the last watcher is gone, "
+            "0 to never unsubscribe")(
+            "md_rate_interval",
+            bpo::value<double>(&md_rate_interval)->default_value(60),
+            "seconds between samples of the market data update rates, "
+            "0 to disable")(
+            "md_rebalance_time",
+            bpo::value<std::string>(&md_rebalance_time),
+            "HH:MM:SS local time to rebalance the securities across the "
+            "market data adapters of one route daily, empty to never")(
+            "md_bus", bpo::value<std::string>(&md_bus),
+            "shared memory name prefix to publish market data to other "
+            "processes, e.g. /opentrade_md_, empty to disable")(
+            "md_bus_capacity",
+            bpo::value<uint32_t>(&md_bus_capacity)->default_value(1u << 18),
+            "maximum security id + 1 on the market data bus")(
+            "md_bus_ring_size",
+            bpo::value<uint32_t>(&md_bus_ring_size)->default_value(1u << 16),
+            "updates kept for the readers of the market data bus, power of 2")(
+            "record_ticks", bpo::value<std::string>(&record_ticks),
+            "directory to record the live feeds into daily binary tick "
+            "files for backtest, empty to disable")(
+            "opentick_prefetch", bpo::value<std::string>(&opentick_prefetch),
+            "comma separated table:interval of opentick to prefetch daily, "
+            "e.g. bar:60, empty to disable")(
+            "opentick_prefetch_universe",
+            bpo::value<std::string>(&opentick_prefetch_universe),
+            "comma separated exchange or security names to prefetch")(
+            "opentick_prefetch_days",
+            bpo::value<int>(&opentick_prefetch_days)->default_value(20),
+            "calendar days before today to prefetch")(
+            "opentick_prefetch_time",
+            bpo::value<std::string>(&opentick_prefetch_time)
+                ->default_value("09:00:00"),
+            "HH:MM:SS local time to prefetch, before the open")(
+            "replication_port",
+            bpo::value<uint16_t>(&replication_port)->default_value(0),
+            "port to serve the hot standbys on, 0 to disable")(
+            "replication_primary",
+            bpo::value<std::string>(&replication_primary),
+            "host:port of the primary to run as a hot standby of, empty if "
+            "not a standby")(
+            "replication_timeout",
+            bpo::value<double>(&replication_timeout)->default_value(3),
+            "seconds of silence of the primary before the standby takes over")(
+            "shard", bpo::value<int>(&shard)->default_value(0),
+            "index of this node in shard_nodes, it owns the sub accounts of "
+            "id % number of shards == shard")(
+            "shard_nodes", bpo::value<std::string>(&shard_nodes),
+            "comma separated web addresses of all the shards in order, empty "
+            "for one node owning all")(
+            "shard_risk_port",
+            bpo::value<uint16_t>(&shard_risk_port)->default_value(0),
+            "port to serve the risk aggregation of shards on, 0 to disable")(
+            "shard_risk_server", bpo::value<std::string>(&shard_risk_server),
+            "host:port of the risk aggregation service")(
+            "position_history_days",
+            bpo::value<int>(&position_history_days)->default_value(2),
+            "days of position rows held in memory for the trades view, 0 to "
+            "always read the database")(
+            "shard_risk_interval",
+            bpo::value<double>(&shard_risk_interval)->default_value(1),
+            "seconds between the usage reports to the risk aggregation "
+            "service")(
+            "huge_pages", bpo::value<std::string>(&huge_pages),
+            "2m or 1g to back the market data, pools and runner arenas with "
+            "huge pages of the size, falling back to transparent ones, empty "
+            "to disable")(
+            "huge_pages_reserve",
+            bpo::value<uint32_t>(&huge_pages_reserve)->default_value(0),
+            "MB of huge pages mapped and prefaulted at startup")(
+            "store_roll_time", bpo::value<std::string>(&store_roll_time),
+            "HH:MM:SS local time to roll the confirmation journal and the "
+            "algo store daily onto the live orders and algos, archiving the "
+            "rest, empty to never")
 #endif
             ("config_file,c",
              bpo::value<std::string>(&config_file_path)
@@ -98,7 +274,18 @@ int main(int argc, char *argv[]) {
                 "db_url", bpo::value<std::string>(&db_url),
                 "database connection url")(
                 "opentick", bpo::value<std::string>(&opentick_url),
-                "opentick connection url");
+                "opentick connection url")(
+                "opentick_cache_size",
+                bpo::value<uint32_t>(&opentick_cache_size)
+                    ->default_value(100000),
+                "security days of opentick bars cached in memory")(
+                "tca_markout_seconds",
+                bpo::value<double>(&tca_markout_seconds)->default_value(60),
+                "seconds after a fill its markout is taken at, 0 to disable")(
+                "fx_home_currency",
+                bpo::value<std::string>(&fx_home_currency),
+                "currency the security rates are of, derived live from the "
+                "currency pairs' ticks if given, e.g. USD");
 
     bpo::options_description config_file_options;
     config_file_options.add(config);
@@ -136,6 +323,18 @@ int main(int argc, char *argv[]) {
   }
 
   opentrade::Logger::Initialize("opentrade", log_config_file_path);
+#ifndef BACKTEST
+  if (async_log) opentrade::AsyncLogger::Start();
+  // before the stores load, the data allocated from now on is of them
+  if (!huge_pages.empty()) {
+    if (huge_pages != "1g" && huge_pages != "2m") {
+      LOG_FATAL("Invalid huge_pages " << huge_pages << ", expect 2m or 1g");
+    }
+    opentrade::HugePages::Instance().Initialize(
+        huge_pages == "1g" ? 1lu << 30 : 2lu << 20,
+        static_cast<size_t>(huge_pages_reserve) << 20);
+  }
+#endif
 
   if (db_url.empty()) {
     LOG_ERROR("db_url not configured");
@@ -144,6 +343,7 @@ int main(int argc, char *argv[]) {
   opentrade::Database::Initialize(db_url, db_pool_size, db_create_tables,
                                   db_alter_tables);
   opentrade::SecurityManager::Initialize();
+  opentrade::TcaManager::Instance().set_markout_seconds(tca_markout_seconds);
 
 #ifdef BACKTEST
   if (backtest_file.empty()) {
@@ -176,6 +376,10 @@ int main(int argc, char *argv[]) {
       boost::to_lower(name);
       params[name] = item.second.data();
     }
+    if (section_name == "threads") {
+      opentrade::ThreadPlacement::Instance().Load(params);
+      continue;
+    }
     auto sofile = params["sofile"];
     if (sofile.empty()) continue;
     params.erase("sofile");
@@ -214,14 +418,40 @@ int main(int argc, char *argv[]) {
   ExchangeConnectivityManager::Instance().AddAdapter(
       new opentrade::TestLatencyEc);
   MarketDataManager::Instance().AddAdapterTmpl<opentrade::TestLatencyMd>();
+  AlgoManager::Instance().AddAdapterTmpl<opentrade::TestLatencyLoad>();
   AlgoManager::Instance().AddAdapterTmpl<opentrade::TestlatencyAlgo>();
 #endif
 
-  AlgoManager::Initialize();
+  // the stores load concurrently where independent: the algo store and the
+  // stop book alongside the accounts, then the BODs and then the
+  // confirmations replayed onto them
+  auto algo_store = std::async(std::launch::async, AlgoManager::Initialize);
   opentrade::AccountManager::Initialize();
-  opentrade::StopBookManager::Initialize();
-  PositionManager::Initialize();
-  opentrade::GlobalOrderBook::Initialize();
+#ifndef BACKTEST
+  opentrade::ShardManager::Instance().Initialize(shard, shard_nodes);
+  if (shard_risk_port) {
+    opentrade::ShardManager::Instance().Serve(shard_risk_port);
+  }
+  if (!shard_risk_server.empty()) {
+    opentrade::ShardManager::Instance().Report(shard_risk_server,
+                                               shard_risk_interval);
+  }
+#endif
+  auto stop_book = std::async(std::launch::async,
+                              opentrade::StopBookManager::Initialize);
+  PositionManager::Initialize(position_history_days);
+  opentrade::GlobalOrderBook::Initialize(journal_fsync);
+  stop_book.get();
+  algo_store.get();
+  opentrade::CrossEngine::Instance().Start(cross_interval, cross_threads);
+  MarketDataManager::Instance().set_unsubscribe_grace(md_unsubscribe_grace);
+  MarketDataManager::Instance().StartBalancing(md_rate_interval,
+                                               md_rebalance_time);
+  if (!md_bus.empty())
+    MarketDataManager::Instance().StartBus(md_bus, md_bus_capacity,
+                                           md_bus_ring_size);
+  if (!record_ticks.empty())
+    MarketDataManager::Instance().StartRecorder(record_ticks);
 
   if (disable_rms) {
     LOG_INFO("rms disabled");
@@ -261,26 +491,69 @@ int main(int argc, char *argv[]) {
       }
     }
   }
+  opentrade::AddBuiltinAlgos();
 
-  if (opentick_url.size())
+  if (opentick_url.size()) {
+    opentrade::OpenTick::Instance().set_cache_size(opentick_cache_size);
     opentrade::OpenTick::Instance().Initialize(opentick_url);
+#ifndef BACKTEST
+    opentrade::OpenTick::Instance().StartPrefetch(
+        opentick_prefetch_universe, opentick_prefetch, opentick_prefetch_days,
+        opentick_prefetch_time);
+#endif
+  }
 
 #ifndef BACKTEST
   AlgoManager::Instance().AddAdapterTmpl<opentrade::BarHandler<>>();
+  AlgoManager::Instance().AddAdapterTmpl<opentrade::MultiBarHandler>();
   AlgoManager::Instance().AddAdapterTmpl<opentrade::ConsolidationHandler>();
+  AlgoManager::Instance()
+      .AddAdapterTmpl<opentrade::ConsolidatedTradeHandler>();
+  AlgoManager::Instance().AddAdapterTmpl<opentrade::RollingVolumeHandler>();
 #endif
 
+  auto &placement = opentrade::ThreadPlacement::Instance();
+  placement.Apply(&opentrade::kTimerTaskPool, "timer");
+  placement.Apply(&opentrade::kWriteTaskPool, "write");
+  placement.Apply(&opentrade::kDatabaseTaskPool, "database");
   for (auto &p : MarketDataManager::Instance().adapters()) {
-    p.second->Start();
+    placement.Apply(&p.second->tp(), p.first, "adapters");
+    auto node = placement.Node(p.first, -1, "adapters");
+    if (node >= 0) p.second->md().set_node(node);
   }
   for (auto &p : ExchangeConnectivityManager::Instance().adapters()) {
-    p.second->Start();
+    placement.Apply(&p.second->tp(), p.first, "adapters");
+  }
+
+  StartAll(MarketDataManager::Instance().adapters());
+#ifndef BACKTEST
+  opentrade::FxRateManager::Instance().Initialize(fx_home_currency);
+  // a standby blocks here until it takes over, then serves its own standbys
+  if (!replication_primary.empty()) {
+    opentrade::Replication::Instance().Follow(replication_primary,
+                                              replication_timeout);
   }
+  if (replication_port) {
+    opentrade::Replication::Instance().Listen(replication_port);
+  }
+  opentrade::DayRoll::Instance().Start(store_roll_time);
+  opentrade::SecurityManager::Instance().WatchChanges(
+      []() { opentrade::Server::Trigger(R"(["securities"])"); });
+#endif
+  StartAll(ExchangeConnectivityManager::Instance().adapters());
   for (auto &p : AlgoManager::Instance().adapters()) {
     p.second->Start();
   }
 
+#ifndef BACKTEST
+  AlgoManager::Instance().SetBusyPoll(algo_busy_poll, algo_busy_poll_idle);
+  AlgoManager::Instance().set_status_window(algo_status_window);
+  opentrade::AlgoRunner::SetLagThresholds(algo_lag_warn, algo_lag_shed);
+#endif
   AlgoManager::Instance().Run(algo_threads);
+#ifndef BACKTEST
+  AlgoManager::Instance().StartCompaction(algo_gc_interval);
+#endif
 
 #ifdef BACKTEST
   auto &bt = opentrade::Backtest::Instance();
@@ -289,11 +562,10 @@ int main(int argc, char *argv[]) {
                             start_date % 100);
   boost::gregorian::date end(end_date / 10000, end_date % 10000 / 100,
                              end_date % 100);
-  while (dt <= end) {
-    bt.Play(dt);
-    dt += boost::gregorian::date_duration(1);
-  }
-  bt.End();
+  if (bt.sweeping())
+    bt.Sweep(dt, end, workers);
+  else
+    bt.Run(dt, end, workers, warmup_days);
 #else
   if (!MarketDataManager::Instance().GetDefault()) {
     LOG_FATAL("At least one market data adapter required");
@@ -302,12 +574,16 @@ int main(int argc, char *argv[]) {
 #ifdef TEST_LATENCY
   while (true) sleep(1);
 #endif
-  // wait for some time to get last price updated
-  // to-do: update last price from opentick
+  // the first pnl once the positions are priced, waiting UPDATE_PNL_WAIT
+  // seconds at most, then every UPDATE_PNL_INTERVAL seconds, e.g. 0.1
   auto wait = getenv("UPDATE_PNL_WAIT");
-  opentrade::kTimerTaskPool.AddTask(
-      []() { PositionManager::Instance().UpdatePnl(); },
-      boost::posix_time::seconds(wait ? atoi(wait) : 15));
+  auto interval = getenv("UPDATE_PNL_INTERVAL");
+  PositionManager::Instance().StartPnl(wait ? atoi(wait) : 15,
+                                       interval ? atof(interval) : 1);
+  // configs retired while a reader was inside, see Rcu::Retire
+  opentrade::kTimerTaskPool.RepeatTask([]() { opentrade::Rcu::Reclaim(); },
+                                       boost::posix_time::seconds(1),
+                                       boost::posix_time::seconds(1));
   opentrade::Server::Start(port, io_threads);
 #endif
 
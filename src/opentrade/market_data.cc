@@ -1,17 +1,36 @@
 #include "market_data.h"
 
+#include <algorithm>
+#include <unordered_map>
+
 #include "algo.h"
 #include "logger.h"
+#include "md_bus.h"
+#include "metrics.h"
+#include "tick_recorder.h"
+#include "order_book.h"
+#include "pool.h"
 #include "utility.h"
 
 namespace opentrade {
 
-inline MarketDataAdapter* MarketDataManager::GetRoute(const Security& sec,
-                                                      DataSrc::IdType src) {
+inline const std::vector<MarketDataAdapter*>* MarketDataManager::FindRoute(
+    const Security& sec, DataSrc::IdType src) {
   auto it = routes_.find(std::make_pair(src, sec.exchange->id));
   if (it == routes_.end() && src) it = routes_.find(std::make_pair(src, 0));
-  return it == routes_.end() ? default_
-                             : it->second[sec.id % it->second.size()];
+  return it == routes_.end() ? nullptr : &it->second;
+}
+
+// static split by id on first use, then as Rebalance decides
+inline MarketDataAdapter* MarketDataManager::GetRoute(const Security& sec,
+                                                      DataSrc::IdType src) {
+  auto& a = assignments_[std::make_pair(src, sec.id)];
+  MarketDataAdapter* adapter = a.adapter;
+  if (adapter) return adapter;
+  auto route = FindRoute(sec, src);
+  auto tmp = route ? (*route)[sec.id % route->size()] : default_;
+  adapter = a.adapter.compare_and_swap(tmp, nullptr);
+  return adapter ? adapter : tmp;
 }
 
 MarketDataAdapter* MarketDataManager::Subscribe(const Security& sec,
@@ -21,16 +40,47 @@ MarketDataAdapter* MarketDataManager::Subscribe(const Security& sec,
   return adapter;
 }
 
+void MarketDataManager::Subscribe(const std::vector<const Security*>& secs,
+                                  DataSrc::IdType src) {
+  std::unordered_map<MarketDataAdapter*, std::vector<const Security*>> batches;
+  for (auto sec : secs) batches[GetRoute(*sec, src)].push_back(sec);
+  for (auto& pair : batches) pair.first->SubscribeBatch(pair.second);
+}
+
+void MarketDataAdapter::SubscribeBatch(const Security* const* secs,
+                                       size_t n) {
+  for (auto i = 0u; i < n; ++i) sub_vers_[secs[i]->id]++;
+  bool first;
+  {
+    std::lock_guard<std::mutex> lock(pending_subs_m_);
+    first = pending_subs_.empty();
+    pending_subs_.insert(pending_subs_.end(), secs, secs + n);
+  }
+  if (first) tp_.AddTask([this]() { FlushSubscribes(); });
+}
+
+void MarketDataAdapter::FlushSubscribes() {
+  std::vector<const Security*> secs;
+  {
+    std::lock_guard<std::mutex> lock(pending_subs_m_);
+    secs.swap(pending_subs_);
+  }
+  auto n = 0u;
+  for (auto sec : secs) {
+    if (subs_.insert(sec).second) secs[n++] = sec;
+  }
+  secs.resize(n);
+  if (secs.empty() || !connected()) return;
+  SubscribeBatchSync(secs);
+}
+
 const MarketData& MarketDataManager::Get(const Security& sec,
                                          DataSrc::IdType src) {
   auto adapter = GetRoute(sec, src);
-  auto md = adapter->md_;
-  auto it = md->find(sec.id);
-  if (it == md->end()) {
-    adapter->Subscribe(sec);
-    return (*md)[sec.id];
-  }
-  return it->second;
+  auto md = adapter->md_->Find(sec.id);
+  if (md) return *md;
+  adapter->Subscribe(sec);
+  return (*adapter->md_)[sec.id];
 }
 
 const MarketData& MarketDataManager::GetLite(Security::IdType id,
@@ -41,6 +91,188 @@ const MarketData& MarketDataManager::GetLite(Security::IdType id,
   return it->second[id];
 }
 
+void MarketDataManager::AddRef(const Security& sec, DataSrc::IdType src) {
+  refs_[std::make_pair(src, sec.id)]++;
+  // again in case unsubscribed by a former Release
+  GetRoute(sec, src)->Subscribe(sec);
+}
+
+void MarketDataManager::Release(const Security& sec, DataSrc::IdType src) {
+  auto& n = refs_[std::make_pair(src, sec.id)];
+  assert(n > 0);
+  if (!--n) Unwatched(sec.id, src);
+}
+
+void MarketDataManager::Unwatched(Security::IdType id, DataSrc::IdType src) {
+  if (unsubscribe_grace_ <= 0) return;
+  auto sec = SecurityManager::Instance().Get(id);
+  if (!sec) return;
+  auto adapter = GetRoute(*sec, src);
+  auto ver = adapter->sub_ver(*sec);
+  kTimerTaskPool.AddTask(
+      [this, sec, src, adapter, ver]() {
+        auto key = std::make_pair(src, sec->id);
+        if (refs_[key] > 0) return;
+        if (AlgoManager::Instance().IsSubscribed(src, sec->id)) return;
+        LOG_DEBUG(adapter->name() << ": unsubscribe " << sec->symbol);
+        adapter->Unsubscribe(*sec, ver);
+      },
+      boost::posix_time::microseconds(
+          static_cast<int64_t>(unsubscribe_grace_ * 1e6)));
+}
+
+static const double kRateDecay = 0.5;
+
+void MarketDataManager::SampleRates() {
+  std::lock_guard<std::mutex> lock(balance_m_);
+  auto now = NowInMicro();
+  auto elapsed = (now - last_sample_) / 1e6;
+  std::unordered_map<MarketDataAdapter*, double> totals;
+  for (auto& pair : assignments_) {
+    auto& a = pair.second;
+    MarketDataAdapter* adapter = a.adapter;
+    if (!adapter) continue;
+    auto md = adapter->md_->Find(pair.first.second);
+    if (!md) continue;
+    auto seq = md->seq();
+    if (last_sample_) {
+      // two increments per write, see MarketData::WriteGuard
+      auto rate = (seq - a.seq) / 2 / elapsed;
+      a.rate = a.rate * kRateDecay + rate * (1 - kRateDecay);
+      totals[adapter] += a.rate;
+    }
+    a.seq = seq;
+  }
+  last_sample_ = now;
+  for (auto& pair : adapters())
+    pair.second->update_rate_.store(totals[pair.second],
+                                    std::memory_order_relaxed);
+}
+
+size_t MarketDataManager::Rebalance() {
+  std::lock_guard<std::mutex> lock(balance_m_);
+  struct Item {
+    const Security* sec;
+    DataSrc::IdType src;
+    Assignment* a;
+  };
+  std::unordered_map<const std::vector<MarketDataAdapter*>*, std::vector<Item>>
+      groups;
+  for (auto& pair : assignments_) {
+    auto sec = SecurityManager::Instance().Get(pair.first.second);
+    if (!sec) continue;
+    auto route = FindRoute(*sec, pair.first.first);
+    if (!route || route->size() < 2) continue;
+    groups[route].push_back(Item{sec, pair.first.first, &pair.second});
+  }
+  size_t moved = 0;
+  for (auto& pair : groups) {
+    auto& route = *pair.first;
+    auto& items = pair.second;
+    auto movable = std::all_of(route.begin(), route.end(), [](auto adapter) {
+      return adapter->unsubscribe_supported() && adapter->connected();
+    });
+    if (!movable) {
+      LOG_WARN("Rebalance skipped " << route.front()->name()
+                                    << " and others that can not move");
+      continue;
+    }
+    // heaviest first onto the lightest adapter, but a security stays where
+    // it is unless that leaves its adapter heavier by more than its rate
+    std::sort(items.begin(), items.end(),
+              [](auto& x, auto& y) { return x.a->rate > y.a->rate; });
+    std::unordered_map<MarketDataAdapter*, double> loads;
+    for (auto adapter : route) loads[adapter] = 0;
+    for (auto& item : items) {
+      MarketDataAdapter* from = item.a->adapter;
+      if (!loads.count(from)) continue;
+      auto to = std::min_element(loads.begin(), loads.end(),
+                                 [](auto& x, auto& y) {
+                                   return x.second < y.second;
+                                 })->first;
+      if (loads[from] <= loads[to] + item.a->rate) to = from;
+      loads[to] += item.a->rate;
+      if (to == from) continue;
+      item.a->adapter = to;
+      moved++;
+      auto sec = item.sec;
+      auto a = item.a;
+      // one writer per MarketData, the new feed starts once the old stops
+      from->tp().AddTask([from, to, sec, a]() {
+        if (!from->subs_.count(sec)) return;
+        if (!from->connected() || !from->UnsubscribeSync(*sec)) {
+          a->adapter = from;
+          return;
+        }
+        from->subs_.unsafe_erase(sec);
+        to->Subscribe(*sec);
+      });
+    }
+    for (auto adapter : route)
+      LOG_INFO(adapter->name() << ": rebalanced to " << loads[adapter]
+                               << " updates per second");
+  }
+  LOG_INFO("Rebalance moved " << moved << " securities");
+  return moved;
+}
+
+void MarketDataManager::ScheduleRebalance(int seconds_of_day) {
+  time_t t = GetTime();
+  struct tm now;
+  localtime_r(&t, &now);
+  auto secs = now.tm_hour * 3600 + now.tm_min * 60 + now.tm_sec;
+  auto delay = seconds_of_day - secs;
+  if (delay <= 0) delay += 24 * 3600;
+  kTimerTaskPool.AddTask(
+      [this, seconds_of_day]() {
+        Rebalance();
+        ScheduleRebalance(seconds_of_day);
+      },
+      boost::posix_time::seconds(delay));
+}
+
+void MarketDataManager::StartBalancing(double interval,
+                                       const std::string& rebalance_time) {
+  if (interval <= 0) return;
+  auto t =
+      boost::posix_time::microseconds(static_cast<int64_t>(interval * 1e6));
+  kTimerTaskPool.RepeatTask([this]() { SampleRates(); }, t, t);
+  auto& m = Metrics::Instance();
+  for (auto& pair : adapters()) {
+    auto adapter = pair.second;
+    m.AddGauge("opentrade_md_update_rate",
+               "Market data updates per second of the securities routed",
+               Metrics::Label("adapter", adapter->name()),
+               [adapter]() { return adapter->update_rate(); });
+  }
+  if (rebalance_time.empty()) return;
+  int h = 0, mi = 0, s = 0;
+  if (sscanf(rebalance_time.c_str(), "%d:%d:%d", &h, &mi, &s) < 2) {
+    LOG_ERROR("Invalid md_rebalance_time: " << rebalance_time);
+    return;
+  }
+  ScheduleRebalance(h * 3600 + mi * 60 + s);
+  LOG_INFO("Market data rebalanced daily at " << rebalance_time);
+}
+
+void MarketDataManager::StartBus(const std::string& prefix, uint32_t capacity,
+                                 uint32_t ring_size) {
+  for (auto& pair : adapters()) {
+    auto adapter = pair.second;
+    auto& bus = buses_[adapter->src_];
+    if (!bus) bus.reset(MarketDataBus::Create(prefix, adapter->src_, capacity,
+                                              ring_size));
+    adapter->bus_ = bus.get();
+  }
+}
+
+void MarketDataManager::StartRecorder(const std::string& dir) {
+  auto& recorder = TickRecorder::Instance();
+  recorder.Start(dir);
+  for (auto& pair : adapters())
+    pair.second->recorder_ = recorder.AddRing(pair.second->src_);
+}
+
 void MarketDataManager::AddAdapter(MarketDataAdapter* adapter) {
   AdapterManager<MarketDataAdapter, kMdPrefix>::AddAdapter(adapter);
 
@@ -50,7 +282,12 @@ void MarketDataManager::AddAdapter(MarketDataAdapter* adapter) {
     LOG_FATAL("Invalid market data src: " << src << ", maximum length is 4");
   }
   auto src_id = DataSrc::GetId(src.c_str());
-  srcs_.emplace(src_id, srcs_.size());
+  if (srcs_.emplace(src_id, srcs_.size()).second) {
+    auto md = &md_of_src_[src_id];
+    MemoryAccounting::Instance().AddReporter(
+        src.empty() ? "market_data" : "market_data_" + src,
+        [md]() { return md->usage(); });
+  }
   auto markets = adapter->config("markets");
   if (markets.empty()) markets = adapter->config("exchanges");
   adapter->md_ = &md_of_src_[src_id];
@@ -71,11 +308,17 @@ void MarketDataManager::AddAdapter(MarketDataAdapter* adapter) {
 
 void MarketDataAdapter::Update(Security::IdType id, const MarketData::Quote& q,
                                uint32_t level, time_t tm, MarketData* md_ptr) {
-  if (level >= 5) return;
+  if (level >= MarketData::kDepthSize) return;
   auto& md = md_ptr ? *md_ptr : (*md_)[id];
-  auto& q0 = md.depth[level];
-  md.tm = tm ? tm : GetTime();
-  q0 = q;
+  {
+    MarketData::WriteGuard guard(md);
+    md.tm = tm ? tm : GetTime();
+    if (md.depth[level] != q) {
+      md.depth[level] = q;
+      md.TouchDepth(level);
+    }
+  }
+  Publish(id, md);
   if (level) return;
   auto& x = AlgoManager::Instance();
   if (!x.IsSubscribed(src_, id)) return;
@@ -85,31 +328,127 @@ void MarketDataAdapter::Update(Security::IdType id, const MarketData::Quote& q,
 void MarketDataAdapter::Update(Security::IdType id, double price,
                                MarketData::Qty size, bool is_bid,
                                uint32_t level, time_t tm, MarketData* md_ptr) {
-  if (level >= 5) return;
+  if (level >= MarketData::kDepthSize) return;
   auto& md = md_ptr ? *md_ptr : (*md_)[id];
-  md.tm = tm ? tm : GetTime();
-  auto& q = md.depth[level];
-  if (is_bid) {
-    q.bid_price = price;
-    q.bid_size = size;
-  } else {
-    q.ask_price = price;
-    q.ask_size = size;
+  {
+    MarketData::WriteGuard guard(md);
+    md.tm = tm ? tm : GetTime();
+    auto& q = md.depth[level];
+    auto q0 = q;
+    if (is_bid) {
+      q.bid_price = price;
+      q.bid_size = size;
+    } else {
+      q.ask_price = price;
+      q.ask_size = size;
+    }
+    if (q != q0) md.TouchDepth(level);
   }
+  Publish(id, md);
   if (level) return;
   auto& x = AlgoManager::Instance();
   if (!x.IsSubscribed(src_, id)) return;
   x.Update(src_, id);
 }
 
-static inline void UpdateTrade(MarketData* md, DataSrc::IdType src,
-                               Security::IdType id, double last_price,
-                               MarketData::Qty last_qty, time_t tm) {
-  md->tm = tm ? tm : GetTime();
-  auto& t = md->trade;
-  if (last_price > 0) t.UpdatePx(last_price);
-  if (last_qty > 0) t.UpdateVolume(last_qty);
+static inline void CopyTop(const OrderBook& book, MarketData* md) {
+  MarketData::Depth depth0;
+  std::copy(md->depth, md->depth + MarketData::kDepthSize, depth0);
+  book.CopyTop(&md->depth);
+  for (auto i = 0u; i < MarketData::kDepthSize; ++i) {
+    if (md->depth[i] != depth0[i]) md->TouchDepth(i);
+  }
+}
+
+static inline OrderBook* GetBook(MarketData* md) {
+  auto book = const_cast<OrderBook*>(md->Get<OrderBook>());
+  if (!book) {
+    book = new OrderBook;
+    md->Set(book);
+  }
+  return book;
+}
+
+void MarketDataAdapter::UpdateBook(Security::IdType id, double price,
+                                   MarketData::Qty size, bool is_bid, time_t tm,
+                                   MarketData* md_ptr) {
+  auto& md = md_ptr ? *md_ptr : (*md_)[id];
+  auto book = GetBook(&md);
+  auto level = book->Update(price, size, is_bid);
+  if (level >= MarketData::kDepthSize) return;
+  {
+    MarketData::WriteGuard guard(md);
+    md.tm = tm ? tm : GetTime();
+    CopyTop(*book, &md);
+  }
+  Publish(id, md);
+  if (level) return;
+  auto& x = AlgoManager::Instance();
+  if (!x.IsSubscribed(src_, id)) return;
+  x.Update(src_, id);
+}
+
+void MarketDataAdapter::UpdateBook(Security::IdType id,
+                                   const std::vector<BookEntry>& entries,
+                                   bool clear, time_t tm, MarketData* md_ptr) {
+  auto& md = md_ptr ? *md_ptr : (*md_)[id];
+  auto book = GetBook(&md);
+  if (clear) book->Clear();
+  size_t level = clear ? 0 : MarketData::kDepthSize;
+  for (auto& e : entries)
+    level = std::min(level, book->Update(e.price, e.size, e.is_bid));
+  if (level >= MarketData::kDepthSize) return;
+  {
+    MarketData::WriteGuard guard(md);
+    md.tm = tm ? tm : GetTime();
+    CopyTop(*book, &md);
+  }
+  Publish(id, md);
+  if (level) return;
+  auto& x = AlgoManager::Instance();
+  if (!x.IsSubscribed(src_, id)) return;
+  x.Update(src_, id);
+}
+
+void MarketDataAdapter::ClearBook(Security::IdType id, MarketData* md_ptr) {
+  auto& md = md_ptr ? *md_ptr : (*md_)[id];
+  auto book = GetBook(&md);
+  book->Clear();
+  {
+    MarketData::WriteGuard guard(md);
+    CopyTop(*book, &md);
+  }
+  Publish(id, md);
+}
+
+inline void MarketDataAdapter::Publish(Security::IdType id,
+                                       const MarketData& md) {
+  if (bus_) bus_->Write(id, md);
+  if (recorder_) recorder_->Push(id, md);
+}
+
+// notify false for a batch, published and notified once at its end, but
+// every trade is recorded
+inline void MarketDataAdapter::UpdateTrade(MarketData* md, Security::IdType id,
+                                           double last_price,
+                                           MarketData::Qty last_qty, time_t tm,
+                                           bool notify) {
+  auto src = src_;
+  {
+    MarketData::WriteGuard guard(*md);
+    md->tm = tm ? tm : GetTime();
+    auto& t = md->trade;
+    auto t0 = t;
+    if (last_price > 0) t.UpdatePx(last_price);
+    if (last_qty > 0) t.UpdateVolume(last_qty);
+    if (t != t0) md->TouchTrade();
+  }
+  if (notify)
+    Publish(id, *md);
+  else if (recorder_)
+    recorder_->Push(id, *md);
   md->CheckTradeHook(src, id);
+  if (!notify) return;
   auto& x = AlgoManager::Instance();
   if (!x.IsSubscribed(src, id)) return;
   x.Update(src, id);
@@ -118,8 +457,7 @@ static inline void UpdateTrade(MarketData* md, DataSrc::IdType src,
 void MarketDataAdapter::Update(Security::IdType id, double last_price,
                                MarketData::Qty last_qty, time_t tm,
                                MarketData* md_ptr) {
-  UpdateTrade(md_ptr ? md_ptr : &(*md_)[id], src_, id, last_price, last_qty,
-              tm);
+  UpdateTrade(md_ptr ? md_ptr : &(*md_)[id], id, last_price, last_qty, tm);
 }
 
 void MarketDataAdapter::Update(Security::IdType id, double last_price,
@@ -130,23 +468,109 @@ void MarketDataAdapter::Update(Security::IdType id, double last_price,
   auto d = volume - md.trade.volume;
   if (d <= 0) return;
   if (md.trade.volume == 0) {
-    md.tm = tm ? tm : GetTime();
-    md.trade.volume = volume;
-    md.trade.open = open;
-    md.trade.high = high;
-    md.trade.low = low;
-    md.trade.close = last_price;
-    md.trade.vwap = vwap;
+    {
+      MarketData::WriteGuard guard(md);
+      md.tm = tm ? tm : GetTime();
+      md.trade.volume = volume;
+      md.trade.open = open;
+      md.trade.high = high;
+      md.trade.low = low;
+      md.trade.close = last_price;
+      md.trade.vwap = vwap;
+      md.TouchTrade();
+    }
+    Publish(id, md);
     return;
   }
-  UpdateTrade(&md, src_, id, last_price, d, tm);
+  UpdateTrade(&md, id, last_price, d, tm);
+}
+
+void MarketDataAdapter::UpdateSnapshot(Security::IdType id, double last_price,
+                                       MarketData::Volume volume, double open,
+                                       double high, double low, double vwap,
+                                       const MarketData::Quote* depth,
+                                       uint32_t levels, time_t tm,
+                                       MarketData* md_ptr) {
+  auto& md = md_ptr ? *md_ptr : (*md_)[id];
+  auto traded = false;
+  {
+    MarketData::WriteGuard guard(md);
+    md.tm = tm ? tm : GetTime();
+    auto& t = md.trade;
+    auto d = volume - t.volume;
+    if (d > 0 && !t.volume) {
+      t.volume = volume;
+      t.open = open;
+      t.high = high;
+      t.low = low;
+      t.close = last_price;
+      t.vwap = vwap;
+      md.TouchTrade();
+    } else if (d > 0) {
+      auto t0 = t;
+      if (last_price > 0) t.UpdatePx(last_price);
+      t.UpdateVolume(d);
+      if (t != t0) md.TouchTrade();
+      traded = true;
+    }
+    levels = std::min<uint32_t>(levels, MarketData::kDepthSize);
+    for (auto i = 0u; i < levels; ++i) {
+      if (md.depth[i] != depth[i]) {
+        md.depth[i] = depth[i];
+        md.TouchDepth(i);
+      }
+    }
+  }
+  Publish(id, md);
+  if (traded) md.CheckTradeHook(src_, id);
+  auto& x = AlgoManager::Instance();
+  if (!x.IsSubscribed(src_, id)) return;
+  x.Update(src_, id);
+}
+
+void MarketDataAdapter::Update(Security::IdType id, const Batch& batch,
+                               time_t tm, MarketData* md_ptr) {
+  if (batch.empty()) return;
+  auto& md = md_ptr ? *md_ptr : (*md_)[id];
+  for (auto& t : batch.trades) {
+    UpdateTrade(&md, id, t.first, t.second, tm, false);
+  }
+  if (batch.asks || batch.bids) {
+    MarketData::WriteGuard guard(md);
+    md.tm = tm ? tm : GetTime();
+    for (auto i = 0u; i < MarketData::kDepthSize; ++i) {
+      auto& q = md.depth[i];
+      auto q0 = q;
+      auto& b = batch.depth[i];
+      if (batch.asks & (1u << i)) {
+        q.ask_price = b.ask_price;
+        q.ask_size = b.ask_size;
+      }
+      if (batch.bids & (1u << i)) {
+        q.bid_price = b.bid_price;
+        q.bid_size = b.bid_size;
+      }
+      if (q != q0) md.TouchDepth(i);
+    }
+  }
+  Publish(id, md);
+  auto& x = AlgoManager::Instance();
+  if (!x.IsSubscribed(src_, id)) return;
+  x.Update(src_, id);
 }
 
 void MarketDataAdapter::UpdateAskPrice(Security::IdType id, double v, time_t tm,
                                        MarketData* md_ptr) {
   auto& md = md_ptr ? *md_ptr : (*md_)[id];
-  md.tm = tm ? tm : GetTime();
-  md.depth[0].ask_price = v;
+  {
+    MarketData::WriteGuard guard(md);
+    md.tm = tm ? tm : GetTime();
+    if (md.depth[0].ask_price != v) {
+      md.depth[0].ask_price = v;
+      md.TouchDepth(0);
+    }
+  }
+  Publish(id, md);
   auto& x = AlgoManager::Instance();
   if (!x.IsSubscribed(src_, id)) return;
   x.Update(src_, id);
@@ -155,8 +579,15 @@ void MarketDataAdapter::UpdateAskPrice(Security::IdType id, double v, time_t tm,
 void MarketDataAdapter::UpdateAskSize(Security::IdType id, double v, time_t tm,
                                       MarketData* md_ptr) {
   auto& md = md_ptr ? *md_ptr : (*md_)[id];
-  md.tm = tm ? tm : GetTime();
-  md.depth[0].ask_size = v;
+  {
+    MarketData::WriteGuard guard(md);
+    md.tm = tm ? tm : GetTime();
+    if (md.depth[0].ask_size != v) {
+      md.depth[0].ask_size = v;
+      md.TouchDepth(0);
+    }
+  }
+  Publish(id, md);
   auto& x = AlgoManager::Instance();
   if (!x.IsSubscribed(src_, id)) return;
   x.Update(src_, id);
@@ -165,8 +596,15 @@ void MarketDataAdapter::UpdateAskSize(Security::IdType id, double v, time_t tm,
 void MarketDataAdapter::UpdateBidPrice(Security::IdType id, double v, time_t tm,
                                        MarketData* md_ptr) {
   auto& md = md_ptr ? *md_ptr : (*md_)[id];
-  md.tm = tm ? tm : GetTime();
-  md.depth[0].bid_price = v;
+  {
+    MarketData::WriteGuard guard(md);
+    md.tm = tm ? tm : GetTime();
+    if (md.depth[0].bid_price != v) {
+      md.depth[0].bid_price = v;
+      md.TouchDepth(0);
+    }
+  }
+  Publish(id, md);
   auto& x = AlgoManager::Instance();
   if (!x.IsSubscribed(src_, id)) return;
   x.Update(src_, id);
@@ -175,8 +613,15 @@ void MarketDataAdapter::UpdateBidPrice(Security::IdType id, double v, time_t tm,
 void MarketDataAdapter::UpdateBidSize(Security::IdType id, double v, time_t tm,
                                       MarketData* md_ptr) {
   auto& md = md_ptr ? *md_ptr : (*md_)[id];
-  md.tm = tm ? tm : GetTime();
-  md.depth[0].bid_size = v;
+  {
+    MarketData::WriteGuard guard(md);
+    md.tm = tm ? tm : GetTime();
+    if (md.depth[0].bid_size != v) {
+      md.depth[0].bid_size = v;
+      md.TouchDepth(0);
+    }
+  }
+  Publish(id, md);
   auto& x = AlgoManager::Instance();
   if (!x.IsSubscribed(src_, id)) return;
   x.Update(src_, id);
@@ -186,8 +631,14 @@ void MarketDataAdapter::UpdateLastPrice(Security::IdType id, double v,
                                         time_t tm, MarketData* md_ptr) {
   if (v <= 0) return;
   auto& md = md_ptr ? *md_ptr : (*md_)[id];
-  md.tm = tm ? tm : GetTime();
-  md.trade.UpdatePx(v);
+  {
+    MarketData::WriteGuard guard(md);
+    md.tm = tm ? tm : GetTime();
+    auto t0 = md.trade;
+    md.trade.UpdatePx(v);
+    if (md.trade != t0) md.TouchTrade();
+  }
+  Publish(id, md);
   auto& x = AlgoManager::Instance();
   if (!x.IsSubscribed(src_, id)) return;
   x.Update(src_, id);
@@ -197,8 +648,14 @@ void MarketDataAdapter::UpdateLastSize(Security::IdType id, double v, time_t tm,
                                        MarketData* md_ptr) {
   if (v <= 0) return;
   auto& md = md_ptr ? *md_ptr : (*md_)[id];
-  md.tm = tm ? tm : GetTime();
-  md.trade.UpdateVolume(v);
+  {
+    MarketData::WriteGuard guard(md);
+    md.tm = tm ? tm : GetTime();
+    auto t0 = md.trade;
+    md.trade.UpdateVolume(v);
+    if (md.trade != t0) md.TouchTrade();
+  }
+  Publish(id, md);
   md.CheckTradeHook(src(), id);
   auto& x = AlgoManager::Instance();
   if (!x.IsSubscribed(src_, id)) return;
@@ -212,8 +669,14 @@ void MarketDataAdapter::UpdateMidAsLastPrice(Security::IdType id, time_t tm,
   auto& t = md.trade;
   if (q.ask_price > q.bid_price && q.bid_price > 0) {
     auto px = (q.ask_price + q.bid_price) / 2;
-    md.tm = tm ? tm : GetTime();
-    t.UpdatePx(px);
+    {
+      MarketData::WriteGuard guard(md);
+      md.tm = tm ? tm : GetTime();
+      auto t0 = t;
+      t.UpdatePx(px);
+      if (t != t0) md.TouchTrade();
+    }
+    Publish(id, md);
     md.CheckTradeHook(src(), id);
     auto& x = AlgoManager::Instance();
     if (!x.IsSubscribed(src_, id)) return;
@@ -221,18 +684,94 @@ void MarketDataAdapter::UpdateMidAsLastPrice(Security::IdType id, time_t tm,
   }
 }
 
+static MemoryTag& IndicatorTag() {
+  static auto& kTag = MemoryTag::Get("indicators");
+  return kTag;
+}
+
+// pooled as Algo, e.g. the consolidation books of all the securities
+void* Indicator::operator new(size_t n) {
+  IndicatorTag().Add(n);
+  if (n <= 256) return SlabPool<256, 16>::Allocate();
+  if (n <= 512) return SlabPool<512, 16>::Allocate();
+  if (n <= 1024) return SlabPool<1024, 16>::Allocate();
+  return ::operator new(n);
+}
+
+void Indicator::operator delete(void* p, size_t n) {
+  IndicatorTag().Sub(n);
+  if (n <= 256) return SlabPool<256, 16>::Free(p);
+  if (n <= 512) return SlabPool<512, 16>::Free(p);
+  if (n <= 1024) return SlabPool<1024, 16>::Free(p);
+  ::operator delete(p);
+}
+
+void Indicator::SetListeners(const Listeners* value) {
+  auto old = subs_.exchange(value, std::memory_order_acq_rel);
+  if (old) retired_.emplace_back(old);
+}
+
+void Indicator::AddListener(Instrument* inst) {
+  std::lock_guard<std::mutex> lock(subs_m_);
+  auto subs = subs_.load(std::memory_order_relaxed);
+  auto tmp = subs ? new Listeners(*subs) : new Listeners;
+  tmp->push_back(inst);
+  SetListeners(tmp);
+}
+
+void Indicator::RemoveInactive() {
+  std::lock_guard<std::mutex> lock(subs_m_);
+  auto subs = subs_.load(std::memory_order_relaxed);
+  auto tmp = new Listeners;
+  for (auto inst : *subs) {
+    if (inst->algo().is_active()) tmp->push_back(inst);
+  }
+  SetListeners(tmp);
+}
+
 void Indicator::Publish(IdType id) {
-  Lock lock(m_);
-  for (auto it = subs_.begin(); it != subs_.end();) {
-    auto inst = *it;
+  Listeners insts;
+  Publish(&insts);
+  Notify(id, &insts);
+}
+
+void Indicator::Publish(Listeners* out) {
+  auto subs = subs_.load(std::memory_order_acquire);
+  if (!subs) return;
+  auto inactive = false;
+  for (auto inst : *subs) {
+    if (inst->algo().is_active())
+      out->push_back(inst);
+    else
+      inactive = true;
+  }
+  if (inactive) RemoveInactive();
+}
+
+void Indicator::Notify(IdType id, Listeners* insts) {
+#ifdef BACKTEST
+  for (auto inst : *insts) {
     auto& algo = inst->algo();
-    if (!algo.is_active()) {
-      it = subs_.erase(it);
-      continue;
-    }
     algo.Async([&algo, id, inst]() { algo.OnIndicator(id, *inst); });
-    ++it;
   }
+#else
+  std::stable_sort(insts->begin(), insts->end(), [](auto a, auto b) {
+    return a->algo().runner() < b->algo().runner();
+  });
+  for (auto it = insts->begin(); it != insts->end();) {
+    auto runner = (*it)->algo().runner();
+    auto it2 = it;
+    while (it2 != insts->end() && (*it2)->algo().runner() == runner) ++it2;
+    AlgoManager::Instance().Post(
+        runner, [id, batch = Listeners(it, it2)]() {
+          for (auto inst : batch) {
+            auto& algo = inst->algo();
+            if (algo.is_active()) algo.OnIndicator(id, *inst);
+          }
+        });
+    it = it2;
+  }
+#endif
 }
 
 }  // namespace opentrade
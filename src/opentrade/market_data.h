@@ -1,15 +1,24 @@
 #ifndef OPENTRADE_MARKET_DATA_H_
 #define OPENTRADE_MARKET_DATA_H_
 
+#include <tbb/atomic.h>
 #include <tbb/concurrent_unordered_map.h>
 #include <tbb/concurrent_unordered_set.h>
 #include <atomic>
 #include <boost/python.hpp>
 #include <boost/unordered_map.hpp>
-#include <shared_mutex>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 
 #include "adapter.h"
+#include "md_bus.h"
+#include "memory.h"
+#include "numa.h"
 #include "security.h"
 
 namespace opentrade {
@@ -61,22 +70,38 @@ struct TradeTickHook {
 };
 
 class Instrument;
+// Listeners are a copy-on-write list, so publishing never takes a lock.
+// Replaced lists are retired until the indicator goes, listeners change
+// rarely.
 class Indicator {
  public:
   typedef size_t IdType;
-  virtual ~Indicator() {}
+  typedef std::vector<Instrument*> Listeners;
+  virtual ~Indicator() { delete subs_.load(std::memory_order_relaxed); }
+  // counted as "indicators", of SlabPool if small
+  static void* operator new(size_t n);
+  static void operator delete(void* p, size_t n);
   virtual boost::python::object GetPyObject() const { return {}; }
-  void AddListener(Instrument* inst) {
-    Lock lock(m_);
-    subs_.push_back(inst);
-  }
+  void AddListener(Instrument* inst);
   void Publish(IdType id);
+  // append listeners instead of notifying them, see Notify
+  void Publish(Listeners* out);
+  // one batch per runner for all the instruments in insts living on it
+  static void Notify(IdType id, Listeners* insts);
   auto& m() { return m_; }
 
  protected:
-  std::vector<Instrument*> subs_;
   mutable std::mutex m_;
   typedef std::lock_guard<std::mutex> Lock;
+
+ private:
+  void RemoveInactive();
+  void SetListeners(const Listeners* value);
+
+ private:
+  std::atomic<const Listeners*> subs_ = nullptr;
+  std::mutex subs_m_;  // writers of subs_
+  std::vector<std::unique_ptr<const Listeners>> retired_;
 };
 
 struct MarketData {
@@ -87,6 +112,16 @@ struct MarketData {
   typedef int Qty;
   typedef int64_t Volume;
 #endif
+  MarketData() = default;
+  // copies are always consistent, see Snapshot()
+  MarketData(const MarketData& b) { Read(b); }
+  MarketData& operator=(const MarketData& b) {
+    if (this == &b) return *this;
+    WriteGuard guard(*this);
+    Read(b);
+    return *this;
+  }
+
   time_t tm = 0;
   struct Trade {
     Qty qty = 0;
@@ -140,92 +175,308 @@ struct MarketData {
   static inline const size_t kDepthSize = 5;
   typedef Quote Depth[kDepthSize];
 
+  // seqlock writer section, one writer (the owning adapter) per MarketData
+  class WriteGuard {
+   public:
+    explicit WriteGuard(MarketData& md) : md_(md) {
+      md_.seq_.store(md_.seq_.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+    }
+    ~WriteGuard() {
+      md_.seq_.store(md_.seq_.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_release);
+    }
+
+   private:
+    MarketData& md_;
+  };
+
+  // consistent copy without tearing even if the adapter thread is updating
+  MarketData Snapshot() const { return *this; }
+  // odd while a write is in progress
+  uint32_t seq() const { return seq_.load(std::memory_order_acquire); }
+
+  // change mask of this against an earlier copy md0 of the same MarketData,
+  // from the per group versions bumped by writers, no field comparison
+  enum : uint32_t {
+    kTradeChanged = 1,
+    kQuoteChanged = 1 << 1,  // depth[0]
+    kDepthChanged = 1 << 2,  // depth[1:]
+  };
+  uint32_t Changes(const MarketData& md0) const {
+    auto levels = ChangedLevels(md0);
+    return (trade_ver_ != md0.trade_ver_ ? kTradeChanged : 0) |
+           (levels & 1 ? kQuoteChanged : 0) |
+           (levels & ~1u ? kDepthChanged : 0);
+  }
+  // bit i set if depth[i] changed against md0
+  uint32_t ChangedLevels(const MarketData& md0) const {
+    uint32_t levels = 0;
+    for (auto i = 0u; i < kDepthSize; ++i) {
+      if (level_ver_[i] != md0.level_ver_[i]) levels |= 1u << i;
+    }
+    return levels;
+  }
+  // called by writers within WriteGuard once the values really changed
+  void TouchTrade() { trade_ver_++; }
+  void TouchDepth(uint32_t level) {
+    if (level < kDepthSize) level_ver_[level]++;
+  }
+
   const Quote& quote() const { return depth[0]; }
   auto mid() const { return (quote().ask_price + quote().bid_price) / 2; }
 
   Trade trade;
   Depth depth;
 
+  // Indicator slots are written once by their handler and read lock free.
+  // Trade tick hooks are a copy-on-write list, replaced lists are retired
+  // until the manager goes, hooks change rarely. A hook may still get one
+  // more OnTrade from an in-flight trade after UnhookTradeTick returns.
   struct IndicatorManager {
-    ~IndicatorManager() {
-      for (auto& ind : inds) delete ind;
+    typedef std::vector<TradeTickHook*> Hooks;
+    static inline const size_t kMaxIndicators = 16;
+    ~IndicatorManager() { Reset(); }
+    void Reset() {
+      for (auto& ind : inds) delete ind.exchange(nullptr);
+      delete hooks.exchange(nullptr);
+      retired.clear();
+    }
+    std::atomic<Indicator*> inds[kMaxIndicators] = {};
+    std::atomic<const Hooks*> hooks = nullptr;
+    std::mutex m;  // hook writers
+    std::vector<std::unique_ptr<const Hooks>> retired;
+
+    void SetHooks(const Hooks* value) {
+      auto old = hooks.exchange(value, std::memory_order_acq_rel);
+      if (old) retired.emplace_back(old);
     }
-    std::vector<Indicator*> inds;
-    std::vector<TradeTickHook*> trade_tick_hooks;
   };
 
   template <typename T>
   void Set(T* value) {
-    assert(T::kId < 16);
-    std::unique_lock<std::shared_mutex> lock(kMutex_);
-    if (!mngr_) mngr_ = new IndicatorManager;
-    if (mngr_->inds.size() <= T::kId) mngr_->inds.resize(T::kId + 1);
-    mngr_->inds[T::kId] = value;
+    static_assert(T::kId < IndicatorManager::kMaxIndicators);
+    manager()->inds[T::kId].store(value, std::memory_order_release);
   }
 
   template <typename T = Indicator>
   const T* Get(Indicator::IdType id) const {
-    if (!mngr_) return {};
-    std::shared_lock<std::shared_mutex> lock(kMutex_);
-    if (id >= mngr_->inds.size()) return {};
-    return dynamic_cast<T*>(mngr_->inds.at(id));
+    auto m = mngr_.load(std::memory_order_acquire);
+    if (!m || id >= IndicatorManager::kMaxIndicators) return {};
+    auto ind = m->inds[id].load(std::memory_order_acquire);
+    if constexpr (std::is_same_v<T, Indicator>)
+      return ind;
+    else
+      return dynamic_cast<const T*>(ind);
   }
 
+  // the slot of T::kId is only set by Set<T>, no dynamic_cast needed
   template <typename T>
   const T* Get() const {
-    return Get<T>(T::kId);
+    static_assert(T::kId < IndicatorManager::kMaxIndicators);
+    auto m = mngr_.load(std::memory_order_acquire);
+    if (!m) return {};
+    return static_cast<const T*>(
+        m->inds[T::kId].load(std::memory_order_acquire));
   }
 
   void HookTradeTick(TradeTickHook* hook) {
-    std::unique_lock<std::shared_mutex> lock(kMutex_);
-    if (!mngr_) mngr_ = new IndicatorManager;
-    mngr_->trade_tick_hooks.push_back(hook);
+    auto m = manager();
+    std::lock_guard<std::mutex> lock(m->m);
+    auto hooks = m->hooks.load(std::memory_order_relaxed);
+    auto tmp = hooks ? new IndicatorManager::Hooks(*hooks)
+                     : new IndicatorManager::Hooks;
+    tmp->push_back(hook);
+    m->SetHooks(tmp);
   }
 
   void UnhookTradeTick(TradeTickHook* hook) {
-    std::unique_lock<std::shared_mutex> lock(kMutex_);
-    if (!mngr_) return;
-    mngr_->trade_tick_hooks.erase(
-        std::remove(mngr_->trade_tick_hooks.begin(),
-                    mngr_->trade_tick_hooks.end(), hook),
-        mngr_->trade_tick_hooks.end());
+    auto m = mngr_.load(std::memory_order_acquire);
+    if (!m) return;
+    std::lock_guard<std::mutex> lock(m->m);
+    auto hooks = m->hooks.load(std::memory_order_relaxed);
+    if (!hooks) return;
+    auto tmp = new IndicatorManager::Hooks(*hooks);
+    tmp->erase(std::remove(tmp->begin(), tmp->end(), hook), tmp->end());
+    m->SetHooks(tmp);
   }
 
   void CheckTradeHook(DataSrc::IdType src, Security::IdType id) {
-    if (!mngr_) return;
-    if (mngr_->trade_tick_hooks.empty()) return;
-    std::shared_lock<std::shared_mutex> lock(kMutex_);
+    auto m = mngr_.load(std::memory_order_acquire);
+    if (!m) return;
+    auto hooks = m->hooks.load(std::memory_order_acquire);
+    if (!hooks) return;
     // to-do: make it async without using TaskPool
-    for (auto& hook : mngr_->trade_tick_hooks) {
+    for (auto& hook : *hooks) {
       hook->OnTrade(src, id, this, tm, trade.close, trade.qty);
     }
   }
 
 #ifdef BACKTEST
+  // drops the indicators and hooks but keeps the manager for the next day
   void Clear() {
-    if (mngr_) {
-      delete mngr_;
-      mngr_ = nullptr;
-    }
+    auto m = mngr_.load(std::memory_order_relaxed);
+    if (m) m->Reset();
   }
 #endif
 
  private:
-  IndicatorManager* mngr_ = nullptr;
-  static inline std::shared_mutex kMutex_;
+  void Read(const MarketData& b) {
+    for (;;) {
+      auto seq = b.seq_.load(std::memory_order_acquire);
+      if (seq & 1) {
+        std::this_thread::yield();
+        continue;
+      }
+      tm = b.tm;
+      trade = b.trade;
+      std::copy(b.depth, b.depth + kDepthSize, depth);
+      trade_ver_ = b.trade_ver_;
+      std::copy(b.level_ver_, b.level_ver_ + kDepthSize, level_ver_);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (b.seq_.load(std::memory_order_relaxed) == seq) break;
+    }
+    mngr_.store(b.mngr_.load(std::memory_order_acquire),
+                std::memory_order_relaxed);
+  }
+
+ private:
+  IndicatorManager* manager() {
+    auto m = mngr_.load(std::memory_order_acquire);
+    if (m) return m;
+    auto tmp = new IndicatorManager;
+    if (mngr_.compare_exchange_strong(m, tmp, std::memory_order_acq_rel))
+      return tmp;
+    delete tmp;
+    return m;
+  }
+
+ private:
+  std::atomic<IndicatorManager*> mngr_ = nullptr;
+  std::atomic<uint32_t> seq_ = 0;
+  uint32_t trade_ver_ = 0;
+  uint32_t level_ver_[kDepthSize] = {};  // of depth[i]
+};
+
+// MarketData of one source indexed by security id, in segments allocated
+// on first touch and never moved, so a lookup is two lock-free loads and
+// a MarketData& stays valid for the process; of HugePages if enabled
+class MarketDataArray {
+ public:
+  MarketDataArray() {
+    dir_ = static_cast<std::atomic<Segment*>*>(
+        calloc(kDirSize, sizeof(Segment*)));
+  }
+  ~MarketDataArray() {
+    for (auto i = 0u; i < kDirSize; ++i) {
+      auto seg = dir_[i].load();
+      if (!seg) continue;
+      seg->~Segment();
+      HugeFree(seg, sizeof(Segment));
+    }
+    free(dir_);
+  }
+  MarketDataArray(const MarketDataArray&) = delete;
+  MarketDataArray& operator=(const MarketDataArray&) = delete;
+
+  // created on first access
+  MarketData& operator[](Security::IdType id) {
+    assert((id >> kBits) < kDirSize);
+    auto& d = dir_[id >> kBits];
+    auto seg = d.load(std::memory_order_acquire);
+    if (!seg) {
+      auto tmp = new (HugeAlloc(sizeof(Segment), node_)) Segment;
+      if (d.compare_exchange_strong(seg, tmp, std::memory_order_acq_rel)) {
+        seg = tmp;
+      } else {
+        tmp->~Segment();
+        HugeFree(tmp, sizeof(Segment));
+      }
+    }
+    auto i = id & kMask;
+    if (!seg->used[i].load(std::memory_order_relaxed))
+      seg->used[i].store(true, std::memory_order_release);
+    return seg->md[i];
+  }
+
+  // nullptr if never accessed
+  MarketData* Find(Security::IdType id) const {
+    if ((id >> kBits) >= kDirSize) return nullptr;
+    auto seg = dir_[id >> kBits].load(std::memory_order_acquire);
+    if (!seg) return nullptr;
+    auto i = id & kMask;
+    return seg->used[i].load(std::memory_order_acquire) ? &seg->md[i]
+                                                        : nullptr;
+  }
+
+  // the entries accessed, and the bytes of the segments holding them
+  MemoryAccounting::Usage usage() const {
+    MemoryAccounting::Usage u;
+    for (auto i = 0u; i < kDirSize; ++i) {
+      auto seg = dir_[i].load(std::memory_order_acquire);
+      if (!seg) continue;
+      u.bytes += sizeof(Segment);
+      for (auto j = 0u; j < kSize; ++j)
+        u.objects += seg->used[j].load(std::memory_order_relaxed);
+    }
+    return u;
+  }
+
+  // segments created from now on are allocated on node, where the feed
+  // thread writing them runs, rather than on the first thread reading them
+  void set_node(int node) { node_ = node; }
+
+  // func(id, md) of the entries accessed
+  template <typename F>
+  void ForEach(F func) {
+    for (auto i = 0u; i < kDirSize; ++i) {
+      auto seg = dir_[i].load(std::memory_order_acquire);
+      if (!seg) continue;
+      for (auto j = 0u; j < kSize; ++j) {
+        if (seg->used[j].load(std::memory_order_acquire))
+          func(static_cast<Security::IdType>(i << kBits | j), seg->md[j]);
+      }
+    }
+  }
+
+ private:
+  static inline const uint32_t kBits = 10;
+  static inline const uint32_t kSize = 1 << kBits;
+  static inline const uint32_t kMask = kSize - 1;
+  static inline const uint32_t kDirSize = 1 << 16;
+  struct Segment {
+    MarketData md[kSize];
+    std::atomic<bool> used[kSize] = {};
+  };
+  std::atomic<Segment*>* dir_ = nullptr;
+  int node_ = -1;
 };
 
+struct TickRing;
+
 class MarketDataAdapter : public virtual NetworkAdapter {
  public:
-  typedef tbb::concurrent_unordered_map<Security::IdType, MarketData>
-      MarketDataMap;
+  typedef MarketDataArray MarketDataMap;
+  // coalesced with the other subscriptions made before tp_ gets to them,
+  // see SubscribeBatchSync
   void Subscribe(const Security& sec) {
-    tp_.AddTask([this, &sec]() {
-      if (!subs_.insert(&sec).second) return;
-      if (!connected()) return;
-      SubscribeSync(sec);
+    auto p = &sec;
+    SubscribeBatch(&p, 1);
+  }
+  void SubscribeBatch(const Security* const* secs, size_t n);
+  void SubscribeBatch(const std::vector<const Security*>& secs) {
+    SubscribeBatch(secs.data(), secs.size());
+  }
+  // ver of sub_ver taken before, dropped if subscribed again since
+  void Unsubscribe(const Security& sec, uint32_t ver) {
+    tp_.AddTask([this, &sec, ver]() {
+      if (sub_vers_[sec.id] != ver || !subs_.count(&sec)) return;
+      if (!connected() || !UnsubscribeSync(sec)) return;
+      subs_.unsafe_erase(&sec);
     });
   }
+  uint32_t sub_ver(const Security& sec) { return sub_vers_[sec.id]; }
   DataSrc::IdType src() const { return src_; }
   MarketDataMap& md() { return *md_; }
   void Update(Security::IdType id, const MarketData::Quote& q,
@@ -238,6 +489,53 @@ class MarketDataAdapter : public virtual NetworkAdapter {
   void Update(Security::IdType id, double last_price, MarketData::Volume volume,
               double open, double high, double low, double vwap, time_t tm = 0,
               MarketData* md_ptr = nullptr);
+  // the trade snapshot above and the top levels of one exchange tick, e.g.
+  // CTP depth market data, written at once and notified once
+  void UpdateSnapshot(Security::IdType id, double last_price,
+                      MarketData::Volume volume, double open, double high,
+                      double low, double vwap, const MarketData::Quote* depth,
+                      uint32_t levels, time_t tm = 0,
+                      MarketData* md_ptr = nullptr);
+  // the updates of one security coalesced from a batch of messages, e.g.
+  // one B-PIPE event: the trades in order, each seen by the trade hooks,
+  // then the sides given of the top levels, then one notification
+  struct Batch {
+    std::vector<std::pair<double, MarketData::Qty>> trades;
+    MarketData::Depth depth;
+    uint32_t asks = 0;  // bit masks of the levels given
+    uint32_t bids = 0;
+    void SetAsk(uint32_t level, double price, MarketData::Qty size) {
+      depth[level].ask_price = price;
+      depth[level].ask_size = size;
+      asks |= 1u << level;
+    }
+    void SetBid(uint32_t level, double price, MarketData::Qty size) {
+      depth[level].bid_price = price;
+      depth[level].bid_size = size;
+      bids |= 1u << level;
+    }
+    bool empty() const { return trades.empty() && !asks && !bids; }
+    void clear() {
+      trades.clear();
+      asks = bids = 0;
+    }
+  };
+  void Update(Security::IdType id, const Batch& batch, time_t tm = 0,
+              MarketData* md_ptr = nullptr);
+  // full depth book beyond MarketData::kDepthSize, see OrderBook
+  void UpdateBook(Security::IdType id, double price, MarketData::Qty size,
+                  bool is_bid, time_t tm = 0, MarketData* md_ptr = nullptr);
+  void ClearBook(Security::IdType id, MarketData* md_ptr = nullptr);
+  struct BookEntry {
+    double price;
+    MarketData::Qty size;
+    bool is_bid;
+  };
+  // UpdateBook for a burst of entries, e.g. one FIX incremental refresh,
+  // the top levels are copied and published once
+  void UpdateBook(Security::IdType id, const std::vector<BookEntry>& entries,
+                  bool clear = false, time_t tm = 0,
+                  MarketData* md_ptr = nullptr);
   void UpdateMidAsLastPrice(Security::IdType id, time_t tm = 0,
                             MarketData* md_ptr = nullptr);
   void UpdateAskPrice(Security::IdType id, double v, time_t tm = 0,
@@ -255,17 +553,49 @@ class MarketDataAdapter : public virtual NetworkAdapter {
 
  protected:
   void ReSubscribeAll() {
-    for (auto sec : subs_) SubscribeSync(*sec);
+    std::vector<const Security*> secs(subs_.begin(), subs_.end());
+    if (!secs.empty()) SubscribeBatchSync(secs);
   }
   virtual void SubscribeSync(const Security& sec) noexcept = 0;
+  // in as few requests as the feed allows
+  virtual void SubscribeBatchSync(
+      const std::vector<const Security*>& secs) noexcept {
+    for (auto sec : secs) SubscribeSync(*sec);
+  }
+  // false if the feed can not unsubscribe, it is kept subscribed then
+  virtual bool UnsubscribeSync(const Security& sec) noexcept { return false; }
+
+ public:
+  // with UnsubscribeSync, so that MarketDataManager::Rebalance may move its
+  // subscriptions
+  virtual bool unsubscribe_supported() const noexcept { return false; }
+  // updates per second of the securities routed to it, see
+  // MarketDataManager::StartBalancing
+  double update_rate() const {
+    return update_rate_.load(std::memory_order_relaxed);
+  }
 
  protected:
   std::atomic<int> request_counter_ = 0;
   tbb::concurrent_unordered_set<const opentrade::Security*> subs_;
+  // bumped on every Subscribe, see Unsubscribe
+  tbb::concurrent_unordered_map<Security::IdType, tbb::atomic<uint32_t>>
+      sub_vers_;
 
  private:
+  // to the bus and the recorder after an update
+  void Publish(Security::IdType id, const MarketData& md);
+  void UpdateTrade(MarketData* md, Security::IdType id, double last_price,
+                   MarketData::Qty last_qty, time_t tm, bool notify = true);
+  void FlushSubscribes();
+  std::vector<const Security*> pending_subs_;
+  std::mutex pending_subs_m_;
+
   MarketDataMap* md_ = nullptr;
   DataSrc::IdType src_ = 0;
+  std::atomic<double> update_rate_ = 0;
+  MarketDataBus* bus_ = nullptr;  // of src_, see MarketDataManager::StartBus
+  TickRing* recorder_ = nullptr;
   friend class MarketDataManager;
 };
 
@@ -273,11 +603,36 @@ class MarketDataManager : public AdapterManager<MarketDataAdapter, kMdPrefix>,
                           public Singleton<MarketDataManager> {
  public:
   MarketDataAdapter* Subscribe(const Security& sec, DataSrc::IdType src);
+  // one batch per adapter routed to
+  void Subscribe(const std::vector<const Security*>& secs,
+                 DataSrc::IdType src);
   void AddAdapter(MarketDataAdapter* adapter) override;
   const MarketData& Get(const Security& sec, DataSrc::IdType src = 0);
   // Lite version without subscription
   const MarketData& GetLite(Security::IdType id, DataSrc::IdType src = 0);
   MarketDataAdapter* GetDefault() const { return default_; }
+  // a client's watch of the security, together with the instruments of
+  // AlgoManager::md_refs_ these keep the feed subscribed
+  void AddRef(const Security& sec, DataSrc::IdType src);
+  void Release(const Security& sec, DataSrc::IdType src);
+  // on the last watch gone, unsubscribes at the feed if nobody watches again
+  // within the grace period
+  void Unwatched(Security::IdType id, DataSrc::IdType src);
+  // seconds, 0 never unsubscribes
+  void set_unsubscribe_grace(double v) { unsubscribe_grace_ = v; }
+  // samples the update rates every interval seconds, and rebalances daily
+  // at rebalance_time, "HH:MM:SS" local time, never if empty
+  void StartBalancing(double interval, const std::string& rebalance_time);
+  // moves subscriptions between the adapters sharing a route so that they
+  // get about the same update rate, to be run at a safe point, e.g. before
+  // the open; returns the number of securities moved
+  size_t Rebalance();
+  // publishes every source into the shared memory of prefix + src, to be
+  // called before the adapters start, see md_bus/md_bus.h
+  void StartBus(const std::string& prefix, uint32_t capacity,
+                uint32_t ring_size);
+  // records every source into daily tick files under dir, see TickRecorder
+  void StartRecorder(const std::string& dir);
   auto& srcs() const { return srcs_; }
   auto GetIndex(DataSrc::IdType src) {
     auto it = srcs_.find(src);
@@ -287,6 +642,10 @@ class MarketDataManager : public AdapterManager<MarketDataAdapter, kMdPrefix>,
 
  private:
   MarketDataAdapter* GetRoute(const Security& sec, DataSrc::IdType src);
+  const std::vector<MarketDataAdapter*>* FindRoute(const Security& sec,
+                                                   DataSrc::IdType src);
+  void SampleRates();
+  void ScheduleRebalance(int seconds_of_day);
 
  private:
   std::unordered_map<DataSrc::IdType, MarketDataAdapter::MarketDataMap>
@@ -296,6 +655,22 @@ class MarketDataManager : public AdapterManager<MarketDataAdapter, kMdPrefix>,
                        std::vector<MarketDataAdapter*>>
       routes_;
   std::unordered_map<DataSrc::IdType, uint8_t> srcs_;
+  tbb::concurrent_unordered_map<std::pair<DataSrc::IdType, Security::IdType>,
+                                tbb::atomic<uint32_t>>
+      refs_;
+  double unsubscribe_grace_ = 0;
+  // the adapter a security is routed to, and its update rate
+  struct Assignment {
+    tbb::atomic<MarketDataAdapter*> adapter;
+    uint32_t seq = 0;  // MarketData::seq() at the last sample
+    double rate = 0;   // updates per second, decayed
+  };
+  tbb::concurrent_unordered_map<std::pair<DataSrc::IdType, Security::IdType>,
+                                Assignment>
+      assignments_;
+  std::mutex balance_m_;  // of seq, rate and moving
+  int64_t last_sample_ = 0;
+  std::unordered_map<DataSrc::IdType, std::unique_ptr<MarketDataBus>> buses_;
 };
 
 }  // namespace opentrade
@@ -0,0 +1,104 @@
+#include "md_bus.h"
+
+#include <cerrno>
+
+#include "logger.h"
+#include "market_data.h"
+
+namespace opentrade {
+
+MarketDataBus* MarketDataBus::Create(const std::string& prefix, uint64_t src,
+                                     uint32_t capacity, uint32_t ring_size) {
+  if (!ring_size || (ring_size & (ring_size - 1))) {
+    LOG_ERROR("Market data bus ring size must be a power of 2: " << ring_size);
+    return nullptr;
+  }
+  auto name = md_bus::ShmName(prefix, src);
+  // a stale object of an earlier run may have another layout
+  shm_unlink(name.c_str());
+  auto fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    LOG_ERROR("Failed to create market data bus " << name << ": "
+                                                  << strerror(errno));
+    return nullptr;
+  }
+  auto size = md_bus::MapSize(capacity, ring_size);
+  void* p = MAP_FAILED;
+  if (!ftruncate(fd, size))
+    p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    LOG_ERROR("Failed to map market data bus " << name << ": "
+                                               << strerror(errno));
+    shm_unlink(name.c_str());
+    return nullptr;
+  }
+  // pages stay untouched, and zero, until the securities of them are written
+  auto bus = new MarketDataBus;
+  bus->name_ = name;
+  bus->map_ = p;
+  bus->size_ = size;
+  bus->header_ = static_cast<md_bus::Header*>(p);
+  bus->slots_ = reinterpret_cast<md_bus::Slot*>(bus->header_ + 1);
+  bus->ring_ = reinterpret_cast<md_bus::Note*>(bus->slots_ + capacity);
+  auto h = bus->header_;
+  h->version = md_bus::kVersion;
+  h->capacity = capacity;
+  h->ring_size = ring_size;
+  h->record_size = sizeof(md_bus::Slot);
+  h->depth_size = md_bus::kDepthSize;
+  h->src = src;
+  h->head.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  // readers check the magic last
+  memcpy(h->magic, md_bus::kMagic, sizeof(h->magic));
+  LOG_INFO("Market data bus " << name << " created, capacity=" << capacity
+                              << ", ring_size=" << ring_size);
+  return bus;
+}
+
+MarketDataBus::~MarketDataBus() {
+  if (map_) munmap(map_, size_);
+  shm_unlink(name_.c_str());
+}
+
+void MarketDataBus::Write(Security::IdType id, const MarketData& md) {
+  if (id >= header_->capacity) {
+    LOG_RATE_LIMITED(WARN, 60,
+                     "Market data bus " << name_ << " capacity "
+                                        << header_->capacity
+                                        << " exceeded by security id " << id);
+    return;
+  }
+  static_assert(MarketData::kDepthSize == md_bus::kDepthSize);
+  auto& r = slots_[id].r;
+  auto seq = r.seq.load(std::memory_order_relaxed);
+  r.seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  r.id = id;
+  r.tm = md.tm;
+  auto& t = md.trade;
+  r.trade = {static_cast<double>(t.qty),
+             t.open,
+             t.high,
+             t.low,
+             t.close,
+             t.vwap,
+             static_cast<double>(t.volume)};
+  for (auto i = 0u; i < md_bus::kDepthSize; ++i) {
+    auto& q = md.depth[i];
+    r.depth[i] = {q.ask_price, q.bid_price, static_cast<double>(q.ask_size),
+                  static_cast<double>(q.bid_size)};
+  }
+  r.seq.store(seq + 2, std::memory_order_release);
+
+  auto pos = header_->head.fetch_add(1, std::memory_order_relaxed);
+  auto& note = ring_[pos & (header_->ring_size - 1)];
+  // invalidated first, so that a reader of the lapped note sees it changed
+  note.pos.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  note.id = id;
+  note.pos.store(pos + 1, std::memory_order_release);
+}
+
+}  // namespace opentrade
@@ -0,0 +1,38 @@
+#ifndef OPENTRADE_MD_BUS_H_
+#define OPENTRADE_MD_BUS_H_
+
+#include <string>
+
+#include "md_bus/md_bus.h"
+#include "security.h"
+
+namespace opentrade {
+
+struct MarketData;
+
+// Publishes the MarketData of one source into shared memory for other
+// processes, see md_bus/md_bus.h for the layout and the readers. Write is
+// called by the adapter thread owning the MarketData right after its own
+// update, several adapters of the source may write different securities.
+class MarketDataBus {
+ public:
+  // nullptr with the error logged if the shared memory can not be created
+  static MarketDataBus* Create(const std::string& prefix, uint64_t src,
+                               uint32_t capacity, uint32_t ring_size);
+  ~MarketDataBus();
+  void Write(Security::IdType id, const MarketData& md);
+  const std::string& name() const { return name_; }
+
+ private:
+  MarketDataBus() = default;
+  std::string name_;
+  void* map_ = nullptr;
+  size_t size_ = 0;
+  md_bus::Header* header_ = nullptr;
+  md_bus::Slot* slots_ = nullptr;
+  md_bus::Note* ring_ = nullptr;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_MD_BUS_H_
@@ -0,0 +1,71 @@
+#include "memory.h"
+
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+
+#include "metrics.h"
+
+namespace opentrade {
+
+MemoryTag& MemoryAccounting::GetTag(const std::string& name) {
+  MemoryTag* tag;
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    for (auto& t : tags_) {
+      if (t.name() == name) return t;
+    }
+    tag = &tags_.emplace_back(name);
+  }
+  Export(name, [tag]() { return Usage{{}, tag->bytes(), tag->objects()}; });
+  return *tag;
+}
+
+void MemoryAccounting::AddReporter(const std::string& name, Reporter func) {
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    reporters_.emplace_back(name, func);
+  }
+  Export(name, func);
+}
+
+void MemoryAccounting::Export(const std::string& name,
+                              std::function<Usage()> func) {
+  auto& m = Metrics::Instance();
+  auto label = Metrics::Label("subsystem", name);
+  m.AddGauge("opentrade_memory_bytes", "Memory held by subsystem", label,
+             [func]() { return func().bytes; });
+  m.AddGauge("opentrade_memory_objects", "Objects held by subsystem", label,
+             [func]() { return func().objects; });
+}
+
+std::vector<MemoryAccounting::Usage> MemoryAccounting::Report() {
+  std::vector<Usage> out;
+  decltype(reporters_) reporters;
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    for (auto& t : tags_) out.push_back({t.name(), t.bytes(), t.objects()});
+    reporters = reporters_;
+  }
+  // outside m_, a reporter takes the locks of its subsystem
+  for (auto& pair : reporters) {
+    auto u = pair.second();
+    u.name = pair.first;
+    out.push_back(u);
+  }
+  std::sort(out.begin(), out.end(),
+            [](auto& a, auto& b) { return a.name < b.name; });
+  out.insert(out.begin(), Usage{"rss", Rss(), 0});
+  return out;
+}
+
+int64_t MemoryAccounting::Rss() {
+  auto f = fopen("/proc/self/statm", "r");
+  if (!f) return 0;
+  long size = 0, resident = 0;
+  auto n = fscanf(f, "%ld %ld", &size, &resident);
+  fclose(f);
+  return n == 2 ? resident * sysconf(_SC_PAGESIZE) : 0;
+}
+
+}  // namespace opentrade
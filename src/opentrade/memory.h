@@ -0,0 +1,146 @@
+#ifndef OPENTRADE_MEMORY_H_
+#define OPENTRADE_MEMORY_H_
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace opentrade {
+
+// Bytes and objects held by a subsystem, counted as they are allocated and
+// freed, e.g. in the operator new of a class or by CountingAllocator of a
+// container. Striped as Counter is, a thread adds to its own cache line.
+class MemoryTag {
+ public:
+  // the tag of name, created on first use and never freed
+  static MemoryTag& Get(const std::string& name);
+
+  void Add(int64_t bytes, int64_t objects = 1) {
+    auto& c = cells_[Cell::Index()];
+    c.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    c.objects.fetch_add(objects, std::memory_order_relaxed);
+  }
+  void Sub(int64_t bytes, int64_t objects = 1) { Add(-bytes, -objects); }
+  int64_t bytes() const {
+    int64_t n = 0;
+    for (auto& c : cells_) n += c.bytes.load(std::memory_order_relaxed);
+    return n;
+  }
+  int64_t objects() const {
+    int64_t n = 0;
+    for (auto& c : cells_) n += c.objects.load(std::memory_order_relaxed);
+    return n;
+  }
+  const std::string& name() const { return name_; }
+
+  explicit MemoryTag(const std::string& name) : name_(name) {}
+
+ private:
+  struct alignas(64) Cell {
+    static inline const size_t kNum = 16;
+    static size_t Index() {
+      static std::atomic<size_t> kNext = 0;
+      static thread_local size_t kIndex = kNext++ % kNum;
+      return kIndex;
+    }
+    std::atomic<int64_t> bytes = 0;
+    std::atomic<int64_t> objects = 0;
+  };
+  Cell cells_[Cell::kNum];
+  std::string name_;
+};
+
+// std allocator counting into a tag, e.g.
+//   std::unordered_map<K, V, H, E, CountingAllocator<std::pair<const K, V>>>
+//       map{0, H{}, E{}, CountingAllocator<...>("algo_index")};
+template <typename T>
+struct CountingAllocator {
+  typedef T value_type;
+
+  explicit CountingAllocator(const std::string& tag)
+      : tag_(&MemoryTag::Get(tag)) {}
+  template <typename U>
+  CountingAllocator(const CountingAllocator<U>& b) : tag_(b.tag_) {}
+
+  T* allocate(size_t n) {
+    tag_->Add(n * sizeof(T), n);
+    return std::allocator<T>().allocate(n);
+  }
+  void deallocate(T* p, size_t n) {
+    tag_->Sub(n * sizeof(T), n);
+    std::allocator<T>().deallocate(p, n);
+  }
+
+  template <typename U>
+  bool operator==(const CountingAllocator<U>& b) const {
+    return tag_ == b.tag_;
+  }
+  template <typename U>
+  bool operator!=(const CountingAllocator<U>& b) const {
+    return tag_ != b.tag_;
+  }
+
+  MemoryTag* tag_;
+};
+
+// Per subsystem memory, of the tags and of the reporters which estimate
+// what a subsystem holds when asked, e.g. the entries of a map times their
+// size. Exported as opentrade_memory_bytes and opentrade_memory_objects,
+// and to admins as "memory".
+class MemoryAccounting {
+ public:
+  // not Singleton, tags are created during static initialization
+  static MemoryAccounting& Instance() {
+    static MemoryAccounting kInstance;
+    return kInstance;
+  }
+
+  struct Usage {
+    std::string name;
+    int64_t bytes = 0;
+    int64_t objects = 0;
+    Usage& operator+=(const Usage& b) {
+      bytes += b.bytes;
+      objects += b.objects;
+      return *this;
+    }
+  };
+  // estimate of a node based map, its entries with a next pointer and a
+  // hash each, not what the entries own on the heap
+  template <typename M>
+  static Usage OfMap(const M& m) {
+    auto n = static_cast<int64_t>(m.size());
+    return {{}, n * static_cast<int64_t>(sizeof(typename M::value_type) + 16),
+            n};
+  }
+  typedef std::function<Usage()> Reporter;
+  // name is the subsystem, also set in the Usage returned by func
+  void AddReporter(const std::string& name, Reporter func);
+  // the tags and reporters by name, with "rss" of the process first
+  std::vector<Usage> Report();
+  // resident set size in bytes, from /proc/self/statm
+  static int64_t Rss();
+
+ private:
+  MemoryAccounting() {}
+  MemoryTag& GetTag(const std::string& name);
+  void Export(const std::string& name, std::function<Usage()> func);
+
+  std::mutex m_;
+  std::deque<MemoryTag> tags_;  // stable references
+  std::vector<std::pair<std::string, Reporter>> reporters_;
+  friend class MemoryTag;
+};
+
+inline MemoryTag& MemoryTag::Get(const std::string& name) {
+  return MemoryAccounting::Instance().GetTag(name);
+}
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_MEMORY_H_
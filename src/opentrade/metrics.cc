@@ -0,0 +1,125 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+#include "latency.h"
+
+namespace opentrade {
+
+void Metrics::Add(const std::string& name, const std::string& help,
+                  const char* type, Series series) {
+  std::lock_guard<std::mutex> lock(m_);
+  auto& f = families_[name];
+  if (f.series.empty()) {
+    f.help = help;
+    f.type = type;
+  }
+  f.series.push_back(std::move(series));
+}
+
+Counter* Metrics::AddCounter(const std::string& name, const std::string& help,
+                             const std::string& labels) {
+  auto c = new Counter;
+  Add(name, help, "counter", Series{labels, [c]() { return c->value(); }});
+  std::lock_guard<std::mutex> lock(m_);
+  counters_.emplace_back(c);
+  return c;
+}
+
+Gauge* Metrics::AddGauge(const std::string& name, const std::string& help,
+                         const std::string& labels) {
+  auto g = new Gauge;
+  Add(name, help, "gauge", Series{labels, [g]() { return g->value(); }});
+  std::lock_guard<std::mutex> lock(m_);
+  gauges_.emplace_back(g);
+  return g;
+}
+
+void Metrics::AddCounter(const std::string& name, const std::string& help,
+                         const std::string& labels,
+                         std::function<double()> func, const void* owner) {
+  Add(name, help, "counter", Series{labels, std::move(func), nullptr, owner});
+}
+
+void Metrics::AddGauge(const std::string& name, const std::string& help,
+                       const std::string& labels, std::function<double()> func,
+                       const void* owner) {
+  Add(name, help, "gauge", Series{labels, std::move(func), nullptr, owner});
+}
+
+void Metrics::AddSummary(const std::string& name, const std::string& help,
+                         const std::string& labels,
+                         const LatencyHistogram* hist, const void* owner) {
+  Add(name, help, "summary", Series{labels, {}, hist, owner});
+}
+
+void Metrics::Remove(const void* owner) {
+  if (!owner) return;
+  std::lock_guard<std::mutex> lock(m_);
+  for (auto it = families_.begin(); it != families_.end();) {
+    auto& s = it->second.series;
+    s.erase(std::remove_if(s.begin(), s.end(),
+                           [owner](auto& x) { return x.owner == owner; }),
+            s.end());
+    if (s.empty())
+      it = families_.erase(it);
+    else
+      ++it;
+  }
+}
+
+std::string Metrics::Label(const std::string& name, const std::string& value) {
+  std::string out = name + "=\"";
+  for (auto c : value) {
+    if (c == '\\' || c == '"') {
+      out += '\\';
+      out += c;
+    } else if (c == '\n') {
+      out += "\\n";
+    } else {
+      out += c;
+    }
+  }
+  return out + '"';
+}
+
+static inline std::string Braces(const std::string& labels,
+                                 const std::string& extra = "") {
+  if (labels.empty() && extra.empty()) return "";
+  if (labels.empty()) return "{" + extra + "}";
+  if (extra.empty()) return "{" + labels + "}";
+  return "{" + labels + "," + extra + "}";
+}
+
+std::string Metrics::Dump() const {
+  std::stringstream ss;
+  ss << std::setprecision(15);
+  std::lock_guard<std::mutex> lock(m_);
+  for (auto& pair : families_) {
+    auto& name = pair.first;
+    auto& f = pair.second;
+    ss << "# HELP " << name << ' ' << f.help << '\n';
+    ss << "# TYPE " << name << ' ' << f.type << '\n';
+    for (auto& s : f.series) {
+      if (!s.hist) {
+        ss << name << Braces(s.labels) << ' ' << s.func() << '\n';
+        continue;
+      }
+      for (auto q : {0.5, 0.9, 0.99, 0.999}) {
+        std::stringstream tmp;
+        tmp << "quantile=\"" << q << '"';
+        ss << name << Braces(s.labels, tmp.str()) << ' '
+           << s.hist->Percentile(q) / 1e9 << '\n';
+      }
+      ss << name << "_sum" << Braces(s.labels) << ' ' << s.hist->sum() / 1e9
+         << '\n';
+      ss << name << "_count" << Braces(s.labels) << ' ' << s.hist->count()
+         << '\n';
+    }
+  }
+  return ss.str();
+}
+
+}  // namespace opentrade
@@ -0,0 +1,114 @@
+#ifndef OPENTRADE_METRICS_H_
+#define OPENTRADE_METRICS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace opentrade {
+
+class LatencyHistogram;
+
+// Striped counter, a thread adds to its own cache line, summed on read
+class Counter {
+ public:
+  void Add(uint64_t n = 1) {
+    cells_[Cell::Index()].v.fetch_add(n, std::memory_order_relaxed);
+  }
+  uint64_t value() const {
+    uint64_t n = 0;
+    for (auto& c : cells_) n += c.v.load(std::memory_order_relaxed);
+    return n;
+  }
+
+ private:
+  struct alignas(64) Cell {
+    static inline const size_t kNum = 16;
+    static size_t Index() {
+      static std::atomic<size_t> kNext = 0;
+      static thread_local size_t kIndex = kNext++ % kNum;
+      return kIndex;
+    }
+    std::atomic<uint64_t> v = 0;
+  };
+  Cell cells_[Cell::kNum];
+};
+
+class Gauge {
+ public:
+  void Set(int64_t v) { v_.store(v, std::memory_order_relaxed); }
+  void Add(int64_t n) { v_.fetch_add(n, std::memory_order_relaxed); }
+  int64_t value() const { return v_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> v_ = 0;
+};
+
+// Registry of the process metrics, read in Prometheus text format on
+// GET /metrics. A metric is looked up once at registration, the hot path
+// only touches its Counter or Gauge. Labels are given preformatted, e.g.
+// Label("runner", 1) + "," + Label("pool", "write").
+class Metrics {
+ public:
+  // not Singleton, metrics are registered during static initialization
+  static Metrics& Instance() {
+    static Metrics kInstance;
+    return kInstance;
+  }
+
+  // owned by the registry and never freed
+  Counter* AddCounter(const std::string& name, const std::string& help,
+                      const std::string& labels = "");
+  Gauge* AddGauge(const std::string& name, const std::string& help,
+                  const std::string& labels = "");
+  // evaluated on read, owner is for Remove
+  void AddCounter(const std::string& name, const std::string& help,
+                  const std::string& labels, std::function<double()> func,
+                  const void* owner = nullptr);
+  void AddGauge(const std::string& name, const std::string& help,
+                const std::string& labels, std::function<double()> func,
+                const void* owner = nullptr);
+  // quantiles of a histogram of nanoseconds, reported in seconds
+  void AddSummary(const std::string& name, const std::string& help,
+                  const std::string& labels, const LatencyHistogram* hist,
+                  const void* owner = nullptr);
+  // drops the series registered with owner
+  void Remove(const void* owner);
+  std::string Dump() const;
+
+  static std::string Label(const std::string& name, const std::string& value);
+  static std::string Label(const std::string& name, int64_t value) {
+    return Label(name, std::to_string(value));
+  }
+
+ private:
+  Metrics() {}
+  struct Series {
+    std::string labels;
+    std::function<double()> func;
+    const LatencyHistogram* hist = nullptr;
+    const void* owner = nullptr;
+  };
+  struct Family {
+    std::string help;
+    const char* type;
+    std::vector<Series> series;
+  };
+  void Add(const std::string& name, const std::string& help, const char* type,
+           Series series);
+
+ private:
+  std::map<std::string, Family> families_;
+  std::vector<std::unique_ptr<Counter>> counters_;
+  std::vector<std::unique_ptr<Gauge>> gauges_;
+  mutable std::mutex m_;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_METRICS_H_
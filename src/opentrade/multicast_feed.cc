@@ -0,0 +1,201 @@
+#include "multicast_feed.h"
+
+#include <algorithm>
+
+#include "logger.h"
+#include "metrics.h"
+#include "socket.h"
+
+namespace opentrade {
+
+namespace ip = boost::asio::ip;
+
+MulticastFeed::~MulticastFeed() { Metrics::Instance().Remove(this); }
+
+void MulticastFeed::Start() noexcept {
+  gap_timeout_ = config<int64_t>("gap_timeout", gap_timeout_);
+  buf_.resize(kBatch * kMaxPacket);
+  for (auto i = 0u; i < kBatch; ++i) {
+    iovs_[i].iov_base = &buf_[i * kMaxPacket];
+    iovs_[i].iov_len = kMaxPacket;
+    msgs_[i].msg_hdr.msg_iov = &iovs_[i];
+    msgs_[i].msg_hdr.msg_iovlen = 1;
+  }
+  auto& m = Metrics::Instance();
+  auto label = Metrics::Label("adapter", name());
+  for (auto i = 0; i < 2; ++i) {
+    auto& line = lines_[i];
+    line.name = i ? "line_b" : "line_a";
+    auto addr = config(line.name);
+    if (addr.empty()) continue;
+    if (!Open(&line, addr)) continue;
+    auto l = label + "," + Metrics::Label("line", line.name);
+    m.AddCounter("opentrade_multicast_packets_total",
+                 "Packets received of the feed", l,
+                 [&line]() { return line.packets.load(); }, this);
+    m.AddCounter("opentrade_multicast_arbitration_won_total",
+                 "Packets decoded first from the line", l,
+                 [&line]() { return line.won.load(); }, this);
+  }
+  if (!lines_[0].socket && !lines_[1].socket) {
+    LOG_ERROR(name() << ": no line to receive from");
+    return;
+  }
+  m.AddCounter("opentrade_multicast_gap_messages_total",
+               "Messages skipped on unrecovered gaps", label,
+               [this]() { return gaps_.load(); }, this);
+  tp_.AddTask([this]() {
+    for (auto& line : lines_) {
+      if (line.socket) Wait(&line);
+    }
+  });
+  auto interval =
+      boost::posix_time::microseconds(std::max<int64_t>(gap_timeout_, 1));
+  gap_timer_ = tp_.RepeatTask([this]() { CheckGap(); }, interval, interval);
+  connected_ = 1;
+}
+
+void MulticastFeed::Stop() noexcept {
+  tp_.CancelTask(gap_timer_);
+  tp_.AddTask([this]() {
+    for (auto& line : lines_) {
+      if (!line.socket) continue;
+      boost::system::error_code ec;
+      line.socket->close(ec);
+    }
+  });
+  connected_ = 0;
+}
+
+bool MulticastFeed::Open(Line* line, const std::string& addr) {
+  std::string host, port;
+  boost::system::error_code ec;
+  ip::address group;
+  if (SplitHostPort(addr, &host, &port))
+    group = ip::address::from_string(host, ec);
+  if (port.empty() || ec || !group.is_multicast()) {
+    LOG_ERROR(name() << ": invalid " << line->name << " " << addr);
+    return false;
+  }
+  auto iface = ip::address_v4::any();
+  auto iface_str = config("interface");
+  if (!iface_str.empty()) iface = ip::address_v4::from_string(iface_str, ec);
+  auto s = std::make_unique<ip::udp::socket>(tp_.service());
+  // bound to the group rather than any, not to take other groups of the port
+  ip::udp::endpoint ep(group, atoi(port.c_str()));
+  s->open(ep.protocol(), ec);
+  if (!ec) s->set_option(ip::udp::socket::reuse_address(true), ec);
+  if (!ec) s->bind(ep, ec);
+  if (!ec) s->set_option(ip::multicast::join_group(group.to_v4(), iface), ec);
+  auto rcvbuf = config<int>("rcvbuf");
+  if (!ec && rcvbuf > 0) {
+    s->set_option(boost::asio::socket_base::receive_buffer_size(rcvbuf), ec);
+  }
+  if (!ec) s->non_blocking(true, ec);
+  if (ec) {
+    LOG_ERROR(name() << ": failed to join " << line->name << " " << addr
+                     << ": " << ec.message());
+    return false;
+  }
+  LOG_INFO(name() << ": joined " << line->name << " " << addr);
+  line->socket = std::move(s);
+  return true;
+}
+
+void MulticastFeed::Wait(Line* line) {
+  auto func = [this, line](const boost::system::error_code& ec, auto...) {
+    if (ec) return;
+    Receive(line);
+    Wait(line);
+  };
+#if BOOST_VERSION < 106600
+  line->socket->async_receive(boost::asio::null_buffers(), func);
+#else
+  line->socket->async_wait(ip::udp::socket::wait_read, func);
+#endif
+}
+
+void MulticastFeed::Receive(Line* line) {
+  auto fd = line->socket->native_handle();
+  for (;;) {
+    auto n = recvmmsg(fd, msgs_, kBatch, MSG_DONTWAIT, nullptr);
+    if (n <= 0) break;
+    for (auto i = 0; i < n; ++i)
+      OnPacket(line, &buf_[i * kMaxPacket], msgs_[i].msg_len);
+    if (n < static_cast<int>(kBatch)) break;
+  }
+  CheckGap();
+}
+
+void MulticastFeed::OnPacket(Line* line, const char* p, size_t n) {
+  uint64_t seq;
+  uint32_t count;
+  if (!Sequence(p, n, &seq, &count)) return;
+  if (line) line->packets.fetch_add(1, std::memory_order_relaxed);
+  if (!started_) {
+    next_ = seq;
+    started_ = true;
+  }
+  auto end = seq + count;
+  if (seq <= next_) {
+    if (end <= next_) return;  // the other line's, or retransmitted already
+    if (line) line->won.fetch_add(1, std::memory_order_relaxed);
+    Decode(p, n, next_ - seq);
+    next_ = end;
+    if (!pending_.empty()) Drain();
+    return;
+  }
+  if (pending_.empty()) gap_since_ = TimerService::Now();
+  if (pending_.size() < kMaxPending)
+    pending_.emplace(seq, Pending{std::string(p, n), count});
+}
+
+void MulticastFeed::Drain() {
+  auto n = pending_.size();
+  while (!pending_.empty()) {
+    auto it = pending_.begin();
+    if (it->first > next_) break;
+    auto end = it->first + it->second.count;
+    if (end > next_) {
+      auto& packet = it->second.packet;
+      Decode(packet.data(), packet.size(), next_ - it->first);
+      next_ = end;
+    }
+    pending_.erase(it);
+  }
+  if (pending_.empty()) {
+    if (recovering_) LOG_INFO(name() << ": recovered at " << next_);
+    recovering_ = false;
+  } else if (pending_.size() != n) {
+    gap_since_ = TimerService::Now();
+  }
+}
+
+void MulticastFeed::CheckGap() {
+  if (pending_.empty()) return;
+  auto full = pending_.size() >= kMaxPending;
+  if (recovering_ && !full) return;
+  if (!full && TimerService::Now() - gap_since_ < gap_timeout_) return;
+  auto to = pending_.begin()->first;
+  if (!recovering_ && !full && OnGap(next_, to)) {
+    LOG_INFO(name() << ": recovering " << next_ << " to " << to - 1);
+    recovering_ = true;
+    return;
+  }
+  LOG_WARN(name() << ": skipped " << next_ << " to " << to - 1);
+  gaps_.fetch_add(to - next_, std::memory_order_relaxed);
+  recovering_ = false;
+  next_ = to;
+  Drain();
+}
+
+void MulticastFeed::Resync(uint64_t next) {
+  LOG_INFO(name() << ": resync at " << next);
+  if (next > next_) next_ = next;
+  recovering_ = false;
+  started_ = true;
+  Drain();
+  if (!pending_.empty()) gap_since_ = TimerService::Now();
+}
+
+}  // namespace opentrade
@@ -0,0 +1,93 @@
+#ifndef OPENTRADE_MULTICAST_FEED_H_
+#define OPENTRADE_MULTICAST_FEED_H_
+
+#include <sys/socket.h>
+#include <boost/asio.hpp>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "market_data.h"
+
+namespace opentrade {
+
+// Base of the direct exchange feeds over UDP multicast, e.g. MoldUDP64 or
+// the packet headers of the other native feeds. The packets of the lines
+// are received in batches of recvmmsg on tp_, where all of the below runs,
+// and arbitrated by sequence number: the first copy of a packet from either
+// line is decoded in place in the receive buffer by Decode, which calls
+// Update as the other adapters do. Packets ahead of the expected sequence
+// wait gap_timeout for the other line, then OnGap may start a retransmit or
+// snapshot recovery, whose packets come in with Retransmitted and which ends
+// once the gap is filled or with Resync; otherwise the gap is skipped.
+// Configs:
+//   line_a=239.1.1.1:30001
+//   line_b=239.1.1.2:30001, optional
+//   interface=10.0.0.1, the local address to join on, any by default
+//   rcvbuf=<bytes>, SO_RCVBUF
+//   gap_timeout=<micro seconds>, 1000 by default
+class MulticastFeed : public MarketDataAdapter {
+ public:
+  ~MulticastFeed();
+  void Start() noexcept override;
+  void Stop() noexcept override;
+
+ protected:
+  // the sequence number of the first message and the count of messages of
+  // a packet, false if not a packet of the feed; count is 0 for a
+  // heartbeat, whose seq is the next one to come
+  virtual bool Sequence(const char* p, size_t n, uint64_t* seq,
+                        uint32_t* count) noexcept = 0;
+  // the messages of a packet, the first skip of them decoded already
+  virtual void Decode(const char* p, size_t n, uint32_t skip) noexcept = 0;
+  // messages [from, to) missed on all lines, true if a recovery is started
+  virtual bool OnGap(uint64_t from, uint64_t to) noexcept { return false; }
+  // the feed has all the securities, subscribing is only local
+  void SubscribeSync(const Security& sec) noexcept override {}
+
+  // a packet of the recovery, on tp_
+  void Retransmitted(const char* p, size_t n) { OnPacket(nullptr, p, n); }
+  // the state is that before message next, e.g. after a snapshot, on tp_
+  void Resync(uint64_t next);
+  uint64_t next_seq() const { return next_; }
+
+ private:
+  struct Line {
+    std::string name;
+    std::unique_ptr<boost::asio::ip::udp::socket> socket;
+    std::atomic<uint64_t> packets = 0;
+    std::atomic<uint64_t> won = 0;  // of the arbitration
+  };
+  struct Pending {
+    std::string packet;
+    uint32_t count;
+  };
+  bool Open(Line* line, const std::string& addr);
+  void Wait(Line* line);
+  void Receive(Line* line);
+  void OnPacket(Line* line, const char* p, size_t n);
+  // the pending packets up to the next gap
+  void Drain();
+  void CheckGap();
+
+  static inline const size_t kBatch = 32;
+  static inline const size_t kMaxPacket = 9000;  // jumbo frame
+  static inline const size_t kMaxPending = 1 << 16;
+  Line lines_[2];
+  std::vector<char> buf_;
+  mmsghdr msgs_[kBatch] = {};
+  iovec iovs_[kBatch] = {};
+  std::map<uint64_t, Pending> pending_;
+  uint64_t next_ = 0;
+  bool started_ = false;
+  bool recovering_ = false;
+  int64_t gap_since_ = 0;
+  int64_t gap_timeout_ = 1000;
+  TimerId gap_timer_ = 0;
+  std::atomic<uint64_t> gaps_ = 0;  // messages skipped
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_MULTICAST_FEED_H_
@@ -0,0 +1,149 @@
+#include "numa.h"
+
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <cstdint>
+
+#include "logger.h"
+#include "memory.h"
+
+namespace fs = boost::filesystem;
+
+namespace opentrade {
+
+int NumaNodeOfCpu(int cpu) {
+  if (cpu < 0) return -1;
+  boost::system::error_code ec;
+  fs::directory_iterator it(
+      "/sys/devices/system/cpu/cpu" + std::to_string(cpu), ec);
+  if (ec) return -1;
+  for (; it != fs::directory_iterator(); it.increment(ec)) {
+    auto name = it->path().filename().string();
+    if (name.size() > 4 && !name.compare(0, 4, "node"))
+      return atoi(name.c_str() + 4);
+  }
+  return -1;
+}
+
+void HugePages::Initialize(size_t page_size, size_t reserve) {
+  if (page_size != kThpSize && page_size != (1lu << 30)) {
+    LOG_ERROR("Invalid huge page size " << page_size);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    if (page_size_) return;
+    page_size_ = page_size;
+    if (reserve) Map(reserve, -1);
+  }
+  LOG_INFO("Huge pages of " << (page_size >> 20) << "MB, "
+                            << (mapped_ >> 20) << "MB reserved");
+  MemoryAccounting::Instance().AddReporter("huge_pages", [this]() {
+    std::lock_guard<std::mutex> lock(m_);
+    MemoryAccounting::Usage u;
+    u.bytes = mapped_;
+    u.objects = chunks_.size();
+    return u;
+  });
+}
+
+HugePages::Chunk* HugePages::Map(size_t size, int node) {
+  void* p = MAP_FAILED;
+  size_t n = 0;
+  if (hugetlb_) {
+    n = (size + page_size_ - 1) / page_size_ * page_size_;
+    auto shift = page_size_ == kThpSize ? 21 : 30;
+    auto flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+    p = mmap(nullptr, n, PROT_READ | PROT_WRITE,
+             flags | shift << MAP_HUGE_SHIFT, -1, 0);
+    if (p == MAP_FAILED) {
+      hugetlb_ = false;
+      LOG_WARN("No hugetlbfs pages of " << (page_size_ >> 20)
+                                        << "MB left, falling back to "
+                                           "transparent huge pages");
+    }
+  }
+  if (p == MAP_FAILED) {
+    // mapped one page more to be trimmed to the alignment
+    n = (size + kThpSize - 1) / kThpSize * kThpSize;
+    auto raw = static_cast<char*>(mmap(nullptr, n + kThpSize,
+                                       PROT_READ | PROT_WRITE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (raw == MAP_FAILED) throw std::bad_alloc();
+    auto aligned = reinterpret_cast<char*>(
+        (reinterpret_cast<uintptr_t>(raw) + kThpSize - 1) & ~(kThpSize - 1));
+    if (aligned > raw) munmap(raw, aligned - raw);
+    munmap(aligned + n, raw + kThpSize - aligned);
+    madvise(aligned, n, MADV_HUGEPAGE);
+    p = aligned;
+  }
+  NumaBind(p, n, node);
+  // prefault, a write per 4K page as transparent ones may be split
+  auto begin = static_cast<char*>(p);
+  for (size_t i = 0; i < n; i += 4096)
+    reinterpret_cast<volatile char*>(begin)[i] = 0;
+  mapped_ += n;
+  chunks_.push_back({begin, begin, begin + n, node});
+  return &chunks_.back();
+}
+
+void* HugePages::Allocate(size_t size, int node) {
+  if (!page_size_) return nullptr;
+  size = (size + kAlign - 1) / kAlign * kAlign;
+  std::lock_guard<std::mutex> lock(m_);
+  Chunk* c = nullptr;
+  for (auto& c2 : chunks_) {
+    if (c2.node == node && static_cast<size_t>(c2.end - c2.cur) >= size) {
+      c = &c2;
+      break;
+    }
+  }
+  if (!c) c = Map(std::max(size, hugetlb_ ? page_size_ : kThpSize), node);
+  auto p = c->cur;
+  c->cur += size;
+  return p;
+}
+
+bool HugePages::Owns(const void* p) {
+  if (!page_size_) return false;
+  std::lock_guard<std::mutex> lock(m_);
+  for (auto& c : chunks_) {
+    if (p >= c.begin && p < c.end) return true;
+  }
+  return false;
+}
+
+NumaArena::~NumaArena() {
+  for (auto c : chunks_) HugeFree(c, kChunkSize);
+}
+
+void* NumaArena::Allocate(size_t size) {
+  if (size > kMaxBlock) return HugeAlloc(size, node_);
+  auto c = Class(size);
+  if (!c) c = 1;
+  if (auto b = free_[c]) {
+    free_[c] = b->next;
+    return b;
+  }
+  auto n = c * kAlign;
+  if (!cur_ || n > static_cast<size_t>(end_ - cur_)) {
+    cur_ = static_cast<char*>(HugeAlloc(kChunkSize, node_));
+    end_ = cur_ + kChunkSize;
+    chunks_.push_back(cur_);
+  }
+  auto p = cur_;
+  cur_ += n;
+  return p;
+}
+
+void NumaArena::Deallocate(void* p, size_t size) {
+  if (!p) return;
+  if (size > kMaxBlock) return HugeFree(p, size);
+  auto c = Class(size);
+  if (!c) c = 1;
+  auto b = static_cast<Block*>(p);
+  b->next = free_[c];
+  free_[c] = b;
+}
+
+}  // namespace opentrade
@@ -0,0 +1,150 @@
+#ifndef OPENTRADE_NUMA_H_
+#define OPENTRADE_NUMA_H_
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace opentrade {
+
+// node of cpu, -1 if unknown, e.g. not a NUMA machine
+int NumaNodeOfCpu(int cpu);
+
+// pages of [p, p + size) not faulted yet to come from node, node < 0 leaves
+// it to the first touch
+inline void NumaBind(void* p, size_t size, int node) {
+  if (node < 0 || node >= 64) return;
+  // MPOL_PREFERRED of mbind(2), not to depend on libnuma for one call;
+  // preferred rather than bound, falls back to other nodes if node is full
+  static const int kMpolPreferred = 1;
+  unsigned long mask = 1lu << node;
+  syscall(SYS_mbind, p, size, kMpolPreferred, &mask, sizeof(mask) * 8 + 1, 0);
+}
+
+// page aligned, preferably from node, node < 0 leaves it to the first touch
+inline void* NumaAlloc(size_t size, int node) {
+  auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) throw std::bad_alloc();
+  NumaBind(p, size, node);
+  return p;
+}
+
+inline void NumaFree(void* p, size_t size) {
+  if (p) munmap(p, size);
+}
+
+// Huge page arena of the hot data kept for the process, e.g. the MarketData
+// segments, the slabs of the pools and the chunks of the runner arenas, so
+// tens of thousands of securities take a few TLB entries rather than
+// thousands. Chunks are of hugetlbfs pages of page_size if the kernel has
+// them reserved, else 2MB aligned ones advised to transparent huge pages,
+// and are prefaulted when mapped, not to fault on the first ticks after the
+// open. Disabled unless Initialize is called at startup, before the data is
+// allocated.
+class HugePages {
+ public:
+  static HugePages& Instance() {
+    static HugePages kInstance;
+    return kInstance;
+  }
+
+  // page_size of 2MB or 1GB, reserve bytes mapped up front
+  void Initialize(size_t page_size, size_t reserve);
+  bool enabled() const { return page_size_; }
+  // 64 byte aligned, preferably from node, nullptr if disabled; never
+  // returned to the system
+  void* Allocate(size_t size, int node = -1);
+  // whether p is of Allocate, not to be freed
+  bool Owns(const void* p);
+
+ private:
+  HugePages() {}
+  struct Chunk {
+    char* begin;
+    char* cur;
+    char* end;
+    int node;
+  };
+  // m_ held
+  Chunk* Map(size_t size, int node);
+
+  static inline const size_t kAlign = 64;
+  static inline const size_t kThpSize = 2 << 20;
+  std::mutex m_;
+  std::vector<Chunk> chunks_;
+  size_t page_size_ = 0;
+  bool hugetlb_ = true;  // false once the reserved pages run out
+  size_t mapped_ = 0;
+};
+
+// from HugePages if enabled, else NumaAlloc
+inline void* HugeAlloc(size_t size, int node) {
+  auto p = HugePages::Instance().Allocate(size, node);
+  return p ? p : NumaAlloc(size, node);
+}
+
+inline void HugeFree(void* p, size_t size) {
+  if (p && !HugePages::Instance().Owns(p)) NumaFree(p, size);
+}
+
+// Chunks of node local memory carved into 64 byte aligned blocks, freed
+// blocks go to per size free lists and never back to the system until the
+// arena is destroyed. Not thread safe, owned by the one thread using it.
+class NumaArena {
+ public:
+  explicit NumaArena(int node = -1) : node_(node) {}
+  ~NumaArena();
+  NumaArena(const NumaArena&) = delete;
+  NumaArena& operator=(const NumaArena&) = delete;
+
+  // for the chunks allocated from now on
+  void set_node(int node) { node_ = node; }
+  int node() const { return node_; }
+  void* Allocate(size_t size);
+  void Deallocate(void* p, size_t size);
+
+ private:
+  static inline const size_t kAlign = 64;
+  static inline const size_t kChunkSize = 2 << 20;
+  // larger ones are allocated on their own
+  static inline const size_t kMaxBlock = 64 * kAlign;
+  static size_t Class(size_t size) { return (size + kAlign - 1) / kAlign; }
+  struct Block {
+    Block* next;
+  };
+  int node_;
+  std::vector<void*> chunks_;
+  char* cur_ = nullptr;
+  char* end_ = nullptr;
+  Block* free_[kMaxBlock / kAlign + 1] = {};
+};
+
+template <typename T>
+struct NumaAllocator {
+  typedef T value_type;
+  explicit NumaAllocator(NumaArena* a) : arena(a) {}
+  template <typename U>
+  NumaAllocator(const NumaAllocator<U>& b) : arena(b.arena) {}
+  T* allocate(size_t n) {
+    return static_cast<T*>(arena->Allocate(n * sizeof(T)));
+  }
+  void deallocate(T* p, size_t n) { arena->Deallocate(p, n * sizeof(T)); }
+  template <typename U>
+  bool operator==(const NumaAllocator<U>& b) const {
+    return arena == b.arena;
+  }
+  template <typename U>
+  bool operator!=(const NumaAllocator<U>& b) const {
+    return arena != b.arena;
+  }
+  NumaArena* arena;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_NUMA_H_
@@ -1,14 +1,89 @@
 #include "opentick.h"
 
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <set>
+
 #include "logger.h"
 
 namespace opentrade {
 
+static const int kDay = 24 * 3600;
+static const int64_t kMicro = kMicroInSec;
+static const auto kCachePath = kStorePath / "opentick";
+
 struct OpenTickLogger : public opentick::Logger {
   void Info(const std::string& msg) noexcept override { LOG_INFO(msg); }
   void Error(const std::string& msg) noexcept override { LOG_ERROR(msg); }
 };
 
+struct OpenTick::Batch {
+  std::vector<Security::IdType> secs;
+  int interval;
+  time_t start_time;
+  time_t end_time;
+  std::string tbl;
+  RowsCallback callback;
+  std::function<void()> done;
+  std::atomic<size_t> next = 0;
+  std::atomic<size_t> completed = 0;
+};
+
+// one row of a cached day on disk
+struct DiskBar {
+  int64_t tm;  // microseconds since epoch
+  double v[5];
+};
+
+static int64_t ToMicro(const opentick::ValueScalar& v) {
+  auto tm = std::get_if<opentick::Tm>(&v);
+  if (!tm) return INT64_MIN;
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             tm->time_since_epoch())
+      .count();
+}
+
+static bool ToDouble(const opentick::ValueScalar& v, double* out) {
+  return std::visit(
+      [out](auto&& x) {
+        typedef std::decay_t<decltype(x)> T;
+        if constexpr (std::is_arithmetic_v<T>) {
+          *out = static_cast<double>(x);
+          return true;
+        } else {
+          return false;
+        }
+      },
+      v);
+}
+
+OpenTickBars::OpenTickBars(Security::IdType sec,
+                           const opentick::ValuesVector& rows)
+    : sec(sec) {
+  data.resize(kColumns * rows.size());
+  for (auto& row : rows) {
+    if (row.size() != kColumns) continue;
+    auto tm = ToMicro(row[0]);
+    if (tm == INT64_MIN) continue;
+    data[kTime * rows.size() + size] = static_cast<double>(tm) / kMicroInSec;
+    for (auto c = 1; c < kColumns; ++c) {
+      if (!ToDouble(row[c], &data[c * rows.size() + size])) {
+        data[c * rows.size() + size] = NAN;
+      }
+    }
+    ++size;
+  }
+  // skipped rows leave gaps at the end of each column
+  if (size < rows.size()) {
+    for (auto c = 1; c < kColumns; ++c) {
+      auto from = data.begin() + c * rows.size();
+      std::copy(from, from + size, data.begin() + c * size);
+    }
+    data.resize(kColumns * size);
+  }
+}
+
 void OpenTick::Initialize(const std::string& url) {
   conn_ = opentick::Connection::Create(url);
   conn_->SetLogger(std::make_shared<OpenTickLogger>());
@@ -16,24 +91,372 @@ void OpenTick::Initialize(const std::string& url) {
   conn_->Start();
 }
 
-opentick::ResultSet OpenTick::Request(Security::IdType sec, int interval,
-                                      time_t start_time, time_t end_time,
-                                      const std::string& tbl,
-                                      opentick::Callback callback) {
+void OpenTick::Query(const std::string& tbl, Security::IdType sec,
+                     int interval, time_t start_time, time_t end_time,
+                     opentick::Callback callback) {
   if (!conn_ || !conn_->IsConnected()) {
-    if (callback) callback({}, "OpenTick not connected");
-    return {};
+    callback({}, "OpenTick not connected");
+    return;
   }
   try {
-    auto fut = conn_->ExecuteAsync(
+    conn_->ExecuteAsync(
         "select time, open, high, low, close, volume from " + tbl +
             " where sec=? and interval=? and time>=? and time<?",
         opentick::Args{sec, interval, start_time, end_time}, callback);
-    if (!callback) return fut->Get();
   } catch (std::exception& e) {
-    if (callback) callback({}, e.what());
+    callback({}, e.what());
+  }
+}
+
+opentick::ResultSet OpenTick::Request(Security::IdType sec, int interval,
+                                      time_t start_time, time_t end_time,
+                                      const std::string& tbl,
+                                      opentick::Callback callback) {
+  if (!callback) {
+    // errors give an empty result as before
+    auto p = std::make_shared<std::promise<opentick::ResultSet>>();
+    auto fut = p->get_future();
+    Request(sec, interval, start_time, end_time, tbl,
+            [p](opentick::ResultSet res, const std::string& err) {
+              p->set_value(err.empty() ? res : opentick::ResultSet{});
+            });
+    return fut.get();
+  }
+  if (start_time >= end_time) {
+    callback(std::make_shared<opentick::ValuesVector>(), "");
+    return {};
+  }
+
+  // today may still be growing, so only the days before it are cached
+  auto today = static_cast<int>(GetTime() / kDay);
+  auto day0 = static_cast<int>(start_time / kDay);
+  auto day1 = std::min(static_cast<int>((end_time - 1) / kDay), today - 1);
+  auto live = end_time > static_cast<time_t>(today) * kDay;
+  auto n = std::max(day1 - day0 + 1, 0) + live;
+
+  struct Join {
+    std::vector<opentick::ResultSet> parts;
+    std::atomic<int> left;
+    std::mutex m;
+    std::string err;
+  };
+  auto join = std::make_shared<Join>();
+  join->parts.resize(n);
+  join->left = n;
+  auto set = [join, start_time, end_time, callback](
+                 int i, opentick::ResultSet rows, const std::string& err) {
+    if (err.size()) {
+      std::lock_guard<std::mutex> lock(join->m);
+      if (join->err.empty()) join->err = err;
+    } else {
+      join->parts[i] = rows;
+    }
+    if (--join->left) return;
+    if (join->err.size()) {
+      callback({}, join->err);
+      return;
+    }
+    auto start = start_time * kMicro;
+    auto end = end_time * kMicro;
+    auto out = std::make_shared<opentick::ValuesVector>();
+    for (auto& part : join->parts) {
+      if (!part) continue;
+      for (auto& row : *part) {
+        if (row.empty()) continue;
+        auto tm = ToMicro(row[0]);
+        if (tm == INT64_MIN || (tm >= start && tm < end)) out->push_back(row);
+      }
+    }
+    callback(out, "");
+  };
+
+  std::vector<std::pair<int, opentick::ResultSet>> ready;
+  std::vector<int> missing;
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    for (auto d = day0; d <= day1; ++d) {
+      auto& e = cache_[Key{tbl, sec, interval, d}];
+      if (!e) {
+        e = std::make_shared<Entry>();
+        missing.push_back(d);
+      }
+      auto i = d - day0;
+      if (e->ready) {
+        ready.emplace_back(i, e->rows);
+      } else {
+        e->waiters.push_back(
+            [set, i](opentick::ResultSet rows, const std::string& err) {
+              set(i, rows, err);
+            });
+      }
+    }
+  }
+  for (auto& pair : ready) set(pair.first, pair.second, "");
+
+  std::vector<int> fetch;
+  for (auto d : missing) {
+    Key key{tbl, sec, interval, d};
+    if (auto rows = Load(key))
+      Complete(key, rows, "");
+    else
+      fetch.push_back(d);
+  }
+  // contiguous days missing from the disk too in one query each
+  for (auto i = 0u; i < fetch.size();) {
+    auto j = i;
+    while (j + 1 < fetch.size() && fetch[j + 1] == fetch[j] + 1) ++j;
+    Fetch(tbl, sec, interval, fetch[i], fetch[j]);
+    i = j + 1;
+  }
+
+  if (live) {
+    Query(tbl, sec, interval,
+          std::max(start_time, static_cast<time_t>(today) * kDay), end_time,
+          [set, n](opentick::ResultSet rows, const std::string& err) {
+            set(n - 1, rows, err);
+          });
   }
   return {};
 }
 
+void OpenTick::Fetch(const std::string& tbl, Security::IdType sec,
+                     int interval, int day0, int day1) {
+  Query(
+      tbl, sec, interval, static_cast<time_t>(day0) * kDay,
+      static_cast<time_t>(day1 + 1) * kDay,
+      [this, tbl, sec, interval, day0, day1](opentick::ResultSet res,
+                                             const std::string& err) {
+        std::vector<opentick::ResultSet> days(day1 - day0 + 1);
+        for (auto& rows : days) {
+          rows = std::make_shared<opentick::ValuesVector>();
+        }
+        if (err.empty() && res) {
+          for (auto& row : *res) {
+            if (row.empty()) continue;
+            auto tm = ToMicro(row[0]);
+            if (tm == INT64_MIN) continue;
+            auto d = static_cast<int>(tm / kMicro / kDay);
+            if (d >= day0 && d <= day1) days[d - day0]->push_back(row);
+          }
+        }
+        for (auto d = day0; d <= day1; ++d) {
+          Key key{tbl, sec, interval, d};
+          auto& rows = days[d - day0];
+          Complete(key, rows, err);
+          if (err.empty())
+            kWriteTaskPool.AddTask([key, rows]() { Save(key, rows); });
+        }
+      });
+}
+
+void OpenTick::Complete(const Key& key, opentick::ResultSet rows,
+                        const std::string& err) {
+  std::vector<opentick::Callback> waiters;
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    auto it = cache_.find(key);
+    if (it == cache_.end()) return;
+    waiters.swap(it->second->waiters);
+    if (err.size()) {
+      // retried by the next request
+      cache_.erase(it);
+    } else {
+      it->second->rows = rows;
+      it->second->ready = true;
+      loaded_.push_back(key);
+      while (cache_.size() > cache_size_ && !loaded_.empty()) {
+        auto it2 = cache_.find(loaded_.front());
+        if (it2 != cache_.end() && it2->second->ready) cache_.erase(it2);
+        loaded_.pop_front();
+      }
+    }
+  }
+  for (auto& func : waiters) func(rows, err);
+}
+
+static fs::path CachePath(const std::string& tbl, Security::IdType sec,
+                          int interval, int day) {
+  // tbl comes from the clients, keep it inside the cache directory
+  if (tbl.empty() || !std::all_of(tbl.begin(), tbl.end(), [](char c) {
+        return isalnum(c) || c == '_';
+      }))
+    return {};
+  return kCachePath / (tbl + '_' + std::to_string(interval)) /
+         std::to_string(day) / std::to_string(sec);
+}
+
+opentick::ResultSet OpenTick::Load(const Key& key) {
+  auto path = CachePath(std::get<0>(key), std::get<1>(key), std::get<2>(key),
+                        std::get<3>(key));
+  if (path.empty()) return {};
+  std::ifstream ifs(path.c_str(), std::ifstream::binary);
+  if (!ifs.good()) return {};
+  auto rows = std::make_shared<opentick::ValuesVector>();
+  DiskBar bar;
+  while (ifs.read(reinterpret_cast<char*>(&bar), sizeof(bar))) {
+    rows->push_back(
+        {opentick::Tm(std::chrono::microseconds(bar.tm)), bar.v[0], bar.v[1],
+         bar.v[2], bar.v[3], bar.v[4]});
+  }
+  return rows;
+}
+
+void OpenTick::Save(const Key& key, opentick::ResultSet rows) {
+  auto path = CachePath(std::get<0>(key), std::get<1>(key), std::get<2>(key),
+                        std::get<3>(key));
+  if (path.empty()) return;
+  std::vector<DiskBar> bars;
+  for (auto& row : *rows) {
+    if (row.size() != 6) return;
+    DiskBar bar;
+    bar.tm = ToMicro(row[0]);
+    if (bar.tm == INT64_MIN) return;
+    for (auto i = 0; i < 5; ++i) {
+      if (!ToDouble(row[i + 1], &bar.v[i])) return;
+    }
+    bars.push_back(bar);
+  }
+  boost::system::error_code ec;
+  fs::create_directories(path.parent_path(), ec);
+  auto tmp = path.string() + ".tmp";
+  std::ofstream of(tmp, std::ofstream::binary);
+  of.write(reinterpret_cast<const char*>(bars.data()),
+           bars.size() * sizeof(DiskBar));
+  of.close();
+  if (of.good())
+    fs::rename(tmp, path, ec);
+  else
+    LOG_WARN("Failed to write OpenTick cache " << tmp);
+}
+
+void OpenTick::StartPrefetch(const std::string& universe,
+                             const std::string& tables, int days,
+                             const std::string& time) {
+  if (universe.empty() || tables.empty() || days <= 0) return;
+  for (auto& tok : Split(tables, ",; ")) {
+    auto pos = tok.find(':');
+    auto interval = pos == std::string::npos ? 0 : atoi(tok.c_str() + pos + 1);
+    if (interval <= 0) {
+      LOG_ERROR("Invalid opentick_prefetch table, expect table:interval: "
+                << tok);
+      continue;
+    }
+    tables_.emplace_back(tok.substr(0, pos), interval);
+  }
+  if (tables_.empty()) return;
+  int h = 0, mi = 0, s = 0;
+  if (sscanf(time.c_str(), "%d:%d:%d", &h, &mi, &s) < 2) {
+    LOG_ERROR("Invalid opentick_prefetch_time: " << time);
+    return;
+  }
+  universe_ = universe;
+  prefetch_days_ = days;
+  SchedulePrefetch(h * 3600 + mi * 60 + s);
+  LOG_INFO("OpenTick prefetch of " << days << " days daily at " << time);
+}
+
+void OpenTick::SchedulePrefetch(int seconds_of_day) {
+  time_t t = GetTime();
+  struct tm now;
+  localtime_r(&t, &now);
+  auto secs = now.tm_hour * 3600 + now.tm_min * 60 + now.tm_sec;
+  auto delay = seconds_of_day - secs;
+  if (delay <= 0) delay += 24 * 3600;
+  kTimerTaskPool.AddTask(
+      [this, seconds_of_day]() {
+        Prefetch();
+        SchedulePrefetch(seconds_of_day);
+      },
+      boost::posix_time::seconds(delay));
+}
+
+void OpenTick::Prefetch() {
+  std::set<std::string> names;
+  for (auto& tok : Split(universe_, ",; ")) names.insert(tok);
+  auto& sm = SecurityManager::Instance();
+  std::set<Security::IdType> secs;
+  for (auto& name : names) {
+    if (auto sec = sm.Get(name)) secs.insert(sec->id);
+  }
+  for (auto& pair : sm.securities()) {
+    auto sec = pair.second;
+    if (sec->exchange && names.count(sec->exchange->name)) secs.insert(sec->id);
+  }
+  if (secs.empty()) {
+    LOG_WARN("OpenTick prefetch: no security found in " << universe_);
+    return;
+  }
+  auto today = GetTime() / kDay;
+  LOG_INFO("OpenTick prefetch of " << secs.size() << " securities");
+  std::vector<Security::IdType> ids(secs.begin(), secs.end());
+  for (auto& t : tables_) {
+    auto failed = std::make_shared<std::atomic<size_t>>(0);
+    auto name = t.first + ':' + std::to_string(t.second);
+    RequestBatch(
+        ids, t.second, (today - prefetch_days_) * kDay, today * kDay, t.first,
+        [failed](Security::IdType, opentick::ResultSet,
+                 const std::string& err) {
+          if (err.size()) (*failed)++;
+        },
+        [failed, name]() {
+          LOG_INFO("OpenTick prefetch of " << name << " done, " << *failed
+                                           << " failed");
+        });
+  }
+}
+
+void OpenTick::RequestBatch(const std::vector<Security::IdType>& secs,
+                            int interval, time_t start_time, time_t end_time,
+                            const std::string& tbl, BarsCallback callback,
+                            std::function<void()> done) {
+  RequestBatch(
+      secs, interval, start_time, end_time, tbl,
+      [callback](Security::IdType sec, opentick::ResultSet rows,
+                 const std::string& err) {
+        if (err.size()) return callback(sec, {}, err);
+        static const opentick::ValuesVector kEmpty;
+        auto bars = std::make_shared<OpenTickBars>(sec, rows ? *rows : kEmpty);
+        callback(sec, bars, "");
+      },
+      done);
+}
+
+void OpenTick::RequestBatch(const std::vector<Security::IdType>& secs,
+                            int interval, time_t start_time, time_t end_time,
+                            const std::string& tbl, RowsCallback callback,
+                            std::function<void()> done) {
+  if (secs.empty()) {
+    if (done) done();
+    return;
+  }
+  auto batch = std::make_shared<Batch>();
+  batch->secs = secs;
+  batch->interval = interval;
+  batch->start_time = start_time;
+  batch->end_time = end_time;
+  batch->tbl = tbl;
+  batch->callback = callback;
+  batch->done = done;
+  // ExecuteAsync pipelines, a window of them not to flood the server
+  static const size_t kInFlight = 32;
+  for (auto i = 0u; i < kInFlight; ++i) BatchNext(batch);
+}
+
+void OpenTick::BatchNext(std::shared_ptr<Batch> batch) {
+  auto i = batch->next++;
+  if (i >= batch->secs.size()) return;
+  auto sec = batch->secs[i];
+  Request(sec, batch->interval, batch->start_time, batch->end_time,
+          batch->tbl,
+          [this, batch, sec](opentick::ResultSet rows, const std::string& err) {
+            batch->callback(sec, rows, err);
+            if (++batch->completed == batch->secs.size()) {
+              if (batch->done) batch->done();
+              return;
+            }
+            // not recursively for the cached ones
+            kDatabaseTaskPool.AddTask([this, batch]() { BatchNext(batch); });
+          });
+}
+
 }  // namespace opentrade
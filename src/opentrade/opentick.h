@@ -1,6 +1,11 @@
 #ifndef OPENTRADE_OPENTICK_H_
 #define OPENTRADE_OPENTICK_H_
 
+#include <deque>
+#include <map>
+#include <mutex>
+#include <tuple>
+
 #include "3rd/json.hpp"
 #include "3rd/opentick.hpp"
 #include "common.h"
@@ -10,16 +15,80 @@ namespace opentrade {
 
 using json = nlohmann::json;
 
+// Bars of one security in one contiguous column major buffer of doubles,
+// time in seconds since epoch, open, high, low, close then volume, read as
+// is by indicators and by Python through the buffer protocol
+struct OpenTickBars {
+  enum Column { kTime, kOpen, kHigh, kLow, kClose, kVolume, kColumns };
+  OpenTickBars(Security::IdType sec, const opentick::ValuesVector& rows);
+  const double* column(Column c) const { return data.data() + c * size; }
+  Security::IdType sec;
+  size_t size = 0;
+  std::vector<double> data;
+};
+
 class OpenTick : public Singleton<OpenTick> {
  public:
   void Initialize(const std::string& url);
+  // Bars of [start_time, end_time). The days before today are served from
+  // the local cache, memory then store/opentick, and fetched only once by
+  // concurrent requests of the same day.
   opentick::ResultSet Request(Security::IdType sec, int interval,
                               time_t start_time, time_t end_time,
                               const std::string& tbl,
                               opentick::Callback callback);
+  typedef std::shared_ptr<const OpenTickBars> BarsPtr;
+  typedef std::function<void(Security::IdType, BarsPtr, const std::string&)>
+      BarsCallback;
+  // Request of many securities pipelined over the connection with a bounded
+  // number in flight. callback is called per security as it completes, in
+  // any order and from any thread, done once after all of them.
+  void RequestBatch(const std::vector<Security::IdType>& secs, int interval,
+                    time_t start_time, time_t end_time, const std::string& tbl,
+                    BarsCallback callback, std::function<void()> done = {});
+  // days kept in memory
+  void set_cache_size(size_t n) { cache_size_ = n; }
+  // Fetches the last days calendar days of the universe, comma separated
+  // exchange or security names, for every table:interval of tables,
+  // daily at time (HH:MM:SS local), e.g. before the open.
+  void StartPrefetch(const std::string& universe, const std::string& tables,
+                     int days, const std::string& time);
 
  private:
+  // table, security, interval, day since epoch in UTC
+  typedef std::tuple<std::string, Security::IdType, int, int> Key;
+  struct Entry {
+    opentick::ResultSet rows;
+    bool ready = false;
+    std::vector<opentick::Callback> waiters;
+  };
+  typedef std::function<void(Security::IdType, opentick::ResultSet,
+                             const std::string&)>
+      RowsCallback;
+  struct Batch;
+  void Query(const std::string& tbl, Security::IdType sec, int interval,
+             time_t start_time, time_t end_time, opentick::Callback callback);
+  void Fetch(const std::string& tbl, Security::IdType sec, int interval,
+             int day0, int day1);
+  void Complete(const Key& key, opentick::ResultSet rows,
+                const std::string& err);
+  static opentick::ResultSet Load(const Key& key);
+  static void Save(const Key& key, opentick::ResultSet rows);
+  void SchedulePrefetch(int seconds_of_day);
+  void Prefetch();
+  void RequestBatch(const std::vector<Security::IdType>& secs, int interval,
+                    time_t start_time, time_t end_time, const std::string& tbl,
+                    RowsCallback callback, std::function<void()> done);
+  void BatchNext(std::shared_ptr<Batch> batch);
+
   opentick::Connection::Ptr conn_;
+  std::mutex m_;
+  std::map<Key, std::shared_ptr<Entry>> cache_;
+  std::deque<Key> loaded_;  // ready ones in the order loaded, for eviction
+  size_t cache_size_ = 100000;
+  std::string universe_;
+  std::vector<std::pair<std::string, int>> tables_;
+  int prefetch_days_ = 0;
 };
 
 }  // namespace opentrade
@@ -2,70 +2,139 @@
 
 #include <boost/filesystem.hpp>
 #include <boost/iostreams/device/mapped_file.hpp>
+#include <algorithm>
 #include <cstring>
-#include <fstream>
+#include <future>
 #include <iomanip>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <sstream>
+#include <thread>
 
 #include "algo.h"
 #include "backtest.h"
 #include "connection.h"
 #include "database.h"
 #include "exchange_connectivity.h"
+#include "latency.h"
 #include "logger.h"
+#include "memory.h"
+#include "metrics.h"
 #include "position.h"
 #include "server.h"
+#include "tca.h"
 
 namespace fs = boost::filesystem;
 
 namespace opentrade {
 
+// written before the journal, read only
 static auto kPath = kStorePath / "confirmations";
+// journal record payload: [u32 seq][sub account id][exec type][body]['\0']
+static const size_t kRecordHeader = 4 + sizeof(SubAccount::IdType) + 1;
+static const size_t kMaxBody = std::numeric_limits<uint16_t>::max();
 
-void GlobalOrderBook::Initialize() {
+static inline bool IsValidRecord(Journal::Record payload) {
+  return payload.size() >= kRecordHeader + 1 && !payload.back();
+}
+
+void GlobalOrderBook::Initialize(bool journal_fsync) {
   auto& self = Instance();
-  self.of_.open(kPath.c_str(), std::ofstream::app);
-  if (!self.of_.good()) {
-    LOG_FATAL("Failed to write file: " << kPath.c_str() << ": "
-                                       << strerror(errno));
-  }
   self.LoadStore();
-  LOG_INFO("Got last maximum client order id: " << self.order_id_counter_);
+  self.journal_.set_fsync(journal_fsync);
+  self.journal_.Open();
+  self.ResumeCounters();
+  auto& mem = MemoryAccounting::Instance();
+  mem.AddReporter("exec_ids", [&self]() {
+    return MemoryAccounting::Usage{
+        {},
+        static_cast<int64_t>(self.exec_ids_.bytes()),
+        static_cast<int64_t>(self.exec_ids_.size())};
+  });
+  mem.AddReporter("order_store_index", [&self]() {
+    std::lock_guard<std::mutex> lock(self.store_index_m_);
+    auto u = MemoryAccounting::OfMap(self.store_index_);
+    for (auto& pair : self.store_index_) {
+      u.bytes += pair.second.capacity() * sizeof(StoreLoc);
+      u.objects += pair.second.size();
+    }
+    return u;
+  });
+}
+
+void GlobalOrderBook::Replicate(Journal::Record payload,
+                                const std::string& segment, uint64_t offset) {
+  if (!IsValidRecord(payload)) {
+    LOG_ERROR("Invalid replicated confirmation record");
+    return;
+  }
+  auto r = ParseRecord(payload);
+  IndexRecord(r.seq, r.sub_account_id, segment, offset, payload.size());
+  Load(r, ++replicated_);
+}
+
+void GlobalOrderBook::IndexRecord(uint32_t seq, SubAccount::IdType id,
+                                  const std::string& segment, uint64_t offset,
+                                  uint32_t size) {
+  std::lock_guard<std::mutex> lock(store_index_m_);
+  if (store_segments_.empty() || store_segments_.back() != segment)
+    store_segments_.push_back(segment);
+  store_index_[id].push_back(
+      StoreLoc{seq, static_cast<uint32_t>(store_segments_.size() - 1), size,
+               offset});
+}
+
+void GlobalOrderBook::TakeOver() {
+  LOG_INFO("Took over after " << replicated_ << " replicated confirmations");
+  ResumeCounters();
+}
+
+void GlobalOrderBook::ResumeCounters() {
+  LOG_INFO("Got last maximum client order id: " << order_id_counter_);
   time_t t = GetTime();
   struct tm now;
   localtime_r(&t, &now);
   auto secs = now.tm_hour * 3600 + now.tm_min * 60 + now.tm_sec;
   auto min_counter = now.tm_wday * 1e7 + secs * 50;
-  self.order_id_counter_ = self.order_id_counter_ + 1e5;
-  if (self.order_id_counter_ < min_counter) {
-    self.order_id_counter_ = min_counter;
+  // skips ids reserved but not used before the restart, the journal only
+  // has the maximum one used
+  static_assert(kIdRestartGap >= 64 * kIdBlock);
+  order_id_counter_ = order_id_counter_ + kIdRestartGap;
+  if (order_id_counter_ < min_counter) {
+    order_id_counter_ = min_counter;
   }
-  LOG_INFO("New client order id starts from " << self.order_id_counter_);
-  self.seq_counter_ += 1000;
+  LOG_INFO("New client order id starts from " << order_id_counter_);
+  seq_counter_ += 1000;
 }
 
 inline void GlobalOrderBook::UpdateOrder(Confirmation::Ptr cm) {
   switch (cm->exec_type) {
     case kUnconfirmedNew:
-    case kUnconfirmedCancel: {
+    case kUnconfirmedCancel:
+    case kUnconfirmedReplace: {
       auto ord = cm->order;
       if (cm->exec_type == kUnconfirmedNew) ord->leaves_qty = ord->qty;
       if (!ord->id) {  // if offline, id and tm already assigned
         ord->id = NewOrderId();
         ord->tm = NowUtcInMicro();
       }
-      orders_.emplace(ord->id, ord);
+      orders_.Set(ord->id, ord);
       ord->status = cm->exec_type;
       if (kUnconfirmedCancel == cm->exec_type) {
-        if (ord->sub_account->limits.msg_rate_per_security > 0)
-          const_cast<SubAccount*>(ord->sub_account)
-              ->cancels_per_security[ord->sec->id]++;
-        if (ord->broker_account->limits.msg_rate_per_security > 0)
-          const_cast<BrokerAccount*>(ord->broker_account)
-              ->cancels_per_security[ord->sec->id]++;
-        if (ord->user->limits.msg_rate_per_security > 0)
-          const_cast<User*>(ord->user)->cancels_per_security[ord->sec->id]++;
+        auto now = NowCoarseInMicro();
+        const AccountBase* accs[] = {ord->sub_account, ord->broker_account,
+                                     ord->user};
+        for (auto acc : accs) {
+          if (acc->limits.max_cancels_per_security > 0)
+            const_cast<AccountBase*>(acc)
+                ->per_security.Get(ord->sec->id)
+                ->AddCancel(now);
+        }
+      }
+      if (kUnconfirmedReplace == cm->exec_type) {
+        auto orig = Get(ord->orig_id);
+        if (orig) orig->replace_id = ord->id;
       }
     } break;
     case kPartiallyFilled:
@@ -103,8 +172,43 @@ inline void GlobalOrderBook::UpdateOrder(Confirmation::Ptr cm) {
     case kSuspended:
     case kPendingNew:
     case kPendingCancel:
+    case kPendingReplace:
       cm->order->status = cm->exec_type;
       break;
+    case kReplaced: {
+      // the replacement takes over the fills and leaves of the order it
+      // amends, cm->leaves_qty is what is left of the amended leaves
+      auto ord = cm->order;
+      if (!ord->IsReplacing()) break;
+      auto orig = Get(ord->orig_id);
+      // fills on the replacement already, if any, came out of the old leaves
+      cm->leaves_qty = 0;
+      if (orig) {
+        cm->leaves_qty = std::max(0., Round6(orig->leaves_qty - ord->cum_qty));
+        auto cum_qty = orig->cum_qty + ord->cum_qty;
+        if (cum_qty > 0)
+          ord->avg_px = (orig->avg_px * orig->cum_qty +
+                         ord->avg_px * ord->cum_qty) / cum_qty;
+        ord->cum_qty = Round6(cum_qty);
+        orig->leaves_qty = 0;
+        orig->status = kReplaced;
+        if (orig->replace_id == ord->id) orig->replace_id = 0;
+        UpdateStatusList(orig);
+      }
+      ord->leaves_qty = std::max(0., Round6(ord->qty - ord->cum_qty));
+      if (ord->leaves_qty <= 0)
+        ord->status = kFilled;
+      else
+        ord->status = ord->cum_qty > 0 ? kPartiallyFilled : kNew;
+    } break;
+    case kCancelRejected:
+      // of a replacement, the order it amends stays as it is
+      if (cm->order->IsReplacing()) {
+        auto orig = Get(cm->order->orig_id);
+        if (orig && orig->replace_id == cm->order->id) orig->replace_id = 0;
+        cm->order->status = kCancelRejected;
+      }
+      break;
     case kRiskRejected:
     case kCanceled:
     case kRejected:
@@ -118,9 +222,138 @@ inline void GlobalOrderBook::UpdateOrder(Confirmation::Ptr cm) {
     default:
       break;
   }
+  UpdateStatusList(cm->order);
 }
 
+inline int GlobalOrderBook::StatusListIndex(OrderStatus status) {
+  switch (status) {
+    case kUnconfirmedNew:
+      return 0;
+    case kPendingNew:
+      return 1;
+    case kNew:
+      return 2;
+    case kSuspended:
+      return 3;
+    case kPartiallyFilled:
+      return 4;
+    case kUnconfirmedCancel:
+      return 5;
+    case kPendingCancel:
+      return 6;
+    default:
+      return -1;
+  }
+}
+
+inline void GlobalOrderBook::UpdateStatusList(Order* ord) {
+  auto& hook = ord->hook;
+  if (hook.status == ord->status) return;
+  std::lock_guard<std::mutex> lock(status_mutex_);
+  auto status = ord->status;
+  if (hook.status == status) return;
+  auto i = StatusListIndex(hook.status);
+  if (i >= 0) {
+    auto& l = status_lists_[i];
+    if (hook.prev)
+      hook.prev->hook.next = hook.next;
+    else
+      l.head = hook.next;
+    if (hook.next) hook.next->hook.prev = hook.prev;
+    hook.prev = hook.next = nullptr;
+    l.size--;
+  }
+  auto was_open = i >= 0;
+  hook.status = status;
+  i = StatusListIndex(status);
+  if (i >= 0) {
+    auto& l = status_lists_[i];
+    hook.next = l.head;
+    if (l.head) l.head->hook.prev = ord;
+    l.head = ord;
+    l.size++;
+  }
+  if (was_open == (i >= 0) || !ord->broker_account) return;
+  auto& l = account_lists_[ord->broker_account];
+  if (was_open) {
+    if (hook.acc_prev)
+      hook.acc_prev->hook.acc_next = hook.acc_next;
+    else
+      l.head = hook.acc_next;
+    if (hook.acc_next) hook.acc_next->hook.acc_prev = hook.acc_prev;
+    hook.acc_prev = hook.acc_next = nullptr;
+    l.size--;
+  } else {
+    hook.acc_next = l.head;
+    if (l.head) l.head->hook.acc_prev = ord;
+    l.head = ord;
+    l.size++;
+  }
+}
+
+std::vector<Order*> GlobalOrderBook::GetOrders(OrderStatus status) {
+  std::vector<Order*> out;
+  auto i = StatusListIndex(status);
+  if (i < 0) {
+    orders_.ForEach([&](Order* ord) {
+      if (ord->status == status) out.push_back(ord);
+    });
+    return out;
+  }
+  std::lock_guard<std::mutex> lock(status_mutex_);
+  auto& l = status_lists_[i];
+  out.reserve(l.size);
+  for (auto ord = l.head; ord; ord = ord->hook.next) out.push_back(ord);
+  return out;
+}
+
+std::vector<Order*> GlobalOrderBook::GetOrders(const BrokerAccount* acc) {
+  std::vector<Order*> out;
+  std::lock_guard<std::mutex> lock(status_mutex_);
+  auto it = account_lists_.find(acc);
+  if (it == account_lists_.end()) return out;
+  out.reserve(it->second.size);
+  for (auto ord = it->second.head; ord; ord = ord->hook.acc_next)
+    out.push_back(ord);
+  return out;
+}
+
+std::vector<Order*> GlobalOrderBook::GetOrders(
+    const ExchangeConnectivityAdapter* adapter) {
+  std::vector<Order*> out;
+  std::lock_guard<std::mutex> lock(status_mutex_);
+  for (auto& it : account_lists_) {
+    auto acc = it.first;
+    for (auto ord = it.second.head; ord; ord = ord->hook.acc_next) {
+      // see FindAdapter, an account without adapter routes by destination
+      auto a = acc->GetSession(ord->session, *ord->sec);
+      if (a ? a == adapter : ord->destination == adapter->name())
+        out.push_back(ord);
+    }
+  }
+  return out;
+}
+
+static Counter* const kConfirmations = Metrics::Instance().AddCounter(
+    "opentrade_confirmations_total", "Confirmations handled");
+
+static LatencyHistogram* AddStage(const char* stage) {
+  auto h = new LatencyHistogram;
+  Metrics::Instance().AddSummary(
+      "opentrade_confirmation_stage_seconds",
+      "GlobalOrderBook::Handle by stage, queue is the wait for the write stage",
+      Metrics::Label("stage", stage), h);
+  return h;
+}
+
+static LatencyHistogram* const kOrderStage = AddStage("order");
+static LatencyHistogram* const kPositionStage = AddStage("position");
+static LatencyHistogram* const kAlgoStage = AddStage("algo");
+static LatencyHistogram* const kQueueStage = AddStage("queue");
+static LatencyHistogram* const kWriteStage = AddStage("write");
+
 void GlobalOrderBook::Handle(Confirmation::Ptr cm, bool offline) {
+  kConfirmations->Add();
   // risk rejected not by adapter, not persist
   if (cm->exec_type == kRiskRejected &&
       cm->order->status == kOrderStatusUnknown) {
@@ -129,403 +362,788 @@ void GlobalOrderBook::Handle(Confirmation::Ptr cm, bool offline) {
     if (cm->order->inst) AlgoManager::Instance().Handle(cm);
     return;
   }
+  auto t0 = TickLatency::Now();
   UpdateOrder(cm);
+  auto t1 = TickLatency::Now();
   PositionManager::Instance().Handle(cm, offline);
+  auto t2 = TickLatency::Now();
   if (cm->order->inst) AlgoManager::Instance().Handle(cm);
   if (offline) return;
+  auto t3 = TickLatency::Now();
+  kOrderStage->Record(t1 - t0);
+  kPositionStage->Record(t2 - t1);
+  kAlgoStage->Record(t3 - t2);
+  TcaManager::Instance().Handle(*cm);
 #ifdef BACKTEST
   Backtest::Instance().OnConfirmation(*cm);
   return;
 #endif
-  kWriteTaskPool.AddTask([this, cm]() {
-    cm->seq = ++seq_counter_;
-    Server::Publish(cm);
-    std::stringstream ss;
-    auto ord = cm->order;
-    switch (cm->exec_type) {
-      case kNew:
-      case kSuspended:
-        ss << ord->id << ' ' << cm->transaction_time << ' ' << cm->order_id;
-        break;
-      case kPartiallyFilled:
-      case kFilled:
-        ss << std::setprecision(15) << ord->id << ' ' << cm->transaction_time
-           << ' ' << cm->last_shares << ' ' << cm->last_px << ' '
-           << static_cast<char>(cm->exec_trans_type) << ' ' << cm->exec_id;
-        break;
-      case kPendingNew:
-      case kPendingCancel:
-      case kCancelRejected:
-      case kCanceled:
-      case kRejected:
-      case kExpired:
-      case kCalculated:
-      case kDoneForDay:
-        ss << ord->id << ' ' << cm->transaction_time << ' ' << cm->text;
-        break;
-      case kUnconfirmedNew: {
-        ss << std::setprecision(15) << ord->id << ' ' << cm->transaction_time
-           << ' ' << ord->algo_id << ' ' << ord->qty << ' ' << ord->price << ' '
-           << ord->stop_price << ' ' << static_cast<char>(ord->side) << ' '
-           << static_cast<char>(ord->type) << ' ' << static_cast<char>(ord->tif)
-           << ' ' << ord->sec->id << ' ' << ord->user->id << ' '
-           << ord->broker_account->id;
-        if (!ord->destination.empty()) ss << ' ' << ord->destination;
-      } break;
-      case kUnconfirmedCancel:
-        ss << ord->id << ' ' << cm->transaction_time << ' ' << ord->orig_id;
-        break;
-      case kRiskRejected:
-        ss << ord->id << ' ' << cm->text;
-        break;
-      default:
-        break;
-    }
-    auto str = ss.str();
-    if (str.empty()) return;
-    of_.write(reinterpret_cast<const char*>(&cm->seq), sizeof(cm->seq));
-    uint16_t n = str.size();
-    of_.write(reinterpret_cast<const char*>(&n), sizeof(n));
-    of_ << static_cast<char>(cm->exec_type);
-    of_.write(reinterpret_cast<const char*>(&ord->sub_account->id),
-              sizeof(ord->sub_account->id));
-    if (str.size() > n) str = str.substr(0, n);
-    of_ << str << '\0' << std::endl;
-  });
+  auto node = new WriteNode;
+  node->cm = std::move(cm);
+  node->tm = t3;
+  // count before push so that the drain never exits with a node queued
+  auto n = write_pending_++;
+  PushWrite(node);
+  if (!n) kWriteTaskPool.AddTask([this]() { DrainWrites(); });
 }
 
-void GlobalOrderBook::LoadStore(uint32_t seq0, Connection* conn) {
-  if (!fs::file_size(kPath)) return;
-  boost::iostreams::mapped_file_source m(kPath.string());
-  auto p = m.data();
-  auto p_end = p + m.size();
-  auto ln = 0;
-  std::unordered_set<Order::IdType> orders_to_ignore;
-  while (p + 6 < p_end) {
-    ln++;
-    auto seq = *reinterpret_cast<const uint32_t*>(p);
-    if (!conn) seq_counter_ = seq;
-    p += 4;
-    auto n = *reinterpret_cast<const uint16_t*>(p);
-    if (p + 2 + 1 + sizeof(SubAccount::IdType) + n > p_end) break;
-    if (seq <= seq0) {
-      p += 2 + 1 + sizeof(SubAccount::IdType) + n + 2;
+inline void GlobalOrderBook::PushWrite(WriteNode* node) {
+  node->next.store(nullptr, std::memory_order_relaxed);
+  auto prev = write_head_.exchange(node, std::memory_order_acq_rel);
+  prev->next.store(node, std::memory_order_release);
+}
+
+inline GlobalOrderBook::WriteNode* GlobalOrderBook::PopWrite() {
+  auto tail = write_tail_;
+  auto next = tail->next.load(std::memory_order_acquire);
+  if (tail == &write_stub_) {
+    if (!next) return nullptr;
+    write_tail_ = next;
+    tail = next;
+    next = next->next.load(std::memory_order_acquire);
+  }
+  if (next) {
+    write_tail_ = next;
+    return tail;
+  }
+  // a producer is in the middle of PushWrite
+  if (tail != write_head_.load(std::memory_order_acquire)) return nullptr;
+  PushWrite(&write_stub_);
+  next = tail->next.load(std::memory_order_acquire);
+  if (!next) return nullptr;
+  write_tail_ = next;
+  return tail;
+}
+
+// group commit, one journal write for the confirmations drained together,
+// at least every kFlushEvery of them under a steady stream
+void GlobalOrderBook::DrainWrites() {
+  static const uint32_t kFlushEvery = 256;
+  auto n = 0u;
+  for (;;) {
+    auto node = PopWrite();
+    if (!node) {
+      if (!write_pending_) break;
+      std::this_thread::yield();
       continue;
     }
-    p += 2;
-    auto exec_type = static_cast<opentrade::OrderStatus>(*p);
-    p += 1;
-    auto sub_account_id = *reinterpret_cast<const SubAccount::IdType*>(p);
-    p += sizeof(SubAccount::IdType);
-    auto body = p;
-    p += n + 2;  // body + '\0' + '\n'
-    if (conn) {
-      assert(conn->user_);
-      if (!conn->user_->is_admin && !conn->user_->GetSubAccount(sub_account_id))
-        continue;
-      auto id = atol(body);
-      if (orders_to_ignore.find(id) != orders_to_ignore.end()) continue;
-    }
-    switch (exec_type) {
-      case kNew:
-      case kSuspended: {
-        uint32_t id;
-        int64_t tm;
-        char id_str[n];
-        *id_str = 0;
-        if (sscanf(body, "%u %ld %[^\1]", &id, &tm, id_str) < 2) {
-          LOG_ERROR("Failed to parse confirmation line #" << ln);
-          continue;
-        }
-        if (conn) {
-          Confirmation cm{};
-          cm.seq = seq;
-          Order ord{};
-          ord.id = id;
-          cm.order = &ord;
-          cm.exec_type = exec_type;
-          cm.transaction_time = tm;
-          cm.order_id = id_str;
-          conn->Send(cm, true);
-          continue;
-        }
-        auto ord = Get(id);
-        if (!ord) {
-          LOG_ERROR("Unknown order id " << id << " on confirmation line #"
-                                        << ln);
-          continue;
-        }
-        auto cm = std::make_shared<Confirmation>();
-        cm->exec_type = exec_type;
-        cm->order = ord;
-        cm->transaction_time = tm;
-        cm->order_id = id_str;
-        Handle(cm, true);
-      } break;
-      case kPartiallyFilled:
-      case kFilled: {
-        uint32_t id;
-        int64_t tm;
-        double last_shares;
-        double last_px;
-        char exec_trans_type;
-        char exec_id[n];
-        if (sscanf(body, "%u %ld %lf %lf %c %[^\1]", &id, &tm, &last_shares,
-                   &last_px, &exec_trans_type, exec_id) < 6) {
-          LOG_ERROR("Failed to parse confirmation line #" << ln);
-          continue;
-        }
-        if (conn) {
-          Confirmation cm{};
-          cm.seq = seq;
-          Order ord{};
-          ord.id = id;
-          cm.order = &ord;
-          cm.exec_type = exec_type;
-          cm.transaction_time = tm;
-          cm.last_shares = last_shares;
-          cm.last_px = last_px;
-          cm.exec_trans_type =
-              static_cast<opentrade::ExecTransType>(exec_trans_type);
-          cm.exec_id = exec_id;
-          conn->Send(cm, true);
-          continue;
-        }
+    auto t0 = TickLatency::Now();
+    kQueueStage->Record(t0 - node->tm);
+    Write(std::move(node->cm));
+    kWriteStage->Record(TickLatency::Now() - t0);
+    delete node;
+    if (++n % kFlushEvery == 0) journal_.Flush();
+    if (--write_pending_ == 0) break;
+  }
+  journal_.Flush();
+}
+
+void GlobalOrderBook::Write(Confirmation::Ptr cm) {
+  cm->seq = ++seq_counter_;
+  Server::Publish(cm);
+  auto str = Body(*cm);
+  if (str.empty()) return;
+  WriteRecord(cm->seq, cm->order->sub_account->id, cm->exec_type,
+              std::move(str));
+}
+
+std::string GlobalOrderBook::Body(const Confirmation& cm) {
+  std::stringstream ss;
+  auto ord = cm.order;
+  switch (cm.exec_type) {
+    case kNew:
+    case kSuspended:
+    case kReplaced:
+      ss << ord->id << ' ' << cm.transaction_time << ' ' << cm.order_id;
+      break;
+    case kPartiallyFilled:
+    case kFilled:
+      ss << std::setprecision(15) << ord->id << ' ' << cm.transaction_time
+         << ' ' << cm.last_shares << ' ' << cm.last_px << ' '
+         << static_cast<char>(cm.exec_trans_type) << ' ' << cm.exec_id;
+      break;
+    case kPendingNew:
+    case kPendingCancel:
+    case kPendingReplace:
+    case kCancelRejected:
+    case kCanceled:
+    case kRejected:
+    case kExpired:
+    case kCalculated:
+    case kDoneForDay:
+      ss << ord->id << ' ' << cm.transaction_time << ' ' << cm.text;
+      break;
+    case kUnconfirmedNew: {
+      ss << std::setprecision(15) << ord->id << ' ' << cm.transaction_time
+         << ' ' << ord->algo_id << ' ' << ord->qty << ' ' << ord->price << ' '
+         << ord->stop_price << ' ' << static_cast<char>(ord->side) << ' '
+         << static_cast<char>(ord->type) << ' ' << static_cast<char>(ord->tif)
+         << ' ' << ord->sec->id << ' ' << ord->user->id << ' '
+         << ord->broker_account->id;
+      if (!ord->destination.empty()) ss << ' ' << ord->destination;
+    } break;
+    case kUnconfirmedCancel:
+      ss << ord->id << ' ' << cm.transaction_time << ' ' << ord->orig_id;
+      break;
+    case kUnconfirmedReplace:
+      ss << std::setprecision(15) << ord->id << ' ' << cm.transaction_time
+         << ' ' << ord->orig_id << ' ' << ord->qty << ' ' << ord->price;
+      break;
+    case kRiskRejected:
+      ss << ord->id << ' ' << cm.text;
+      break;
+    default:
+      break;
+  }
+  return ss.str();
+}
+
+void GlobalOrderBook::WriteRecord(uint32_t seq, SubAccount::IdType acc,
+                                  OrderStatus exec_type, std::string body) {
+  if (body.size() > kMaxBody) body.resize(kMaxBody);
+  char header[kRecordHeader];
+  memcpy(header, &seq, sizeof(seq));
+  memcpy(header + 4, &acc, sizeof(acc));
+  header[kRecordHeader - 1] = static_cast<char>(exec_type);
+  auto offset = journal_.Append({{header, sizeof(header)}, body, {"", 1}});
+  IndexRecord(seq, acc, journal_.segment(), offset,
+              sizeof(header) + body.size() + 1);
+}
+
+GlobalOrderBook::StoreRecord GlobalOrderBook::ParseRecord(
+    Journal::Record payload) {
+  StoreRecord r;
+  memcpy(&r.seq, payload.data(), sizeof(r.seq));
+  memcpy(&r.sub_account_id, payload.data() + 4, sizeof(r.sub_account_id));
+  r.exec_type = static_cast<opentrade::OrderStatus>(payload[kRecordHeader - 1]);
+  r.body = payload.data() + kRecordHeader;
+  r.n = payload.size() - kRecordHeader - 1;
+  return r;
+}
+
+void GlobalOrderBook::Load(
+    const StoreRecord& r, int ln, uint32_t seq0, Connection* conn,
+    std::unordered_set<Order::IdType>* orders_to_ignore) {
+  auto seq = r.seq;
+  if (!conn) seq_counter_ = seq;
+  if (seq <= seq0) return;
+  auto exec_type = r.exec_type;
+  auto sub_account_id = r.sub_account_id;
+  auto body = r.body;
+  auto n = r.n;
+  if (conn) {
+    assert(conn->user_);
+    if (!conn->user_->is_admin && !conn->user_->GetSubAccount(sub_account_id))
+      return;
+    auto id = atol(body);
+    if (orders_to_ignore->find(id) != orders_to_ignore->end()) return;
+  }
+  switch (exec_type) {
+    case kNew:
+    case kSuspended:
+    case kReplaced: {
+      uint32_t id;
+      int64_t tm;
+      char id_str[n];
+      *id_str = 0;
+      if (sscanf(body, "%u %ld %[^\1]", &id, &tm, id_str) < 2) {
+        LOG_ERROR("Failed to parse confirmation line #" << ln);
+        return;
+      }
+      if (conn) {
+        Confirmation cm{};
+        cm.seq = seq;
+        Order ord{};
+        ord.id = id;
+        cm.order = &ord;
+        cm.exec_type = exec_type;
+        cm.transaction_time = tm;
+        cm.order_id = id_str;
+        conn->Send(cm, true);
+        return;
+      }
+      auto ord = Get(id);
+      if (!ord) {
+        LOG_ERROR("Unknown order id " << id << " on confirmation line #"
+                                      << ln);
+        return;
+      }
+      auto cm = Confirmation::New();
+      cm->exec_type = exec_type;
+      cm->order = ord;
+      cm->transaction_time = tm;
+      cm->order_id = id_str;
+      Handle(cm, true);
+    } break;
+    case kPartiallyFilled:
+    case kFilled: {
+      uint32_t id;
+      int64_t tm;
+      double last_shares;
+      double last_px;
+      char exec_trans_type;
+      char exec_id[n];
+      if (sscanf(body, "%u %ld %lf %lf %c %[^\1]", &id, &tm, &last_shares,
+                 &last_px, &exec_trans_type, exec_id) < 6) {
+        LOG_ERROR("Failed to parse confirmation line #" << ln);
+        return;
+      }
+      if (conn) {
+        Confirmation cm{};
+        cm.seq = seq;
+        Order ord{};
+        ord.id = id;
+        cm.order = &ord;
+        cm.exec_type = exec_type;
+        cm.transaction_time = tm;
+        cm.last_shares = last_shares;
+        cm.last_px = last_px;
+        cm.exec_trans_type =
+            static_cast<opentrade::ExecTransType>(exec_trans_type);
+        cm.exec_id = exec_id;
+        conn->Send(cm, true);
+        return;
+      }
+      auto ord = Get(id);
+      if (!ord) {
+        LOG_ERROR("Unknown order id " << id << " on confirmation line #"
+                                      << ln);
+        return;
+      }
+      if (IsDupExecId(id,
+                      exec_id)) {  // not only double check, but also insert
+                                   // into exec_ids_
+        LOG_ERROR("Duplicate exec id " << exec_id << " of ClOrdId " << id
+                                       << " on confirmation line #" << ln);
+        return;
+      }
+      auto cm = Confirmation::New();
+      cm->exec_type = exec_type;
+      cm->order = ord;
+      cm->transaction_time = tm;
+      cm->last_shares = last_shares;
+      cm->last_px = last_px;
+      cm->exec_trans_type =
+          static_cast<opentrade::ExecTransType>(exec_trans_type);
+      cm->exec_id = exec_id;
+      Handle(cm, true);
+    } break;
+    case kPendingNew:
+    case kPendingCancel:
+    case kPendingReplace:
+    case kCancelRejected:
+    case kCanceled:
+    case kRejected:
+    case kExpired:
+    case kCalculated:
+    case kDoneForDay: {
+      uint32_t id;
+      int64_t tm;
+      char text[n];
+      *text = 0;
+      if (sscanf(body, "%u %ld %[^\1]", &id, &tm, text) < 2) {
+        LOG_ERROR("Failed to parse confirmation line #" << ln);
+        return;
+      }
+      if (conn) {
+        Confirmation cm{};
+        cm.seq = seq;
+        Order ord{};
+        ord.id = id;
+        cm.order = &ord;
+        cm.exec_type = exec_type;
+        cm.transaction_time = tm;
+        cm.text = text;
+        conn->Send(cm, true);
+        return;
+      }
+      auto ord = Get(id);
+      if (!ord) {
+        LOG_ERROR("Unknown order id " << id << " on confirmation line #"
+                                      << ln);
+        return;
+      }
+      auto cm = Confirmation::New();
+      cm->exec_type = exec_type;
+      cm->order = ord;
+      cm->transaction_time = tm;
+      cm->text = text;
+      Handle(cm, true);
+    } break;
+    case kUnconfirmedNew: {
+      uint32_t id;
+      int64_t tm;
+      uint32_t algo_id;
+      double qty;
+      double price;
+      double stop_price;
+      char side;
+      char type;
+      char tif;
+      uint32_t sec_id;
+      uint32_t user_id;
+      uint32_t broker_account_id;
+      char destination[n];
+      *destination = 0;
+      if (sscanf(body, "%u %ld %u %lf %lf %lf %c %c %c %u %u %u %s", &id, &tm,
+                 &algo_id, &qty, &price, &stop_price, &side, &type, &tif,
+                 &sec_id, &user_id, &broker_account_id, destination) < 12) {
+        LOG_ERROR("Failed to parse confirmation line #" << ln);
+        return;
+      }
+      if (conn) {
         auto ord = Get(id);
-        if (!ord) {
-          LOG_ERROR("Unknown order id " << id << " on confirmation line #"
-                                        << ln);
-          continue;
+        assert(ord);
+        if (!ord) return;
+        if (ord->status == kCanceled && ord->cum_qty == 0) {
+          orders_to_ignore->insert(id);
+          return;
         }
-        if (IsDupExecId(id,
-                        exec_id)) {  // not only double check, but also insert
-                                     // into exec_ids_
-          LOG_ERROR("Duplicate exec id " << exec_id << " of ClOrdId " << id
+        Confirmation cm{};
+        cm.seq = seq;
+        cm.order = ord;
+        cm.exec_type = exec_type;
+        cm.transaction_time = tm;
+        conn->Send(cm, true);
+        return;
+      }
+      auto sec = SecurityManager::Instance().Get(sec_id);
+      if (!sec) {
+        LOG_ERROR("Unknown security id " << sec_id
                                          << " on confirmation line #" << ln);
-          continue;
-        }
-        auto cm = std::make_shared<Confirmation>();
-        cm->exec_type = exec_type;
-        cm->order = ord;
-        cm->transaction_time = tm;
-        cm->last_shares = last_shares;
-        cm->last_px = last_px;
-        cm->exec_trans_type =
-            static_cast<opentrade::ExecTransType>(exec_trans_type);
-        cm->exec_id = exec_id;
-        Handle(cm, true);
-      } break;
-      case kPendingNew:
-      case kPendingCancel:
-      case kCancelRejected:
-      case kCanceled:
-      case kRejected:
-      case kExpired:
-      case kCalculated:
-      case kDoneForDay: {
-        uint32_t id;
-        int64_t tm;
-        char text[n];
-        *text = 0;
-        if (sscanf(body, "%u %ld %[^\1]", &id, &tm, text) < 2) {
-          LOG_ERROR("Failed to parse confirmation line #" << ln);
-          continue;
-        }
-        if (conn) {
-          Confirmation cm{};
-          cm.seq = seq;
-          Order ord{};
-          ord.id = id;
-          cm.order = &ord;
-          cm.exec_type = exec_type;
-          cm.transaction_time = tm;
-          cm.text = text;
-          conn->Send(cm, true);
-          continue;
-        }
+        return;
+      }
+      auto user = AccountManager::Instance().GetUser(user_id);
+      if (!user) {
+        LOG_ERROR("Unknown user id " << user_id << " on confirmation line #"
+                                     << ln);
+        return;
+      }
+      auto sub_account =
+          AccountManager::Instance().GetSubAccount(sub_account_id);
+      if (!sub_account) {
+        LOG_ERROR("Unknown sub account id "
+                  << sub_account_id << " on confirmation line #" << ln);
+        return;
+      }
+      auto broker_account =
+          AccountManager::Instance().GetBrokerAccount(broker_account_id);
+      if (!sub_account) {
+        LOG_ERROR("Unknown broker account id "
+                  << broker_account_id << " on confirmation line #" << ln);
+        return;
+      }
+      auto ord = new Order{};
+      ord->id = id;
+      ord->algo_id = algo_id;
+      ord->qty = qty;
+      ord->price = price;
+      ord->stop_price = stop_price;
+      ord->side = static_cast<opentrade::OrderSide>(side);
+      ord->type = static_cast<opentrade::OrderType>(type);
+      ord->tif = static_cast<opentrade::TimeInForce>(tif);
+      ord->sec = sec;
+      ord->user = user;
+      ord->sub_account = sub_account;
+      ord->broker_account = broker_account;
+      ord->destination = destination;
+      ord->tm = tm;
+      auto cm = Confirmation::New();
+      cm->exec_type = exec_type;
+      cm->order = ord;
+      cm->transaction_time = tm;
+      Handle(cm, true);
+      if (id > order_id_counter_) order_id_counter_ = id;
+    } break;
+    case kUnconfirmedCancel: {
+      if (conn) return;
+      uint32_t id;
+      int64_t tm;
+      uint32_t orig_id;
+      if (sscanf(body, "%u %ld %u", &id, &tm, &orig_id) < 3) {
+        LOG_ERROR("Failed to parse confirmation line #" << ln);
+        return;
+      }
+      auto orig_ord = Get(orig_id);
+      if (!orig_ord) {
+        LOG_ERROR("Unknown orig_id " << orig_id << " on confirmation line #"
+                                     << ln);
+        return;
+      }
+      auto cancel_order = new Order(*orig_ord);
+      cancel_order->id = id;
+      cancel_order->orig_id = orig_id;
+      cancel_order->tm = tm;
+      auto cm = Confirmation::New();
+      cm->exec_type = exec_type;
+      cm->order = cancel_order;
+      cm->transaction_time = tm;
+      if (id > order_id_counter_) order_id_counter_ = id;
+      Handle(cm, true);
+    } break;
+    case kUnconfirmedReplace: {
+      uint32_t id;
+      int64_t tm;
+      uint32_t orig_id;
+      double qty;
+      double price;
+      if (sscanf(body, "%u %ld %u %lf %lf", &id, &tm, &orig_id, &qty,
+                 &price) < 5) {
+        LOG_ERROR("Failed to parse confirmation line #" << ln);
+        return;
+      }
+      if (conn) {
         auto ord = Get(id);
-        if (!ord) {
-          LOG_ERROR("Unknown order id " << id << " on confirmation line #"
-                                        << ln);
-          continue;
-        }
-        auto cm = std::make_shared<Confirmation>();
-        cm->exec_type = exec_type;
-        cm->order = ord;
-        cm->transaction_time = tm;
-        cm->text = text;
-        Handle(cm, true);
-      } break;
-      case kUnconfirmedNew: {
-        uint32_t id;
-        int64_t tm;
-        uint32_t algo_id;
-        double qty;
-        double price;
-        double stop_price;
-        char side;
-        char type;
-        char tif;
-        uint32_t sec_id;
-        uint32_t user_id;
-        uint32_t broker_account_id;
-        char destination[n];
-        *destination = 0;
-        if (sscanf(body, "%u %ld %u %lf %lf %lf %c %c %c %u %u %u %s", &id, &tm,
-                   &algo_id, &qty, &price, &stop_price, &side, &type, &tif,
-                   &sec_id, &user_id, &broker_account_id, destination) < 12) {
-          LOG_ERROR("Failed to parse confirmation line #" << ln);
-          continue;
-        }
-        if (conn) {
-          auto ord = Get(id);
-          assert(ord);
-          if (!ord) continue;
-          if (ord->status == kCanceled && ord->cum_qty == 0) {
-            orders_to_ignore.insert(id);
-            continue;
-          }
-          Confirmation cm{};
-          cm.seq = seq;
-          cm.order = ord;
-          cm.exec_type = exec_type;
-          cm.transaction_time = tm;
-          conn->Send(cm, true);
-          continue;
-        }
-        auto sec = SecurityManager::Instance().Get(sec_id);
-        if (!sec) {
-          LOG_ERROR("Unknown security id " << sec_id
-                                           << " on confirmation line #" << ln);
-          continue;
-        }
-        auto user = AccountManager::Instance().GetUser(user_id);
-        if (!user) {
-          LOG_ERROR("Unknown user id " << user_id << " on confirmation line #"
-                                       << ln);
-          continue;
-        }
-        auto sub_account =
-            AccountManager::Instance().GetSubAccount(sub_account_id);
-        if (!sub_account) {
-          LOG_ERROR("Unknown sub account id "
-                    << sub_account_id << " on confirmation line #" << ln);
-          continue;
-        }
-        auto broker_account =
-            AccountManager::Instance().GetBrokerAccount(broker_account_id);
-        if (!sub_account) {
-          LOG_ERROR("Unknown broker account id "
-                    << broker_account_id << " on confirmation line #" << ln);
-          continue;
-        }
-        auto ord = new Order{};
-        ord->id = id;
-        ord->algo_id = algo_id;
-        ord->qty = qty;
-        ord->price = price;
-        ord->stop_price = stop_price;
-        ord->side = static_cast<opentrade::OrderSide>(side);
-        ord->type = static_cast<opentrade::OrderType>(type);
-        ord->tif = static_cast<opentrade::TimeInForce>(tif);
-        ord->sec = sec;
-        ord->user = user;
-        ord->sub_account = sub_account;
-        ord->broker_account = broker_account;
-        ord->destination = destination;
-        ord->tm = tm;
-        auto cm = std::make_shared<Confirmation>();
-        cm->exec_type = exec_type;
-        cm->order = ord;
-        cm->transaction_time = tm;
-        Handle(cm, true);
-        if (id > order_id_counter_) order_id_counter_ = id;
-      } break;
-      case kUnconfirmedCancel: {
-        if (conn) continue;
-        uint32_t id;
-        int64_t tm;
-        uint32_t orig_id;
-        if (sscanf(body, "%u %ld %u", &id, &tm, &orig_id) < 3) {
-          LOG_ERROR("Failed to parse confirmation line #" << ln);
-          continue;
-        }
-        auto orig_ord = Get(orig_id);
-        if (!orig_ord) {
-          LOG_ERROR("Unknown orig_id " << orig_id << " on confirmation line #"
-                                       << ln);
-          continue;
-        }
-        auto cancel_order = new Order(*orig_ord);
-        cancel_order->id = id;
-        cancel_order->orig_id = orig_id;
-        cancel_order->tm = tm;
-        auto cm = std::make_shared<Confirmation>();
-        cm->exec_type = exec_type;
-        cm->order = cancel_order;
-        cm->transaction_time = tm;
-        if (id > order_id_counter_) order_id_counter_ = id;
-        Handle(cm, true);
-      } break;
-      case kRiskRejected: {
+        if (!ord) return;
+        Confirmation cm{};
+        cm.seq = seq;
+        cm.order = ord;
+        cm.exec_type = exec_type;
+        cm.transaction_time = tm;
+        conn->Send(cm, true);
+        return;
+      }
+      auto orig_ord = Get(orig_id);
+      if (!orig_ord) {
+        LOG_ERROR("Unknown orig_id " << orig_id << " on confirmation line #"
+                                     << ln);
+        return;
+      }
+      auto ord = new Order(*orig_ord);
+      ord->id = id;
+      ord->orig_id = orig_id;
+      ord->status = kOrderStatusUnknown;
+      ord->qty = qty;
+      ord->price = price;
+      ord->avg_px = 0;
+      ord->cum_qty = 0;
+      ord->leaves_qty = 0;
+      ord->replace_id = 0;
+      ord->tm = tm;
+      auto cm = Confirmation::New();
+      cm->exec_type = exec_type;
+      cm->order = ord;
+      cm->transaction_time = tm;
+      if (id > order_id_counter_) order_id_counter_ = id;
+      Handle(cm, true);
+    } break;
+    case kRiskRejected: {
+      uint32_t id;
+      char text[n];
+      *text = 0;
+      if (sscanf(body, "%u %[^\1]", &id, text) < 1) {
+        LOG_ERROR("Failed to parse confirmation line #" << ln);
+        return;
+      }
+      auto ord = Get(id);
+      if (!ord) {
+        LOG_ERROR("Unknown order id " << id << " on confirmation line #"
+                                      << ln);
+        return;
+      }
+      if (conn) {
+        assert(id > 0);
+        Confirmation cm{};
+        cm.seq = seq;
+        cm.order = ord;
+        cm.exec_type = exec_type;
+        cm.text = text;
+        conn->Send(cm, true);
+        return;
+      }
+      auto cm = Confirmation::New();
+      cm->exec_type = exec_type;
+      cm->order = ord;
+      cm->text = text;
+      Handle(cm, true);
+    } break;
+    case kComment:
+      if (!conn) {
         uint32_t id;
-        char text[n];
-        *text = 0;
-        if (sscanf(body, "%u %[^\1]", &id, text) < 1) {
+        char exec_id[n];
+        *exec_id = 0;
+        if (sscanf(body, "exec_id %u %s", &id, exec_id) != 2) {
           LOG_ERROR("Failed to parse confirmation line #" << ln);
-          continue;
+          return;
         }
-        auto ord = Get(id);
-        if (!ord) {
-          LOG_ERROR("Unknown order id " << id << " on confirmation line #"
-                                        << ln);
-          continue;
-        }
-        if (conn) {
-          assert(id > 0);
-          Confirmation cm{};
-          cm.seq = seq;
-          cm.order = ord;
-          cm.exec_type = exec_type;
-          cm.text = text;
-          conn->Send(cm, true);
-          continue;
-        }
-        auto cm = std::make_shared<Confirmation>();
-        cm->exec_type = exec_type;
-        cm->order = ord;
-        cm->text = text;
-        Handle(cm, true);
-      } break;
-      case kComment:
-        if (!conn) {
-          uint32_t id;
-          char exec_id[n];
-          *exec_id = 0;
-          if (sscanf(body, "exec_id %u %s", &id, exec_id) != 2) {
-            LOG_ERROR("Failed to parse confirmation line #" << ln);
-            continue;
-          }
-          exec_ids_.emplace(id, std::string(exec_id));
-        }
-        break;
-      default:
-        break;
-    }
+        exec_ids_.Insert(id, exec_id);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+// [u32 seq][u16 n][exec type][sub account id][body]['\0']['\n'] of
+// the file before the journal, returns the end of the whole records
+const char* GlobalOrderBook::ReadLegacy(const char* p, const char* p_end,
+                                        std::vector<StoreRecord>* out) {
+  while (p + 6 < p_end) {
+    StoreRecord r;
+    r.seq = *reinterpret_cast<const uint32_t*>(p);
+    p += 4;
+    r.n = *reinterpret_cast<const uint16_t*>(p);
+    if (p + 2 + 1 + sizeof(SubAccount::IdType) + r.n > p_end) return p - 4;
+    p += 2;
+    r.exec_type = static_cast<opentrade::OrderStatus>(*p);
+    p += 1;
+    r.sub_account_id = *reinterpret_cast<const SubAccount::IdType*>(p);
+    p += sizeof(SubAccount::IdType);
+    r.body = p;
+    p += r.n + 2;  // body + '\0' + '\n'
+    out->push_back(r);
   }
-  if (!conn && p != p_end) {
-    LOG_FATAL("Corrupted confirmation file: " << kPath.c_str()
-                                              << ", please fix it first");
+  return p;
+}
+
+void GlobalOrderBook::LoadStore(uint32_t seq0, Connection* conn) {
+  std::vector<StoreRecord> records;
+
+  boost::iostreams::mapped_file_source legacy;
+  if (fs::exists(kPath) && fs::file_size(kPath)) {
+    legacy.open(kPath.string());
+    auto p_end = legacy.data() + legacy.size();
+    auto p = ReadLegacy(legacy.data(), p_end, &records);
+    if (!conn && p != p_end) {
+      LOG_FATAL("Corrupted confirmation file: " << kPath.c_str()
+                                                << ", please fix it first");
+    }
   }
   if (conn) {
+    Replay(seq0, conn, records);
     LOG_DEBUG("Load offline confirmation done");
+    return;
+  }
+
+  // map and verify segments in parallel, replay in order
+  auto segments = journal_.Segments();
+  auto nseg = segments.size();
+  std::vector<boost::iostreams::mapped_file_source> files(nseg);
+  std::vector<std::vector<Journal::Record>> framed(nseg);
+  std::vector<std::future<size_t>> scans;
+  for (auto i = 0u; i < nseg; ++i) {
+    scans.push_back(std::async(std::launch::async, [&, i]() -> size_t {
+      if (!fs::file_size(segments[i])) return 0;
+      files[i].open(segments[i].string());
+      return Journal::Scan(files[i].data(), files[i].size(), &framed[i]);
+    }));
+  }
+  ssize_t truncate_at = -1;
+  for (auto i = 0u; i < nseg; ++i) {
+    auto valid = scans[i].get();
+    // a segment being appended may end in the middle of a record
+    if (valid == files[i].size()) continue;
+    if (i + 1 < nseg) {
+      LOG_FATAL("Corrupted confirmation journal: "
+                << segments[i].c_str() << ", please fix it first");
+    }
+    LOG_ERROR("Torn tail of confirmation journal "
+              << segments[i].c_str() << " at " << valid << ", truncated");
+    truncate_at = valid;
+  }
+  for (auto i = 0u; i < nseg; ++i) {
+    auto segment = segments[i].filename().string();
+    for (auto& payload : framed[i]) {
+      if (!IsValidRecord(payload)) {
+        LOG_ERROR("Invalid confirmation journal record");
+        continue;
+      }
+      records.push_back(ParseRecord(payload));
+      auto& r = records.back();
+      IndexRecord(r.seq, r.sub_account_id, segment,
+                  payload.data() - files[i].data(), payload.size());
+    }
+  }
+
+  auto ln = 0;
+  for (auto& r : records) Load(r, ++ln, seq0);
+  if (truncate_at >= 0) {
+    files.back().close();
+    fs::resize_file(segments.back(), truncate_at);
+  }
+}
+
+// of an order, superseded by its next status in a snapshot
+static inline bool IsStatusUpdate(OrderStatus exec_type) {
+  switch (exec_type) {
+    case kPendingNew:
+    case kPendingCancel:
+    case kPendingReplace:
+    case kNew:
+    case kSuspended:
+    case kReplaced:
+    case kCanceled:
+    case kRejected:
+    case kExpired:
+    case kCalculated:
+    case kDoneForDay:
+      return true;
+    default:
+      return false;
   }
 }
 
-void GlobalOrderBook::Cancel() {
-  for (auto& pair : orders_) {
-    auto ord = pair.second;
-    if (ord->IsLive()) ExchangeConnectivityManager::Instance().Cancel(*ord);
+// a fresh login (seq0 == 0) gets a snapshot, the orders, fills and rejects
+// with only the latest status of each order, a reconnect gets the tail after
+// seq0 in full
+void GlobalOrderBook::Replay(uint32_t seq0, Connection* conn,
+                             const std::vector<StoreRecord>& legacy) {
+  assert(conn->user_);
+  std::vector<std::string> segments;
+  std::vector<StoreLoc> locs;
+  {
+    std::lock_guard<std::mutex> lock(store_index_m_);
+    segments = store_segments_;
+    auto add = [&](const std::vector<StoreLoc>& v) {
+      auto it = std::upper_bound(
+          v.begin(), v.end(), seq0,
+          [](uint32_t seq, const StoreLoc& l) { return seq < l.seq; });
+      locs.insert(locs.end(), it, v.end());
+    };
+    if (conn->user_->is_admin) {
+      for (auto& pair : store_index_) add(pair.second);
+    } else {
+      for (auto& pair : *conn->user_->sub_accounts()) {
+        auto it = store_index_.find(pair.first);
+        if (it != store_index_.end()) add(it->second);
+      }
+    }
+  }
+  std::sort(locs.begin(), locs.end(),
+            [](const StoreLoc& a, const StoreLoc& b) { return a.seq < b.seq; });
+
+  std::vector<boost::iostreams::mapped_file_source> files(segments.size());
+  for (auto& l : locs) {
+    auto& f = files[l.segment];
+    if (f.is_open()) continue;
+    auto path = kStorePath / segments[l.segment];
+    if (fs::exists(path) && fs::file_size(path)) f.open(path.string());
+  }
+  auto records = legacy;
+  for (auto& l : locs) {
+    auto& f = files[l.segment];
+    // indexed but not flushed yet
+    if (!f.is_open() || l.offset + l.size > f.size()) continue;
+    Journal::Record payload(f.data() + l.offset, l.size);
+    if (IsValidRecord(payload)) records.push_back(ParseRecord(payload));
+  }
+
+  if (!seq0) {
+    std::unordered_set<Order::IdType> seen;
+    std::vector<StoreRecord> snapshot;
+    for (auto it = records.rbegin(); it != records.rend(); ++it) {
+      if (IsStatusUpdate(it->exec_type) && !seen.insert(atol(it->body)).second)
+        continue;
+      snapshot.push_back(*it);
+    }
+    records.assign(snapshot.rbegin(), snapshot.rend());
+  }
+
+  auto ln = 0;
+  std::unordered_set<Order::IdType> orders_to_ignore;
+  for (auto& r : records) Load(r, ++ln, seq0, conn, &orders_to_ignore);
+}
+
+// the GTC and GTD orders still live start over with their leaves, their
+// acks and exec ids; the rest is in the BODs of the next session. Taken
+// after the confirmations handled so far are written, a fill handled in
+// the middle of it would be counted twice, hence at a quiet time of day.
+std::vector<fs::path> GlobalOrderBook::Roll() {
+  DrainWrites();
+  struct Rolled {
+    Order ord;
+    std::string ack;  // body of the last kNew
+    std::vector<std::string> exec_ids;
+  };
+  std::map<Order::IdType, Rolled> rolled;
+  orders_.ForEach([&rolled](Order* ord) {
+    if (!ord->IsLive()) return;
+    if (ord->tif != kGoodTillCancel && ord->tif != kGoodTillDate) return;
+    auto& r = rolled[ord->id];
+    r.ord = *ord;
+    r.ord.qty = ord->leaves_qty;
+  });
+
+  std::vector<StoreRecord> records;
+  boost::iostreams::mapped_file_source legacy;
+  if (fs::exists(kPath) && fs::file_size(kPath)) {
+    legacy.open(kPath.string());
+    ReadLegacy(legacy.data(), legacy.data() + legacy.size(), &records);
+  }
+  auto segments = journal_.Segments();
+  std::vector<boost::iostreams::mapped_file_source> files(segments.size());
+  for (auto i = 0u; i < segments.size(); ++i) {
+    if (!fs::file_size(segments[i])) continue;
+    files[i].open(segments[i].string());
+    std::vector<Journal::Record> framed;
+    Journal::Scan(files[i].data(), files[i].size(), &framed);
+    for (auto& payload : framed) {
+      if (IsValidRecord(payload)) records.push_back(ParseRecord(payload));
+    }
+  }
+  for (auto& r : records) {
+    uint32_t id = 0;
+    char exec_id[r.n + 1];
+    if (r.exec_type == kComment) {
+      if (sscanf(r.body, "exec_id %u %s", &id, exec_id) != 2) continue;
+    } else if (r.exec_type == kPartiallyFilled || r.exec_type == kFilled) {
+      if (sscanf(r.body, "%u %*s %*s %*s %*s %[^\1]", &id, exec_id) != 2)
+        continue;
+    } else if (r.exec_type != kNew) {
+      continue;
+    } else {
+      id = atol(r.body);
+    }
+    auto it = rolled.find(id);
+    if (it == rolled.end()) continue;
+    if (r.exec_type == kNew)
+      it->second.ack.assign(r.body, r.n);
+    else
+      it->second.exec_ids.push_back(exec_id);
+  }
+  for (auto& f : files) f.close();
+  auto has_legacy = legacy.is_open();
+  legacy.close();
+
+  auto old = journal_.Roll();
+  {
+    std::lock_guard<std::mutex> lock(store_index_m_);
+    store_segments_.clear();
+    store_index_.clear();
+  }
+  for (auto& pair : rolled) {
+    auto& r = pair.second;
+    auto acc = r.ord.sub_account->id;
+    Confirmation cm{};
+    cm.order = &r.ord;
+    cm.exec_type = kUnconfirmedNew;
+    cm.transaction_time = r.ord.tm;
+    WriteRecord(++seq_counter_, acc, kUnconfirmedNew, Body(cm));
+    if (!r.ack.empty()) WriteRecord(++seq_counter_, acc, kNew, r.ack);
+    for (auto& exec_id : r.exec_ids) {
+      WriteRecord(++seq_counter_, acc, kComment,
+                  "exec_id " + std::to_string(pair.first) + " " + exec_id);
+    }
+  }
+  journal_.Flush();
+  LOG_INFO("Rolled " << rolled.size() << " live orders onto "
+                     << journal_.segment());
+  if (has_legacy) old.push_back(kPath);
+  return old;
+}
+
+void GlobalOrderBook::Cancel(const BrokerAccount* acc) {
+  if (acc) {
+    for (auto ord : GetOrders(acc)) {
+      if (ord->IsLive()) ExchangeConnectivityManager::Instance().Cancel(*ord);
+    }
+    return;
+  }
+  for (auto status :
+       {kUnconfirmedNew, kPendingNew, kNew, kSuspended, kPartiallyFilled}) {
+    for (auto ord : GetOrders(status)) {
+      if (ord->IsLive()) ExchangeConnectivityManager::Instance().Cancel(*ord);
+    }
   }
 }
 
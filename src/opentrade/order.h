@@ -2,17 +2,24 @@
 #define OPENTRADE_ORDER_H_
 
 #include <tbb/concurrent_unordered_map.h>
-#include <tbb/concurrent_unordered_set.h>
 #include <any>
 #include <atomic>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
 #include <variant>
+#include <vector>
 
 #include "account.h"
+#include "exec_id_set.h"
+#include "journal.h"
+#include "pool.h"
 #include "security.h"
+#include "small_string.h"
 
 namespace opentrade {
 
@@ -127,9 +134,29 @@ struct Contract {
 };
 
 class Instrument;
+struct Order;
+struct Position;
+
+// GlobalOrderBook per-status and per-broker-account list hook, a copied
+// order starts unlinked
+struct OrderListHook {
+  OrderListHook() {}
+  OrderListHook(const OrderListHook&) {}
+  OrderListHook& operator=(const OrderListHook&) { return *this; }
+  Order* prev = nullptr;
+  Order* next = nullptr;
+  Order* acc_prev = nullptr;
+  Order* acc_next = nullptr;
+  OrderStatus status = kOrderStatusUnknown;  // of the list it is linked in
+};
 
 struct Order : public Contract {
   OrderStatus status = kOrderStatusUnknown;
+  // 1 + index of the session placed through in the session group of
+  // broker_account, see BrokerAccount::Route, here to fit in the padding
+  uint8_t session = 0;
+  // in Instrument::Orders of inst while live, in the padding too
+  uint16_t inst_index = 0;
 
   // in case inst of offline order is nullptr, for frontend only
   uint32_t algo_id = 0;
@@ -137,25 +164,68 @@ struct Order : public Contract {
   typedef uint32_t IdType;
   IdType id = 0;
   IdType orig_id = 0;
+  // of the replacement pending on the exchange, at most one at a time
+  IdType replace_id = 0;
   double avg_px = 0;
   double cum_qty = 0;
   double leaves_qty = 0;
   int64_t tm = 0;
+  // steady clock nanoseconds of the tick it reacts to, see TickLatency
+  uint64_t origin = 0;
   const User* user = nullptr;
   const BrokerAccount* broker_account = nullptr;  // primary broker account
   const Instrument* inst = nullptr;
+  OrderListHook hook;
+  // resolved by PositionManager on placing
+  Position* sub_position = nullptr;
+  Position* broker_position = nullptr;
+  Position* user_position = nullptr;
 
   bool IsLive() const {
     return status == kUnconfirmedNew || status == kPendingNew ||
            status == kNew || status == kSuspended || status == kPartiallyFilled;
   }
+
+  // a replacement not yet acknowledged, orig_id is the order it amends
+  bool IsReplacing() const {
+    return status == kUnconfirmedReplace || status == kPendingReplace;
+  }
+
+  // Order and its subclasses (CrossOrder) share one slab pool, so that it
+  // does not matter through which type it is deleted
+#ifdef TEST_LATENCY
+  static inline const size_t kPoolBlockSize = 320;  // tm_for_test_latency
+#else
+  static inline const size_t kPoolBlockSize = 256;
+#endif
+  typedef SlabPool<kPoolBlockSize> Pool;
+  static MemoryTag& memory_tag() {
+    static auto& kTag = MemoryTag::Get("orders");
+    return kTag;
+  }
+  static void* operator new(size_t n) {
+    memory_tag().Add(n);
+    if (n > kPoolBlockSize) return ::operator new(n);
+    return Pool::Allocate();
+  }
+  static void operator delete(void* p, size_t n) {
+    memory_tag().Sub(n);
+    if (n > kPoolBlockSize)
+      ::operator delete(p);
+    else
+      Pool::Free(p);
+  }
 };
 
 struct Confirmation {
   typedef std::shared_ptr<Confirmation> Ptr;
+  // pooled, use this instead of std::make_shared
+  static Ptr New() {
+    return std::allocate_shared<Confirmation>(PoolAllocator<Confirmation>());
+  }
   Order* order = nullptr;
-  std::string exec_id;
-  std::string order_id;  // exchange order id
+  SmallString<> exec_id;
+  SmallString<> order_id;  // exchange order id
   std::string text;
   OrderStatus exec_type = kOrderStatusUnknown;
   ExecTransType exec_trans_type = kTransNew;
@@ -171,42 +241,217 @@ struct Confirmation {
   StrMapPtr misc;
 };
 
+// Append-only two-level table indexed by order id, lookups are two
+// lock-free loads. Segments are calloc'ed so untouched pages cost nothing.
+class OrderTable {
+ public:
+  OrderTable() {
+    dir_ = static_cast<std::atomic<Slot*>*>(calloc(kSize, sizeof(Slot*)));
+  }
+  ~OrderTable() {
+    Clear();
+    free(dir_);
+  }
+  Order* Get(Order::IdType id) const {
+    auto seg = dir_[id >> kBits].load(std::memory_order_acquire);
+    return seg ? seg[id & kMask].load(std::memory_order_acquire) : nullptr;
+  }
+  void Set(Order::IdType id, Order* ord) {
+    auto& d = dir_[id >> kBits];
+    auto seg = d.load(std::memory_order_acquire);
+    if (!seg) {
+      auto tmp = TakeSpare();
+      if (!tmp) tmp = static_cast<Slot*>(calloc(kSize, sizeof(Slot)));
+      if (d.compare_exchange_strong(seg, tmp, std::memory_order_acq_rel)) {
+        seg = tmp;
+      } else {
+        std::lock_guard<std::mutex> lock(spare_m_);
+        spare_.push_back(tmp);
+      }
+    }
+    seg[id & kMask].store(ord, std::memory_order_release);
+  }
+  template <typename F>
+  void ForEach(F func) const {
+    for (auto i = 0u; i < kSize; ++i) {
+      auto seg = dir_[i].load(std::memory_order_acquire);
+      if (!seg) continue;
+      for (auto j = 0u; j < kSize; ++j) {
+        auto ord = seg[j].load(std::memory_order_acquire);
+        if (ord) func(ord);
+      }
+    }
+  }
+  // not thread safe
+  void Clear() {
+    for (auto i = 0u; i < kSize; ++i) {
+      free(dir_[i].load());
+      dir_[i] = nullptr;
+    }
+    for (auto seg : spare_) free(seg);
+    spare_.clear();
+  }
+  // not thread safe, same as Clear but the segments are zeroed and kept for
+  // the next Set instead of freed, e.g. between backtest days
+  void Reset() {
+    for (auto i = 0u; i < kSize; ++i) {
+      auto seg = dir_[i].load();
+      if (!seg) continue;
+      memset(static_cast<void*>(seg), 0, kSize * sizeof(Slot));
+      spare_.push_back(seg);
+      dir_[i] = nullptr;
+    }
+  }
+
+ private:
+  static inline const uint32_t kBits = 16;
+  static inline const uint32_t kSize = 1 << kBits;
+  static inline const uint32_t kMask = kSize - 1;
+  typedef std::atomic<Order*> Slot;
+
+  Slot* TakeSpare() {
+    std::lock_guard<std::mutex> lock(spare_m_);
+    if (spare_.empty()) return nullptr;
+    auto seg = spare_.back();
+    spare_.pop_back();
+    return seg;
+  }
+
+  std::atomic<Slot*>* dir_ = nullptr;
+  std::mutex spare_m_;
+  std::vector<Slot*> spare_;
+};
+
 class Connection;
 
 class GlobalOrderBook : public Singleton<GlobalOrderBook> {
  public:
-  static void Initialize();
-  uint32_t NewOrderId() { return ++order_id_counter_; }
-  bool IsDupExecId(Order::IdType id, const std::string& exec_id) {
-    return !exec_ids_.emplace(id, exec_id).second;
+  static void Initialize(bool journal_fsync = false);
+  // each thread takes kIdBlock ids off the counter at a time, so the ids
+  // are unique but only increase per thread
+  uint32_t NewOrderId() {
+    thread_local uint32_t next = 0;
+    thread_local uint32_t end = 0;
+    if (next == end) {
+      next = order_id_counter_.fetch_add(kIdBlock, std::memory_order_relaxed) +
+             1;
+      end = next + kIdBlock;
+    }
+    return next++;
+  }
+  bool IsDupExecId(Order::IdType id, std::string_view exec_id) {
+    return !exec_ids_.Insert(id, exec_id);
   }
-  Order* Get(Order::IdType id) {
-    auto it = orders_.find(id);
-    return it == orders_.end() ? nullptr : it->second;
+  Order* Get(Order::IdType id) { return orders_.Get(id); }
+  // func(Order*) of all orders, thread safe
+  template <typename F>
+  void ForEach(F func) const {
+    orders_.ForEach(func);
   }
-  void Cancel();
+  // all live orders, or only those of the broker account
+  void Cancel(const BrokerAccount* acc = nullptr);
+  // order state, positions and the algo's runner in line, then hands off to
+  // the write stage for publishing and the journal
   void Handle(Confirmation::Ptr cm, bool offline = false);
   void LoadStore(uint32_t seq0 = 0, Connection* conn = nullptr);
+  // on a standby, a journal record streamed from the primary at offset of
+  // segment, see Replication
+  void Replicate(Journal::Record payload, const std::string& segment,
+                 uint64_t offset);
+  // the standby becomes the primary
+  void TakeOver();
   void ReadPreviousDayExecIds();
-  auto GetOrders(OrderStatus status) {
-    std::vector<Order*> out;
-    for (auto& pair : orders_) {
-      if (pair.second->status == status) out.push_back(pair.second);
-    }
-    return out;
-  }
+  // day roll on the write thread, see DayRoll; returns the files rolled
+  // out of the store
+  std::vector<boost::filesystem::path> Roll();
+  // live and pending statuses are indexed, the others scan all orders
+  std::vector<Order*> GetOrders(OrderStatus status);
+  // live and pending cancel orders of the broker account
+  std::vector<Order*> GetOrders(const BrokerAccount* acc);
+  // live and pending cancel orders sent through the adapter
+  std::vector<Order*> GetOrders(const ExchangeConnectivityAdapter* adapter);
 
  private:
+  struct StoreRecord {
+    uint32_t seq;
+    OrderStatus exec_type;
+    SubAccount::IdType sub_account_id;
+    const char* body;
+    uint32_t n;
+  };
+  static StoreRecord ParseRecord(Journal::Record payload);
+  static const char* ReadLegacy(const char* p, const char* p_end,
+                                std::vector<StoreRecord>* out);
+  // applies r, or sends it to conn
+  void Load(const StoreRecord& r, int ln, uint32_t seq0 = 0,
+            Connection* conn = nullptr,
+            std::unordered_set<Order::IdType>* orders_to_ignore = nullptr);
+  // the journal records of conn's sub accounts after seq0, read through
+  // store_index_, or every record of the legacy file
+  void Replay(uint32_t seq0, Connection* conn,
+              const std::vector<StoreRecord>& legacy);
+  void ResumeCounters();
   void UpdateOrder(Confirmation::Ptr cm);
+  void UpdateStatusList(Order* ord);
+  static int StatusListIndex(OrderStatus status);
+  // write stage, one drain on kWriteTaskPool at a time
+  struct WriteNode {
+    Confirmation::Ptr cm;
+    uint64_t tm = 0;  // enqueued, see TickLatency::Now
+    std::atomic<WriteNode*> next = nullptr;
+    static void* operator new(size_t) {
+      return SlabPool<sizeof(WriteNode)>::Allocate();
+    }
+    static void operator delete(void* p) {
+      SlabPool<sizeof(WriteNode)>::Free(p);
+    }
+  };
+  // intrusive MPSC queue (Vyukov) as AlgoRunner's
+  void PushWrite(WriteNode* node);
+  WriteNode* PopWrite();
+  void DrainWrites();
+  void Write(Confirmation::Ptr cm);
+  static std::string Body(const Confirmation& cm);
+  void WriteRecord(uint32_t seq, SubAccount::IdType acc, OrderStatus exec_type,
+                   std::string body);
 
  private:
-  tbb::concurrent_unordered_map<Order::IdType, Order*> orders_;
-  std::atomic<uint32_t> order_id_counter_ = 0;
+  OrderTable orders_;
+  // intrusive lists by status, see StatusListIndex
+  struct StatusList {
+    Order* head = nullptr;
+    size_t size = 0;
+  };
+  StatusList status_lists_[8];
+  // orders in any of the status lists by broker account
+  std::unordered_map<const BrokerAccount*, StatusList> account_lists_;
+  std::mutex status_mutex_;
+  static inline const uint32_t kIdBlock = 1024;
+  static inline const uint32_t kIdRestartGap = 1e5;
+  alignas(64) std::atomic<uint32_t> order_id_counter_ = 0;
   uint32_t seq_counter_ = 0;
-  tbb::concurrent_unordered_set<std::pair<Order::IdType, std::string>>
-      exec_ids_;
-  std::ofstream of_;
+  ExecIdSet exec_ids_;
+  Journal journal_{kStorePath, "confirmations"};
+  // where the journal records of each sub account are, in seq order, so
+  // that the replay on login reads only those of the user
+  struct StoreLoc {
+    uint32_t seq;
+    uint32_t segment;  // in store_segments_
+    uint32_t size;  // of the payload
+    uint64_t offset;
+  };
+  void IndexRecord(uint32_t seq, SubAccount::IdType id,
+                   const std::string& segment, uint64_t offset, uint32_t size);
+  std::mutex store_index_m_;
+  std::vector<std::string> store_segments_;
+  std::unordered_map<SubAccount::IdType, std::vector<StoreLoc>> store_index_;
+  WriteNode write_stub_;
+  std::atomic<WriteNode*> write_head_ = &write_stub_;
+  WriteNode* write_tail_ = &write_stub_;
+  std::atomic<uint32_t> write_pending_ = 0;
+  int replicated_ = 0;
   friend class Backtest;
+  friend class Replication;
 };
 
 static inline bool GetOrderSide(const std::string& side_str, OrderSide* side) {
@@ -0,0 +1,106 @@
+#ifndef OPENTRADE_ORDER_BOOK_H_
+#define OPENTRADE_ORDER_BOOK_H_
+
+#include <algorithm>
+#include <boost/python.hpp>
+#include <functional>
+#include <vector>
+
+#include "market_data.h"
+
+namespace opentrade {
+
+static const Indicator::IdType kOrderBook = 2;
+
+// Full depth price level book for venues deeper than MarketData::kDepthSize,
+// populated by adapters with MarketDataAdapter::UpdateBook. It hangs off
+// MarketData as an indicator, so MarketData copies stay small, and its best
+// levels are mirrored into MarketData::depth.
+class OrderBook : public Indicator {
+ public:
+  static const Indicator::IdType kId = kOrderBook;
+  struct Level {
+    double price;
+    MarketData::Qty size;
+  };
+  typedef std::vector<Level> Levels;  // best first
+
+  // size <= 0 removes the level, return the index of the level touched
+  size_t Update(double price, MarketData::Qty size, bool is_bid) {
+    Lock lock(m_);
+    if (is_bid) return Update(price, size, std::greater<double>(), &bids_);
+    return Update(price, size, std::less<double>(), &asks_);
+  }
+
+  void Clear() {
+    Lock lock(m_);
+    asks_.clear();
+    bids_.clear();
+  }
+
+  // copy of the best n levels, all if n is 0
+  Levels asks(size_t n = 0) const { return Copy(asks_, n); }
+  Levels bids(size_t n = 0) const { return Copy(bids_, n); }
+
+  void CopyTop(MarketData::Depth* depth) const {
+    Lock lock(m_);
+    for (auto i = 0u; i < MarketData::kDepthSize; ++i) {
+      auto& q = (*depth)[i];
+      q = MarketData::Quote{};
+      if (i < asks_.size()) {
+        q.ask_price = asks_[i].price;
+        q.ask_size = asks_[i].size;
+      }
+      if (i < bids_.size()) {
+        q.bid_price = bids_[i].price;
+        q.bid_size = bids_[i].size;
+      }
+    }
+  }
+
+  boost::python::object GetPyObject() const override {
+    boost::python::dict out;
+    out["asks"] = ToPy(asks());
+    out["bids"] = ToPy(bids());
+    return out;
+  }
+
+ private:
+  template <typename Cmp>
+  static size_t Update(double price, MarketData::Qty size, Cmp cmp,
+                       Levels* levels) {
+    auto it = std::lower_bound(
+        levels->begin(), levels->end(), price,
+        [cmp](const Level& l, double px) { return cmp(l.price, px); });
+    auto i = it - levels->begin();
+    if (it != levels->end() && it->price == price) {
+      if (size > 0)
+        it->size = size;
+      else
+        levels->erase(it);
+    } else if (size > 0) {
+      levels->insert(it, Level{price, size});
+    }
+    return i;
+  }
+
+  Levels Copy(const Levels& levels, size_t n) const {
+    Lock lock(m_);
+    if (!n || n > levels.size()) n = levels.size();
+    return Levels(levels.begin(), levels.begin() + n);
+  }
+
+  static boost::python::list ToPy(const Levels& levels) {
+    boost::python::list out;
+    for (auto& l : levels)
+      out.append(boost::python::make_tuple(l.price, l.size));
+    return out;
+  }
+
+  Levels asks_;
+  Levels bids_;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_ORDER_BOOK_H_
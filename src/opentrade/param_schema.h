@@ -0,0 +1,275 @@
+#ifndef OPENTRADE_PARAM_SCHEMA_H_
+#define OPENTRADE_PARAM_SCHEMA_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+#include "algo.h"
+
+namespace opentrade {
+
+// The base of the parameter struct of a TypedAlgo
+struct ParamStruct {
+  uint64_t given = 0;  // bit i if field i of the schema was given
+};
+
+// ParamDefs bound to the members of a parameter struct, so that the json of
+// spawn and modify is parsed into the struct directly, without the ParamMap
+// hashing and variant conversions. Built once per algo and immutable then,
+// the defs not bound are ignored.
+class ParamSchema {
+ public:
+  enum Kind : uint8_t { kString, kBool, kInt, kDouble, kSecurity, kChoice };
+  struct Field {
+    std::string_view name;
+    const ParamDef* def;
+    Kind kind;
+    uint8_t index;
+  };
+
+  explicit ParamSchema(const ParamDefs& defs) : defs_(defs) {}
+  ParamSchema(const ParamSchema&) = delete;
+  ParamSchema& operator=(const ParamSchema&) = delete;
+  virtual ~ParamSchema() {}
+  const ParamDefs& defs() const { return defs_; }
+  const std::vector<Field>& fields() const { return fields_; }
+
+  // nullptr if not bound
+  const Field* Find(std::string_view name) const {
+    auto it = std::lower_bound(
+        sorted_.begin(), sorted_.end(), name,
+        [this](uint8_t i, std::string_view n) { return fields_[i].name < n; });
+    if (it == sorted_.end() || fields_[*it].name != name) return nullptr;
+    return &fields_[*it];
+  }
+
+  // index of v in the choices of a kChoice field, -1 if not one of them
+  static int Choice(const Field& f, std::string_view v) {
+    auto& choices = std::get<ParamDef::ValueVector>(f.def->default_value);
+    for (auto i = 0u; i < choices.size(); ++i) {
+      auto& c = choices[i];
+      if (auto s = std::get_if<std::string>(&c); s && *s == v) return i;
+      if (auto s = std::get_if<const char*>(&c); s && v == *s) return i;
+    }
+    return -1;
+  }
+
+  virtual std::shared_ptr<ParamStruct> New() const = 0;
+  // converted to the type of the member, a choice to its index if the member
+  // is a number; return error
+  virtual std::string Set(ParamStruct* p, const Field& f, bool v) const = 0;
+  virtual std::string Set(ParamStruct* p, const Field& f, int64_t v) const = 0;
+  virtual std::string Set(ParamStruct* p, const Field& f, double v) const = 0;
+  virtual std::string Set(ParamStruct* p, const Field& f,
+                          std::string v) const = 0;
+  virtual std::string Set(ParamStruct* p, const Field& f,
+                          SecurityTuple v) const = 0;
+  // copies the fields given in from, adding them to to->given
+  virtual void Merge(const ParamStruct& from, ParamStruct* to) const = 0;
+
+  // for the ParamMap callers, python and backtest, nullptr on error
+  std::shared_ptr<ParamStruct> FromMap(const Algo::ParamMap& m,
+                                       std::string* err) const {
+    auto p = New();
+    for (auto& f : fields_) {
+      auto it = m.find(f.def->name);
+      if (it == m.end()) continue;
+      *err = std::visit(
+          [&](auto& v) -> std::string {
+            typedef std::decay_t<decltype(v)> T;
+            if constexpr (std::is_same_v<T, const char*>) {
+              return Set(p.get(), f, std::string(v));
+            } else if constexpr (std::is_same_v<T, int32_t>) {
+              return Set(p.get(), f, static_cast<int64_t>(v));
+            } else if constexpr (std::is_same_v<T, ParamDef::ValueVector>) {
+              return "list not supported for " + f.def->name;
+            } else {
+              return Set(p.get(), f, v);
+            }
+          },
+          it->second);
+      if (!err->empty()) return nullptr;
+    }
+    return p;
+  }
+
+ protected:
+  static Kind KindOf(const ParamDef::Value& v) {
+    return std::visit(
+        [](auto& v) {
+          typedef std::decay_t<decltype(v)> T;
+          if constexpr (std::is_same_v<T, bool>) return kBool;
+          if constexpr (std::is_same_v<T, int64_t> ||
+                        std::is_same_v<T, int32_t>)
+            return kInt;
+          if constexpr (std::is_same_v<T, double>) return kDouble;
+          if constexpr (std::is_same_v<T, SecurityTuple>) return kSecurity;
+          if constexpr (std::is_same_v<T, ParamDef::ValueVector>)
+            return kChoice;
+          return kString;
+        },
+        v);
+  }
+
+  const ParamDefs defs_;
+  std::vector<Field> fields_;
+  std::vector<uint8_t> sorted_;  // indices of fields_ by name
+};
+
+template <typename P>
+class ParamSchemaT : public ParamSchema {
+ public:
+  static_assert(std::is_base_of_v<ParamStruct, P>);
+  typedef std::variant<std::string P::*, bool P::*, int32_t P::*,
+                       int64_t P::*, double P::*, SecurityTuple P::*>
+      Member;
+
+  using ParamSchema::ParamSchema;
+
+  // the def of name to member
+  template <typename T>
+  ParamSchemaT& Bind(const char* name, T P::*member) {
+    auto it = std::find_if(defs_.begin(), defs_.end(),
+                           [name](auto& d) { return d.name == name; });
+    assert(it != defs_.end());
+    assert(fields_.size() < 64);
+    if (it == defs_.end() || fields_.size() >= 64) return *this;
+    fields_.push_back(Field{it->name, &*it, KindOf(it->default_value),
+                            static_cast<uint8_t>(fields_.size())});
+    members_.push_back(member);
+    sorted_.push_back(fields_.back().index);
+    std::sort(sorted_.begin(), sorted_.end(), [this](uint8_t a, uint8_t b) {
+      return fields_[a].name < fields_[b].name;
+    });
+    return *this;
+  }
+
+  std::shared_ptr<ParamStruct> New() const override {
+    return std::make_shared<P>();
+  }
+  std::string Set(ParamStruct* p, const Field& f, bool v) const override {
+    return Assign(p, f, v);
+  }
+  std::string Set(ParamStruct* p, const Field& f, int64_t v) const override {
+    return Assign(p, f, v);
+  }
+  std::string Set(ParamStruct* p, const Field& f, double v) const override {
+    return Assign(p, f, v);
+  }
+  std::string Set(ParamStruct* p, const Field& f,
+                  std::string v) const override {
+    return Assign(p, f, std::move(v));
+  }
+  std::string Set(ParamStruct* p, const Field& f,
+                  SecurityTuple v) const override {
+    return Assign(p, f, v);
+  }
+
+  void Merge(const ParamStruct& from, ParamStruct* to) const override {
+    auto& a = static_cast<const P&>(from);
+    auto& b = *static_cast<P*>(to);
+    for (auto& f : fields_) {
+      if (!(from.given >> f.index & 1)) continue;
+      std::visit([&](auto m) { b.*m = a.*m; }, members_[f.index]);
+    }
+    to->given |= from.given;
+  }
+
+ private:
+  template <typename V>
+  std::string Assign(ParamStruct* p, const Field& f, V v) const {
+    auto& obj = *static_cast<P*>(p);
+    std::string err;
+    std::visit(
+        [&](auto m) {
+          auto& dst = obj.*m;
+          typedef std::decay_t<decltype(dst)> T;
+          if constexpr (std::is_same_v<V, std::string>) {
+            if (f.kind == kChoice) {
+              auto i = Choice(f, v);
+              if (i < 0) {
+                err = "invalid " + f.def->name + ": " + v;
+                return;
+              }
+              if constexpr (std::is_arithmetic_v<T>) {
+                dst = i;
+                return;
+              }
+            }
+          }
+          if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool> &&
+                        std::is_floating_point_v<V>) {
+            dst = std::round(v);
+          } else if constexpr (std::is_arithmetic_v<T> &&
+                               std::is_arithmetic_v<V>) {
+            dst = v;
+          } else if constexpr (std::is_same_v<T, V>) {
+            dst = std::move(v);
+          } else {
+            err = "invalid type of " + f.def->name;
+          }
+        },
+        members_[f.index]);
+    if (err.empty()) p->given |= 1lu << f.index;
+    return err;
+  }
+
+  std::vector<Member> members_;
+};
+
+// An algo taking its parameters as the struct P, parsed once from the json by
+// Connection through schema(), or from the ParamMap of the python and
+// backtest callers
+template <typename P>
+class TypedAlgo : public Algo {
+ public:
+  typedef P Params;
+  typedef ParamSchemaT<P> Schema;
+
+  virtual std::string OnStart(const P& params) noexcept = 0;
+  // params are the current ones with the modified merged in, params.given
+  // is of the modified ones only
+  virtual void OnModify(const P& params) noexcept {}
+  // built once, e.g. a function static, of the defs of GetParamDefs
+  virtual const Schema& schema() noexcept = 0;
+
+  const ParamSchema* GetParamSchema() noexcept override { return &schema(); }
+  const ParamDefs& GetParamDefs() noexcept override { return schema().defs(); }
+  const P& params() const { return params_; }
+
+  std::string OnStart(const ParamMap& params) noexcept override {
+    std::string err;
+    auto p = Typed(params, &err);
+    if (!p) return err;
+    params_ = *p;
+    return OnStart(params_);
+  }
+
+  void OnModify(const ParamMap& params) noexcept override {
+    std::string err;
+    auto p = Typed(params, &err);
+    if (!p) return;
+    schema().Merge(*p, &params_);
+    params_.given = p->given;
+    OnModify(params_);
+  }
+
+ private:
+  std::shared_ptr<const P> Typed(const ParamMap& m, std::string* err) {
+    if (m.typed) return std::static_pointer_cast<const P>(m.typed);
+    return std::static_pointer_cast<const P>(schema().FromMap(m, err));
+  }
+
+  P params_;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_PARAM_SCHEMA_H_
@@ -0,0 +1,186 @@
+#ifndef OPENTRADE_PIPE_STREAM_H_
+#define OPENTRADE_PIPE_STREAM_H_
+
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/file.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filter/lzma.hpp>
+#include <boost/iostreams/filter/zstd.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "utility.h"
+
+namespace opentrade {
+
+// A tick or profile file, .gz, .xz and .zst decompressed in process rather
+// than through a zcat pipe: by a readahead thread kReadahead blocks ahead of
+// the reader, or all at once into memory with in_memory, for the binary
+// readers wanting the whole file as the mapped plain ones.
+class PipeStream {
+ public:
+  static inline const size_t kBlockSize = 1 << 20;
+  static inline const size_t kReadahead = 4;
+
+  PipeStream() {}
+  explicit PipeStream(const char* fn, bool in_memory = false) {
+    open(fn, in_memory);
+  }
+  PipeStream(const PipeStream&) = delete;
+  PipeStream& operator=(const PipeStream&) = delete;
+  ~PipeStream() { close(); }
+
+  static bool IsCompressed(const char* fn) {
+    return EndsWith(fn, ".gz") || EndsWith(fn, ".xz") || EndsWith(fn, ".zst");
+  }
+
+  bool open(const char* fn, bool in_memory = false) {
+    namespace io = boost::iostreams;
+    close();
+    compressed_ = IsCompressed(fn);
+    if (!compressed_) {
+      fstream_.open(fn);
+      return fstream_.good();
+    }
+    io::file_source src(fn, std::ios_base::in | std::ios_base::binary);
+    if (!src.is_open()) return Fail();
+    auto in = std::make_unique<io::filtering_istream>();
+    if (EndsWith(fn, ".gz"))
+      in->push(io::gzip_decompressor(io::gzip::default_window_bits,
+                                     kBlockSize));
+    else if (EndsWith(fn, ".xz"))
+      in->push(io::lzma_decompressor(kBlockSize));
+    else
+      in->push(io::zstd_decompressor(kBlockSize));
+    in->push(src, kBlockSize);
+    in_memory_ = in_memory;
+    if (in_memory) {
+      auto n = 0lu;
+      do {
+        data_.resize(n + kBlockSize);
+        in->read(&data_[n], kBlockSize);
+        n += in->gcount();
+      } while (*in);
+      data_.resize(n);
+      if (in->bad()) return Fail();
+      mstream_.open(io::array_source(data_.data(), data_.size()));
+      return mstream_.good();
+    }
+    stop_ = done_ = false;
+    thread_ = std::thread(
+        [this, in = std::move(in)]() mutable { Readahead(in.get()); });
+    pstream_.open(Reader{this}, kBlockSize / 16);
+    return pstream_.good();
+  }
+
+  std::basic_istream<char>& stream() {
+    if (!compressed_) return fstream_;
+    if (in_memory_) return mstream_;
+    return pstream_;
+  }
+  auto tellg() { return stream().tellg(); }
+  bool good() { return stream().good(); }
+  bool compressed() const { return compressed_; }
+  // the decompressed file if opened in_memory
+  const char* data() const { return data_.data(); }
+  size_t size() const { return data_.size(); }
+
+  void close() {
+    if (thread_.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(m_);
+        stop_ = true;
+      }
+      cv_.notify_all();
+      thread_.join();
+    }
+    blocks_.clear();
+    block_.clear();
+    pos_ = 0;
+    if (pstream_.is_open()) pstream_.close();
+    if (mstream_.is_open()) mstream_.close();
+    if (fstream_.is_open()) fstream_.close();
+    pstream_.clear();
+    mstream_.clear();
+    fstream_.clear();
+    std::string().swap(data_);
+    compressed_ = in_memory_ = false;
+  }
+
+ private:
+  bool Fail() {
+    close();
+    fstream_.setstate(std::ios_base::failbit);
+    return false;
+  }
+
+  // the reader side, the blocks of the readahead thread in order
+  struct Reader {
+    typedef char char_type;
+    typedef boost::iostreams::source_tag category;
+    PipeStream* self;
+
+    std::streamsize read(char* s, std::streamsize n) {
+      auto& x = *self;
+      if (x.pos_ == x.block_.size()) {
+        std::unique_lock<std::mutex> lock(x.m_);
+        x.cv_.wait(lock, [&x]() { return !x.blocks_.empty() || x.done_; });
+        if (x.blocks_.empty()) return -1;
+        x.block_ = std::move(x.blocks_.front());
+        x.blocks_.pop_front();
+        x.pos_ = 0;
+        x.cv_.notify_all();
+      }
+      n = std::min<std::streamsize>(n, x.block_.size() - x.pos_);
+      memcpy(s, x.block_.data() + x.pos_, n);
+      x.pos_ += n;
+      return n;
+    }
+  };
+
+  void Readahead(boost::iostreams::filtering_istream* in) {
+    while (true) {
+      std::string block(kBlockSize, '\0');
+      in->read(&block[0], block.size());
+      block.resize(in->gcount());
+      std::unique_lock<std::mutex> lock(m_);
+      cv_.wait(lock, [this]() { return blocks_.size() < kReadahead || stop_; });
+      if (stop_) return;
+      if (block.empty()) {
+        done_ = true;
+      } else {
+        blocks_.push_back(std::move(block));
+      }
+      cv_.notify_all();
+      if (done_) return;
+    }
+  }
+
+  bool compressed_ = false;
+  bool in_memory_ = false;
+  std::ifstream fstream_;
+  boost::iostreams::stream<Reader> pstream_;
+  boost::iostreams::stream<boost::iostreams::array_source> mstream_;
+  std::string data_;
+  std::thread thread_;
+  std::mutex m_;
+  std::condition_variable cv_;
+  std::deque<std::string> blocks_;
+  bool stop_ = false;
+  bool done_ = false;
+  std::string block_;  // being read, of the reader thread only
+  size_t pos_ = 0;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_PIPE_STREAM_H_
@@ -0,0 +1,148 @@
+#ifndef OPENTRADE_POOL_H_
+#define OPENTRADE_POOL_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "memory.h"
+#include "numa.h"
+
+namespace opentrade {
+
+// Fixed size slab pool. Each thread keeps its own free list, surplus is
+// handed back to a global list in batches, so objects allocated on one
+// thread and released on another (e.g. Confirmation created on adapter
+// thread and dropped on write thread) are recycled instead of piling up.
+// Memory is never returned to the system, counted as "slab_pools", and
+// is of HugePages if enabled.
+template <size_t kSize, size_t kBatch = 64>
+class SlabPool {
+ public:
+  static void* Allocate() {
+    auto& l = local();
+    if (!l.head) Refill(&l);
+    auto p = l.head;
+    l.head = p->next;
+    l.n--;
+    return p;
+  }
+
+  static void Free(void* p) {
+    if (!p) return;
+    auto& l = local();
+    auto node = static_cast<Node*>(p);
+    node->next = l.head;
+    l.head = node;
+    if (++l.n >= 2 * kBatch) Release(&l, kBatch);
+  }
+
+ private:
+  struct Node {
+    Node* next;
+  };
+  // multiple of 16 to keep the default new alignment for every block
+  static inline const size_t kBlock =
+      (std::max(kSize, sizeof(Node)) + 15) / 16 * 16;
+
+  typedef std::pair<Node*, size_t> Batch;
+  struct Global {
+    std::mutex m;
+    std::vector<Batch> batches;
+  };
+  struct Local {
+    Node* head = nullptr;
+    size_t n = 0;
+    ~Local() {
+      if (n) Release(this, n);
+    }
+  };
+
+  static Global& global() {
+    static Global kGlobal;
+    return kGlobal;
+  }
+
+  static Local& local() {
+    static thread_local Local kLocal;
+    return kLocal;
+  }
+
+  static void Refill(Local* l) {
+    auto& g = global();
+    {
+      std::lock_guard<std::mutex> lock(g.m);
+      if (!g.batches.empty()) {
+        auto b = g.batches.back();
+        g.batches.pop_back();
+        l->head = b.first;
+        l->n = b.second;
+        return;
+      }
+    }
+    static auto& kTag = MemoryTag::Get("slab_pools");
+    kTag.Add(kBlock * kBatch, kBatch);
+    auto size = kBlock * kBatch;
+    auto slab = static_cast<char*>(HugePages::Instance().Allocate(size));
+    if (!slab) slab = static_cast<char*>(::operator new(size));
+    Node* head = nullptr;
+    for (auto i = kBatch; i > 0; --i) {
+      auto node = reinterpret_cast<Node*>(slab + (i - 1) * kBlock);
+      node->next = head;
+      head = node;
+    }
+    l->head = head;
+    l->n = kBatch;
+  }
+
+  static void Release(Local* l, size_t n) {
+    auto head = l->head;
+    auto tail = head;
+    for (auto i = 1u; i < n; ++i) tail = tail->next;
+    l->head = tail->next;
+    l->n -= n;
+    tail->next = nullptr;
+    auto& g = global();
+    std::lock_guard<std::mutex> lock(g.m);
+    g.batches.emplace_back(head, n);
+  }
+};
+
+// for std::allocate_shared, single objects come from SlabPool
+template <typename T>
+struct PoolAllocator {
+  typedef T value_type;
+  static_assert(alignof(T) <= 16, "over-aligned type");
+
+  PoolAllocator() = default;
+  template <typename U>
+  PoolAllocator(const PoolAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    if (n == 1) return static_cast<T*>(SlabPool<sizeof(T)>::Allocate());
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t n) {
+    if (n == 1)
+      SlabPool<sizeof(T)>::Free(p);
+    else
+      ::operator delete(p);
+  }
+
+  template <typename U>
+  bool operator==(const PoolAllocator<U>&) const {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const PoolAllocator<U>&) const {
+    return false;
+  }
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_POOL_H_
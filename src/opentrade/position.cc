@@ -1,17 +1,20 @@
 #include "position.h"
 
 #include <postgresql/soci-postgresql.h>
-#include <boost/date_time/posix_time/posix_time.hpp>
+#include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <mutex>
+#include <sstream>
 
 #include "connection.h"
 #include "database.h"
 #include "logger.h"
+#include "memory.h"
+#include "metrics.h"
+#include "sharding.h"
 #include "task_pool.h"
 
-namespace pt = boost::posix_time;
-
 namespace opentrade {
 
 inline void HandlePnl(double qty, double price, double multiplier,
@@ -101,13 +104,29 @@ inline void Position::HandleNew(bool is_buy, double qty, double price,
   PositionValue::HandleNew(is_buy, qty, price, multiplier);
 }
 
-void PositionManager::Initialize() {
+static const auto kSessionPath = kStorePath / "session";
+
+void PositionManager::RollSession() {
+  auto tmp = kSessionPath.string() + ".tmp";
+  std::ofstream ofs(tmp.c_str(), std::ofstream::trunc);
+  auto tm = GetNowStr<false>();
+  ofs.write(tm, strlen(tm));
+  ofs.close();
+  if (!ofs) {
+    LOG_ERROR("Failed to write file: " << tmp << ": " << strerror(errno));
+    return;
+  }
+  fs::rename(tmp, kSessionPath);
+  LOG_INFO("Next session from " << tm << " UTC");
+}
+
+void PositionManager::Initialize(int history_days) {
   Instance().sql_ = Database::Session();
 
   auto& self = Instance();
   auto sql = Database::Session();
 
-  auto path = kStorePath / "session";
+  auto path = kSessionPath;
   std::ifstream ifs(path.c_str());
   char buf[256] = {0};
   if (ifs.good()) {
@@ -152,6 +171,8 @@ void PositionManager::Initialize() {
     auto security_id = Database::GetValue(*it, i++, 0);
     auto sec = SecurityManager::Instance().Get(security_id);
     if (!sec) continue;
+    // other shards' accounts counted there, the shared limits are budgeted
+    if (!ShardManager::Instance().Owns(sub_account_id)) continue;
     p.qty = Database::GetValue(*it, i++, 0.);
     p.cx_qty = Database::GetValue(*it, i++, 0.);
     p.avg_px = Database::GetValue(*it, i++, 0.);
@@ -183,6 +204,23 @@ void PositionManager::Initialize() {
     p3.cx_qty += p.cx_qty;
   }
 
+  auto& am = AccountManager::Instance();
+  auto& sm = SecurityManager::Instance();
+  for (auto& pair : self.sub_positions_) {
+    self.AddRef(sm.Get(pair.first.second), &pair.second,
+                am.GetSubAccount(pair.first.first), pair.first.first,
+                &self.sub_rows_[pair.first.first]);
+  }
+  for (auto& pair : self.broker_positions_) {
+    self.AddRef(sm.Get(pair.first.second), &pair.second,
+                am.GetBrokerAccount(pair.first.first), 0,
+                &self.broker_rows_[pair.first.first]);
+  }
+  for (auto& pair : self.user_positions_) {
+    self.AddRef(sm.Get(pair.first.second), &pair.second,
+                am.GetUser(pair.first.first), 0, nullptr);
+  }
+
   for (auto& pair : AccountManager::Instance().sub_accounts_) {
     auto acc = pair.second;
     auto path = kStorePath / ("target-" + std::to_string(acc->id) + ".json");
@@ -202,6 +240,216 @@ void PositionManager::Initialize() {
       }
     }
   }
+
+  self.history_.Load(history_days);
+  MemoryAccounting::Instance().AddReporter("positions", [&self]() {
+    auto u = MemoryAccounting::OfMap(self.sub_positions_);
+    u += MemoryAccounting::OfMap(self.broker_positions_);
+    u += MemoryAccounting::OfMap(self.user_positions_);
+    return u;
+  });
+}
+
+static Gauge* const kPositionQueue = Metrics::Instance().AddGauge(
+    "opentrade_position_write_queue", "Position rows waiting for database");
+static Counter* const kPositionRows = Metrics::Instance().AddCounter(
+    "opentrade_position_rows_written_total", "Position rows written");
+static Counter* const kPositionBatches = Metrics::Instance().AddCounter(
+    "opentrade_position_batches_total", "Position row batches written");
+static Counter* const kPositionStalls = Metrics::Instance().AddCounter(
+    "opentrade_position_write_stalls_total",
+    "Fills blocked on a full position write queue");
+
+static std::string GetPositionInfo(const Confirmation& cm) {
+  auto ord = cm.order;
+  char side[2];
+  side[0] = static_cast<char>(ord->side);
+  side[1] = 0;
+  char type[2];
+  type[0] = static_cast<char>(ord->type);
+  type[1] = 0;
+  json j = {{"tm", cm.transaction_time},
+            {"qty", cm.last_shares},
+            {"px", cm.last_px},
+            {"exec_id", cm.exec_id.str()},
+            {"side", side},
+            {"type", type},
+            {"id", ord->id}};
+  if (!ord->destination.empty()) j["destination"] = ord->destination;
+  if (ord->optional) {
+    for (auto& pair : *ord->optional) {
+      j[pair.first] = ToString(pair.second);
+    }
+  }
+  if (cm.exec_trans_type == kTransCancel) j["bust"] = true;
+  if (ord->type == kOTC)
+    j["otc"] = true;
+  else if (ord->type == kCX)
+    j["cx"] = true;
+  if (cm.misc) {
+    for (auto& pair : *cm.misc) j[pair.first] = pair.second;
+  }
+  return j.dump();
+}
+
+// the seconds of a GetNowStr<false> string, as Database::GetTm reads it
+static time_t ParseTm(const char* str) {
+  struct tm tm_info {};
+  strptime(str, "%Y-%m-%d %H:%M:%S", &tm_info);
+  return timegm(&tm_info);
+}
+
+static inline std::string Quote(const std::string& str) {
+  std::string out = "'";
+  for (auto c : str) {
+    if (c == '\'') out += c;
+    out += c;
+  }
+  return out + "'";
+}
+
+void PositionManager::Persist(const Position& pos, Confirmation::Ptr cm) {
+  std::unique_lock<std::mutex> lock(rows_m_);
+  if (pending_rows_.size() >= kMaxPendingRows) {
+    kPositionStalls->Add();
+    rows_cv_.wait(lock, [this]() {
+      return pending_rows_.size() < kMaxPendingRows;
+    });
+  }
+  pending_rows_.push_back(PendingRow{pos, cm});
+  kPositionQueue->Add(1);
+  if (flush_scheduled_) return;
+  flush_scheduled_ = true;
+  kDatabaseTaskPool.AddTask([this]() { Flush(); });
+}
+
+// all the rows queued while the previous batch was being written go out
+// together, a multi-row insert per kBatchRows for postgres, one transaction
+// of the prepared insert for sqlite
+void PositionManager::Flush() {
+  std::vector<PendingRow> rows;
+  {
+    std::lock_guard<std::mutex> lock(rows_m_);
+    rows.swap(pending_rows_);
+    flush_scheduled_ = false;
+  }
+  rows_cv_.notify_all();
+  if (rows.empty()) return;
+  try {
+    for (auto i = 0u; i < rows.size(); i += kBatchRows) {
+      auto n = std::min(rows.size() - i, kBatchRows);
+      if (Database::is_sqlite())
+        Insert(&rows[i], n);
+      else
+        InsertValues(&rows[i], n);
+      kPositionBatches->Add();
+      kPositionRows->Add(n);
+      kPositionQueue->Add(-static_cast<int64_t>(n));
+    }
+  } catch (const soci::postgresql_soci_error& e) {
+    LOG_FATAL("Trying update position to database: \n"
+              << e.sqlstate() << ' ' << e.what());
+  } catch (const soci::soci_error& e) {
+    LOG_FATAL("Trying update position to database: \n" << e.what());
+  }
+}
+
+void PositionManager::Insert(const PendingRow* rows, size_t n) {
+  static User::IdType user_id;
+  static SubAccount::IdType sub_account_id;
+  static Security::IdType security_id;
+  static BrokerAccount::IdType broker_account_id;
+  static double qty;
+  static double cx_qty;
+  static double avg_px;
+  static double realized_pnl0;
+  static double commission0;
+  static std::string info;
+  static std::string tm;
+  static const char* cmd = R"(
+    insert into position(user_id, sub_account_id, security_id, 
+    broker_account_id, qty, cx_qty, avg_px, realized_pnl, commission, tm, info) 
+    values(:user_id, :sub_account_id, :security_id, :broker_account_id,
+    :qty, :cx_qty, :avg_px, :realized_pnl, :commission, :tm, :info)
+  )";
+  static soci::statement st =
+      (sql_->prepare << cmd, soci::use(user_id), soci::use(sub_account_id),
+       soci::use(security_id), soci::use(broker_account_id), soci::use(qty),
+       soci::use(cx_qty), soci::use(avg_px), soci::use(realized_pnl0),
+       soci::use(commission0), soci::use(tm), soci::use(info));
+  std::vector<std::pair<long long, std::string>> ids;
+  ids.reserve(n);
+  soci::transaction tr(*sql_);
+  tm = GetNowStr<false>();
+  for (auto row = rows; row != rows + n; ++row) {
+    auto& pos = row->pos;
+    auto ord = row->cm->order;
+    user_id = ord->user->id;
+    sub_account_id = ord->sub_account->id;
+    security_id = ord->sec->id;
+    broker_account_id = ord->broker_account->id;
+    qty = Round6(pos.qty);
+    cx_qty = Round6(pos.cx_qty);
+    avg_px = pos.avg_px;
+    realized_pnl0 = pos.realized_pnl0;
+    commission0 = pos.commission0;
+    info = GetPositionInfo(*row->cm);
+    st.execute(true);
+    long long id = 0;
+    sql_->get_last_insert_id("position", id);
+    ids.emplace_back(id, std::move(info));
+  }
+  tr.commit();
+  auto t = ParseTm(tm.c_str());
+  for (auto i = 0u; i < n; ++i)
+    AddHistory(rows[i], ids[i].first, t, std::move(ids[i].second));
+}
+
+void PositionManager::InsertValues(const PendingRow* rows, size_t n) {
+  std::stringstream ss;
+  ss.precision(17);
+  ss << "insert into position(user_id, sub_account_id, security_id, "
+        "broker_account_id, qty, cx_qty, avg_px, realized_pnl, commission, "
+        "tm, info) values";
+  auto now = GetNowStr<false>();
+  auto t = ParseTm(now);
+  auto tm = Quote(now);
+  std::vector<std::string> infos;
+  infos.reserve(n);
+  for (auto row = rows; row != rows + n; ++row) {
+    auto& pos = row->pos;
+    auto ord = row->cm->order;
+    if (row != rows) ss << ',';
+    ss << '(' << ord->user->id << ',' << ord->sub_account->id << ','
+       << ord->sec->id << ',' << ord->broker_account->id << ','
+       << Round6(pos.qty) << ',' << Round6(pos.cx_qty) << ',' << pos.avg_px
+       << ',' << pos.realized_pnl0 << ',' << pos.commission0 << ',' << tm
+       << ',' << Quote(infos.emplace_back(GetPositionInfo(*row->cm))) << ')';
+  }
+  ss << " returning id";
+  soci::rowset<soci::row> st = sql_->prepare << ss.str();
+  auto i = 0u;
+  for (auto it = st.begin(); it != st.end() && i < n; ++it, ++i) {
+    AddHistory(rows[i], Database::GetValue(*it, 0, 0ll), t,
+               std::move(infos[i]));
+  }
+}
+
+void PositionManager::AddHistory(const PendingRow& row, int64_t id, time_t tm,
+                                 std::string info) {
+  auto& pos = row.pos;
+  auto ord = row.cm->order;
+  PositionSnapshot s;
+  s.id = id;
+  s.tm = tm;
+  s.sec = ord->sec->id;
+  s.broker_account_id = ord->broker_account->id;
+  s.qty = Round6(pos.qty);
+  s.avg_px = pos.avg_px;
+  s.realized_pnl = pos.realized_pnl0;
+  s.commission = pos.commission0;
+  s.info = std::move(info);
+  history_.Add(ord->sub_account->id, std::move(s));
 }
 
 void PositionManager::Handle(Confirmation::Ptr cm, bool offline) {
@@ -212,8 +460,8 @@ void PositionManager::Handle(Confirmation::Ptr cm, bool offline) {
   auto is_otc = ord->type == kOTC || ord->type == kCX;
   auto is_cx = ord->type == kCX;
   assert(cm && ord->id > 0);
-  static std::mutex kMutex;
-  std::lock_guard<std::mutex> lock(kMutex);
+  std::lock_guard<std::mutex> lock(mutex(*sec));
+  ResolveLocked(ord);
   switch (cm->exec_type) {
     case kPartiallyFilled:
     case kFilled: {
@@ -227,7 +475,7 @@ void PositionManager::Handle(Confirmation::Ptr cm, bool offline) {
       auto qty = cm->last_shares;
       auto px = cm->last_px;
       auto px0 = ord->price;
-      auto& pos = sub_positions_[std::make_pair(ord->sub_account->id, sec->id)];
+      auto& pos = *ord->sub_position;
       // should we use volatile variable here for adapter to avoid it optimize
       // out in -O3 mode? In -O3 mode, below two lines generate the same asm
       // with one line without intermediate local adapter variable, adapter is
@@ -238,11 +486,10 @@ void PositionManager::Handle(Confirmation::Ptr cm, bool offline) {
       if (is_bust) commission = -commission;
       pos.HandleTrade(is_buy, qty, px, px0, multiplier, is_bust, is_otc, is_cx,
                       commission);
-      broker_positions_[std::make_pair(ord->broker_account->id, sec->id)]
-          .HandleTrade(is_buy, qty, px, px0, multiplier, is_bust, is_otc, is_cx,
-                       commission);
-      user_positions_[std::make_pair(ord->user->id, sec->id)].HandleTrade(
-          is_buy, qty, px, px0, multiplier, is_bust, is_otc, is_cx, commission);
+      ord->broker_position->HandleTrade(is_buy, qty, px, px0, multiplier,
+                                        is_bust, is_otc, is_cx, commission);
+      ord->user_position->HandleTrade(is_buy, qty, px, px0, multiplier,
+                                      is_bust, is_otc, is_cx, commission);
       const_cast<SubAccount*>(ord->sub_account)
           ->position_value.HandleTrade(is_buy, qty, px, px0, multiplier,
                                        is_bust, is_otc);
@@ -251,99 +498,27 @@ void PositionManager::Handle(Confirmation::Ptr cm, bool offline) {
                                        is_bust, is_otc);
       const_cast<User*>(ord->user)->position_value.HandleTrade(
           is_buy, qty, px, px0, multiplier, is_bust, is_otc);
+      pnl_secs_[sec->id]->dirty = true;
       if (offline) return;
 #ifdef BACKTEST
       return;
 #endif
-      kDatabaseTaskPool.AddTask([this, pos, cm]() {
-        try {
-          static User::IdType user_id;
-          static SubAccount::IdType sub_account_id;
-          static Security::IdType security_id;
-          static BrokerAccount::IdType broker_account_id;
-          static double qty;
-          static double cx_qty;
-          static double avg_px;
-          static double realized_pnl0;
-          static double commission0;
-          static std::string info;
-          static std::string tm;
-          static const char* cmd = R"(
-            insert into position(user_id, sub_account_id, security_id, 
-            broker_account_id, qty, cx_qty, avg_px, realized_pnl, commission, tm, info) 
-            values(:user_id, :sub_account_id, :security_id, :broker_account_id,
-            :qty, :cx_qty, :avg_px, :realized_pnl, :commission, :tm, :info)
-        )";
-          static soci::statement st =
-              (this->sql_->prepare << cmd, soci::use(user_id),
-               soci::use(sub_account_id), soci::use(security_id),
-               soci::use(broker_account_id), soci::use(qty), soci::use(cx_qty),
-               soci::use(avg_px), soci::use(realized_pnl0),
-               soci::use(commission0), soci::use(tm), soci::use(info));
-          auto ord = cm->order;
-          user_id = ord->user->id;
-          sub_account_id = ord->sub_account->id;
-          security_id = ord->sec->id;
-          broker_account_id = ord->broker_account->id;
-          qty = Round6(pos.qty);
-          cx_qty = Round6(pos.cx_qty);
-          avg_px = pos.avg_px;
-          realized_pnl0 = pos.realized_pnl0;
-          commission0 = pos.commission0;
-          char side[2];
-          side[0] = static_cast<char>(ord->side);
-          side[1] = 0;
-          char type[2];
-          type[0] = static_cast<char>(ord->type);
-          type[1] = 0;
-          json j = {{"tm", cm->transaction_time},
-                    {"qty", cm->last_shares},
-                    {"px", cm->last_px},
-                    {"exec_id", cm->exec_id},
-                    {"side", side},
-                    {"type", type},
-                    {"id", ord->id}};
-          if (!ord->destination.empty()) j["destination"] = ord->destination;
-          if (ord->optional) {
-            for (auto& pair : *ord->optional) {
-              j[pair.first] = ToString(pair.second);
-            }
-          }
-          if (cm->exec_trans_type == kTransCancel) j["bust"] = true;
-          if (ord->type == kOTC)
-            j["otc"] = true;
-          else if (ord->type == kCX)
-            j["cx"] = true;
-          if (cm->misc) {
-            for (auto& pair : *cm->misc) j[pair.first] = pair.second;
-          }
-          info = j.dump();
-          tm = GetNowStr<false>();
-          st.execute(true);
-        } catch (const soci::postgresql_soci_error& e) {
-          LOG_FATAL("Trying update position to database: \n"
-                    << e.sqlstate() << ' ' << e.what());
-        } catch (const soci::soci_error& e) {
-          LOG_FATAL("Trying update position to database: \n" << e.what());
-        }
-      });
+      Persist(pos, cm);
     } break;
     case kUnconfirmedNew:
       if (!is_otc) {
         auto qty = ord->qty;
         auto px = ord->price;
-        sub_positions_[std::make_pair(ord->sub_account->id, sec->id)].HandleNew(
-            is_buy, qty, px, multiplier);
-        broker_positions_[std::make_pair(ord->broker_account->id, sec->id)]
-            .HandleNew(is_buy, qty, px, multiplier);
-        user_positions_[std::make_pair(ord->user->id, sec->id)].HandleNew(
-            is_buy, qty, px, multiplier);
+        ord->sub_position->HandleNew(is_buy, qty, px, multiplier);
+        ord->broker_position->HandleNew(is_buy, qty, px, multiplier);
+        ord->user_position->HandleNew(is_buy, qty, px, multiplier);
         const_cast<SubAccount*>(ord->sub_account)
             ->position_value.HandleNew(is_buy, qty, px, multiplier);
         const_cast<BrokerAccount*>(ord->broker_account)
             ->position_value.HandleNew(is_buy, qty, px, multiplier);
         const_cast<User*>(ord->user)->position_value.HandleNew(is_buy, qty, px,
                                                                multiplier);
+        pnl_secs_[sec->id]->dirty = true;
       }
       break;
     case kRiskRejected:
@@ -355,91 +530,285 @@ void PositionManager::Handle(Confirmation::Ptr cm, bool offline) {
       if (!is_otc) {
         auto qty = cm->leaves_qty;
         auto px = ord->price;
-        sub_positions_[std::make_pair(ord->sub_account->id, sec->id)]
-            .HandleFinish(is_buy, qty, px, multiplier);
-        broker_positions_[std::make_pair(ord->broker_account->id, sec->id)]
-            .HandleFinish(is_buy, qty, px, multiplier);
-        user_positions_[std::make_pair(ord->user->id, sec->id)].HandleFinish(
-            is_buy, qty, px, multiplier);
+        ord->sub_position->HandleFinish(is_buy, qty, px, multiplier);
+        ord->broker_position->HandleFinish(is_buy, qty, px, multiplier);
+        ord->user_position->HandleFinish(is_buy, qty, px, multiplier);
         const_cast<SubAccount*>(ord->sub_account)
             ->position_value.HandleFinish(is_buy, qty, px, multiplier);
         const_cast<BrokerAccount*>(ord->broker_account)
             ->position_value.HandleFinish(is_buy, qty, px, multiplier);
         const_cast<User*>(ord->user)->position_value.HandleFinish(
             is_buy, qty, px, multiplier);
+        pnl_secs_[sec->id]->dirty = true;
       }
       break;
+    case kReplaced: {
+      // the old leaves at the old price for the new leaves at the new price
+      auto orig = GlobalOrderBook::Instance().Get(ord->orig_id);
+      if (is_otc || !orig) break;
+      auto apply = [&](auto* pos) {
+        if (cm->leaves_qty > 0)
+          pos->HandleFinish(is_buy, cm->leaves_qty, orig->price, multiplier);
+        if (ord->leaves_qty > 0)
+          pos->HandleNew(is_buy, ord->leaves_qty, ord->price, multiplier);
+      };
+      apply(ord->sub_position);
+      apply(ord->broker_position);
+      apply(ord->user_position);
+      apply(&const_cast<SubAccount*>(ord->sub_account)->position_value);
+      apply(&const_cast<BrokerAccount*>(ord->broker_account)->position_value);
+      apply(&const_cast<User*>(ord->user)->position_value);
+      pnl_secs_[sec->id]->dirty = true;
+    } break;
     default:
       break;
   }
 }
 
-template <typename T1, typename T2>
-void UpdateBalance(T1* positions, T2* accs) {
-  std::unordered_map<int64_t, std::pair<double, double>> balances;
-  auto& sm = SecurityManager::Instance();
-  std::unordered_map<Security::IdType,
-                     std::vector<std::pair<uint64_t, Position*>>>
-      group;
-  for (auto& pair : *positions) {
-    group[pair.first.second].push_back(
-        std::make_pair(pair.first.first, &pair.second));
-  }
-  for (auto& pair : group) {
-    auto sec_id = pair.first;
-    auto sec = sm.Get(sec_id);
-    if (!sec) continue;
-    auto price = sec->CurrentPrice();
-    if (!price) continue;
-    for (auto& acc_pos : pair.second) {
-      auto acc = acc_pos.first;
-      auto& pos = *acc_pos.second;
-      if (!pos.qty && !pos.unrealized_pnl) continue;
-      auto m = sec->rate * sec->multiplier;
-      pos.unrealized_pnl = pos.qty * (price - pos.avg_px) * m;
-      auto qty =
-          pos.qty + pos.total_outstanding_buy - pos.total_outstanding_sell;
-      if (qty > 0)
-        balances[acc].first += qty * price * m;
-      else
-        balances[acc].second -= qty * price * m;
+template <typename Map, typename Acc>
+inline Position& PositionManager::Touch(Map* positions, const Acc* acc,
+                                        const Security* sec,
+                                        SubAccount::IdType sub_account_id) {
+  auto key = std::make_pair(acc->id, sec->id);
+  auto it = positions->find(key);
+  if (it != positions->end()) return it->second;
+  auto& pos = (*positions)[key];
+  AddRef(sec, &pos, acc, sub_account_id, RowsOf(*acc));
+  return pos;
+}
+
+void PositionManager::AddRef(const Security* sec, Position* pos,
+                             const AccountBase* acc,
+                             SubAccount::IdType sub_account_id,
+                             PositionRows* rows) {
+  auto& x = pnl_secs_[sec->id];
+  if (!x) {
+    x.reset(new PnlSecurity);
+    x->sec = sec;
+  }
+  auto value =
+      acc ? const_cast<AccountPositionValue*>(&acc->position_value) : nullptr;
+  auto& book = pnl_books_[sec->id % kShards];
+  if (x->refs.empty()) book.secs.push_back(x.get());
+  x->refs.push_back(
+      PnlSecurity::Ref{pos, value, sub_account_id, book.Add(), rows});
+  x->dirty = true;
+}
+
+void PositionManager::PnlBook::Sync(PnlSecurity* x) {
+#ifndef BACKTEST
+  // hooked on first revalue, market data is not ready in Initialize
+  if (!x->hooked) {
+    x->hooked = true;
+    const_cast<MarketData&>(MarketDataManager::Instance().Get(*x->sec))
+        .HookTradeTick(x);
+  }
+#endif
+  auto price = x->sec->CurrentPrice();
+  auto rate = x->sec->rate * x->sec->multiplier;
+  for (auto& ref : x->refs) {
+    auto& pos = *ref.pos;
+    auto k = ref.slot;
+    qty[k] = pos.qty;
+    avg_px[k] = pos.avg_px;
+    net_qty[k] =
+        pos.qty + pos.total_outstanding_buy - pos.total_outstanding_sell;
+    px[k] = price;
+    m[k] = rate;
+    unrealized[k] = pos.unrealized_pnl;
+    long_value[k] = ref.long_value;
+    short_value[k] = ref.short_value;
+  }
+}
+
+void PositionManager::PnlBook::MarkToMarket() {
+  auto n = qty.size();
+  auto q = qty.data();
+  auto a = avg_px.data();
+  auto nq = net_qty.data();
+  auto p = px.data();
+  auto r = m.data();
+  auto u = unrealized.data();
+  auto l = long_value.data();
+  auto s = short_value.data();
+  for (size_t i = 0; i < n; ++i) {
+    // a flat position without pnl and an unpriced one are left as they are
+    auto active = p[i] != 0 && (q[i] != 0 || u[i] != 0);
+    auto v = p[i] * r[i];
+    u[i] = active ? q[i] * (p[i] - a[i]) * r[i] : u[i];
+    l[i] = active ? std::max(nq[i], 0.) * v : l[i];
+    s[i] = active ? std::max(-nq[i], 0.) * v : s[i];
+  }
+}
+
+void PositionManager::PnlBook::Apply(PositionManager* self, PnlSecurity* x) {
+  for (auto& ref : x->refs) {
+    auto& pos = *ref.pos;
+    auto k = ref.slot;
+    pos.unrealized_pnl = unrealized[k];
+    if (ref.value) {
+      ref.value->long_value += long_value[k] - ref.long_value;
+      ref.value->short_value += short_value[k] - ref.short_value;
+    }
+    ref.long_value = long_value[k];
+    ref.short_value = short_value[k];
+    if (ref.rows) self->UpdateRow(ref.rows, x->sec->id, pos);
+    if (!ref.sub_account_id) continue;
+    if (pos.unrealized_pnl != ref.pnl.unrealized ||
+        pos.commission != ref.pnl.commission ||
+        pos.realized_pnl != ref.pnl.realized) {
+      self->pnl_pending_.push_back(PnlChange{
+          0,
+          ref.sub_account_id,
+          x->sec->id,
+          Pnl{pos.unrealized_pnl, pos.commission, pos.realized_pnl},
+      });
     }
+    auto& sum = self->pnl_sums_[ref.sub_account_id];
+    sum.unrealized += pos.unrealized_pnl - ref.pnl.unrealized;
+    sum.commission += pos.commission - ref.pnl.commission;
+    sum.realized += pos.realized_pnl - ref.pnl.realized;
+    ref.pnl.unrealized = pos.unrealized_pnl;
+    ref.pnl.commission = pos.commission;
+    ref.pnl.realized = pos.realized_pnl;
   }
-  for (auto& pair : *accs) {
-    auto x = balances[pair.first];
-    pair.second->position_value.long_value += x.first;
-    pair.second->position_value.short_value += x.second;
+}
+
+void PositionManager::UpdateRow(PositionRows* rows, Security::IdType sec_id,
+                                const Position& p) {
+  // the row clients take, total_outstanding_sell_qty twice as ever
+  auto str = json({sec_id, p.qty, p.avg_px, p.unrealized_pnl, p.commission,
+                   p.realized_pnl, p.total_bought_qty, p.total_sold_qty,
+                   p.total_outstanding_buy_qty, p.total_outstanding_sell_qty,
+                   p.total_outstanding_sell_qty})
+                 .dump();
+  std::lock_guard<std::mutex> lock(position_rows_m_);
+  auto& row = rows->rows[sec_id];
+  if (row.version && row.json == str) return;
+  row.json = std::move(str);
+  row.version = rows->version = ++position_rows_seq_;
+}
+
+uint64_t PositionManager::GetPositionRows(const PositionRowsMap& map,
+                                          AccountBase::IdType id,
+                                          uint64_t since, std::string* out) {
+  auto it = map.find(id);
+  if (it == map.end()) return 0;
+  std::lock_guard<std::mutex> lock(position_rows_m_);
+  auto& rows = it->second;
+  if (rows.version <= since) return rows.version;
+  for (auto& pair : rows.rows) {
+    if (pair.second.version <= since) continue;
+    *out += ',';
+    *out += pair.second.json;
   }
+  return rows.version;
 }
 
-void PositionManager::UpdatePnl() {
-  auto& am = AccountManager::Instance();
-  UpdateBalance(&sub_positions_, &am.sub_accounts_);
-  UpdateBalance(&broker_positions_, &am.broker_accounts_);
-  UpdateBalance(&user_positions_, &am.users_);
+void PositionManager::Revalue(size_t shard, bool all) {
+  auto& book = pnl_books_[shard];
+  std::lock_guard<std::mutex> lock(mutexes_[shard]);
+  pnl_dirty_.clear();
+#ifdef BACKTEST
+  all = true;
+#endif
+  for (auto x : book.secs) {
+    if (!x->dirty.exchange(false) && !all) continue;
+    book.Sync(x);
+    pnl_dirty_.push_back(x);
+  }
+  if (pnl_dirty_.empty()) return;
+  book.MarkToMarket();
+  for (auto x : pnl_dirty_) book.Apply(this, x);
+}
 
+// full recompute from all refs to catch drift of the incremental sums
+void PositionManager::CheckPnl() {
   std::unordered_map<SubAccount::IdType, Pnl> pnls;
-  for (auto& pair : sub_positions_) {
-    auto acc = pair.first.first;
-    auto& pos = pair.second;
-    auto& pnl = pnls[acc];
-    pnl.unrealized += pos.unrealized_pnl;
-    pnl.commission += pos.commission;
-    pnl.realized += pos.realized_pnl;
+  for (auto i = 0u; i < kShards; ++i) {
+    Revalue(i, true);
+    std::lock_guard<std::mutex> lock(mutexes_[i]);
+    for (auto x : pnl_books_[i].secs) {
+      for (auto& ref : x->refs) {
+        if (!ref.sub_account_id) continue;
+        auto& pnl = pnls[ref.sub_account_id];
+        pnl.unrealized += ref.pnl.unrealized;
+        pnl.commission += ref.pnl.commission;
+        pnl.realized += ref.pnl.realized;
+      }
+    }
+  }
+  auto diff = [](double a, double b) {
+    return std::abs(a - b) > 1e-6 * std::max(1., std::abs(b));
+  };
+  for (auto& pair : pnls) {
+    auto& a = pnl_sums_[pair.first];
+    auto& b = pair.second;
+    if (diff(a.unrealized, b.unrealized) || diff(a.commission, b.commission) ||
+        diff(a.realized, b.realized)) {
+      LOG_WARN("Pnl of sub account " << pair.first << " drifted, unrealized "
+                                     << a.unrealized << " vs "
+                                     << b.unrealized);
+    }
+    a = b;
+  }
+}
+
+#ifndef BACKTEST
+void PositionManager::StartPnl(int max_wait, double interval) {
+  if (interval <= 0) interval = 1;
+  pnl_check_every_ = std::max(1, static_cast<int>(60 / interval));
+  pnl_log_every_ = std::max(1, static_cast<int>(15 / interval));
+  auto deadline = GetTime() + max_wait;
+  auto started = std::make_shared<bool>(false);
+  kTimerTaskPool.RepeatTask(
+      [this, deadline, started]() {
+        if (!*started) {
+          auto n = 0;
+          for (auto& pair : pnl_secs_) {
+            auto& x = pair.second;
+            if (!x || !x->sec) continue;
+            // subscribes the ones not yet
+            if (MarketDataManager::Instance().Get(*x->sec).trade.close <= 0)
+              n++;
+          }
+          if (n && GetTime() < deadline) return;
+          if (n) LOG_WARN(n << " securities unpriced for the first pnl");
+          *started = true;
+        }
+        UpdatePnl();
+      },
+      boost::posix_time::seconds(0),
+      boost::posix_time::microseconds(
+          static_cast<int64_t>(interval * kMicroInSec)));
+}
+#endif
+
+void PositionManager::UpdatePnl() {
+  static int n = 0;
+  if (n % pnl_check_every_ == 0) {
+    CheckPnl();
+  } else {
+    for (auto i = 0u; i < kShards; ++i) Revalue(i, false);
   }
 
 #ifdef BACKTEST
+  pnl_pending_.clear();
   return;
 #endif
 
-  static int n = 0;
+  std::lock_guard<std::mutex> lock(pnl_log_m_);
+  for (auto& c : pnl_pending_) PublishPnl(c.sub_account_id, c.sec_id, c.pnl);
+  pnl_pending_.clear();
   auto tm = GetTime();
-  for (auto& pair : pnls) {
+  for (auto& pair : pnl_sums_) {
     auto& pnl0 = pnls_[pair.first];
     auto& of = pnl0.of;
     auto& pnl = pair.second;
+    if (pnl0.unrealized != pnl.unrealized || pnl0.realized != pnl.realized)
+      PublishPnl(pair.first, 0, pnl);
     static_cast<Pnl&>(pnl0) = pnl;
-    if (n % 15 == 0) {
+    if (n % pnl_log_every_ == 0) {
       static tbb::concurrent_unordered_map<SubAccount::IdType, Pnl> kPnls0;
       auto& pnl0 = kPnls0[pair.first];
       if (pnl0.unrealized != pnl.unrealized || pnl0.realized != pnl.realized) {
@@ -454,8 +823,37 @@ void PositionManager::UpdatePnl() {
     }
   }
   ++n;
+}
+
+// with pnl_log_m_ held
+void PositionManager::PublishPnl(SubAccount::IdType id,
+                                 Security::IdType sec_id, const Pnl& pnl) {
+  auto& log = pnl_logs_[id];
+  PnlChange c{++pnl_seq_, id, sec_id, pnl};
+  log.changes.push_back(c);
+  if (log.changes.size() > kMaxPnlLog) log.changes.pop_front();
+  log.latest[sec_id] = c;
+}
 
-  kTimerTaskPool.AddTask([this]() { this->UpdatePnl(); }, pt::seconds(1));
+void PositionManager::GetPnlChanges(
+    PnlSeqs* seqs, std::function<bool(SubAccount::IdType)> filter,
+    std::vector<PnlChange>* out) {
+  std::lock_guard<std::mutex> lock(pnl_log_m_);
+  for (auto& pair : pnl_logs_) {
+    auto& log = pair.second;
+    if (log.changes.empty()) continue;
+    auto& seq = (*seqs)[pair.first];
+    if (log.changes.back().seq <= seq || !filter(pair.first)) continue;
+    if (!seq || log.changes.front().seq > seq + 1) {
+      for (auto& pair2 : log.latest) out->push_back(pair2.second);
+    } else {
+      auto it = std::upper_bound(
+          log.changes.begin(), log.changes.end(), seq,
+          [](uint64_t seq, const PnlChange& c) { return seq < c.seq; });
+      out->insert(out->end(), it, log.changes.end());
+    }
+    seq = log.changes.back().seq;
+  }
 }
 
 }  // namespace opentrade
@@ -4,12 +4,22 @@
 #include <soci.h>
 #include <tbb/concurrent_unordered_map.h>
 #include <boost/unordered_map.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "account.h"
 #include "common.h"
+#include "market_data.h"
 #include "order.h"
+#include "position_history.h"
 #include "position_value.h"
 #include "security.h"
 
@@ -51,19 +61,40 @@ struct Bod {
 
 class PositionManager : public Singleton<PositionManager> {
  public:
-  static void Initialize();
+  // history_days, see PositionHistory::Load
+  static void Initialize(int history_days = 0);
   auto session() { return session_; }
+  // the next startup takes the BODs up to now from the database, see
+  // DayRoll, the session of this process stays
+  void RollSession();
+  const PositionHistory& history() const { return history_; }
   void Handle(Confirmation::Ptr cm, bool offline);
   const Position& Get(const SubAccount& acc, const Security& sec) {
-    return sub_positions_[std::make_pair(acc.id, sec.id)];
+    std::lock_guard<std::mutex> lock(mutex(sec));
+    return Touch(&sub_positions_, &acc, &sec, acc.id);
   }
   const Position& Get(const BrokerAccount& acc, const Security& sec) {
-    return broker_positions_[std::make_pair(acc.id, sec.id)];
+    std::lock_guard<std::mutex> lock(mutex(sec));
+    return Touch(&broker_positions_, &acc, &sec, 0);
   }
   const Position& Get(const User& user, const Security& sec) {
-    return user_positions_[std::make_pair(user.id, sec.id)];
+    std::lock_guard<std::mutex> lock(mutex(sec));
+    return Touch(&user_positions_, &user, &sec, 0);
+  }
+  // consistent copy, Get's reference is updated by the confirmations
+  Position Snapshot(const SubAccount& acc, const Security& sec) {
+    std::lock_guard<std::mutex> lock(mutex(sec));
+    return Touch(&sub_positions_, &acc, &sec, acc.id);
+  }
+  // caches the order's positions, so that its confirmations need no lookup
+  void Resolve(Order* ord) {
+    std::lock_guard<std::mutex> lock(mutex(*ord->sec));
+    ResolveLocked(ord);
   }
   void UpdatePnl();
+  // UpdatePnl every interval seconds on the timer thread, from once every
+  // security of the positions has a live price, or max_wait seconds at most
+  void StartPnl(int max_wait, double interval = 1);
   typedef tbb::concurrent_unordered_map<
       std::pair<SubAccount::IdType, Security::IdType>, Position>
       SubPositions;
@@ -83,9 +114,150 @@ class PositionManager : public Singleton<PositionManager> {
     double realized = 0;
   };
 
+  // pnl of a sub account's position, or of the account if sec_id is 0
+  struct PnlChange {
+    uint64_t seq;
+    SubAccount::IdType sub_account_id;
+    Security::IdType sec_id;
+    Pnl pnl;
+  };
+  typedef std::unordered_map<SubAccount::IdType, uint64_t> PnlSeqs;
+  // appends the changes after the seqs of the sub accounts passing filter
+  // and advances the seqs, a consumer new to or behind an account's log
+  // gets its latest pnls instead
+  void GetPnlChanges(PnlSeqs* seqs,
+                     std::function<bool(SubAccount::IdType)> filter,
+                     std::vector<PnlChange>* out);
+
+  // Appends the positions of the account changed after version since, 0 for
+  // all, as ",<row>" of the "positions" reply, and returns the account's
+  // version. The rows are serialized once a change, on the revalues of
+  // UpdatePnl, so a fill or a price shows within the pnl interval.
+  uint64_t GetPositionRows(const SubAccount& acc, uint64_t since,
+                           std::string* out) {
+    return GetPositionRows(sub_rows_, acc.id, since, out);
+  }
+  uint64_t GetPositionRows(const BrokerAccount& acc, uint64_t since,
+                           std::string* out) {
+    return GetPositionRows(broker_rows_, acc.id, since, out);
+  }
+
  private:
+  // the serialized positions of an account, each with the version of its
+  // last change, guarded by position_rows_m_
+  struct PositionRows {
+    struct Row {
+      uint64_t version = 0;
+      std::string json;
+    };
+    uint64_t version = 0;
+    std::unordered_map<Security::IdType, Row> rows;
+  };
+  typedef tbb::concurrent_unordered_map<AccountBase::IdType, PositionRows>
+      PositionRowsMap;
+  PositionRows* RowsOf(const SubAccount& acc) { return &sub_rows_[acc.id]; }
+  PositionRows* RowsOf(const BrokerAccount& acc) {
+    return &broker_rows_[acc.id];
+  }
+  PositionRows* RowsOf(const User&) { return nullptr; }
+  void UpdateRow(PositionRows* rows, Security::IdType sec_id,
+                 const Position& pos);
+  uint64_t GetPositionRows(const PositionRowsMap& map, AccountBase::IdType id,
+                           uint64_t since, std::string* out);
+  template <typename Map, typename Acc>
+  Position& Touch(Map* positions, const Acc* acc, const Security* sec,
+                  SubAccount::IdType sub_account_id);
+  void ResolveLocked(Order* ord) {
+    if (ord->sub_position) return;
+    ord->sub_position = &Touch(&sub_positions_, ord->sub_account, ord->sec,
+                               ord->sub_account->id);
+    ord->broker_position =
+        &Touch(&broker_positions_, ord->broker_account, ord->sec, 0);
+    ord->user_position = &Touch(&user_positions_, ord->user, ord->sec, 0);
+  }
+  // positions and pnl refs of one security are guarded by its shard
+  std::mutex& mutex(const Security& sec) { return mutexes_[sec.id % kShards]; }
+  void AddRef(const Security* sec, Position* pos, const AccountBase* acc,
+              SubAccount::IdType sub_account_id, PositionRows* rows);
+  void CheckPnl();
+  void PublishPnl(SubAccount::IdType id, Security::IdType sec_id,
+                  const Pnl& pnl);
+
+  // incremental pnl state of one held security, revalued when it has a
+  // trade tick or a fill, each ref remembers what it last contributed to
+  // the account aggregates so only deltas are applied
+  struct PnlSecurity : public TradeTickHook {
+    void OnTrade(DataSrc::IdType, Security::IdType, const MarketData*, time_t,
+                 double, double) noexcept override {
+      dirty = true;
+    }
+    struct Ref {
+      Position* pos;
+      AccountPositionValue* value;  // of the account, nullptr if unknown
+      SubAccount::IdType sub_account_id;  // 0 for broker and user position
+      uint32_t slot;  // in the PnlBook of the shard
+      PositionRows* rows;  // of the account, nullptr for user position
+      Pnl pnl;
+      double long_value = 0;
+      double short_value = 0;
+    };
+    const Security* sec = nullptr;
+    std::atomic<bool> dirty = true;
+    bool hooked = false;
+    std::vector<Ref> refs;
+  };
+
+  // The refs of the securities of a shard as a struct of arrays, the inputs
+  // of the dirty securities copied in from their positions, then all marked
+  // to market in one branch free loop the compiler vectorizes, and the
+  // results of the dirty ones applied back as deltas
+  struct PnlBook {
+    uint32_t Add() {
+      for (auto v : {&qty, &avg_px, &net_qty, &px, &m, &unrealized,
+                     &long_value, &short_value})
+        v->push_back(0);
+      return qty.size() - 1;
+    }
+    void Sync(PnlSecurity* x);
+    void MarkToMarket();
+    void Apply(PositionManager* self, PnlSecurity* x);
+    std::vector<PnlSecurity*> secs;
+    std::vector<double> qty;
+    std::vector<double> avg_px;
+    std::vector<double> net_qty;  // with the outstanding orders
+    std::vector<double> px;  // 0 if unpriced, kept as is
+    std::vector<double> m;  // rate * multiplier
+    std::vector<double> unrealized;
+    std::vector<double> long_value;
+    std::vector<double> short_value;
+  };
+  // marks the shard to market, all of it or only the dirty securities
+  void Revalue(size_t shard, bool all);
+
+ private:
+  // a fill's position row waiting for the database
+  struct PendingRow {
+    Position pos;
+    Confirmation::Ptr cm;
+  };
+  // queues the row for Flush on kDatabaseTaskPool, blocks while
+  // kMaxPendingRows are queued
+  void Persist(const Position& pos, Confirmation::Ptr cm);
+  void Flush();
+  void Insert(const PendingRow* rows, size_t n);
+  void InsertValues(const PendingRow* rows, size_t n);
+  void AddHistory(const PendingRow& row, int64_t id, time_t tm,
+                  std::string info);
+
+  static inline const size_t kMaxPendingRows = 1 << 16;
+  static inline const size_t kBatchRows = 1000;
   // holding the sql session exclusively for position update
   std::unique_ptr<soci::session> sql_;
+  std::vector<PendingRow> pending_rows_;
+  PositionHistory history_;
+  bool flush_scheduled_ = false;
+  std::mutex rows_m_;
+  std::condition_variable rows_cv_;
   boost::unordered_map<std::pair<SubAccount::IdType, Security::IdType>, Bod>
       bods_;
   SubPositions sub_positions_;
@@ -100,6 +272,29 @@ class PositionManager : public Singleton<PositionManager> {
     std::ofstream* of = nullptr;
   };
   tbb::concurrent_unordered_map<SubAccount::IdType, PnlFile> pnls_;
+  static inline const size_t kShards = 64;
+  std::mutex mutexes_[kShards];
+  tbb::concurrent_unordered_map<Security::IdType, std::unique_ptr<PnlSecurity>>
+      pnl_secs_;
+  PnlBook pnl_books_[kShards];  // guarded by the shard's mutex
+  std::vector<PnlSecurity*> pnl_dirty_;  // of the timer thread
+  int pnl_check_every_ = 60;  // UpdatePnl calls per CheckPnl
+  int pnl_log_every_ = 15;
+  // only touched on the timer thread
+  std::unordered_map<SubAccount::IdType, Pnl> pnl_sums_;
+  std::vector<PnlChange> pnl_pending_;
+  struct PnlLog {
+    std::deque<PnlChange> changes;
+    std::unordered_map<Security::IdType, PnlChange> latest;
+  };
+  static inline const size_t kMaxPnlLog = 4096;
+  std::mutex pnl_log_m_;
+  std::unordered_map<SubAccount::IdType, PnlLog> pnl_logs_;
+  uint64_t pnl_seq_ = 0;
+  std::mutex position_rows_m_;
+  PositionRowsMap sub_rows_;
+  PositionRowsMap broker_rows_;
+  uint64_t position_rows_seq_ = 0;
   std::string session_;
   friend class RiskMananger;
   friend class Connection;
@@ -0,0 +1,105 @@
+#include "position_history.h"
+
+#include <algorithm>
+
+#include "database.h"
+#include "logger.h"
+#include "sharding.h"
+
+namespace opentrade {
+
+static const char* kColumns =
+    "id, sub_account_id, security_id, qty, avg_px, realized_pnl, commission, "
+    "tm, info, broker_account_id";
+
+void PositionHistory::Load(int days) {
+  if (days <= 0) return;
+  // from the midnight (utc) days - 1 ago
+  auto from = time(nullptr) / kSecondsOneDay * kSecondsOneDay -
+              (days - 1) * kSecondsOneDay;
+  struct tm tm_info;
+  gmtime_r(&from, &tm_info);
+  char from_str[32];
+  strftime(from_str, sizeof(from_str), "%Y-%m-%d %H:%M:%S", &tm_info);
+  LOG_INFO("Loading position history since " << from_str << " UTC");
+  std::string last;
+  if (Database::is_sqlite()) {
+    last = R"(
+      select A.id, A.sub_account_id, A.security_id, qty, avg_px, realized_pnl,
+        commission, A.tm, info, broker_account_id
+      from position as A inner join
+        (select sub_account_id, security_id, max(tm) as tm from position
+         where tm < :tm group by sub_account_id, security_id) as B
+      on A.sub_account_id = B.sub_account_id and
+        A.security_id = B.security_id and A.tm = B.tm
+    )";
+  } else {
+    last = std::string("select distinct on (sub_account_id, security_id) ") +
+           kColumns +
+           " from position where tm < :tm"
+           " order by sub_account_id, security_id, tm desc";
+  }
+  auto since = std::string("select ") + kColumns +
+               " from position where tm >= :tm order by tm, id";
+  auto sql = Database::Session();
+  std::lock_guard<std::mutex> lock(m_);
+  auto& shards = ShardManager::Instance();
+  size_t n = 0;
+  for (auto& query : {last, since}) {
+    soci::rowset<soci::row> st =
+        (sql->prepare << query, soci::use(std::string(from_str)));
+    for (auto it = st.begin(); it != st.end(); ++it) {
+      PositionSnapshot s;
+      auto i = 0;
+      s.id = Database::GetValue(*it, i++, 0ll);
+      auto acc = Database::GetValue(*it, i++, 0);
+      s.sec = Database::GetValue(*it, i++, 0);
+      s.qty = Database::GetValue(*it, i++, 0.);
+      s.avg_px = Database::GetValue(*it, i++, 0.);
+      s.realized_pnl = Database::GetValue(*it, i++, 0.);
+      s.commission = Database::GetValue(*it, i++, 0.);
+      s.tm = Database::GetTm(*it, i++);
+      s.info = Database::GetValue(*it, i++, kEmptyStr);
+      s.broker_account_id = Database::GetValue(*it, i++, 0);
+      if (!shards.Owns(acc)) continue;
+      rows_[acc][s.sec].push_back(std::move(s));
+      n++;
+    }
+  }
+  from_ = from;
+  LOG_INFO(n << " position history rows loaded");
+}
+
+void PositionHistory::Add(SubAccount::IdType acc, PositionSnapshot s) {
+  std::lock_guard<std::mutex> lock(m_);
+  if (from_ == std::numeric_limits<time_t>::max()) return;
+  rows_[acc][s.sec].push_back(std::move(s));
+}
+
+bool PositionHistory::Get(SubAccount::IdType acc, const Security* sec,
+                          time_t tm, time_t end_time, Snapshots* out) const {
+  if (!ShardManager::Instance().Owns(acc)) return false;
+  std::lock_guard<std::mutex> lock(m_);
+  if (tm < from_) return false;
+  auto it = rows_.find(acc);
+  if (it == rows_.end()) return true;
+  auto scan = [&](const Snapshots& v) {
+    auto pos = std::lower_bound(
+        v.begin(), v.end(), tm,
+        [](const PositionSnapshot& s, time_t tm) { return s.tm < tm; });
+    if (end_time) {
+      for (; pos != v.end() && pos->tm < end_time; ++pos) out->push_back(*pos);
+    } else if (pos != v.begin()) {
+      out->push_back(*std::prev(pos));
+    }
+  };
+  if (sec) {
+    auto it2 = it->second.find(sec->id);
+    if (it2 != it->second.end()) scan(it2->second);
+  } else {
+    for (auto& pair : it->second) scan(pair.second);
+  }
+  return true;
+}
+
+}  // namespace opentrade
@@ -0,0 +1,56 @@
+#ifndef OPENTRADE_POSITION_HISTORY_H_
+#define OPENTRADE_POSITION_HISTORY_H_
+
+#include <ctime>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "account.h"
+#include "security.h"
+
+namespace opentrade {
+
+// A row of the position table
+struct PositionSnapshot {
+  int64_t id = 0;
+  time_t tm = 0;  // utc seconds, as Database::GetTm reads it back
+  Security::IdType sec = 0;
+  BrokerAccount::IdType broker_account_id = 0;
+  double qty = 0;
+  double avg_px = 0;
+  double realized_pnl = 0;
+  double commission = 0;
+  std::string info;
+};
+
+// The position rows of the sub accounts since some days ago in memory, with
+// the last row before that of every position, so that the trades view of
+// Connection reads the same rows as its SQL would for any time since then.
+// Appended to by PositionManager once the rows are in the database.
+class PositionHistory {
+ public:
+  typedef std::vector<PositionSnapshot> Snapshots;
+  // days <= 0 disables it
+  void Load(int days);
+  void Add(SubAccount::IdType acc, PositionSnapshot s);
+  // the rows with tm in [tm, end_time) if end_time, else the last row
+  // before tm of each security, only of sec if not null; false if tm is
+  // before what is held
+  bool Get(SubAccount::IdType acc, const Security* sec, time_t tm,
+           time_t end_time, Snapshots* out) const;
+
+ private:
+  mutable std::mutex m_;
+  time_t from_ = std::numeric_limits<time_t>::max();
+  // ascending tm per security
+  std::unordered_map<SubAccount::IdType,
+                     std::unordered_map<Security::IdType, Snapshots>>
+      rows_;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_POSITION_HISTORY_H_
@@ -1,17 +1,81 @@
 #ifndef OPENTRADE_POSITION_VALUE_H_
 #define OPENTRADE_POSITION_VALUE_H_
 
+#include <atomic>
 #include <cassert>
+#include <cmath>
+#include <cstdint>
 
 namespace opentrade {
 
-struct PositionValue {
-  double long_value = 0;
-  double short_value = 0;
-  double total_bought = 0;
-  double total_sold = 0;
-  double total_outstanding_buy = 0;
-  double total_outstanding_sell = 0;
+// double with lock-free +=, readers see a consistent value
+class AtomicDouble {
+ public:
+  AtomicDouble(double v = 0) : v_(v) {}
+  AtomicDouble(const AtomicDouble& b) : v_(b) {}
+  AtomicDouble& operator=(const AtomicDouble& b) { return *this = double(b); }
+  AtomicDouble& operator=(double v) {
+    v_.store(v, std::memory_order_relaxed);
+    return *this;
+  }
+  operator double() const { return v_.load(std::memory_order_relaxed); }
+  AtomicDouble& operator+=(double d) {
+    auto v = v_.load(std::memory_order_relaxed);
+    while (!v_.compare_exchange_weak(v, v + d, std::memory_order_relaxed)) {
+    }
+    return *this;
+  }
+  AtomicDouble& operator-=(double d) { return *this += -d; }
+
+ private:
+  std::atomic<double> v_;
+};
+
+// Fixed point value of 1/1024 resolution up to 9e15, += is one fetch_add
+// rather than a CAS loop, so contended writers never retry, and the value
+// subtracted at finish cancels the one added at new exactly. Adds release,
+// reads acquire, so a reader sees the adds of a writer in order.
+class AtomicValue {
+ public:
+  AtomicValue(double v = 0) : v_(ToFixed(v)) {}
+  AtomicValue(const AtomicValue& b)
+      : v_(b.v_.load(std::memory_order_acquire)) {}
+  AtomicValue& operator=(const AtomicValue& b) {
+    v_.store(b.v_.load(std::memory_order_acquire), std::memory_order_release);
+    return *this;
+  }
+  AtomicValue& operator=(double v) {
+    v_.store(ToFixed(v), std::memory_order_release);
+    return *this;
+  }
+  operator double() const {
+    return v_.load(std::memory_order_acquire) / kScale;
+  }
+  AtomicValue& operator+=(double d) {
+    v_.fetch_add(ToFixed(d), std::memory_order_release);
+    return *this;
+  }
+  AtomicValue& operator-=(double d) {
+    v_.fetch_sub(ToFixed(d), std::memory_order_release);
+    return *this;
+  }
+
+ private:
+  static inline const double kScale = 1024;
+  static int64_t ToFixed(double v) { return std::llround(v * kScale); }
+  std::atomic<int64_t> v_;
+};
+
+// T is double for Position, AtomicValue for the account aggregates which
+// are updated from confirmations of different securities concurrently
+template <typename T>
+struct PositionValueT {
+  T long_value = 0;
+  T short_value = 0;
+  T total_bought = 0;
+  T total_sold = 0;
+  T total_outstanding_buy = 0;
+  T total_outstanding_sell = 0;
 
   void HandleNew(bool is_buy, double qty, double price, double multiplier);
   void HandleTrade(bool is_buy, double qty, double price, double price0,
@@ -20,8 +84,17 @@ struct PositionValue {
                     double multiplier);
 };
 
-inline void PositionValue::HandleNew(bool is_buy, double qty, double price,
-                                     double multiplier) {
+typedef PositionValueT<double> PositionValue;
+
+// on a cache line of its own, apart from the throttles and the other fields
+// of its account, and from the other accounts' written on the same fills
+struct alignas(64) AccountPositionValue : public PositionValueT<AtomicValue> {
+};
+static_assert(sizeof(AccountPositionValue) == 64);
+
+template <typename T>
+inline void PositionValueT<T>::HandleNew(bool is_buy, double qty, double price,
+                                         double multiplier) {
   assert(qty > 0);
   auto value = qty * price * multiplier;
   if (is_buy) {
@@ -31,9 +104,11 @@ inline void PositionValue::HandleNew(bool is_buy, double qty, double price,
   }
 }
 
-inline void PositionValue::HandleTrade(bool is_buy, double qty, double price,
-                                       double price0, double multiplier,
-                                       bool is_bust, bool is_otc) {
+template <typename T>
+inline void PositionValueT<T>::HandleTrade(bool is_buy, double qty,
+                                           double price, double price0,
+                                           double multiplier, bool is_bust,
+                                           bool is_otc) {
   assert(qty > 0);
   if (!is_buy) qty = -qty;
   auto value = qty * price * multiplier;
@@ -41,12 +116,14 @@ inline void PositionValue::HandleTrade(bool is_buy, double qty, double price,
     // do nothing
   } else if (!is_bust) {
     auto value0 = qty * price0 * multiplier;
+    // traded before leaving the outstanding, a concurrent check may count
+    // the fill twice for a moment but never misses it
     if (value > 0) {
-      total_outstanding_buy -= value0;
       total_bought += value;
+      total_outstanding_buy -= value0;
     } else {
-      total_outstanding_sell -= -value0;
       total_sold += -value;
+      total_outstanding_sell -= -value0;
     }
   } else {
     if (value > 0) {
@@ -57,8 +134,9 @@ inline void PositionValue::HandleTrade(bool is_buy, double qty, double price,
   }
 }
 
-inline void PositionValue::HandleFinish(bool is_buy, double leaves_qty,
-                                        double price0, double multiplier) {
+template <typename T>
+inline void PositionValueT<T>::HandleFinish(bool is_buy, double leaves_qty,
+                                            double price0, double multiplier) {
   assert(leaves_qty);
   auto value = leaves_qty * price0 * multiplier;
   if (is_buy) {
@@ -2,30 +2,75 @@
 
 #include <Python.h>
 #include <boost/filesystem.hpp>
+#include <atomic>
+#include <ctime>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <thread>
+#include <unordered_map>
 
 #include "backtest.h"
 #include "bar_handler.h"
 #include "logger.h"
+#include "opentick.h"
 #include "server.h"
 
 namespace fs = boost::filesystem;
 
 namespace opentrade {
 
+// Serializes every call into the interpreter. Taken on each python callback,
+// the test token is swapped as a pointer rather than copied, and restored
+// per lock so that a nested lock does not leak its token to the outer one.
 struct LockGIL {
-  explicit LockGIL(const std::string &token = "") {
+  explicit LockGIL(const std::string &token = kNoToken) {
     m.lock();
-    test_token_saved = test_token;
-    test_token = token;
+    if (!depth_++) owner_ = std::this_thread::get_id();
+    saved_ = test_token_;
+    test_token_ = &token;
   }
   ~LockGIL() {
-    test_token = test_token_saved;
+    test_token_ = saved_;
+    if (!--depth_) owner_ = std::thread::id();
     m.unlock();
   }
+  static const std::string &test_token() { return *test_token_; }
   static inline std::recursive_mutex
       m;  // happens in calling Algo::Stop, to-do: will remove
-  static inline std::string test_token;
-  static inline std::string test_token_saved;
+
+ private:
+  friend struct UnlockGIL;
+  static inline const std::string kNoToken;
+  static inline const std::string *test_token_ = &kNoToken;
+  static inline int depth_ = 0;  // of the owner's nested locks
+  static inline std::atomic<std::thread::id> owner_;
+  const std::string *saved_;
+};
+
+// Releases the lock above however deeply the calling thread holds it, around
+// a C++ call that may block or take locks, so that the other python algos
+// run meanwhile; no python object is to be touched until it is destroyed.
+struct UnlockGIL {
+  UnlockGIL() {
+    if (LockGIL::owner_ != std::this_thread::get_id()) return;
+    depth_ = LockGIL::depth_;
+    token_ = LockGIL::test_token_;
+    LockGIL::depth_ = 0;
+    LockGIL::owner_ = std::thread::id();
+    for (auto i = 0; i < depth_; ++i) LockGIL::m.unlock();
+  }
+  ~UnlockGIL() {
+    if (!depth_) return;
+    for (auto i = 0; i < depth_; ++i) LockGIL::m.lock();
+    LockGIL::depth_ = depth_;
+    LockGIL::owner_ = std::this_thread::get_id();
+    LockGIL::test_token_ = token_;
+  }
+
+ private:
+  int depth_ = 0;
+  const std::string *token_ = nullptr;
 };
 
 static inline double GetDouble(const bp::object &obj) {
@@ -38,6 +83,136 @@ static inline double GetDouble(const bp::object &obj) {
   return 0;
 }
 
+// Rows of doubles packed into a bytearray for the securities in secs, one
+// C++ pass without a python object per field, e.g.
+//   np.frombuffer(buf, dtype=[(f, 'f8') for f in market_data_fields])
+static const char *kMarketDataFields[] = {
+    "sec_id", "tm",     "open",      "high",     "low",      "close",    "qty",
+    "vwap",   "volume", "bid_price", "bid_size", "ask_price", "ask_size"};
+static const char *kPositionFields[] = {"sec_id",
+                                        "qty",
+                                        "cx_qty",
+                                        "avg_px",
+                                        "unrealized_pnl",
+                                        "realized_pnl",
+                                        "commission",
+                                        "total_bought_qty",
+                                        "total_sold_qty",
+                                        "total_outstanding_buy_qty",
+                                        "total_outstanding_sell_qty"};
+
+template <size_t N>
+static bp::tuple FieldNames(const char *(&names)[N]) {
+  bp::list out;
+  for (auto name : names) out.append(name);
+  return bp::tuple(out);
+}
+
+template <size_t N, typename Fill>
+static bp::object PackRows(const std::vector<const Security *> &v, Fill fill) {
+  auto buf = PyByteArray_FromStringAndSize(nullptr, v.size() * N * 8);
+  if (!buf) bp::throw_error_already_set();
+  bp::object out{bp::handle<>(buf)};
+  auto p = reinterpret_cast<double *>(PyByteArray_AS_STRING(buf));
+  for (auto sec : v) {
+    std::fill(p, p + N, 0.);
+    if (sec) fill(*sec, p);
+    p += N;
+  }
+  return out;
+}
+
+template <size_t N, typename Fill>
+static bp::object PackRows(const bp::object &secs, Fill fill) {
+  std::vector<const Security *> v;
+  for (bp::stl_input_iterator<bp::object> it(secs), end; it != end; ++it) {
+    v.push_back(bp::extract<const Security *>(*it));
+  }
+  return PackRows<N>(v, fill);
+}
+
+// OpenTickBars held for python, exposing its columns through the buffer
+// protocol as a read only 2-d array of doubles, one row per column, e.g.
+//   np.asarray(bars)[OPEN]
+struct BarsWrapper {
+  explicit BarsWrapper(OpenTick::BarsPtr bars) : bars(bars) {
+    shape[0] = OpenTickBars::kColumns;
+    shape[1] = bars->size;
+    strides[0] = bars->size * sizeof(double);
+    strides[1] = sizeof(double);
+  }
+  OpenTick::BarsPtr bars;
+  Py_ssize_t shape[2];
+  Py_ssize_t strides[2];
+};
+
+#if PY_MAJOR_VERSION >= 3
+static int GetBarsBuffer(PyObject *self, Py_buffer *view, int flags) {
+  if (flags & PyBUF_WRITABLE) {
+    PyErr_SetString(PyExc_BufferError, "OpenTick bars are read only");
+    view->obj = nullptr;
+    return -1;
+  }
+  auto &w = bp::extract<BarsWrapper &>(self)();
+  view->obj = self;
+  Py_INCREF(self);
+  view->buf = const_cast<double *>(w.bars->data.data());
+  view->len = w.bars->data.size() * sizeof(double);
+  view->readonly = 1;
+  view->itemsize = sizeof(double);
+  view->format = (flags & PyBUF_FORMAT) ? const_cast<char *>("d") : nullptr;
+  view->ndim = 2;
+  view->shape = (flags & PyBUF_ND) ? w.shape : nullptr;
+  view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? w.strides
+                                                            : nullptr;
+  view->suboffsets = nullptr;
+  view->internal = nullptr;
+  return 0;
+}
+
+static PyBufferProcs kBarsBufferProcs = {GetBarsBuffer, nullptr};
+#endif
+
+static std::vector<Security::IdType> GetSecurityIds(const bp::object &secs) {
+  std::vector<Security::IdType> ids;
+  for (bp::stl_input_iterator<bp::object> it(secs), end; it != end; ++it) {
+    const Security *sec = bp::extract<const Security *>(*it);
+    if (sec) ids.push_back(sec->id);
+  }
+  return ids;
+}
+
+// one batch of pipelined OpenTick requests, done with the bars back once
+// all are, from any thread; the failed securities are logged and left out
+static void RequestBars(
+    const std::vector<Security::IdType> &ids, int interval, time_t start_time,
+    time_t end_time, const std::string &table,
+    std::function<void(std::vector<OpenTick::BarsPtr>)> done) {
+  struct Results {
+    std::mutex m;
+    std::vector<OpenTick::BarsPtr> bars;
+  };
+  auto results = std::make_shared<Results>();
+  OpenTick::Instance().RequestBatch(
+      ids, interval, start_time, end_time, table,
+      [results](Security::IdType sec, OpenTick::BarsPtr bars,
+                const std::string &err) {
+        if (err.size()) {
+          LOG_WARN("get_bars of " << sec << ": " << err);
+          return;
+        }
+        std::lock_guard<std::mutex> lock(results->m);
+        results->bars.push_back(bars);
+      },
+      [results, done]() { done(std::move(results->bars)); });
+}
+
+static bp::dict BarsDict(const std::vector<OpenTick::BarsPtr> &bars) {
+  bp::dict out;
+  for (auto &b : bars) out[b->sec] = BarsWrapper(b);
+  return out;
+}
+
 template <typename T>
 static inline bool GetValueScalar(const bp::object &value, T *out) {
   auto ptr = value.ptr();
@@ -119,10 +294,10 @@ typedef std::shared_ptr<Securities> SecuritiesPtr;
 typedef ContainerWrapper<SecuritiesPtr> SecuritiesWrapper;
 
 #define PUBLISH_TEST_MSG(type, msg)                        \
-  if (LockGIL::test_token.size()) {                        \
-    std::stringstream os;                                  \
-    os << type << " - " << msg;                            \
-    Server::PublishTestMsg(LockGIL::test_token, os.str()); \
+  if (LockGIL::test_token().size()) {                        \
+    std::stringstream os;                                    \
+    os << type << " - " << msg;                              \
+    Server::PublishTestMsg(LockGIL::test_token(), os.str()); \
   }
 #define LOG2_DEBUG(msg)           \
   PUBLISH_TEST_MSG("DEBUG", msg); \
@@ -219,6 +394,40 @@ BOOST_PYTHON_MODULE(opentrade) {
             }
             return out;
           })
+      // of all the securities traded by the account without secs
+      .def("get_positions",
+           +[](const SubAccount &acc, bp::object secs) {
+             const auto kN = std::size(kPositionFields);
+             std::vector<const Security *> v;
+             if (secs.is_none()) {
+               auto &sec_mngr = SecurityManager::Instance();
+               for (auto &pair : PositionManager::Instance().sub_positions()) {
+                 if (pair.first.first == acc.id)
+                   v.push_back(sec_mngr.Get(pair.first.second));
+               }
+             } else {
+               for (bp::stl_input_iterator<bp::object> it(secs), end;
+                    it != end; ++it) {
+                 v.push_back(bp::extract<const Security *>(*it));
+               }
+             }
+             return PackRows<kN>(v, [&acc](const Security &sec, double *p) {
+               auto pos = PositionManager::Instance().Snapshot(acc, sec);
+               double row[kN] = {static_cast<double>(sec.id),
+                                 pos.qty,
+                                 pos.cx_qty,
+                                 pos.avg_px,
+                                 pos.unrealized_pnl,
+                                 pos.realized_pnl,
+                                 pos.commission,
+                                 pos.total_bought_qty,
+                                 pos.total_sold_qty,
+                                 pos.total_outstanding_buy_qty,
+                                 pos.total_outstanding_sell_qty};
+               std::copy(row, row + kN, p);
+             });
+           },
+           (bp::arg("self"), bp::arg("secs") = bp::object()))
       .def_readonly("id", &SubAccount::id)
       .def_readonly("name", &SubAccount::name);
 
@@ -458,6 +667,45 @@ BOOST_PYTHON_MODULE(opentrade) {
         return ss.str();
       });
 
+  bp::class_<BarHistory::Stats>("BarStats", bp::no_init)
+      .def_readonly("n", &BarHistory::Stats::n)
+      .def_readonly("sum", &BarHistory::Stats::sum)
+      .def_readonly("sum2", &BarHistory::Stats::sum2)
+      .def_readonly("high", &BarHistory::Stats::high)
+      .def_readonly("low", &BarHistory::Stats::low)
+      .def_readonly("vwap", &BarHistory::Stats::vwap)
+      .def_readonly("volume", &BarHistory::Stats::volume)
+      .add_property("mean", &BarHistory::Stats::mean)
+      .add_property("variance", &BarHistory::Stats::variance);
+
+  bp::class_<BarHistory, boost::noncopyable>("BarHistory", bp::no_init)
+      .add_property("capacity", &BarHistory::capacity)
+      .add_property("stats", &BarHistory::stats)
+      .def("__len__", &BarHistory::size)
+      .def("__getitem__", +[](const BarHistory &h, size_t i) {
+        if (i >= h.size()) {
+          PyErr_SetString(PyExc_IndexError, "bar index out of range");
+          bp::throw_error_already_set();
+        }
+        return h.Get(i);
+      });
+
+  bp::object bars_class =
+      bp::class_<BarsWrapper>("OpenTickBars", bp::no_init)
+          .add_property("sec_id",
+                        +[](const BarsWrapper &w) { return w.bars->sec; })
+          .def("__len__", +[](const BarsWrapper &w) { return w.bars->size; });
+#if PY_MAJOR_VERSION >= 3
+  reinterpret_cast<PyTypeObject *>(bars_class.ptr())->tp_as_buffer =
+      &kBarsBufferProcs;
+#endif
+  bp::scope().attr("TIME") = static_cast<int>(OpenTickBars::kTime);
+  bp::scope().attr("OPEN") = static_cast<int>(OpenTickBars::kOpen);
+  bp::scope().attr("HIGH") = static_cast<int>(OpenTickBars::kHigh);
+  bp::scope().attr("LOW") = static_cast<int>(OpenTickBars::kLow);
+  bp::scope().attr("CLOSE") = static_cast<int>(OpenTickBars::kClose);
+  bp::scope().attr("VOLUME") = static_cast<int>(OpenTickBars::kVolume);
+
   bp::class_<MarketData>("MarketData", bp::no_init)
       .def_readonly("tm", &MarketData::tm)
       .add_property("open", +[](const MarketData &md) { return md.trade.open; })
@@ -489,9 +737,11 @@ BOOST_PYTHON_MODULE(opentrade) {
            +[](const MarketData &md, size_t i) {
              return md.depth[std::min(i, MarketData::kDepthSize - 1)].ask_size;
            })
-      .def("get_bid_size", +[](const MarketData &md, size_t i) {
-        return md.depth[std::min(i, MarketData::kDepthSize - 1)].bid_size;
-      });
+      .def("get_bid_size",
+           +[](const MarketData &md, size_t i) {
+             return md.depth[std::min(i, MarketData::kDepthSize - 1)].bid_size;
+           })
+      .def("snapshot", &MarketData::Snapshot);
 
   bp::class_<Confirmation>("Confirmation", bp::no_init)
       .def("__repr__",
@@ -511,9 +761,11 @@ BOOST_PYTHON_MODULE(opentrade) {
       .add_property("order", bp::make_function(
                                  +[](const Confirmation &c) { return c.order; },
                                  bp::return_internal_reference<>()))
-      .def_readonly("exec_id", &Confirmation::exec_id)
+      .add_property("exec_id",
+                    +[](const Confirmation &c) { return c.exec_id.str(); })
       .def_readonly("transaction_time", &Confirmation::transaction_time)
-      .def_readonly("order_id", &Confirmation::order_id)
+      .add_property("order_id",
+                    +[](const Confirmation &c) { return c.order_id.str(); })
       .def_readonly("text", &Confirmation::text)
       .def_readonly("exec_type", &Confirmation::exec_type)
       .def_readonly("exec_trans_type", &Confirmation::exec_trans_type)
@@ -552,6 +804,7 @@ BOOST_PYTHON_MODULE(opentrade) {
       .def_readonly("id", &Order::id)
       .def_readonly("tm", &Order::tm)
       .def_readonly("orig_id", &Order::orig_id)
+      .def_readonly("replace_id", &Order::replace_id)
       .def_readonly("avg_px", &Order::avg_px)
       .def_readonly("cum_qty", &Order::cum_qty)
       .def_readonly("leaves_qty", &Order::leaves_qty)
@@ -585,7 +838,14 @@ BOOST_PYTHON_MODULE(opentrade) {
       .add_property("cum_qty", &Instrument::cum_qty)
       .add_property("cum_cx_qty", &Instrument::cum_cx_qty)
       .add_property("id", &Instrument::id)
+      .add_property("lag", &Instrument::lag)
       .def("unlisten", &Instrument::UnListen)
+      .def("set_interest", &Instrument::SetInterest,
+           (bp::arg("self"), bp::arg("mask"), bp::arg("min_ticks") = 0.))
+      .add_property("interest", &Instrument::interest)
+      .def("set_depth_levels", &Instrument::SetDepthLevels)
+      .add_property("depth_levels", &Instrument::depth_levels)
+      .add_property("changed_levels", &Instrument::changed_levels)
       .def("subscribe", &Instrument::SubscribeByName,
            (bp::arg("self"), bp::arg("indicator_name"),
             bp::arg("listen") = false))
@@ -598,21 +858,62 @@ BOOST_PYTHON_MODULE(opentrade) {
       .add_property("active_orders", +[](const Instrument &inst) {
         return OrdersWrapper(&inst.active_orders());
       });
+  bp::scope().attr("INTEREST_TRADE") =
+      static_cast<int>(Instrument::kInterestTrade);
+  bp::scope().attr("INTEREST_L1_PRICE") =
+      static_cast<int>(Instrument::kInterestL1Price);
+  bp::scope().attr("INTEREST_L1_SIZE") =
+      static_cast<int>(Instrument::kInterestL1Size);
+  bp::scope().attr("INTEREST_DEPTH") =
+      static_cast<int>(Instrument::kInterestDepth);
+  bp::scope().attr("INTEREST_ALL") = static_cast<int>(Instrument::kInterestAll);
 
   bp::class_<Python>("Algo", bp::no_init)
-      .def("subscribe", &Python::Subscribe,
+      // the calls into the engine release the interpreter lock
+      .def("subscribe",
+           +[](Python &algo, const Security &sec, DataSrc src, bool listen) {
+             UnlockGIL unlock;
+             return algo.Subscribe(sec, src, listen);
+           },
            (bp::arg("self"), bp::arg("sec"), bp::arg("src") = DataSrc{},
             bp::arg("listen") = true),
            bp::return_internal_reference<>())
-      .def("place", &Python::Place, bp::return_internal_reference<>())
+      .def("place",
+           +[](Python &algo, const Contract &contract, Instrument *inst) {
+             UnlockGIL unlock;
+             return algo.Place(contract, inst);
+           },
+           bp::return_internal_reference<>())
       .def("cancel",
            +[](Python &algo, const Order *ord) {
+             UnlockGIL unlock;
              if (ord) return algo.Cancel(*ord);
              return false;
            })
-      .def("stop", &Python::Stop)
-      .def("cross", &Python::Cross)
+      .def("replace",
+           +[](Python &algo, const Order *ord, double qty, double price) {
+             UnlockGIL unlock;
+             if (ord) return algo.Replace(*ord, qty, price);
+             return false;
+           })
+      .def("stop",
+           +[](Python &algo) {
+             UnlockGIL unlock;
+             algo.Stop();
+           })
+      .def("cross",
+           +[](Python &algo, double qty, double price, OrderSide side,
+               const SubAccount *acc, Instrument *inst) {
+             UnlockGIL unlock;
+             algo.Cross(qty, price, side, acc, inst);
+           })
+      .def("request_bars", &Python::RequestBars,
+           (bp::arg("self"), bp::arg("secs"), bp::arg("interval"),
+            bp::arg("start_time"), bp::arg("end_time"), bp::arg("callback"),
+            bp::arg("table") = "bar"))
       .def("set_timeout", &Python::SetTimeout)
+      .def("cancel_timeout", &Python::CancelTimeout)
+      .def("set_status", &Algo::SetStatus)
       .add_property("user",
                     bp::make_function(+[](Algo &algo) { return &algo.user(); },
                                       bp::return_internal_reference<>()))
@@ -701,6 +1002,57 @@ BOOST_PYTHON_MODULE(opentrade) {
                                static_cast<double>(kMicroInSec));
   });
 
+  bp::scope().attr("market_data_fields") = FieldNames(kMarketDataFields);
+  bp::scope().attr("position_fields") = FieldNames(kPositionFields);
+  bp::def(
+      "get_market_data",
+      +[](bp::object secs, DataSrc src) {
+        const auto kN = std::size(kMarketDataFields);
+        return PackRows<kN>(secs, [src](const Security &sec, double *p) {
+          auto md = MarketDataManager::Instance().Get(sec, src).Snapshot();
+          auto &q = md.quote();
+          double row[kN] = {static_cast<double>(sec.id),
+                            static_cast<double>(md.tm),
+                            md.trade.open,
+                            md.trade.high,
+                            md.trade.low,
+                            md.trade.close,
+                            static_cast<double>(md.trade.qty),
+                            md.trade.vwap,
+                            static_cast<double>(md.trade.volume),
+                            q.bid_price,
+                            static_cast<double>(q.bid_size),
+                            q.ask_price,
+                            static_cast<double>(q.ask_size)};
+          std::copy(row, row + kN, p);
+        });
+      },
+      (bp::arg("secs"), bp::arg("src") = DataSrc{}));
+
+  // {sec_id: OpenTickBars} of [start_time, end_time), one batch of
+  // pipelined OpenTick requests, blocking until all are back with the other
+  // algos free to run; the failed securities are logged and left out
+  bp::def(
+      "get_bars",
+      +[](bp::object secs, int interval, time_t start_time, time_t end_time,
+          const std::string &table) {
+        auto ids = GetSecurityIds(secs);
+        std::vector<OpenTick::BarsPtr> results;
+        {
+          UnlockGIL unlock;
+          std::promise<void> done;
+          RequestBars(ids, interval, start_time, end_time, table,
+                      [&results, &done](std::vector<OpenTick::BarsPtr> v) {
+                        results = std::move(v);
+                        done.set_value();
+                      });
+          done.get_future().wait();
+        }
+        return BarsDict(results);
+      },
+      (bp::arg("secs"), bp::arg("interval"), bp::arg("start_time"),
+       bp::arg("end_time"), bp::arg("table") = "bar"));
+
   bp::def("get_exchanges", +[]() {
     bp::list out;
     for (auto &pair : SecurityManager::Instance().exchanges()) {
@@ -721,7 +1073,7 @@ BOOST_PYTHON_MODULE(opentrade) {
            +[](Backtest &, bp::object func, bp::object seconds_obj) {
              auto seconds = GetDouble(seconds_obj);
              if (seconds < 0) seconds = 0;
-             kTimers.emplace(kTime + seconds * kMicroInSec, [func]() {
+             kTimers.Push(kTime + seconds * kMicroInSec, [func]() {
                try {
                  func();
                } catch (const bp::error_already_set &err) {
@@ -735,6 +1087,10 @@ BOOST_PYTHON_MODULE(opentrade) {
            }))
       .add_property("start_date", &Backtest::start_date)
       .add_property("end_date", &Backtest::end_date)
+      // index of the forked worker, -1 if not sharded
+      .add_property("shard", &Backtest::shard)
+      // configuration of this sweep worker, None if not sweeping
+      .add_property("config", &Backtest::config)
       .add_property("user", bp::make_function(
                                 +[](Backtest &) {
                                   return AccountManager::Instance().GetUser(0);
@@ -765,6 +1121,9 @@ BOOST_PYTHON_MODULE(opentrade) {
            bp::make_function(+[](Backtest &, Algo::IdType id, bp::dict params) {
              AlgoManager::Instance().Modify(id, ParseParams(params));
            }));
+  // columns of the data of on_confirmation_batch
+  bp::scope().attr("confirmation_fields") =
+      FieldNames(Backtest::ConfirmationBatch::kFields);
 #endif
 }
 
@@ -838,14 +1197,56 @@ void InitalizePy() {
   LOG2_INFO("Python initialized");
 }
 
-PyModule LoadPyModule(const std::string &module_name) {
-  bp::object m;
-  try {
-    m = bp::import(module_name.c_str());
-  } catch (const bp::error_already_set &err) {
-    PrintPyError("load python");
-    return {};
+// Code objects of the algo files run by tests, compiled again only once the
+// file changes, each test running one in a module of its own. Guarded by
+// LockGIL.
+class CodeCache {
+ public:
+  static CodeCache &Instance() {
+    static CodeCache kInstance;
+    return kInstance;
   }
+
+  // a new module of the code of fn named module_name, not kept in
+  // sys.modules, throws bp::error_already_set
+  bp::object Exec(const std::string &module_name, const fs::path &fn) {
+    auto mtime = fs::last_write_time(fn);
+    auto size = fs::file_size(fn);
+    auto &e = entries_[fn.string()];
+    if (!e.code || e.mtime != mtime || e.size != size) {
+      std::ifstream is(fn.string());
+      std::string src((std::istreambuf_iterator<char>(is)),
+                      std::istreambuf_iterator<char>());
+      e.code = bp::object();
+      auto code = Py_CompileString(src.c_str(), fn.string().c_str(),
+                                   Py_file_input);
+      if (!code) bp::throw_error_already_set();
+      e.code = bp::object(bp::handle<>(code));
+      e.mtime = mtime;
+      e.size = size;
+      LOG2_DEBUG(fn.string() << " compiled");
+    }
+    auto m = PyImport_ExecCodeModuleEx(const_cast<char *>(module_name.c_str()),
+                                       e.code.ptr(),
+                                       const_cast<char *>(fn.string().c_str()));
+    auto modules = PyImport_GetModuleDict();
+    if (PyDict_GetItemString(modules, module_name.c_str()))
+      PyDict_DelItemString(modules, module_name.c_str());
+    if (!m) bp::throw_error_already_set();
+    return bp::object(bp::handle<>(m));
+  }
+
+ private:
+  struct Entry {
+    std::time_t mtime = 0;
+    uintmax_t size = 0;
+    bp::object code;
+  };
+  std::unordered_map<std::string, Entry> entries_;
+};
+
+static PyModule GetPyModule(const bp::object &m,
+                            const std::string &module_name) {
   LOG2_INFO(module_name + " loaded");
   auto func = GetCallable(m, "get_param_defs");
   if (!func.ptr()) {
@@ -860,11 +1261,23 @@ PyModule LoadPyModule(const std::string &module_name) {
   out.on_stop = GetCallable(m, "on_stop");
   out.on_market_trade = GetCallable(m, "on_market_trade");
   out.on_market_quote = GetCallable(m, "on_market_quote");
+  out.on_market_batch = GetCallable(m, "on_market_batch");
   out.on_confirmation = GetCallable(m, "on_confirmation");
   out.on_indicator = GetCallable(m, "on_indicator");
   return out;
 }
 
+PyModule LoadPyModule(const std::string &module_name) {
+  bp::object m;
+  try {
+    m = bp::import(module_name.c_str());
+  } catch (const bp::error_already_set &err) {
+    PrintPyError("load python");
+    return {};
+  }
+  return GetPyModule(m, module_name);
+}
+
 static inline bool ParseParamDef(const bp::object &item, ParamDef *out) {
   // (name, default_value, required, min_value, max_value, precision)
   ParamDef::ValueVector value_vector;
@@ -948,14 +1361,14 @@ static bp::dict CreateParamsDict(const Algo::ParamMap &params) {
 }
 
 Python *Python::LoadModule(const std::string &module_name) {
-  auto p = new Python;
-  auto m = LoadPyModule(module_name);
+  return Create(LoadPyModule(module_name));
+}
+
+Python *Python::Create(const PyModule &m) {
   if (!m.get_param_defs) return nullptr;
   auto def = ParseParamDefs(m.get_param_defs);
-  if (def.empty()) {
-    delete p;
-    return nullptr;
-  }
+  if (def.empty()) return nullptr;
+  auto p = new Python;
   p->py_ = m;
   p->def_ = std::move(def);
   return p;
@@ -981,17 +1394,14 @@ Python *Python::LoadTest(const std::string &module_name,
   LOG2_DEBUG("test token " << token);
   auto fn = kAlgoPath / (module_name + ".py");
   auto module_name2 = "_" + module_name + "_" + token;
-  auto fn2 = kAlgoPath / (module_name2 + ".py");
+  Python *p = nullptr;
   try {
-    fs::copy_file(fn, fn2, fs::copy_option::overwrite_if_exists);
+    auto m = CodeCache::Instance().Exec(module_name2, fn);
+    p = Create(GetPyModule(m, module_name2));
   } catch (const fs::filesystem_error &err) {
     LOG2_ERROR(err.what());
-    return nullptr;
-  }
-  auto p = LoadModule(module_name2);
-  try {
-    fs::remove(fn2);
-  } catch (const fs::filesystem_error &err) {
+  } catch (const bp::error_already_set &err) {
+    PrintPyError("load python");
   }
   if (p) {
     p->set_name(module_name);
@@ -1003,8 +1413,8 @@ Python *Python::LoadTest(const std::string &module_name,
   return p;
 }
 
-void Python::SetTimeout(bp::object func, double seconds) {
-  Algo::SetTimeout(
+TimerId Python::SetTimeout(bp::object func, double seconds) {
+  return Algo::SetTimeout(
       [this, func]() {
         LOCK();
         try {
@@ -1016,6 +1426,39 @@ void Python::SetTimeout(bp::object func, double seconds) {
       seconds);
 }
 
+void Python::RequestBars(bp::object secs, int interval, time_t start_time,
+                         time_t end_time, bp::object callback,
+                         const std::string &table) {
+  auto ids = GetSecurityIds(secs);
+  // referenced and released with the lock held only
+  auto cb = new bp::object(callback);
+  auto deliver = [this, cb](std::vector<OpenTick::BarsPtr> bars) {
+    Async([this, cb, bars = std::move(bars)]() {
+      LOCK();
+      try {
+        if (is_active()) (*cb)(BarsDict(bars));
+      } catch (const bp::error_already_set &err) {
+        PrintPyError("request_bars");
+      }
+      delete cb;
+    });
+  };
+#ifdef BACKTEST
+  // the timers are not thread safe, the bars are taken at once
+  std::vector<OpenTick::BarsPtr> results;
+  std::promise<void> done;
+  ::opentrade::RequestBars(ids, interval, start_time, end_time, table,
+                           [&results, &done](std::vector<OpenTick::BarsPtr> v) {
+                             results = std::move(v);
+                             done.set_value();
+                           });
+  done.get_future().wait();
+  deliver(std::move(results));
+#else
+  ::opentrade::RequestBars(ids, interval, start_time, end_time, table, deliver);
+#endif
+}
+
 std::string Python::Test() noexcept {
   LOCK();
   if (!py_.test) {
@@ -1083,6 +1526,9 @@ void Python::OnStop() noexcept {
 
 void Python::OnMarketTrade(const Instrument &inst, const MarketData &md,
                            const MarketData &md0) noexcept {
+  if (py_.on_market_batch) {
+    return MarkBatch(inst, md, MarketData::kTradeChanged);
+  }
   if (!py_.on_market_trade) return;
   LOCK();
   try {
@@ -1094,6 +1540,9 @@ void Python::OnMarketTrade(const Instrument &inst, const MarketData &md,
 
 void Python::OnMarketQuote(const Instrument &inst, const MarketData &md,
                            const MarketData &md0) noexcept {
+  if (py_.on_market_batch) {
+    return MarkBatch(inst, md, MarketData::kQuoteChanged);
+  }
   if (!py_.on_market_quote) return;
   LOCK();
   try {
@@ -1103,6 +1552,73 @@ void Python::OnMarketQuote(const Instrument &inst, const MarketData &md,
   }
 }
 
+// fills the row from the runner's copy of md, no python involved except
+// for the first update of an instrument
+void Python::MarkBatch(const Instrument &inst, const MarketData &md,
+                       uint32_t changes) {
+  auto &b = batch_;
+  auto it = b.slots.find(&inst);
+  if (it == b.slots.end()) {
+    LOCK();
+    try {
+      if (b.instruments.is_none()) b.instruments = bp::list();
+      b.instruments.attr("append")(bp::ptr(&inst));
+    } catch (const bp::error_already_set &err) {
+      PrintPyError("on_market_batch");
+      return;
+    }
+    it = b.slots.emplace(&inst, b.rows.size()).first;
+    b.rows.push_back(-1);
+  }
+  auto slot = it->second;
+  auto &row = b.rows[slot];
+  if (row < 0) {
+    if (!b.n) DeferBatch();
+    row = b.n++;
+    if (b.data.size() < b.n * Batch::kColumns)
+      b.data.resize(b.n * Batch::kColumns);
+    b.data[row * Batch::kColumns + Batch::kChanges] = 0;
+  }
+  auto p = &b.data[row * Batch::kColumns];
+  auto &q = md.quote();
+  p[Batch::kSlot] = slot;
+  p[Batch::kSecurityId] = inst.sec().id;
+  p[Batch::kChanges] = static_cast<uint32_t>(p[Batch::kChanges]) | changes;
+  p[Batch::kBidPrice] = q.bid_price;
+  p[Batch::kBidSize] = q.bid_size;
+  p[Batch::kAskPrice] = q.ask_price;
+  p[Batch::kAskSize] = q.ask_size;
+  p[Batch::kLastPrice] = md.trade.close;
+  p[Batch::kVolume] = md.trade.volume;
+}
+
+void Python::OnMarketBatch() noexcept {
+  auto &b = batch_;
+  if (!b.n) return;
+  auto n = b.n;
+  b.n = 0;
+  for (auto i = 0u; i < n; ++i) {
+    b.rows[static_cast<uint32_t>(b.data[i * Batch::kColumns])] = -1;
+  }
+  b.shape[0] = n;
+  Py_buffer view{};
+  view.buf = b.data.data();
+  view.len = n * Batch::kColumns * sizeof(double);
+  view.itemsize = sizeof(double);
+  view.readonly = 1;
+  view.ndim = 2;
+  view.format = const_cast<char *>("d");
+  view.shape = b.shape;
+  view.strides = b.strides;
+  LOCK();
+  try {
+    bp::object data(bp::handle<>(PyMemoryView_FromBuffer(&view)));
+    py_.on_market_batch(obj_, data, b.instruments);
+  } catch (const bp::error_already_set &err) {
+    PrintPyError("on_market_batch");
+  }
+}
+
 void Python::OnConfirmation(const Confirmation &cm) noexcept {
   if (!py_.on_confirmation) return;
   LOCK();
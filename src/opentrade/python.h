@@ -16,6 +16,7 @@ struct PyModule {
   bp::object on_stop;
   bp::object on_market_trade;
   bp::object on_market_quote;
+  bp::object on_market_batch;
   bp::object on_indicator;
   bp::object on_confirmation;
   bp::object test;
@@ -40,7 +41,13 @@ class Python : public Algo {
   const ParamDefs& GetParamDefs() noexcept override;
   void OnIndicator(Indicator::IdType id,
                    const Instrument& inst) noexcept override;
-  void SetTimeout(bp::object func, double seconds);
+  void OnMarketBatch() noexcept override;
+  TimerId SetTimeout(bp::object func, double seconds);
+  // get_bars without blocking, callback(bars) on the algo's strand once all
+  // are back
+  void RequestBars(bp::object secs, int interval, time_t start_time,
+                   time_t end_time, bp::object callback,
+                   const std::string& table);
 
   Instrument* Subscribe(const Security& sec, DataSrc src, bool listen) {
     return Algo::Subscribe(sec, src, listen);
@@ -55,10 +62,41 @@ class Python : public Algo {
   }
 
  private:
+  // Rows of the instruments updated during one runner cycle, handed to
+  // on_market_batch(self, data, instruments) as a read only memoryview of
+  // doubles shaped (n, kColumns), valid only within the callback.
+  // instruments is indexed by the slot column.
+  struct Batch {
+    enum Column {
+      kSlot,
+      kSecurityId,
+      kChanges,  // MarketData::kTradeChanged | kQuoteChanged
+      kBidPrice,
+      kBidSize,
+      kAskPrice,
+      kAskSize,
+      kLastPrice,
+      kVolume,
+      kColumns,
+    };
+    std::unordered_map<const Instrument*, uint32_t> slots;
+    std::vector<int32_t> rows;  // slot -> row in data, -1 if not updated
+    std::vector<double> data;
+    uint32_t n = 0;
+    bp::object instruments;
+    Py_ssize_t shape[2] = {0, kColumns};
+    Py_ssize_t strides[2] = {kColumns * sizeof(double), sizeof(double)};
+  };
+  void MarkBatch(const Instrument& inst, const MarketData& md,
+                 uint32_t changes);
+
+  static Python* Create(const PyModule& m);
+
   PyModule py_;
   ParamDefs def_;
   bp::object obj_;
   std::string test_token_;
+  Batch batch_;
 };
 
 void InitalizePy();
@@ -0,0 +1,181 @@
+#ifndef OPENTRADE_RCU_H_
+#define OPENTRADE_RCU_H_
+
+#include <boost/shared_ptr.hpp>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "utility.h"
+
+namespace opentrade {
+
+// Epoch based RCU for the read mostly, admin mutable config on the order
+// path. A reader announces the global epoch of its thread on entering and
+// clears it on leaving, a store and a load, never waiting. A writer swaps
+// the pointer, then retires the old object with a newer epoch; it is freed
+// once no reader is still inside an older one.
+class Rcu {
+ public:
+  // read side critical section, nestable, see RcuSnapshot
+  static void Enter() {
+    auto& t = kThread;
+    if (t.depth++) return;
+    // seq_cst so that the pointer loaded after it can't be seen before it
+    t.slot->epoch.store(kEpoch.load(std::memory_order_acquire),
+                        std::memory_order_seq_cst);
+  }
+
+  static void Leave() {
+    auto& t = kThread;
+    if (--t.depth) return;
+    t.slot->epoch.store(0, std::memory_order_release);
+  }
+
+  // func runs once the readers possibly seeing the replaced object are gone,
+  // call after the swap
+  static void Retire(std::function<void()> func) {
+    {
+      std::lock_guard<std::mutex> lock(kMutex);
+      auto epoch = kEpoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+      kRetired.push_back(Retired{epoch, std::move(func)});
+    }
+    Reclaim();
+  }
+
+  // frees what is safe, the rest waits for the next Retire or Reclaim;
+  // returns the number still pending
+  static size_t Reclaim() {
+    std::vector<std::function<void()>> ready;
+    size_t n;
+    {
+      std::lock_guard<std::mutex> lock(kMutex);
+      auto min = UINT64_MAX;
+      for (auto s = kSlots.load(std::memory_order_acquire); s; s = s->next) {
+        auto e = s->epoch.load(std::memory_order_seq_cst);
+        if (e && e < min) min = e;
+      }
+      while (!kRetired.empty() && kRetired.front().epoch <= min) {
+        ready.push_back(std::move(kRetired.front().func));
+        kRetired.pop_front();
+      }
+      n = kRetired.size();
+    }
+    for (auto& f : ready) f();
+    return n;
+  }
+
+  // serializes the writers of RcuPtr
+  static std::mutex& write_mutex() { return kWriteMutex; }
+
+ private:
+  struct Slot {
+    std::atomic<uint64_t> epoch = 0;  // 0 if not reading
+    std::atomic<bool> used = false;
+    Slot* next = nullptr;
+  };
+  // slots are reused by later threads, never freed
+  struct Thread {
+    Thread() {
+      for (auto s = kSlots.load(std::memory_order_acquire); s; s = s->next) {
+        auto used = false;
+        if (s->used.compare_exchange_strong(used, true)) {
+          slot = s;
+          return;
+        }
+      }
+      slot = new Slot;
+      slot->used = true;
+      slot->next = kSlots.load(std::memory_order_relaxed);
+      while (!kSlots.compare_exchange_weak(slot->next, slot)) {
+      }
+    }
+    ~Thread() {
+      slot->epoch.store(0, std::memory_order_release);
+      slot->used.store(false, std::memory_order_release);
+    }
+    Slot* slot = nullptr;
+    uint32_t depth = 0;
+  };
+  struct Retired {
+    uint64_t epoch;
+    std::function<void()> func;
+  };
+  static inline thread_local Thread kThread;
+  static inline std::atomic<uint64_t> kEpoch = 1;
+  static inline std::atomic<Slot*> kSlots = nullptr;
+  static inline std::mutex kMutex;
+  static inline std::deque<Retired> kRetired;
+  static inline std::mutex kWriteMutex;
+};
+
+// A pointer read inside a read side critical section, keep it on the stack
+// of the reading thread only and not for long, it delays reclamation
+template <typename T>
+class RcuSnapshot {
+ public:
+  explicit RcuSnapshot(const std::atomic<const T*>& p) {
+    Rcu::Enter();
+    p_ = p.load(std::memory_order_seq_cst);
+  }
+  RcuSnapshot(const RcuSnapshot& b) : p_(b.p_) { Rcu::Enter(); }
+  RcuSnapshot& operator=(const RcuSnapshot& b) {
+    p_ = b.p_;
+    return *this;
+  }
+  ~RcuSnapshot() { Rcu::Leave(); }
+  const T* get() const { return p_; }
+  const T* operator->() const { return p_; }
+  const T& operator*() const { return *p_; }
+  explicit operator bool() const { return p_; }
+
+ private:
+  const T* p_;
+};
+
+// Wait-free reads and deferred reclamation of an immutable object replaced
+// as a whole, stores take ownership of a shared_ptr to keep the writers'
+// copy-and-swap code unchanged
+template <typename T>
+class RcuPtr {
+ public:
+  typedef boost::shared_ptr<const T> Ptr;
+  explicit RcuPtr(Ptr p = {}) : owner_(std::move(p)), p_(owner_.get()) {}
+  RcuPtr(const RcuPtr&) = delete;
+  RcuPtr& operator=(const RcuPtr&) = delete;
+
+  RcuSnapshot<T> load() const { return RcuSnapshot<T>(p_); }
+  // bumped after every store, to tell a replaced object from a new one at
+  // the same address; read it before load
+  uint64_t version() const { return version_.load(std::memory_order_acquire); }
+
+  void store(Ptr p) {
+    Ptr old;
+    {
+      std::lock_guard<std::mutex> lock(Rcu::write_mutex());
+      old = std::move(owner_);
+      owner_ = std::move(p);
+      p_.store(owner_.get(), std::memory_order_seq_cst);
+      version_.fetch_add(1, std::memory_order_release);
+    }
+    if (old) Rcu::Retire([old]() {});
+  }
+
+ private:
+  Ptr owner_;
+  std::atomic<const T*> p_;
+  std::atomic<uint64_t> version_ = 0;
+};
+
+template <typename V>
+const typename V::mapped_type& FindInMap(const RcuSnapshot<V>& map,
+                                         const typename V::key_type& key) {
+  return FindInMap(*map, key);
+}
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_RCU_H_
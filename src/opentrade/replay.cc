@@ -0,0 +1,177 @@
+#ifdef BACKTEST
+#include "replay.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#include "journal.h"
+#include "logger.h"
+
+namespace fs = boost::filesystem;
+
+namespace opentrade {
+
+// see GlobalOrderBook::Write, [u32 seq][sub account id][exec type][body]['\0']
+static const size_t kRecordHeader = 4 + sizeof(SubAccount::IdType) + 1;
+
+bool Replay::Load(const std::string& dir, const boost::gregorian::date& date) {
+  all_.clear();
+  queues_.clear();
+  diffs_.clear();
+  char fn[32];
+  snprintf(fn, sizeof(fn), "confirmations-%04d%02d%02d",
+           static_cast<int>(date.year()), static_cast<int>(date.month()),
+           static_cast<int>(date.day()));
+  auto path = fs::path(dir) / fn;
+  if (!fs::exists(path) || !fs::file_size(path)) return false;
+  boost::iostreams::mapped_file_source file(path.string());
+  std::vector<Journal::Record> records;
+  auto valid = Journal::Scan(file.data(), file.size(), &records);
+  if (valid != file.size())
+    LOG_WARN("Torn tail of " << path.string() << " at " << valid);
+
+  std::unordered_map<Order::IdType, Recorded*> of_id;
+  auto get = [&of_id](Order::IdType id) -> Recorded* {
+    auto it = of_id.find(id);
+    return it == of_id.end() ? nullptr : it->second;
+  };
+  for (auto& payload : records) {
+    if (payload.size() < kRecordHeader + 1 || payload.back()) continue;
+    auto exec_type = static_cast<OrderStatus>(payload[kRecordHeader - 1]);
+    auto body = payload.data() + kRecordHeader;
+    uint32_t id;
+    int64_t tm;
+    switch (exec_type) {
+      case kUnconfirmedNew: {
+        uint32_t algo_id;
+        double stop_price;
+        char side;
+        char type;
+        char tif;
+        uint32_t sec_id;
+        auto r = std::make_unique<Recorded>();
+        if (sscanf(body, "%u %" SCNd64 " %u %lf %lf %lf %c %c %c %u", &id, &tm,
+                   &algo_id, &r->qty, &r->price, &stop_price, &side, &type,
+                   &tif, &sec_id) < 10)
+          continue;
+        r->id = id;
+        r->tm = r->ack_tm = tm;
+        r->sec = sec_id;
+        r->side = static_cast<OrderSide>(side);
+        r->type = static_cast<OrderType>(type);
+        of_id[id] = r.get();
+        queues_[Key{r->sec, r->side}].push_back(r.get());
+        all_.push_back(std::move(r));
+      } break;
+      case kUnconfirmedCancel:
+      case kUnconfirmedReplace: {
+        uint32_t orig_id;
+        if (sscanf(body, "%u %" SCNd64 " %u", &id, &tm, &orig_id) < 3)
+          continue;
+        auto r = get(orig_id);
+        if (!r) continue;
+        if (exec_type == kUnconfirmedCancel)
+          r->cancel_requested = true;
+        else
+          of_id[id] = r;  // the fills of the replacement go on
+      } break;
+      case kPartiallyFilled:
+      case kFilled: {
+        double qty;
+        double px;
+        char trans;
+        if (sscanf(body, "%u %" SCNd64 " %lf %lf %c", &id, &tm, &qty, &px,
+                   &trans) < 5 ||
+            trans != kTransNew)
+          continue;
+        auto r = get(id);
+        if (r) r->fills.push_back(Fill{tm - r->ack_tm, qty, px});
+      } break;
+      case kNew:
+      case kPendingNew:
+      case kRejected:
+      case kCanceled:
+      case kExpired:
+      case kDoneForDay: {
+        if (sscanf(body, "%u %" SCNd64, &id, &tm) < 2) continue;
+        auto r = get(id);
+        if (!r) continue;
+        if (exec_type == kNew || exec_type == kPendingNew) {
+          if (r->ack_tm == r->tm && r->fills.empty()) r->ack_tm = tm;
+          continue;
+        }
+        auto text = strchr(strchr(body, ' ') + 1, ' ');
+        if (text) r->text = text + 1;
+        if (exec_type == kRejected) {
+          if (r->id == id && r->fills.empty()) r->rejected = true;
+        } else if (!r->cancel_requested && r->unsolicited_dt < 0) {
+          r->unsolicited_dt = tm - r->ack_tm;
+        }
+      } break;
+      default:
+        break;
+    }
+  }
+  stats_.recorded += all_.size();
+  LOG_INFO(all_.size() << " recorded orders loaded from " << path.string());
+  return true;
+}
+
+const Replay::Recorded* Replay::Match(const Order& ord) {
+  auto it = queues_.find(Key{ord.sec->id, ord.side});
+  if (it == queues_.end() || it->second.empty()) {
+    stats_.extra++;
+    std::stringstream ss;
+    ss << std::setprecision(15) << "extra," << ord.tm << ','
+       << ord.sec->symbol << ',' << static_cast<char>(ord.side) << ','
+       << static_cast<char>(ord.type) << ',' << ord.qty << ',' << ord.price
+       << ",,,,";
+    diffs_.push_back(ss.str());
+    return nullptr;
+  }
+  auto r = it->second.front();
+  it->second.pop_front();
+  r->matched = true;
+  stats_.matched++;
+  if (r->type != ord.type || r->qty != ord.qty ||
+      (ord.type != kMarket && r->price != ord.price)) {
+    stats_.diff++;
+    std::stringstream ss;
+    ss << std::setprecision(15) << "diff," << ord.tm << ',' << ord.sec->symbol
+       << ',' << static_cast<char>(ord.side) << ','
+       << static_cast<char>(ord.type) << ',' << ord.qty << ',' << ord.price
+       << ',' << r->tm << ',' << static_cast<char>(r->type) << ',' << r->qty
+       << ',' << r->price;
+    diffs_.push_back(ss.str());
+  }
+  return r;
+}
+
+void Replay::Report(std::ostream& os) {
+  auto missing = 0u;
+  for (auto& r : all_) {
+    if (r->matched) continue;
+    missing++;
+    auto sec = SecurityManager::Instance().Get(r->sec);
+    os << std::setprecision(15) << "missing,,"
+       << (sec ? sec->symbol : std::to_string(r->sec)) << ','
+       << static_cast<char>(r->side) << ",,,," << r->tm << ','
+       << static_cast<char>(r->type) << ',' << r->qty << ',' << r->price
+       << '\n';
+  }
+  for (auto& line : diffs_) os << line << '\n';
+  LOG_INFO("Replay: recorded=" << all_.size() << " missing=" << missing
+                               << " differences=" << diffs_.size());
+  all_.clear();
+  queues_.clear();
+  diffs_.clear();
+}
+
+}  // namespace opentrade
+
+#endif  // BACKTEST
@@ -0,0 +1,87 @@
+#ifndef OPENTRADE_REPLAY_H_
+#define OPENTRADE_REPLAY_H_
+#ifdef BACKTEST
+
+#include <boost/date_time/gregorian/gregorian.hpp>
+#include <deque>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "order.h"
+
+namespace opentrade {
+
+// Production replay, REPLAY_JOURNAL=<store dir>: the orders and exchange
+// confirmations of a day's confirmation journal, see GlobalOrderBook::Write,
+// against the orders the backtest produces from the ticks recorded that day,
+// see TickRecorder. An order placed is matched to the next recorded order of
+// the same security and side; the simulator then plays the recorded ack,
+// fills and unsolicited cancel back to it at the offsets they had from the
+// recorded ack, instead of simulating them. An order matching nothing is
+// simulated as usual. Report writes the orders that differ: "extra" ones
+// not sent that day, "missing" ones not produced, and "diff" ones matched
+// with another type, qty or price.
+class Replay {
+ public:
+  struct Fill {
+    int64_t dt;  // microseconds after the ack
+    double qty;
+    double px;
+  };
+  struct Recorded {
+    Order::IdType id = 0;
+    int64_t tm = 0;     // of placement, UTC microseconds
+    int64_t ack_tm = 0;  // of the first confirmation, tm if none
+    Security::IdType sec = 0;
+    OrderSide side = kOrderSideUnknown;
+    OrderType type = kOrderTypeUnknown;
+    double qty = 0;
+    double price = 0;
+    std::vector<Fill> fills;
+    bool rejected = false;
+    // canceled, expired or done for day without a cancel request of ours
+    int64_t unsolicited_dt = -1;
+    bool cancel_requested = false;
+    std::string text;
+    bool matched = false;
+  };
+  struct Stats {
+    size_t recorded = 0;
+    size_t matched = 0;
+    size_t extra = 0;
+    size_t diff = 0;
+  };
+
+  // false if there is no journal of the date
+  bool Load(const std::string& dir, const boost::gregorian::date& date);
+  bool loaded() const { return !all_.empty(); }
+  // nullptr if nothing left to match, ord is recorded as extra then
+  const Recorded* Match(const Order& ord);
+  // the differences of the day, then cleared
+  void Report(std::ostream& os);
+  const Stats& stats() const { return stats_; }
+
+ private:
+  struct Key {
+    Security::IdType sec;
+    OrderSide side;
+    bool operator==(const Key& b) const {
+      return sec == b.sec && side == b.side;
+    }
+  };
+  struct KeyHash {
+    size_t operator()(const Key& k) const { return k.sec * 31 + k.side; }
+  };
+  std::vector<std::unique_ptr<Recorded>> all_;
+  std::unordered_map<Key, std::deque<Recorded*>, KeyHash> queues_;
+  std::vector<std::string> diffs_;
+  Stats stats_;
+};
+
+}  // namespace opentrade
+
+#endif  // BACKTEST
+#endif  // OPENTRADE_REPLAY_H_
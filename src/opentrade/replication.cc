@@ -0,0 +1,338 @@
+#include "replication.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <sstream>
+#include <thread>
+
+#include "algo.h"
+#include "logger.h"
+#include "order.h"
+#include "socket.h"
+
+namespace opentrade {
+
+static const auto kAlgoStorePath = kStorePath / "algos";
+static const size_t kChunk = 1 << 20;
+// a standby this far behind is dropped rather than growing the primary
+static const size_t kMaxPending = 256 << 20;
+
+static void AppendFrame(std::string* out, Replication::Stream stream,
+                        std::string_view name, std::string_view bytes) {
+  uint32_t size = 1 + 2 + name.size() + bytes.size();
+  uint16_t n = name.size();
+  out->append(reinterpret_cast<const char*>(&size), sizeof(size));
+  out->append(1, static_cast<char>(stream));
+  out->append(reinterpret_cast<const char*>(&n), sizeof(n));
+  out->append(name.data(), name.size());
+  out->append(bytes.data(), bytes.size());
+}
+
+static void WriteAll(int fd, std::string_view bytes, const std::string& name) {
+  auto p = bytes.data();
+  auto n = bytes.size();
+  while (n) {
+    auto rc = ::write(fd, p, n);
+    if (rc < 0) {
+      if (errno == EINTR) continue;
+      LOG_FATAL("Replication: failed to write " << name << ": "
+                                                << strerror(errno));
+    }
+    p += rc;
+    n -= rc;
+  }
+}
+
+struct Replication::Peer {
+  Peer(int fd, const std::string& addr) : fd(fd), addr(addr) {}
+  // limit is for the live stream, not the catch-up
+  void Append(Stream stream, std::string_view name, std::string_view bytes,
+              bool limit) {
+    std::lock_guard<std::mutex> lock(m);
+    if (closed) return;
+    AppendFrame(&out, stream, name, bytes);
+    if (limit && out.size() > kMaxPending) {
+      LOG_ERROR("Replication: standby " << addr << " too far behind, dropped");
+      closed = true;
+    }
+    cv.notify_one();
+  }
+  const int fd;
+  const std::string addr;
+  std::mutex m;
+  std::condition_variable cv;
+  std::string out;  // frames not sent yet
+  bool closed = false;
+  bool live = false;  // under Replication::m_
+};
+
+void Replication::Listen(uint16_t port) {
+  listen_fd_ = TcpListen(port);
+  if (listen_fd_ < 0) {
+    LOG_FATAL("Replication: failed to listen on port " << port << ": "
+                                                       << strerror(errno));
+  }
+  GlobalOrderBook::Instance().journal_.set_tap(
+      [this](const std::string& segment, std::string_view bytes) {
+        Publish(kJournal, segment, bytes);
+      });
+  std::thread([this]() { Accept(); }).detach();
+  LOG_INFO("Replication: listening on port " << port);
+}
+
+void Replication::Accept() {
+  for (;;) {
+    std::string addr;
+    auto fd = TcpAccept(listen_fd_, &addr);
+    if (fd < 0) {
+      LOG_ERROR("Replication: failed to accept: " << strerror(errno));
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+      continue;
+    }
+    auto peer = std::make_shared<Peer>(fd, addr);
+    std::thread([this, peer]() { Serve(peer); }).detach();
+  }
+}
+
+void Replication::Serve(std::shared_ptr<Peer> peer) {
+  std::string hello;
+  for (char c; hello.size() < (1 << 20);) {
+    auto rc = recv(peer->fd, &c, 1, 0);
+    if (rc < 0 && errno == EINTR) continue;
+    if (rc <= 0 || c == '\n') break;
+    hello += c;
+  }
+  // <algo store size> [<journal segment> <size>]...
+  std::istringstream is(hello);
+  uint64_t algos_offset;
+  std::unordered_map<std::string, uint64_t> offsets;
+  if (is >> algos_offset) {
+    std::string segment;
+    uint64_t offset;
+    while (is >> segment >> offset) offsets[segment] = offset;
+    LOG_INFO("Replication: standby " << peer->addr << " connected");
+    {
+      std::lock_guard<std::mutex> lock(m_);
+      peers_.push_back(peer);
+      active_ = true;
+    }
+    // on the write thread, where both stores are written, so that the
+    // switch to the live stream neither misses nor repeats a byte
+    std::promise<void> caught;
+    kWriteTaskPool.AddTask([&]() {
+      CatchUp(peer.get(), offsets, algos_offset);
+      caught.set_value();
+    });
+    caught.get_future().wait();
+    std::string buf;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(peer->m);
+        peer->cv.wait_for(lock, std::chrono::seconds(1), [&peer]() {
+          return peer->closed || !peer->out.empty();
+        });
+        if (peer->closed) break;
+        buf.swap(peer->out);
+      }
+      if (buf.empty()) AppendFrame(&buf, kHeartbeat, {}, {});
+      if (!SendAll(peer->fd, buf.data(), buf.size())) break;
+      buf.clear();
+    }
+    std::lock_guard<std::mutex> lock(m_);
+    peers_.erase(std::find(peers_.begin(), peers_.end(), peer));
+    active_ = !peers_.empty();
+  } else {
+    LOG_ERROR("Replication: invalid hello from " << peer->addr);
+  }
+  {
+    std::lock_guard<std::mutex> lock(peer->m);
+    peer->closed = true;
+  }
+  close(peer->fd);
+  LOG_WARN("Replication: standby " << peer->addr << " disconnected");
+}
+
+void Replication::CatchUp(
+    Peer* peer, const std::unordered_map<std::string, uint64_t>& offsets,
+    uint64_t algos_offset) {
+  auto& book = GlobalOrderBook::Instance();
+  book.journal_.Flush();
+  AlgoManager::Instance().of_.flush();
+  auto send_file = [peer](Stream stream, const std::string& name,
+                          const fs::path& path, uint64_t from) {
+    std::ifstream ifs(path.c_str(), std::ifstream::binary);
+    if (!ifs.good()) return;
+    ifs.seekg(from);
+    std::string chunk(kChunk, '\0');
+    while (ifs.read(&chunk[0], kChunk) || ifs.gcount()) {
+      peer->Append(stream, name, {chunk.data(), size_t(ifs.gcount())}, false);
+    }
+  };
+  for (auto& path : book.journal_.Segments()) {
+    auto name = path.filename().string();
+    auto it = offsets.find(name);
+    send_file(kJournal, name, path, it == offsets.end() ? 0 : it->second);
+  }
+  send_file(kAlgos, "", kAlgoStorePath, algos_offset);
+  std::lock_guard<std::mutex> lock(m_);
+  for (auto& pair : files_) peer->Append(kFile, pair.first, pair.second, false);
+  peer->live = true;
+}
+
+void Replication::Publish(Stream stream, std::string_view name,
+                          std::string_view bytes) {
+  if (stream != kFile && !active_.load(std::memory_order_acquire)) return;
+  std::lock_guard<std::mutex> lock(m_);
+  // kept for the standbys connecting later
+  if (stream == kFile) files_[std::string(name)] = bytes;
+  for (auto& peer : peers_) {
+    if (peer->live) peer->Append(stream, name, bytes, true);
+  }
+}
+
+std::string Replication::Hello() const {
+  boost::system::error_code ec;
+  auto algos = fs::file_size(kAlgoStorePath, ec);
+  std::stringstream ss;
+  ss << (ec ? 0 : algos);
+  for (auto& path : GlobalOrderBook::Instance().journal_.Segments()) {
+    ss << ' ' << path.filename().string() << ' ' << fs::file_size(path);
+  }
+  ss << '\n';
+  return ss.str();
+}
+
+void Replication::Follow(const std::string& primary, double timeout) {
+  std::string host, port;
+  if (!SplitHostPort(primary, &host, &port)) {
+    LOG_FATAL("Invalid replication_primary, expect host:port: " << primary);
+  }
+  LOG_INFO("Replication: standby of " << primary);
+  auto connected = false;
+  for (;;) {
+    auto fd = TcpConnect(host, port);
+    if (fd >= 0) {
+      auto hello = Hello();
+      if (SendAll(fd, hello.data(), hello.size())) {
+        LOG_INFO("Replication: connected to primary " << primary);
+        if (!connected) last_recv_ = std::chrono::steady_clock::now();
+        connected = true;
+        Receive(fd, timeout);
+        LOG_WARN("Replication: lost primary " << primary);
+      }
+      close(fd);
+    }
+    // never before having seen the primary, it may not be up yet
+    if (connected && std::chrono::steady_clock::now() - last_recv_ >=
+                         std::chrono::duration<double>(timeout))
+      break;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  if (segment_fd_ >= 0) close(segment_fd_);
+  if (algos_fd_ >= 0) close(algos_fd_);
+  segment_fd_ = algos_fd_ = -1;
+  LOG_WARN("Replication: primary silent for " << timeout << "s, taking over");
+  GlobalOrderBook::Instance().TakeOver();
+  AlgoManager::Instance().TakeOver();
+}
+
+bool Replication::Receive(int fd, double timeout) {
+  std::string buf;
+  char tmp[1 << 16];
+  for (;;) {
+    pollfd p{fd, POLLIN, 0};
+    auto rc = poll(&p, 1, static_cast<int>(timeout * 1000));
+    if (rc < 0 && errno == EINTR) continue;
+    if (rc <= 0) return false;
+    auto n = recv(fd, tmp, sizeof(tmp), 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    last_recv_ = std::chrono::steady_clock::now();
+    buf.append(tmp, n);
+    // a frame torn by a lost connection is dropped, neither written nor
+    // applied, so the sizes in the next hello stay exact
+    size_t off = 0;
+    while (buf.size() - off >= sizeof(uint32_t)) {
+      uint32_t size;
+      memcpy(&size, buf.data() + off, sizeof(size));
+      if (buf.size() - off - sizeof(size) < size) break;
+      auto p = buf.data() + off + sizeof(size);
+      uint16_t name_size = 0;
+      if (size >= 3) memcpy(&name_size, p + 1, sizeof(name_size));
+      if (size < 3 || 3u + name_size > size) {
+        LOG_ERROR("Replication: invalid frame from primary");
+        return false;
+      }
+      Apply(static_cast<Stream>(*p), {p + 3, name_size},
+            {p + 3 + name_size, size - 3 - name_size});
+      off += sizeof(size) + size;
+    }
+    buf.erase(0, off);
+  }
+}
+
+void Replication::Apply(Stream stream, std::string_view name,
+                        std::string_view bytes) {
+  switch (stream) {
+    case kJournal: {
+      if (name != segment_) {
+        if (name.empty() || name.find('/') != std::string::npos) {
+          LOG_ERROR("Replication: invalid journal segment " << name);
+          return;
+        }
+        if (segment_fd_ >= 0) close(segment_fd_);
+        segment_ = name;
+        auto path = kStorePath / segment_;
+        segment_fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (segment_fd_ < 0) {
+          LOG_FATAL("Failed to write file: " << path.c_str() << ": "
+                                             << strerror(errno));
+        }
+        carry_.clear();
+      }
+      WriteAll(segment_fd_, bytes, segment_);
+      carry_.append(bytes.data(), bytes.size());
+      std::vector<Journal::Record> records;
+      auto n = Journal::Scan(carry_.data(), carry_.size(), &records);
+      // of carry_ in the segment file
+      uint64_t base = lseek(segment_fd_, 0, SEEK_END) - carry_.size();
+      auto& book = GlobalOrderBook::Instance();
+      for (auto& r : records)
+        book.Replicate(r, segment_, base + (r.data() - carry_.data()));
+      carry_.erase(0, n);
+    } break;
+    case kAlgos:
+      if (algos_fd_ < 0) {
+        algos_fd_ = open(kAlgoStorePath.c_str(), O_WRONLY | O_CREAT | O_APPEND,
+                         0644);
+        if (algos_fd_ < 0) {
+          LOG_FATAL("Failed to write file: " << kAlgoStorePath.c_str() << ": "
+                                             << strerror(errno));
+        }
+      }
+      WriteAll(algos_fd_, bytes, kAlgoStorePath.string());
+      break;
+    case kFile: {
+      fs::path path(std::string{name});
+      boost::system::error_code ec;
+      if (path.has_parent_path()) {
+        fs::create_directories(path.parent_path(), ec);
+      }
+      auto tmp = path.string() + ".tmp";
+      std::ofstream of(tmp, std::ofstream::binary | std::ofstream::trunc);
+      of.write(bytes.data(), bytes.size());
+      of.close();
+      if (of.good())
+        fs::rename(tmp, path, ec);
+      else
+        LOG_ERROR("Replication: failed to write " << tmp);
+    } break;
+    default:
+      break;
+  }
+}
+
+}  // namespace opentrade
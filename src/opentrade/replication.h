@@ -0,0 +1,72 @@
+#ifndef OPENTRADE_REPLICATION_H_
+#define OPENTRADE_REPLICATION_H_
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+
+namespace opentrade {
+
+// Hot standby. The primary streams what it appends to the confirmation
+// journal and the algo store, and the FIX seq num files, to the standbys
+// connected to its port, batched by whatever piles up during a send. A
+// standby mirrors them byte for byte into its own store, replays the
+// confirmations into GlobalOrderBook and positions as they arrive, and
+// takes over once the primary has been silent for the timeout; the
+// exchange connectivity adapters then start on the mirrored seq nums.
+//
+// Frame: [u32 size][u8 stream][u16 name size][name][bytes], size is of
+// what follows it. The standby says hello with one line, its store sizes,
+// "<algo store> [<journal segment> <size>]...\n", and gets the bytes
+// beyond those first, then the live stream.
+class Replication : public Singleton<Replication> {
+ public:
+  enum Stream : uint8_t { kHeartbeat, kJournal, kAlgos, kFile };
+  // primary, serves the standbys connecting to port
+  void Listen(uint16_t port);
+  // primary, thread safe. bytes appended to the journal segment name or
+  // the algo store, or, for kFile, the new content of the file at path
+  // name, which must be the same on the standbys
+  void Publish(Stream stream, std::string_view name, std::string_view bytes);
+  // standby, mirrors the primary at host:port, returns after taking over
+  void Follow(const std::string& primary, double timeout);
+  // primary listening for the standbys
+  bool serving() const { return listen_fd_ >= 0; }
+
+ private:
+  struct Peer;
+  void Accept();
+  void Serve(std::shared_ptr<Peer> peer);
+  void CatchUp(Peer* peer,
+               const std::unordered_map<std::string, uint64_t>& offsets,
+               uint64_t algos_offset);
+  std::string Hello() const;
+  // false once the connection is lost or silent for timeout seconds
+  bool Receive(int fd, double timeout);
+  void Apply(Stream stream, std::string_view name, std::string_view bytes);
+
+  // primary
+  int listen_fd_ = -1;
+  std::atomic<bool> active_ = false;  // any peer to publish to
+  std::mutex m_;
+  std::vector<std::shared_ptr<Peer>> peers_;
+  std::map<std::string, std::string> files_;  // latest of kFile
+  // standby
+  std::string segment_;
+  int segment_fd_ = -1;
+  int algos_fd_ = -1;
+  std::string carry_;  // a torn journal record of the last frame
+  std::chrono::steady_clock::time_point last_recv_;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_REPLICATION_H_
@@ -1,7 +1,11 @@
 #include "risk.h"
 
+#include <unordered_map>
+
+#include "algo.h"
 #include "position.h"
 #include "stop_book.h"
+#include "text_parser.h"
 
 namespace opentrade {
 
@@ -25,11 +29,15 @@ std::string Limits::GetString() {
 std::string Limits::FromString(const std::string& str) {
   Limits l;
   for (auto& str : Split(str, ",;\n")) {
-    char name[str.size()];
+    auto eq = str.find('=');
     double value;
-    if (sscanf(str.c_str(), "%[^=]=%lf", name, &value) != 2) {
+    if (!eq || eq == std::string::npos ||
+        !TextCursor(str.c_str() + eq + 1, str.c_str() + str.size())
+             .Double(&value)) {
       return "Invalid limits format, expect <name>=<value>[,;<new line>]...";
     }
+    str[eq] = 0;
+    auto name = str.c_str();
     if (!strcasecmp(name, "msg_rate"))
       l.msg_rate = value;
     else if (!strcasecmp(name, "msg_rate_per_security"))
@@ -57,12 +65,62 @@ std::string Limits::FromString(const std::string& str) {
   return {};
 }
 
-static inline bool CheckMsgRate(const char* name, const AccountBase& acc,
+// without inserting, for the cancel path
+static inline RiskSlot FindSlot(const AccountBase& acc, Security::IdType sid) {
+  RiskSlot slot;
+  slot.acc = &acc;
+  slot.counters = acc.per_security.Find(sid);
+  return slot;
+}
+
+// the entries never move, the pointer stays valid, only created if the
+// per security limits are set, looked up on each check again until then
+static inline RiskSlot MakeSlot(const AccountBase& acc, Security::IdType sid) {
+  auto& l = acc.limits;
+  if (l.msg_rate_per_security <= 0 && l.max_cancels_per_security <= 0)
+    return FindSlot(acc, sid);
+  RiskSlot slot;
+  slot.acc = &acc;
+  slot.counters = const_cast<AccountBase&>(acc).per_security.Get(sid);
+  return slot;
+}
+
+bool RiskContext::Matches(const Order& ord) const {
+  return sec == ord.sec && sub_account == ord.sub_account &&
+         broker_account == ord.broker_account && user == ord.user &&
+         destination == ord.destination;
+}
+
+void RiskContext::Resolve(const Order& ord) {
+  sec = ord.sec;
+  sub_account = ord.sub_account;
+  broker_account = ord.broker_account;
+  user = ord.user;
+  destination = ord.destination;
+  destination_account =
+      destination.empty()
+          ? nullptr
+          : AccountManager::Instance().GetBrokerAccount(destination);
+  sub_account_slot = MakeSlot(*sub_account, sec->id);
+  broker_account_slot = MakeSlot(*broker_account, sec->id);
+  user_slot = MakeSlot(*user, sec->id);
+  if (destination_account)
+    destination_slot = MakeSlot(*destination_account, sec->id);
+}
+
+static inline const SecurityCounters::Entry* GetCounters(
+    const RiskSlot& slot, Security::IdType sid) {
+  return slot.counters ? slot.counters : slot.acc->per_security.Find(sid);
+}
+
+static inline bool CheckMsgRate(const char* name, const RiskSlot& slot,
                                 Security::IdType sid) {
-  auto tm = GetTime();
+  auto tm = NowCoarseInMicro();
+  auto& acc = *slot.acc;
   auto& l = acc.limits;
-  if (l.msg_rate_per_security > 0) {
-    auto v = FindInMap(acc.throttle_per_security_in_sec, sid)(tm);
+  const SecurityCounters::Entry* counters;
+  if (l.msg_rate_per_security > 0 && (counters = GetCounters(slot, sid))) {
+    auto v = counters->throttle(tm);
     if (v >= l.msg_rate_per_security) {
       char buf[256];
       snprintf(buf, sizeof(buf),
@@ -72,26 +130,28 @@ static inline bool CheckMsgRate(const char* name, const AccountBase& acc,
       return false;
     }
   }
-  if (l.msg_rate > 0 && acc.throttle_in_sec(tm) >= l.msg_rate) {
+  auto msg_rate = l.msg_rate * acc.msg_rate_share;
+  if (l.msg_rate > 0 && acc.throttle_in_sec(tm) >= msg_rate) {
     char buf[256];
     snprintf(buf, sizeof(buf), "%s limit breach: message rate %d > %f", name,
-             acc.throttle_in_sec(tm), l.msg_rate);
+             acc.throttle_in_sec(tm), msg_rate);
     kRiskError = buf;
     return false;
   }
   return true;
 }
 
-static inline bool CheckCancels(const char* name, const AccountBase& acc,
+static inline bool CheckCancels(const char* name, const RiskSlot& slot,
                                 Security::IdType sid) {
-  auto& l = acc.limits;
-  if (l.max_cancels_per_security > 0) {
-    auto v = FindInMap(acc.cancels_per_security, sid);
+  auto& l = slot.acc->limits;
+  const SecurityCounters::Entry* counters;
+  if (l.max_cancels_per_security > 0 && (counters = GetCounters(slot, sid))) {
+    auto v = counters->Cancels(NowCoarseInMicro());
     if (v >= l.max_cancels_per_security) {
       char buf[256];
       snprintf(buf, sizeof(buf),
-               "%s limit breach: maximum cancels per second %d > %d", name,
-               v.load(), l.max_cancels_per_security);
+               "%s limit breach: maximum cancels per second %d > %d", name, v,
+               l.max_cancels_per_security);
       kRiskError = buf;
       return false;
     }
@@ -99,14 +159,33 @@ static inline bool CheckCancels(const char* name, const AccountBase& acc,
   return true;
 }
 
-static bool Check(const char* name, const Order& ord, const AccountBase& acc,
-                  const Position* pos) {
+// the qty a buy of qty adds to the long side of pos, after covering its short
+static inline double LongQty(const Position& pos, double qty) {
+  auto net = pos.qty + pos.total_outstanding_buy - pos.total_outstanding_sell;
+  if (net >= 0) return qty;
+  auto tmp = net + qty;
+  return tmp > 0 ? tmp : 0;
+}
+
+static inline double ShortQty(const Position& pos, double qty) {
+  auto net = pos.qty + pos.total_outstanding_buy - pos.total_outstanding_sell;
+  if (net <= 0) return qty;
+  auto tmp = net - qty;
+  return tmp < 0 ? -tmp : 0;
+}
+
+// value is the account's own if null, or with the earlier orders of a basket
+static bool Check(const char* name, const Order& ord, const RiskSlot& slot,
+                  const Position* pos, const Order* orig,
+                  const AccountPositionValue* value = nullptr) {
+  auto& acc = *slot.acc;
+  auto& acc_value = value ? *value : acc.position_value;
   if (!acc.CheckDisabled(name, &kRiskError)) return false;
 
-  if (!CheckMsgRate(name, acc, ord.sec->id)) return false;
+  if (!CheckMsgRate(name, slot, ord.sec->id)) return false;
 
   // reject new order also if cancels breached
-  if (!CheckCancels(name, acc, ord.sec->id)) return false;
+  if (!CheckCancels(name, slot, ord.sec->id)) return false;
 
   auto& l = acc.limits;
 
@@ -133,6 +212,14 @@ static bool Check(const char* name, const Order& ord, const AccountBase& acc,
 
   if (!pos) return true;
 
+  // a replacement swaps the leaves of the order it amends for its own
+  auto qty = ord.qty;
+  if (orig) {
+    qty -= orig->cum_qty;
+    v = qty * ord.price * m - orig->leaves_qty * orig->price * m;
+    qty -= orig->leaves_qty;
+  }
+
   if (l.value > 0) {
     double v2;
     auto net = pos->total_bought - pos->total_sold;
@@ -167,75 +254,59 @@ static bool Check(const char* name, const Order& ord, const AccountBase& acc,
     }
   }
 
+  // the limits shared with other shards
+  double share = acc.value_share;
   if (l.total_value > 0) {
     double v2;
-    auto& pos = acc.position_value;
-    auto net = pos.total_bought - pos.total_sold;
+    auto& pos = acc_value;
+    double net = pos.total_bought - pos.total_sold;
     if (ord.IsBuy())
       v2 = std::max(std::abs(net + pos.total_outstanding_buy + v),
                     std::abs(net - pos.total_outstanding_sell));
     else
       v2 = std::max(std::abs(net + pos.total_outstanding_buy),
                     std::abs(net - pos.total_outstanding_sell - v));
-    if (v2 > l.total_value) {
+    if (v2 > l.total_value * share) {
       snprintf(buf, sizeof(buf),
                "%s limit breach: total intraday trade value %f > %f", name, v2,
-               l.total_value);
+               l.total_value * share);
       kRiskError = buf;
       return false;
     }
   }
 
   if (l.total_turnover > 0) {
-    auto& pos = acc.position_value;
+    auto& pos = acc_value;
     double v2 = pos.total_bought + pos.total_outstanding_buy + pos.total_sold +
                 pos.total_outstanding_sell + v;
-    if (v2 > l.total_turnover) {
+    if (v2 > l.total_turnover * share) {
       snprintf(buf, sizeof(buf),
                "%s limit breach: total intraday turnover %f > %f", name, v2,
-               l.total_turnover);
+               l.total_turnover * share);
       kRiskError = buf;
       return false;
     }
   }
 
   if (l.total_long_value > 0 && ord.IsBuy()) {
-    auto v2 = acc.position_value.long_value;
-    auto net =
-        pos->qty + pos->total_outstanding_buy - pos->total_outstanding_sell;
-    auto d = ord.qty;
-    if (net < 0) {
-      auto tmp = net + ord.qty;
-      if (tmp > 0)
-        d = tmp;
-      else
-        d = 0;
-    }
+    double v2 = acc_value.long_value;
+    auto d = LongQty(*pos, qty);
     if (d > 0) v2 += d * ord.price * m;
-    if (d > 0 && v2 > l.total_long_value) {
+    if (d > 0 && v2 > l.total_long_value * share) {
       snprintf(buf, sizeof(buf), "%s limit breach: total long value %f > %f",
-               name, v2, l.total_long_value);
+               name, v2, l.total_long_value * share);
       kRiskError = buf;
       return false;
     }
   }
 
   if (l.total_short_value > 0 && !ord.IsBuy()) {
-    auto v2 = acc.position_value.short_value;
-    auto net =
-        pos->qty + pos->total_outstanding_buy - pos->total_outstanding_sell;
-    auto d = ord.qty;
-    if (net > 0) {
-      auto tmp = net - ord.qty;
-      if (tmp < 0)
-        d = -tmp;
-      else
-        d = 0;
-    }
+    double v2 = acc_value.short_value;
+    auto d = ShortQty(*pos, qty);
     if (d > 0) v2 += d * ord.price * m;
-    if (d > 0 && v2 > l.total_short_value) {
+    if (d > 0 && v2 > l.total_short_value * share) {
       snprintf(buf, sizeof(buf), "%s limit breach: total short value %f > %f",
-               name, v2, l.total_short_value);
+               name, v2, l.total_short_value * share);
       kRiskError = buf;
       return false;
     }
@@ -252,14 +323,17 @@ bool RiskManager::CheckMsgRate(const Order& ord) {
   assert(ord.user);
   assert(ord.broker_account);
 
-  if (!opentrade::CheckMsgRate("sub_account", *ord.sub_account, ord.sec->id))
+  auto sid = ord.sec->id;
+  if (!opentrade::CheckMsgRate("sub_account", FindSlot(*ord.sub_account, sid),
+                               sid))
     return false;
 
-  if (!opentrade::CheckMsgRate("broker_account", *ord.broker_account,
-                               ord.sec->id))
+  if (!opentrade::CheckMsgRate("broker_account",
+                               FindSlot(*ord.broker_account, sid), sid))
     return false;
 
-  if (!opentrade::CheckMsgRate("user", *ord.user, ord.sec->id)) return false;
+  if (!opentrade::CheckMsgRate("user", FindSlot(*ord.user, sid), sid))
+    return false;
 
   return true;
 }
@@ -272,19 +346,23 @@ bool RiskManager::CheckCancels(const Order& ord) {
   assert(ord.user);
   assert(ord.broker_account);
 
-  if (!opentrade::CheckCancels("sub_account", *ord.sub_account, ord.sec->id))
+  auto sid = ord.sec->id;
+  if (!opentrade::CheckCancels("sub_account", FindSlot(*ord.sub_account, sid),
+                               sid))
     return false;
 
-  if (!opentrade::CheckCancels("broker_account", *ord.broker_account,
-                               ord.sec->id))
+  if (!opentrade::CheckCancels("broker_account",
+                               FindSlot(*ord.broker_account, sid), sid))
     return false;
 
-  if (!opentrade::CheckCancels("user", *ord.user, ord.sec->id)) return false;
+  if (!opentrade::CheckCancels("user", FindSlot(*ord.user, sid), sid))
+    return false;
 
   return true;
 }
 
-bool RiskManager::Check(const Order& ord) {
+bool RiskManager::Check(const Order& ord, RiskContext* ctx,
+                        const Order* orig) {
   if (disabled_) return true;
 
   assert(ord.sub_account);
@@ -292,30 +370,127 @@ bool RiskManager::Check(const Order& ord) {
   assert(ord.user);
   assert(ord.broker_account);
 
+  RiskContext tmp;
+  if (!ctx) ctx = &tmp;
+  if (!ctx->Matches(ord)) ctx->Resolve(ord);
+
   if (!StopBookManager::Instance().CheckStop(*ord.sec, ord.sub_account,
                                              &kRiskError))
     return false;
 
-  if (!opentrade::Check(
-          "sub_account", ord, *ord.sub_account,
-          &PositionManager::Instance().Get(*ord.sub_account, *ord.sec)))
+  if (!ord.sub_position)
+    PositionManager::Instance().Resolve(const_cast<Order*>(&ord));
+
+  if (!opentrade::Check("sub_account", ord, ctx->sub_account_slot,
+                        ord.sub_position, orig))
+    return false;
+
+  if (!opentrade::Check("broker_account", ord, ctx->broker_account_slot,
+                        ord.broker_position, orig))
     return false;
 
-  if (!opentrade::Check(
-          "broker_account", ord, *ord.broker_account,
-          &PositionManager::Instance().Get(*ord.broker_account, *ord.sec)))
+  if (!opentrade::Check("user", ord, ctx->user_slot, ord.user_position, orig))
     return false;
 
-  if (!opentrade::Check("user", ord, *ord.user,
-                        &PositionManager::Instance().Get(*ord.user, *ord.sec)))
+  if (ctx->destination_account &&
+      !opentrade::Check("destination", ord, ctx->destination_slot, nullptr,
+                        orig))
     return false;
 
-  if (!ord.destination.empty()) {
-    auto acc = AccountManager::Instance().GetBrokerAccount(ord.destination);
-    if (acc && !opentrade::Check("destination", ord, *acc, nullptr))
+  return true;
+}
+
+bool RiskManager::Check(const std::vector<Order*>& ords) {
+  if (ords.size() == 1) {
+    auto ord = ords[0];
+    return Check(*ord, ord->inst ? ord->inst->risk_context() : nullptr);
+  }
+  if (disabled_) return true;
+
+  // the values of the accounts and positions with the orders checked so
+  // far, copied on first touch, so that each order is checked as if the
+  // ones before it were placed
+  struct Group {
+    AccountPositionValue value;
+    int msgs = 0;
+  };
+  std::unordered_map<const AccountBase*, Group> groups;
+  std::unordered_map<const Position*, Position> positions;
+  auto group = [&groups](const AccountBase* acc) -> Group& {
+    auto it = groups.find(acc);
+    if (it == groups.end())
+      it = groups.emplace(acc, Group{acc->position_value}).first;
+    return it->second;
+  };
+  auto position = [&positions](const Position* pos) -> Position* {
+    if (!pos) return nullptr;
+    auto it = positions.find(pos);
+    if (it == positions.end()) it = positions.emplace(pos, *pos).first;
+    return &it->second;
+  };
+
+  RiskContext ctx;
+  for (auto i = 0u; i < ords.size(); ++i) {
+    auto& ord = *ords[i];
+    assert(ord.sub_account);
+    assert(ord.sec);
+    assert(ord.user);
+    assert(ord.broker_account);
+    if (!ctx.Matches(ord)) ctx.Resolve(ord);
+    if (!StopBookManager::Instance().CheckStop(*ord.sec, ord.sub_account,
+                                               &kRiskError))
       return false;
+    if (!ord.sub_position)
+      PositionManager::Instance().Resolve(const_cast<Order*>(&ord));
+    const std::pair<const char*, const Position*> kSides[] = {
+        {"sub_account", ord.sub_position},
+        {"broker_account", ord.broker_position},
+        {"user", ord.user_position},
+        {"destination", nullptr},
+    };
+    const RiskSlot* slots[] = {&ctx.sub_account_slot, &ctx.broker_account_slot,
+                               &ctx.user_slot, &ctx.destination_slot};
+    auto n = ctx.destination_account ? 4 : 3;
+    for (auto j = 0; j < n; ++j) {
+      auto& g = group(slots[j]->acc);
+      if (!opentrade::Check(kSides[j].first, ord, *slots[j],
+                            position(kSides[j].second), nullptr, &g.value)) {
+        kRiskError = "basket order " + std::to_string(i) + ": " + kRiskError;
+        return false;
+      }
+    }
+    auto m = ord.sec->multiplier * ord.sec->rate;
+    auto buy = ord.IsBuy();
+    for (auto j = 0; j < n; ++j) {
+      auto& g = group(slots[j]->acc);
+      auto pos = position(kSides[j].second);
+      if (pos) {
+        auto v = ord.price * m;
+        if (buy)
+          g.value.long_value += LongQty(*pos, ord.qty) * v;
+        else
+          g.value.short_value += ShortQty(*pos, ord.qty) * v;
+        pos->PositionValue::HandleNew(buy, ord.qty, ord.price, m);
+      }
+      g.value.HandleNew(buy, ord.qty, ord.price, m);
+      g.msgs++;
+    }
   }
 
+  // the messages of the basket on top of the ones of the last second
+  auto tm = NowCoarseInMicro();
+  for (auto& pair : groups) {
+    auto& acc = *pair.first;
+    auto msg_rate = acc.limits.msg_rate * acc.msg_rate_share;
+    auto v = acc.throttle_in_sec(tm) + pair.second.msgs;
+    if (acc.limits.msg_rate > 0 && v > msg_rate) {
+      char buf[256];
+      snprintf(buf, sizeof(buf), "basket limit breach: message rate %d > %f",
+               v, msg_rate);
+      kRiskError = buf;
+      return false;
+    }
+  }
   return true;
 }
 
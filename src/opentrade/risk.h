@@ -2,7 +2,11 @@
 #define OPENTRADE_RISK_H_
 
 #include <tbb/atomic.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "common.h"
 
@@ -24,31 +28,192 @@ struct Limits {
   std::string FromString(const std::string& str);
 };
 
-struct Throttle {
-  tbb::atomic<int> n = 0;
-  int operator()(int tm) const {
-    if (tm != this->tm) return 0;
+// Message count of the rolling window (kWindow micro seconds) ending now,
+// at the resolution of kWindow / kBuckets. Each bucket packs its bucket
+// index (high 40 bits) with its count (low 24 bits), so updating is one CAS
+// and a stale bucket is recycled on the fly.
+template <int64_t kWindow, int kBuckets>
+struct SlidingThrottle {
+  static inline const int64_t kResolution = kWindow / kBuckets;
+
+  int operator()(int64_t now) const {
+    auto idx = now / kResolution;
+    auto n = 0;
+    for (auto& b : buckets) {
+      uint64_t v = b;
+      auto idx2 = static_cast<int64_t>(v >> kCountBits);
+      if (idx2 <= idx && idx2 > idx - kBuckets) n += v & kCountMask;
+    }
     return n;
   }
-  int tm = 0;
 
-  void Update(int tm2) {
-    if (tm2 != tm) {
-      n = 0;
-      tm2 = tm;
-    } else {
-      n++;
+  void Update(int64_t now) {
+    uint64_t idx = now / kResolution;
+    auto& b = buckets[idx % kBuckets];
+    while (true) {
+      uint64_t v = b;
+      auto v2 = (v >> kCountBits) == idx ? v + 1 : (idx << kCountBits) | 1;
+      if (b.compare_and_swap(v2, v) == v) break;
     }
   }
+
+  tbb::atomic<uint64_t> buckets[kBuckets] = {};
+
+ private:
+  static inline const int kCountBits = 24;
+  static inline const uint64_t kCountMask = (1lu << kCountBits) - 1;
+};
+
+// one second window in 100ms buckets, driven by NowCoarseInMicro()
+typedef SlidingThrottle<kMicroInSec, 10> Throttle;
+
+// Per security message throttles and cancel counts of an account, of only
+// the securities sent while msg_rate_per_security or max_cancels_per_security
+// is set. Entries are allocated in blocks and never move, the index over
+// them is open-addressed on the security id, read lock free and replaced
+// when half full, the old ones retired until the table goes. The cancel
+// count of an entry restarts on the first cancel of a new (UTC) day.
+class SecurityCounters {
+ public:
+  struct Entry {
+    Throttle throttle;
+    tbb::atomic<int> cancels;
+    tbb::atomic<uint32_t> day;  // of cancels
+
+    int Cancels(int64_t now) const {
+      return day == Day(now) ? static_cast<int>(cancels) : 0;
+    }
+    void AddCancel(int64_t now) {
+      auto d = Day(now);
+      if (day != d) {
+        day = d;
+        cancels = 0;
+      }
+      cancels++;
+    }
+  };
+
+  ~SecurityCounters() { delete index_.load(std::memory_order_relaxed); }
+
+  // without inserting
+  const Entry* Find(uint32_t sec_id) const {
+    auto idx = index_.load(std::memory_order_acquire);
+    if (!idx) return nullptr;
+    auto key = sec_id + 1;
+    for (auto i = idx->Hash(key);; i = (i + 1) & idx->mask) {
+      auto& s = idx->slots[i];
+      auto k = s.key.load(std::memory_order_acquire);
+      if (k == key) return s.entry;
+      if (!k) return nullptr;
+    }
+  }
+
+  Entry* Get(uint32_t sec_id) {
+    auto e = Find(sec_id);
+    if (e) return const_cast<Entry*>(e);
+    std::lock_guard<std::mutex> lock(m_);
+    e = Find(sec_id);
+    if (e) return const_cast<Entry*>(e);
+    if (size_ % kBlockSize == 0) blocks_.emplace_back(new Entry[kBlockSize]());
+    auto entry = &blocks_.back()[size_ % kBlockSize];
+    auto idx = index_.load(std::memory_order_relaxed);
+    if (!idx || (size_ + 1) * 2 > idx->mask + 1) {
+      auto idx2 = new Index(idx ? idx->bits + 1 : 4);
+      if (idx) {
+        for (auto i = 0u; i <= idx->mask; ++i) {
+          auto& s = idx->slots[i];
+          if (s.key) idx2->Insert(s.key, s.entry);
+        }
+        retired_.emplace_back(idx);
+      }
+      index_.store(idx2, std::memory_order_release);
+      idx = idx2;
+    }
+    idx->Insert(sec_id + 1, entry);
+    size_++;
+    return entry;
+  }
+
+  size_t size() const { return size_; }
+
+ private:
+  static inline const size_t kBlockSize = 64;
+
+  static uint32_t Day(int64_t now) { return now / (86400 * kMicroInSec); }
+
+  struct Index {
+    struct Slot {
+      std::atomic<uint32_t> key = 0;  // security id + 1, 0 for empty
+      Entry* entry = nullptr;
+    };
+    explicit Index(uint32_t bits)
+        : bits(bits), mask((1u << bits) - 1), slots(new Slot[mask + 1]) {}
+    uint32_t Hash(uint32_t key) const {
+      return (key * 0x9E3779B97F4A7C15lu) >> (64 - bits);
+    }
+    // single writer, the entry published with the key
+    void Insert(uint32_t key, Entry* entry) {
+      auto i = Hash(key);
+      while (slots[i].key.load(std::memory_order_relaxed))
+        i = (i + 1) & mask;
+      slots[i].entry = entry;
+      slots[i].key.store(key, std::memory_order_release);
+    }
+    const uint32_t bits;
+    const uint32_t mask;
+    std::unique_ptr<Slot[]> slots;
+  };
+
+  std::atomic<Index*> index_ = nullptr;
+  std::vector<std::unique_ptr<Index>> retired_;
+  std::vector<std::unique_ptr<Entry[]>> blocks_;
+  size_t size_ = 0;
+  std::mutex m_;  // writers
 };
 
 inline thread_local std::string kRiskError;
 
 struct Order;
+struct Security;
+struct AccountBase;
+struct SubAccount;
+struct BrokerAccount;
+struct User;
+
+// what the per account check needs beyond the account itself
+struct RiskSlot {
+  const AccountBase* acc = nullptr;
+  // of the security, nullptr if not created yet
+  const SecurityCounters::Entry* counters = nullptr;
+};
+
+// risk slots of one (accounts, security), kept on Instrument, so that child
+// orders do no map lookup, re-resolved if the accounts of order changes
+struct RiskContext {
+  const Security* sec = nullptr;
+  const SubAccount* sub_account = nullptr;
+  const BrokerAccount* broker_account = nullptr;
+  const User* user = nullptr;
+  std::string destination;
+  const BrokerAccount* destination_account = nullptr;
+  RiskSlot sub_account_slot;
+  RiskSlot broker_account_slot;
+  RiskSlot user_slot;
+  RiskSlot destination_slot;
+  bool Matches(const Order& ord) const;
+  void Resolve(const Order& ord);
+};
 
 class RiskManager : public Singleton<RiskManager> {
  public:
-  bool Check(const Order& ord);
+  // ctx is resolved on demand, nullptr to use a temporary one, orig is the
+  // order which ord replaces, only the difference adds to the exposure
+  bool Check(const Order& ord, RiskContext* ctx = nullptr,
+             const Order* orig = nullptr);
+  // all or none of the orders of a basket, each checked with the exposure
+  // of the ones before it added, grouped by account, as if they were placed;
+  // the per order Check if only one
+  bool Check(const std::vector<Order*>& ords);
   bool CheckMsgRate(const Order& ord);
   bool CheckCancels(const Order& ord);
   void Disable() { disabled_ = true; }
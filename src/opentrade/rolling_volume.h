@@ -0,0 +1,164 @@
+#ifndef OPENTRADE_ROLLING_VOLUME_H_
+#define OPENTRADE_ROLLING_VOLUME_H_
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include "async_trade_tick_hook.h"
+#include "indicator_cache.h"
+#include "indicator_handler.h"
+
+namespace opentrade {
+
+static const Indicator::IdType kRollingVolume = 4;
+
+// Market volume traded since the indicator was created, sampled per second
+// in a ring covering kMaxWindow, so window sums of any length up to it are
+// a subtraction, shared by all the algos on the security. Only the handler
+// thread writes, readers go lock free.
+class RollingVolume : public Indicator {
+ public:
+  static const Indicator::IdType kId = kRollingVolume;
+  static inline const time_t kMaxWindow = 3600;  // seconds
+
+  explicit RollingVolume(time_t tm)
+      : ring_(new std::atomic<MarketData::Volume>[kSize]{}),
+        first_(tm),
+        last_(tm) {}
+
+  // volume traded in the window seconds up to tm, not before since
+  MarketData::Volume Get(time_t tm, time_t window, time_t since = 0) const {
+    window = std::min(window, kMaxWindow);
+    return At(tm) - At(std::max(tm - window, since));
+  }
+
+  // cumulative volume at the end of second tm
+  MarketData::Volume At(time_t tm) const {
+#ifdef BACKTEST
+    if (from_cache_) return CachedAt(tm);
+#endif
+    auto last = last_.load(std::memory_order_acquire);
+    if (tm >= last) tm = last;
+    if (tm < first_) return 0;
+    if (tm <= last - kSize) tm = last - kSize + 1;
+    return ring_[tm % kSize].load(std::memory_order_relaxed);
+  }
+
+  void Update(time_t tm, double qty) {
+    auto last = last_.load(std::memory_order_relaxed);
+    if (tm > last) {
+      auto v = ring_[last % kSize].load(std::memory_order_relaxed);
+      for (auto t = std::max(last + 1, tm - kSize + 1); t < tm; ++t)
+        ring_[t % kSize].store(v, std::memory_order_relaxed);
+      ring_[tm % kSize].store(v, std::memory_order_relaxed);
+      last_.store(tm, std::memory_order_release);
+      last = tm;
+    }
+    auto& slot = ring_[last % kSize];
+    auto v = slot.load(std::memory_order_relaxed) + qty;
+    slot.store(v, std::memory_order_release);
+#ifdef BACKTEST
+    if (!record_) return;
+    if (!record_->empty() && record_->back().tm == kTime)
+      record_->back().volume = v;
+    else
+      record_->push_back(Sample{kTime, v});
+#endif
+  }
+
+#ifdef BACKTEST
+  // of IndicatorCache, kTime and the volume since the series was recorded
+  struct Sample {
+    uint64_t tm;
+    MarketData::Volume volume;
+  };
+
+  // the volume of the samples instead of the trades, less the one before
+  // this was created
+  void UseCache(const IndicatorCache::Series<Sample>& s) {
+    from_cache_ = true;
+    cached_ = s;
+    base_ = Find(kTime - 1);
+  }
+  void Record(std::vector<Sample>* s) { record_ = s; }
+#endif
+
+ private:
+#ifdef BACKTEST
+  // the volume of the last sample at or before tm
+  MarketData::Volume Find(uint64_t tm) const {
+    auto end = cached_.p + cached_.n;
+    auto it = std::upper_bound(
+        cached_.p, end, tm,
+        [](uint64_t tm, const Sample& s) { return tm < s.tm; });
+    return it == cached_.p ? 0 : (it - 1)->volume;
+  }
+
+  MarketData::Volume CachedAt(time_t tm) const {
+    if (tm < first_) return 0;
+    auto end = std::min<uint64_t>((tm + 1) * kMicroInSec - 1, kTime);
+    return Find(end) - base_;
+  }
+
+  bool from_cache_ = false;
+  IndicatorCache::Series<Sample> cached_;
+  MarketData::Volume base_ = 0;
+  std::vector<Sample>* record_ = nullptr;
+#endif
+  static inline const time_t kSize = kMaxWindow + 2;
+  std::unique_ptr<std::atomic<MarketData::Volume>[]> ring_;
+  const time_t first_;
+  std::atomic<time_t> last_;
+};
+
+class RollingVolumeHandler : public IndicatorHandler,
+                             public AsyncTradeTickHook {
+ public:
+  typedef RollingVolume Ind;
+  explicit RollingVolumeHandler(const char* name = "rolling_volume") {
+    set_name(name);
+  }
+
+  Indicator::IdType id() const override { return kRollingVolume; }
+
+  void Subscribe(Instrument* inst, bool listen) noexcept override {
+    Async([=]() {
+      auto ind = const_cast<Ind*>(inst->Get<Ind>());
+      if (!ind) {
+        ind = new Ind(GetTime());
+        if (!FromCache(inst->sec(), ind)) inst->HookTradeTick(this);
+        const_cast<MarketData&>(inst->md()).Set(ind);
+      }
+      if (listen) ind->AddListener(inst);
+    });
+  }
+
+  void OnTick(const Tick& t) noexcept override {
+    auto ind = const_cast<Ind*>(t.md->Get<Ind>());
+    if (!ind || t.qty <= 0) return;
+    ind->Update(t.tm, t.qty);
+  }
+
+  void Post(std::function<void()> func) noexcept override { Async(func); }
+
+ private:
+  bool FromCache(const Security& sec, Ind* ind) {
+#ifdef BACKTEST
+    auto& cache = IndicatorCache::Instance();
+    if (!cache.enabled()) return false;
+    auto key = name() + "-v1";
+    IndicatorCache::Series<Ind::Sample> s;
+    if (cache.Get(key, sec.id, kTime, &s)) {
+      ind->UseCache(s);
+      return true;
+    }
+    ind->Record(cache.Record<Ind::Sample>(key, sec.id, kTime));
+#endif
+    return false;
+  }
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_ROLLING_VOLUME_H_
@@ -1,12 +1,22 @@
 #include "security.h"
 
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
 #include <boost/make_shared.hpp>
+#include <libpq-fe.h>
+#include <poll.h>
+#include <cerrno>
+#include <chrono>
 #include <cstring>
+#include <fstream>
+#include <thread>
 #include <unordered_map>
 
 #include "database.h"
 #include "logger.h"
 #include "market_data.h"
+#include "memory.h"
+#include "tick_file.h"
 
 namespace opentrade {
 
@@ -25,7 +35,20 @@ std::string Exchange::ParseTickSizeTable(const std::string& str) {
     if (!tmp->empty()) {
       tmp->shrink_to_fit();
       std::sort(tmp->begin(), tmp->end());
-      tick_size_table_.store(tmp, boost::memory_order_release);
+      tick_size_table_.store(tmp);
+      TickLadder* ladder = nullptr;
+      if (tmp->size() <= TickLadder::kMaxBands) {
+        ladder = new TickLadder;
+        for (auto i = 0; i < TickLadder::kMaxBands; ++i) {
+          auto in = i < static_cast<int>(tmp->size());
+          ladder->lower[i] = in ? (*tmp)[i].lower_bound
+                                : std::numeric_limits<double>::infinity();
+          ladder->value[i] = in ? (*tmp)[i].value : 0;
+        }
+        ladder->value[TickLadder::kMaxBands] = 0;
+        tick_ladders_.emplace_back(ladder);
+      }
+      tick_ladder_.store(ladder, std::memory_order_release);
     }
   }
   return {};
@@ -98,7 +121,7 @@ std::string Exchange::ParseHalfDays(const std::string& str) {
     if (tmp->empty()) {
       return "Invalid half days format, expect '<YYYmmdd>[,;<new line>]...'";
     }
-    half_days_.store(tmp, boost::memory_order_release);
+    half_days_.store(tmp);
   }
   return {};
 }
@@ -142,106 +165,359 @@ std::string Exchange::GetHalfDayString() const {
   return buf;
 }
 
+static const fs::path kSnapshotPath = kStorePath / "securities";
+static const uint32_t kSnapshotVersion = 1;
+
+// Snapshot: "OTSM" string, version, fingerprint, exchange and security counts,
+// then every column value in the order LoadExchange/LoadSecurity read them,
+// numbers raw and strings prefixed by their uint32 length.
+struct SnapshotWriter {
+  std::string buf;
+  template <typename T>
+  void Write(const T& v) {
+    if constexpr (std::is_same_v<T, std::string>) {
+      Write(static_cast<uint32_t>(v.size()));
+      buf.append(v);
+    } else {
+      buf.append(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+  }
+};
+
+struct DatabaseRow {
+  const soci::row& row;
+  SnapshotWriter* out;
+  int i = 0;
+  template <typename T>
+  T Get(T default_value) {
+    auto v = Database::GetValue(row, i++, default_value);
+    out->Write(v);
+    return v;
+  }
+};
+
+struct SnapshotRow {
+  const char* p;
+  const char* end;
+  bool ok = true;
+  template <typename T>
+  T Get(T default_value) {
+    if constexpr (std::is_same_v<T, std::string>) {
+      auto n = Get<uint32_t>(0);
+      if (!ok || end - p < n) {
+        ok = false;
+        return default_value;
+      }
+      std::string v(p, n);
+      p += n;
+      return v;
+    } else {
+      if (end - p < static_cast<ssize_t>(sizeof(T))) {
+        ok = false;
+        return default_value;
+      }
+      T v;
+      memcpy(&v, p, sizeof(T));
+      p += sizeof(T);
+      return v;
+    }
+  }
+};
+
 void SecurityManager::Initialize() {
   auto& self = Instance();
+  MemoryAccounting::Instance().AddReporter("securities", [&self]() {
+    auto u = MemoryAccounting::OfMap(self.securities_);
+    u.bytes += u.objects * sizeof(Security);
+    return u;
+  });
+#ifndef BACKTEST
+  self.change_seq_ = GetChangeSeq();
+  if (self.LoadSnapshot(GetFingerprint())) {
+    // catch up with in place edits in the background
+    kDatabaseTaskPool.AddTask([&self]() { self.LoadFromDatabase(); });
+    return;
+  }
+#endif
   self.LoadFromDatabase();
 }
 
-void SecurityManager::LoadFromDatabase() {
+std::string SecurityManager::GetFingerprint() {
   auto sql = Database::Session();
+  std::string out;
+  for (auto table : {"exchange", "security"}) {
+    std::string v;
+    *sql << "select cast(count(*) as varchar(32)) || ',' || "
+            "cast(coalesce(max(id), 0) as varchar(32)) from "
+         << table,
+        soci::into(v);
+    out += v + ';';
+  }
+  return out;
+}
 
-  auto query = R"(
-    select id, "name", mic, params, country, ib_name, bb_name, tz, tick_size_table, 
-    odd_lot_allowed, trade_period, break_period, half_day, half_days from exchange
-  )";
-  soci::rowset<soci::row> st = sql->prepare << query;
-  for (auto it = st.begin(); it != st.end(); ++it) {
-    auto i = 0;
-    auto id = Database::GetValue(*it, i++, 0);
-    auto eit = exchanges_.find(id);
-    auto e = (exchanges_.end() == eit) ? new Exchange() : eit->second;
-    e->id = id;
-    e->name = Database::GetValue(*it, i++, "");
-    e->mic = Database::GetValue(*it, i++, "");
-    e->SetParams(Database::GetValue(*it, i++, kEmptyStr));
-    e->country = Database::GetValue(*it, i++, "");
-    e->ib_name = Database::GetValue(*it, i++, "");
-    e->bb_name = Database::GetValue(*it, i++, "");
-    e->tz = Database::GetValue(*it, i++, "");
-    if (*e->tz) e->utc_time_offset = GetUtcTimeOffset(e->tz);
-    e->ParseTickSizeTable(Database::GetValue(*it, i++, kEmptyStr));
-    e->odd_lot_allowed = Database::GetValue(*it, i++, 0);
-    e->ParseTradePeriod(Database::GetValue(*it, i++, kEmptyStr));
-    e->ParseBreakPeriod(Database::GetValue(*it, i++, kEmptyStr));
-    e->ParseHalfDay(Database::GetValue(*it, i++, kEmptyStr));
-    e->ParseHalfDays(Database::GetValue(*it, i++, kEmptyStr));
-
-    std::atomic_thread_fence(std::memory_order_release);
-    exchanges_.emplace(e->id, e);
-    exchange_of_name_.emplace(e->name, e);
+bool SecurityManager::LoadSnapshot(const std::string& fingerprint) {
+  boost::iostreams::mapped_file_source file;
+  try {
+    if (!fs::exists(kSnapshotPath)) return false;
+    file.open(kSnapshotPath.string());
+  } catch (const std::exception& e) {
+    LOG_WARN("Failed to open security snapshot: " << e.what());
+    return false;
+  }
+  SnapshotRow row{file.data(), file.data() + file.size()};
+  auto magic = row.Get(kEmptyStr);
+  auto version = row.Get<uint32_t>(0);
+  if (magic != "OTSM" || version != kSnapshotVersion ||
+      row.Get(kEmptyStr) != fingerprint) {
+    LOG_INFO("Security snapshot out of date");
+    return false;
   }
+  auto num_exchanges = row.Get<uint32_t>(0);
+  auto num_securities = row.Get<uint32_t>(0);
+  for (auto i = 0u; i < num_exchanges && row.ok; ++i) LoadExchange(&row);
+  std::unordered_map<Security*, Security::IdType> underlying;
+  for (auto i = 0u; i < num_securities && row.ok; ++i)
+    LoadSecurity(&row, &underlying);
+  if (!row.ok) {
+    LOG_ERROR("Corrupted security snapshot, loading from database");
+    return false;
+  }
+  for (auto& pair : underlying) {
+    auto it = securities_.find(pair.second);
+    if (it != securities_.end()) pair.first->underlying = it->second;
+  }
+  LOG_INFO(securities_.size() << " securities loaded from snapshot");
+  UpdateCheckSum();
+  return true;
+}
 
-  std::unordered_map<Security*, Security::IdType> underlying_map;
-  query = R"(
+template <typename Row>
+void SecurityManager::LoadExchange(Row* row) {
+  auto id = row->Get(0);
+  auto eit = exchanges_.find(id);
+  auto e = (exchanges_.end() == eit) ? new Exchange() : eit->second;
+  auto str = [&](const char* old) {
+    return strings_.Update(old, row->Get(kEmptyStr));
+  };
+  e->id = id;
+  e->name = str(e->name);
+  e->mic = str(e->mic);
+  e->SetParams(row->Get(kEmptyStr));
+  e->country = str(e->country);
+  e->ib_name = str(e->ib_name);
+  e->bb_name = str(e->bb_name);
+  e->tz = str(e->tz);
+  if (*e->tz) e->utc_time_offset = GetUtcTimeOffset(e->tz);
+  e->ParseTickSizeTable(row->Get(kEmptyStr));
+  e->odd_lot_allowed = row->Get(0);
+  e->ParseTradePeriod(row->Get(kEmptyStr));
+  e->ParseBreakPeriod(row->Get(kEmptyStr));
+  e->ParseHalfDay(row->Get(kEmptyStr));
+  e->ParseHalfDays(row->Get(kEmptyStr));
+
+  std::atomic_thread_fence(std::memory_order_release);
+  exchanges_.emplace(e->id, e);
+  exchange_of_name_.emplace(e->name, e);
+}
+
+template <typename Row>
+Security* SecurityManager::LoadSecurity(
+    Row* row, std::unordered_map<Security*, Security::IdType>* underlying) {
+  auto id = row->Get(0);
+  auto sit = securities_.find(id);
+  auto s = (securities_.end() == sit) ? new Security() : sit->second;
+  s->id = id;
+  auto str = [&](const char* old) {
+    return strings_.Update(old, row->Get(kEmptyStr));
+  };
+  s->symbol = str(s->symbol);
+  s->local_symbol = str(s->local_symbol);
+  s->type = str(s->type);
+  s->currency = str(s->currency);
+  auto exchange_id = row->Get(0);
+  auto ex_it = exchanges_.find(exchange_id);
+  if (ex_it != exchanges_.end()) {
+    s->exchange = ex_it->second;
+  }
+  auto underlying_id = row->Get(Security::IdType());
+  if (underlying_id > 0) {
+    (*underlying)[s] = underlying_id;
+  }
+  s->rate = row->Get(s->rate);
+  if (s->rate > 0 && *s->currency) rates_[s->currency] = s->rate;
+  if (s->rate <= 0) s->rate = 1;
+  s->multiplier = row->Get(s->multiplier);
+  if (s->multiplier <= 0) s->multiplier = 1;
+  s->tick_size = row->Get(s->tick_size);
+  s->lot_size = row->Get(s->lot_size);
+  s->close_price = row->Get(s->close_price);
+  s->strike_price = row->Get(s->strike_price);
+  s->maturity_date = row->Get(s->maturity_date);
+  s->put_or_call = row->Get(0);
+  auto opt_attribute = row->Get(kEmptyStr);
+  if (!opt_attribute.empty()) s->opt_attribute = opt_attribute.at(0);
+  s->bbgid = str(s->bbgid);
+  s->cusip = str(s->cusip);
+  s->isin = str(s->isin);
+  s->sedol = str(s->sedol);
+  s->ric = str(s->ric);
+  s->adv20 = row->Get(0.);
+  s->market_cap = row->Get(0.);
+  s->sector = row->Get(0);
+  s->industry_group = row->Get(0);
+  s->industry = row->Get(0);
+  s->sub_industry = row->Get(0);
+  s->SetParams(row->Get(kEmptyStr));
+  std::atomic_thread_fence(std::memory_order_release);
+  securities_.emplace(s->id, s);
+  hot_.Set(*s);
+  if (s->exchange) {
+    const_cast<Exchange*>(s->exchange)->security_of_name.emplace(s->symbol, s);
+    security_of_name_.emplace(s->symbol + std::string(" ") + s->exchange->name,
+                              s);
+  }
+  return s;
+}
+
+static const char* kSecuritySelect = R"(
     select id, symbol, local_symbol, type, currency, exchange_id, underlying_id, rate,
            multiplier, tick_size, lot_size, close_price, strike_price, maturity_date,
            put_or_call, opt_attribute, bbgid, cusip, isin, sedol, ric,
            adv20, market_cap, sector, industry_group, industry, sub_industry, params
     from security
   )";
-  st = sql->prepare << query;
-  for (auto it = st.begin(); it != st.end(); ++it) {
-    auto i = 0;
-    auto id = Database::GetValue(*it, i++, 0);
-    auto sit = securities_.find(id);
-    auto s = (securities_.end() == sit) ? new Security() : sit->second;
-    s->id = id;
-    s->symbol = Database::GetValue(*it, i++, "");
-    s->local_symbol = Database::GetValue(*it, i++, "");
-    s->type = Database::GetValue(*it, i++, "");
-    s->currency = Database::GetValue(*it, i++, "");
-    auto exchange_id = Database::GetValue(*it, i++, 0);
-    auto ex_it = exchanges_.find(exchange_id);
-    if (ex_it != exchanges_.end()) {
-      s->exchange = ex_it->second;
+
+int64_t SecurityManager::GetChangeSeq() {
+  std::string v;
+  try {
+    *Database::Session()
+        << "select cast(coalesce(max(seq), 0) as varchar(32)) from "
+           "security_change",
+        soci::into(v);
+  } catch (const soci::soci_error& e) {
+    return 0;
+  }
+  return atoll(v.c_str());
+}
+
+std::vector<const Security*> SecurityManager::LoadChanged() {
+  std::vector<const Security*> out;
+  std::lock_guard<std::mutex> lock(m_);
+  auto sql = Database::Session();
+  std::vector<Security::IdType> ids;
+  auto seq = change_seq_;
+  try {
+    std::stringstream ss;
+    ss << "select security_id, cast(seq as varchar(32)) from security_change "
+          "where seq > "
+       << change_seq_;
+    soci::rowset<soci::row> st = sql->prepare << ss.str();
+    for (auto it = st.begin(); it != st.end(); ++it) {
+      ids.push_back(Database::GetValue(*it, 0, 0));
+      auto v = Database::GetValue(*it, 1, kEmptyStr);
+      seq = std::max<int64_t>(seq, atoll(v.c_str()));
     }
-    auto underlying_id = Database::GetValue(*it, i++, Security::IdType());
-    if (underlying_id > 0) {
-      underlying_map[s] = underlying_id;
+  } catch (const soci::soci_error& e) {
+    LOG_ERROR("Failed to read security_change: " << e.what());
+    return out;
+  }
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  std::unordered_map<Security*, Security::IdType> underlying_map;
+  SnapshotWriter discard;
+  static const size_t kBatch = 1000;
+  for (auto i = 0u; i < ids.size(); i += kBatch) {
+    std::stringstream ss;
+    ss << kSecuritySelect << " where id in (";
+    for (auto j = i; j < std::min(ids.size(), i + kBatch); ++j)
+      ss << (j > i ? "," : "") << ids[j];
+    ss << ')';
+    soci::rowset<soci::row> st = sql->prepare << ss.str();
+    for (auto it = st.begin(); it != st.end(); ++it) {
+      DatabaseRow row{*it, &discard};
+      out.push_back(LoadSecurity(&row, &underlying_map));
+      discard.buf.clear();
     }
-    s->rate = Database::GetValue(*it, i++, s->rate);
-    if (s->rate > 0 && *s->currency) rates_[s->currency] = s->rate;
-    if (s->rate <= 0) s->rate = 1;
-    s->multiplier = Database::GetValue(*it, i++, s->multiplier);
-    if (s->multiplier <= 0) s->multiplier = 1;
-    s->tick_size = Database::GetValue(*it, i++, s->tick_size);
-    s->lot_size = Database::GetValue(*it, i++, s->lot_size);
-    s->close_price = Database::GetValue(*it, i++, s->close_price);
-    s->strike_price = Database::GetValue(*it, i++, s->strike_price);
-    s->maturity_date = Database::GetValue(*it, i++, s->maturity_date);
-    s->put_or_call = Database::GetValue(*it, i++, 0);
-    auto opt_attribute = Database::GetValue(*it, i++, kEmptyStr);
-    if (!opt_attribute.empty()) s->opt_attribute = opt_attribute.at(0);
-    s->bbgid = Database::GetValue(*it, i++, "");
-    s->cusip = Database::GetValue(*it, i++, "");
-    s->isin = Database::GetValue(*it, i++, "");
-    s->sedol = Database::GetValue(*it, i++, "");
-    s->ric = Database::GetValue(*it, i++, "");
-    s->adv20 = Database::GetValue(*it, i++, 0.);
-    s->market_cap = Database::GetValue(*it, i++, 0.);
-    s->sector = Database::GetValue(*it, i++, 0);
-    s->industry_group = Database::GetValue(*it, i++, 0);
-    s->industry = Database::GetValue(*it, i++, 0);
-    s->sub_industry = Database::GetValue(*it, i++, 0);
-    s->SetParams(Database::GetValue(*it, i++, kEmptyStr));
-    std::atomic_thread_fence(std::memory_order_release);
-    securities_.emplace(s->id, s);
-    if (s->exchange) {
-      const_cast<Exchange*>(s->exchange)
-          ->security_of_name.emplace(s->symbol, s);
-      security_of_name_.emplace(
-          s->symbol + std::string(" ") + s->exchange->name, s);
+  }
+  for (auto& pair : underlying_map) {
+    auto it = securities_.find(pair.second);
+    if (it != securities_.end()) pair.first->underlying = it->second;
+  }
+  change_seq_ = seq;
+  if (out.empty()) return out;
+  LOG_INFO(out.size() << " securities reloaded");
+  UpdateCheckSum();
+  for (auto& func : listeners_) func(out);
+  return out;
+}
+
+void SecurityManager::WatchChanges(std::function<void()> func) {
+  if (Database::is_sqlite()) return;
+  std::thread([this, func]() {
+    for (;;) {
+      auto conn = PQconnectdb(Database::url().c_str());
+      auto res = PQstatus(conn) == CONNECTION_OK
+                     ? PQexec(conn, (std::string("listen ") + kChangeChannel)
+                                        .c_str())
+                     : nullptr;
+      if (PQresultStatus(res) == PGRES_COMMAND_OK) {
+        LOG_INFO("Listening on " << kChangeChannel);
+        PQclear(res);
+        // the changes while not listening
+        auto changed = true;
+        for (auto fd = PQsocket(conn); fd >= 0;) {
+          if (changed && !LoadChanged().empty()) func();
+          changed = false;
+          pollfd pfd{fd, POLLIN, 0};
+          if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+          }
+          if (!PQconsumeInput(conn)) break;
+          while (auto note = PQnotifies(conn)) {
+            PQfreemem(note);
+            changed = true;
+          }
+        }
+      } else {
+        PQclear(res);
+      }
+      LOG_ERROR("Failed to listen on " << kChangeChannel << ": "
+                                       << PQerrorMessage(conn));
+      PQfinish(conn);
+      std::this_thread::sleep_for(std::chrono::seconds(5));
     }
+  }).detach();
+}
+
+void SecurityManager::LoadFromDatabase() {
+  std::lock_guard<std::mutex> lock(m_);
+  change_seq_ = GetChangeSeq();
+  auto fingerprint = GetFingerprint();
+  auto sql = Database::Session();
+  SnapshotWriter exchanges;
+  SnapshotWriter securities;
+  uint32_t num_exchanges = 0;
+  uint32_t num_securities = 0;
+
+  auto query = R"(
+    select id, "name", mic, params, country, ib_name, bb_name, tz, tick_size_table, 
+    odd_lot_allowed, trade_period, break_period, half_day, half_days from exchange
+  )";
+  soci::rowset<soci::row> st = sql->prepare << query;
+  for (auto it = st.begin(); it != st.end(); ++it) {
+    DatabaseRow row{*it, &exchanges};
+    LoadExchange(&row);
+    num_exchanges++;
+  }
+
+  std::unordered_map<Security*, Security::IdType> underlying_map;
+  st = sql->prepare << kSecuritySelect;
+  for (auto it = st.begin(); it != st.end(); ++it) {
+    DatabaseRow row{*it, &securities};
+    LoadSecurity(&row, &underlying_map);
+    num_securities++;
   }
   LOG_INFO(securities_.size() << " securities loaded");
   for (auto& pair : underlying_map) {
@@ -249,6 +525,23 @@ void SecurityManager::LoadFromDatabase() {
     if (it != securities_.end()) pair.first->underlying = it->second;
   }
   UpdateCheckSum();
+
+#ifndef BACKTEST
+  SnapshotWriter header;
+  header.Write(std::string("OTSM"));
+  header.Write(kSnapshotVersion);
+  header.Write(fingerprint);
+  header.Write(num_exchanges);
+  header.Write(num_securities);
+  auto tmp = kSnapshotPath.string() + ".tmp";
+  std::ofstream of(tmp, std::ios::binary);
+  of << header.buf << exchanges.buf << securities.buf;
+  of.close();
+  if (of.good())
+    fs::rename(tmp, kSnapshotPath);
+  else
+    LOG_WARN("Failed to write security snapshot " << tmp);
+#endif
 }
 
 void SecurityManager::UpdateCheckSum() {
@@ -260,6 +553,26 @@ void SecurityManager::UpdateCheckSum() {
        << s->multiplier << s->currency;
   }
   check_sum_ = strdup(sha1(ss.str()).c_str());
+  version_++;
+}
+
+void SecurityManager::SetClosePrice(Security::IdType id, double px) {
+  auto it = securities_.find(id);
+  if (it == securities_.end()) return;
+  it->second->close_price = px;
+  hot_.Set(*it->second);
+}
+
+void SecurityManager::SetRate(Security::IdType id, double rate) {
+  auto it = securities_.find(id);
+  if (it == securities_.end()) return;
+  auto s = it->second;
+  s->rate = rate;
+  // the segment of a loaded security exists, so only the rate is written
+  auto h = const_cast<HotSecurity*>(hot_.Get(id));
+  if (h) h->rate = rate;
+  auto it2 = rates_.find(s->currency);
+  if (it2 != rates_.end()) it2->second = rate;
 }
 
 double Security::CurrentPrice() const {
@@ -267,7 +580,20 @@ double Security::CurrentPrice() const {
   return px > 0 ? px : close_price;
 }
 
-double Exchange::GetTickSize(double ref) const {
+FixedScale Security::price_scale() const {
+  if (tick_size > 0) return FixedScale::Of(tick_size);
+  if (!exchange) return FixedScale();
+  auto table = exchange->tick_size_table();
+  if (!table || table->empty()) return FixedScale();
+  FixedScale scale(0);
+  for (auto& t : *table) {
+    auto s = FixedScale::Of(t.value, FixedScale::kMaxDecimals);
+    if (s.decimals() > scale.decimals()) scale = s;
+  }
+  return scale;
+}
+
+double Exchange::GetTickSizeFromTable(double ref) const {
   auto table = tick_size_table();
   if (!table) return 0;
   TickSizeTuple t{ref};
@@ -278,23 +604,19 @@ double Exchange::GetTickSize(double ref) const {
 
 std::vector<const Security*> SecurityManager::GetSecurities(
     std::basic_istream<char>* ifs, const char* fn, bool* binary,
-    const std::set<std::string>& used_symbols) {
-  std::string line;
-  if (!std::getline(*ifs, line)) {
+    const std::set<std::string>& used_symbols, std::string* format) {
+  TickFileHeader h;
+  if (!ReadTickFileHeader(ifs, &h)) {
     LOG_FATAL("Invalid file: " << fn);
   }
-  char a[256];
-  *a = 0;
-  char b[256];
-  *b = 0;
-  char c[256];
-  *c = 0;
   std::vector<const Security*> out;
-  if (sscanf(line.c_str(), "%s %s %s", a, b, c) < 2 ||
-      strcasecmp(a, "@begin")) {
-    LOG_FATAL("Invalid file: " << fn);
+  *binary = h.format != TickFileHeader::kText;
+  if (format) {
+    *format = h.format == TickFileHeader::kColumnar
+                  ? "columnar"
+                  : h.format == TickFileHeader::kIndexed ? "indexed" : "";
   }
-  *binary = !strncasecmp(c, "bin", 3);
+  auto b = h.id_type.c_str();
   std::unordered_map<std::string, const Security*> sec_map;
   if (!strcasecmp(b, "bbgid")) {
     for (auto& pair : securities()) {
@@ -331,8 +653,7 @@ std::vector<const Security*> SecurityManager::GetSecurities(
     LOG_FATAL("Invalid file: " << fn);
   }
 
-  while (std::getline(*ifs, line)) {
-    if (!strcasecmp(line.c_str(), "@end")) break;
+  for (auto& line : h.symbols) {
     auto sec = sec_map[line];
     if (!sec) {
       LOG_ERROR("Unknown security on line " << line << " of " << fn);
@@ -2,10 +2,19 @@
 #define OPENTRADE_SECURITY_H_
 
 #include <tbb/concurrent_unordered_map.h>
+#include <atomic>
+#include <cstdlib>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_set>
+#include <vector>
 
 #include "common.h"
+#include "fixed_point.h"
 #include "utility.h"
 
 namespace opentrade {
@@ -33,19 +42,33 @@ struct Exchange : public ParamsBase {
   };
   typedef std::vector<TickSizeTuple> TickSizeTable;
   typedef boost::shared_ptr<const TickSizeTable> TickSizeTablePtr;
-  TickSizeTablePtr tick_size_table() const {
-    return tick_size_table_.load(boost::memory_order_relaxed);
+  RcuSnapshot<TickSizeTable> tick_size_table() const {
+    return tick_size_table_.load();
+  }
+  // tick_size_table compiled for GetTickSize, the bands padded with
+  // infinite lower bounds to kMaxBands and the value after them 0
+  struct TickLadder {
+    static inline const int kMaxBands = 8;
+    double lower[kMaxBands];
+    double value[kMaxBands + 1];
+  };
+  // value of the first band whose lower bound is not below ref, counted
+  // without branches on the ladder if the table has at most kMaxBands
+  double GetTickSize(double ref) const {
+    auto ladder = tick_ladder_.load(std::memory_order_acquire);
+    if (!ladder) return GetTickSizeFromTable(ref);
+    auto n = 0;
+    for (auto i = 0; i < TickLadder::kMaxBands; ++i)
+      n += ladder->lower[i] < ref;
+    return ladder->value[n];
   }
-  double GetTickSize(double ref) const;
   int trade_start = 0;  // seconds since midnight
   int break_start = 0;
   int break_end = 0;
   int half_day = 0;
   typedef std::unordered_set<int> HalfDays;
   typedef boost::shared_ptr<const HalfDays> HalfDaysPtr;
-  HalfDaysPtr half_days() const {
-    return half_days_.load(boost::memory_order_relaxed);
-  }
+  RcuSnapshot<HalfDays> half_days() const { return half_days_.load(); }
 
   int GetSeconds(
       time_t tm = 0) const {  // seconds since midnight in exchange time zone
@@ -92,9 +115,14 @@ struct Exchange : public ParamsBase {
   std::string GetHalfDayString() const;
 
  private:
+  double GetTickSizeFromTable(double ref) const;
+
   int trade_end_ = 0;
-  boost::atomic_shared_ptr<const TickSizeTable> tick_size_table_;
-  boost::atomic_shared_ptr<const HalfDays> half_days_;
+  RcuPtr<TickSizeTable> tick_size_table_;
+  std::atomic<const TickLadder*> tick_ladder_ = nullptr;
+  // kept alive for readers of a replaced ladder
+  std::vector<std::unique_ptr<TickLadder>> tick_ladders_;
+  RcuPtr<HalfDays> half_days_;
 };
 
 // follow IB
@@ -147,6 +175,18 @@ struct Security : public ParamsBase {
     if (tick_size > 0) return tick_size;
     return exchange->GetTickSize(px);
   }
+  // to the tick below for buy and above for sell
+  double RoundPrice(double px, bool buy) const {
+    auto tick = GetTickSize(px);
+    if (tick > 0) {
+      px = (buy ? std::floor(px / tick) : std::ceil(px / tick)) * tick;
+      return FixedScale::Of(tick).Round(px);
+    }
+    return px > 100 ? Round6(px) : Round8(px);
+  }
+  // of the tick size, or of the finest band of the exchange's tick size
+  // table, kPriceDecimals if neither
+  FixedScale price_scale() const;
   bool IsInTradePeriod() const { return exchange->IsInTradePeriod(); }
 #ifdef BACKTEST
   struct Adj {
@@ -161,13 +201,108 @@ struct Security : public ParamsBase {
 #endif
 };
 
+// Fields of a security hit on every order and tick, one cache line each,
+// copied from Security on load.
+struct alignas(64) HotSecurity {
+  std::atomic<const Security*> sec = nullptr;
+  const Exchange* exchange = nullptr;
+  double tick_size = 0;
+  double multiplier = 1;
+  double rate = 1;
+  double close_price = 0;
+  double adv20 = 0;
+  int lot_size = 0;
+};
+static_assert(sizeof(HotSecurity) == 64, "HotSecurity not one cache line");
+
+// Append-only two-level table indexed by security id, a lookup is two loads
+// without hashing. Segments are allocated on first use of their id range.
+class SecurityTable {
+ public:
+  SecurityTable() {
+    dir_ = static_cast<std::atomic<HotSecurity*>*>(
+        calloc(kDirSize, sizeof(std::atomic<HotSecurity*>)));
+  }
+  const HotSecurity* Get(Security::IdType id) const {
+    auto seg = dir_[id >> kBits].load(std::memory_order_acquire);
+    if (!seg) return nullptr;
+    auto& h = seg[id & kMask];
+    return h.sec.load(std::memory_order_acquire) ? &h : nullptr;
+  }
+  // single writer
+  HotSecurity* Set(const Security& s) {
+    auto& d = dir_[s.id >> kBits];
+    auto seg = d.load(std::memory_order_relaxed);
+    if (!seg) {
+      seg = new HotSecurity[kSize];
+      d.store(seg, std::memory_order_release);
+    }
+    auto& h = seg[s.id & kMask];
+    h.exchange = s.exchange;
+    h.tick_size = s.tick_size;
+    h.multiplier = s.multiplier;
+    h.rate = s.rate;
+    h.close_price = s.close_price;
+    h.adv20 = s.adv20;
+    h.lot_size = s.lot_size;
+    h.sec.store(&s, std::memory_order_release);
+    return &h;
+  }
+
+ private:
+  static inline const uint32_t kBits = 12;
+  static inline const uint32_t kSize = 1 << kBits;
+  static inline const uint32_t kMask = kSize - 1;
+  static inline const uint32_t kDirSize = 1 << (32 - kBits);
+  std::atomic<HotSecurity*>* dir_ = nullptr;
+};
+
+// Identifiers of the security master packed in large chunks rather than one
+// heap block each, never freed as they are referenced by Security.
+class StringArena {
+ public:
+  const char* Add(const std::string& str) {
+    std::lock_guard<std::mutex> lock(m_);
+    auto n = str.size() + 1;
+    if (n > kChunkSize) return strdup(str.c_str());
+    if (!chunk_ || used_ + n > kChunkSize) {
+      chunk_ = static_cast<char*>(malloc(kChunkSize));
+      used_ = 0;
+    }
+    auto out = chunk_ + used_;
+    memcpy(out, str.c_str(), n);
+    used_ += n;
+    return out;
+  }
+  // str unchanged keeps old so that reloads do not grow the arena
+  const char* Update(const char* old, const std::string& str) {
+    if (old && str == old) return old;
+    return str.empty() ? "" : Add(str);
+  }
+
+ private:
+  static inline const size_t kChunkSize = 1 << 16;
+  char* chunk_ = nullptr;
+  size_t used_ = 0;
+  std::mutex m_;
+};
+
 class SecurityManager : public Singleton<SecurityManager> {
  public:
   static void Initialize();
   const char* check_sum() const { return check_sum_; }
+  // bumped on every load
+  uint32_t version() const { return version_; }
   const Security* Get(Security::IdType id) const {
-    return FindInMap(securities_, id);
+    auto h = hot_.Get(id);
+    return h ? h->sec.load(std::memory_order_relaxed) : nullptr;
   }
+  const HotSecurity* GetHot(Security::IdType id) const { return hot_.Get(id); }
+  // e.g. the last close of a backtest day
+  void SetClosePrice(Security::IdType id, double px);
+  // the live currency rate, see FxRateManager, of a security loaded, not
+  // locking the loads, which may call it from their listeners
+  void SetRate(Security::IdType id, double rate);
   const Exchange* GetExchange(Exchange::IdType id) const {
     return FindInMap(exchanges_, id);
   }
@@ -186,14 +321,32 @@ class SecurityManager : public Singleton<SecurityManager> {
 
   std::vector<const Security*> GetSecurities(
       std::basic_istream<char>* ifs, const char* fn, bool* binary,
-      const std::set<std::string>& used_symbols = {});
+      const std::set<std::string>& used_symbols = {},
+      std::string* format = nullptr);
 
   typedef tbb::concurrent_unordered_map<Security::IdType, Security*>
       SecurityMap;
   typedef tbb::concurrent_unordered_map<std::string, Security*>
       SecurityOfNameMap;
   const SecurityMap& securities() const { return securities_; }
+  // also writes the snapshot file for the next start
   void LoadFromDatabase();
+  // Reloads only the securities logged in security_change since the last
+  // load, new listings included, and notifies the listeners if any. The
+  // Security objects are updated in place, their pointers are held all
+  // over, as in LoadFromDatabase.
+  std::vector<const Security*> LoadChanged();
+  // Listens on kChangeChannel of a dedicated postgres connection, notified
+  // e.g. by the security_import tool, and calls LoadChanged on every
+  // notification, func after one reloading any, reconnecting on failure.
+  // Nothing for sqlite.
+  void WatchChanges(std::function<void()> func);
+  static inline const char* kChangeChannel = "opentrade_security";
+  typedef std::function<void(const std::vector<const Security*>&)> Listener;
+  void AddListener(Listener func) {
+    std::lock_guard<std::mutex> lock(m_);
+    listeners_.push_back(func);
+  }
   typedef tbb::concurrent_unordered_map<Exchange::IdType, Exchange*>
       ExchangeMap;
   const ExchangeMap& exchanges() const { return exchanges_; }
@@ -201,13 +354,30 @@ class SecurityManager : public Singleton<SecurityManager> {
 
  protected:
   void UpdateCheckSum();
+  // the rows from the database or replayed from the snapshot
+  template <typename Row>
+  void LoadExchange(Row* row);
+  template <typename Row>
+  Security* LoadSecurity(
+      Row* row, std::unordered_map<Security*, Security::IdType>* underlying);
+  // "<count>,<max id>" of the exchange and security tables
+  static std::string GetFingerprint();
+  bool LoadSnapshot(const std::string& fingerprint);
+  // max seq of security_change, 0 if no such table
+  static int64_t GetChangeSeq();
 
  private:
   ExchangeMap exchanges_;
   tbb::concurrent_unordered_map<std::string, Exchange*> exchange_of_name_;
   SecurityMap securities_;
+  SecurityTable hot_;
+  StringArena strings_;
+  int64_t change_seq_ = 0;
+  std::vector<Listener> listeners_;
+  std::mutex m_;  // loads and listeners_
   SecurityOfNameMap security_of_name_;
   const char* check_sum_ = "";
+  std::atomic<uint32_t> version_ = 0;
   friend class Connection;
   std::unordered_map<std::string, double> rates_;
 };
@@ -1,16 +1,28 @@
 #include "server.h"
 
+#include <zlib.h>
+#ifdef OPENTRADE_BROTLI
+#include <brotli/encode.h>
+#endif
 #include <boost/asio.hpp>
 #include <boost/filesystem.hpp>
+#include <algorithm>
+#include <atomic>
 #include <exception>
 #include <fstream>
+#include <memory>
 #include <mutex>
+#include <regex>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "3rd/simple_web_server/server_http.hpp"
 #include "3rd/simple_websocket_server/server_ws.hpp"
 #include "connection.h"
 #include "logger.h"
+#include "metrics.h"
+#include "thread_placement.h"
 
 namespace opentrade {
 
@@ -23,34 +35,324 @@ typedef std::lock_guard<std::mutex> LockGuard;
 
 static HttpServer kHttpServer;
 static WsServer kWsServer;
-static std::unordered_map<WsConnPtr, Connection::Ptr> kSocketMap;
-static std::mutex kMutex;
 static auto kIoService = std::make_shared<boost::asio::io_service>();
 
+// Connections sharded by socket, so that fan-outs of different shards run
+// in parallel on the io threads and do not contend on one mutex.
+static const size_t kShards = 16;
+struct alignas(64) SocketShard {
+  std::mutex m;
+  std::unordered_map<WsConnPtr, Connection::Ptr> sockets;
+};
+static SocketShard kSocketShards[kShards];
+
+static SocketShard& GetShard(const WsConnPtr& connection) {
+  return kSocketShards[std::hash<WsConnPtr>()(connection) % kShards];
+}
+
+// post func(shard) per shard
+template <typename Func>
+static void ForEachShard(Func func) {
+  for (auto& shard : kSocketShards) {
+    kIoService->post([&shard, func]() {
+      LockGuard lock(shard.m);
+      func(shard);
+    });
+  }
+}
+
+// bumped when a connection opens or closes
+static std::atomic<uint32_t> kSocketsVersion = 0;
+
 void Close(WsConnPtr connection) {
-  LockGuard lock(kMutex);
-  auto it = kSocketMap.find(connection);
-  if (it == kSocketMap.end()) return;
+  auto& shard = GetShard(connection);
+  LockGuard lock(shard.m);
+  auto it = shard.sockets.find(connection);
+  if (it == shard.sockets.end()) return;
   it->second->Close();
-  kSocketMap.erase(it);
+  shard.sockets.erase(it);
+  kSocketsVersion++;
+}
+
+// Connections entitled to the confirmations of each sub account, so a fill
+// only visits the sessions that may see it. Rebuilt when connections come
+// and go or sub accounts of users change, connections not yet logged in at
+// the last build are rechecked on every use.
+class ConfirmationIndex {
+ public:
+  template <typename Func>
+  void ForEach(SubAccount::IdType acc, Func func) {
+    LockGuard lock(m_);
+    if (sockets_version_ != kSocketsVersion ||
+        sub_accounts_version_ != User::sub_accounts_version()) {
+      Build();
+    } else {
+      for (auto& p : pending_) {
+        if (p->user()) {
+          Build();
+          break;
+        }
+      }
+    }
+    for (auto& p : admins_) func(p);
+    auto it = by_sub_account_.find(acc);
+    if (it == by_sub_account_.end()) return;
+    for (auto& p : it->second) func(p);
+  }
+
+ private:
+  void Build() {
+    sockets_version_ = kSocketsVersion;
+    sub_accounts_version_ = User::sub_accounts_version();
+    admins_.clear();
+    pending_.clear();
+    by_sub_account_.clear();
+    for (auto& shard : kSocketShards) {
+      LockGuard lock(shard.m);
+      for (auto& pair : shard.sockets) {
+        auto& p = pair.second;
+        auto user = p->user();
+        if (!user) {
+          pending_.push_back(p);
+        } else if (user->is_admin) {
+          admins_.push_back(p);
+        } else {
+          auto accs = user->sub_accounts();
+          for (auto& pair2 : *accs)
+            by_sub_account_[pair2.first].push_back(p);
+        }
+      }
+    }
+  }
+
+  std::mutex m_;
+  uint32_t sockets_version_ = -1;
+  uint32_t sub_accounts_version_ = -1;
+  std::vector<Connection::Ptr> admins_;
+  std::vector<Connection::Ptr> pending_;
+  std::unordered_map<SubAccount::IdType, std::vector<Connection::Ptr>>
+      by_sub_account_;
+};
+
+static ConfirmationIndex kConfirmationIndex;
+
+// permessage-deflate (RFC 7692) of the first acceptable offer of the
+// handshake; the server keeps its context across messages unless asked not
+// to, the client always resets its own, so that its messages are inflated
+// one by one
+struct DeflateOffer {
+  bool ok = false;
+  int window_bits = 15;
+  bool window_bits_set = false;
+  bool no_context = false;
+
+  explicit DeflateOffer(const SimpleWeb::CaseInsensitiveMultimap& header) {
+    auto range = header.equal_range("Sec-WebSocket-Extensions");
+    for (auto it = range.first; it != range.second && !ok; ++it) {
+      for (auto& ext : Split(it->second, ",")) Parse(ext);
+    }
+  }
+
+  std::string response() const {
+    std::string out = "permessage-deflate; client_no_context_takeover";
+    if (no_context) out += "; server_no_context_takeover";
+    if (window_bits_set)
+      out += "; server_max_window_bits=" + std::to_string(window_bits);
+    return out;
+  }
+
+ private:
+  void Parse(const std::string& ext) {
+    if (ok) return;
+    auto toks = Split(ext, " \t;");
+    if (toks.empty() || toks[0] != "permessage-deflate") return;
+    DeflateOffer x = *this;
+    for (auto i = 1u; i < toks.size(); ++i) {
+      auto& t = toks[i];
+      auto pos = t.find('=');
+      auto key = t.substr(0, pos);
+      if (key == "server_no_context_takeover") {
+        x.no_context = true;
+      } else if (key == "server_max_window_bits") {
+        if (pos == std::string::npos) return;
+        auto v = t.substr(pos + 1);
+        v.erase(std::remove(v.begin(), v.end(), '"'), v.end());
+        // zlib has no raw deflate of 256 bytes windows
+        x.window_bits = atoi(v.c_str());
+        if (x.window_bits < 9 || x.window_bits > 15) return;
+        x.window_bits_set = true;
+      } else if (key != "client_no_context_takeover" &&
+                 key != "client_max_window_bits") {
+        return;
+      }
+    }
+    *this = x;
+    ok = true;
+  }
+};
+
+// a compressed message of a client in place, false if corrupt or beyond
+// kMaxInflated bytes
+static bool Inflate(std::string* msg) {
+  static const size_t kMaxInflated = 64 << 20;
+  struct Inflater {
+    z_stream z{};
+    Inflater() { inflateInit2(&z, -15); }
+    ~Inflater() { inflateEnd(&z); }
+  };
+  static thread_local Inflater kInflater;
+  auto& z = kInflater.z;
+  std::string in = *msg;
+  in.append("\x00\x00\xff\xff", 4);
+  msg->clear();
+  z.next_in = reinterpret_cast<Bytef*>(&in[0]);
+  z.avail_in = in.size();
+  char buf[16384];
+  auto ret = Z_OK;
+  while (z.avail_in && ret == Z_OK && msg->size() <= kMaxInflated) {
+    z.next_out = reinterpret_cast<Bytef*>(buf);
+    z.avail_out = sizeof(buf);
+    ret = inflate(&z, Z_SYNC_FLUSH);
+    msg->append(buf, sizeof(buf) - z.avail_out);
+  }
+  inflateReset(&z);
+  if (msg->size() > kMaxInflated) return false;
+  return ret == Z_OK || ret == Z_BUF_ERROR || ret == Z_STREAM_END;
 }
 
-struct WsSocketWrapper : public Transport {
-  explicit WsSocketWrapper(WsConnPtr ws) : ws_(ws) {}
+// Frames queued behind a slow client are bounded, beyond kMaxQueued bytes
+// the connection is closed rather than buffering without limit, the client
+// reconnects and catches up with its offline requests. Queued frames are
+// coalesced into one write by the websocket server.
+// With "?batch=<ms>" in the url, the messages sent within the window go as
+// one frame of their json array, e.g. [["md",...],["market",...]], a message
+// alone in its window as it is. With permessage-deflate, a message of
+// kMinDeflate bytes or more is compressed.
+struct WsSocketWrapper : public Transport,
+                         public std::enable_shared_from_this<WsSocketWrapper> {
+  explicit WsSocketWrapper(WsConnPtr ws) : ws_(ws), timer_(*kIoService) {
+    auto query = SimpleWeb::QueryString::parse(ws->query_string);
+    auto it = query.find("batch");
+    if (it != query.end()) {
+      batch_ms_ = std::min(std::max(atoi(it->second.c_str()), 0), 100);
+    }
+    DeflateOffer offer(ws->header);
+    if (offer.ok) {
+      deflate_.reset(new z_stream{});
+      deflateInit2(deflate_.get(), Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                   -offer.window_bits, 8, Z_DEFAULT_STRATEGY);
+      no_context_ = offer.no_context;
+    }
+  }
+
+  ~WsSocketWrapper() {
+    if (deflate_) deflateEnd(deflate_.get());
+  }
 
   std::string GetAddress() const { return ws_->remote_endpoint_address(); }
 
   void Send(const std::string& msg) override {
-    ws_->send(msg, [](const SimpleWeb::error_code& e) {
-      if (e) {
-        LOG_DEBUG("GATEWAY Server: Error sending message. "
-                  << "Error: " << e << ", error message: " << e.message());
+    auto n = msg.size();
+    if (queued_.fetch_add(n, std::memory_order_relaxed) + n > kMaxQueued) {
+      queued_.fetch_sub(n, std::memory_order_relaxed);
+      if (!overflow_.exchange(true)) {
+        LOG_WARN("GATEWAY Server: " << GetAddress()
+                                    << " too slow, closing connection");
+        ws_->send_close(1013, "too slow");
       }
+      return;
+    }
+    LockGuard lock(m_);
+    if (!batch_ms_) {
+      Write(msg, n);
+      return;
+    }
+    if (!batch_n_) {
+      batch_.clear();
+      batch_.push_back('[');
+      first_ = msg;
+    } else {
+      batch_.push_back(',');
+    }
+    batch_ += msg;
+    batch_n_ += n;
+    count_++;
+    if (batch_.size() >= kMaxBatch) {
+      Flush();
+      return;
+    }
+    if (count_ > 1) return;
+    auto self = shared_from_this();
+    timer_.expires_from_now(boost::posix_time::milliseconds(batch_ms_));
+    timer_.async_wait([self](const boost::system::error_code& e) {
+      if (e) return;
+      LockGuard lock(self->m_);
+      self->Flush();
     });
   }
 
  private:
+  static inline const size_t kMaxQueued = 64 << 20;
+  static inline const size_t kMaxBatch = 64 << 10;
+  static inline const size_t kMinDeflate = 32;
+
+  void Flush() {
+    if (!count_) return;
+    if (count_ == 1) {
+      Write(first_, batch_n_);
+    } else {
+      batch_.push_back(']');
+      Write(batch_, batch_n_);
+    }
+    batch_.clear();
+    first_.clear();
+    batch_n_ = 0;
+    count_ = 0;
+  }
+
+  // in the order of the deflate context, under m_
+  void Write(const std::string& msg, size_t n) {
+    auto self = shared_from_this();
+    auto callback = [self, n](const SimpleWeb::error_code& e) {
+      self->queued_.fetch_sub(n, std::memory_order_relaxed);
+      if (e) {
+        LOG_RATE_LIMITED(DEBUG, 10,
+                         "GATEWAY Server: Error sending message. "
+                             << "Error: " << e
+                             << ", error message: " << e.message());
+      }
+    };
+    if (!deflate_ || msg.size() < kMinDeflate) {
+      ws_->send(msg, callback);
+      return;
+    }
+    auto& z = *deflate_;
+    z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(msg.data()));
+    z.avail_in = msg.size();
+    out_.resize(deflateBound(&z, msg.size()) + 16);
+    z.next_out = reinterpret_cast<Bytef*>(&out_[0]);
+    z.avail_out = out_.size();
+    deflate(&z, Z_SYNC_FLUSH);
+    // the sync flush's empty block is implied, RFC 7692 7.2.1
+    out_.resize(out_.size() - z.avail_out - 4);
+    if (no_context_) deflateReset(&z);
+    // fin, rsv1 of a compressed message, text
+    ws_->send(out_, callback, 0xc1);
+  }
+
   WsConnPtr ws_;
+  std::atomic<size_t> queued_ = 0;
+  std::atomic<bool> overflow_ = false;
+  std::mutex m_;
+  boost::asio::deadline_timer timer_;
+  int batch_ms_ = 0;
+  std::string batch_;
+  std::string first_;  // the message alone in its window is sent as is
+  size_t batch_n_ = 0;
+  size_t count_ = 0;
+  std::unique_ptr<z_stream> deflate_;
+  bool no_context_ = false;
+  std::string out_;
 };
 
 struct HttpWrapper : public Transport {
@@ -61,14 +363,34 @@ struct HttpWrapper : public Transport {
   std::string GetAddress() const { return req_->remote_endpoint_address(); }
 
   void Send(const std::string& msg) override {
+    if (streaming_) {
+      // one chunk per part, newline delimited
+      *res_ << std::hex << msg.length() + 1 << std::dec << "\r\n"
+            << msg << "\n\r\n";
+      res_->send();
+      return;
+    }
     *res_ << "HTTP/1.1 200 OK\r\n"
           << "Content-Length: " << msg.length() << "\r\n\r\n"
           << msg;
   }
 
+  void BeginStream() override {
+    streaming_ = true;
+    *res_ << "HTTP/1.1 200 OK\r\n"
+          << "Transfer-Encoding: chunked\r\n\r\n";
+  }
+
+  void EndStream() override {
+    if (!streaming_) return;
+    streaming_ = false;
+    *res_ << "0\r\n\r\n";
+  }
+
  private:
   ResponsePtr res_;
   RequestPtr req_;
+  bool streaming_ = false;
 };
 
 void Server::Publish(Confirmation::Ptr cm) {
@@ -76,10 +398,11 @@ void Server::Publish(Confirmation::Ptr cm) {
   return;
 #endif
   kIoService->post([cm]() {
-    LockGuard lock(kMutex);
-    for (auto& pair : kSocketMap) {
-      pair.second->Send(cm);
-    }
+    auto msg = Connection::Serialize(*cm, false);
+    if (msg.empty()) return;
+    auto shared = std::make_shared<const std::string>(std::move(msg));
+    kConfirmationIndex.ForEach(cm->order->sub_account->id,
+                               [&shared](auto& p) { p->Send(shared); });
   });
 }
 
@@ -87,18 +410,14 @@ void Server::Publish(const std::string& msg, const SubAccount* acc) {
 #ifdef BACKTEST
   return;
 #endif
-  kIoService->post([msg, acc]() {
-    LockGuard lock(kMutex);
-    for (auto& pair : kSocketMap) {
-      pair.second->Send(msg, acc);
-    }
+  ForEachShard([msg, acc](auto& shard) {
+    for (auto& pair : shard.sockets) pair.second->Send(msg, acc);
   });
 }
 
 void Server::CloseConnection(User::IdType id) {
-  kIoService->post([id]() {
-    LockGuard lock(kMutex);
-    for (auto& pair : kSocketMap) {
+  ForEachShard([id](auto& shard) {
+    for (auto& pair : shard.sockets) {
       auto user = pair.second->user();
       if (!id || (user && user->id == id)) {
         pair.first->send_close(1011);
@@ -108,37 +427,230 @@ void Server::CloseConnection(User::IdType id) {
 }
 
 void Server::Trigger(const std::string& cmd) {
-  kIoService->post([cmd]() {
-    LockGuard lock(kMutex);
-    for (auto& pair : kSocketMap) {
-      pair.second->OnMessageAsync(cmd);
-    }
+  ForEachShard([cmd](auto& shard) {
+    for (auto& pair : shard.sockets) pair.second->OnMessageAsync(cmd);
   });
 }
 
 void Server::PublishTestMsg(const std::string& token, const std::string& msg,
                             bool stopped) {
-  kIoService->post([token, msg, stopped]() {
-    LockGuard lock(kMutex);
-    for (auto& pair : kSocketMap) {
+  ForEachShard([token, msg, stopped](auto& shard) {
+    for (auto& pair : shard.sockets)
       pair.second->SendTestMsg(token, msg, stopped);
-    }
   });
 }
 
 void Server::Publish(const Algo& algo, const std::string& status,
                      const std::string& body, uint32_t seq) {
-  kIoService->post([&algo, status, body, seq]() {
-    LockGuard lock(kMutex);
-    for (auto& pair : kSocketMap) {
+  ForEachShard([&algo, status, body, seq](auto& shard) {
+    for (auto& pair : shard.sockets)
       pair.second->Send(algo, status, body, seq);
-    }
   });
 }
 
+void Server::Publish(std::shared_ptr<const AlgoMessages> msgs) {
+  ForEachShard([msgs](auto& shard) {
+    for (auto& pair : shard.sockets) pair.second->Send(msgs);
+  });
+}
+
+// The files under web/ read once at startup, with their gzip variant and
+// the brotli one where built with it, or "<file>.br" / "<file>.gz" next to
+// them. An ETag of the content and Last-Modified of the mtime answer
+// conditional requests with 304; a name with a content hash, e.g.
+// index-a074c4b8121e218bd207.bundle.js, is cached by the browsers for a
+// year, the others revalidated. Bodies go from memory without a copy, files
+// added later are read from disk as before.
+class StaticFiles {
+ public:
+  struct File {
+    std::string type;
+    std::string etag;
+    std::string last_modified;
+    bool immutable = false;
+    std::shared_ptr<const std::string> raw;
+    std::shared_ptr<const std::string> gzip;
+    std::shared_ptr<const std::string> br;
+  };
+
+  void Load(const boost::filesystem::path& root) {
+    namespace fs = boost::filesystem;
+    if (!fs::is_directory(root)) return;
+    size_t raw = 0, compressed = 0;
+    for (auto& entry : fs::recursive_directory_iterator(root)) {
+      auto path = entry.path();
+      if (!fs::is_regular_file(path)) continue;
+      auto ext = path.extension().string();
+      if (ext == ".gz" || ext == ".br") continue;
+      auto content = Read(path);
+      if (!content) continue;
+      File f;
+      f.type = Type(ext);
+      f.etag = ETag(*content);
+      f.last_modified = HttpDate(fs::last_write_time(path));
+      static const std::regex kHashed("[.-][0-9a-f]{16,}\\.[^/]+$");
+      f.immutable = std::regex_search(path.filename().string(), kHashed);
+      f.raw = content;
+      if (Compressible(f.type)) {
+        f.gzip = Read(path.string() + ".gz");
+        if (!f.gzip) f.gzip = Gzip(*content);
+        f.br = Read(path.string() + ".br");
+#ifdef OPENTRADE_BROTLI
+        if (!f.br) f.br = Brotli(*content);
+#endif
+        if (f.gzip && f.gzip->size() >= content->size()) f.gzip.reset();
+        if (f.br && f.br->size() >= content->size()) f.br.reset();
+      }
+      raw += content->size();
+      compressed += f.gzip ? f.gzip->size() : content->size();
+      auto rel = path.string().substr(root.string().size());
+      if (rel.empty() || rel[0] != '/') rel = '/' + rel;
+      files_[rel] = std::move(f);
+    }
+    LOG_INFO("Static files: " << files_.size() << ", " << raw << " bytes, "
+                              << compressed << " gzipped");
+  }
+
+  // false if path is not cached
+  bool Serve(const std::string& path, RequestPtr request,
+             ResponsePtr response) const {
+    auto it = files_.find(path.empty() || path.back() == '/'
+                              ? path + "index.html"
+                              : path);
+    if (it == files_.end()) return false;
+    auto& f = it->second;
+    SimpleWeb::CaseInsensitiveMultimap header;
+    header.emplace("ETag", f.etag);
+    header.emplace("Last-Modified", f.last_modified);
+    header.emplace("Cache-Control", f.immutable
+                                        ? "public, max-age=31536000, immutable"
+                                        : "no-cache");
+    if (f.gzip || f.br) header.emplace("Vary", "Accept-Encoding");
+    auto inm = request->header.find("If-None-Match");
+    auto ims = request->header.find("If-Modified-Since");
+    if (inm != request->header.end()
+            ? inm->second.find(f.etag) != std::string::npos ||
+                  inm->second == "*"
+            : ims != request->header.end() &&
+                  ims->second == f.last_modified) {
+      response->write(SimpleWeb::StatusCode::redirection_not_modified, header);
+      return true;
+    }
+    auto body = f.raw;
+    auto accept = FindInMap(request->header, "Accept-Encoding");
+    if (f.br && accept.find("br") != std::string::npos) {
+      body = f.br;
+      header.emplace("Content-Encoding", "br");
+    } else if (f.gzip && accept.find("gzip") != std::string::npos) {
+      body = f.gzip;
+      header.emplace("Content-Encoding", "gzip");
+    }
+    header.emplace("Content-Type", f.type);
+    header.emplace("Content-Length", std::to_string(body->size()));
+    response->write(header);
+    response->send(body);
+    return true;
+  }
+
+ private:
+  static std::shared_ptr<const std::string> Read(
+      const boost::filesystem::path& path) {
+    std::ifstream ifs(path.string(), std::ios::binary);
+    if (!ifs) return {};
+    return std::make_shared<std::string>(std::istreambuf_iterator<char>(ifs),
+                                         std::istreambuf_iterator<char>());
+  }
+
+  static std::string Type(const std::string& ext) {
+    static const std::unordered_map<std::string, std::string> kTypes{
+        {".html", "text/html; charset=utf-8"},
+        {".js", "application/javascript"},
+        {".css", "text/css"},
+        {".json", "application/json"},
+        {".map", "application/json"},
+        {".txt", "text/plain; charset=utf-8"},
+        {".svg", "image/svg+xml"},
+        {".png", "image/png"},
+        {".jpg", "image/jpeg"},
+        {".gif", "image/gif"},
+        {".ico", "image/x-icon"},
+        {".woff", "font/woff"},
+        {".woff2", "font/woff2"},
+        {".ttf", "font/ttf"},
+        {".eot", "application/vnd.ms-fontobject"},
+    };
+    auto it = kTypes.find(ext);
+    return it == kTypes.end() ? "application/octet-stream" : it->second;
+  }
+
+  static bool Compressible(const std::string& type) {
+    for (auto s : {"text/", "javascript", "json", "svg", "font/ttf",
+                   "fontobject"}) {
+      if (type.find(s) != std::string::npos) return true;
+    }
+    return false;
+  }
+
+  static std::string ETag(const std::string& content) {
+    auto crc = crc32(0L, reinterpret_cast<const Bytef*>(content.data()),
+                     content.size());
+    char buf[32];
+    snprintf(buf, sizeof(buf), "\"%zx-%lx\"", content.size(), crc);
+    return buf;
+  }
+
+  static std::string HttpDate(time_t tm) {
+    struct tm t;
+    gmtime_r(&tm, &t);
+    char buf[64];
+    strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &t);
+    return buf;
+  }
+
+  static std::shared_ptr<const std::string> Gzip(const std::string& in) {
+    z_stream z{};
+    // 31: gzip header and trailer
+    if (deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, 31, 9,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+      return {};
+    auto out = std::make_shared<std::string>();
+    out->resize(deflateBound(&z, in.size()));
+    z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    z.avail_in = in.size();
+    z.next_out = reinterpret_cast<Bytef*>(&(*out)[0]);
+    z.avail_out = out->size();
+    auto ret = deflate(&z, Z_FINISH);
+    out->resize(out->size() - z.avail_out);
+    deflateEnd(&z);
+    if (ret != Z_STREAM_END) return {};
+    return out;
+  }
+
+#ifdef OPENTRADE_BROTLI
+  static std::shared_ptr<const std::string> Brotli(const std::string& in) {
+    auto out = std::make_shared<std::string>();
+    auto n = BrotliEncoderMaxCompressedSize(in.size());
+    out->resize(n);
+    if (!BrotliEncoderCompress(
+            BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+            in.size(), reinterpret_cast<const uint8_t*>(in.data()), &n,
+            reinterpret_cast<uint8_t*>(&(*out)[0])))
+      return {};
+    out->resize(n);
+    return out;
+  }
+#endif
+
+  std::unordered_map<std::string, File> files_;
+};
+
+static StaticFiles kStaticFiles;
+
 static void ServeStatic() {
+  kStaticFiles.Load("web");
   kHttpServer.default_resource["GET"] = [](ResponsePtr response,
                                            RequestPtr request) {
+    if (kStaticFiles.Serve(request->path, request, response)) return;
     try {
       auto web_root_path = boost::filesystem::canonical("web");
       auto path = boost::filesystem::canonical(web_root_path / request->path);
@@ -171,9 +683,8 @@ static void ServeStatic() {
          public:
           static void read_and_send(ResponsePtr response,
                                     const std::shared_ptr<std::ifstream> ifs) {
-            // Read and send 128 KB at a time
-            static std::vector<char> buffer(
-                131072);  // Safe when server is running on one thread
+            // Read and send 128 KB at a time, write copies it out
+            static thread_local std::vector<char> buffer(131072);
             std::streamsize read_length;
             if ((read_length =
                      ifs->read(&buffer[0],
@@ -204,45 +715,70 @@ static void ServeStatic() {
 }
 
 void Server::Start(int port, int nthreads) {
-  nthreads = std::min(1, nthreads);
+  nthreads = std::max(1, nthreads);
   LOG_INFO("Web server nthreads=" << nthreads);
   kHttpServer.io_service = kIoService;
   kHttpServer.config.reuse_address = true;
   kHttpServer.config.port = port;
+  // keep-alive connections of REST clients, e.g. basket loaders sending
+  // batches back to back, may idle this long between requests
+  kHttpServer.config.timeout_request = 60;
   kWsServer.io_service = kIoService;
   kWsServer.config.reuse_address = true;
   kWsServer.config.port = port + 1;
 
   auto& endpoint = kWsServer.endpoint["^/ot[/]?$"];
 
+  endpoint.on_handshake = [](WsConnPtr connection,
+                             SimpleWeb::CaseInsensitiveMultimap& header) {
+    DeflateOffer offer(connection->header);
+    if (offer.ok) header.emplace("Sec-WebSocket-Extensions", offer.response());
+    return SimpleWeb::StatusCode::information_switching_protocols;
+  };
+
   endpoint.on_message = [](WsConnPtr connection,
                            std::shared_ptr<WsServer::InMessage> message) {
     Connection::Ptr p;
     {
-      LockGuard lock(kMutex);
-      p = kSocketMap[connection];
+      auto& shard = GetShard(connection);
+      LockGuard lock(shard.m);
+      p = FindInMap(shard.sockets, connection);
     }
-    if (p) p->OnMessageAsync(message->string());
+    if (!p) return;
+    // rsv1, permessage-deflate
+    if (message->fin_rsv_opcode & 0x40) {
+      auto msg = message->string();
+      if (!Inflate(&msg)) {
+        connection->send_close(1007, "invalid compressed message");
+        return;
+      }
+      p->OnMessageAsync(msg);
+      return;
+    }
+    p->OnMessageAsync(message->string());
   };
 
   endpoint.on_open = [](WsConnPtr connection) {
     auto p = std::make_shared<Connection>(
         std::make_shared<WsSocketWrapper>(connection), kIoService);
     {
-      LockGuard lock(kMutex);
-      kSocketMap[connection] = p;
+      auto& shard = GetShard(connection);
+      LockGuard lock(shard.m);
+      shard.sockets[connection] = p;
     }
+    kSocketsVersion++;
   };
 
   endpoint.on_close = [](WsConnPtr connection, int status,
                          const std::string& /*reason*/) {
-    LOG_DEBUG("endpoint.on_close"
-              << " status code " << status);
+    LOG_RATE_LIMITED(DEBUG, 10, "endpoint.on_close"
+                                    << " status code " << status);
     Close(connection);
   };
 
   endpoint.on_error = [](WsConnPtr connection, const SimpleWeb::error_code& e) {
-    LOG_DEBUG("endpoint.on_error message: " << e.message());
+    LOG_RATE_LIMITED(DEBUG, 10,
+                     "endpoint.on_error message: " << e.message());
     Close(connection);
   };
 
@@ -272,9 +808,16 @@ void Server::Start(int port, int nthreads) {
         ->OnMessageSync(request->content.string(), sessionToken);
   };
 
+  kHttpServer.resource["^/metrics$"]["GET"] = [](ResponsePtr response,
+                                                 RequestPtr request) {
+    SimpleWeb::CaseInsensitiveMultimap header;
+    header.emplace("Content-Type", "text/plain; version=0.0.4");
+    response->write(Metrics::Instance().Dump(), header);
+  };
+
   kHttpServer.on_error = [](RequestPtr /*request*/,
                             const SimpleWeb::error_code& e) {
-    LOG_DEBUG("Http Server Error: " << e.message());
+    LOG_RATE_LIMITED(DEBUG, 10, "Http Server Error: " << e.message());
   };
 
   try {
@@ -283,9 +826,11 @@ void Server::Start(int port, int nthreads) {
     LOG_INFO("http://0.0.0.0:" << port);
     LOG_INFO("ws://0.0.0.0:" << port << "/ot/");
     LOG_INFO("http://0.0.0.0:" << port << "/api/");
+    LOG_INFO("http://0.0.0.0:" << port << "/metrics");
     std::vector<std::thread> threads;
     for (auto i = 0; i < nthreads; ++i) {
       threads.emplace_back([]() { kIoService->run(); });
+      ThreadPlacement::Instance().Apply(threads.back().native_handle(), "web");
     }
     if (fs::exists(fs::path("start.py"))) {
       if (system(("nohup ./start.py " + std::to_string(port) + " &").c_str())) {
@@ -302,9 +847,12 @@ void Server::Stop() {
   kHttpServer.stop();
   kWsServer.stop();
 
-  LockGuard lock(kMutex);
-  for (auto& pair : kSocketMap) pair.second->Close();
-  kSocketMap.clear();
+  for (auto& shard : kSocketShards) {
+    LockGuard lock(shard.m);
+    for (auto& pair : shard.sockets) pair.second->Close();
+    shard.sockets.clear();
+  }
+  kSocketsVersion++;
 }
 
 }  // namespace opentrade
@@ -1,6 +1,11 @@
 #ifndef OPENTRADE_SERVER_H_
 #define OPENTRADE_SERVER_H_
 
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "algo.h"
 
 namespace opentrade {
@@ -12,6 +17,10 @@ class Server {
   static void Publish(const Algo& algo, const std::string& status,
                       const std::string& body, uint32_t seq);
   static void Publish(const std::string& msg, const SubAccount* acc = nullptr);
+  // serialized once for all, each to the connections of its user id, in one
+  // post per connection
+  typedef std::vector<std::pair<User::IdType, std::string>> AlgoMessages;
+  static void Publish(std::shared_ptr<const AlgoMessages> msgs);
   static void PublishTestMsg(const std::string& token, const std::string& msg,
                              bool stopped = false);
   static void CloseConnection(User::IdType id);
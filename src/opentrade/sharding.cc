@@ -0,0 +1,219 @@
+#include "sharding.h"
+
+#include <chrono>
+#include <sstream>
+#include <thread>
+
+#include "logger.h"
+#include "socket.h"
+
+namespace opentrade {
+
+// reads one line without '\n' into *line, buf keeps what follows it; false
+// on error, or on timeout if timeout_ms >= 0
+static bool ReadLine(int fd, std::string* buf, std::string* line,
+                     int timeout_ms) {
+  for (;;) {
+    auto pos = buf->find('\n');
+    if (pos != std::string::npos) {
+      line->assign(*buf, 0, pos);
+      buf->erase(0, pos + 1);
+      return true;
+    }
+    if (buf->size() > (1 << 20)) return false;
+    pollfd p{fd, POLLIN, 0};
+    auto rc = poll(&p, 1, timeout_ms);
+    if (rc < 0 && errno == EINTR) continue;
+    if (rc <= 0) return false;
+    char tmp[1 << 16];
+    auto n = recv(fd, tmp, sizeof(tmp), 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    buf->append(tmp, n);
+  }
+}
+
+void ShardManager::Initialize(int shard, const std::string& nodes) {
+  for (auto& node : Split(nodes, ", ")) nodes_.push_back(node);
+  if (nodes_.empty()) return;
+  if (shard < 0 || shard >= static_cast<int>(nodes_.size())) {
+    LOG_FATAL("Invalid shard " << shard << ", expect 0 to "
+                               << nodes_.size() - 1);
+  }
+  shard_ = shard;
+  if (!enabled()) return;
+  // the even split until the service says otherwise
+  auto share = 1. / nodes_.size();
+  auto& am = AccountManager::Instance();
+  for (auto& pair : am.users_) {
+    pair.second->msg_rate_share = share;
+    pair.second->value_share = share;
+  }
+  for (auto& pair : am.broker_accounts_) {
+    pair.second->msg_rate_share = share;
+    pair.second->value_share = share;
+  }
+  LOG_INFO("Shard " << shard_ << " of " << nodes_.size());
+}
+
+void ShardManager::Serve(uint16_t port) {
+  if (!enabled()) {
+    LOG_FATAL("Risk aggregation service requires shard_nodes");
+  }
+  auto fd = TcpListen(port, 64);
+  if (fd < 0) {
+    LOG_FATAL("Shard: failed to listen on port " << port << ": "
+                                                 << strerror(errno));
+  }
+  std::thread([this, fd]() {
+    for (;;) {
+      std::string addr;
+      auto fd2 = TcpAccept(fd, &addr);
+      if (fd2 < 0) {
+        LOG_ERROR("Shard: failed to accept: " << strerror(errno));
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        continue;
+      }
+      std::thread([this, fd2, addr]() { Serve(fd2, addr); }).detach();
+    }
+  }).detach();
+  LOG_INFO("Shard: risk aggregation service on port " << port);
+}
+
+void ShardManager::Serve(int fd, const std::string& addr) {
+  LOG_INFO("Shard: " << addr << " connected");
+  std::string buf, line;
+  while (ReadLine(fd, &buf, &line, -1)) {
+    int shard;
+    size_t n;
+    if (sscanf(line.c_str(), "%d %zu", &shard, &n) != 2 || shard < 0 ||
+        shard >= static_cast<int>(nodes_.size())) {
+      LOG_ERROR("Shard: invalid report from " << addr << ": " << line);
+      break;
+    }
+    std::vector<std::pair<std::string, Usage>> usages;
+    for (size_t i = 0; i < n; ++i) {
+      char kind;
+      unsigned id;
+      Usage u;
+      if (!ReadLine(fd, &buf, &line, 1000) ||
+          sscanf(line.c_str(), "%c %u %lf %lf", &kind, &id, &u.msg_rate,
+                 &u.value) != 4)
+        break;
+      usages.emplace_back(kind + std::to_string(id), u);
+    }
+    if (usages.size() != n) break;
+    std::stringstream out;
+    {
+      std::lock_guard<std::mutex> lock(m_);
+      for (auto& pair : usages) {
+        auto& v = usages_[pair.first];
+        v.resize(nodes_.size());
+        v[shard] = pair.second;
+        Usage sum;
+        for (auto& u : v) {
+          sum.msg_rate += u.msg_rate;
+          sum.value += u.value;
+        }
+        // what is used plus an even part of what is not
+        auto share = [n = v.size()](double u, double sum) {
+          return sum <= 1 ? u + (1 - sum) / n : u / sum;
+        };
+        out << pair.first[0] << ' ' << pair.first.substr(1) << ' '
+            << share(pair.second.msg_rate, sum.msg_rate) << ' '
+            << share(pair.second.value, sum.value) << '\n';
+      }
+    }
+    auto s = out.str();
+    if (!SendAll(fd, s.data(), s.size())) break;
+  }
+  close(fd);
+  LOG_WARN("Shard: " << addr << " disconnected");
+}
+
+void ShardManager::Report(const std::string& server, double interval) {
+  if (!enabled()) return;
+  std::string host, port;
+  if (!SplitHostPort(server, &host, &port)) {
+    LOG_FATAL("Invalid shard_risk_server, expect host:port: " << server);
+  }
+  std::thread([=]() {
+    auto fd = -1;
+    for (;;) {
+      if (fd < 0) {
+        fd = TcpConnect(host, port);
+        if (fd >= 0) LOG_INFO("Shard: connected to " << server);
+      }
+      if (fd >= 0 && !Report(fd)) {
+        LOG_WARN("Shard: lost risk aggregation service " << server
+                                                         << ", budgets kept");
+        close(fd);
+        fd = -1;
+      }
+      std::this_thread::sleep_for(std::chrono::duration<double>(interval));
+    }
+  }).detach();
+}
+
+// "<msg usage> <value usage>", as fractions of the limits, value is the
+// largest of the total_* limits, measured the same as in risk.cc
+static std::string GetUsage(const AccountBase& acc) {
+  auto& l = acc.limits;
+  auto& pos = acc.position_value;
+  double msg_rate = 0;
+  if (l.msg_rate > 0)
+    msg_rate = acc.throttle_in_sec(NowCoarseInMicro()) / l.msg_rate;
+  double value = 0;
+  auto f = [&value](double v, double limit) {
+    if (limit > 0) value = std::max(value, v / limit);
+  };
+  double net = pos.total_bought - pos.total_sold;
+  f(std::max(std::abs(net + pos.total_outstanding_buy),
+             std::abs(net - pos.total_outstanding_sell)),
+    l.total_value);
+  f(pos.total_bought + pos.total_outstanding_buy + pos.total_sold +
+        pos.total_outstanding_sell,
+    l.total_turnover);
+  f(pos.long_value, l.total_long_value);
+  f(pos.short_value, l.total_short_value);
+  std::stringstream out;
+  out << msg_rate << ' ' << value;
+  return out.str();
+}
+
+bool ShardManager::Report(int fd) {
+  auto& am = AccountManager::Instance();
+  std::stringstream out;
+  size_t n = 0;
+  for (auto& pair : am.users_) {
+    out << "u " << pair.first << ' ' << GetUsage(*pair.second) << '\n';
+    ++n;
+  }
+  for (auto& pair : am.broker_accounts_) {
+    out << "b " << pair.first << ' ' << GetUsage(*pair.second) << '\n';
+    ++n;
+  }
+  auto s = std::to_string(shard_) + ' ' + std::to_string(n) + '\n' + out.str();
+  if (!SendAll(fd, s.data(), s.size())) return false;
+  std::string buf, line;
+  for (size_t i = 0; i < n; ++i) {
+    char kind;
+    unsigned id;
+    double msg_rate, value;
+    if (!ReadLine(fd, &buf, &line, 1000) ||
+        sscanf(line.c_str(), "%c %u %lf %lf", &kind, &id, &msg_rate,
+               &value) != 4)
+      return false;
+    AccountBase* acc = nullptr;
+    if (kind == 'u')
+      acc = FindInMap(am.users_, id);
+    else if (kind == 'b')
+      acc = FindInMap(am.broker_accounts_, id);
+    if (!acc) continue;
+    acc->msg_rate_share = msg_rate;
+    acc->value_share = value;
+  }
+  return true;
+}
+
+}  // namespace opentrade
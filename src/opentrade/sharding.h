@@ -0,0 +1,63 @@
+#ifndef OPENTRADE_SHARDING_H_
+#define OPENTRADE_SHARDING_H_
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "account.h"
+#include "common.h"
+
+namespace opentrade {
+
+// Account sharded deployment. Each node owns the sub accounts of
+// id % shards == shard, and places and loads positions of them only, with
+// exchange connectivity sessions of its own. Users and broker accounts span
+// the shards, so their msg_rate and total_* limits are split into budgets,
+// AccountBase::msg_rate_share and value_share, that the order path checks
+// against without leaving the node. A risk aggregation service collects the
+// usage of every shard and hands the unused part of each limit out evenly,
+// never granting more than the whole limit in sum. A shard keeps its last
+// budgets if the service is down, and may overshoot a shrunk budget by what
+// it used since its last report.
+//
+// Protocol, text lines: the shard sends "<shard> <n>\n" and n lines of
+// "<u|b> <account id> <msg usage> <value usage>\n", usages as fractions of
+// the limits, and gets back n lines of "<u|b> <account id> <msg share>
+// <value share>\n".
+class ShardManager : public Singleton<ShardManager> {
+ public:
+  // nodes: comma separated web addresses of all the shards in order,
+  // e.g. host1:9111,host2:9111, for the web clients to route by
+  void Initialize(int shard, const std::string& nodes);
+  bool enabled() const { return nodes_.size() > 1; }
+  int shard() const { return shard_; }
+  const std::vector<std::string>& nodes() const { return nodes_; }
+  int ShardOf(SubAccount::IdType id) const {
+    return enabled() ? id % nodes_.size() : shard_;
+  }
+  bool Owns(SubAccount::IdType id) const { return ShardOf(id) == shard_; }
+  // the risk aggregation service, on any one node
+  void Serve(uint16_t port);
+  // reports to the service at host:port every interval seconds
+  void Report(const std::string& server, double interval);
+
+ private:
+  struct Usage {
+    double msg_rate = 0;
+    double value = 0;
+  };
+  void Serve(int fd, const std::string& addr);
+  bool Report(int fd);
+
+  int shard_ = 0;
+  std::vector<std::string> nodes_;
+  // service, usages of the shards by <u|b><account id>
+  std::mutex m_;
+  std::unordered_map<std::string, std::vector<Usage>> usages_;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_SHARDING_H_
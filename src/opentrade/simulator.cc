@@ -6,70 +6,134 @@
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
+#include <algorithm>
+#include <cmath>
 
 #include "algo.h"
 #include "backtest.h"
+#include "fill_model.h"
 #include "logger.h"
 
 namespace opentrade {
 
 static boost::uuids::random_generator kUuidGen;
 
-static inline void Async(std::function<void()> func, double seconds = 0) {
-  kTimers.emplace(kTime + seconds * kMicroInSec, func);
+static bool kHasFxTrade;
+
+template <typename F>
+static inline void Async(F&& func, double seconds = 0) {
+  kTimers.Push(kTime + seconds * kMicroInSec, std::forward<F>(func));
 }
 
-inline double Simulator::TryFillBuy(double px, double qty,
-                                    Orders* actives_of_sec) {
-  if (!px) return qty;
-  for (auto it = actives_of_sec->buys.rbegin();
-       it != actives_of_sec->buys.rend() && qty > 0 && px <= it->first;) {
-    auto& tuple = it->second;
-    auto n = std::fmin(qty, tuple.leaves);
-    qty -= n;
-    tuple.leaves -= n;
-    assert(qty >= 0);
-    assert(tuple.leaves >= 0);
-    HandleFill(tuple.order->id, n, it->first,
-               boost::uuids::to_string(kUuidGen()), 0, tuple.leaves > 0);
-    auto algo_id = tuple.order->inst ? tuple.order->inst->algo().id() : 0;
-    of_ << std::setprecision(15) << GetNowStr() << ','
-        << tuple.order->sec->symbol << ",B," << n << ',' << it->first << ','
-        << algo_id << '\n';
+// runs func once the message sent to the exchange of sec reaches it
+template <typename F>
+static inline void ToExchange(const Security& sec, F&& func) {
+  kTimers.Push(Backtest::Instance().OrderArrival(sec), std::forward<F>(func));
+}
+
+// runs the confirmation func once it reaches the algos from the exchange of
+// sec, at once without CONFIRMATION_LATENCY
+template <typename F>
+static inline void FromExchange(const Security& sec, F&& func) {
+  auto& bt = Backtest::Instance();
+  if (!bt.confirmation_delayed()) {
+    func();
+    return;
+  }
+  kTimers.Push(bt.ConfirmationArrival(sec), std::forward<F>(func));
+}
+
+// the touch moved to px with size qty, it walks the side from its best
+// level to the touch
+template <typename It>
+static inline void UpdateQueues(It it, It end, bool buy, Fixed px,
+                                double qty) {
+  for (; it != end; ++it) {
+    for (auto& tuple : it->second) {
+      if (!UpdateQueue(buy, it->first, px, qty, &tuple.ahead)) return;
+    }
+    if (SamePrice(it->first, px)) return;
+  }
+}
+
+inline void Simulator::Fill(OrderTuple* tuple, double qty, double px) {
+  tuple->leaves -= qty;
+  assert(tuple->leaves >= 0);
+  auto& ord = *tuple->order;
+  FromExchange(*ord.sec, [this, id = ord.id, qty, px,
+                          partial = tuple->leaves > 0]() {
+    HandleFill(id, qty, px, boost::uuids::to_string(kUuidGen()), 0, partial);
+  });
+  LogTrade(ord, qty, px);
+}
+
+inline void Simulator::LogTrade(const Order& ord, double qty, double px) {
+  auto algo_id = ord.inst ? ord.inst->algo().id() : 0;
+  of_.Add(kTime, ord.sec->id, ord.sec->symbol, ord.IsBuy(), qty, px, algo_id);
+}
+
+// fills the level in time priority and returns the qty left. A print at the
+// level price only reaches an order once it has eaten the queue in front of
+// it, any other crossing tick fills outright.
+inline double Simulator::FillLevel(Ladder* side, Ladder::iterator level,
+                                   double qty, bool print,
+                                   Orders* actives_of_sec) {
+  auto& orders = level->second;
+  auto used = 0.;
+  for (auto it = orders.begin(); it != orders.end() && used < qty;) {
+    auto& tuple = *it;
+    auto n = tuple.leaves;
+    if (print)
+      n = std::fmin(n, std::fmax(0., qty - tuple.ahead - used));
+    else
+      n = std::fmin(n, qty - used);
+    if (n <= 0) {
+      ++it;
+      continue;
+    }
+    used += n;
+    Fill(&tuple, n, actives_of_sec->scale.To(level->first));
     if (tuple.leaves <= 0) {
       actives_of_sec->all.erase(tuple.order->id);
-      it = std::reverse_iterator(
-          actives_of_sec->buys.erase(std::next(it).base()));
+      it = orders.erase(it);
     } else {
       ++it;
     }
   }
+  // the queue in front of the rest shrinks by the print too
+  if (print) {
+    for (auto& tuple : orders) tuple.ahead = std::fmax(0., tuple.ahead - qty);
+  }
+  if (orders.empty()) side->erase(level);
+  return qty - used;
+}
+
+inline double Simulator::TryFillBuy(double px, double qty,
+                                    Orders* actives_of_sec, bool print) {
+  if (!px) return qty;
+  auto tick = actives_of_sec->scale.From(px);
+  auto& buys = actives_of_sec->buys;
+  while (qty > 0 && !buys.empty()) {
+    auto level = std::prev(buys.end());
+    auto at = tick == level->first;
+    if (tick > level->first) break;
+    qty = FillLevel(&buys, level, qty, print && at, actives_of_sec);
+    if (print && at) break;
+  }
   return qty;
 }
 
 inline double Simulator::TryFillSell(double px, double qty,
-                                     Orders* actives_of_sec) {
+                                     Orders* actives_of_sec, bool print) {
   if (!px) return qty;
-  for (auto it = actives_of_sec->sells.begin();
-       it != actives_of_sec->sells.end() && qty > 0 && px >= it->first;) {
-    auto& tuple = it->second;
-    auto n = std::fmin(qty, tuple.leaves);
-    qty -= n;
-    tuple.leaves -= n;
-    assert(qty >= 0);
-    assert(tuple.leaves >= 0);
-    HandleFill(tuple.order->id, n, it->first,
-               boost::uuids::to_string(kUuidGen()), 0, tuple.leaves > 0);
-    auto algo_id = tuple.order->inst ? tuple.order->inst->algo().id() : 0;
-    of_ << std::setprecision(15) << GetNowStr() << ','
-        << tuple.order->sec->symbol << ",S," << n << ',' << it->first << ','
-        << algo_id << '\n';
-    if (tuple.leaves <= 0) {
-      actives_of_sec->all.erase(tuple.order->id);
-      it = actives_of_sec->sells.erase(it);
-    } else {
-      ++it;
-    }
+  auto tick = actives_of_sec->scale.From(px);
+  auto& sells = actives_of_sec->sells;
+  while (qty > 0 && !sells.empty()) {
+    auto level = sells.begin();
+    auto at = tick == level->first;
+    if (tick < level->first) break;
+    qty = FillLevel(&sells, level, qty, print && at, actives_of_sec);
+    if (print && at) break;
   }
   return qty;
 }
@@ -78,29 +142,58 @@ void Simulator::HandleTick(const Security& sec, char type, double px,
                            double qty, double trade_hit_ratio,
                            Orders* actives_of_sec) {
   if (!qty && sec.type == kForexPair && type != 'T') qty = 1e9;
-  static bool kHasFxTrade;
+  auto& bt = Backtest::Instance();
+  if (bt.md_delayed()) {
+    kTimers.Push(bt.MdArrival(sec), [this, &sec, type, px, qty]() {
+      Deliver(sec, type, px, qty);
+    });
+  } else {
+    Deliver(sec, type, px, qty);
+  }
   switch (type) {
     case 'T': {
-      Update(sec.id, px, qty);
-      if (sec.type == kForexPair) {
-        if (!kHasFxTrade) kHasFxTrade = true;
-        break;  // not try fill for FX trade tick
-      }
+      if (sec.type == kForexPair) break;  // not try fill for FX trade tick
       if (actives_of_sec->all.empty()) return;
-      if (px > 0 && qty > 0 &&
-          rand_r(&seed_) % 100 / 100. >= (1 - trade_hit_ratio)) {
+      if (px <= 0 || qty <= 0) break;
+      if (trade_hit_ratio < 0) {
+        TryFillBuy(px, qty, actives_of_sec, true);
+        TryFillSell(px, qty, actives_of_sec, true);
+      } else if (rand_r(&seed_) % 100 / 100. >= (1 - trade_hit_ratio)) {
         TryFillBuy(px, qty, actives_of_sec);
         TryFillSell(px, qty, actives_of_sec);
       }
     } break;
     case 'A':
-      Update(sec.id, px, qty, false);
+      actives_of_sec->quote.ask_price = px;
+      actives_of_sec->quote.ask_size = qty;
       TryFillBuy(px, qty, actives_of_sec);
-      if (sec.type == kForexPair && !kHasFxTrade) UpdateMidAsLastPrice(sec.id);
+      if (trade_hit_ratio < 0 && px > 0)
+        UpdateQueues(actives_of_sec->sells.begin(), actives_of_sec->sells.end(),
+                     false, actives_of_sec->scale.From(px), qty);
       break;
     case 'B':
-      Update(sec.id, px, qty, true);
+      actives_of_sec->quote.bid_price = px;
+      actives_of_sec->quote.bid_size = qty;
       TryFillSell(px, qty, actives_of_sec);
+      if (trade_hit_ratio < 0 && px > 0)
+        UpdateQueues(actives_of_sec->buys.rbegin(), actives_of_sec->buys.rend(),
+                     true, actives_of_sec->scale.From(px), qty);
+      break;
+    default:
+      break;
+  }
+}
+
+void Simulator::Deliver(const Security& sec, char type, double px,
+                        double qty) {
+  switch (type) {
+    case 'T':
+      Update(sec.id, px, qty);
+      if (sec.type == kForexPair) kHasFxTrade = true;
+      break;
+    case 'A':
+    case 'B':
+      Update(sec.id, px, qty, type == 'B');
       if (sec.type == kForexPair && !kHasFxTrade) UpdateMidAsLastPrice(sec.id);
       break;
     default:
@@ -108,101 +201,244 @@ void Simulator::HandleTick(const Security& sec, char type, double px,
   }
 }
 
+void Simulator::ReplayFill(const Replay::Recorded* rec, double qty,
+                           double px) {
+  auto it = replayed_.find(rec);
+  if (it == replayed_.end()) return;
+  auto& r = it->second;
+  qty = std::fmin(qty, r.leaves);
+  if (qty <= 0) return;
+  r.leaves -= qty;
+  auto& ord = *r.order;
+  HandleFill(ord.id, qty, px, boost::uuids::to_string(kUuidGen()), 0,
+             r.leaves > 0);
+  LogTrade(ord, qty, px);
+  if (r.leaves > 0) return;
+  replayed_ids_.erase(ord.id);
+  replayed_.erase(it);
+}
+
+// the recorded fills keep their live timing, CONFIRMATION_LATENCY not added
+void Simulator::PlaceReplayed(const Order& ord, const Replay::Recorded& rec) {
+  ToExchange(*ord.sec, [this, &ord, &rec]() {
+    if (rec.rejected) {
+      HandleNewRejected(ord.id, rec.text);
+      return;
+    }
+    HandleNew(ord.id, "");
+    replayed_[&rec] = Replayed{&ord, ord.qty};
+    replayed_ids_[ord.id] = &rec;
+    for (auto& f : rec.fills) {
+      auto px = f.px;
+      auto qty = f.qty;
+      Async([this, &rec, px, qty]() { ReplayFill(&rec, qty, px); },
+            f.dt / kMicroInSecF);
+    }
+    if (rec.unsolicited_dt < 0) return;
+    Async(
+        [this, &rec]() {
+          auto it = replayed_.find(&rec);
+          if (it == replayed_.end()) return;
+          auto id = it->second.order->id;
+          HandleCanceled(id, id, rec.text);
+          replayed_ids_.erase(id);
+          replayed_.erase(it);
+        },
+        rec.unsolicited_dt / kMicroInSecF);
+  });
+}
+
 std::string Simulator::Place(const Order& ord) noexcept {
-  Async(
-      [this, &ord]() {
-        auto id = ord.id;
-        if (!ord.sec->IsInTradePeriod()) {
-          HandleNewRejected(id, "Not in trading period");
-          return;
-        }
-        auto qty = ord.qty;
-        if (qty <= 0) {
-          HandleNewRejected(id, "invalid OrderQty");
-          return;
-        }
-        if (ord.price < 0 && ord.type != kMarket) {
-          HandleNewRejected(id, "invalid price");
-          return;
-        }
-        if (ord.type == kMarket) {
-          auto q = MarketDataManager::Instance().Get(*ord.sec).quote();
-          auto qty_q = ord.IsBuy() ? q.ask_size : q.bid_size;
-          auto px_q = ord.IsBuy() ? q.ask_price : q.bid_price;
-          if (!qty_q && ord.sec->type == kForexPair) qty_q = 1e9;
-          if (qty_q > 0 && px_q > 0) {
-            HandleNew(id, "");
-            if (qty_q > qty) qty_q = qty;
-            HandleFill(id, qty_q, px_q, boost::uuids::to_string(kUuidGen()), 0,
-                       qty_q != qty);
-            auto algo_id = ord.inst ? ord.inst->algo().id() : 0;
-            of_ << std::setprecision(15) << GetNowStr() << ','
-                << ord.sec->symbol << ',' << (ord.IsBuy() ? 'B' : 'S') << ','
-                << qty_q << ',' << px_q << ',' << algo_id << '\n';
-            if (qty_q != qty) {
-              HandleCanceled(id, id, "");
-            }
-            return;
-          } else {
-            HandleNewRejected(id, "no quote");
-            return;
-          }
-        } else {
-          HandleNew(id, "");
-        }
-        OrderTuple tuple{qty, &ord};
-        auto& actives_of_sec = active_orders_[ord.sec->id];
-        auto it = (ord.IsBuy() ? actives_of_sec.buys : actives_of_sec.sells)
-                      .emplace(ord.price, tuple);
-        actives_of_sec.all.emplace(id, it);
-        assert(actives_of_sec.all.size() ==
-               actives_of_sec.buys.size() + actives_of_sec.sells.size());
-        Async([this, &ord, &actives_of_sec]() {
-          auto& md = this->md()[ord.sec->id];
-          auto px = ord.IsBuy() ? md.quote().ask_price : md.quote().bid_price;
-          if (!px) return;
-          auto qty = ord.IsBuy() ? md.quote().ask_size : md.quote().bid_size;
-          if (!qty && ord.sec->type == kForexPair) qty = 1e9;
-          if (ord.IsBuy()) {
-            TryFillBuy(px, qty, &actives_of_sec);
-          } else {
-            TryFillSell(px, qty, &actives_of_sec);
-          }
-        });
-      },
-      Backtest::Instance().latency());
+  auto& replay = Backtest::Instance().replay();
+  if (replay.loaded()) {
+    auto rec = replay.Match(ord);
+    if (rec) {
+      PlaceReplayed(ord, *rec);
+      return {};
+    }
+  }
+  ToExchange(*ord.sec, [this, &ord]() {
+    auto& sec = *ord.sec;
+    auto id = ord.id;
+    auto reject = [this, &sec, id](const char* text) {
+      FromExchange(sec, [this, id, text]() { HandleNewRejected(id, text); });
+    };
+    if (!sec.IsInTradePeriod()) {
+      reject("Not in trading period");
+      return;
+    }
+    auto qty = ord.qty;
+    if (qty <= 0) {
+      reject("invalid OrderQty");
+      return;
+    }
+    if (ord.price < 0 && ord.type != kMarket) {
+      reject("invalid price");
+      return;
+    }
+    if (ord.type == kMarket) {
+      auto& q = OrdersOf(sec).quote;
+      auto qty_q = ord.IsBuy() ? q.ask_size : q.bid_size;
+      auto px_q = ord.IsBuy() ? q.ask_price : q.bid_price;
+      if (!qty_q && sec.type == kForexPair) qty_q = 1e9;
+      if (qty_q <= 0 || px_q <= 0) {
+        reject("no quote");
+        return;
+      }
+      if (qty_q > qty) qty_q = qty;
+      FromExchange(sec, [this, id, qty_q, px_q, partial = qty_q != qty]() {
+        HandleNew(id, "");
+        HandleFill(id, qty_q, px_q, boost::uuids::to_string(kUuidGen()), 0,
+                   partial);
+        if (partial) HandleCanceled(id, id, "");
+      });
+      LogTrade(ord, qty_q, px_q);
+      return;
+    }
+    FromExchange(sec, [this, id]() { HandleNew(id, ""); });
+    Rest(ord, qty);
+  });
   return {};
 }
 
+// queues qty of ord at the back of its price level, and fills it against
+// the quote it crosses
+void Simulator::Rest(const Order& ord, double qty) {
+  auto& actives_of_sec = OrdersOf(*ord.sec);
+  auto& scale = actives_of_sec.scale;
+  auto& q = actives_of_sec.quote;
+  auto buy = ord.IsBuy();
+  auto tick = scale.From(ord.price);
+  auto px = buy ? q.bid_price : q.ask_price;
+  OrderTuple tuple{qty, &ord,
+                   px > 0 ? QueueAhead(buy, tick, scale.From(px),
+                                       buy ? q.bid_size : q.ask_size)
+                          : 0};
+  auto& side = buy ? actives_of_sec.buys : actives_of_sec.sells;
+  auto level = side.try_emplace(tick).first;
+  auto it = level->second.insert(level->second.end(), tuple);
+  actives_of_sec.all.emplace(ord.id, Orders::Loc{level, it});
+  Async([this, &ord, &actives_of_sec]() {
+    auto& q = actives_of_sec.quote;
+    auto px = ord.IsBuy() ? q.ask_price : q.bid_price;
+    if (!px) return;
+    auto qty = ord.IsBuy() ? q.ask_size : q.bid_size;
+    if (!qty && ord.sec->type == kForexPair) qty = 1e9;
+    if (ord.IsBuy()) {
+      TryFillBuy(px, qty, &actives_of_sec);
+    } else {
+      TryFillSell(px, qty, &actives_of_sec);
+    }
+  });
+}
+
 std::string Simulator::Cancel(const Order& ord) noexcept {
-  Async(
-      [this, &ord]() {
-        auto& actives_of_sec = active_orders_[ord.sec->id];
-        auto it = actives_of_sec.all.find(ord.orig_id);
-        auto id = ord.id;
-        auto orig_id = ord.orig_id;
-        if (it == actives_of_sec.all.end()) {
-          HandleCancelRejected(id, orig_id, "inactive");
-        } else {
-          HandleCanceled(id, orig_id, "");
-          (ord.IsBuy() ? actives_of_sec.buys : actives_of_sec.sells)
-              .erase(it->second);
-          actives_of_sec.all.erase(it);
-        }
-      },
-      Backtest::Instance().latency());
+  ToExchange(*ord.sec, [this, &ord]() {
+    auto& sec = *ord.sec;
+    auto id = ord.id;
+    auto orig_id = ord.orig_id;
+    auto canceled = [this, &sec, id, orig_id]() {
+      FromExchange(sec,
+                   [this, id, orig_id]() { HandleCanceled(id, orig_id, ""); });
+    };
+    auto rit = replayed_ids_.find(orig_id);
+    if (rit != replayed_ids_.end()) {
+      canceled();
+      replayed_.erase(rit->second);
+      replayed_ids_.erase(rit);
+      return;
+    }
+    auto& actives_of_sec = OrdersOf(sec);
+    auto it = actives_of_sec.all.find(orig_id);
+    if (it == actives_of_sec.all.end()) {
+      FromExchange(sec, [this, id, orig_id]() {
+        HandleCancelRejected(id, orig_id, "inactive");
+      });
+      return;
+    }
+    canceled();
+    auto level = it->second.level;
+    auto buy = it->second.tuple->order->IsBuy();
+    level->second.erase(it->second.tuple);
+    if (level->second.empty())
+      (buy ? actives_of_sec.buys : actives_of_sec.sells).erase(level);
+    actives_of_sec.all.erase(it);
+  });
+  return {};
+}
+
+// a smaller size at the same price keeps the queue position, anything else
+// goes to the back of the new level
+std::string Simulator::Replace(const Order& ord) noexcept {
+  ToExchange(*ord.sec, [this, &ord]() {
+    auto& sec = *ord.sec;
+    auto id = ord.id;
+    auto reject = [this, &sec, id](const char* text) {
+      FromExchange(sec,
+                   [this, id, text]() { HandleReplaceRejected(id, text); });
+    };
+    auto replaced = [this, &sec, id]() {
+      FromExchange(sec, [this, id]() { HandleReplaced(id, ""); });
+    };
+    // a replayed order keeps its recorded fills
+    auto rit = replayed_ids_.find(ord.orig_id);
+    if (rit != replayed_ids_.end()) {
+      auto rec = rit->second;
+      auto& r = replayed_[rec];
+      auto leaves = ord.qty - r.order->cum_qty;
+      if (leaves <= 0) {
+        reject("invalid OrderQty");
+        return;
+      }
+      replaced();
+      r = Replayed{&ord, leaves};
+      replayed_ids_.erase(rit);
+      replayed_ids_[id] = rec;
+      return;
+    }
+    auto& actives_of_sec = OrdersOf(sec);
+    auto it = actives_of_sec.all.find(ord.orig_id);
+    if (it == actives_of_sec.all.end()) {
+      reject("inactive");
+      return;
+    }
+    auto loc = it->second;
+    auto& tuple = *loc.tuple;
+    // filled at the exchange, of which the confirmations may be on the way
+    auto cum_qty = tuple.order->qty - tuple.leaves;
+    auto leaves = ord.qty - cum_qty;
+    if (leaves <= 0) {
+      reject("invalid OrderQty");
+      return;
+    }
+    actives_of_sec.all.erase(it);
+    replaced();
+    if (loc.level->first == actives_of_sec.scale.From(ord.price) &&
+        leaves <= tuple.leaves) {
+      tuple.leaves = leaves;
+      tuple.order = &ord;
+      actives_of_sec.all.emplace(id, loc);
+      return;
+    }
+    auto buy = ord.IsBuy();
+    loc.level->second.erase(loc.tuple);
+    if (loc.level->second.empty())
+      (buy ? actives_of_sec.buys : actives_of_sec.sells).erase(loc.level);
+    Rest(ord, leaves);
+  });
   return {};
 }
 
 void Simulator::ResetData() {
   seed_ = 0;
-  for (auto& pair : md()) {
-    const_cast<Security*>(SecurityManager::Instance().Get(pair.first))
-        ->close_price = pair.second.trade.close;
-    pair.second.Clear();
-    pair.second = MarketData{};
-  }
+  md().ForEach([](Security::IdType id, MarketData& md) {
+    SecurityManager::Instance().SetClosePrice(id, md.trade.close);
+    md.Clear();
+    md = MarketData{};
+  });
   active_orders_.clear();
+  replayed_.clear();
+  replayed_ids_.clear();
 }
 
 }  // namespace opentrade
@@ -4,44 +4,95 @@
 
 #include <boost/date_time/gregorian/gregorian.hpp>
 #include <fstream>
+#include <list>
+#include <map>
 #include <unordered_map>
 
 #include "exchange_connectivity.h"
+#include "fixed_point.h"
 #include "market_data.h"
 #include "order.h"
+#include "replay.h"
 #include "security.h"
+#include "trade_file.h"
 
 namespace opentrade {
 
 class Simulator : public ExchangeConnectivityAdapter, public MarketDataAdapter {
  public:
-  explicit Simulator(std::ostream& of) : of_(of) { connected_ = 1; }
+  explicit Simulator(TradeWriter& of) : of_(of) { connected_ = 1; }
   void Start() noexcept override {}
   void Stop() noexcept override {}
   void Reconnect() noexcept override {}
   void SubscribeSync(const opentrade::Security& sec) noexcept override {}
   std::string Place(const opentrade::Order& ord) noexcept override;
   std::string Cancel(const opentrade::Order& ord) noexcept override;
+  bool replace_supported() const noexcept override { return true; }
+  std::string Replace(const opentrade::Order& ord) noexcept override;
   void ResetData();
   struct OrderTuple {
     double leaves = 0;
     const Order* order = nullptr;
+    // displayed size queued in front of the order at its price
+    double ahead = 0;
   };
+  typedef std::list<OrderTuple> Level;  // time priority
+  // by the exact ticks of the prices in the scale of the security
+  typedef std::map<Fixed, Level> Ladder;
   struct Orders {
-    typedef std::multimap<double, OrderTuple> Map;
-    Map buys;
-    Map sells;
-    std::unordered_map<Order::IdType, Map::iterator> all;
+    struct Loc {
+      Ladder::iterator level;
+      Level::iterator tuple;
+    };
+    Ladder buys;
+    Ladder sells;
+    std::unordered_map<Order::IdType, Loc> all;
+    FixedScale scale;
+    // the top of book matched against, ahead of the one the algos see by
+    // MD_LATENCY
+    MarketData::Quote quote;
   };
+  // matches the tick at once and delivers it to the algos MD_LATENCY later.
+  // trade_hit_ratio < 0 fills on trade ticks by queue position, otherwise
+  // that share of trade ticks fills regardless of the queue
   void HandleTick(const Security& sec, char type, double px, double qty,
                   double trade_hit_ratio, Orders* actives_of_sec);
-  double TryFillBuy(double px, double qty, Orders* actives_of_sec);
-  double TryFillSell(double px, double qty, Orders* actives_of_sec);
+  // print: px is a trade, which only fills the queue behind the displayed
+  // size at px
+  double TryFillBuy(double px, double qty, Orders* actives_of_sec,
+                    bool print = false);
+  double TryFillSell(double px, double qty, Orders* actives_of_sec,
+                     bool print = false);
   auto& active_orders() { return active_orders_; }
+  // of the security, created with its price scale
+  Orders& OrdersOf(const Security& sec) {
+    auto r = active_orders_.try_emplace(sec.id);
+    if (r.second) r.first->second.scale = sec.price_scale();
+    return r.first->second;
+  }
+
+ private:
+  double FillLevel(Ladder* side, Ladder::iterator level, double qty,
+                   bool print, Orders* actives_of_sec);
+  void Fill(OrderTuple* tuple, double qty, double px);
+  void Rest(const Order& ord, double qty);
+  // the tick to the algos
+  void Deliver(const Security& sec, char type, double px, double qty);
+  void LogTrade(const Order& ord, double qty, double px);
+  // plays the confirmations of rec back to ord, see Replay
+  void PlaceReplayed(const Order& ord, const Replay::Recorded& rec);
+  void ReplayFill(const Replay::Recorded* rec, double qty, double px);
 
  private:
   std::unordered_map<Security::IdType, Orders> active_orders_;
-  std::ostream& of_;
+  // the live orders played back, and the recorded one of each id
+  struct Replayed {
+    const Order* order;
+    double leaves;
+  };
+  std::unordered_map<const Replay::Recorded*, Replayed> replayed_;
+  std::unordered_map<Order::IdType, const Replay::Recorded*> replayed_ids_;
+  TradeWriter& of_;
   uint32_t seed_ = 0;
 };
 
@@ -0,0 +1,73 @@
+#ifndef OPENTRADE_SMALL_STRING_H_
+#define OPENTRADE_SMALL_STRING_H_
+
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace opentrade {
+
+// String with inline buffer for ids (exec id, exchange order id), only
+// strings no shorter than N go to heap.
+template <size_t N = 32>
+class SmallString {
+ public:
+  SmallString() { buf_[0] = 0; }
+  SmallString(const char* s) { Assign(s, strlen(s)); }
+  SmallString(const std::string& s) { Assign(s.data(), s.size()); }
+  SmallString(std::string_view s) { Assign(s.data(), s.size()); }
+  SmallString(const SmallString& b) { Assign(b.data(), b.size()); }
+  ~SmallString() { delete[] heap_; }
+
+  SmallString& operator=(const SmallString& b) {
+    if (this != &b) Assign(b.data(), b.size());
+    return *this;
+  }
+  SmallString& operator=(const std::string& s) {
+    Assign(s.data(), s.size());
+    return *this;
+  }
+  SmallString& operator=(const char* s) {
+    Assign(s, strlen(s));
+    return *this;
+  }
+
+  const char* c_str() const { return heap_ ? heap_ : buf_; }
+  const char* data() const { return c_str(); }
+  size_t size() const { return size_; }
+  bool empty() const { return !size_; }
+  std::string str() const { return std::string(data(), size_); }
+  operator std::string_view() const { return std::string_view(data(), size_); }
+
+  bool operator==(std::string_view b) const {
+    return std::string_view(*this) == b;
+  }
+  bool operator!=(std::string_view b) const { return !(*this == b); }
+
+  friend std::ostream& operator<<(std::ostream& os, const SmallString& s) {
+    return os.write(s.data(), s.size());
+  }
+
+ private:
+  void Assign(const char* s, size_t n) {
+    char* dest = buf_;
+    if (n >= N) {
+      dest = new char[n + 1];
+    }
+    memmove(dest, s, n);
+    dest[n] = 0;
+    delete[] heap_;
+    heap_ = dest == buf_ ? nullptr : dest;
+    size_ = n;
+  }
+
+  char* heap_ = nullptr;
+  uint32_t size_ = 0;
+  char buf_[N];
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_SMALL_STRING_H_
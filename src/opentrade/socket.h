@@ -0,0 +1,118 @@
+#ifndef OPENTRADE_SOCKET_H_
+#define OPENTRADE_SOCKET_H_
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <string>
+
+namespace opentrade {
+
+// Blocking TCP helpers for the node to node links, replication and
+// sharding, which run on threads of their own rather than the io_service
+
+static inline bool SendAll(int fd, const char* p, size_t n) {
+  while (n) {
+    auto rc = ::send(fd, p, n, MSG_NOSIGNAL);
+    if (rc < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    p += rc;
+    n -= rc;
+  }
+  return true;
+}
+
+static inline bool SplitHostPort(const std::string& addr, std::string* host,
+                                 std::string* port) {
+  auto pos = addr.rfind(':');
+  if (pos == std::string::npos || !pos || pos + 1 == addr.size()) return false;
+  *host = addr.substr(0, pos);
+  *port = addr.substr(pos + 1);
+  return true;
+}
+
+// non-blocking connect to bound the wait for an unreachable host, returns a
+// blocking socket, -1 on failure
+static inline int TcpConnect(const std::string& host, const std::string& port,
+                             int timeout_ms = 1000) {
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* res = nullptr;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res)) return -1;
+  auto fd = -1;
+  for (auto ai = res; ai && fd < 0; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0) continue;
+    auto flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    auto ok = !connect(fd, ai->ai_addr, ai->ai_addrlen);
+    if (!ok && errno == EINPROGRESS) {
+      pollfd p{fd, POLLOUT, 0};
+      int err = 0;
+      socklen_t len = sizeof(err);
+      ok = poll(&p, 1, timeout_ms) == 1 &&
+           !getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) && !err;
+    }
+    fcntl(fd, F_SETFL, flags);
+    if (!ok) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(res);
+  if (fd >= 0) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  return fd;
+}
+
+// on all interfaces, -1 on failure with errno set
+static inline int TcpListen(uint16_t port, int backlog = 4) {
+  auto fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) ||
+      listen(fd, backlog)) {
+    auto err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  return fd;
+}
+
+// retries on EINTR, sets *addr to ip:port of the peer, -1 on failure
+static inline int TcpAccept(int listen_fd, std::string* addr) {
+  for (;;) {
+    sockaddr_in sa{};
+    socklen_t len = sizeof(sa);
+    auto fd = accept(listen_fd, reinterpret_cast<sockaddr*>(&sa), &len);
+    if (fd < 0 && errno == EINTR) continue;
+    if (fd < 0) return fd;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    char ip[INET_ADDRSTRLEN] = "";
+    inet_ntop(AF_INET, &sa.sin_addr, ip, sizeof(ip));
+    *addr = std::string(ip) + ':' + std::to_string(ntohs(sa.sin_port));
+    return fd;
+  }
+}
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_SOCKET_H_
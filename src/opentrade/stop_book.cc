@@ -1,6 +1,7 @@
 #include "stop_book.h"
 
 #include "database.h"
+#include "logger.h"
 
 namespace opentrade {
 
@@ -14,12 +15,32 @@ void StopBookManager::Initialize() {
     auto i = 0;
     auto sec = Database::GetValue(*it, i++, 0);
     auto acc = Database::GetValue(*it, i++, 0);
-    self.stop_book_.emplace(std::make_pair(sec, acc), true);
+    self.Set(sec, acc, true);
+  }
+
+  try {
+    query = "select kind, value, sub_account_id from stop_book_group";
+    soci::rowset<soci::row> rows = sql->prepare << query;
+    for (auto it = rows.begin(); it != rows.end(); ++it) {
+      auto i = 0;
+      auto kind = Database::GetValue(*it, i++, 0);
+      auto value = Database::GetValue(*it, i++, 0);
+      auto acc = Database::GetValue(*it, i++, 0);
+      if (kind != kExchange && kind != kSector) continue;
+      self.SetGroup(static_cast<GroupKind>(kind), value, acc, true);
+    }
+  } catch (const soci::soci_error& e) {
+    LOG_WARN("No stop_book_group table, run with --db_create_tables: "
+             << e.what());
   }
 }
 
 bool StopBookManager::CheckStop(const Security& sec, const SubAccount* acc,
                                 std::string* err) const {
+  if (!counts_[sec.id & (kSlots - 1)].load(std::memory_order_relaxed) &&
+      !num_groups_.load(std::memory_order_relaxed))
+    return true;
+
   char buf[256];
   if (Get(sec.id, acc ? acc->id : 0)) {
     if (acc)
@@ -39,6 +60,20 @@ bool StopBookManager::CheckStop(const Security& sec, const SubAccount* acc,
       return false;
     }
   }
+
+  if (!num_groups_.load(std::memory_order_relaxed)) return true;
+  auto acc_id = acc ? acc->id : 0;
+  if (sec.exchange && IsGroupStopped(kExchange, sec.exchange->id, acc_id)) {
+    snprintf(buf, sizeof(buf), "exchange \"%s\" is stopped",
+             sec.exchange->name);
+    *err = buf;
+    return false;
+  }
+  if (IsGroupStopped(kSector, sec.sector, acc_id)) {
+    snprintf(buf, sizeof(buf), "sector %d is stopped", sec.sector);
+    *err = buf;
+    return false;
+  }
   return true;
 }
 
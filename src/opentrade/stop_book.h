@@ -2,14 +2,27 @@
 #define OPENTRADE_STOP_BOOK_H_
 
 #include <tbb/concurrent_unordered_map.h>
+#include <atomic>
+#include <memory>
 
 #include "account.h"
 #include "security.h"
 
 namespace opentrade {
 
+// Stopped securities, and stopped exchanges and sectors in bulk, optionally
+// of one sub account. CheckStop reads one counter slot of the security and
+// the group count in the common case that nothing of either is stopped.
 class StopBookManager : public Singleton<StopBookManager> {
  public:
+  enum GroupKind {
+    kExchange = 0,
+    kSector = 1,
+  };
+  typedef std::pair<Security::IdType, SubAccount::IdType> Key;
+  typedef tbb::concurrent_unordered_map<Key, bool> Book;
+
+  StopBookManager() : counts_(new std::atomic<uint32_t>[kSlots]{}) {}
   static void Initialize();
 
   const auto Get(Security::IdType sec, Security::IdType acc) const {
@@ -17,18 +30,40 @@ class StopBookManager : public Singleton<StopBookManager> {
   }
 
   void Set(Security::IdType sec, Security::IdType acc, bool value) {
-    stop_book_[std::make_pair(sec, acc)] = value;
+    auto& v = stop_book_[std::make_pair(sec, acc)];
+    if (v == value) return;
+    v = value;
+    counts_[sec & (kSlots - 1)].fetch_add(value ? 1 : -1,
+                                          std::memory_order_relaxed);
   }
 
   const auto& Get() const { return stop_book_; }
 
+  void SetGroup(GroupKind kind, int value, SubAccount::IdType acc,
+                bool stopped) {
+    auto& v = groups_[kind][std::make_pair(value, acc)];
+    if (v == stopped) return;
+    v = stopped;
+    num_groups_.fetch_add(stopped ? 1 : -1, std::memory_order_relaxed);
+  }
+
+  const Book& GetGroups(GroupKind kind) const { return groups_[kind]; }
+
   bool CheckStop(const Security& sec, const SubAccount* acc,
                  std::string* err) const;
 
  private:
-  tbb::concurrent_unordered_map<std::pair<Security::IdType, SubAccount::IdType>,
-                                bool>
-      stop_book_;
+  bool IsGroupStopped(GroupKind kind, int value, SubAccount::IdType acc) const {
+    if (FindInMap(groups_[kind], std::make_pair(value, 0))) return true;
+    return acc && FindInMap(groups_[kind], std::make_pair(value, acc));
+  }
+
+  static inline const size_t kSlots = 1 << 16;
+  Book stop_book_;
+  Book groups_[2];
+  // stopped entries of the securities hashed to each slot
+  std::unique_ptr<std::atomic<uint32_t>[]> counts_;
+  std::atomic<uint32_t> num_groups_ = 0;
 };
 
 }  // namespace opentrade
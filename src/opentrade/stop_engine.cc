@@ -0,0 +1,93 @@
+#include "stop_engine.h"
+
+#include <boost/container/small_vector.hpp>
+
+#include "exchange_connectivity.h"
+
+namespace opentrade {
+
+template <typename Map>
+static inline bool Erase(Map* map, const Order& ord) {
+  auto range = map->equal_range(ord.stop_price);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second != &ord) continue;
+    map->erase(it);
+    return true;
+  }
+  return false;
+}
+
+StopEngine::Ladder* StopEngine::Get(const Security& sec) {
+  std::lock_guard<std::mutex> lock(m_);
+  auto& ladder = ladders_[sec.id];
+  if (!ladder) {
+    // never unhooked, a security with stops once likely has them again
+    ladder = new Ladder;
+    const_cast<MarketData&>(MarketDataManager::Instance().Get(sec))
+        .HookTradeTick(ladder);
+  }
+  return ladder;
+}
+
+void StopEngine::Place(Order* ord) {
+  auto ladder = Get(*ord->sec);
+  std::lock_guard<std::mutex> lock(ladder->m);
+  if (ord->IsBuy())
+    ladder->buys.emplace(ord->stop_price, ord);
+  else
+    ladder->sells.emplace(ord->stop_price, ord);
+  ladder->UpdateBounds();
+  size_++;
+}
+
+bool StopEngine::Cancel(const Order& ord) {
+  Ladder* ladder;
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    ladder = FindInMap(ladders_, ord.sec->id);
+  }
+  if (!ladder) return false;
+  std::lock_guard<std::mutex> lock(ladder->m);
+  if (!(ord.IsBuy() ? Erase(&ladder->buys, ord) : Erase(&ladder->sells, ord)))
+    return false;
+  ladder->UpdateBounds();
+  size_--;
+  return true;
+}
+
+void StopEngine::Ladder::UpdateBounds() {
+  buy_at.store(buys.empty() ? std::numeric_limits<double>::infinity()
+                            : buys.begin()->first,
+               std::memory_order_release);
+  sell_at.store(sells.empty() ? -std::numeric_limits<double>::infinity()
+                              : sells.begin()->first,
+                std::memory_order_release);
+}
+
+void StopEngine::Ladder::OnTrade(DataSrc::IdType src, Security::IdType id,
+                                 const MarketData* md, time_t tm, double px,
+                                 double qty) noexcept {
+  if (px <= 0) return;
+  if (px < buy_at.load(std::memory_order_acquire) &&
+      px > sell_at.load(std::memory_order_acquire))
+    return;
+  boost::container::small_vector<Order*, 8> triggered;
+  {
+    std::lock_guard<std::mutex> lock(m);
+    while (!buys.empty() && buys.begin()->first <= px) {
+      triggered.push_back(buys.begin()->second);
+      buys.erase(buys.begin());
+    }
+    while (!sells.empty() && sells.begin()->first >= px) {
+      triggered.push_back(sells.begin()->second);
+      sells.erase(sells.begin());
+    }
+    UpdateBounds();
+  }
+  StopEngine::Instance().size_ -= triggered.size();
+  // outside of the lock, the confirmations may cancel other stops of it
+  auto& ecm = ExchangeConnectivityManager::Instance();
+  for (auto ord : triggered) ecm.Trigger(ord);
+}
+
+}  // namespace opentrade
@@ -0,0 +1,56 @@
+#ifndef OPENTRADE_STOP_ENGINE_H_
+#define OPENTRADE_STOP_ENGINE_H_
+
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+#include "market_data.h"
+#include "order.h"
+
+namespace opentrade {
+
+// Stop and stop limit orders held locally for the sessions without native
+// stops, see ExchangeConnectivityAdapter::stop_supported. Each security has
+// two ladders of stop prices hooked on its trade ticks (of the default data
+// source), a tick takes the stops it crosses off the near ends, so it costs
+// O(triggered) however many are resting, and only two atomic loads if none.
+// A triggered stop goes to its session as a market order, a stop limit as a
+// limit order at its price. Held in memory only, the ones resting when the
+// process exits are not restored.
+class StopEngine : public Singleton<StopEngine> {
+ public:
+  // ord is risk checked and confirmed new already
+  void Place(Order* ord);
+  // takes ord off its ladder, false if not resting here, e.g. triggered
+  bool Cancel(const Order& ord);
+  // resting orders
+  size_t size() const { return size_; }
+
+ private:
+  struct Ladder : public TradeTickHook {
+    void OnTrade(DataSrc::IdType src, Security::IdType id,
+                 const MarketData* md, time_t tm, double px,
+                 double qty) noexcept override;
+    void UpdateBounds();
+    std::mutex m;
+    // buy stops trigger at or above, sell stops at or below their price
+    std::multimap<double, Order*> buys;
+    std::multimap<double, Order*, std::greater<double>> sells;
+    // the nearest stop prices, read without the lock
+    std::atomic<double> buy_at = std::numeric_limits<double>::infinity();
+    std::atomic<double> sell_at = -std::numeric_limits<double>::infinity();
+  };
+  Ladder* Get(const Security& sec);
+
+  std::mutex m_;
+  std::unordered_map<Security::IdType, Ladder*> ladders_;
+  std::atomic<size_t> size_ = 0;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_STOP_ENGINE_H_
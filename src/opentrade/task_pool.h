@@ -2,22 +2,195 @@
 #define OPENTRADE_TASK_POOL_H_
 
 #include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include "metrics.h"
+#include "timer_wheel.h"
+
 namespace opentrade {
 
+// posts a move-only handler, io_service::post before boost 1.66 copies it
+template <typename T>
+inline void PostTask(boost::asio::io_service& io, T&& func) {
+#if BOOST_VERSION < 106600
+  auto f = std::make_shared<std::decay_t<T>>(std::forward<T>(func));
+  io.post([f]() { (*f)(); });
+#else
+  boost::asio::post(io, std::forward<T>(func));
+#endif
+}
+
+// TimerWheel driven by a single steady_timer of an io_service, expired tasks
+// run on the io_service threads. Thread safe.
+class TimerService {
+ public:
+  explicit TimerService(boost::asio::io_service& io,
+                        int64_t tick_in_micro = 1000)
+      : wheel_(tick_in_micro, Now()), timer_(io) {}
+
+  static int64_t Now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  TimerId Add(InlineFunc func, int64_t delay_in_micro) {
+    std::lock_guard<std::mutex> lock(m_);
+    auto id = wheel_.Add(std::move(func), Now() + delay_in_micro);
+    Arm();
+    return id;
+  }
+
+  // fixed-rate, the n-th run is scheduled at first + n * interval regardless
+  // of how late the previous runs were, missed runs are skipped
+  TimerId AddPeriodic(InlineFunc func, int64_t delay_in_micro,
+                      int64_t interval_in_micro) {
+    if (interval_in_micro <= 0) interval_in_micro = 1;
+    auto p = std::make_shared<Periodic>();
+    p->func = std::move(func);
+    p->interval = interval_in_micro;
+    std::lock_guard<std::mutex> lock(m_);
+    auto id = kPeriodic | ++periodic_id_counter_;
+    p->next = Now() + delay_in_micro;
+    p->timer = wheel_.Add([this, id]() { Fire(id); }, p->next);
+    periodics_.emplace(id, p);
+    Arm();
+    return id;
+  }
+
+  bool Cancel(TimerId id) {
+    std::lock_guard<std::mutex> lock(m_);
+    if (id & kPeriodic) {
+      auto it = periodics_.find(id);
+      if (it == periodics_.end()) return false;
+      wheel_.Cancel(it->second->timer);
+      periodics_.erase(it);
+      return true;
+    }
+    return wheel_.Cancel(id);
+  }
+
+  struct Stats {
+    uint64_t runs = 0;
+    uint64_t skipped = 0;
+    int64_t max_jitter = 0;  // micro seconds behind schedule
+    double avg_jitter = 0;
+  };
+
+  // stats of a periodic task
+  Stats GetStats(TimerId id) const {
+    std::lock_guard<std::mutex> lock(m_);
+    auto it = periodics_.find(id);
+    if (it == periodics_.end()) return {};
+    return it->second->stats;
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(m_);
+    return wheel_.size();
+  }
+
+  // runs the expired tasks on the calling thread without waiting for the
+  // io_service to see the timer, for a busy polling thread; false if none due
+  bool Poll() {
+    auto due = due_.load(std::memory_order_relaxed);
+    if (due < 0 || Now() < due) return false;
+    OnTimer();
+    return true;
+  }
+
+ private:
+  void Arm() {
+    auto next = wheel_.NextWakeup();
+    if (next < 0 || (armed_ >= 0 && armed_ <= next)) return;
+    armed_ = next;
+    due_.store(next, std::memory_order_relaxed);
+    timer_.expires_at(std::chrono::steady_clock::time_point(
+        std::chrono::microseconds(next)));
+    timer_.async_wait([this](const boost::system::error_code& ec) {
+      if (ec == boost::asio::error::operation_aborted) return;
+      OnTimer();
+    });
+  }
+
+  void OnTimer() {
+    std::vector<InlineFunc> funcs;
+    {
+      std::lock_guard<std::mutex> lock(m_);
+      armed_ = -1;
+      due_.store(-1, std::memory_order_relaxed);
+      wheel_.Advance(Now(), &funcs);
+      Arm();
+    }
+    for (auto& f : funcs) f();
+  }
+
+  void Fire(TimerId id) {
+    std::shared_ptr<Periodic> p;
+    {
+      std::lock_guard<std::mutex> lock(m_);
+      auto it = periodics_.find(id);
+      if (it == periodics_.end()) return;
+      p = it->second;
+      auto now = Now();
+      auto& st = p->stats;
+      auto jitter = now - p->next;
+      if (jitter > st.max_jitter) st.max_jitter = jitter;
+      st.avg_jitter += (jitter - st.avg_jitter) / ++st.runs;
+      p->next += p->interval;
+      if (p->next <= now) {
+        auto n = (now - p->next) / p->interval + 1;
+        st.skipped += n;
+        p->next += n * p->interval;
+      }
+      // rescheduled before running so that a slow run does not drift
+      p->timer = wheel_.Add([this, id]() { Fire(id); }, p->next);
+      Arm();
+    }
+    p->func();
+  }
+
+ private:
+  static inline const TimerId kPeriodic = 1lu << 63;
+  struct Periodic {
+    InlineFunc func;
+    int64_t next = 0;
+    int64_t interval = 0;
+    TimerId timer = 0;
+    Stats stats;
+  };
+  TimerWheel wheel_;
+  boost::asio::steady_timer timer_;
+  int64_t armed_ = -1;
+  std::atomic<int64_t> due_ = -1;  // armed_ readable without the lock
+  TimerId periodic_id_counter_ = 0;
+  std::unordered_map<TimerId, std::shared_ptr<Periodic>> periodics_;
+  mutable std::mutex m_;
+};
+
 class TaskPool {
  public:
-  explicit TaskPool(size_t nthreads = 1) {
+  // a named pool is exported in Metrics with label pool=name
+  explicit TaskPool(size_t nthreads = 1, const std::string& name = "")
+      : timers_(service_) {
     work_.reset(new boost::asio::io_service::work(service_));
     for (auto i = 0u; i < nthreads; ++i) {
       threads_.emplace_back([this]() { service_.run(); });
     }
+    if (!name.empty()) Register(name);
   }
 
   ~TaskPool() {
+    Metrics::Instance().Remove(this);
     if (work_) Stop();
   }
 
@@ -33,34 +206,77 @@ class TaskPool {
     }
   }
 
+  // t is a boost::posix_time duration, returned id can be used in CancelTask
   template <typename T, typename Tm>
-  void AddTask(const T& func, Tm t) {
-    auto tt = new boost::asio::deadline_timer(service_, t);
-    tt->async_wait([=](const boost::system::error_code&) {
+  TimerId AddTask(T&& func, Tm t) {
+    return timers_.Add(std::forward<T>(func), t.total_microseconds());
+  }
+
+  bool CancelTask(TimerId id) { return timers_.Cancel(id); }
+
+  template <typename T>
+  void AddTask(T&& func) {
+    queued_.fetch_add(1, std::memory_order_relaxed);
+    PostTask(service_, [this, func = std::forward<T>(func),
+                        tm = TimerService::Now()]() mutable {
+      lag_.store(TimerService::Now() - tm, std::memory_order_relaxed);
+      queued_.fetch_sub(1, std::memory_order_relaxed);
+      executed_.fetch_add(1, std::memory_order_relaxed);
       func();
-      delete tt;
     });
   }
 
-  template <typename T>
-  void AddTask(const T& func) {
-    service_.post(func);
+  // tasks of AddTask not started yet
+  int64_t queued() const { return queued_.load(std::memory_order_relaxed); }
+  // micro seconds the last started task waited in the queue
+  int64_t lag() const { return lag_.load(std::memory_order_relaxed); }
+  uint64_t executed() const {
+    return executed_.load(std::memory_order_relaxed);
   }
 
+  // fixed-rate periodic task, first run after t, then every interval
   template <typename T, typename Tm, typename Tm2>
-  void RepeatTask(const T& func, Tm t, Tm2 interval) {
-    addTask(
-        [=]() {
-          addTask(func, interval);
-          func();
-        },
-        t);
+  TimerId RepeatTask(T&& func, Tm t, Tm2 interval) {
+    return timers_.AddPeriodic(std::forward<T>(func), t.total_microseconds(),
+                               interval.total_microseconds());
+  }
+
+  TimerService::Stats GetTaskStats(TimerId id) const {
+    return timers_.GetStats(id);
+  }
+
+  auto& service() { return service_; }
+
+  // e.g. to pin them, see ThreadPlacement
+  std::vector<std::thread::native_handle_type> native_handles() {
+    std::vector<std::thread::native_handle_type> out;
+    for (auto& t : threads_) out.push_back(t.native_handle());
+    return out;
+  }
+
+ private:
+  void Register(const std::string& name) {
+    auto& m = Metrics::Instance();
+    auto label = Metrics::Label("pool", name);
+    m.AddGauge("opentrade_task_pool_queued", "Tasks waiting in the pool",
+               label, [this]() { return queued(); }, this);
+    m.AddGauge("opentrade_task_pool_lag_seconds",
+               "Queue wait of the last task started", label,
+               [this]() { return lag() / 1e6; }, this);
+    m.AddCounter("opentrade_task_pool_tasks_total", "Tasks started", label,
+                 [this]() { return executed(); }, this);
+    m.AddGauge("opentrade_task_pool_timers", "Delayed tasks pending", label,
+               [this]() { return timers_.size(); }, this);
   }
 
  protected:
   std::vector<std::thread> threads_;
   boost::asio::io_service service_;
   std::unique_ptr<boost::asio::io_service::work> work_;
+  TimerService timers_;
+  std::atomic<int64_t> queued_ = 0;
+  std::atomic<int64_t> lag_ = 0;
+  std::atomic<uint64_t> executed_ = 0;
 };
 
 }  // namespace opentrade
@@ -0,0 +1,96 @@
+#include "tca.h"
+
+#include "algo.h"
+#include "market_data.h"
+
+namespace opentrade {
+
+static inline double GetMid(const MarketData& md) {
+  auto& q = md.quote();
+  if (q.ask_price > 0 && q.bid_price > 0) return md.mid();
+  return md.trade.close;
+}
+
+// the market volume since the last update, the day volume restarting at 0
+// on a new day
+static inline void UpdateVolume(const MarketData& md, TcaStats* s) {
+  double volume = md.trade.volume;
+  auto value = volume * md.trade.vwap;
+  if (volume >= s->day_volume) {
+    s->volume += volume - s->day_volume;
+    s->value += value - s->day_value;
+  } else {
+    s->volume += volume;
+    s->value += value;
+  }
+  s->day_volume = volume;
+  s->day_value = value;
+}
+
+void TcaManager::Handle(const Confirmation& cm) {
+  auto ord = cm.order;
+  if (!ord || !ord->sec || !ord->sub_account) return;
+  auto fill = (cm.exec_type == kPartiallyFilled || cm.exec_type == kFilled) &&
+              cm.exec_trans_type == kTransNew && cm.last_shares > 0;
+  auto algo_id = ord->inst ? ord->inst->algo().id() : 0;
+  Key key{algo_id, ord->sub_account->id, ord->sec->id};
+  auto& md = MarketDataManager::Instance().Get(*ord->sec);
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    auto it = stats_.find(key);
+    if (it == stats_.end()) {
+      it = stats_.emplace(key, TcaStats{}).first;
+      auto& s = it->second;
+      s.buy = ord->IsBuy();
+      s.arrival_px = GetMid(md);
+      s.day_volume = md.trade.volume;
+      s.day_value = s.day_volume * md.trade.vwap;
+    }
+    if (!fill) return;
+    auto& s = it->second;
+    UpdateVolume(md, &s);
+    s.qty += cm.last_shares;
+    s.notional += cm.last_shares * cm.last_px;
+  }
+  if (markout_seconds_ > 0)
+    Markout(key, *ord->sec, ord->IsBuy(), cm.last_shares, cm.last_px);
+}
+
+void TcaManager::Markout(const Key& key, const Security& sec, bool buy,
+                         double qty, double px) {
+  uint64_t gen;
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    gen = generation_;
+  }
+  auto func = [this, key, &sec, buy, qty, px, gen]() {
+    auto mid = GetMid(MarketDataManager::Instance().Get(sec));
+    if (mid <= 0) return;
+    std::lock_guard<std::mutex> lock(m_);
+    if (gen != generation_) return;
+    auto it = stats_.find(key);
+    if (it == stats_.end()) return;
+    it->second.markout_qty += qty;
+    it->second.markout_pnl += qty * (buy ? mid - px : px - mid);
+  };
+#ifdef BACKTEST
+  kTimers.Push(kTime + markout_seconds_ * kMicroInSec, func);
+#else
+  kTimerTaskPool.AddTask(
+      func, boost::posix_time::microseconds(
+                static_cast<int64_t>(markout_seconds_ * kMicroInSec)));
+#endif
+}
+
+std::vector<std::pair<TcaManager::Key, TcaStats>> TcaManager::Get() const {
+  std::lock_guard<std::mutex> lock(m_);
+  return {stats_.begin(), stats_.end()};
+}
+
+void TcaManager::Clear() {
+  std::lock_guard<std::mutex> lock(m_);
+  stats_.clear();
+  generation_++;
+}
+
+}  // namespace opentrade
@@ -0,0 +1,79 @@
+#ifndef OPENTRADE_TCA_H_
+#define OPENTRADE_TCA_H_
+
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#include "account.h"
+#include "common.h"
+#include "order.h"
+#include "security.h"
+
+namespace opentrade {
+
+// Transaction cost of the fills of an algo, or of the manual orders (algo id
+// 0), of a sub account in a security, accumulated in GlobalOrderBook::Handle
+// as the confirmations come, live and in backtest. The costs are in bps,
+// positive for worse than the benchmark.
+struct TcaStats {
+  bool buy = true;
+  double arrival_px = 0;  // mid at the first confirmation
+  // of the market from arrival to the last fill
+  double volume = 0;
+  double value = 0;  // vwap * volume
+  // day volume and vwap * volume of the market at the last update
+  double day_volume = 0;
+  double day_value = 0;
+  double qty = 0;  // filled
+  double notional = 0;
+  double markout_qty = 0;  // of the fills past the markout horizon
+  double markout_pnl = 0;  // in favor of the fills at the horizon
+
+  double avg_px() const { return qty > 0 ? notional / qty : 0; }
+  double arrival_bps() const { return Bps(avg_px(), arrival_px); }
+  double vwap_bps() const {
+    return volume > 0 ? Bps(avg_px(), value / volume) : 0;
+  }
+  // of the market volume since arrival
+  double participation() const { return volume > 0 ? qty / volume : 0; }
+  double markout_bps() const {
+    auto px = avg_px();
+    return markout_qty > 0 && px > 0 ? markout_pnl / markout_qty / px * 1e4
+                                     : 0;
+  }
+
+ private:
+  double Bps(double px, double benchmark) const {
+    if (px <= 0 || benchmark <= 0) return 0;
+    return (buy ? px - benchmark : benchmark - px) / benchmark * 1e4;
+  }
+};
+
+class TcaManager : public Singleton<TcaManager> {
+ public:
+  // <algo id, sub account id, security id>
+  typedef std::tuple<uint32_t, SubAccount::IdType, Security::IdType> Key;
+
+  void Handle(const Confirmation& cm);
+  // snapshot in key order
+  std::vector<std::pair<Key, TcaStats>> Get() const;
+  void Clear();
+  // seconds after a fill its markout is taken at, 0 for no markout
+  void set_markout_seconds(double v) { markout_seconds_ = v; }
+  double markout_seconds() const { return markout_seconds_; }
+
+ private:
+  void Markout(const Key& key, const Security& sec, bool buy, double qty,
+               double px);
+
+  mutable std::mutex m_;
+  std::map<Key, TcaStats> stats_;
+  double markout_seconds_ = 60;
+  uint64_t generation_ = 0;  // of Clear, the markouts pending dropped
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_TCA_H_
@@ -2,113 +2,290 @@
 #define OPENTRADE_TEST_LATENCY_H_
 #ifdef TEST_LATENCY
 
+#include <sys/resource.h>
+#include <algorithm>
+#include <mutex>
+
 #include "algo.h"
 #include "exchange_connectivity.h"
+#include "latency.h"
 #include "market_data.h"
 
 namespace opentrade {
 
+// Load harness of the algo runtime, configured by environment
+//   TEST_LATENCY_SECURITIES=<n>, the first n securities, 10 by default
+//   TEST_LATENCY_ALGOS=<m>, algos on each security, 1 by default
+//   TEST_LATENCY_RATE=<updates per second> of all the securities, trades
+//     and quotes alternately, 0 (default) as fast as usleep(1) between them
+//   TEST_LATENCY_SECONDS=<s> to sample, 10 by default, then exits
+//   TEST_LATENCY_PLACE=0 not to place an order on every update
+// and the runners by algo_threads. Every second it logs the update rate,
+// the latency percentiles since the first second, and the coalescing ratio
+// and busy share of every runner, then a "Runtime load:" line at the end.
+static inline int64_t TestLatencyEnv(const char* name, int64_t value) {
+  auto str = getenv(name);
+  return str && *str ? atoll(str) : value;
+}
+
+struct TestLatencyEc : public ExchangeConnectivityAdapter {
+  void Start() noexcept override { connected_ = 1; }
+  void Stop() noexcept override {}
+  std::string Place(const opentrade::Order& ord) noexcept override {
+    auto latency = NowUtcInMicro() - ord.tm_for_test_latency;
+    kLatency.Record(std::max<int64_t>(latency, 0));
+    return {};
+  }
+  std::string Cancel(const opentrade::Order& ord) noexcept override {
+    return {};
+  }
+  // market data time stamp to Place, in microseconds
+  static inline LatencyHistogram kLatency;
+};
+
+class TestLatencyReport {
+ public:
+  static void Start(const std::atomic<uint64_t>* updates) {
+    static TestLatencyReport kInstance;
+    kInstance.updates_ = updates;
+    kInstance.tp_.RepeatTask([]() { kInstance.Sample(); },
+                             boost::posix_time::seconds(1),
+                             boost::posix_time::seconds(1));
+  }
+
+ private:
+  struct Runner {
+    uint64_t coalesced = 0;
+    uint64_t dispatched = 0;
+    uint64_t busy = 0;
+  };
+
+  static double CpuSeconds() {
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+  }
+
+  static double Micros(const LatencyHistogram& h, double q) {
+    return h.Percentile(q) / 1e3;
+  }
+
+  void Sample() {
+    auto& mngr = AlgoManager::Instance();
+    auto& latency = TickLatency::Instance();
+    auto now = FineClock::SteadyNow();
+    auto cpu = CpuSeconds();
+    auto updates = updates_->load(std::memory_order_relaxed);
+    runners_.resize(mngr.num_runners());
+    if (!n_++) {
+      // the first second is warm-up
+      latency.Clear();
+      TestLatencyEc::kLatency.Reset();
+      tm0_ = now;
+      cpu0_ = cpu;
+      updates0_ = updates;
+      for (auto i = 0u; i < runners_.size(); ++i) {
+        auto& r = mngr.runner(i);
+        first_.push_back({r.coalesced(), r.dispatched(), r.busy()});
+      }
+    } else {
+      auto s = (now - tm_) / 1e9;
+      LOG_INFO("rate=" << static_cast<uint64_t>((updates - updates_n_) / s)
+                       << "/s cpu=" << (cpu - cpu_) / s * 100 << "%");
+      for (auto i = 0u; i < runners_.size(); ++i) {
+        auto& r = mngr.runner(i);
+        auto& r0 = runners_[i];
+        auto coalesced = r.coalesced() - r0.coalesced;
+        auto marks = coalesced + r.dispatched() - r0.dispatched;
+        LOG_INFO("runner " << i << ": algos=" << r.algos() << " coalesced="
+                           << (marks ? coalesced * 100. / marks : 0.)
+                           << "% busy=" << (r.busy() - r0.busy) / 1e7 / s
+                           << "%");
+      }
+      auto& dispatch = latency.Get(TickLatency::kDispatch);
+      auto& send = latency.Get(TickLatency::kSend);
+      LOG_INFO("dispatch p50=" << Micros(dispatch, 0.5)
+                               << " p99=" << Micros(dispatch, 0.99)
+                               << " p99.9=" << Micros(dispatch, 0.999)
+                               << " max=" << dispatch.max() / 1e3
+                               << ", send p50=" << Micros(send, 0.5)
+                               << " p99=" << Micros(send, 0.99)
+                               << ", market data to place p99="
+                               << TestLatencyEc::kLatency.Percentile(0.99)
+                               << " (us)");
+    }
+    tm_ = now;
+    cpu_ = cpu;
+    updates_n_ = updates;
+    for (auto i = 0u; i < runners_.size(); ++i) {
+      auto& r = mngr.runner(i);
+      runners_[i] = {r.coalesced(), r.dispatched(), r.busy()};
+    }
+    if (n_ <= TestLatencyEnv("TEST_LATENCY_SECONDS", 10)) return;
+    Summary();
+    LOG_FATAL("done");
+  }
+
+  void Summary() {
+    auto& mngr = AlgoManager::Instance();
+    auto& latency = TickLatency::Instance();
+    auto s = std::max((tm_ - tm0_) / 1e9, 1e-9);
+    uint64_t coalesced = 0, marks = 0;
+    double max_busy = 0;
+    for (auto i = 0u; i < runners_.size(); ++i) {
+      coalesced += runners_[i].coalesced - first_[i].coalesced;
+      marks += runners_[i].coalesced - first_[i].coalesced +
+               runners_[i].dispatched - first_[i].dispatched;
+      max_busy = std::max(
+          max_busy, (runners_[i].busy - first_[i].busy) / 1e7 / s);
+    }
+    auto& dispatch = latency.Get(TickLatency::kDispatch);
+    auto& send = latency.Get(TickLatency::kSend);
+    LOG_INFO("Runtime load: securities="
+             << TestLatencyEnv("TEST_LATENCY_SECURITIES", 10)
+             << " algos=" << TestLatencyEnv("TEST_LATENCY_ALGOS", 1)
+             << " runners=" << mngr.num_runners()
+             << " target_rate=" << TestLatencyEnv("TEST_LATENCY_RATE", 0)
+             << " rate=" << static_cast<uint64_t>((updates_n_ - updates0_) / s)
+             << " dispatch_p50_us=" << Micros(dispatch, 0.5)
+             << " dispatch_p99_us=" << Micros(dispatch, 0.99)
+             << " dispatch_p999_us=" << Micros(dispatch, 0.999)
+             << " send_p99_us=" << Micros(send, 0.99)
+             << " md_to_place_p99_us="
+             << TestLatencyEc::kLatency.Percentile(0.99)
+             << " coalesced_pct=" << (marks ? coalesced * 100. / marks : 0.)
+             << " max_runner_busy_pct=" << max_busy
+             << " cpu_pct=" << (cpu_ - cpu0_) / s * 100);
+  }
+
+  TaskPool tp_;
+  const std::atomic<uint64_t>* updates_ = nullptr;
+  std::vector<Runner> runners_;
+  std::vector<Runner> first_;
+  int n_ = 0;
+  uint64_t tm0_ = 0, tm_ = 0;
+  double cpu0_ = 0, cpu_ = 0;
+  uint64_t updates0_ = 0, updates_n_ = 0;
+};
+
 struct TestLatencyMd : public MarketDataAdapter {
   void Start() noexcept override {
     connected_ = 1;
     static TaskPool kTaskPool;
-    kTaskPool.AddTask([this] {
-      usleep(1e5);
-      LOG_INFO(secs_.size() << " securities subscribed");
-      static uint32_t kSeed;
-      while (true) {
-        for (auto sec : secs_) {
-          Update(sec->id, 0.01, 100, NowUtcInMicro());
-          usleep(1);
-          Update(sec->id, 0.01, rand_r(&kSeed), false, 0, NowUtcInMicro());
-          usleep(1);
-        }
-      }
-    });
+    kTaskPool.AddTask([this] { Run(); });
+    TestLatencyReport::Start(&updates_);
   }
   void Stop() noexcept override {}
   void SubscribeSync(const opentrade::Security& sec) noexcept override {
+    std::lock_guard<std::mutex> lock(m_);
     secs_.push_back(&sec);
   }
 
  private:
+  void Run() {
+    // the algos subscribe in bulk, up to 10 seconds for all of them
+    auto n = TestLatencyEnv("TEST_LATENCY_SECURITIES", 10);
+    std::vector<const opentrade::Security*> secs;
+    for (auto i = 0; i < 100 && static_cast<int64_t>(secs.size()) < n; ++i) {
+      usleep(1e5);
+      std::lock_guard<std::mutex> lock(m_);
+      secs = secs_;
+    }
+    LOG_INFO(secs.size() << " securities subscribed");
+    if (secs.empty()) return;
+    auto rate = TestLatencyEnv("TEST_LATENCY_RATE", 0);
+    auto interval = rate > 0 ? 1e9 / rate : 0.;
+    static uint32_t kSeed;
+    auto tm0 = FineClock::SteadyNow();
+    for (uint64_t i = 0;; ++i) {
+      auto sec = secs[(i / 2) % secs.size()];
+      if (i % 2)
+        Update(sec->id, 0.01, rand_r(&kSeed), false, 0, NowUtcInMicro());
+      else
+        Update(sec->id, 0.01, 100, NowUtcInMicro());
+      updates_.fetch_add(1, std::memory_order_relaxed);
+      if (!rate) {
+        usleep(1);
+        continue;
+      }
+      // paced to the schedule so that a late update does not lower the rate
+      auto due = tm0 + static_cast<uint64_t>((i + 1) * interval);
+      while (FineClock::SteadyNow() < due) {
+      }
+    }
+  }
+
+  std::mutex m_;
   std::vector<const opentrade::Security*> secs_;
+  std::atomic<uint64_t> updates_ = 0;
 };
 
-struct TestlatencyAlgo : public Algo {
-  TestlatencyAlgo() { name_ = "_test_latency"; }
-  std::string OnStart(const ParamMap& params) noexcept {
-    set_user(AccountManager::Instance().GetUser("test"));
-    acc_ = AccountManager::Instance().GetSubAccount("test");
-    for (auto i = 0; i < 10; ++i) {
-      auto sec = SecurityManager::Instance().Get(i + 1);
-      if (!sec) continue;
-      Subscribe(*sec);
-    }
+// one of the algos of a security, placing on every update
+struct TestLatencyLoad : public Algo {
+  TestLatencyLoad() { name_ = "test_latency_load"; }
+  std::string OnStart(const ParamMap& params) noexcept override {
+    st_ = GetParam(params, "Security", st_);
+    place_ = TestLatencyEnv("TEST_LATENCY_PLACE", 1);
+    Subscribe(*st_.sec, st_.src);
     return {};
   }
   void OnMarketTrade(const Instrument& inst, const MarketData& md,
-                     const MarketData& md0) noexcept {
+                     const MarketData& md0) noexcept override {
     Place(inst, md.tm);
   }
   void OnMarketQuote(const Instrument& inst, const MarketData& md,
-                     const MarketData& md0) noexcept {
+                     const MarketData& md0) noexcept override {
     Place(inst, md.tm);
   }
 
+ private:
   void Place(const Instrument& inst, time_t tm) {
+    if (!place_) return;
     Contract c;
-    c.sub_account = acc_;
+    c.sub_account = st_.acc;
     c.qty = 100;
     c.price = 0.01;
     c.tm_for_test_latency = tm;
     Algo::Place(c, const_cast<Instrument*>(&inst));
   }
 
- private:
-  const SubAccount* acc_;
+  SecurityTuple st_;
+  bool place_ = true;
 };
 
-struct TestLatencyEc : public ExchangeConnectivityAdapter {
-  void Start() noexcept override {
-    connected_ = 1;
-    kLatencies.reserve(100000);
-  }
-  void Stop() noexcept override {}
-  std::string Place(const opentrade::Order& ord) noexcept override {
-    static time_t kLastSampleTm = NowUtcInMicro();
-    auto now = NowUtcInMicro();
-    auto latency = now - ord.tm_for_test_latency;
-    kLatencies.push_back(latency);
-    static int kN;
-    if (now - kLastSampleTm >= 1000000) {
-      kN += 1;
-      static TaskPool kTaskPool;
-      kTaskPool.AddTask([latencies = new decltype(kLatencies)(kLatencies)] {
-        std::sort(latencies->begin(), latencies->end());
-        auto mean = std::accumulate(latencies->begin(), latencies->end(), 0) /
-                    latencies->size();
-        LOG_INFO("sample size="
-                 << latencies->size() << ", min=" << latencies->front()
-                 << ", max=" << latencies->back() << ", mean=" << mean
-                 << ", median=" << latencies->at(latencies->size() / 2)
-                 << ", 90th percentile="
-                 << latencies->at(latencies->size() * 9 / 10)
-                 << ", 99th percentile="
-                 << latencies->at(latencies->size() * 99 / 100) << " (us)");
-        if (kN == 10) {
-          LOG_FATAL("done");
-        }
-      });
-      kLatencies.clear();
-      kLastSampleTm = now;
+// permanent, spawns the TestLatencyLoad algos
+struct TestlatencyAlgo : public Algo {
+  TestlatencyAlgo() { name_ = "_test_latency"; }
+  std::string OnStart(const ParamMap& params) noexcept override {
+    auto user = AccountManager::Instance().GetUser("test");
+    auto acc = AccountManager::Instance().GetSubAccount("test");
+    if (!user || !acc) return "user or sub account \"test\" not found";
+    std::vector<Security::IdType> ids;
+    for (auto& pair : SecurityManager::Instance().securities())
+      ids.push_back(pair.first);
+    std::sort(ids.begin(), ids.end());
+    ids.resize(std::min<size_t>(
+        ids.size(), TestLatencyEnv("TEST_LATENCY_SECURITIES", 10)));
+    auto m = TestLatencyEnv("TEST_LATENCY_ALGOS", 1);
+    std::vector<AlgoManager::SpawnRequest> reqs;
+    for (auto id : ids) {
+      SecurityTuple st;
+      st.sec = SecurityManager::Instance().Get(id);
+      st.acc = acc;
+      st.side = kBuy;
+      st.qty = 100;
+      for (auto i = 0; i < m; ++i) {
+        auto params = std::make_shared<ParamMap>();
+        (*params)["Security"] = st;
+        reqs.push_back({params, "{}", ""});
+      }
     }
+    LOG_INFO("Spawning " << reqs.size() << " algos on " << ids.size()
+                         << " securities");
+    AlgoManager::Instance().SpawnBatch("test_latency_load", *user, reqs);
     return {};
   }
-  std::string Cancel(const opentrade::Order& ord) noexcept override {
-    return {};
-  }
-  static inline std::vector<time_t> kLatencies;
 };
 
 }  // namespace opentrade
@@ -0,0 +1,185 @@
+#ifndef OPENTRADE_TEXT_PARSER_H_
+#define OPENTRADE_TEXT_PARSER_H_
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <istream>
+#include <string_view>
+#include <vector>
+
+namespace opentrade {
+
+// The fields of a text line in place, for the tick, profile and limits
+// formats instead of sscanf. Blanks before a field are skipped as the
+// spaces of a scanf format. A text is followed by a char not of a number,
+// e.g. the '\0' of a std::string or of the LineReader buffer, which the
+// strtod fallback of Double relies on.
+class TextCursor {
+ public:
+  TextCursor(const char* p, const char* end) : p_(p), end_(end) {}
+  explicit TextCursor(std::string_view s)
+      : TextCursor(s.data(), s.data() + s.size()) {}
+
+  bool Uint(uint32_t* v) {
+    SkipBlanks();
+    uint64_t x;
+    if (!Digits(&x)) return false;
+    *v = x;
+    return true;
+  }
+
+  bool Int(int* v) {
+    SkipBlanks();
+    auto neg = p_ < end_ && *p_ == '-';
+    if (p_ < end_ && (*p_ == '-' || *p_ == '+')) ++p_;
+    uint64_t x;
+    if (!Digits(&x)) return false;
+    *v = neg ? -static_cast<int64_t>(x) : x;
+    return true;
+  }
+
+  // exact for the digits without exponent up to 2^53, as strtod rounds,
+  // which takes the others
+  bool Double(double* v) {
+    static const double kPow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                    1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                    1e18, 1e19, 1e20, 1e21, 1e22};
+    SkipBlanks();
+    auto s = p_;
+    auto neg = s < end_ && *s == '-';
+    if (s < end_ && (*s == '-' || *s == '+')) ++s;
+    uint64_t m = 0;
+    auto digits = 0;
+    auto frac = -1;
+    for (; s < end_; ++s) {
+      if (*s == '.' && frac < 0) {
+        frac = 0;
+        continue;
+      }
+      auto d = static_cast<unsigned>(*s - '0');
+      if (d > 9) break;
+      if (++digits <= 19) m = m * 10 + d;
+      if (frac >= 0) ++frac;
+    }
+    if (!digits) return false;
+    if (frac < 0) frac = 0;
+    auto exact = digits <= 19 && m < (1lu << 53) && frac <= 22;
+    if (exact && (s == end_ || (*s != 'e' && *s != 'E'))) {
+      auto x = m / kPow10[frac];
+      *v = neg ? -x : x;
+      p_ = s;
+      return true;
+    }
+    char* e;
+    *v = strtod(p_, &e);
+    if (e == p_) return false;
+    p_ = e;
+    return true;
+  }
+
+  bool Char(char* c) {
+    SkipBlanks();
+    if (p_ == end_) return false;
+    *c = *p_++;
+    return true;
+  }
+
+  bool Expect(char c) {
+    if (p_ == end_ || *p_ != c) return false;
+    ++p_;
+    return true;
+  }
+
+  // up to the next blank, empty at the end
+  std::string_view Word() {
+    SkipBlanks();
+    auto s = p_;
+    while (p_ < end_ && !IsBlank(*p_)) ++p_;
+    return std::string_view(s, p_ - s);
+  }
+
+  bool empty() const { return p_ == end_; }
+  const char* p() const { return p_; }
+
+ private:
+  static bool IsBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+  void SkipBlanks() {
+    while (p_ < end_ && IsBlank(*p_)) ++p_;
+  }
+  bool Digits(uint64_t* x) {
+    auto s = p_;
+    uint64_t v = 0;
+    for (; p_ < end_; ++p_) {
+      auto d = static_cast<unsigned>(*p_ - '0');
+      if (d > 9) break;
+      v = v * 10 + d;
+    }
+    *x = v;
+    return p_ != s;
+  }
+
+  const char* p_;
+  const char* end_;
+};
+
+// The lines of a stream, read in blocks of block_size and split by memchr,
+// which glibc vectorizes. A line, without its '\n', is valid until the next
+// call of Next.
+class LineReader {
+ public:
+  LineReader() {}
+  explicit LineReader(std::istream* is, size_t block_size = 1 << 20)
+      : is_(is), buf_(block_size + 1) {
+    p_ = end_ = buf_.data();
+    *end_ = 0;
+  }
+  // moving the buffer keeps p_ and end_ valid
+  LineReader(LineReader&&) = default;
+  LineReader& operator=(LineReader&&) = default;
+
+  bool Next(const char** line, const char** end) {
+    if (!is_) return false;
+    while (true) {
+      auto nl = static_cast<char*>(memchr(p_, '\n', end_ - p_));
+      if (nl) {
+        *line = p_;
+        *end = nl;
+        p_ = nl + 1;
+        return true;
+      }
+      if (eof_) {
+        if (p_ == end_) return false;
+        *line = p_;
+        *end = end_;
+        p_ = end_;
+        return true;
+      }
+      Fill();
+    }
+  }
+
+ private:
+  void Fill() {
+    size_t n = end_ - p_;
+    if (n) memmove(buf_.data(), p_, n);
+    // a line longer than the buffer
+    if (n + 1 >= buf_.size()) buf_.resize(buf_.size() * 2);
+    is_->read(buf_.data() + n, buf_.size() - 1 - n);
+    if (!*is_) eof_ = true;
+    p_ = buf_.data();
+    end_ = p_ + n + is_->gcount();
+    *end_ = 0;
+  }
+
+  std::istream* is_ = nullptr;
+  std::vector<char> buf_;
+  char* p_ = nullptr;
+  char* end_ = nullptr;
+  bool eof_ = false;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_TEXT_PARSER_H_
@@ -0,0 +1,143 @@
+#include "thread_placement.h"
+
+#include <sched.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "logger.h"
+#include "numa.h"
+
+namespace opentrade {
+
+static const char kRtSuffix[] = "_rt_priority";
+
+std::vector<int> ThreadPlacement::ParseCpus(const std::string& str) {
+  std::vector<int> out;
+  for (auto& tok : Split(str, ",; ")) {
+    if (tok == "isolated") {
+      auto& iso = IsolatedCpus();
+      out.insert(out.end(), iso.begin(), iso.end());
+      continue;
+    }
+    int a, b;
+    auto n = sscanf(tok.c_str(), "%d-%d", &a, &b);
+    if (n < 1 || a < 0) continue;
+    if (n < 2) b = a;
+    for (auto i = a; i <= b && i < CPU_SETSIZE; ++i) out.push_back(i);
+  }
+  std::sort(out.begin(), out.end());
+  out.erase(std::unique(out.begin(), out.end()), out.end());
+  return out;
+}
+
+const std::vector<int>& ThreadPlacement::IsolatedCpus() {
+  static const std::vector<int> kCpus = []() {
+    std::ifstream ifs("/sys/devices/system/cpu/isolated");
+    std::string line;
+    std::getline(ifs, line);
+    std::vector<int> out;
+    if (line.empty()) return out;
+    // no "isolated" keyword there, so no recursion
+    return ParseCpus(line);
+  }();
+  return kCpus;
+}
+
+void ThreadPlacement::Load(const Adapter::StrMap& params) {
+  for (auto& pair : params) {
+    auto& key = pair.first;
+    if (key.size() > strlen(kRtSuffix) &&
+        !key.compare(key.size() - strlen(kRtSuffix), std::string::npos,
+                     kRtSuffix)) {
+      auto role = key.substr(0, key.size() - strlen(kRtSuffix));
+      placements_[role].rt_priority = atoi(pair.second.c_str());
+      continue;
+    }
+    auto cpus = ParseCpus(pair.second);
+    if (cpus.empty())
+      LOG_WARN("No cpu in [threads] " << key << '=' << pair.second);
+    placements_[key].cpus = cpus;
+  }
+  auto& iso = IsolatedCpus();
+  if (!iso.empty()) {
+    std::stringstream ss;
+    for (auto c : iso) ss << ' ' << c;
+    LOG_INFO("Isolated cpus:" << ss.str());
+  }
+}
+
+const ThreadPlacement::Placement* ThreadPlacement::Get(
+    const std::string& role, const std::string& fallback) const {
+  auto it = placements_.find(role);
+  if (it == placements_.end() && !fallback.empty())
+    it = placements_.find(fallback);
+  return it == placements_.end() ? nullptr : &it->second;
+}
+
+bool ThreadPlacement::Apply(pthread_t thread, const std::string& role,
+                            int index, const std::string& fallback) const {
+  auto p = Get(role, fallback);
+  if (!p) return false;
+  std::stringstream ss;
+  auto ok = true;
+  if (!p->cpus.empty()) {
+    auto cpus = p->cpus;
+    if (index >= 0) cpus = {cpus[index % cpus.size()]};
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    ss << " cpus=";
+    for (auto c : cpus) {
+      CPU_SET(c, &set);
+      ss << c << (c == cpus.back() ? "" : ",");
+    }
+    auto& iso = IsolatedCpus();
+    if (std::all_of(cpus.begin(), cpus.end(), [&iso](int c) {
+          return std::binary_search(iso.begin(), iso.end(), c);
+        }))
+      ss << " (isolated)";
+    auto err = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if (err) {
+      ss << " failed: " << strerror(err);
+      ok = false;
+    }
+  }
+  if (p->rt_priority > 0) {
+    sched_param param{};
+    param.sched_priority = p->rt_priority;
+    auto err = pthread_setschedparam(thread, SCHED_FIFO, &param);
+    ss << " rt_priority=" << p->rt_priority;
+    if (err) {
+      ss << " failed: " << strerror(err);
+      ok = false;
+    }
+  }
+  auto name = index >= 0 ? role + " " + std::to_string(index) : role;
+  if (ok)
+    LOG_INFO("Thread " << name << ':' << ss.str());
+  else
+    LOG_ERROR("Thread " << name << ':' << ss.str());
+  return ok;
+}
+
+int ThreadPlacement::Node(const std::string& role, int index,
+                          const std::string& fallback) const {
+  auto p = Get(role, fallback);
+  if (!p || p->cpus.empty()) return -1;
+  auto& cpus = p->cpus;
+  if (index >= 0) return NumaNodeOfCpu(cpus[index % cpus.size()]);
+  auto node = NumaNodeOfCpu(cpus.front());
+  // no single node for a set spanning several
+  for (auto c : cpus) {
+    if (NumaNodeOfCpu(c) != node) return -1;
+  }
+  return node;
+}
+
+void ThreadPlacement::Apply(TaskPool* pool, const std::string& role,
+                            const std::string& fallback) const {
+  for (auto h : pool->native_handles()) Apply(h, role, -1, fallback);
+}
+
+}  // namespace opentrade
@@ -0,0 +1,57 @@
+#ifndef OPENTRADE_THREAD_PLACEMENT_H_
+#define OPENTRADE_THREAD_PLACEMENT_H_
+
+#include <pthread.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "adapter.h"
+#include "common.h"
+#include "utility.h"
+
+namespace opentrade {
+
+// CPU sets and real-time priorities of the thread roles, from the [threads]
+// section of opentrade.conf, e.g.
+//   [threads]
+//   runners=isolated      # one cpu each, round robin over the set
+//   runners_rt_priority=50  # SCHED_FIFO, 0 or none for the default policy
+//   timer=1
+//   write=1
+//   database=0
+//   web=0-1
+//   adapters=6,7          # the default of the adapters' own threads
+//   md_ctp=6              # of one adapter, by section name
+// A CPU list is "a-b,c,...", "isolated" for the kernel's isolcpus set.
+// Roles not configured keep the default affinity.
+class ThreadPlacement : public Singleton<ThreadPlacement> {
+ public:
+  struct Placement {
+    std::vector<int> cpus;
+    int rt_priority = 0;
+  };
+  void Load(const Adapter::StrMap& params);
+  // the placement of role, falling back to fallback if not configured
+  const Placement* Get(const std::string& role,
+                       const std::string& fallback = "") const;
+  // all the cpus of role, or only the index-th of them round robin if
+  // index >= 0; false if not configured or failed, which is logged
+  bool Apply(pthread_t thread, const std::string& role, int index = -1,
+             const std::string& fallback = "") const;
+  void Apply(TaskPool* pool, const std::string& role,
+             const std::string& fallback = "") const;
+  // NUMA node of the (index-th) cpu Apply pins role to, -1 if unknown
+  int Node(const std::string& role, int index = -1,
+           const std::string& fallback = "") const;
+
+  static std::vector<int> ParseCpus(const std::string& str);
+  static const std::vector<int>& IsolatedCpus();
+
+ private:
+  std::unordered_map<std::string, Placement> placements_;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_THREAD_PLACEMENT_H_
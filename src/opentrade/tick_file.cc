@@ -0,0 +1,233 @@
+#include "tick_file.h"
+
+#include <strings.h>
+#include <zlib.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+
+#include "logger.h"
+
+namespace opentrade {
+
+static const size_t kBlockHeader = 3 * sizeof(uint32_t) + sizeof(double);
+
+namespace {
+
+struct VarintReader {
+  const uint8_t* p;
+  const uint8_t* p_end;
+
+  bool Read(uint64_t* v) {
+    *v = 0;
+    for (auto shift = 0; shift < 64 && p < p_end; shift += 7) {
+      auto b = *p++;
+      *v |= static_cast<uint64_t>(b & 0x7f) << shift;
+      if (!(b & 0x80)) return true;
+    }
+    return false;
+  }
+};
+
+void PutVarint(uint64_t v, std::string* out) {
+  while (v >= 0x80) {
+    out->push_back(static_cast<char>((v & 0x7f) | 0x80));
+    v >>= 7;
+  }
+  out->push_back(static_cast<char>(v));
+}
+
+int Decimals(double px) {
+  auto m = 1.;
+  for (auto d = 0; d < 8; ++d, m *= 10) {
+    auto v = px * m;
+    if (std::abs(v - std::round(v)) < 1e-6) return d;
+  }
+  return 8;
+}
+
+}  // namespace
+
+bool ReadTickFileHeader(std::istream* is, TickFileHeader* h) {
+  std::string line;
+  if (!std::getline(*is, line)) return false;
+  std::istringstream ss(line);
+  std::string begin;
+  std::string format;
+  ss >> begin >> h->id_type >> format;
+  if (strcasecmp(begin.c_str(), "@begin") || h->id_type.empty()) return false;
+  if (!strcasecmp(format.c_str(), "columnar"))
+    h->format = TickFileHeader::kColumnar;
+  else if (!strcasecmp(format.c_str(), "indexed"))
+    h->format = TickFileHeader::kIndexed;
+  else if (!strncasecmp(format.c_str(), "bin", 3))
+    h->format = TickFileHeader::kBinary;
+  else
+    h->format = TickFileHeader::kText;
+  h->symbols.clear();
+  while (std::getline(*is, line)) {
+    if (!strcasecmp(line.c_str(), "@end")) break;
+    h->symbols.push_back(line);
+  }
+  return true;
+}
+
+void WriteTickFileHeader(const TickFileHeader& h, std::ostream* os) {
+  static const char* kFormats[] = {"", " binary", " columnar", " indexed"};
+  *os << "@begin " << h.id_type << kFormats[h.format] << '\n';
+  for (auto& s : h.symbols) *os << s << '\n';
+  *os << "@end\n";
+}
+
+std::string EncodeTickBlock(const RawTick* ticks, size_t n) {
+  auto d = 0;
+  for (auto t = ticks; t != ticks + n; ++t) d = std::max(d, Decimals(t->px));
+  auto scale = std::pow(10., d);
+  std::string raw;
+  raw.reserve(n * 8);
+  uint32_t last = 0;
+  for (auto t = ticks; t != ticks + n; ++t) {
+    PutVarint(t->ms - last, &raw);
+    last = t->ms;
+  }
+  for (auto t = ticks; t != ticks + n; ++t) PutVarint(t->index, &raw);
+  for (auto t = ticks; t != ticks + n; ++t) raw.push_back(t->type);
+  std::vector<int64_t> last_px;
+  for (auto t = ticks; t != ticks + n; ++t) {
+    if (t->index >= last_px.size()) last_px.resize(t->index + 1);
+    auto px = std::llround(t->px * scale);
+    int64_t v = px - last_px[t->index];
+    last_px[t->index] = px;
+    PutVarint(static_cast<uint64_t>(v) << 1 ^ static_cast<uint64_t>(v >> 63),
+              &raw);
+  }
+  for (auto t = ticks; t != ticks + n; ++t) PutVarint(t->qty, &raw);
+  auto zsize = compressBound(raw.size());
+  std::string out(kBlockHeader + zsize, '\0');
+  auto rc = compress2(reinterpret_cast<Bytef*>(&out[kBlockHeader]), &zsize,
+                      reinterpret_cast<const Bytef*>(raw.data()), raw.size(),
+                      9);
+  if (rc != Z_OK) LOG_FATAL("Failed to compress tick block: " << rc);
+  uint32_t header[] = {static_cast<uint32_t>(n),
+                       static_cast<uint32_t>(raw.size()),
+                       static_cast<uint32_t>(zsize)};
+  memcpy(&out[0], header, sizeof(header));
+  memcpy(&out[sizeof(header)], &scale, sizeof(scale));
+  out.resize(kBlockHeader + zsize);
+  return out;
+}
+
+bool ColumnarTickReader::Decode() {
+  ticks_.clear();
+  pos_ = 0;
+  if (p_ >= p_end_) return false;
+  if (p_end_ - p_ < static_cast<ptrdiff_t>(kBlockHeader)) {
+    LOG_FATAL("Truncated columnar tick block");
+    return false;
+  }
+  uint32_t n;
+  uint32_t raw_size;
+  uint32_t zsize;
+  double scale;
+  memcpy(&n, p_, sizeof(n));
+  memcpy(&raw_size, p_ + 4, sizeof(raw_size));
+  memcpy(&zsize, p_ + 8, sizeof(zsize));
+  memcpy(&scale, p_ + 12, sizeof(scale));
+  p_ += kBlockHeader;
+  if (zsize > static_cast<size_t>(p_end_ - p_)) {
+    LOG_FATAL("Truncated columnar tick block");
+    return false;
+  }
+  raw_.resize(raw_size);
+  uLongf len = raw_size;
+  auto rc = uncompress(reinterpret_cast<Bytef*>(&raw_[0]), &len,
+                       reinterpret_cast<const Bytef*>(p_), zsize);
+  p_ += zsize;
+  if (rc != Z_OK || len != raw_size) {
+    LOG_FATAL("Corrupted columnar tick block: " << rc);
+    return false;
+  }
+
+  auto p = reinterpret_cast<const uint8_t*>(raw_.data());
+  VarintReader r{p, p + raw_size};
+  ticks_.resize(n);
+  uint64_t v;
+  uint32_t ms = 0;
+  auto ok = true;
+  for (auto& t : ticks_) {
+    ok = ok && r.Read(&v);
+    ms += v;
+    t.ms = ms;
+  }
+  for (auto& t : ticks_) {
+    ok = ok && r.Read(&v);
+    t.index = v;
+  }
+  if (!ok || static_cast<size_t>(r.p_end - r.p) < n) {
+    LOG_FATAL("Corrupted columnar tick block");
+    return false;
+  }
+  for (auto& t : ticks_) t.type = *r.p++;
+  last_px_.assign(last_px_.size(), 0);
+  for (auto& t : ticks_) {
+    ok = ok && r.Read(&v);
+    if (t.index >= last_px_.size()) last_px_.resize(t.index + 1);
+    auto& px = last_px_[t.index];
+    px += static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+    t.px = px / scale;
+  }
+  for (auto& t : ticks_) {
+    ok = ok && r.Read(&v);
+    t.qty = v;
+  }
+  if (!ok) {
+    LOG_FATAL("Corrupted columnar tick block");
+    return false;
+  }
+  return n > 0 || Decode();
+}
+
+IndexedTickReader::IndexedTickReader(const char* p, const char* p_end,
+                                     const std::vector<bool>& used) {
+  uint32_t m = 0;
+  if (p_end - p >= static_cast<ptrdiff_t>(sizeof(m))) memcpy(&m, p, sizeof(m));
+  auto size = static_cast<size_t>(p_end - p);
+  if (size < sizeof(m) + m * 2 * sizeof(uint64_t)) {
+    LOG_FATAL("Invalid tick file index");
+    return;
+  }
+  auto q = p + sizeof(m);
+  for (auto i = 0u; i < m && i < used.size(); ++i, q += 2 * sizeof(uint64_t)) {
+    if (!used[i]) continue;
+    uint64_t offset;
+    uint64_t n;
+    memcpy(&offset, q, sizeof(offset));
+    memcpy(&n, q + sizeof(offset), sizeof(n));
+    if (offset > size || n > size - offset) {
+      LOG_FATAL("Invalid tick file index");
+      return;
+    }
+    if (!n) continue;
+    ColumnarTickReader reader(p + offset, p + offset + n);
+    Head h{{}, readers_.size()};
+    if (!reader.Next(&h.tick)) continue;
+    readers_.push_back(std::move(reader));
+    heap_.push_back(h);
+  }
+  std::make_heap(heap_.begin(), heap_.end());
+}
+
+bool IndexedTickReader::Next(RawTick* t) {
+  if (heap_.empty()) return false;
+  std::pop_heap(heap_.begin(), heap_.end());
+  auto& h = heap_.back();
+  *t = h.tick;
+  if (readers_[h.reader].Next(&h.tick))
+    std::push_heap(heap_.begin(), heap_.end());
+  else
+    heap_.pop_back();
+  return true;
+}
+
+}  // namespace opentrade
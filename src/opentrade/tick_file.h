@@ -0,0 +1,107 @@
+#ifndef OPENTRADE_TICK_FILE_H_
+#define OPENTRADE_TICK_FILE_H_
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace opentrade {
+
+// The header of a tick file, "@begin <id type>[ binary|columnar|indexed]",
+// the securities one per line, and "@end". The text body is of lines
+// "<hhmmssmmm> <security index> <type> <px> <qty>", the binary one of
+// 19-byte [u32 ms][u16 security index][char type][double px][u32 qty].
+struct TickFileHeader {
+  enum Format { kText, kBinary, kColumnar, kIndexed };
+  std::string id_type;
+  Format format = kText;
+  std::vector<std::string> symbols;
+};
+
+// false if not a tick file
+bool ReadTickFileHeader(std::istream* is, TickFileHeader* h);
+void WriteTickFileHeader(const TickFileHeader& h, std::ostream* os);
+
+// Body of a columnar tick file, i.e. what follows the
+// "@begin <id type> columnar" security list, written by
+// scripts/convert_tick_file.py. It is a sequence of independently
+// compressed blocks:
+//   [u32 n][u32 raw size][u32 zlib size][double px scale][zlib data]
+// the raw data holds the n ticks column by column, LEB128 varints except
+// type:
+//   ms, delta from the previous tick of the block
+//   security index
+//   type, one byte per tick
+//   px * px scale, zigzag delta from the previous tick of the same security
+//   in the block
+//   qty
+// Only one block is decoded at a time, so the reader streams a file of any
+// size with bounded memory.
+struct RawTick {
+  uint32_t ms;
+  uint16_t index;
+  char type;
+  double px;
+  uint32_t qty;
+};
+
+// a columnar block of the n ticks, px scaled by the least power of ten up
+// to 1e8 making them all integers
+std::string EncodeTickBlock(const RawTick* ticks, size_t n);
+
+class ColumnarTickReader {
+ public:
+  ColumnarTickReader() {}
+  ColumnarTickReader(const char* p, const char* p_end)
+      : p_(p), p_end_(p_end) {}
+  // false at the end of file
+  bool Next(RawTick* t) {
+    if (pos_ == ticks_.size() && !Decode()) return false;
+    *t = ticks_[pos_++];
+    return true;
+  }
+
+ private:
+  bool Decode();
+
+ private:
+  const char* p_ = nullptr;
+  const char* p_end_ = nullptr;
+  std::vector<RawTick> ticks_;
+  size_t pos_ = 0;
+  std::string raw_;
+  std::vector<int64_t> last_px_;
+};
+
+// Body of an indexed tick file, "@begin <id type> indexed":
+//   [u32 m] m x [u64 offset][u64 size]
+// followed by the columnar blocks of security 0, then of security 1 and so
+// on, in time order. Entry i of the index locates the blocks of security i,
+// the offset counted from the start of the body. Only the securities in use
+// are decoded, or even paged in, and merged by time.
+class IndexedTickReader {
+ public:
+  IndexedTickReader() {}
+  // used[i] tells if security i is in use
+  IndexedTickReader(const char* p, const char* p_end,
+                    const std::vector<bool>& used);
+  bool Next(RawTick* t);
+
+ private:
+  struct Head {
+    RawTick tick;
+    size_t reader;
+    // std heap is a max heap
+    bool operator<(const Head& b) const {
+      return tick.ms != b.tick.ms ? tick.ms > b.tick.ms : reader > b.reader;
+    }
+  };
+  std::vector<ColumnarTickReader> readers_;
+  std::vector<Head> heap_;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_TICK_FILE_H_
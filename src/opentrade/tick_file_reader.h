@@ -0,0 +1,115 @@
+#ifndef OPENTRADE_TICK_FILE_READER_H_
+#define OPENTRADE_TICK_FILE_READER_H_
+
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "pipe_stream.h"
+#include "text_parser.h"
+#include "tick_file.h"
+
+namespace opentrade {
+
+// The ticks of a tick file of any format, compressed or not, in file order,
+// an indexed one merged by time
+class TickFileReader {
+ public:
+  static inline const size_t kBinaryTickSize = 19;
+
+  // error if failed
+  std::string Open(const std::string& fn, TickFileHeader* h) {
+    if (!ifs_.open(fn.c_str())) return "can not open";
+    if (!ReadTickFileHeader(&ifs_.stream(), h)) return "not a tick file";
+    format_ = h->format;
+    if (format_ == TickFileHeader::kText) {
+      lines_ = LineReader(&ifs_.stream());
+      return {};
+    }
+    if (ifs_.compressed()) {
+      if (!ifs_.open(fn.c_str(), true)) return "failed to decompress";
+      ReadTickFileHeader(&ifs_.stream(), h);
+      p_ = ifs_.data() + ifs_.tellg();
+      p_end_ = ifs_.data() + ifs_.size();
+    } else {
+      size_t offset = ifs_.tellg();
+      ifs_.close();
+      mmfile_.open(fn);
+      p_ = mmfile_.data() + offset;
+      p_end_ = mmfile_.data() + mmfile_.size();
+    }
+    if (format_ == TickFileHeader::kBinary) {
+      if ((p_end_ - p_) % kBinaryTickSize) return "invalid binary body size";
+    } else if (format_ == TickFileHeader::kColumnar) {
+      columnar_ = ColumnarTickReader(p_, p_end_);
+    } else {
+      indexed_ = IndexedTickReader(
+          p_, p_end_, std::vector<bool>(h->symbols.size(), true));
+    }
+    return {};
+  }
+
+  bool Next(RawTick* t) {
+    switch (format_) {
+      case TickFileHeader::kText:
+        return NextText(t);
+      case TickFileHeader::kBinary:
+        if (p_ >= p_end_) return false;
+        memcpy(&t->ms, p_, 4);
+        memcpy(&t->index, p_ + 4, 2);
+        t->type = p_[6];
+        memcpy(&t->px, p_ + 7, 8);
+        memcpy(&t->qty, p_ + 15, 4);
+        p_ += kBinaryTickSize;
+        return true;
+      case TickFileHeader::kColumnar:
+        return columnar_.Next(t);
+      case TickFileHeader::kIndexed:
+        return indexed_.Next(t);
+    }
+    return false;
+  }
+
+  size_t skipped() const { return skipped_; }
+
+ private:
+  bool NextText(RawTick* t) {
+    const char* line;
+    const char* end;
+    while (lines_.Next(&line, &end)) {
+      TextCursor c(line, end);
+      uint32_t hmsm;
+      uint32_t index;
+      double qty;
+      if (!c.Uint(&hmsm) || !c.Uint(&index) || !c.Char(&t->type) ||
+          !c.Double(&t->px) || !c.Double(&qty)) {
+        if (line != end) skipped_++;
+        continue;
+      }
+      auto hms = hmsm / 1000;
+      t->ms = (hms / 10000 * 3600 + hms % 10000 / 100 * 60 + hms % 100) *
+                  1000 +
+              hmsm % 1000;
+      t->index = index;
+      t->qty = std::llround(qty);
+      return true;
+    }
+    return false;
+  }
+
+  TickFileHeader::Format format_ = TickFileHeader::kText;
+  PipeStream ifs_;
+  LineReader lines_;
+  boost::iostreams::mapped_file_source mmfile_;
+  const char* p_ = nullptr;
+  const char* p_end_ = nullptr;
+  ColumnarTickReader columnar_;
+  IndexedTickReader indexed_;
+  size_t skipped_ = 0;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_TICK_FILE_READER_H_
@@ -0,0 +1,158 @@
+#include "tick_recorder.h"
+
+#include <boost/filesystem.hpp>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#include "logger.h"
+
+namespace fs = boost::filesystem;
+
+namespace opentrade {
+
+void TickRecorder::Start(const std::string& dir) {
+  if (started_.exchange(true)) return;
+  dir_ = dir;
+  boost::system::error_code ec;
+  fs::create_directories(dir_, ec);
+  std::thread([this]() {
+    while (!stopped_.load(std::memory_order_acquire)) {
+      if (!Drain()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }).detach();
+  LOG_INFO("Recording ticks to " << dir_);
+}
+
+TickRing* TickRecorder::AddRing(DataSrc::IdType src) {
+  std::lock_guard<std::mutex> lock(m_);
+  rings_.emplace_back(new TickRing);
+  rings_.back()->src = src;
+  return rings_.back().get();
+}
+
+void TickRecorder::Stop() {
+  if (!started_.load(std::memory_order_acquire)) return;
+  stopped_.store(true, std::memory_order_release);
+  Drain();
+  std::lock_guard<std::mutex> lock(m_);
+  for (auto& pair : files_) Close(&pair.second);
+  for (auto& r : rings_) {
+    auto n = r->dropped.load(std::memory_order_relaxed);
+    if (n) LOG_WARN(n << " ticks of " << DataSrc::GetStr(r->src) << " dropped");
+  }
+}
+
+size_t TickRecorder::Drain() {
+  std::lock_guard<std::mutex> lock(m_);
+  auto n = 0u;
+  for (auto& r : rings_) {
+    auto head = r->head.load(std::memory_order_relaxed);
+    auto tail = r->tail.load(std::memory_order_acquire);
+    auto& f = files_[r->src];
+    for (; head != tail; ++head) {
+      Write(&f, r->src, r->entries[head % TickRing::kSize]);
+      r->head.store(head + 1, std::memory_order_release);
+      ++n;
+    }
+  }
+  return n;
+}
+
+void TickRecorder::Open(File* f, DataSrc::IdType src, uint64_t us) {
+  time_t t = us / kMicroInSec;
+  struct tm tm;
+  localtime_r(&t, &tm);
+  char date[16];
+  strftime(date, sizeof(date), "%Y%m%d", &tm);
+  f->day_us = (t - tm.tm_hour * 3600 - tm.tm_min * 60 - tm.tm_sec) *
+              kMicroInSec;
+  auto name = dir_ + "/" + date + "." + (src ? DataSrc::GetStr(src) : "_");
+  // a restart in the day gets a file of its own
+  if (fs::exists(name)) name += "." + std::to_string(t);
+  f->name = name;
+  f->body = fopen((name + ".body").c_str(), "wb");
+  if (!f->body)
+    LOG_ERROR("Failed to open " << name << ".body: " << strerror(errno));
+}
+
+void TickRecorder::Close(File* f) {
+  if (!f->body) return;
+  fclose(f->body);
+  f->body = nullptr;
+  auto body = f->name + ".body";
+  auto out = fopen(f->name.c_str(), "wb");
+  auto in = fopen(body.c_str(), "rb");
+  if (out && in) {
+    fprintf(out, "@begin id binary\n");
+    for (auto id : f->ids) fprintf(out, "%u\n", id);
+    fprintf(out, "@end\n");
+    char buf[1 << 16];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) fwrite(buf, 1, n, out);
+  }
+  if (!out || !in || ferror(out)) {
+    LOG_ERROR("Failed to write " << f->name << ", ticks left in " << body);
+  } else {
+    remove(body.c_str());
+    LOG_INFO(f->ids.size() << " securities recorded in " << f->name);
+  }
+  if (out) fclose(out);
+  if (in) fclose(in);
+  f->index.clear();
+  f->ids.clear();
+  f->last.clear();
+}
+
+// 19 bytes, see ReadBinaryTick
+static inline void WriteTick(FILE* fp, uint32_t ms, uint16_t index, char type,
+                             double px, double qty) {
+  char buf[19];
+  auto p = buf;
+  memcpy(p, &ms, 4);
+  p += 4;
+  memcpy(p, &index, 2);
+  p += 2;
+  *p++ = type;
+  memcpy(p, &px, 8);
+  p += 8;
+  uint32_t q = qty > 0 ? qty : 0;
+  memcpy(p, &q, 4);
+  fwrite(buf, 1, sizeof(buf), fp);
+}
+
+void TickRecorder::Write(File* f, DataSrc::IdType src, const TickEntry& e) {
+  static const auto kDayUs = kSecondsOneDay * kMicroInSec;
+  if (!f->day_us || e.us >= f->day_us + kDayUs) {
+    Close(f);
+    Open(f, src, e.us);
+  }
+  if (!f->body) return;
+  auto it = f->index.find(e.id);
+  auto first = it == f->index.end();
+  if (first) {
+    if (f->ids.size() > UINT16_MAX) {
+      LOG_RATE_LIMITED(WARN, 60, "Too many securities in " << f->name);
+      return;
+    }
+    it = f->index.emplace(e.id, f->ids.size()).first;
+    f->ids.push_back(e.id);
+    f->last.emplace_back();
+  }
+  auto i = it->second;
+  auto& last = f->last[i];
+  uint32_t ms = (e.us - std::min(e.us, f->day_us)) / 1000;
+  auto& q = e.quote;
+  if (q.ask_price != last.quote.ask_price || q.ask_size != last.quote.ask_size)
+    WriteTick(f->body, ms, i, 'A', q.ask_price, q.ask_size);
+  if (q.bid_price != last.quote.bid_price || q.bid_size != last.quote.bid_size)
+    WriteTick(f->body, ms, i, 'B', q.bid_price, q.bid_size);
+  last.quote = q;
+  // the day's total of a snapshot feed is not a trade
+  if (e.volume > last.volume && (!first || e.volume == e.qty))
+    WriteTick(f->body, ms, i, 'T', e.close, e.volume - last.volume);
+  last.volume = e.volume;
+}
+
+}  // namespace opentrade
@@ -0,0 +1,98 @@
+#ifndef OPENTRADE_TICK_RECORDER_H_
+#define OPENTRADE_TICK_RECORDER_H_
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "clock.h"
+#include "market_data.h"
+
+namespace opentrade {
+
+struct TickEntry {
+  uint64_t us;
+  Security::IdType id;
+  MarketData::Quote quote;
+  double close;
+  MarketData::Qty qty;
+  MarketData::Volume volume;
+};
+
+// of one adapter, see TickRecorder
+struct TickRing {
+  static inline const size_t kSize = 1 << 16;
+  alignas(64) std::atomic<uint64_t> head = 0;
+  alignas(64) std::atomic<uint64_t> tail = 0;
+  std::atomic<uint64_t> dropped = 0;
+  DataSrc::IdType src = 0;
+  TickEntry entries[kSize];
+
+  // by the owning adapter thread only
+  void Push(Security::IdType id, const MarketData& md) {
+    auto t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) >= kSize) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    auto& e = entries[t % kSize];
+    e.us = NowUtcInMicro();
+    e.id = id;
+    e.quote = md.quote();
+    e.close = md.trade.close;
+    e.qty = md.trade.qty;
+    e.volume = md.trade.volume;
+    tail.store(t + 1, std::memory_order_release);
+  }
+};
+
+// Records the live feeds into the binary tick files backtest plays, see
+// ReadBinaryTick, one file per source and day: <dir>/<%Y%m%d>.<src>.
+// An adapter thread only copies the top of book and the trade totals onto
+// its own ring after an update, the background thread turns the changes of
+// them into 'A', 'B' and 'T' ticks. The security list header is only known
+// at the end of the day, so the ticks go to a body file first and the tick
+// file is assembled on the day change or Stop. Ticks are dropped, and
+// counted, if a ring is full.
+class TickRecorder : public Singleton<TickRecorder> {
+ public:
+  void Start(const std::string& dir);
+  // one per adapter, nullptr until Start
+  TickRing* AddRing(DataSrc::IdType src);
+  // drains the rings and writes the tick files of the day so far
+  void Stop();
+
+ private:
+  struct File {
+    struct Last {
+      MarketData::Quote quote;
+      MarketData::Volume volume = 0;
+    };
+    std::string name;
+    FILE* body = nullptr;
+    uint64_t day_us = 0;  // local midnight
+    std::unordered_map<Security::IdType, uint16_t> index;
+    std::vector<Security::IdType> ids;
+    std::vector<Last> last;
+  };
+  size_t Drain();
+  void Write(File* f, DataSrc::IdType src, const TickEntry& e);
+  void Open(File* f, DataSrc::IdType src, uint64_t us);
+  void Close(File* f);
+
+ private:
+  std::string dir_;
+  std::atomic<bool> started_ = false;
+  std::atomic<bool> stopped_ = false;
+  std::mutex m_;  // of rings_ and the files
+  std::vector<std::unique_ptr<TickRing>> rings_;
+  std::unordered_map<DataSrc::IdType, File> files_;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_TICK_RECORDER_H_
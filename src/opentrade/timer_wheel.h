@@ -0,0 +1,193 @@
+#ifndef OPENTRADE_TIMER_WHEEL_H_
+#define OPENTRADE_TIMER_WHEEL_H_
+
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "inline_func.h"
+
+namespace opentrade {
+
+typedef uint64_t TimerId;  // 0 is never a valid id
+
+// Hierarchical timing wheel, 4 levels of 256 slots, O(1) insert and cancel.
+// Nodes are recycled through a free list, so steady rearming does not malloc
+// (except for closures too big for InlineFunc). Not thread safe.
+class TimerWheel {
+ public:
+  typedef InlineFunc Func;
+
+  explicit TimerWheel(int64_t tick_in_micro = 1000, int64_t now = 0)
+      : tick_(tick_in_micro), origin_(now) {
+    for (auto& h : heads_) h = kNil;
+    for (auto& b : bitmap_) b = 0;
+  }
+
+  // expire is absolute time in micro seconds, fires at least one tick later
+  TimerId Add(Func func, int64_t expire) {
+    auto t = expire - origin_;
+    uint64_t tick = t > 0 ? (t + tick_ - 1) / tick_ : 0;
+    if (tick <= cur_) tick = cur_ + 1;
+    uint32_t idx;
+    if (free_.empty()) {
+      idx = nodes_.size();
+      nodes_.emplace_back();
+    } else {
+      idx = free_.back();
+      free_.pop_back();
+    }
+    auto& n = nodes_[idx];
+    n.func = std::move(func);
+    n.tick = tick;
+    Place(idx);
+    size_++;
+    return (static_cast<TimerId>(n.gen) << 32) | (idx + 1);
+  }
+
+  bool Cancel(TimerId id) {
+    if (!id) return false;
+    uint32_t idx = (id & 0xFFFFFFFF) - 1;
+    if (idx >= nodes_.size()) return false;
+    auto& n = nodes_[idx];
+    if (n.gen != (id >> 32) || n.slot == kNil) return false;
+    Unlink(idx);
+    Free(idx);
+    return true;
+  }
+
+  // moves timers expired by now into out
+  void Advance(int64_t now, std::vector<Func>* out) {
+    auto t = now - origin_;
+    if (t < 0) return;
+    uint64_t target = t / tick_;
+    while (cur_ < target && size_) {
+      ++cur_;
+      if (!(cur_ & kMask)) {
+        for (auto level = 1u; level < kLevels; ++level) {
+          auto s = (cur_ >> (kBits * level)) & kMask;
+          Cascade(level * kSlots + s);
+          if (s) break;
+        }
+      }
+      auto slot = cur_ & kMask;
+      for (auto idx = heads_[slot]; idx != kNil;) {
+        auto next = nodes_[idx].next;
+        out->push_back(std::move(nodes_[idx].func));
+        Free(idx);
+        size_--;
+        idx = next;
+      }
+      heads_[slot] = kNil;
+      bitmap_[slot >> 6] &= ~(1lu << (slot & 63));
+      if (!size_) break;
+    }
+    if (cur_ < target) cur_ = target;
+  }
+
+  // absolute time in micro seconds the wheel needs Advance, -1 if empty.
+  // it is either the next non-empty level-0 slot or the next cascade.
+  int64_t NextWakeup() const {
+    if (!size_) return -1;
+    auto next = (cur_ | kMask) + 1;
+    for (auto s = (cur_ & kMask) + 1; s < kSlots; ++s) {
+      auto word = bitmap_[s >> 6] >> (s & 63);
+      if (!word) {
+        s |= 63;
+        continue;
+      }
+      next = (cur_ & ~kMask) + s + __builtin_ctzl(word);
+      break;
+    }
+    return origin_ + next * tick_;
+  }
+
+  size_t size() const { return size_; }
+  int64_t tick() const { return tick_; }
+
+ private:
+  static inline const uint32_t kNil = std::numeric_limits<uint32_t>::max();
+  static inline const uint32_t kBits = 8;
+  static inline const uint32_t kSlots = 1 << kBits;
+  static inline const uint64_t kMask = kSlots - 1;
+  static inline const uint32_t kLevels = 4;
+
+  struct Node {
+    Func func;
+    uint64_t tick = 0;
+    uint32_t prev = kNil;
+    uint32_t next = kNil;
+    uint32_t slot = kNil;  // kNil if not in the wheel
+    uint32_t gen = 0;
+  };
+
+  void Place(uint32_t idx) {
+    auto& n = nodes_[idx];
+    auto delta = n.tick > cur_ ? n.tick - cur_ : 0;
+    uint32_t slot;
+    if (delta < kSlots) {
+      slot = n.tick & kMask;
+    } else {
+      auto level = 1u;
+      while (level < kLevels - 1 && delta >= (1lu << (kBits * (level + 1))))
+        ++level;
+      auto tick = n.tick;
+      // beyond the top level, park it and recheck on cascade
+      auto max = cur_ + (1lu << (kBits * kLevels)) - 1;
+      if (tick > max) tick = max;
+      slot = level * kSlots + ((tick >> (kBits * level)) & kMask);
+    }
+    n.slot = slot;
+    n.prev = kNil;
+    n.next = heads_[slot];
+    if (n.next != kNil) nodes_[n.next].prev = idx;
+    heads_[slot] = idx;
+    if (slot < kSlots) bitmap_[slot >> 6] |= 1lu << (slot & 63);
+  }
+
+  void Unlink(uint32_t idx) {
+    auto& n = nodes_[idx];
+    if (n.prev != kNil)
+      nodes_[n.prev].next = n.next;
+    else
+      heads_[n.slot] = n.next;
+    if (n.next != kNil) nodes_[n.next].prev = n.prev;
+    if (n.slot < kSlots && heads_[n.slot] == kNil)
+      bitmap_[n.slot >> 6] &= ~(1lu << (n.slot & 63));
+    size_--;
+  }
+
+  void Free(uint32_t idx) {
+    auto& n = nodes_[idx];
+    n.func.reset();
+    n.slot = kNil;
+    n.gen++;
+    free_.push_back(idx);
+  }
+
+  void Cascade(uint32_t slot) {
+    auto idx = heads_[slot];
+    heads_[slot] = kNil;
+    // detached first, a node may land in the same slot again
+    while (idx != kNil) {
+      auto next = nodes_[idx].next;
+      Place(idx);
+      idx = next;
+    }
+  }
+
+ private:
+  const int64_t tick_;
+  const int64_t origin_;
+  uint64_t cur_ = 0;  // last processed tick
+  size_t size_ = 0;
+  std::vector<Node> nodes_;
+  std::vector<uint32_t> free_;
+  uint32_t heads_[kSlots * kLevels];
+  uint64_t bitmap_[kSlots / 64];  // non-empty level-0 slots
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_TIMER_WHEEL_H_
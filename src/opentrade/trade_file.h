@@ -0,0 +1,214 @@
+#ifndef OPENTRADE_TRADE_FILE_H_
+#define OPENTRADE_TRADE_FILE_H_
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "utility.h"
+
+namespace opentrade {
+
+// A fill of the backtest trades file
+struct TradeRecord {
+  uint64_t tm = 0;  // microseconds since epoch, 0 in a text file
+  uint32_t sec_id = 0;
+  std::string symbol;
+  char side = 0;  // 'B' or 'S'
+  double qty = 0;
+  double px = 0;
+  uint32_t algo_id = 0;
+};
+
+// The backtest trades file, of "<time>,<symbol>,<B|S>,<qty>,<px>,<algo id>"
+// lines, or with binary of independent blocks of up to kBlockSize fills,
+// column by column so that numpy.frombuffer reads them in place, see
+// scripts/execution_optimization/report.py:
+//   "OTTB" u32 n, u32 nsymbols, [u32 sec id, u16 len, symbol] * nsymbols,
+//   u64 tm[n], u32 sec_id[n], char side[n], double qty[n], double px[n],
+//   u32 algo_id[n]
+// Files of either kind concatenate, as the shards of Backtest::Run.
+class TradeWriter {
+ public:
+  static inline const size_t kBlockSize = 1 << 16;
+  static inline const size_t kBufferSize = 1 << 22;
+
+  explicit TradeWriter(bool binary = false)
+      : binary_(binary), buf_(kBufferSize) {}
+  ~TradeWriter() { close(); }
+
+  void open(const std::string& path) {
+    close();
+    of_.clear();
+    of_.rdbuf()->pubsetbuf(buf_.data(), buf_.size());
+    of_.open(path, std::ofstream::binary | std::ofstream::trunc);
+  }
+
+  void close() {
+    Flush();
+    if (of_.is_open()) of_.close();
+  }
+
+  bool binary() const { return binary_; }
+  bool good() const { return of_.good(); }
+
+  void Add(uint64_t tm, uint32_t sec_id, const char* symbol, bool buy,
+           double qty, double px, uint32_t algo_id) {
+    if (!binary_) {
+      of_ << std::setprecision(15) << GetNowStr() << ',' << symbol << ','
+          << (buy ? 'B' : 'S') << ',' << qty << ',' << px << ',' << algo_id
+          << '\n';
+      return;
+    }
+    tm_.push_back(tm);
+    sec_id_.push_back(sec_id);
+    side_.push_back(buy ? 'B' : 'S');
+    qty_.push_back(qty);
+    px_.push_back(px);
+    algo_id_.push_back(algo_id);
+    symbols_.emplace(sec_id, symbol);
+    if (tm_.size() >= kBlockSize) Flush();
+  }
+
+  void Flush() {
+    if (tm_.empty()) return;
+    if (of_.is_open()) {
+      uint32_t n = tm_.size();
+      uint32_t m = symbols_.size();
+      of_.write("OTTB", 4);
+      Write(&n, 1);
+      Write(&m, 1);
+      for (auto& pair : symbols_) {
+        uint16_t len = pair.second.size();
+        Write(&pair.first, 1);
+        Write(&len, 1);
+        of_.write(pair.second.data(), len);
+      }
+      Write(tm_.data(), n);
+      Write(sec_id_.data(), n);
+      Write(side_.data(), n);
+      Write(qty_.data(), n);
+      Write(px_.data(), n);
+      Write(algo_id_.data(), n);
+    }
+    tm_.clear();
+    sec_id_.clear();
+    side_.clear();
+    qty_.clear();
+    px_.clear();
+    algo_id_.clear();
+    symbols_.clear();
+  }
+
+ private:
+  template <typename T>
+  void Write(const T* p, size_t n) {
+    of_.write(reinterpret_cast<const char*>(p), n * sizeof(T));
+  }
+
+  const bool binary_;
+  std::vector<char> buf_;
+  std::ofstream of_;
+  std::vector<uint64_t> tm_;
+  std::vector<uint32_t> sec_id_;
+  std::vector<char> side_;
+  std::vector<double> qty_;
+  std::vector<double> px_;
+  std::vector<uint32_t> algo_id_;
+  std::unordered_map<uint32_t, std::string> symbols_;  // of the block
+};
+
+// The fills of a trades file of either kind, told apart by the first block
+class TradeReader {
+ public:
+  explicit TradeReader(const std::string& path)
+      : is_(path, std::ifstream::binary) {
+    char magic[4];
+    binary_ = is_.read(magic, 4) && !memcmp(magic, "OTTB", 4);
+    is_.clear();
+    is_.seekg(0);
+  }
+
+  // false at the end of file
+  bool Next(TradeRecord* r) {
+    if (!binary_) return NextText(r);
+    if (i_ == tm_.size() && !ReadBlock()) return false;
+    r->tm = tm_[i_];
+    r->sec_id = sec_id_[i_];
+    r->symbol = symbols_[r->sec_id];
+    r->side = side_[i_];
+    r->qty = qty_[i_];
+    r->px = px_[i_];
+    r->algo_id = algo_id_[i_];
+    ++i_;
+    return true;
+  }
+
+ private:
+  bool NextText(TradeRecord* r) {
+    std::string line;
+    while (std::getline(is_, line)) {
+      auto fds = Split(line, ",");
+      if (fds.size() < 6) continue;
+      r->symbol = fds[1];
+      r->side = fds[2].empty() ? 0 : fds[2][0];
+      r->qty = atof(fds[3].c_str());
+      r->px = atof(fds[4].c_str());
+      r->algo_id = atol(fds[5].c_str());
+      return true;
+    }
+    return false;
+  }
+
+  bool ReadBlock() {
+    char magic[4];
+    uint32_t n;
+    uint32_t m;
+    if (!is_.read(magic, 4) || memcmp(magic, "OTTB", 4)) return false;
+    if (!Read(&n, 1) || !Read(&m, 1)) return false;
+    for (auto j = 0u; j < m; ++j) {
+      uint32_t id;
+      uint16_t len;
+      if (!Read(&id, 1) || !Read(&len, 1)) return false;
+      std::string s(len, '\0');
+      is_.read(&s[0], len);
+      symbols_[id] = std::move(s);
+    }
+    tm_.resize(n);
+    sec_id_.resize(n);
+    side_.resize(n);
+    qty_.resize(n);
+    px_.resize(n);
+    algo_id_.resize(n);
+    i_ = 0;
+    return Read(tm_.data(), n) && Read(sec_id_.data(), n) &&
+           Read(side_.data(), n) && Read(qty_.data(), n) &&
+           Read(px_.data(), n) && Read(algo_id_.data(), n) && n;
+  }
+
+  template <typename T>
+  bool Read(T* p, size_t n) {
+    return static_cast<bool>(
+        is_.read(reinterpret_cast<char*>(p), n * sizeof(T)));
+  }
+
+  std::ifstream is_;
+  bool binary_ = false;
+  size_t i_ = 0;
+  std::vector<uint64_t> tm_;
+  std::vector<uint32_t> sec_id_;
+  std::vector<char> side_;
+  std::vector<double> qty_;
+  std::vector<double> px_;
+  std::vector<uint32_t> algo_id_;
+  std::unordered_map<uint32_t, std::string> symbols_;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_TRADE_FILE_H_
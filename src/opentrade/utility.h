@@ -4,8 +4,6 @@
 #include <sys/time.h>
 #include <any>
 #include <boost/algorithm/string.hpp>
-#include <boost/iostreams/device/file_descriptor.hpp>
-#include <boost/iostreams/stream.hpp>
 #include <cmath>
 #include <cstring>
 #include <ctime>
@@ -18,6 +16,9 @@
 #include <variant>
 #include <vector>
 
+#include "clock.h"
+#include "event_queue.h"
+
 namespace opentrade {
 
 template <typename V>
@@ -100,42 +101,8 @@ inline std::string ToString(const V& variant) {
 }
 
 #ifdef BACKTEST
-inline uint64_t kTime;
-inline std::multimap<uint64_t, std::function<void()>> kTimers;
-#endif
-
-static const auto kMicroInSec = 1000000lu;
-static const double kMicroInSecF = kMicroInSec;
-static const auto kMicroInMin = kMicroInSec * 60;
-
-inline time_t GetTime() {
-#ifdef BACKTEST
-  if (kTime) return kTime / kMicroInSec;
+inline EventQueue kTimers;
 #endif
-  return std::time(nullptr);
-}
-
-inline int GetTimeOfDay(struct timeval* out) {
-#ifdef BACKTEST
-  out->tv_sec = kTime / kMicroInSec;
-  out->tv_usec = kTime % kMicroInSec;
-  return 0;
-#endif
-  return gettimeofday(out, nullptr);
-}
-
-static inline int64_t NowUtcInMicro() {
-  struct timeval now;
-  auto rc = GetTimeOfDay(&now);
-  if (rc)
-    return GetTime() * kMicroInSec;
-  else
-    return now.tv_sec * kMicroInSec + now.tv_usec;
-}
-
-static inline int64_t NowInMicro(int tm_gmtoff = 0) {
-  return NowUtcInMicro() + tm_gmtoff * kMicroInSec;
-}
 
 template <bool localtime = true, int offset_seconds = 0>
 static inline const char* GetNowStr() {
@@ -244,64 +211,6 @@ static inline bool EndsWith(std::string const& value,
   return std::equal(ending.rbegin(), ending.rend(), value.rbegin());
 }
 
-class PipeStream {
- public:
-  PipeStream() {}
-  explicit PipeStream(const char* fn) { open(fn); }
-
-  bool open(const char* fn) {
-    fstream_.open(fn);
-    if (!fstream_.good()) return false;
-    std::string cmd;
-    if (EndsWith(fn, ".xz")) {
-      cmd = "xzcat";
-    } else if (EndsWith(fn, ".gz")) {
-      cmd = "zcat";
-    } else {
-      return true;
-    }
-    fstream_.close();
-    cmd += " ";
-    cmd += fn;
-    pipe_ = popen(cmd.c_str(), "r");
-#if BOOST_VERSION > 104300
-    boost::iostreams::file_descriptor_source pipe_src(
-        fileno(pipe_), boost::iostreams::never_close_handle);
-#else
-    boost::iostreams::file_descriptor_source pipe_src(fileno(pipe_));
-#endif
-    pstream_.open(pipe_src);
-    pstream_.set_auto_close(false);
-    return pstream_.good();
-  }
-
-  std::basic_istream<char>& stream() {
-    if (pipe_) return pstream_;
-    return fstream_;
-  }
-  auto tellg() { return pipe_ ? pstream_.tellg() : fstream_.tellg(); }
-  auto good() const { return pipe_ ? pstream_.good() : fstream_.good(); }
-  void close() {
-    if (pipe_) {
-      pclose(pipe_);
-      pstream_.close();
-      pipe_ = nullptr;
-    } else {
-      fstream_.close();
-    }
-  }
-  auto pipe() const { return pipe_; }
-
-  ~PipeStream() {
-    if (pipe_) pclose(pipe_);
-  }
-
- private:
-  FILE* pipe_ = nullptr;
-  boost::iostreams::stream<boost::iostreams::file_descriptor_source> pstream_;
-  std::ifstream fstream_;
-};
-
 template <typename T>
 class RollSum {
  public:
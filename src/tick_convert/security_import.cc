@@ -0,0 +1,436 @@
+// Bulk imports a security master file, e.g. a daily vendor file of all the
+// listings, into the security table of a postgres database:
+//   security_import -d "host=db dbname=opentrade user=ot" securities.csv
+// The file is the csv of scripts/load_securities.py, a header of security
+// columns with exchange (the exchange name) and symbol required. The table is
+// read with one COPY and diffed with the file on (exchange, symbol) over the
+// columns of the file; only the new or changed rows are copied into a staging
+// table and merged with one statement, so that security_change logs just the
+// delta and the running instances, notified on kChannel, reload only that,
+// see SecurityManager::WatchChanges.
+
+#include <libpq-fe.h>
+#include <boost/program_options.hpp>
+#include <strings.h>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "opentrade/logger.h"
+
+namespace bpo = boost::program_options;
+
+static const char* kChannel = "opentrade_security";
+static const char* kNull = "\\N";
+static const std::set<std::string> kTypes{"STK", "CASH", "CMDTY", "FUT",
+                                          "OPT", "IND",  "FOP",   "WAR",
+                                          "BOND", "FUND"};
+
+enum ColumnType { kText, kChar, kInt, kFloat, kBool };
+
+struct Column {
+  std::string name;
+  ColumnType type = kText;
+};
+
+typedef std::unique_ptr<PGconn, decltype(&PQfinish)> Conn;
+typedef std::unique_ptr<PGresult, decltype(&PQclear)> Result;
+
+static Result Exec(PGconn* conn, const std::string& sql) {
+  return Result(PQexec(conn, sql.c_str()), &PQclear);
+}
+
+static bool Ok(PGconn* conn, const Result& res, ExecStatusType expected,
+               const char* what) {
+  if (PQresultStatus(res.get()) == expected) return true;
+  LOG_ERROR("Failed to " << what << ": " << PQerrorMessage(conn));
+  return false;
+}
+
+static std::string Quote(const std::string& name) { return '"' + name + '"'; }
+
+// one line of a csv, quoted fields with "" for a quote taken, false if a
+// quoted field is not closed on the line
+static bool SplitCsv(const std::string& line, std::vector<std::string>* out) {
+  out->clear();
+  std::string v;
+  auto quoted = false;
+  for (auto i = 0u; i < line.size(); ++i) {
+    auto c = line[i];
+    if (quoted) {
+      if (c != '"') {
+        v += c;
+      } else if (i + 1 < line.size() && line[i + 1] == '"') {
+        v += c;
+        ++i;
+      } else {
+        quoted = false;
+      }
+    } else if (c == '"') {
+      quoted = true;
+    } else if (c == ',') {
+      out->push_back(std::move(v));
+      v.clear();
+    } else if (c != '\r') {
+      v += c;
+    }
+  }
+  out->push_back(std::move(v));
+  return !quoted;
+}
+
+// the text format of COPY, tab separated with backslash escapes
+static void SplitCopy(const char* p, size_t n, std::vector<std::string>* out) {
+  out->clear();
+  out->emplace_back();
+  for (auto end = p + n; p < end; ++p) {
+    auto c = *p;
+    if (c == '\n') break;
+    if (c == '\t') {
+      out->emplace_back();
+      continue;
+    }
+    if (c == '\\' && p + 1 < end) {
+      c = *++p;
+      if (c == 'N') {
+        out->back() = kNull;
+        continue;
+      }
+      if (c == 't') c = '\t';
+      if (c == 'n') c = '\n';
+      if (c == 'r') c = '\r';
+    }
+    out->back() += c;
+  }
+}
+
+static void AppendCopy(const std::string& v, std::string* out) {
+  if (v == kNull) {
+    *out += v;
+    return;
+  }
+  for (auto c : v) {
+    switch (c) {
+      case '\\':
+        *out += "\\\\";
+        break;
+      case '\t':
+        *out += "\\t";
+        break;
+      case '\n':
+        *out += "\\n";
+        break;
+      case '\r':
+        *out += "\\r";
+        break;
+      default:
+        *out += c;
+    }
+  }
+}
+
+// a value of the file in the text of COPY, empty as null, false if invalid
+static bool Normalize(const Column& col, std::string* v) {
+  if (v->empty()) {
+    *v = kNull;
+    return true;
+  }
+  char* end;
+  switch (col.type) {
+    case kChar:
+      v->erase(v->find_last_not_of(' ') + 1);
+      break;
+    case kInt: {
+      // pandas writes the int columns with missing values as floats
+      auto d = strtod(v->c_str(), &end);
+      if (*end || d != std::floor(d)) return false;
+      *v = std::to_string(static_cast<int64_t>(d));
+      break;
+    }
+    case kFloat:
+      strtod(v->c_str(), &end);
+      if (*end) return false;
+      break;
+    case kBool: {
+      auto s = v->c_str();
+      if (!strcasecmp(s, "t") || !strcasecmp(s, "true") || !strcmp(s, "1") ||
+          !strcasecmp(s, "y") || !strcasecmp(s, "yes"))
+        *v = "t";
+      else if (!strcasecmp(s, "f") || !strcasecmp(s, "false") ||
+               !strcmp(s, "0") || !strcasecmp(s, "n") || !strcasecmp(s, "no"))
+        *v = "f";
+      else
+        return false;
+      break;
+    }
+    case kText:
+      break;
+  }
+  return true;
+}
+
+static bool Same(const Column& col, const std::string& a,
+                 const std::string& b) {
+  if (a == b) return true;
+  if (a == kNull || b == kNull) return false;
+  switch (col.type) {
+    case kInt:
+    case kFloat:
+      // the shortest round trip of the database or not, 1e3 and 1000 alike
+      return atof(a.c_str()) == atof(b.c_str());
+    case kChar:
+      return a.substr(0, a.find_last_not_of(' ') + 1) ==
+             b.substr(0, b.find_last_not_of(' ') + 1);
+    default:
+      return false;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  std::string db_url;
+  std::string file;
+  auto dry_run = false;
+  bpo::options_description config("Options");
+  config.add_options()("help,h", "produce help message")(
+      "db_url,d", bpo::value<std::string>(&db_url),
+      "postgres connection url, as the db_url of opentrade")(
+      "dry_run", bpo::bool_switch(&dry_run),
+      "diff and report only, without writing the database");
+  bpo::options_description hidden;
+  hidden.add_options()("file", bpo::value<std::string>(&file));
+  bpo::options_description all;
+  all.add(config).add(hidden);
+  bpo::positional_options_description pos;
+  pos.add("file", 1);
+  bpo::variables_map vm;
+  try {
+    bpo::store(bpo::command_line_parser(argc, argv)
+                   .options(all)
+                   .positional(pos)
+                   .run(),
+               vm);
+    bpo::notify(vm);
+  } catch (const bpo::error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  if (vm.count("help") || file.empty() || db_url.empty()) {
+    std::cerr << "Usage: security_import [options] -d <db_url> <csv file>\n"
+              << config << std::endl;
+    return 1;
+  }
+  opentrade::Logger::Initialize("security_import", "");
+  if (db_url.find("sqlite") != std::string::npos) {
+    LOG_ERROR("postgres only, use scripts/load_securities.py for sqlite");
+    return 1;
+  }
+
+  Conn conn(PQconnectdb(db_url.c_str()), &PQfinish);
+  if (PQstatus(conn.get()) != CONNECTION_OK) {
+    LOG_ERROR("Failed to connect " << db_url << ": "
+                                   << PQerrorMessage(conn.get()));
+    return 1;
+  }
+  auto c = conn.get();
+
+  std::unordered_map<std::string, Column> types;
+  auto res = Exec(c,
+                  "select column_name, data_type from "
+                  "information_schema.columns where table_name='security' "
+                  "and table_schema=current_schema()");
+  if (!Ok(c, res, PGRES_TUPLES_OK, "read the security columns")) return 1;
+  for (auto i = 0; i < PQntuples(res.get()); ++i) {
+    Column col{PQgetvalue(res.get(), i, 0)};
+    std::string type = PQgetvalue(res.get(), i, 1);
+    if (type == "character")
+      col.type = kChar;
+    else if (type == "smallint" || type == "integer" || type == "bigint")
+      col.type = kInt;
+    else if (type == "double precision" || type == "real" || type == "numeric")
+      col.type = kFloat;
+    else if (type == "boolean")
+      col.type = kBool;
+    types[col.name] = col;
+  }
+  std::unordered_map<std::string, std::string> exchanges;
+  res = Exec(c, "select name, id from exchange");
+  if (!Ok(c, res, PGRES_TUPLES_OK, "read the exchanges")) return 1;
+  for (auto i = 0; i < PQntuples(res.get()); ++i)
+    exchanges[PQgetvalue(res.get(), i, 0)] = PQgetvalue(res.get(), i, 1);
+
+  // the columns of the file, exchange_id and symbol first as the key
+  std::ifstream is(file);
+  if (!is) {
+    LOG_ERROR("Can not open " << file);
+    return 1;
+  }
+  std::string line;
+  std::vector<std::string> header;
+  if (!std::getline(is, line) || !SplitCsv(line, &header)) {
+    LOG_ERROR("No header in " << file);
+    return 1;
+  }
+  std::vector<Column> cols{types["exchange_id"], types["symbol"]};
+  std::vector<int> index{-1, -1};
+  for (auto i = 0u; i < header.size(); ++i) {
+    auto name = header[i];
+    if (name == "exchange") name = "exchange_id";
+    auto it = types.find(name);
+    if (it == types.end() || name == "id") {
+      LOG_ERROR("Unknown security column " << header[i]);
+      return 1;
+    }
+    if (name == "exchange_id") {
+      index[0] = i;
+    } else if (name == "symbol") {
+      index[1] = i;
+    } else {
+      cols.push_back(it->second);
+      index.push_back(i);
+    }
+  }
+  if (index[0] < 0 || index[1] < 0) {
+    LOG_ERROR("exchange and symbol required in the csv");
+    return 1;
+  }
+
+  std::vector<std::vector<std::string>> rows;
+  std::set<std::string> keys;
+  std::vector<std::string> fields;
+  for (auto ln = 2; std::getline(is, line); ++ln) {
+    if (line.empty() || line == "\r") continue;
+    if (!SplitCsv(line, &fields) || fields.size() != header.size()) {
+      LOG_ERROR(file << ":" << ln << ": " << fields.size() << " fields, "
+                     << header.size() << " expected");
+      return 1;
+    }
+    std::vector<std::string> row;
+    row.reserve(cols.size());
+    for (auto i = 0u; i < cols.size(); ++i) {
+      auto v = fields[index[i]];
+      if (i == 0) {
+        auto it = exchanges.find(v);
+        if (it == exchanges.end()) {
+          LOG_ERROR(file << ":" << ln << ": unknown exchange " << v);
+          return 1;
+        }
+        v = it->second;
+      } else if (!Normalize(cols[i], &v)) {
+        LOG_ERROR(file << ":" << ln << ": invalid " << cols[i].name << " "
+                       << fields[index[i]]);
+        return 1;
+      }
+      if (cols[i].name == "type" && !kTypes.count(v)) {
+        LOG_ERROR(file << ":" << ln << ": invalid security type " << v);
+        return 1;
+      }
+      row.push_back(std::move(v));
+    }
+    if (row[1] == kNull) {
+      LOG_ERROR(file << ":" << ln << ": empty symbol");
+      return 1;
+    }
+    if (!keys.insert(row[0] + '\t' + row[1]).second) {
+      LOG_ERROR(file << ":" << ln << ": duplicate " << fields[index[0]] << " "
+                     << row[1]);
+      return 1;
+    }
+    rows.push_back(std::move(row));
+  }
+
+  std::string names;
+  for (auto& col : cols) names += (names.empty() ? "" : ",") + Quote(col.name);
+  if (!Ok(c, Exec(c, "begin"), PGRES_COMMAND_OK, "begin")) return 1;
+
+  // the current rows of the columns of the file, "exchange_id\tsymbol" -> id
+  // and the values
+  std::unordered_map<std::string, std::pair<std::string,
+                                            std::vector<std::string>>>
+      current;
+  res = Exec(c, "copy (select id," + names + " from security) to stdout");
+  if (!Ok(c, res, PGRES_COPY_OUT, "copy out the securities")) return 1;
+  for (;;) {
+    char* buf;
+    auto n = PQgetCopyData(c, &buf, 0);
+    if (n < 0) break;
+    SplitCopy(buf, n, &fields);
+    PQfreemem(buf);
+    if (fields.size() != cols.size() + 1) continue;
+    auto key = fields[1] + '\t' + fields[2];
+    auto& v = current[key];
+    v.first = std::move(fields[0]);
+    v.second.assign(fields.begin() + 1, fields.end());
+  }
+  res = Result(PQgetResult(c), &PQclear);
+  if (!Ok(c, res, PGRES_COMMAND_OK, "copy out the securities")) return 1;
+
+  std::string copy;
+  auto nnew = 0u;
+  auto nupdate = 0u;
+  for (auto& row : rows) {
+    auto it = current.find(row[0] + '\t' + row[1]);
+    if (it == current.end()) {
+      copy += kNull;
+      ++nnew;
+    } else {
+      auto& v = it->second.second;
+      auto same = true;
+      for (auto i = 2u; i < cols.size() && same; ++i)
+        same = Same(cols[i], row[i], v[i]);
+      if (same) continue;
+      copy += it->second.first;
+      ++nupdate;
+    }
+    for (auto& v : row) {
+      copy += '\t';
+      AppendCopy(v, &copy);
+    }
+    copy += '\n';
+  }
+  LOG_INFO(rows.size() << " rows read, " << nupdate << " to update, " << nnew
+                       << " to insert");
+  if (dry_run || copy.empty()) {
+    Exec(c, "rollback");
+    return 0;
+  }
+
+  // without the not null of the table, id is null for the new rows
+  res = Exec(c, "create temp table security_import on commit drop as select "
+                "id," + names + " from security limit 0");
+  if (!Ok(c, res, PGRES_COMMAND_OK, "create the staging table")) return 1;
+  res = Exec(c, "copy security_import(id," + names + ") from stdin");
+  if (!Ok(c, res, PGRES_COPY_IN, "copy in the securities")) return 1;
+  if (PQputCopyData(c, copy.data(), copy.size()) != 1 ||
+      PQputCopyEnd(c, nullptr) != 1) {
+    LOG_ERROR("Failed to copy in the securities: " << PQerrorMessage(c));
+    return 1;
+  }
+  res = Result(PQgetResult(c), &PQclear);
+  if (!Ok(c, res, PGRES_COMMAND_OK, "copy in the securities")) return 1;
+
+  std::string sets, values;
+  for (auto& col : cols) {
+    auto name = Quote(col.name);
+    sets += (sets.empty() ? "" : ",") + name + "=i." + name;
+    values += (values.empty() ? "" : ",") + std::string("i.") + name;
+  }
+  res = Exec(c, "with u as (update security s set " + sets +
+                    " from security_import i where i.id is not null and "
+                    "s.id=i.id returning s.id) insert into security(" +
+                    names + ") select " + values +
+                    " from security_import i where i.id is null");
+  if (!Ok(c, res, PGRES_COMMAND_OK, "merge the securities")) return 1;
+  res = Exec(c, std::string("notify ") + kChannel);
+  if (!Ok(c, res, PGRES_COMMAND_OK, "notify")) return 1;
+  if (!Ok(c, Exec(c, "commit"), PGRES_COMMAND_OK, "commit")) return 1;
+  LOG_INFO(nupdate << " updated, " << nnew << " inserted");
+  return 0;
+}
@@ -0,0 +1,280 @@
+// Converts tick files between the formats of opentrade/tick_file.h, the
+// native counterpart of scripts/convert_tick_file.py, many files at once:
+//   tick_convert -f columnar -j 8 -s 20170701 -e 20181115 ticks/%Y%m%d.xz
+//     ticks-columnar/%Y%m%d
+// for the days of which the input exists, or of the pairs given:
+//   tick_convert -f binary in1 out1 in2 out2
+// A file whose ticks go back in time is reported and not written, unless
+// with --sort, which orders them by time first, stably.
+
+#include <boost/date_time/gregorian/gregorian.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "opentrade/logger.h"
+#include "opentrade/tick_file_reader.h"
+
+namespace bpo = boost::program_options;
+namespace fs = boost::filesystem;
+using opentrade::RawTick;
+using opentrade::TickFileHeader;
+
+static const size_t kBlockTicks = 65536;  // as convert_tick_file.py
+
+class TickSink {
+ public:
+  TickSink(std::ostream* os, const TickFileHeader& h) : os_(*os), h_(h) {
+    opentrade::WriteTickFileHeader(h, os);
+    if (h.format == TickFileHeader::kIndexed) by_sec_.resize(h.symbols.size());
+  }
+
+  void Add(const RawTick& t) {
+    switch (h_.format) {
+      case TickFileHeader::kText: {
+        auto s = t.ms / 1000;
+        char buf[128];
+        auto n =
+            snprintf(buf, sizeof(buf), "%02u%02u%02u%03u %u %c %.12g %u\n",
+                     s / 3600, s % 3600 / 60, s % 60, t.ms % 1000, t.index,
+                     t.type, t.px, t.qty);
+        os_.write(buf, n);
+      } break;
+      case TickFileHeader::kBinary: {
+        char buf[opentrade::TickFileReader::kBinaryTickSize];
+        memcpy(buf, &t.ms, 4);
+        memcpy(buf + 4, &t.index, 2);
+        buf[6] = t.type;
+        memcpy(buf + 7, &t.px, 8);
+        memcpy(buf + 15, &t.qty, 4);
+        os_.write(buf, sizeof(buf));
+      } break;
+      case TickFileHeader::kColumnar:
+        block_.push_back(t);
+        if (block_.size() >= kBlockTicks) Flush(&block_);
+        break;
+      case TickFileHeader::kIndexed:
+        by_sec_[t.index].push_back(t);
+        break;
+    }
+  }
+
+  void Finish() {
+    if (h_.format == TickFileHeader::kColumnar) Flush(&block_);
+    if (h_.format != TickFileHeader::kIndexed) return;
+    std::vector<std::string> regions(by_sec_.size());
+    for (auto i = 0u; i < by_sec_.size(); ++i) {
+      auto& ticks = by_sec_[i];
+      for (auto j = 0u; j < ticks.size(); j += kBlockTicks) {
+        regions[i] += opentrade::EncodeTickBlock(
+            &ticks[j], std::min(kBlockTicks, ticks.size() - j));
+      }
+      std::vector<RawTick>().swap(ticks);
+    }
+    uint32_t m = regions.size();
+    os_.write(reinterpret_cast<const char*>(&m), sizeof(m));
+    uint64_t offset = sizeof(m) + 2 * sizeof(uint64_t) * m;
+    for (auto& r : regions) {
+      uint64_t size = r.size();
+      os_.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+      os_.write(reinterpret_cast<const char*>(&size), sizeof(size));
+      offset += size;
+    }
+    for (auto& r : regions) os_.write(r.data(), r.size());
+  }
+
+ private:
+  void Flush(std::vector<RawTick>* block) {
+    if (block->empty()) return;
+    auto z = opentrade::EncodeTickBlock(block->data(), block->size());
+    os_.write(z.data(), z.size());
+    block->clear();
+  }
+
+  std::ostream& os_;
+  const TickFileHeader& h_;
+  std::vector<RawTick> block_;
+  std::vector<std::vector<RawTick>> by_sec_;
+};
+
+struct Job {
+  std::string in;
+  std::string out;
+};
+
+// error if failed, the output is only renamed into place on success
+static std::string Convert(const Job& job, int format, bool sort,
+                           size_t* count) {
+  opentrade::TickFileReader src;
+  TickFileHeader h;
+  auto err = src.Open(job.in, &h);
+  if (!err.empty()) return err;
+  // text to binary and the others to text by default, as the script
+  if (format < 0)
+    h.format = h.format == TickFileHeader::kText ? TickFileHeader::kBinary
+                                                 : TickFileHeader::kText;
+  else
+    h.format = static_cast<TickFileHeader::Format>(format);
+  auto tmp = job.out + ".tmp";
+  std::vector<char> buf(1 << 20);
+  std::ofstream os;
+  os.rdbuf()->pubsetbuf(buf.data(), buf.size());
+  os.open(tmp, std::ofstream::binary | std::ofstream::trunc);
+  if (!os.good()) return "can not write " + tmp;
+  TickSink sink(&os, h);
+  std::vector<RawTick> ticks;
+  RawTick t;
+  uint32_t last_ms = 0;
+  size_t n = 0;
+  while (src.Next(&t)) {
+    if (t.index >= h.symbols.size()) {
+      err = "security index " + std::to_string(t.index) + " out of range";
+      break;
+    }
+    if (t.ms < last_ms && !sort) {
+      err = "tick #" + std::to_string(n) + " at " + std::to_string(t.ms) +
+            "ms goes back from " + std::to_string(last_ms) + "ms";
+      break;
+    }
+    last_ms = std::max(last_ms, t.ms);
+    ++n;
+    if (sort)
+      ticks.push_back(t);
+    else
+      sink.Add(t);
+  }
+  if (err.empty() && sort) {
+    std::stable_sort(ticks.begin(), ticks.end(),
+                     [](auto& a, auto& b) { return a.ms < b.ms; });
+    for (auto& t : ticks) sink.Add(t);
+  }
+  if (err.empty()) {
+    sink.Finish();
+    os.close();
+    if (!os) err = "failed to write " + tmp;
+  }
+  boost::system::error_code ec;
+  if (err.empty()) {
+    fs::rename(tmp, job.out, ec);
+    if (ec) err = ec.message();
+  }
+  if (!err.empty()) fs::remove(tmp, ec);
+  if (src.skipped())
+    LOG_WARN(job.in << ": " << src.skipped() << " invalid lines skipped");
+  *count = n;
+  return err;
+}
+
+static int ParseFormat(const std::string& s) {
+  if (s.empty()) return -1;
+  if (s == "text") return TickFileHeader::kText;
+  if (s == "binary") return TickFileHeader::kBinary;
+  if (s == "columnar") return TickFileHeader::kColumnar;
+  if (s == "indexed") return TickFileHeader::kIndexed;
+  return -2;
+}
+
+int main(int argc, char* argv[]) {
+  std::string format_str;
+  auto jobs = static_cast<int>(std::thread::hardware_concurrency());
+  auto start_date = 0u;
+  auto end_date = 0u;
+  auto sort = false;
+  std::vector<std::string> files;
+  bpo::options_description config("Options");
+  config.add_options()("help,h", "produce help message")(
+      "format,f", bpo::value<std::string>(&format_str),
+      "text, binary, columnar or indexed, binary for a text input and text "
+      "otherwise by default")(
+      "jobs,j", bpo::value<int>(&jobs),
+      "files converted in parallel, the number of cores by default")(
+      "start_date,s", bpo::value<uint32_t>(&start_date),
+      "start date, in 'YYYYmmdd' format, with the files in strftime format")(
+      "end_date,e", bpo::value<uint32_t>(&end_date),
+      "end date inclusively, in 'YYYYmmdd' format")(
+      "sort", bpo::bool_switch(&sort),
+      "sort the ticks by time instead of failing on the ones out of order");
+  bpo::options_description hidden;
+  hidden.add_options()("files", bpo::value<std::vector<std::string>>(&files));
+  bpo::options_description all;
+  all.add(config).add(hidden);
+  bpo::positional_options_description pos;
+  pos.add("files", -1);
+  bpo::variables_map vm;
+  try {
+    bpo::store(bpo::command_line_parser(argc, argv)
+                   .options(all)
+                   .positional(pos)
+                   .run(),
+               vm);
+    bpo::notify(vm);
+  } catch (const bpo::error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  auto format = ParseFormat(format_str);
+  if (vm.count("help") || files.empty() || files.size() % 2 || format < -1) {
+    std::cerr << "Usage: tick_convert [options] <input> <output> "
+                 "[<input> <output>]...\n"
+              << config << std::endl;
+    return 1;
+  }
+  opentrade::Logger::Initialize("tick_convert", "");
+
+  std::vector<Job> todo;
+  if (start_date) {
+    if (files.size() != 2) {
+      LOG_ERROR("one pair of file patterns expected with the dates");
+      return 1;
+    }
+    if (!end_date) end_date = start_date;
+    boost::gregorian::date dt(start_date / 10000, start_date % 10000 / 100,
+                              start_date % 100);
+    boost::gregorian::date end(end_date / 10000, end_date % 10000 / 100,
+                               end_date % 100);
+    for (; dt <= end; dt += boost::gregorian::days(1)) {
+      auto tm = boost::gregorian::to_tm(dt);
+      char in[256];
+      char out[256];
+      strftime(in, sizeof(in), files[0].c_str(), &tm);
+      strftime(out, sizeof(out), files[1].c_str(), &tm);
+      if (fs::exists(in)) todo.push_back(Job{in, out});
+    }
+  } else {
+    for (auto i = 0u; i < files.size(); i += 2)
+      todo.push_back(Job{files[i], files[i + 1]});
+  }
+
+  std::atomic<size_t> next = 0;
+  std::atomic<int> failed = 0;
+  std::vector<std::thread> threads;
+  for (auto i = 0; i < std::max(1, jobs); ++i) {
+    threads.emplace_back([&]() {
+      for (size_t j; (j = next++) < todo.size();) {
+        auto& job = todo[j];
+        size_t n = 0;
+        auto err = Convert(job, format, sort, &n);
+        if (err.empty()) {
+          LOG_INFO(job.in << " -> " << job.out << ": " << n << " ticks");
+        } else {
+          LOG_ERROR(job.in << ": " << err);
+          failed++;
+        }
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+  LOG_INFO(todo.size() - failed << " of " << todo.size() << " files converted");
+  return failed ? 1 : 0;
+}
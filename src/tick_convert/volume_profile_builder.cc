@@ -0,0 +1,305 @@
+// Builds the binary volume profile of the vwap algo from the trades of the
+// last n days of tick files, of any format of opentrade/tick_file.h:
+//   volume_profile_builder -n 20 -e 20181115 -c vp-cache -o vp.bin
+//     ticks/%Y%m%d.xz
+// Each day is scanned once into a per day cache file of per minute volumes,
+// so that a nightly run only scans the newest day. A day is normalized to
+// fractions of its total volume, and a minute of a security is the mean of
+// its days with the trim fraction of the lowest and of the highest dropped.
+
+#include <boost/date_time/gregorian/gregorian.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include <strings.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "algos/vwap/volume_profile.h"
+#include "opentrade/logger.h"
+#include "opentrade/tick_file_reader.h"
+
+namespace bpo = boost::program_options;
+namespace fs = boost::filesystem;
+using opentrade::VolumeProfile;
+
+static const auto kMinutes = VolumeProfile::kMinutes;
+
+// the per minute volumes of the securities traded on a day
+typedef std::map<uint32_t, std::vector<float>> DayVolumes;
+
+// "OTVD", version, count, minutes, uint32 ids[count] ascending,
+// float volumes[count][kMinutes]
+struct DayHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t count;
+  uint32_t minutes;
+};
+
+static bool LoadDay(const std::string& fn, DayVolumes* out) {
+  std::ifstream is(fn, std::ifstream::binary);
+  DayHeader h;
+  if (!is.read(reinterpret_cast<char*>(&h), sizeof(h))) return false;
+  if (memcmp(h.magic, "OTVD", 4) || h.version != 1 || h.minutes != kMinutes)
+    return false;
+  std::vector<uint32_t> ids(h.count);
+  is.read(reinterpret_cast<char*>(ids.data()), ids.size() * sizeof(ids[0]));
+  for (auto id : ids) {
+    auto& v = (*out)[id];
+    v.resize(kMinutes);
+    is.read(reinterpret_cast<char*>(v.data()), kMinutes * sizeof(v[0]));
+  }
+  return is.good();
+}
+
+static bool SaveDay(const std::string& fn, const DayVolumes& day) {
+  auto tmp = fn + ".tmp";
+  std::ofstream os(tmp, std::ofstream::binary | std::ofstream::trunc);
+  DayHeader h{{'O', 'T', 'V', 'D'}, 1, static_cast<uint32_t>(day.size()),
+              kMinutes};
+  os.write(reinterpret_cast<const char*>(&h), sizeof(h));
+  for (auto& pair : day)
+    os.write(reinterpret_cast<const char*>(&pair.first), sizeof(pair.first));
+  for (auto& pair : day) {
+    os.write(reinterpret_cast<const char*>(pair.second.data()),
+             kMinutes * sizeof(float));
+  }
+  os.close();
+  boost::system::error_code ec;
+  if (os) fs::rename(tmp, fn, ec);
+  if (!os || ec) {
+    fs::remove(tmp, ec);
+    return false;
+  }
+  return true;
+}
+
+// security line of the tick file header, e.g. "IBM NYSE", -> security id
+typedef std::unordered_map<std::string, uint32_t> SecurityMap;
+
+static std::string ScanDay(const std::string& fn, const SecurityMap& sec_map,
+                           DayVolumes* out) {
+  opentrade::TickFileReader src;
+  opentrade::TickFileHeader h;
+  auto err = src.Open(fn, &h);
+  if (!err.empty()) return err;
+  std::vector<std::vector<float>*> rows(h.symbols.size());
+  auto by_id = !strcasecmp(h.id_type.c_str(), "id");
+  if (!by_id && sec_map.empty())
+    return "security_map required for the " + h.id_type + " symbols";
+  for (auto i = 0u; i < h.symbols.size(); ++i) {
+    auto& s = h.symbols[i];
+    uint32_t id = 0;
+    if (sec_map.empty()) {
+      id = atol(s.c_str());
+    } else {
+      auto it = sec_map.find(s);
+      if (it != sec_map.end()) id = it->second;
+    }
+    if (!id) continue;
+    auto& v = (*out)[id];
+    v.resize(kMinutes);
+    rows[i] = &v;
+  }
+  opentrade::RawTick t;
+  while (src.Next(&t)) {
+    if (t.type != 'T' || t.index >= rows.size() || !rows[t.index]) continue;
+    auto m = t.ms / 60000;
+    if (m < kMinutes) (*rows[t.index])[m] += t.qty;
+  }
+  for (auto it = out->begin(); it != out->end();) {
+    auto total = 0.;
+    for (auto x : it->second) total += x;
+    if (total > 0)
+      ++it;
+    else
+      it = out->erase(it);
+  }
+  return {};
+}
+
+static bool LoadSecurityMap(const std::string& fn, SecurityMap* out) {
+  std::ifstream is(fn);
+  if (!is.good()) return false;
+  std::string line;
+  while (std::getline(is, line)) {
+    auto pos = line.find_last_of(' ');
+    if (pos == std::string::npos) continue;
+    auto id = atol(line.c_str() + pos + 1);
+    auto n = line.find_last_not_of(' ', pos) + 1;
+    if (id > 0 && n) (*out)[line.substr(0, n)] = id;
+  }
+  return true;
+}
+
+static void Parallel(size_t n, int jobs, std::function<void(size_t)> func) {
+  std::atomic<size_t> next = 0;
+  std::vector<std::thread> threads;
+  for (auto i = 0; i < std::max(1, jobs); ++i) {
+    threads.emplace_back([&]() {
+      for (size_t j; (j = next++) < n;) func(j);
+    });
+  }
+  for (auto& t : threads) t.join();
+}
+
+int main(int argc, char* argv[]) {
+  auto jobs = static_cast<int>(std::thread::hardware_concurrency());
+  auto end_date = 0u;
+  auto ndays = 20;
+  auto trim = 0.1;
+  std::string cache_dir;
+  std::string output;
+  std::string security_map_file;
+  std::string pattern;
+  bpo::options_description config("Options");
+  config.add_options()("help,h", "produce help message")(
+      "end_date,e", bpo::value<uint32_t>(&end_date),
+      "last date, in 'YYYYmmdd' format, today by default")(
+      "days,n", bpo::value<int>(&ndays),
+      "days of tick files, the ones missing skipped, 20 by default")(
+      "trim", bpo::value<double>(&trim),
+      "fraction of days of a minute dropped on either side, 0.1 by default")(
+      "cache_dir,c", bpo::value<std::string>(&cache_dir),
+      "directory of the per day volumes, none by default")(
+      "output,o", bpo::value<std::string>(&output), "volume profile file")(
+      "security_map", bpo::value<std::string>(&security_map_file),
+      "file of '<security line of the tick files> <security id>' lines, "
+      "the lines taken as the ids by default, for the 'id' tick files")(
+      "jobs,j", bpo::value<int>(&jobs),
+      "days scanned in parallel, the number of cores by default");
+  bpo::options_description hidden;
+  hidden.add_options()("ticks", bpo::value<std::string>(&pattern));
+  bpo::options_description all;
+  all.add(config).add(hidden);
+  bpo::positional_options_description pos;
+  pos.add("ticks", 1);
+  bpo::variables_map vm;
+  try {
+    bpo::store(bpo::command_line_parser(argc, argv)
+                   .options(all)
+                   .positional(pos)
+                   .run(),
+               vm);
+    bpo::notify(vm);
+  } catch (const bpo::error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  if (vm.count("help") || pattern.empty() || output.empty() || ndays <= 0 ||
+      trim < 0 || trim >= 0.5) {
+    std::cerr << "Usage: volume_profile_builder [options] -o <output> "
+                 "<tick file pattern in strftime format>\n"
+              << config << std::endl;
+    return 1;
+  }
+  opentrade::Logger::Initialize("volume_profile_builder", "");
+
+  SecurityMap sec_map;
+  if (!security_map_file.empty() &&
+      !LoadSecurityMap(security_map_file, &sec_map)) {
+    LOG_ERROR("can not read " << security_map_file);
+    return 1;
+  }
+  if (!cache_dir.empty()) fs::create_directories(cache_dir);
+
+  // the days of which the tick file exists, the holidays skipped
+  struct Day {
+    std::string date;
+    std::string fn;
+    DayVolumes volumes;
+  };
+  std::vector<Day> days;
+  auto dt = end_date ? boost::gregorian::date(end_date / 10000,
+                                              end_date % 10000 / 100,
+                                              end_date % 100)
+                     : boost::gregorian::day_clock::local_day();
+  for (auto i = 0; i < ndays * 2 + 14 && static_cast<int>(days.size()) < ndays;
+       ++i, dt -= boost::gregorian::days(1)) {
+    auto tm = boost::gregorian::to_tm(dt);
+    char fn[256];
+    strftime(fn, sizeof(fn), pattern.c_str(), &tm);
+    if (!fs::exists(fn)) continue;
+    days.push_back(Day{boost::gregorian::to_iso_string(dt), fn, {}});
+  }
+  if (days.empty()) {
+    LOG_ERROR("no tick files found");
+    return 1;
+  }
+
+  std::atomic<int> failed = 0;
+  Parallel(days.size(), jobs, [&](size_t i) {
+    auto& day = days[i];
+    auto cache_fn =
+        cache_dir.empty() ? "" : cache_dir + "/" + day.date + ".vd";
+    if (!cache_fn.empty() && fs::exists(cache_fn)) {
+      if (LoadDay(cache_fn, &day.volumes)) return;
+      LOG_WARN(cache_fn << ": invalid, rescanning");
+      day.volumes.clear();
+    }
+    auto err = ScanDay(day.fn, sec_map, &day.volumes);
+    if (!err.empty()) {
+      LOG_ERROR(day.fn << ": " << err);
+      failed++;
+      return;
+    }
+    LOG_INFO(day.fn << ": " << day.volumes.size() << " securities");
+    if (!cache_fn.empty() && !SaveDay(cache_fn, day.volumes))
+      LOG_ERROR("failed to write " << cache_fn);
+  });
+  if (failed) return 1;
+
+  // the days of each security, as fractions of the day's volume
+  std::map<uint32_t, std::vector<const std::vector<float>*>> by_sec;
+  for (auto& day : days) {
+    for (auto& pair : day.volumes) by_sec[pair.first].push_back(&pair.second);
+  }
+  std::vector<std::pair<uint32_t, std::vector<double>>> out;
+  std::vector<const std::vector<const std::vector<float>*>*> rows;
+  for (auto& pair : by_sec) {
+    out.emplace_back(pair.first, std::vector<double>());
+    rows.push_back(&pair.second);
+  }
+  Parallel(out.size(), jobs, [&](size_t i) {
+    auto& sec_days = *rows[i];
+    std::vector<double> totals;
+    for (auto v : sec_days) {
+      auto total = 0.;
+      for (auto x : *v) total += x;
+      totals.push_back(total);
+    }
+    auto n = sec_days.size();
+    auto k = static_cast<size_t>(n * trim);
+    auto& res = out[i].second;
+    res.resize(kMinutes);
+    std::vector<double> xs(n);
+    for (auto m = 0u; m < kMinutes; ++m) {
+      for (auto j = 0u; j < n; ++j) xs[j] = (*sec_days[j])[m] / totals[j];
+      if (k) std::sort(xs.begin(), xs.end());
+      auto sum = 0.;
+      for (auto j = k; j < n - k; ++j) sum += xs[j];
+      res[m] = sum / (n - 2 * k);
+    }
+  });
+  VolumeProfile::Volumes volumes(out.begin(), out.end());
+  VolumeProfile profile(volumes);
+  if (!profile.Save(output.c_str())) {
+    LOG_ERROR("failed to write " << output);
+    return 1;
+  }
+  LOG_INFO(output << ": " << volumes.size() << " securities of " << days.size()
+                  << " days from " << days.back().date << " to "
+                  << days.front().date);
+  return 0;
+}
@@ -16,7 +16,7 @@ struct MockConsolidationHandler : public ConsolidationHandler {
 
 struct MockAlgoManager : public AlgoManager {
   struct Strand : public AlgoManager::Strand {
-    void post(std::function<void()> func) override { func(); }
+    void post(InlineFunc func) override { func(); }
   };
   MockAlgoManager() {
     threads_.resize(1);
@@ -150,6 +150,33 @@ TEST_CASE("ConsolidationHandler", "[ConsolidationHandler]") {
     handler.OnMarketQuote(*inst_a, md, md0_a);
     md0_a = md;
     REQUIRE(Stringify(book) == "0    2|1.2A|0.3B");
+    auto top = book.top();
+    REQUIRE((!top.ask.inst && top.bid.price == 1.2 && top.bid.inst == inst_a));
+  }
+
+  SECTION("Sweep") {
+    md = MarketData{};
+    auto md0 = md;
+    book.Reset();
+    ask = 1, quote.ask_size = 100;
+    handler.OnMarketQuote(*inst_a, md, md0);
+    quote.ask_size = 300;
+    handler.OnMarketQuote(*inst_b, md, md0);
+    ask = 1.1, quote.ask_size = 200;
+    handler.OnMarketQuote(*inst_c, md, md0);
+    std::vector<SweepLeg> legs;
+    REQUIRE(book.Sweep(true, 350, &legs) == 350);
+    REQUIRE(legs.size() == 2);
+    REQUIRE((legs[0].inst == inst_b && legs[0].size == 300));
+    REQUIRE((legs[1].inst == inst_a && legs[1].size == 50));
+    legs.clear();
+    REQUIRE(book.Sweep(true, 1000, &legs) == 600);
+    REQUIRE((legs.size() == 3 && legs[2].inst == inst_c &&
+             legs[2].price == 1.1));
+    legs.clear();
+    REQUIRE(book.Sweep(true, 1000, &legs, 1) == 400);
+    legs.clear();
+    REQUIRE(book.Sweep(false, 1000, &legs) == 0);
   }
 }
 
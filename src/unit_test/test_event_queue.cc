@@ -0,0 +1,84 @@
+#include "3rd/catch.hpp"
+
+#include <memory>
+
+#include "opentrade/event_queue.h"
+
+namespace opentrade {
+
+TEST_CASE("EventQueue", "[EventQueue]") {
+  EventQueue q;
+  std::vector<int> fired;
+  auto run = [&](uint64_t tm) {
+    EventQueue::Func func;
+    uint64_t at;
+    while (q.Pop(tm, &func, &at)) func();
+  };
+
+  SECTION("Order") {
+    q.Push(300, [&]() { fired.push_back(3); });
+    q.Push(100, [&]() { fired.push_back(1); });
+    q.Push(300, [&]() { fired.push_back(4); });
+    q.Push(100, [&]() { fired.push_back(2); });
+    REQUIRE(q.size() == 4);
+    run(99);
+    REQUIRE(fired.empty());
+    run(100);
+    REQUIRE(fired == (std::vector<int>{1, 2}));
+    run(1000);
+    REQUIRE(fired == (std::vector<int>{1, 2, 3, 4}));
+    REQUIRE(q.empty());
+  }
+
+  SECTION("PushWhileRunning") {
+    q.Push(100, [&]() {
+      fired.push_back(1);
+      q.Push(0, [&]() { fired.push_back(2); });
+      q.Push(200, [&]() { fired.push_back(4); });
+    });
+    q.Push(150, [&]() { fired.push_back(3); });
+    run(200);
+    REQUIRE(fired == (std::vector<int>{1, 2, 3, 4}));
+  }
+
+  SECTION("Cancel") {
+    auto id = q.Push(100, [&]() { fired.push_back(1); });
+    q.Push(200, [&]() { fired.push_back(2); });
+    REQUIRE(q.Cancel(id));
+    REQUIRE(!q.Cancel(id));
+    REQUIRE(q.size() == 1);
+    run(1000);
+    REQUIRE(fired == std::vector<int>{2});
+    // recycled node does not accept stale id
+    auto id2 = q.Push(1100, [&]() { fired.push_back(3); });
+    REQUIRE(id2 != id);
+    REQUIRE(!q.Cancel(id));
+    run(1100);
+    REQUIRE(fired == (std::vector<int>{2, 3}));
+  }
+
+  SECTION("Compact") {
+    std::vector<EventQueue::Id> ids;
+    for (auto i = 0; i < 5000; ++i)
+      ids.push_back(q.Push(i, [&, i]() { fired.push_back(i); }));
+    for (auto i = 0; i < 5000; ++i)
+      if (i % 10) REQUIRE(q.Cancel(ids[i]));
+    REQUIRE(q.size() == 500);
+    run(5000);
+    REQUIRE(fired.size() == 500);
+    REQUIRE(fired[1] == 10);
+  }
+
+  SECTION("BigClosure") {
+    auto p = std::make_shared<int>(0);
+    char pad[200] = {1};
+    q.Push(1, [p, pad]() { *p += pad[0]; });
+    q.Push(2, [p]() { *p += 2; });
+    REQUIRE(p.use_count() == 3);
+    run(10);
+    REQUIRE(*p == 3);
+    REQUIRE(p.use_count() == 1);
+  }
+}
+
+}  // namespace opentrade
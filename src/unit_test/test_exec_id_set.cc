@@ -0,0 +1,28 @@
+#include "3rd/catch.hpp"
+
+#include "opentrade/exec_id_set.h"
+
+namespace opentrade {
+
+TEST_CASE("ExecIdSet", "[ExecIdSet]") {
+  SECTION("Dedup") {
+    ExecIdSet s;
+    REQUIRE(s.Insert(1, "a"));
+    REQUIRE(!s.Insert(1, "a"));
+    REQUIRE(s.Insert(2, "a"));
+    REQUIRE(s.Insert(1, "b"));
+    REQUIRE(s.size() == 3);
+    s.Clear();
+    REQUIRE(s.size() == 0);
+    REQUIRE(s.Insert(1, "a"));
+  }
+
+  SECTION("Rolling") {
+    ExecIdSet s(4);
+    for (auto i = 0u; i < 1000; ++i) REQUIRE(s.Insert(i, "x"));
+    REQUIRE(s.size() <= 16 * 2 * 4);
+    REQUIRE(!s.Insert(999, "x"));
+  }
+}
+
+}  // namespace opentrade
@@ -0,0 +1,56 @@
+#include "3rd/catch.hpp"
+
+#include "algos/rule/expression.h"
+
+namespace opentrade {
+
+TEST_CASE("Expression", "[Expression]") {
+  Expression e;
+  Expression::Vars vars{};
+  vars[Expression::kBidPrice] = 10;
+  vars[Expression::kAskPrice] = 10.02;
+  vars[Expression::kBidSize] = 300;
+  vars[Expression::kAskSize] = 100;
+
+  SECTION("Arithmetic") {
+    REQUIRE(e.Compile("1 + 2 * 3 - 4 / 2").empty());
+    REQUIRE(e.Evaluate(vars) == 5);
+    REQUIRE(e.Compile("-(1 + 2) * 3").empty());
+    REQUIRE(e.Evaluate(vars) == -9);
+    REQUIRE(e.Compile("max(bid_size, ask_size) - min(1, 2) + abs(-.5)")
+                .empty());
+    REQUIRE(e.Evaluate(vars) == 299.5);
+    REQUIRE(!e.Uses(Expression::kPosition));
+    REQUIRE(e.Uses(Expression::kAskSize));
+  }
+
+  SECTION("Boolean") {
+    REQUIRE(e.Compile("ask_price - bid_price <= 0.021 && bid_size > 2 * "
+                      "ask_size")
+                .empty());
+    REQUIRE(e.Evaluate(vars) == 1);
+    vars[Expression::kAskSize] = 200;
+    REQUIRE(e.Evaluate(vars) == 0);
+    REQUIRE(e.Compile("bid_size == 300 || !(ask_size != 200)").empty());
+    REQUIRE(e.Evaluate(vars) == 1);
+    REQUIRE(e.Compile("1 < 2 == 1").empty());
+    REQUIRE(e.Evaluate(vars) == 1);
+  }
+
+  SECTION("Errors") {
+    REQUIRE(!e.Compile("").empty());
+    REQUIRE(!e.Compile("bid_price >").empty());
+    REQUIRE(!e.Compile("foo > 1").empty());
+    REQUIRE(!e.Compile("(1 + 2").empty());
+    REQUIRE(!e.Compile("1 2").empty());
+    REQUIRE(!e.Compile("min(1)").empty());
+    REQUIRE(e.empty());
+    std::string deep = "1";
+    for (auto i = 0; i < Expression::kMaxDepth; ++i) {
+      deep = "1 + (" + deep + ")";
+    }
+    REQUIRE(!e.Compile(deep).empty());
+  }
+}
+
+}  // namespace opentrade
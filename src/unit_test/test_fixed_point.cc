@@ -0,0 +1,31 @@
+#include "3rd/catch.hpp"
+
+#include "opentrade/fixed_point.h"
+
+namespace opentrade {
+
+TEST_CASE("FixedPoint", "[FixedPoint]") {
+  SECTION("Of") {
+    REQUIRE(FixedScale::Of(0.01).decimals() == 2);
+    REQUIRE(FixedScale::Of(0.05).decimals() == 2);
+    REQUIRE(FixedScale::Of(0.0025).decimals() == 4);
+    REQUIRE(FixedScale::Of(1).decimals() == 0);
+    REQUIRE(FixedScale::Of(0).decimals() == FixedScale::kPriceDecimals);
+    REQUIRE(FixedScale::Of(-1, 6).decimals() == 6);
+  }
+
+  SECTION("Exact") {
+    FixedScale s(2);
+    REQUIRE(0.1 + 0.2 != 0.3);
+    REQUIRE(s.From(0.1) + s.From(0.2) == s.From(0.3));
+    REQUIRE(s.From(10.1) == s.From(1010 * 0.01));
+    REQUIRE(s.From(10.1).units() == 1010);
+    REQUIRE(s.To(Fixed(1010)) == 10.1);
+    REQUIRE(s.Round(10.100000000000001) == 10.1);
+    REQUIRE(s.From(-0.05) == -s.From(0.05));
+    REQUIRE(s.From(10.11) > s.From(10.1));
+    REQUIRE(!Fixed());
+  }
+}
+
+}  // namespace opentrade
@@ -0,0 +1,45 @@
+#include "3rd/catch.hpp"
+
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include "opentrade/journal.h"
+
+namespace fs = boost::filesystem;
+
+namespace opentrade {
+
+TEST_CASE("Journal", "[Journal]") {
+  static const fs::path kDir = "test_journal";
+  fs::remove_all(kDir);
+  fs::create_directory(kDir);
+
+  SECTION("Roll") {
+    {
+      Journal j(kDir, "confirmations");
+      j.Open();
+      j.Append({"a", "b"});
+      auto day = j.segment();
+      auto old = j.Roll();
+      REQUIRE(old.size() == 1);
+      REQUIRE(old[0].filename().string() == day);
+      // sorted after the segment of the day
+      REQUIRE(j.segment().size() == day.size() + 7);
+      REQUIRE(j.segment() > day);
+      j.Append({"c"});
+      REQUIRE(j.Segments().size() == 2);
+      fs::remove(old[0]);
+    }
+    auto segments = Journal(kDir, "confirmations").Segments();
+    REQUIRE(segments.size() == 1);
+    boost::iostreams::mapped_file_source f(segments[0].string());
+    std::vector<Journal::Record> records;
+    REQUIRE(Journal::Scan(f.data(), f.size(), &records) == f.size());
+    REQUIRE(records.size() == 1);
+    REQUIRE(records[0] == "c");
+  }
+
+  fs::remove_all(kDir);
+}
+
+}  // namespace opentrade
@@ -0,0 +1,40 @@
+#include "3rd/catch.hpp"
+
+#include "opentrade/latency.h"
+
+namespace opentrade {
+
+TEST_CASE("LatencyHistogram", "[LatencyHistogram]") {
+  LatencyHistogram h;
+
+  SECTION("Buckets") {
+    for (uint64_t v : {0lu, 1lu, 31lu, 32lu, 33lu, 63lu, 64lu, 65lu, 1000lu,
+                       123456789lu, 1lu << 40, ~0lu}) {
+      auto i = LatencyHistogram::Index(v);
+      REQUIRE(i < LatencyHistogram::kBuckets);
+      REQUIRE(LatencyHistogram::Highest(i) >= v);
+      REQUIRE(LatencyHistogram::Highest(i) - v <= v / 16);
+      if (i) REQUIRE(LatencyHistogram::Highest(i - 1) < v);
+    }
+  }
+
+  SECTION("Percentile") {
+    REQUIRE(h.Percentile(0.5) == 0);
+    REQUIRE(h.max() == 0);
+    for (auto i = 1; i <= 1000; ++i) h.Record(i * 1000);
+    REQUIRE(h.count() == 1000);
+    REQUIRE(h.sum() == 500500000);
+    auto p50 = h.Percentile(0.5);
+    REQUIRE(p50 >= 500000);
+    REQUIRE(p50 <= 500000 * 1.04);
+    auto p99 = h.Percentile(0.99);
+    REQUIRE(p99 >= 990000);
+    REQUIRE(p99 <= 990000 * 1.04);
+    REQUIRE(h.max() >= 1000000);
+    REQUIRE(h.Percentile(1) == h.max());
+    h.Reset();
+    REQUIRE(h.count() == 0);
+  }
+}
+
+}  // namespace opentrade
@@ -0,0 +1,26 @@
+#include "3rd/catch.hpp"
+
+#include "opentrade/market_data.h"
+
+namespace opentrade {
+
+TEST_CASE("MarketDataArray", "[MarketDataArray]") {
+  MarketDataArray a;
+  REQUIRE(!a.Find(1));
+  auto& md = a[1];
+  md.trade.close = 10;
+  REQUIRE(a.Find(1) == &md);
+  REQUIRE(!a.Find(2));
+  REQUIRE(!a.Find(5000));
+
+  a[5000].trade.close = 20;
+  REQUIRE(&a[1] == &md);
+  std::vector<Security::IdType> ids;
+  a.ForEach([&](Security::IdType id, MarketData& x) {
+    ids.push_back(id);
+    REQUIRE(x.trade.close == (id == 1 ? 10 : 20));
+  });
+  REQUIRE(ids == std::vector<Security::IdType>{1, 5000});
+}
+
+}  // namespace opentrade
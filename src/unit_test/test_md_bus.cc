@@ -0,0 +1,40 @@
+#include "3rd/catch.hpp"
+
+#include <memory>
+
+#include "opentrade/market_data.h"
+#include "opentrade/md_bus.h"
+
+namespace opentrade {
+
+TEST_CASE("MarketDataBus", "[MarketDataBus]") {
+  std::unique_ptr<MarketDataBus> bus(
+      MarketDataBus::Create("/opentrade_md_test_", DataSrc::GetId("T"), 16, 4));
+  REQUIRE(bus);
+  md_bus::Reader reader;
+  REQUIRE(reader.Open(bus->name()));
+  md_bus::Record r;
+  REQUIRE(!reader.Read(1, &r));
+
+  MarketData md;
+  md.trade.close = 10;
+  md.depth[1].bid_size = 300;
+  bus->Write(1, md);
+  bus->Write(16, md);  // beyond capacity
+  REQUIRE(reader.Read(1, &r));
+  REQUIRE(r.trade.close == 10);
+  REQUIRE(r.depth[1].bid_size == 300);
+
+  std::vector<uint32_t> ids;
+  REQUIRE(reader.Poll([&](uint32_t id) { ids.push_back(id); }) == 1);
+  REQUIRE(ids == std::vector<uint32_t>{1});
+
+  for (auto i = 0u; i < 6; ++i) bus->Write(i % 3, md);
+  uint64_t lost = 0;
+  ids.clear();
+  reader.Poll([&](uint32_t id) { ids.push_back(id); }, &lost);
+  REQUIRE(lost == 2);
+  REQUIRE(ids == std::vector<uint32_t>{2, 0, 1, 2});
+}
+
+}  // namespace opentrade
@@ -0,0 +1,47 @@
+#include "3rd/catch.hpp"
+
+#include <map>
+#include <vector>
+
+#include "opentrade/memory.h"
+
+namespace opentrade {
+
+TEST_CASE("MemoryAccounting", "[MemoryAccounting]") {
+  auto& tag = MemoryTag::Get("test_memory");
+  REQUIRE(&tag == &MemoryTag::Get("test_memory"));
+
+  SECTION("CountingAllocator") {
+    {
+      std::vector<int, CountingAllocator<int>> v(
+          CountingAllocator<int>("test_memory"));
+      v.reserve(100);
+      REQUIRE(tag.bytes() == 100 * sizeof(int));
+      REQUIRE(tag.objects() == 100);
+      typedef CountingAllocator<std::pair<const int, double>> Allocator;
+      std::map<int, double, std::less<int>, Allocator> m(
+          Allocator("test_memory"));
+      m[1] = 1;
+      REQUIRE(tag.objects() == 101);
+    }
+    REQUIRE(tag.bytes() == 0);
+    REQUIRE(tag.objects() == 0);
+  }
+
+  SECTION("Report") {
+    MemoryAccounting::Instance().AddReporter("test_reporter", []() {
+      return MemoryAccounting::Usage{{}, 10, 2};
+    });
+    auto report = MemoryAccounting::Instance().Report();
+    REQUIRE(report.front().name == "rss");
+    auto found = false;
+    for (auto& u : report) {
+      if (u.name != "test_reporter") continue;
+      found = true;
+      REQUIRE((u.bytes == 10 && u.objects == 2));
+    }
+    REQUIRE(found);
+  }
+}
+
+}  // namespace opentrade
@@ -0,0 +1,37 @@
+#include "3rd/catch.hpp"
+
+#include "opentrade/order_book.h"
+
+namespace opentrade {
+
+TEST_CASE("OrderBook", "[OrderBook]") {
+  OrderBook book;
+
+  SECTION("Levels") {
+    REQUIRE(book.Update(10, 1, false) == 0);
+    REQUIRE(book.Update(9, 1, false) == 0);
+    REQUIRE(book.Update(11, 1, false) == 2);
+    REQUIRE(book.Update(8.5, 2, true) == 0);
+    REQUIRE(book.Update(9.5, 3, true) == 0);
+    REQUIRE(book.Update(9.5, 4, true) == 0);
+    REQUIRE(book.Update(10, 0, false) == 1);
+    auto asks = book.asks();
+    REQUIRE((asks.size() == 2 && asks[0].price == 9 && asks[1].price == 11));
+    auto bids = book.bids(1);
+    REQUIRE((bids.size() == 1 && bids[0].price == 9.5 && bids[0].size == 4));
+    REQUIRE(book.bids().size() == 2);
+  }
+
+  SECTION("Deep") {
+    for (auto i = 1; i <= 30; ++i) book.Update(100 + i, i, false);
+    REQUIRE(book.asks().size() == 30);
+    MarketData::Depth depth;
+    book.CopyTop(&depth);
+    REQUIRE((depth[0].ask_price == 101 && depth[4].ask_price == 105));
+    REQUIRE((depth[0].bid_price == 0 && depth[0].bid_size == 0));
+    book.Clear();
+    REQUIRE(book.asks().empty());
+  }
+}
+
+}  // namespace opentrade
@@ -0,0 +1,81 @@
+#include "3rd/catch.hpp"
+
+#include "opentrade/param_schema.h"
+
+namespace opentrade {
+
+struct TestParams : public ParamStruct {
+  double price = 0;
+  int valid_seconds = 0;
+  int aggression = -1;
+  std::string internal_cross;
+  bool flag = false;
+};
+
+static const ParamSchemaT<TestParams>& TestSchema() {
+  static ParamSchemaT<TestParams> schema(CombineParamDefs(
+      kCommonParamDefs, ParamDefs{{"Flag", false, false}}));
+  static auto init = (schema.Bind("Price", &TestParams::price)
+                          .Bind("ValidSeconds", &TestParams::valid_seconds)
+                          .Bind("Aggression", &TestParams::aggression)
+                          .Bind("InternalCross", &TestParams::internal_cross)
+                          .Bind("Flag", &TestParams::flag),
+                      true);
+  (void)init;
+  return schema;
+}
+
+TEST_CASE("ParamSchema", "[ParamSchema]") {
+  auto& schema = TestSchema();
+  auto p = schema.New();
+  auto& t = static_cast<const TestParams&>(*p);
+  auto set = [&](const char* name, auto v) {
+    return schema.Set(p.get(), *schema.Find(name), v);
+  };
+
+  SECTION("Find") {
+    REQUIRE(schema.fields().size() == 5);
+    REQUIRE(schema.Find("Flag")->index == 4);
+    REQUIRE(schema.Find("Price")->kind == ParamSchema::kDouble);
+    REQUIRE(schema.Find("Aggression")->kind == ParamSchema::kChoice);
+    REQUIRE(!schema.Find("MaxPov"));
+    REQUIRE(!schema.Find("Unknown"));
+  }
+
+  SECTION("Set") {
+    REQUIRE(set("Price", 1.5).empty());
+    REQUIRE(set("ValidSeconds", 60.6).empty());
+    REQUIRE(set("Aggression", std::string("High")).empty());
+    REQUIRE(set("InternalCross", std::string("No")).empty());
+    REQUIRE(t.price == 1.5);
+    REQUIRE(t.valid_seconds == 61);
+    REQUIRE(t.aggression == 2);
+    REQUIRE(t.internal_cross == "No");
+    REQUIRE(t.given == 0b1111);
+    REQUIRE(!set("Aggression", std::string("Max")).empty());
+    REQUIRE(!set("Price", std::string("1")).empty());
+    REQUIRE(t.aggression == 2);
+  }
+
+  SECTION("FromMap and Merge") {
+    Algo::ParamMap m{{"Flag", true}, {"Price", int64_t(2)}, {"MaxPov", 0.1}};
+    std::string err;
+    auto q = schema.FromMap(m, &err);
+    REQUIRE(q);
+    auto& u = static_cast<const TestParams&>(*q);
+    REQUIRE(u.flag);
+    REQUIRE(u.price == 2);
+    REQUIRE(u.given == 0b10001);
+    set("ValidSeconds", int64_t(300));
+    schema.Merge(*q, p.get());
+    REQUIRE(t.flag);
+    REQUIRE(t.price == 2);
+    REQUIRE(t.valid_seconds == 300);
+    REQUIRE(t.given == 0b10011);
+    m["Aggression"] = "None";
+    REQUIRE(!schema.FromMap(m, &err));
+    REQUIRE(!err.empty());
+  }
+}
+
+}  // namespace opentrade
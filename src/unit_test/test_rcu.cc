@@ -0,0 +1,54 @@
+#include "3rd/catch.hpp"
+
+#include <string>
+
+#include "opentrade/rcu.h"
+
+namespace opentrade {
+
+struct Counted {
+  explicit Counted(int* n) : n(n) {}
+  ~Counted() { ++*n; }
+  int* n;
+};
+
+TEST_CASE("Rcu", "[Rcu]") {
+  auto freed = 0;
+  RcuPtr<Counted> p(boost::shared_ptr<const Counted>(new Counted(&freed)));
+  Rcu::Reclaim();
+
+  SECTION("Replace") {
+    auto v = p.version();
+    p.store(boost::shared_ptr<const Counted>(new Counted(&freed)));
+    REQUIRE(p.version() == v + 1);
+    REQUIRE(freed == 1);
+  }
+
+  SECTION("Deferred") {
+    {
+      auto s = p.load();
+      auto old = s.get();
+      p.store(boost::shared_ptr<const Counted>(new Counted(&freed)));
+      // still readable inside the snapshot
+      REQUIRE(freed == 0);
+      REQUIRE(old->n == &freed);
+      {
+        auto s2 = p.load();
+        REQUIRE(s2.get() != old);
+      }
+      REQUIRE(Rcu::Reclaim() == 1);
+      REQUIRE(freed == 0);
+    }
+    REQUIRE(Rcu::Reclaim() == 0);
+    REQUIRE(freed == 1);
+  }
+
+  SECTION("Null") {
+    RcuPtr<std::string> s;
+    REQUIRE(!s.load());
+    s.store(boost::shared_ptr<const std::string>(new std::string("x")));
+    REQUIRE(*s.load() == "x");
+  }
+}
+
+}  // namespace opentrade
@@ -0,0 +1,38 @@
+#include "3rd/catch.hpp"
+
+#include "opentrade/risk.h"
+
+namespace opentrade {
+
+TEST_CASE("SecurityCounters", "[SecurityCounters]") {
+  SECTION("Insert") {
+    SecurityCounters c;
+    REQUIRE(!c.Find(1));
+    std::vector<SecurityCounters::Entry*> entries;
+    for (auto i = 0u; i < 1000; ++i) entries.push_back(c.Get(i * 7));
+    REQUIRE(c.size() == 1000);
+    // the entries stay where they were as the index grows
+    for (auto i = 0u; i < 1000; ++i) {
+      REQUIRE(c.Find(i * 7) == entries[i]);
+      REQUIRE(c.Get(i * 7) == entries[i]);
+    }
+    REQUIRE(!c.Find(1));
+    REQUIRE(c.size() == 1000);
+  }
+
+  SECTION("Cancels") {
+    SecurityCounters c;
+    auto e = c.Get(1);
+    const int64_t kDay = 86400 * kMicroInSec;
+    auto now = 100 * kDay + 1;
+    REQUIRE(e->Cancels(now) == 0);
+    e->AddCancel(now);
+    e->AddCancel(now + 1);
+    REQUIRE(e->Cancels(now) == 2);
+    REQUIRE(e->Cancels(now + kDay) == 0);
+    e->AddCancel(now + kDay);
+    REQUIRE(e->Cancels(now + kDay) == 1);
+  }
+}
+
+}  // namespace opentrade
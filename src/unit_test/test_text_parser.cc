@@ -0,0 +1,75 @@
+#include "3rd/catch.hpp"
+
+#include <sstream>
+
+#include "opentrade/text_parser.h"
+
+namespace opentrade {
+
+TEST_CASE("TextParser", "[TextParser]") {
+  SECTION("TextCursor") {
+    std::string line = "93000123 12 T 10.25 300";
+    TextCursor c(line);
+    uint32_t hmsm, i;
+    char type;
+    double px, qty;
+    REQUIRE(c.Uint(&hmsm));
+    REQUIRE(c.Uint(&i));
+    REQUIRE(c.Char(&type));
+    REQUIRE(c.Double(&px));
+    REQUIRE(c.Double(&qty));
+    REQUIRE(c.empty());
+    REQUIRE(hmsm == 93000123);
+    REQUIRE(i == 12);
+    REQUIRE(type == 'T');
+    REQUIRE(px == 10.25);
+    REQUIRE(qty == 300);
+    REQUIRE(!c.Double(&px));
+
+    for (auto s : {"0.1", "-3.14159", "123456.789012", ".5", "7.", "1e-3",
+                   "1.5E+10", "12345678901234567890.5", "0.000000000000001"}) {
+      double v;
+      REQUIRE(TextCursor(std::string_view(s)).Double(&v));
+      REQUIRE(v == strtod(s, nullptr));
+    }
+
+    std::string s2 = "601318 09:31 2500.5";
+    TextCursor c2(s2);
+    int hour, minute;
+    REQUIRE(c2.Uint(&i));
+    REQUIRE(c2.Int(&hour));
+    REQUIRE(c2.Expect(':'));
+    REQUIRE(c2.Int(&minute));
+    REQUIRE(c2.Double(&px));
+    REQUIRE(hour == 9);
+    REQUIRE(minute == 31);
+    REQUIRE(px == 2500.5);
+
+    TextCursor c3(std::string_view("x 1"));
+    REQUIRE(!c3.Uint(&i));
+    REQUIRE(c3.Word() == "x");
+    REQUIRE(c3.Uint(&i));
+  }
+
+  SECTION("LineReader") {
+    std::string text;
+    for (auto i = 0; i < 1000; ++i) text += std::to_string(i) + " line\n";
+    text += std::string(100, 'x');
+    std::istringstream is(text);
+    LineReader lines(&is, 64);
+    const char* line;
+    const char* end;
+    auto n = 0;
+    while (lines.Next(&line, &end)) {
+      if (n < 1000) {
+        REQUIRE(std::string(line, end) == std::to_string(n) + " line");
+      } else {
+        REQUIRE(std::string(line, end) == std::string(100, 'x'));
+      }
+      n++;
+    }
+    REQUIRE(n == 1001);
+  }
+}
+
+}  // namespace opentrade
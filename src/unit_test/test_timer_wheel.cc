@@ -0,0 +1,83 @@
+#include "3rd/catch.hpp"
+
+#include <thread>
+
+#include "opentrade/task_pool.h"
+#include "opentrade/timer_wheel.h"
+
+namespace opentrade {
+
+TEST_CASE("TimerWheel", "[TimerWheel]") {
+  TimerWheel w(1000, 0);
+  std::vector<TimerWheel::Func> out;
+  std::vector<int> fired;
+  auto advance = [&](int64_t now) {
+    out.clear();
+    w.Advance(now, &out);
+    for (auto& f : out) f();
+  };
+
+  SECTION("Order") {
+    w.Add([&]() { fired.push_back(2); }, 300000);
+    w.Add([&]() { fired.push_back(1); }, 2000);
+    w.Add([&]() { fired.push_back(3); }, 100000000);
+    REQUIRE(w.size() == 3);
+    advance(1999);
+    REQUIRE(fired.empty());
+    advance(2000);
+    REQUIRE(fired == std::vector<int>{1});
+    advance(299000);
+    REQUIRE(fired.size() == 1);
+    advance(300000);
+    REQUIRE(fired == (std::vector<int>{1, 2}));
+    advance(100000000);
+    REQUIRE(fired == (std::vector<int>{1, 2, 3}));
+    REQUIRE(w.size() == 0);
+    REQUIRE(w.NextWakeup() == -1);
+  }
+
+  SECTION("Cancel") {
+    auto id = w.Add([&]() { fired.push_back(1); }, 5000);
+    auto id2 = w.Add([&]() { fired.push_back(2); }, 70000000);
+    REQUIRE(w.Cancel(id));
+    REQUIRE(!w.Cancel(id));
+    REQUIRE(w.Cancel(id2));
+    advance(100000000);
+    REQUIRE(fired.empty());
+    // recycled node does not accept stale id
+    auto id3 = w.Add([&]() { fired.push_back(3); }, 100001000);
+    REQUIRE(id3 != id);
+    REQUIRE(!w.Cancel(id));
+    advance(100001000);
+    REQUIRE(fired == std::vector<int>{3});
+  }
+
+  SECTION("NextWakeup") {
+    w.Add([]() {}, 10500);
+    REQUIRE(w.NextWakeup() == 11000);
+    w.Add([]() {}, 0);
+    REQUIRE(w.NextWakeup() == 1000);
+  }
+}
+
+TEST_CASE("TimerService", "[TimerWheel]") {
+  boost::asio::io_service io;
+  TimerService ts(io);
+  auto fired = 0;
+
+  SECTION("Poll") {
+    REQUIRE(!ts.Poll());
+    ts.Add([&]() { fired++; }, 0);
+    ts.Add([&]() { fired += 10; }, 60000000);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    REQUIRE(ts.Poll());
+    REQUIRE(fired == 1);
+    REQUIRE(!ts.Poll());
+    REQUIRE(ts.size() == 1);
+    // nothing left for the io_service to run
+    io.poll();
+    REQUIRE(fired == 1);
+  }
+}
+
+}  // namespace opentrade
@@ -0,0 +1,39 @@
+#include "3rd/catch.hpp"
+
+#include "opentrade/trade_file.h"
+
+namespace opentrade {
+
+TEST_CASE("TradeFile", "[TradeFile]") {
+  static const char* kFile = "test_trades.bin";
+  for (auto binary : {false, true}) {
+    TradeWriter w(binary);
+    w.open(kFile);
+    auto n = TradeWriter::kBlockSize + 10;
+    for (auto i = 0u; i < n; ++i) {
+      w.Add(1000000 + i, i % 3 + 1, i % 3 ? "ABC" : "X", i % 2, i + 1,
+            10.25 + i, 7);
+    }
+    w.close();
+    REQUIRE(w.good());
+
+    TradeReader r(kFile);
+    TradeRecord t;
+    auto i = 0u;
+    for (; r.Next(&t); ++i) {
+      if (binary) {
+        REQUIRE(t.tm == 1000000 + i);
+        REQUIRE(t.sec_id == i % 3 + 1);
+      }
+      REQUIRE(t.symbol == (i % 3 ? "ABC" : "X"));
+      REQUIRE(t.side == (i % 2 ? 'B' : 'S'));
+      REQUIRE(t.qty == i + 1);
+      REQUIRE(t.px == 10.25 + i);
+      REQUIRE(t.algo_id == 7);
+    }
+    REQUIRE(i == n);
+  }
+  std::remove(kFile);
+}
+
+}  // namespace opentrade
@@ -40,6 +40,39 @@ TEST_CASE("VolumeProfile", "[VolumeProfile]") {
   REQUIRE(p.size() == 7);
   REQUIRE(p[0] == 0);
   REQUIRE(p[6] == 1);
+
+  SECTION("binary") {
+    static const char* kVpBinFile = "test_vp.bin";
+    REQUIRE(vp.Save(kVpBinFile));
+    VolumeProfile vp2(kVpBinFile);
+    REQUIRE(vp2.size() == 1);
+    for (auto [start, end] : {std::make_pair(11 * 60, 12 * 60 + 5),
+                              std::make_pair(12 * 60, 12 * 60 + 6),
+                              std::make_pair(12 * 60 + 4, 12 * 60 + 12)}) {
+      auto a = vp.Get(1, start, end);
+      auto b = vp2.Get(1, start, end);
+      REQUIRE(a.size() == b.size());
+      for (auto i = 0u; i < a.size(); ++i) REQUIRE(a[i] == b[i]);
+    }
+    REQUIRE(vp2.Get(2, 12 * 60, 12 * 60 + 6).empty());
+  }
+
+  SECTION("volumes") {
+    VolumeProfile::Volumes volumes;
+    auto& v = volumes[1];
+    v.resize(VolumeProfile::kMinutes);
+    v[12 * 60] = v[12 * 60 + 2] = 100;
+    v[12 * 60 + 1] = v[12 * 60 + 3] = 200;
+    v[12 * 60 + 6] = v[12 * 60 + 10] = 100;
+    volumes[2].resize(VolumeProfile::kMinutes);
+    volumes[3].resize(10, 1);
+    VolumeProfile vp2(volumes);
+    REQUIRE(vp2.size() == 1);
+    auto a = vp.Get(1, 12 * 60 + 4, 12 * 60 + 12);
+    auto b = vp2.Get(1, 12 * 60 + 4, 12 * 60 + 12);
+    REQUIRE(a.size() == b.size());
+    for (auto i = 0u; i < a.size(); ++i) REQUIRE(a[i] == b[i]);
+  }
 }
 
 }  // namespace opentrade